@@ -77,6 +77,9 @@ struct _MyQttConnOpts {
 	axlPointer                    init_user_data;
 	axlPointer                    init_user_data2;
 	axlPointer                    init_user_data3;
+
+	/** listener socket options (indexed from MYQTT_LISTENER_SNDBUF, 0 = use context value) **/
+	int                           sock_opts[MYQTT_LISTENER_SOCK_OPTS];
 };
 
 
@@ -124,11 +127,15 @@ struct _MyQttConn {
 	char       * port;
 
 	/** 
-	 * @brief Contains the local address that is used by this connection.
+	 * @brief Contains the local address that is used by this
+	 * connection. For accepted connections it is only resolved
+	 * when requested (see myqtt_conn_get_local_addr) because it is
+	 * the same for all connections of a listener.
 	 */
 	char       * local_addr;
 	/** 
-	 * @brief Contains the local port that is used by this connection.
+	 * @brief Contains the local port that is used by this
+	 * connection (resolved on demand like local_addr).
 	 */
 	char       * local_port;
 
@@ -182,6 +189,9 @@ struct _MyQttConn {
 	 * MyQtt Library programmers through the functions:
 	 *   - \ref myqtt_connection_get_data 
 	 *   - \ref myqtt_connection_set_data
+	 *
+	 * Created on first use (under ref_mutex): most connections
+	 * never store anything.
 	 */
 	MyQttHash * data;
 
@@ -191,18 +201,18 @@ struct _MyQttConn {
 	 * This enable a myqtt connection to keep track of the
 	 * reference counting.  The reference counting is controlled
 	 * thought the myqtt_connection_ref and
-	 * myqtt_connection_unref.
+	 * myqtt_connection_unref, using atomic operations
+	 * (myqtt_atomic_add) so only the thread dropping the last
+	 * reference executes myqtt_connection_free.
 	 * 
 	 */
 	int  ref_count;
 	
 	/** 
 	 * @brief The ref_mutex
-	 * This mutex is used at myqtt_connection_ref and
-	 * myqtt_connection_unref to avoid race conditions especially
-	 * at myqtt_connection_unref. Because several threads can
-	 * execute at the same time this unref function this mutex
-	 * ensure only one thread will execute the myqtt_connection_free.
+	 * This mutex protects connection state updated by several
+	 * threads (is_connected, session, receive stamps). It is not
+	 * used for reference counting.
 	 * 
 	 */
 	MyQttMutex  ref_mutex;
@@ -214,14 +224,6 @@ struct _MyQttConn {
 	 */
 	MyQttMutex op_mutex;
 	
-	/** 
-	 * @brief The handlers mutex
-	 *
-	 * This mutex is used to secure code sections destined to
-	 * handle handlers stored associated to the connection.
-	 */
-	MyQttMutex handlers_mutex;
-
 	/** 
 	 * @brief The peer role
 	 * 
@@ -240,15 +242,11 @@ struct _MyQttConn {
 	MyQttReceive receive;
 
 	/** 
-	 * @brief On close handler, extended version.
+	 * @brief On close handler, extended version (protected by
+	 * __myqtt_conn_handlers_mutex).
 	 */
 	axlList * on_close_full;
 
-	/** 
-	 * @brief Mutex used to open the pending errors list.
-	 */
-	MyQttMutex pending_errors_mutex;
-
 	/** 
 	 * @internal Reference to implement connection I/O block.
 	 */
@@ -281,6 +279,12 @@ struct _MyQttConn {
 	axl_bool                transport_detected;
 	axl_bool                connect_received;
 
+	/** 
+	 * @internal CONNACK accepted was sent on this connection (used
+	 * to account connections closed, see myqtt_metrics_get).
+	 */
+	axl_bool                connect_accepted;
+
 	/** 
 	 * @internal Reference to a line that wasn't totally read when
 	 * call myqtt_msg_readline.
@@ -333,13 +337,16 @@ struct _MyQttConn {
 	/** 
 	 * @internal Reference to keep track about wait replies ( pkg
 	 * id => async queues) where the async queue are used to push
-	 * replies received for a certain pkd id.
+	 * replies received for a certain pkd id. Created by
+	 * __myqtt_reader_prepare_wait_reply when first needed, so it
+	 * may be NULL.
 	 */
 	axlHash                   * wait_replies;
 	/** 
 	 * @internal See relevant notes about this attribute at
 	 * myqtt-reader.c:1755 inside
-	 * __myqtt_reader_prepare_wait_reply's documentation.
+	 * __myqtt_reader_prepare_wait_reply's documentation. Created
+	 * on demand like wait_replies.
 	 */
 	axlHash                   * peer_wait_replies;
 
@@ -349,7 +356,16 @@ struct _MyQttConn {
 	 */
 	int                         sequencer_messages;
 
-	/*** subscriptions ***/
+	/** 
+	 * @internal Bytes pending on the sequencer, whether they are
+	 * over the connection high watermark and whether reads on
+	 * this connection were paused by backpressure.
+	 */
+	int                         sequencer_bytes;
+	axl_bool                    sequencer_over_watermark;
+	axl_bool                    backpressure_paused;
+
+	/*** subscriptions (created on first subscription, may be NULL) ***/
 	axlHash                   * subs;
 	axlHash                   * wild_subs;
 
@@ -382,6 +398,18 @@ struct _MyQttConn {
 	char          * chain_certificate;
 };
 
+/** 
+ * @internal Number of items in a connection hash that is created on
+ * demand (wait_replies, peer_wait_replies, subs, wild_subs).
+ */
+#define __myqtt_conn_hash_items(hash) ((hash) ? axl_hash_items (hash) : 0)
+
+/** 
+ * @internal Returns the mutex protecting the on close handlers of
+ * the provided connection (shared with other connections).
+ */
+#define __myqtt_conn_handlers_mutex(conn) (&((conn)->ctx->connection_handlers_m[((unsigned int) (conn)->id) % MYQTT_CONN_HANDLERS_LOCKS]))
+
 axl_bool               myqtt_conn_ref_internal           (MyQttConn   * conn, 
 							  const char  * who,
 							  axl_bool      check_ref);
@@ -415,5 +443,7 @@ MyQttNetTransport      __myqtt_conn_detect_transport (MyQttCtx * ctx, const char
 
 int  __myqtt_conn_get_next_id (MyQttCtx * ctx);
 void __myqtt_conn_init_mutex (MyQttConn * connection);
+void __myqtt_conn_create_data (MyQttConn * connection);
+axl_bool __myqtt_conn_resolve_local_addr (MyQttConn * conn);
 
 #endif /* __MYQTT_CONNECTION_PRIVATE_H__ */
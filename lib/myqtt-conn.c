@@ -82,8 +82,9 @@ void __myqtt_conn_init_mutex (MyQttConn * connection)
 	/* inits all mutex associated to the connection provided. */
 	myqtt_mutex_create (&connection->ref_mutex);
 	myqtt_mutex_create (&connection->op_mutex);
-	myqtt_mutex_create (&connection->handlers_mutex);
-	myqtt_mutex_create (&connection->pending_errors_mutex);
+
+	/* on close handlers use a mutex shared through the context
+	 * (see __myqtt_conn_handlers_mutex) */
 	return;
 }
 
@@ -288,13 +289,8 @@ MyQttConn * myqtt_conn_new_empty_from_conn (MyQttCtx        * ctx,
 	connection->is_connected       = axl_true;
 	connection->ref_count          = 1;
 
-	/* wait reply hash */
-	connection->wait_replies       = axl_hash_new (axl_hash_int, axl_hash_equal_int);
-	connection->peer_wait_replies  = axl_hash_new (axl_hash_int, axl_hash_equal_int);
-
-	/* subscriptions **/
-	connection->subs               = axl_hash_new (axl_hash_string, axl_hash_equal_string);
-	connection->wild_subs          = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+	/* wait reply hashes, subscriptions and data hash are created
+	 * on demand: an idle connection does not need them */
 
 	/* call to init all mutex associated to this particular connection */
 	__myqtt_conn_init_mutex (connection);
@@ -304,30 +300,20 @@ MyQttConn * myqtt_conn_new_empty_from_conn (MyQttCtx        * ctx,
 
 		/* creates the user space data */
 		if (__connection != NULL) {
-			/* transfer hash used by previous connection into the new one */
+			/* transfer hash used by previous connection into
+			 * the new one (the previous connection will
+			 * create a new one if needed) */
 			connection->data       = __connection->data;
-			/* creates a new hash to keep the connection internal state consistent */
-			__connection->data     = myqtt_hash_new_full (axl_hash_string, axl_hash_equal_string,
-								       NULL,
-								       NULL);
+			__connection->data     = NULL;
 
 			/* remove being closed flag if found */
 			myqtt_conn_set_data (connection, "being_closed", NULL);
-		} else 
-			connection->data       = myqtt_hash_new_full (axl_hash_string, axl_hash_equal_string,
-								       NULL, 
-								       NULL);
+		} /* end if */
 		
 		/* set default send and receive handlers */
 		connection->send               = myqtt_conn_default_send;
 		connection->receive            = myqtt_conn_default_receive;
 
-	} else {
-		/* create the hash data table for master listener connections */
-		connection->data       = myqtt_hash_new_full (axl_hash_string, axl_hash_equal_string,
-							       NULL, 
-							       NULL);
-		
 	} /* end if */
 	
 	/* set by default to close the underlying connection when the
@@ -452,9 +438,42 @@ axl_bool            myqtt_conn_set_socket                (MyQttConn * conn,
 		conn->port = axl_strdup (srv_name);
 	} /* end if */
 
+	/* accepted connections share the local address of their
+	 * listener: resolve it only when requested (see
+	 * myqtt_conn_get_local_addr) */
+	if (conn->role != MyQttRoleMasterListener)
+		return axl_true;
+
 	/* now set local address */
-	if (getsockname (_socket, (struct sockaddr *) &sin, &sin_size) < 0) {
-		myqtt_log (MYQTT_LEVEL_CRITICAL, "unable to get local hostname and port to resolve local address from socket=%d", _socket);
+	return __myqtt_conn_resolve_local_addr (conn);
+}
+
+/** 
+ * @internal Resolves and sets local address and port
+ * (conn->local_addr and conn->local_port) from the connection
+ * socket.
+ *
+ * @return axl_true if both values were configured, otherwise
+ * axl_false is returned.
+ */
+axl_bool            __myqtt_conn_resolve_local_addr     (MyQttConn * conn)
+{
+	struct sockaddr_storage   sin;
+#if defined(AXL_OS_WIN32)
+	/* windows flavors */
+	int                  sin_size = sizeof (sin);
+#else
+	/* unix flavors */
+	socklen_t            sin_size = sizeof (sin);
+#endif
+#if defined(ENABLE_MYQTT_LOG)
+	MyQttCtx          * ctx       = CONN_CTX(conn);
+#endif
+	char                 host_name[NI_MAXHOST];
+	char                 srv_name[NI_MAXSERV]; 
+
+	if (getsockname (conn->session, (struct sockaddr *) &sin, &sin_size) < 0) {
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "unable to get local hostname and port to resolve local address from socket=%d", conn->session);
 		return axl_false;
 	} /* end if */
 
@@ -465,6 +484,8 @@ axl_bool            myqtt_conn_set_socket                (MyQttConn * conn,
 	}
 
 	/* set local addr and local port */
+	axl_free (conn->local_addr);
+	axl_free (conn->local_port);
 	conn->local_addr = axl_strdup (host_name);
 	conn->local_port = axl_strdup (srv_name);
 
@@ -1570,20 +1591,12 @@ MyQttConn  * myqtt_conn_new_full_common        (MyQttCtx             * ctx,
 	data->connection->port                = axl_strdup (port);
 	data->connection->ref_count           = 1;
 
-	/* wait reply hash */
-	data->connection->wait_replies        = axl_hash_new (axl_hash_int, axl_hash_equal_int);
-	data->connection->peer_wait_replies   = axl_hash_new (axl_hash_int, axl_hash_equal_int);
-
-	/* subscriptions **/
-	data->connection->subs                = axl_hash_new (axl_hash_string, axl_hash_equal_string);
-	data->connection->wild_subs           = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+	/* wait reply hashes, subscriptions and data hash are created
+	 * on demand */
 
 	/* call to init all mutex associated to this particular connection */
 	__myqtt_conn_init_mutex (data->connection);
 
-	data->connection->data                = myqtt_hash_new_full (axl_hash_string, axl_hash_equal_string,
-								     NULL,
-								     NULL);
 	/* establish the connection role */
 	data->connection->role                = MyQttRoleInitiator;
 
@@ -1848,7 +1861,7 @@ void            myqtt_conn_send_connect_reply (MyQttConn * conn, MyQttConnAckTyp
 {
 	MyQttCtx          * ctx;
 	int                 size = 0;
-	unsigned char     * reply;
+	unsigned char       reply[MYQTT_MSG_ACK_SIZE];
 
 	if (conn == NULL)
 		return;
@@ -1892,19 +1905,19 @@ void            myqtt_conn_send_connect_reply (MyQttConn * conn, MyQttConnAckTyp
 	} /* end if */
 
 	/* rest of cases, reply with the response */
-	reply = myqtt_msg_build (ctx, MYQTT_CONNACK, axl_false, 0, axl_false, &size, 
-				 /* variable header and payload */
-				 MYQTT_PARAM_16BIT_INT, response, 
-				 MYQTT_PARAM_END);
+	size = myqtt_msg_encode_connack (ctx, reply, MYQTT_MSG_ACK_SIZE, axl_false, response);
+
+	/* account accepted connections (before the peer can close it) */
+	if (response == MYQTT_CONNACK_ACCEPTED) {
+		conn->connect_accepted = axl_true;
+		__myqtt_metrics_add (ctx, MYQTT_METRIC_CONNS_ACCEPTED, 1);
+	} /* end if */
 
 	/* send message */
 	if (! myqtt_msg_send_raw (conn, reply, size)) {
 		myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to send CONNACK message, errno=%d", errno);
 	} /* end if */
 
-	/* free reply */
-	myqtt_msg_free_build (ctx, reply, size);
-
 	/* close connection in the case it is not an accepted */
 	if (response != MYQTT_CONNACK_ACCEPTED) {
 		myqtt_conn_shutdown (conn);
@@ -2004,7 +2017,7 @@ int __myqtt_conn_get_next_pkgid_aux (MyQttCtx * ctx, MyQttConn * conn, MyQttQos
 	if (conn->sent_pkgids == NULL)
 		conn->sent_pkgids = axl_list_new (axl_list_equal_int, NULL);
 
-	if (axl_list_length (conn->sent_pkgids) == 0 && axl_hash_items (conn->wait_replies) == 0) {
+	if (axl_list_length (conn->sent_pkgids) == 0 && __myqtt_conn_hash_items (conn->wait_replies) == 0) {
 
 		while (pkg_id < 65535 && ! myqtt_storage_lock_pkgid (ctx, conn, pkg_id)) {
 			/* id is already in use, go for the next */
@@ -2027,7 +2040,7 @@ int __myqtt_conn_get_next_pkgid_aux (MyQttCtx * ctx, MyQttConn * conn, MyQttQos
 
 				/* check there is no wait reply still looked on the provided hash which represents 
 				   wait replies for packages sent which are still waiting */
-				if (axl_hash_exists (conn->wait_replies, INT_TO_PTR (pkg_id))) {
+				if (conn->wait_replies && axl_hash_exists (conn->wait_replies, INT_TO_PTR (pkg_id))) {
 					pkg_id ++;
 					iterator++;
 					continue;
@@ -2116,6 +2129,7 @@ axl_bool __myqtt_conn_pub_send_and_handle_reply (MyQttCtx      * ctx,
 
 	MyQttMsg   * reply;
 	axl_bool     result = axl_true;
+	unsigned char ack[MYQTT_MSG_ACK_SIZE];
 
 	/* skip storage if requested by the caller. */
 	axl_bool     skip_storage         = (qos & MYQTT_QOS_SKIP_STORAGE) == MYQTT_QOS_SKIP_STORAGE;
@@ -2213,12 +2227,9 @@ axl_bool __myqtt_conn_pub_send_and_handle_reply (MyQttCtx      * ctx,
 		/* ok, so far, so good, now send pubrel, reusing packet id */
 		/* build QOS=1/2 message */
 		/* dup = axl_false, qos = 1, retain = axl_false */
-		msg  = myqtt_msg_build  (ctx, MYQTT_PUBREL, axl_false, MYQTT_QOS_1, axl_false, &size,  /* 2 bytes */
-					 /* packet id */
-					 MYQTT_PARAM_16BIT_INT, packet_id,
-					 MYQTT_PARAM_END);		
-		if (msg == NULL || size == 0) {
-			myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to create PUBREL message, empty/NULL value reported by myqtt_msg_build()");
+		size = myqtt_msg_encode_ack (ctx, ack, MYQTT_MSG_ACK_SIZE, MYQTT_PUBREL, packet_id);
+		if (size <= 0) {
+			myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to create PUBREL message, myqtt_msg_encode_ack() failed");
 
 			/* release packet id */
 			/* do not release package id on failure to avoid overwriting packages ids */
@@ -2232,7 +2243,7 @@ axl_bool __myqtt_conn_pub_send_and_handle_reply (MyQttCtx      * ctx,
 
 		/* configure package to send */
 		myqtt_log (MYQTT_LEVEL_DEBUG, "Sending PUBREL for packet_id=%d conn-id=%d conn=%p", packet_id, conn->id, conn);
-		if (! myqtt_sequencer_send (conn, MYQTT_PUBREL, msg, size)) {
+		if (! myqtt_sequencer_send_inline (conn, MYQTT_PUBREL, ack, size)) {
 			/* release packet id */
 			/* do not release package id on failure to avoid overwriting packages ids */
 			/* __myqtt_conn_release_pkgid (ctx, conn, packet_id); */
@@ -2375,12 +2386,7 @@ axl_bool            myqtt_conn_pub             (MyQttConn           * conn,
 	if (qos == 0) {
 		/* build QOS=0 message */
 		/* dup = axl_false, qos = 0, retain = <as described by parameter> */
-		msg  = myqtt_msg_build  (ctx, MYQTT_PUBLISH, axl_false, 0, retain, &size,  /* 2 bytes */
-					 /* topic name */
-					 MYQTT_PARAM_UTF8_STRING, strlen (topic_name), topic_name,
-					 /* message */
-					 MYQTT_PARAM_BINARY_PAYLOAD, app_message_size, app_message,
-					 MYQTT_PARAM_END);
+		msg  = myqtt_msg_build_publish (ctx, axl_false, MYQTT_QOS_0, retain, 0, topic_name, app_message, app_message_size, &size);
 
 		myqtt_log (MYQTT_LEVEL_DEBUG, "Built PUBLISH qos=0 message size=%d packet-id=%d app-message-size=%d conn-id=%d",
 			   size, packet_id, app_message_size, conn->id);
@@ -2393,14 +2399,7 @@ axl_bool            myqtt_conn_pub             (MyQttConn           * conn,
 
 		/* build QOS=1/2 message */
 		/* dup = axl_false, qos = 0, retain = <as described by parameter> */
-		msg       = myqtt_msg_build  (ctx, MYQTT_PUBLISH, axl_false, (qos & MYQTT_QOS_1) == 1 ? 1 : 2, retain, &size,  /* 2 bytes */
-					      /* topic name */
-					      MYQTT_PARAM_UTF8_STRING, strlen (topic_name), topic_name,
-					      /* packet id */
-					      MYQTT_PARAM_16BIT_INT, packet_id,
-					      /* message */
-					      MYQTT_PARAM_BINARY_PAYLOAD, app_message_size, app_message,
-					      MYQTT_PARAM_END);
+		msg       = myqtt_msg_build_publish (ctx, axl_false, (qos & MYQTT_QOS_1) == 1 ? 1 : 2, retain, packet_id, topic_name, app_message, app_message_size, &size);
 
 		if (msg == NULL || size == 0) {
 			myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to create PUBLISH message, empty/NULL value reported by myqtt_msg_build()");
@@ -2435,7 +2434,12 @@ axl_bool            myqtt_conn_pub             (MyQttConn           * conn,
 	} /* end if */
 
 	/* call to send message and handle reply */
-	return __myqtt_conn_pub_send_and_handle_reply (ctx, conn, packet_id, qos, handle, wait_publish, msg, size);
+	if (! __myqtt_conn_pub_send_and_handle_reply (ctx, conn, packet_id, qos, handle, wait_publish, msg, size))
+		return axl_false;
+
+	/* account message sent */
+	__myqtt_metrics_add (ctx, qos == MYQTT_QOS_0 ? MYQTT_METRIC_MSGS_SENT_QOS0 : ((qos & MYQTT_QOS_1) == 1 ? MYQTT_METRIC_MSGS_SENT_QOS1 : MYQTT_METRIC_MSGS_SENT_QOS2), 1);
+	return axl_true;
 }
 
 /** 
@@ -2543,24 +2547,12 @@ axl_bool            myqtt_conn_offline_pub     (MyQttCtx            * ctx,
 	switch (qos) {
 	case MYQTT_QOS_0:
 		/* build message */
-		msg  = myqtt_msg_build  (ctx, MYQTT_PUBLISH, axl_false, 0, retain, &size,  /* 2 bytes */
-					 /* topic name */
-					 MYQTT_PARAM_UTF8_STRING, strlen (topic_name), topic_name,
-					 /* message */
-					 MYQTT_PARAM_BINARY_PAYLOAD, app_message_size, app_message,
-					 MYQTT_PARAM_END);
+		msg  = myqtt_msg_build_publish (ctx, axl_false, MYQTT_QOS_0, retain, 0, topic_name, app_message, app_message_size, &size);
 		break;
 	case MYQTT_QOS_1:
 	case MYQTT_QOS_2:
 		/* build message */
-		msg       = myqtt_msg_build  (ctx, MYQTT_PUBLISH, axl_false, qos, retain, &size,  /* 2 bytes */
-					      /* topic name */
-					      MYQTT_PARAM_UTF8_STRING, strlen (topic_name), topic_name,
-					      /* packet id */
-					      MYQTT_PARAM_16BIT_INT, pkg_id,
-					      /* message */
-					      MYQTT_PARAM_BINARY_PAYLOAD, app_message_size, app_message,
-					      MYQTT_PARAM_END);
+		msg       = myqtt_msg_build_publish (ctx, axl_false, qos, retain, pkg_id, topic_name, app_message, app_message_size, &size);
 		break;
 	default:
 		myqtt_log (MYQTT_LEVEL_CRITICAL, "Wrong QoS value received=%d, unable to publish message", qos);
@@ -3156,7 +3148,7 @@ axl_bool                    myqtt_conn_close                  (MyQttConn * conne
 
 	/** ensure that all wait and peer replies are satisfied ***/
 	while (timeout > 0 && myqtt_conn_is_ok (connection, axl_false)) {
-		if (axl_hash_items (connection->wait_replies) > 0 || axl_hash_items (connection->peer_wait_replies) > 0) {
+		if (__myqtt_conn_hash_items (connection->wait_replies) > 0 || __myqtt_conn_hash_items (connection->peer_wait_replies) > 0) {
 			/* still pending messages, wait a little bit */
 			timeout = timeout - 10000;
 			myqtt_sleep (10000);
@@ -3214,7 +3206,7 @@ axl_bool                    myqtt_conn_close                  (MyQttConn * conne
 
 		/* update the connection reference to avoid race
 		 * conditions caused by de-allocations */
-		refcount = connection->ref_count;
+		refcount = myqtt_atomic_get (&connection->ref_count);
 		myqtt_conn_unref (connection, "myqtt_conn_close");
 
 		/* check special case where the caller have stopped a
@@ -3336,6 +3328,34 @@ void                myqtt_conn_opts_set_reuse (MyQttConnOpts * opts,
 	return;
 }
 
+/** 
+ * @brief Allows to configure a socket option for the listener
+ * created with these options (\ref myqtt_listener_new), overriding
+ * the context wide value configured with \ref myqtt_conf_set.
+ *
+ * @param opts The connection option where the operation will take place.
+ *
+ * @param item The socket option to configure, from \ref
+ * MYQTT_LISTENER_SNDBUF to \ref MYQTT_LISTENER_NOTSENT_LOWAT.
+ *
+ * @param value The value to configure (see each item
+ * documentation). 0 means using the context value.
+ *
+ * @return axl_true if the option was configured, otherwise
+ * axl_false is returned (wrong item or value).
+ */
+axl_bool            myqtt_conn_opts_set_sock_opt (MyQttConnOpts * opts,
+						  int             item,
+						  int             value)
+{
+	if (opts == NULL || value < 0)
+		return axl_false;
+	if (item < MYQTT_LISTENER_SNDBUF || item > MYQTT_LISTENER_NOTSENT_LOWAT)
+		return axl_false;
+	opts->sock_opts[item - MYQTT_LISTENER_SNDBUF] = value;
+	return axl_true;
+}
+
 /** 
  * @brief Allows to configure Will options on the provided connection options.
  *
@@ -3510,22 +3530,14 @@ axl_bool               myqtt_conn_ref_internal                    (MyQttConn * c
 	ctx = connection->ctx;
 #endif
 	
-	/* lock ref/unref operations over this connection */
-	myqtt_mutex_lock   (&connection->ref_mutex);
-
 	/* increase and log the connection increased */
-	connection->ref_count++;
-
-	ref_count = connection->ref_count;
+	ref_count = myqtt_atomic_add (&connection->ref_count, 1);
 
 	myqtt_log (MYQTT_LEVEL_DEBUG, "%d increased connection id=%d (%p) reference to %d by %s\n",
 		   myqtt_getpid (),
 		   connection->id, connection,
 		   ref_count, who ? who : "??"); 
 
-	/* unlock ref/unref options over this connection */
-	myqtt_mutex_unlock (&connection->ref_mutex);
-
 	return ref_count > 1;
 }
 
@@ -3617,25 +3629,18 @@ void               myqtt_conn_unref                  (MyQttConn * connection,
 	if (connection == NULL)
 		return;
 
-	/* lock the connection being unrefered */
-	myqtt_mutex_lock     (&(connection->ref_mutex));
-
 #if defined(ENABLE_MYQTT_LOG)
 	/* get context */
 	ctx = connection->ctx;
 #endif
 
-	/* decrease reference counting */
-	connection->ref_count--;
+	/* decrease reference counting and get current count */
+	count = myqtt_atomic_add (&connection->ref_count, -1);
 
 	myqtt_log (MYQTT_LEVEL_DEBUG, "%d decreased connection id=%d (%p) reference count to %d decreased by %s\n", 
 		myqtt_getpid (),
 		connection->id, connection,
-		connection->ref_count, who ? who : "??");  
-		
-	/* get current count */
-	count = connection->ref_count;
-	myqtt_mutex_unlock (&(connection->ref_mutex));
+		count, who ? who : "??");  
 
 	/* if count is 0, free the connection */
 	if (count == 0) {
@@ -3661,17 +3666,12 @@ void               myqtt_conn_unref                  (MyQttConn * connection,
  */
 int                 myqtt_conn_ref_count              (MyQttConn * connection)
 {
-	int result;
-
 	/* check reference received */
 	if (connection == NULL)
 		return -1;
 
 	/* return the reference count */
-	myqtt_mutex_lock     (&(connection->ref_mutex));
-	result = connection->ref_count;
-	myqtt_mutex_unlock     (&(connection->ref_mutex));
-	return result;
+	return myqtt_atomic_get (&connection->ref_count);
 }
 
 /** 
@@ -3933,23 +3933,20 @@ void               myqtt_conn_free (MyQttConn * connection)
 
 	myqtt_log (MYQTT_LEVEL_DEBUG, "freeing connection host id=%d", connection->id);
 
-	/* free host and port */
-	if (connection->host != NULL) {
-		axl_free (connection->host);
-		axl_free (connection->local_addr);
-		connection->host       = NULL;
-		connection->local_addr = NULL;
-	}
+	/* free host and port (local values are resolved on demand
+	 * so they may be defined without host) */
+	axl_free (connection->host);
+	axl_free (connection->local_addr);
+	connection->host       = NULL;
+	connection->local_addr = NULL;
 	axl_free (connection->host_ip);
 
 	myqtt_log (MYQTT_LEVEL_DEBUG, "freeing connection port id=%d", connection->id);
 
-	if (connection->port != NULL) {
-		axl_free (connection->port);
-		axl_free (connection->local_port);
-		connection->port       = NULL;
-		connection->local_port = NULL;
-	}
+	axl_free (connection->port);
+	axl_free (connection->local_port);
+	connection->port       = NULL;
+	connection->local_port = NULL;
 
 	/* free pending line */
 	axl_free (connection->pending_line);
@@ -3964,8 +3961,6 @@ void               myqtt_conn_free (MyQttConn * connection)
 
 	myqtt_mutex_destroy (&connection->op_mutex);
 
-	myqtt_mutex_destroy (&connection->handlers_mutex);
-
 	myqtt_log (MYQTT_LEVEL_DEBUG, "freeing/terminating connection id=%d", connection->id);
 
 	/* close connection */
@@ -4009,8 +4004,13 @@ void               myqtt_conn_free (MyQttConn * connection)
 	axl_list_free (connection->sent_pkgids);
 	connection->sent_pkgids = NULL;
 
-	/* free possible msg and buffer */
-	axl_free (connection->buffer);
+	/* free possible msg and buffer (small buffers are placed
+	 * inside the msg) */
+	if (connection->last_msg == NULL || connection->buffer != connection->last_msg->inline_buffer)
+		axl_free (connection->buffer);
+	connection->buffer = NULL;
+	myqtt_msg_free (connection->last_msg);
+	connection->last_msg = NULL;
 
 	/* release ping resp queue if defined */
 	myqtt_async_queue_unref (connection->ping_resp_queue);
@@ -4095,6 +4095,12 @@ void                myqtt_conn_set_receive_stamp            (MyQttConn * conn, l
 	conn->bytes_sent      += bytes_sent;
 	myqtt_mutex_unlock (&conn->ref_mutex);
 
+	/* account bytes on the context */
+	if (bytes_received > 0)
+		__myqtt_metrics_add (conn->ctx, MYQTT_METRIC_BYTES_RECEIVED, bytes_received);
+	if (bytes_sent > 0)
+		__myqtt_metrics_add (conn->ctx, MYQTT_METRIC_BYTES_SENT, bytes_sent);
+
 	return;
 }
 
@@ -4360,6 +4366,12 @@ const char        * myqtt_conn_get_local_addr         (MyQttConn * connection)
 	if (connection == NULL)
 		return NULL;
 
+	/* resolve on demand */
+	myqtt_mutex_lock (&connection->op_mutex);
+	if (connection->local_addr == NULL && connection->session != -1)
+		__myqtt_conn_resolve_local_addr (connection);
+	myqtt_mutex_unlock (&connection->op_mutex);
+
 	return connection->local_addr;
 }
 
@@ -4374,6 +4386,12 @@ const char        * myqtt_conn_get_local_port         (MyQttConn * connection)
 	if (connection == NULL)
 		return NULL;
 
+	/* resolve on demand */
+	myqtt_mutex_lock (&connection->op_mutex);
+	if (connection->local_port == NULL && connection->session != -1)
+		__myqtt_conn_resolve_local_addr (connection);
+	myqtt_mutex_unlock (&connection->op_mutex);
+
 	return connection->local_port;
 }
 
@@ -4455,7 +4473,7 @@ void __myqtt_conn_invoke_on_close (MyQttConn * connection)
 		return;
 
 	/* lock now the op mutex is not blocked */
-	myqtt_mutex_lock (&connection->handlers_mutex);
+	myqtt_mutex_lock (__myqtt_conn_handlers_mutex (connection));
 
 	/* invoke full */
 	/* iterate over all full handlers and invoke them */
@@ -4471,7 +4489,7 @@ void __myqtt_conn_invoke_on_close (MyQttConn * connection)
 		axl_list_unlink_first (connection->on_close_full);
 		
 		/* unlock now the op mutex is not blocked */
-		myqtt_mutex_unlock (&connection->handlers_mutex);
+		myqtt_mutex_unlock (__myqtt_conn_handlers_mutex (connection));
 		
 		/* invoke */
 		__myqtt_conn_invoke_on_close_do_notify (connection, handler->handler, handler->data);
@@ -4480,12 +4498,12 @@ void __myqtt_conn_invoke_on_close (MyQttConn * connection)
 		axl_free (handler);
 		
 		/* reacquire the mutex */
-		myqtt_mutex_lock (&connection->handlers_mutex);
+		myqtt_mutex_lock (__myqtt_conn_handlers_mutex (connection));
 
 	} /* end while */
 
 	/* unlock now the op mutex is not blocked */
-	myqtt_mutex_unlock (&connection->handlers_mutex);
+	myqtt_mutex_unlock (__myqtt_conn_handlers_mutex (connection));
 
 	return;
 } 
@@ -4711,6 +4729,14 @@ void           __myqtt_conn_set_not_connected (MyQttConn * connection,
 		/* unlock now the op mutex is not blocked */
 		myqtt_mutex_unlock (&connection->op_mutex);
 
+		/* account accepted connections closed */
+		if (connection->connect_accepted)
+			__myqtt_metrics_add (connection->ctx, MYQTT_METRIC_CONNS_CLOSED, 1);
+
+		/* resume publishers paused by this connection (or
+		 * drop its entry if it was paused) */
+		__myqtt_sequencer_release_backpressure (connection->ctx, axl_false);
+
 		/* check for the close handler full definition */
 		if (connection->on_close_full != NULL) {
 			myqtt_log (MYQTT_LEVEL_DEBUG, "notifying connection-id=%d close handlers", connection->id);
@@ -4805,6 +4831,20 @@ void                myqtt_conn_delete_key_data        (MyQttConn * connection,
 	myqtt_hash_delete (connection->data, (axlPointer) key);
 	return;
 }
+/** 
+ * @internal Creates the connection data hash (if it wasn't created
+ * by another thread in the mean time). Connections do not create it
+ * until something is stored.
+ */
+void                __myqtt_conn_create_data          (MyQttConn * connection)
+{
+	myqtt_mutex_lock (&connection->ref_mutex);
+	if (connection->data == NULL)
+		connection->data = myqtt_hash_new_full (axl_hash_string, axl_hash_equal_string, NULL, NULL);
+	myqtt_mutex_unlock (&connection->ref_mutex);
+	return;
+}
+
 /** 
  * @brief Allows to store user space data into the connection like
  * \ref myqtt_conn_set_data does but configuring functions to
@@ -4861,10 +4901,15 @@ void                myqtt_conn_set_data_full          (MyQttConn * connection,
 	/* check if the value is not null. It it is null, remove the
 	 * value. */
 	if (value == NULL) {
-		myqtt_hash_remove (connection->data, key);
+		if (connection->data)
+			myqtt_hash_remove (connection->data, key);
 		return;
 	}
 
+	/* create data hash on first use */
+	if (connection->data == NULL)
+		__myqtt_conn_create_data (connection);
+
 	/* store the data selected replacing previous one */
 	myqtt_hash_replace_full (connection->data, 
 				  key, key_destroy, 
@@ -4926,7 +4971,10 @@ axlPointer         myqtt_conn_get_data               (MyQttConn * connection,
 {
  	v_return_val_if_fail (connection,       NULL);
  	v_return_val_if_fail (key,              NULL);
- 	v_return_val_if_fail (connection->data, NULL);
+
+	/* nothing was stored yet */
+	if (connection->data == NULL)
+		return NULL;
 
 	return myqtt_hash_lookup (connection->data, (axlPointer) key);
 }
@@ -4943,6 +4991,10 @@ axlPointer         myqtt_conn_get_data               (MyQttConn * connection,
 MyQttHash        * myqtt_conn_get_data_hash          (MyQttConn * connection)
 {
 	v_return_val_if_fail (connection, NULL);
+
+	/* create data hash on first use */
+	if (connection->data == NULL)
+		__myqtt_conn_create_data (connection);
 	return connection->data;
 }
 
@@ -5355,13 +5407,13 @@ void myqtt_conn_set_on_close       (MyQttConn         * connection,
 		return;
 
 	/* lock during the operation */
-	myqtt_mutex_lock (&connection->handlers_mutex);
+	myqtt_mutex_lock (__myqtt_conn_handlers_mutex (connection));
 
 	/* init on close list on demand */
 	if (connection->on_close_full == NULL) {
 		connection->on_close_full  = axl_list_new (axl_list_always_return_1, axl_free);
 		if (connection->on_close_full == NULL) {
-			myqtt_mutex_unlock (&connection->handlers_mutex);
+			myqtt_mutex_unlock (__myqtt_conn_handlers_mutex (connection));
 			return;
 		} /* end if */
 	}
@@ -5383,7 +5435,7 @@ void myqtt_conn_set_on_close       (MyQttConn         * connection,
 #endif
 
 	/* unlock now it is done */
-	myqtt_mutex_unlock (&connection->handlers_mutex);
+	myqtt_mutex_unlock (__myqtt_conn_handlers_mutex (connection));
 	/* returns previous handler */
 	return;
 }
@@ -5477,13 +5529,13 @@ void                    myqtt_conn_set_on_close_full2  (MyQttConn          * con
 		return;
 
 	/* lock during the operation */
-	myqtt_mutex_lock (&connection->handlers_mutex);
+	myqtt_mutex_lock (__myqtt_conn_handlers_mutex (connection));
 
 	/* init on close list on demand */
 	if (connection->on_close_full == NULL) {
 		connection->on_close_full  = axl_list_new (axl_list_always_return_1, axl_free);
 		if (connection->on_close_full == NULL) {
-			myqtt_mutex_unlock (&connection->handlers_mutex);
+			myqtt_mutex_unlock (__myqtt_conn_handlers_mutex (connection));
 			return;
 		} /* end if */
 	}
@@ -5505,7 +5557,7 @@ void                    myqtt_conn_set_on_close_full2  (MyQttConn          * con
 #endif
 
 	/* unlock now it is done */
-	myqtt_mutex_unlock (&connection->handlers_mutex);
+	myqtt_mutex_unlock (__myqtt_conn_handlers_mutex (connection));
 
 	/* finish */
 	return;
@@ -5545,7 +5597,7 @@ axl_bool   myqtt_conn_remove_on_close (MyQttConn          * connection,
 	v_return_val_if_fail (on_close_handler, axl_false);
 
 	/* look during the operation */
-	myqtt_mutex_lock (&connection->handlers_mutex);
+	myqtt_mutex_lock (__myqtt_conn_handlers_mutex (connection));
 
 	/* remove by pointer */
 	iterator = 0;
@@ -5560,7 +5612,7 @@ axl_bool   myqtt_conn_remove_on_close (MyQttConn          * connection,
 			axl_list_remove_ptr (connection->on_close_full, handler);
 
 			/* unlock */
-			myqtt_mutex_unlock (&connection->handlers_mutex);
+			myqtt_mutex_unlock (__myqtt_conn_handlers_mutex (connection));
 
 			return axl_true;
 			
@@ -5572,7 +5624,7 @@ axl_bool   myqtt_conn_remove_on_close (MyQttConn          * connection,
 	} /* end while */
 	
 	/* unlock */
-	myqtt_mutex_unlock (&connection->handlers_mutex);
+	myqtt_mutex_unlock (__myqtt_conn_handlers_mutex (connection));
 
 	return axl_false;
 }
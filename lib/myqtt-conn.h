@@ -132,6 +132,10 @@ void                myqtt_conn_opts_set_auth (MyQttConnOpts * opts,
 void                myqtt_conn_opts_set_reuse (MyQttConnOpts * opts,
 					       axl_bool        reuse);
 
+axl_bool            myqtt_conn_opts_set_sock_opt (MyQttConnOpts * opts,
+						  int             item,
+						  int             value);
+
 void                myqtt_conn_opts_set_will (MyQttConnOpts  * opts,
 					      MyQttQos         will_qos,
 					      const char     * will_topic,
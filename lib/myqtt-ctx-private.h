@@ -43,9 +43,38 @@
 #include <axl.h>
 #include <myqtt.h>
 
+/** 
+ * @internal Number of mutexes shared by all connections to protect
+ * their on close handlers (see __myqtt_conn_handlers_mutex).
+ */
+#define MYQTT_CONN_HANDLERS_LOCKS 64
+
+/** 
+ * @internal Number of slots metrics are striped over (each thread
+ * updates the slot assigned to it, see __myqtt_metrics_slot).
+ */
+#define MYQTT_METRICS_SLOTS 16
+
+/** 
+ * @internal Number of topics published by myqtt_metrics_publish_sys
+ * (see __myqtt_metrics_sys_topics).
+ */
+#define MYQTT_METRICS_SYS_TOPICS 24
+
+/** 
+ * @internal Metrics counters and histograms updated by one or more
+ * threads (see myqtt-metrics.c).
+ */
+typedef struct _MyQttMetricsSlot {
+	long                 counters[MYQTT_METRIC_COUNTERS];
+	long long            fanout[MYQTT_METRICS_HISTOGRAM_BUCKETS];
+	long long            latency[MYQTT_METRICS_HISTOGRAM_BUCKETS];
+} MyQttMetricsSlot;
+
 struct _MyQttCtx {
 
 	MyQttMutex           ref_mutex;
+	/* updated with myqtt_atomic_* (see myqtt_ctx_ref2) */
 	int                  ref_count;
 
 	/* global hash to store arbitrary data */
@@ -62,7 +91,6 @@ struct _MyQttCtx {
 	axl_bool             skip_storage_init;
 
 	/* global mutex */
-	MyQttMutex           msg_id_mutex;
 	MyQttMutex           connection_id_mutex;
 	MyQttMutex           search_path_mutex;
 	MyQttMutex           exit_mutex;
@@ -80,6 +108,14 @@ struct _MyQttCtx {
 	int                  backlog;
 	int                  automatic_mime;
 
+	/* listener accept configuration (see
+	 * MYQTT_LISTENER_ACCEPT_BATCH and MYQTT_LISTENER_REUSE_PORT) */
+	int                  listener_accept_batch;
+	axl_bool             listener_reuse_port;
+
+	/* listener socket options (indexed from MYQTT_LISTENER_SNDBUF) */
+	int                  listener_sock_opts[MYQTT_LISTENER_SOCK_OPTS];
+
 	/* allows to control if we should wait to finish threads
 	 * inside the pool */
 	axl_bool             skip_thread_pool_wait;
@@ -101,6 +137,12 @@ struct _MyQttCtx {
 	axl_bool             debug_filter_checked;
 	axl_bool             debug_filter_is_enabled;
 
+	/* levels reported (console or handler) once filters are
+	 * applied, checked by myqtt_log before building its
+	 * arguments. Computed by myqtt_init_ctx and log setters
+	 * (never by the log path). */
+	int                  log_levels;
+
 	/*** global handlers */
 	/* @internal Finish handler */
 	MyQttOnFinishHandler             finish_handler;
@@ -135,6 +177,14 @@ struct _MyQttCtx {
 	 */ 
 	axlHash            * connection_hostname;
 	MyQttMutex           connection_hostname_mutex;
+
+	/** 
+	 * @internal Mutexes used by connections to protect their on
+	 * close handlers list, selected by connection id. This avoids
+	 * having one mutex per connection for a list that is rarely
+	 * used.
+	 */
+	MyQttMutex           connection_handlers_m[MYQTT_CONN_HANDLERS_LOCKS];
 	
 	/** 
 	 * @internal Default timeout used by myqtt connection operations.
@@ -150,10 +200,10 @@ struct _MyQttCtx {
 	/** 
 	 * @internal
 	 *
-	 * Internal variables (msg_id and msg_id_mutex) to make msg
-	 * identification for the on going process. This allows to check if
-	 * two msgs are equal or to track which msgs are not properly
-	 * released by the MyQtt Library.
+	 * Internal variable (msg_id) to make msg identification for
+	 * the on going process (updated with myqtt_atomic_add). This
+	 * allows to check if two msgs are equal or to track which msgs
+	 * are not properly released by the MyQtt Library.
 	 *
 	 * Msgs are generated calling to __myqtt_msg_get_next_id. Thus,
 	 * every msg created while the running process is alive have a
@@ -161,6 +211,23 @@ struct _MyQttCtx {
 	 */
 	long                msg_id;
 
+	/** 
+	 * @internal Free list of released MyQttMsg objects (up to
+	 * MYQTT_MSG_POOL_SIZE) reused by next messages (see
+	 * __myqtt_msg_new).
+	 */
+	MyQttMutex          msg_pool_m;
+	MyQttMsg          * msg_pool;
+	int                 msg_pool_count;
+
+	/** 
+	 * @internal Intern table (string -> refcounted node) used to
+	 * share topic filters and client identifiers stored by the
+	 * subscription tables (see myqtt_support_intern).
+	 */
+	MyQttMutex          intern_m;
+	axlHash           * intern;
+
 	/**** myqtt io waiting module state ****/
 	MyQttIoCreateFdGroup  waiting_create;
 	MyQttIoDestroyFdGroup waiting_destroy;
@@ -199,6 +266,14 @@ struct _MyQttCtx {
 	 * @internal Reference to the thread pool.
 	 */
 	axl_bool                     thread_pool_exclusive;
+	axl_bool                     thread_pool_work_stealing;
+
+	/* cpu sets configured for each MyQttThreadClass (see
+	 * myqtt_thread_set_cpus), thread_cpus_gen of the class is
+	 * increased on each change so its running threads apply it */
+	char                       * thread_cpus[4];
+	int                          thread_cpus_gen[4];
+	MyQttMutex                   thread_cpus_mutex;
 	MyQttThreadPool *            thread_pool;
 	axl_bool                     thread_pool_being_stopped;
 
@@ -228,6 +303,22 @@ struct _MyQttCtx {
 	axlList                   * pending_messages;
 	MyQttThread                 sequencer_thread;
 
+	/** 
+	 * @internal Ingress backpressure: bytes queued on the
+	 * sequencer, configured watermarks (0 disabled) and the list
+	 * of publishers paused (MyQttBackpressure, see
+	 * myqtt-sequencer.c).
+	 */
+	int                         sequencer_bytes;
+	axl_bool                    sequencer_over_watermark;
+	int                         conn_queue_high;
+	int                         conn_queue_low;
+	int                         ctx_queue_high;
+	int                         ctx_queue_low;
+	MyQttMutex                  backpressure_m;
+	axlList                   * backpressure_paused;
+	int                         backpressure_count;
+
 	/** references to the on subscribe handler */
 	MyQttOnSubscribeHandler     on_subscribe;
 	axlPointer                  on_subscribe_data;
@@ -285,6 +376,116 @@ struct _MyQttCtx {
 	int                         storage_path_hash_size;
 	axl_bool                    local_storage;
 
+	/** 
+	 * @internal Storage driver configured and its private state
+	 * (NULL means file storage).
+	 */
+	MyQttStorageBackend       * storage_backend;
+	MyQttStorageType            storage_type;
+	axlPointer                  storage_backend_data;
+
+	/** 
+	 * @internal File storage subscription index (append only log
+	 * used by myqtt_storage_load to avoid walking all sessions).
+	 */
+	MyQttMutex                  storage_index_mutex;
+	FILE                      * storage_index;
+
+	/** 
+	 * @internal Storage expiration settings (seconds, 0 to
+	 * disable) and the thread pool event running the sweeper.
+	 */
+	int                         storage_msg_ttl;
+	int                         storage_session_expiry;
+	int                         storage_expiry_event_id;
+
+	/** 
+	 * @internal Sessions (client identifiers) being removed by
+	 * the storage sweeper: myqtt_storage_init waits on
+	 * storage_expiring_c until they are done.
+	 */
+	MyQttMutex                  storage_expiring_m;
+	MyQttCond                   storage_expiring_c;
+	axlHash                   * storage_expiring;
+
+	/** 
+	 * @internal Storage writer: bounded queue of storage
+	 * operations (MyQttStorageWriterJob) run by a dedicated
+	 * thread (see myqtt_storage_writer_start).
+	 */
+	MyQttMutex                  storage_writer_m;
+	MyQttCond                   storage_writer_c;
+	axlList                   * storage_writer_jobs;
+	MyQttThread                 storage_writer_thread;
+	int                         storage_writer_limit;
+	int                         storage_writer_running_jobs;
+	axl_bool                    storage_writer_started;
+	axl_bool                    storage_writer_stop;
+
+	/** 
+	 * @internal Retained message operations handed off to the
+	 * storage writer not finished yet (updated with
+	 * myqtt_atomic_*, see __myqtt_storage_writer_wait).
+	 */
+	int                         storage_writer_retained;
+
+	/** 
+	 * @internal Storage usage accounting: per client identifier
+	 * counters (MyQttStorageUsage) and totals for the whole
+	 * context (see myqtt_storage_usage). Complete is set once
+	 * counters were loaded for all sessions and claimed once
+	 * persisted counters were removed because they changed.
+	 */
+	MyQttMutex                  storage_usage_m;
+	axlHash                   * storage_usage;
+	int                         storage_usage_messages;
+	long                        storage_usage_bytes;
+	axl_bool                    storage_usage_complete;
+	int                         storage_usage_claimed;
+
+	/** 
+	 * @internal Compression applied to payloads stored and the
+	 * minimum payload size to apply it.
+	 */
+	MyQttStorageCompression     storage_compression;
+	int                         storage_compression_threshold;
+
+	/** 
+	 * @internal Additional storage roots (shards) configured
+	 * with myqtt_storage_add_path (storage_path is shard 0) and
+	 * the consistent hashing ring used to place client
+	 * identifiers and retained topics on them.
+	 */
+	char                     ** storage_shards;
+	int                         storage_shards_count;
+	unsigned int              * storage_ring_points;
+	int                       * storage_ring_shards;
+	int                         storage_ring_size;
+
+	/** 
+	 * @internal Retained messages write-behind: latest retained
+	 * value for each topic (MyQttStorageRetained) pending to be
+	 * flushed to the storage driver (see
+	 * myqtt_storage_set_retain_write_behind).
+	 */
+	MyQttMutex                  storage_retain_m;
+	MyQttMutex                  storage_retain_flush_m;
+	axlHash                   * storage_retain_cache;
+	axl_bool                    storage_retain_write_behind;
+	int                         storage_retain_event_id;
+
+	/** 
+	 * @internal Metrics registry (updated with myqtt_atomic_*,
+	 * see myqtt_metrics_get) and $SYS publisher state (last
+	 * values published and the thread pool event running it).
+	 */
+	MyQttMetricsSlot            metrics_slots[MYQTT_METRICS_SLOTS];
+	long                        metrics_started;
+	MyQttMutex                  metrics_m;
+	int                         metrics_sys_event_id;
+	axl_bool                    metrics_sys_published;
+	long                        metrics_sys_last[MYQTT_METRICS_SYS_TOPICS];
+
 	/* ssl/tls support */
 	axlPointer              context_creator;
 	axlPointer              context_creator_data;
@@ -293,5 +494,17 @@ struct _MyQttCtx {
 	axlPointer              post_ssl_check_data;
 };
 
+/** 
+ * @internal All log levels.
+ */
+#define MYQTT_LOG_LEVELS_ALL (MYQTT_LEVEL_DEBUG | MYQTT_LEVEL_WARNING | MYQTT_LEVEL_CRITICAL)
+
+/** 
+ * @internal Inside the library, check log levels reading the context
+ * directly (see myqtt_log_level_enabled).
+ */
+#undef  MYQTT_LOG_LEVEL_ENABLED
+#define MYQTT_LOG_LEVEL_ENABLED(c, l) ((c) == NULL || ((c)->log_levels & (l)))
+
 #endif /* __MYQTT_CTX_PRIVATE_H__ */
 
@@ -81,6 +81,7 @@
 MyQttCtx * myqtt_ctx_new (void)
 {
 	MyQttCtx * ctx;
+	int        iterator;
 
 	/* create a new context */
 	ctx           = axl_new (MyQttCtx, 1);
@@ -96,18 +97,34 @@ MyQttCtx * myqtt_ctx_new (void)
 
 	/* init mutex for the log */
 	myqtt_mutex_create (&ctx->log_mutex);
+	ctx->log_levels = MYQTT_LOG_LEVELS_ALL;
 
 	/**** myqtt_thread_pool.c: init ****/
 	ctx->thread_pool_exclusive = axl_true;
 
+	/**** myqtt-thread.c: init ****/
+	myqtt_mutex_create (&ctx->thread_cpus_mutex);
+	__myqtt_thread_init_cpus ();
+
+	/**** myqtt-listener.c: init ****/
+	ctx->listener_accept_batch = 64;
+
 	/* init reference counting */
 	myqtt_mutex_create (&ctx->ref_mutex);
 	ctx->ref_count = 1;
 
+	/* msg free list */
+	myqtt_mutex_create (&ctx->msg_pool_m);
+
+	/* string intern table */
+	myqtt_mutex_create (&ctx->intern_m);
+
 	/* init pending messages */
 	ctx->pending_messages = axl_list_new (axl_list_always_return_1, NULL);
 	myqtt_mutex_create (&ctx->pending_messages_m);
 	myqtt_cond_create (&ctx->pending_messages_c);
+	ctx->backpressure_paused = axl_list_new (axl_list_always_return_1, NULL);
+	myqtt_mutex_create (&ctx->backpressure_m);
 
 	/* subscription list */
 	myqtt_mutex_create (&ctx->subs_m);
@@ -116,6 +133,35 @@ MyQttCtx * myqtt_ctx_new (void)
 	/* client ids */
 	myqtt_mutex_create (&ctx->client_ids_m);
 
+	/* storage subscription index */
+	myqtt_mutex_create (&ctx->storage_index_mutex);
+
+	/* storage writer */
+	myqtt_mutex_create (&ctx->storage_writer_m);
+	myqtt_cond_create (&ctx->storage_writer_c);
+
+	/* storage usage counters */
+	myqtt_mutex_create (&ctx->storage_usage_m);
+
+	/* sessions being expired */
+	myqtt_mutex_create (&ctx->storage_expiring_m);
+	myqtt_cond_create (&ctx->storage_expiring_c);
+
+	/* retained messages write-behind */
+	myqtt_mutex_create (&ctx->storage_retain_m);
+	myqtt_mutex_create (&ctx->storage_retain_flush_m);
+
+	/* metrics */
+	ctx->metrics_started = (long) time (NULL);
+	myqtt_mutex_create (&ctx->metrics_m);
+
+	/* connection on close handlers */
+	iterator = 0;
+	while (iterator < MYQTT_CONN_HANDLERS_LOCKS) {
+		myqtt_mutex_create (&ctx->connection_handlers_m[iterator]);
+		iterator++;
+	} /* end while */
+
 	/* set default connect timeout */
 	ctx->connection_connect_std_timeout = 15;
 
@@ -745,17 +791,15 @@ axl_bool        myqtt_ctx_ref2                       (MyQttCtx  * ctx, const cha
 	if (ctx == NULL)
 		return axl_false;
 
-	/* acquire the mutex */
-	myqtt_mutex_lock (&ctx->ref_mutex);
-	if (ctx->ref_count <= 0) {
-		/* estrange case */
-		myqtt_mutex_unlock (&ctx->ref_mutex);
-		return axl_false;
-	} /* end if */
-
-	ctx->ref_count++;
-	refs = ctx->ref_count;
-	myqtt_mutex_unlock (&ctx->ref_mutex);
+	/* increase unless the context is already finished */
+	do {
+		refs = myqtt_atomic_get (&ctx->ref_count);
+		if (refs <= 0) {
+			/* estrange case */
+			return axl_false;
+		} /* end if */
+	} while (! myqtt_atomic_cas (&ctx->ref_count, refs, refs + 1));
+	refs++;
 
 	myqtt_log (MYQTT_LEVEL_DEBUG, "%s: increased references to MyQttCtx %p (refs: %d)", who, ctx, refs);
 
@@ -772,16 +816,10 @@ axl_bool        myqtt_ctx_ref2                       (MyQttCtx  * ctx, const cha
  */
 int         myqtt_ctx_ref_count                 (MyQttCtx  * ctx)
 {
-	int result;
 	if (ctx == NULL)
 		return -1;
 	
-	/* acquire the mutex */
-	myqtt_mutex_lock (&ctx->ref_mutex); 
-	result = ctx->ref_count;
-	myqtt_mutex_unlock (&ctx->ref_mutex); 
-
-	return result;
+	return myqtt_atomic_get (&ctx->ref_count);
 }
 
 /** 
@@ -813,6 +851,7 @@ void        myqtt_ctx_unref2                     (MyQttCtx ** ctx, const char *
 {
 	MyQttCtx * _ctx;
 	axl_bool   nullify;
+	int        refs;
 
 	/* do nothing with a null reference */
 	if (ctx == NULL || (*ctx) == NULL)
@@ -821,21 +860,17 @@ void        myqtt_ctx_unref2                     (MyQttCtx ** ctx, const char *
 	/* get local reference */
 	_ctx = (*ctx);
 
-	/* check if we have to nullify after unref */
-	myqtt_mutex_lock (&_ctx->ref_mutex);
-
 	/* do sanity check */
-	if (_ctx->ref_count <= 0) {
-		myqtt_mutex_unlock (&_ctx->ref_mutex);
-
+	refs = myqtt_atomic_get (&_ctx->ref_count);
+	if (refs <= 0) {
 		_myqtt_log (NULL, __AXL_FILE__, __AXL_LINE__, MYQTT_LEVEL_CRITICAL, "attempting to unref MyQttCtx %p object more times than references supported", _ctx);
 		/* nullify */
 		(*ctx) = NULL;
 		return;
 	}
 
-	nullify =  (_ctx->ref_count == 1);
-	myqtt_mutex_unlock (&_ctx->ref_mutex);
+	/* check if we have to nullify after unref */
+	nullify =  (refs == 1);
 
 	/* call to unref */
 	myqtt_ctx_free2 (*ctx, who);
@@ -868,19 +903,17 @@ void        myqtt_ctx_free (MyQttCtx * ctx)
  */
 void        myqtt_ctx_free2 (MyQttCtx * ctx, const char * who)
 {
+	int refs;
+	int iterator;
+
 	/* do nothing */
 	if (ctx == NULL)
 		return;
 
-	/* acquire the mutex */
-	myqtt_mutex_lock (&ctx->ref_mutex);
-	ctx->ref_count--;
-
-	if (ctx->ref_count != 0) {
-		myqtt_log (MYQTT_LEVEL_DEBUG, "%s: decreased references to MyQttCtx %p (refs: %d)", who, ctx, ctx->ref_count);
-
-		/* release mutex */
-		myqtt_mutex_unlock (&ctx->ref_mutex);
+	/* decrease references */
+	refs = myqtt_atomic_add (&ctx->ref_count, -1);
+	if (refs != 0) {
+		myqtt_log (MYQTT_LEVEL_DEBUG, "%s: decreased references to MyQttCtx %p (refs: %d)", who, ctx, refs);
 		return;
 	} /* end if */
 
@@ -892,9 +925,16 @@ void        myqtt_ctx_free2 (MyQttCtx * ctx, const char * who)
 
 	/* release log mutex */
 	myqtt_mutex_destroy (&ctx->log_mutex);
+
+	/* release cpu sets configured */
+	myqtt_mutex_destroy (&ctx->thread_cpus_mutex);
+	iterator = 0;
+	while (iterator < 4) {
+		axl_free (ctx->thread_cpus[iterator]);
+		iterator++;
+	} /* end while */
 	
 	/* release and clean mutex */
-	myqtt_mutex_unlock (&ctx->ref_mutex);
 	myqtt_mutex_destroy (&ctx->ref_mutex);
 
 	/* init pending messages */
@@ -902,6 +942,10 @@ void        myqtt_ctx_free2 (MyQttCtx * ctx, const char * who)
 	myqtt_mutex_destroy (&ctx->pending_messages_m);
 	myqtt_cond_destroy (&ctx->pending_messages_c);
 
+	/* entries were released by myqtt_sequencer_stop */
+	axl_list_free (ctx->backpressure_paused);
+	myqtt_mutex_destroy (&ctx->backpressure_m);
+
 	/* release connections subscribed */
 	axl_hash_free (ctx->subs);
 	axl_hash_free (ctx->wild_subs);
@@ -916,8 +960,48 @@ void        myqtt_ctx_free2 (MyQttCtx * ctx, const char * who)
 	myqtt_mutex_destroy (&ctx->client_ids_m);
 	axl_hash_free (ctx->client_ids);
 
-	/* release path */
+	/* stop storage driver and release path */
+	__myqtt_storage_cleanup (ctx);
 	axl_free (ctx->storage_path);
+	while (ctx->storage_shards_count > 0) {
+		ctx->storage_shards_count--;
+		axl_free (ctx->storage_shards[ctx->storage_shards_count]);
+	} /* end while */
+	axl_free (ctx->storage_shards);
+	axl_free (ctx->storage_ring_points);
+	axl_free (ctx->storage_ring_shards);
+	myqtt_mutex_destroy (&ctx->storage_index_mutex);
+	axl_list_free (ctx->storage_writer_jobs);
+	myqtt_mutex_destroy (&ctx->storage_writer_m);
+	myqtt_cond_destroy (&ctx->storage_writer_c);
+	axl_hash_free (ctx->storage_usage);
+	myqtt_mutex_destroy (&ctx->storage_usage_m);
+	axl_hash_free (ctx->storage_expiring);
+	myqtt_mutex_destroy (&ctx->storage_expiring_m);
+	myqtt_cond_destroy (&ctx->storage_expiring_c);
+	axl_hash_free (ctx->storage_retain_cache);
+	myqtt_mutex_destroy (&ctx->storage_retain_m);
+	myqtt_mutex_destroy (&ctx->storage_retain_flush_m);
+
+	/* metrics */
+	myqtt_mutex_destroy (&ctx->metrics_m);
+
+	/* release msg free list */
+	__myqtt_msg_pool_cleanup (ctx);
+	myqtt_mutex_destroy (&ctx->msg_pool_m);
+
+	/* release connection on close handlers mutexes */
+	iterator = 0;
+	while (iterator < MYQTT_CONN_HANDLERS_LOCKS) {
+		myqtt_mutex_destroy (&ctx->connection_handlers_m[iterator]);
+		iterator++;
+	} /* end while */
+
+	/* release intern table: done last because subscription
+	 * tables released above hold interned strings */
+	axl_hash_free (ctx->intern);
+	ctx->intern = NULL;
+	myqtt_mutex_destroy (&ctx->intern_m);
 
 	myqtt_log (MYQTT_LEVEL_DEBUG, "about.to.free MyQttCtx %p", ctx);
 
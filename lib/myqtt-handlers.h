@@ -763,7 +763,10 @@ typedef axl_bool (*MyQttOnStoreMsg) (MyQttCtx * ctx, MyQttConn * conn,
  *
  * @param ctx The context where the operation is taking place.
  *
- * @param conn The connection where the operation is taking place.
+ * @param conn The connection where the operation is taking place. It
+ * is NULL when no connection is involved, for example, when a queued
+ * message is removed because it expired (see \ref
+ * myqtt_storage_set_expiry).
  *
  * @param client_identifier The client identifier for which the
  * message is being stored.
@@ -845,6 +848,98 @@ typedef axlPointer (*MyQttInitSessionSetupPtr) (MyQttCtx   * ctx,
 						axlPointer   user_data, 
 						axlPointer   user_data2, 
 						axlPointer   user_data3);
+
+/** 
+ * @brief Handler called by a storage driver (\ref
+ * MyQttStorageBackend) for every subscription found while iterating
+ * over the subscriptions stored for a client identifier.
+ *
+ * @param ctx The context where the operation is taking place.
+ *
+ * @param client_identifier The client identifier that owns the subscription.
+ *
+ * @param topic_filter The topic filter subscribed. The reference is
+ * owned by the storage driver: copy it if you need to keep it.
+ *
+ * @param qos The QoS requested for the subscription.
+ *
+ * @param user_data User defined pointer passed to the iteration.
+ *
+ * @param user_data2 Second user defined pointer passed to the iteration.
+ */
+typedef void (*MyQttStorageSubFound) (MyQttCtx    * ctx,
+				      const char  * client_identifier,
+				      const char  * topic_filter,
+				      MyQttQos      qos,
+				      axlPointer    user_data,
+				      axlPointer    user_data2);
+
+/** 
+ * @brief Handler called by a storage driver (\ref
+ * MyQttStorageBackend) for every queued message found while
+ * iterating over the messages stored for a client identifier.
+ *
+ * @param ctx The context where the operation is taking place.
+ *
+ * @param client_identifier The client identifier that owns the message.
+ *
+ * @param handle The storage handle pointing to the message. Its
+ * ownership is transferred to the handler (it must be released
+ * through \ref myqtt_storage_release_msg).
+ *
+ * @param packet_id The packet id the message was stored with.
+ *
+ * @param qos The QoS the message was stored with.
+ *
+ * @param app_msg The message content. Its ownership is transferred to
+ * the handler.
+ *
+ * @param app_msg_size The message size.
+ *
+ * @param user_data User defined pointer passed to the iteration.
+ */
+typedef void (*MyQttStorageMsgFound) (MyQttCtx       * ctx,
+				      const char     * client_identifier,
+				      axlPointer       handle,
+				      int              packet_id,
+				      MyQttQos         qos,
+				      unsigned char  * app_msg,
+				      int              app_msg_size,
+				      axlPointer       user_data);
+
+/** 
+ * @brief Storage operation queued with \ref
+ * myqtt_storage_writer_queue to be run by the storage writer.
+ *
+ * @param ctx The context where the operation is taking place.
+ *
+ * @param user_data User defined pointer passed to \ref myqtt_storage_writer_queue.
+ *
+ * @param user_data2 Second user defined pointer passed to \ref myqtt_storage_writer_queue.
+ *
+ * @return axl_true if the operation was completed, otherwise axl_false.
+ */
+typedef axl_bool (*MyQttStorageJob) (MyQttCtx       * ctx,
+				     axlPointer       user_data,
+				     axlPointer       user_data2);
+
+/** 
+ * @brief Completion handler called once a storage operation queued
+ * with \ref myqtt_storage_writer_queue has finished. It is the
+ * right place to release user_data and user_data2.
+ *
+ * @param ctx The context where the operation is taking place.
+ *
+ * @param status Value reported by the \ref MyQttStorageJob.
+ *
+ * @param user_data User defined pointer passed to \ref myqtt_storage_writer_queue.
+ *
+ * @param user_data2 Second user defined pointer passed to \ref myqtt_storage_writer_queue.
+ */
+typedef void (*MyQttStorageJobDone) (MyQttCtx       * ctx,
+				     axl_bool         status,
+				     axlPointer       user_data,
+				     axlPointer       user_data2);
 				      
 #endif
 
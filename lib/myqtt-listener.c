@@ -36,9 +36,14 @@
  *         info@aspl.es - http://www.aspl.es/mqtt
  *                        http://www.aspl.es/myqtt
  */
+#if defined(MYQTT_HAVE_ACCEPT4) && ! defined(_GNU_SOURCE)
+/* required to get accept4 (2) declaration */
+#define _GNU_SOURCE
+#endif
 #include <myqtt.h>
 #if defined(AXL_OS_UNIX)
 #include <netdb.h>
+#include <netinet/tcp.h>
 #endif
 
 /* local include */
@@ -330,33 +335,76 @@ MYQTT_SOCKET myqtt_listener_accept (MYQTT_SOCKET server_socket)
 	return accept (server_socket, (struct sockaddr *)&inet_addr, &addrlen);
 }
 
+/** 
+ * @internal Accept variant used by the reader loop on listener
+ * sockets. Where accept4 (2) is available, the socket returned is
+ * already non-blocking and close-on-exec, saving the fcntl calls
+ * done later when the connection is registered.
+ *
+ * @param server_socket The non-blocking listener socket.
+ *
+ * @return Returns a connected socket descriptor or -1 if it fails
+ * (errno set to EAGAIN when there are no more pending connections).
+ */
+MYQTT_SOCKET __myqtt_listener_accept_nonblock (MYQTT_SOCKET server_socket)
+{
+#if defined(MYQTT_HAVE_ACCEPT4)
+	struct sockaddr_storage inet_addr;
+	socklen_t               addrlen = sizeof (inet_addr);
+
+	return accept4 (server_socket, (struct sockaddr *)&inet_addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+	return myqtt_listener_accept (server_socket);
+#endif
+}
+
+/** 
+ * @internal Called by the reader loop when the listener socket is
+ * ready. Accepts pending connections until the backlog is drained
+ * or MYQTT_LISTENER_ACCEPT_BATCH connections were accepted, whatever
+ * happens first, so a reconnection storm is not limited to one
+ * accept per reader loop pass.
+ */
 void myqtt_listener_accept_connections (MyQttCtx        * ctx,
 					int               server_socket, 
 					MyQttConn       * listener)
 {
 	int   soft_limit, hard_limit, client_socket;
+	int   accepted = 0;
+	int   batch    = ctx->listener_accept_batch;
+
+	if (batch < 1)
+		batch = 1;
+
+	while (accepted < batch) {
+		/* accept the connection new connection */
+		client_socket = __myqtt_listener_accept_nonblock (server_socket);
+		if (client_socket == MYQTT_SOCKET_ERROR) {
+			/* backlog drained (or connection was reset
+			 * before being accepted) */
+			if (errno == MYQTT_EAGAIN || errno == MYQTT_EWOULDBLOCK || errno == MYQTT_EINTR || errno == ECONNABORTED)
+				return;
+
+			/* get values */
+			myqtt_conf_get (ctx, MYQTT_SOFT_SOCK_LIMIT, &soft_limit);
+			myqtt_conf_get (ctx, MYQTT_HARD_SOCK_LIMIT, &hard_limit);
+
+			myqtt_log (MYQTT_LEVEL_CRITICAL, "accept () failed, server_socket=%d, soft-limit=%d, hard-limit=%d: (errno=%d) %s\n",
+				   server_socket, soft_limit, hard_limit, errno, myqtt_errno_get_last_error ());
+			return;
+		} /* end if */
+		accepted++;
 
-	/* accept the connection new connection */
-	client_socket = myqtt_listener_accept (server_socket);
-	if (client_socket == MYQTT_SOCKET_ERROR) {
-		/* get values */
-		myqtt_conf_get (ctx, MYQTT_SOFT_SOCK_LIMIT, &soft_limit);
-		myqtt_conf_get (ctx, MYQTT_HARD_SOCK_LIMIT, &hard_limit);
-
-		myqtt_log (MYQTT_LEVEL_CRITICAL, "accept () failed, server_socket=%d, soft-limit=%d, hard-limit=%d: (errno=%d) %s\n",
-			   server_socket, soft_limit, hard_limit, errno, myqtt_errno_get_last_error ());
-		return;
-	} /* end if */
-
-	/* check we can support more sockets, if not close current
-	 * connection: function already closes client socket in the
-	 * case of failure */
-	if (! myqtt_conn_check_socket_limit (ctx, client_socket))
-		return;
+		/* check we can support more sockets, if not close current
+		 * connection: function already closes client socket in the
+		 * case of failure */
+		if (! myqtt_conn_check_socket_limit (ctx, client_socket))
+			return;
 
-	/* instead of negotiate the connection at this point simply
-	 * accept it to negotiate it inside myqtt_reader loop.  */
-	__myqtt_listener_initial_accept (myqtt_conn_get_ctx (listener), client_socket, listener, axl_true);
+		/* instead of negotiate the connection at this point simply
+		 * accept it to negotiate it inside myqtt_reader loop.  */
+		__myqtt_listener_initial_accept (myqtt_conn_get_ctx (listener), client_socket, listener, axl_true);
+	} /* end while */
 
 	return;
 }
@@ -376,6 +424,93 @@ typedef struct _MyQttListenerData {
 	MYQTT_SOCKET               reuse_socket;
 }MyQttListenerData;
 
+/** 
+ * @internal Applies listener socket options (\ref
+ * MYQTT_LISTENER_SNDBUF .. \ref MYQTT_LISTENER_NOTSENT_LOWAT) on the
+ * provided listener socket before calling listen (). Values
+ * configured on opts take precedence over context values. Accepted
+ * sockets inherit them from the listener.
+ */
+void __myqtt_listener_set_sock_opts (MyQttCtx * ctx, MYQTT_SOCKET fd, MyQttConnOpts * opts)
+{
+	int          item;
+	int          value;
+	int          level;
+	int          name;
+	const char * label;
+
+	for (item = MYQTT_LISTENER_SNDBUF; item <= MYQTT_LISTENER_NOTSENT_LOWAT; item++) {
+		/* get value to configure */
+		value = ctx->listener_sock_opts[item - MYQTT_LISTENER_SNDBUF];
+		if (opts && opts->sock_opts[item - MYQTT_LISTENER_SNDBUF] > 0)
+			value = opts->sock_opts[item - MYQTT_LISTENER_SNDBUF];
+		if (value <= 0)
+			continue;
+
+		level = SOL_SOCKET;
+		name  = -1;
+		label = NULL;
+		switch (item) {
+		case MYQTT_LISTENER_SNDBUF:
+			name  = SO_SNDBUF;
+			label = "SO_SNDBUF";
+			break;
+		case MYQTT_LISTENER_RCVBUF:
+			name  = SO_RCVBUF;
+			label = "SO_RCVBUF";
+			break;
+		case MYQTT_LISTENER_DEFER_ACCEPT:
+			label = "TCP_DEFER_ACCEPT";
+#if defined(TCP_DEFER_ACCEPT)
+			level = IPPROTO_TCP;
+			name  = TCP_DEFER_ACCEPT;
+#endif
+			break;
+		case MYQTT_LISTENER_FASTOPEN:
+			label = "TCP_FASTOPEN";
+#if defined(TCP_FASTOPEN)
+			level = IPPROTO_TCP;
+			name  = TCP_FASTOPEN;
+#endif
+			break;
+		case MYQTT_LISTENER_BUSY_POLL:
+			label = "SO_BUSY_POLL";
+#if defined(SO_BUSY_POLL)
+			name  = SO_BUSY_POLL;
+#endif
+			break;
+		case MYQTT_LISTENER_USER_TIMEOUT:
+			label = "TCP_USER_TIMEOUT";
+#if defined(TCP_USER_TIMEOUT)
+			level = IPPROTO_TCP;
+			name  = TCP_USER_TIMEOUT;
+#endif
+			break;
+		case MYQTT_LISTENER_NOTSENT_LOWAT:
+			label = "TCP_NOTSENT_LOWAT";
+#if defined(TCP_NOTSENT_LOWAT)
+			level = IPPROTO_TCP;
+			name  = TCP_NOTSENT_LOWAT;
+#endif
+			break;
+		} /* end switch */
+
+		if (name == -1) {
+			myqtt_log (MYQTT_LEVEL_WARNING, "%s is not supported on this platform, skipping listener option (value=%d)", label, value);
+			continue;
+		} /* end if */
+
+		if (setsockopt (fd, level, name, (const char *) &value, sizeof (value)) != 0) {
+			myqtt_log (MYQTT_LEVEL_WARNING, "failed to set %s=%d on listener socket %d (errno=%d:%s)", 
+				   label, value, fd, errno, myqtt_errno_get_error (errno));
+			continue;
+		} /* end if */
+		myqtt_log (MYQTT_LEVEL_DEBUG, "configured %s=%d on listener socket %d", label, value, fd);
+	} /* end for */
+
+	return;
+}
+
 /** 
  * @internal Function used to create a listen process.
  */
@@ -384,6 +519,21 @@ MYQTT_SOCKET     myqtt_listener_sock_listen_common      (MyQttCtx            * c
 							   const char           * port,
 							   axlError            ** error,
 							   MyQttNetTransport     transport)
+{
+	return __myqtt_listener_sock_listen_full (ctx, host, port, error, transport, NULL);
+}
+
+/** 
+ * @internal Same as \ref myqtt_listener_sock_listen_common but
+ * applying listener socket options found in opts (or in the
+ * context).
+ */
+MYQTT_SOCKET     __myqtt_listener_sock_listen_full      (MyQttCtx            * ctx,
+							   const char           * host,
+							   const char           * port,
+							   axlError            ** error,
+							   MyQttNetTransport     transport,
+							   MyQttConnOpts       * opts)
 {
 	struct hostent     * he    = NULL;
 	struct in_addr     * haddr = NULL;
@@ -477,6 +627,14 @@ MYQTT_SOCKET     myqtt_listener_sock_listen_common      (MyQttCtx            * c
 	/* setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char  *)&unit, sizeof(BOOL)); */
 #else
 	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &unit, sizeof (unit));
+#if defined(SO_REUSEPORT)
+	/* allow several listeners (usually one per context) to bind
+	 * the same address:port so the kernel balances accepts */
+	if (ctx->listener_reuse_port && setsockopt (fd, SOL_SOCKET, SO_REUSEPORT, &unit, sizeof (unit)) != 0) {
+		myqtt_log (MYQTT_LEVEL_WARNING, "failed to enable SO_REUSEPORT on listener socket %d (errno=%d:%s)", 
+			   fd, errno, myqtt_errno_get_error (errno));
+	} /* end if */
+#endif
 #endif 
 
 	/* get integer port */
@@ -511,6 +669,10 @@ MYQTT_SOCKET     myqtt_listener_sock_listen_common      (MyQttCtx            * c
 		return -1;
 	}
 	
+	/* configure socket options before listen () so buffer
+	 * sizes are taken into account for window scaling */
+	__myqtt_listener_set_sock_opts (ctx, fd, opts);
+
 	/* get current backlog configuration */
 	myqtt_conf_get (ctx, MYQTT_LISTENER_BACKLOG, &backlog);
 	
@@ -654,9 +816,9 @@ axlPointer __myqtt_listener_new (MyQttListenerData * data)
 		/* allocate listener, try to guess IPv6 support */
 		if (strstr (host, ":") || transport == MYQTT_IPv6) {
 			myqtt_log (MYQTT_LEVEL_DEBUG, "Detected IPv6 listener: %s:%s..", host, str_port);
-			fd = myqtt_listener_sock_listen6 (ctx, host, str_port, &error);
+			fd = __myqtt_listener_sock_listen_full (ctx, host, str_port, &error, MYQTT_IPv6, opts);
 		} else
-			fd = myqtt_listener_sock_listen (ctx, host, str_port, &error);
+			fd = __myqtt_listener_sock_listen_full (ctx, host, str_port, &error, MYQTT_IPv4, opts);
 		
 		if (fd == MYQTT_SOCKET_ERROR || fd == -1) {
 			myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to create listener socket, fd reported is an error %d. Unable to find on %s:%s. Error found: %s", fd,
@@ -671,6 +833,12 @@ axlPointer __myqtt_listener_new (MyQttListenerData * data)
 		/* reuse socket for fd */
 		fd = reuse_socket;
 	} /* end if */
+
+	/* listener socket is non-blocking so the reader loop can
+	 * accept in batches until the backlog is drained */
+	if (! myqtt_conn_set_sock_block (fd, axl_false)) {
+		myqtt_log (MYQTT_LEVEL_WARNING, "unable to set listener socket %d non-blocking, accepts may block the reader", fd);
+	} /* end if */
 		
 	/* listener ok */
 	/* seems listener to be created, now create the MQTT connection around it */
@@ -108,6 +108,17 @@ MyQttConn * __myqtt_listener_initial_accept (MyQttCtx      * ctx,
 					     MyQttConn     * listener,
 					     axl_bool        dont_register);
 
+MYQTT_SOCKET __myqtt_listener_accept_nonblock (MYQTT_SOCKET server_socket);
+
+MYQTT_SOCKET __myqtt_listener_sock_listen_full (MyQttCtx           * ctx,
+						const char          * host,
+						const char          * port,
+						axlError           ** error,
+						MyQttNetTransport     transport,
+						MyQttConnOpts       * opts);
+
+void         __myqtt_listener_set_sock_opts    (MyQttCtx * ctx, MYQTT_SOCKET fd, MyQttConnOpts * opts);
+
 axl_bool __myqtt_listener_check_port_sharing (MyQttCtx * ctx, MyQttConn * connection);
 
 
@@ -0,0 +1,474 @@
+/* 
+ *  MyQtt: A high performance open source MQTT implementation
+ *  Copyright (C) 2016 Advanced Software Production Line, S.L.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307 USA
+ *  
+ *  You may find a copy of the license under this software is released
+ *  at COPYING file. This is LGPL software: you are welcome to develop
+ *  proprietary applications using this library without any royalty or
+ *  fee but returning back any change, improvement or addition in the
+ *  form of source code, project image, documentation patches, etc.
+ *
+ *  For commercial support on build MQTT enabled solutions contact us:
+ *          
+ *      Postal address:
+ *         Advanced Software Production Line, S.L.
+ *         C/ Antonio Suarez Nº 10, 
+ *         Edificio Alius A, Despacho 102
+ *         Alcalá de Henares 28802 (Madrid)
+ *         Spain
+ *
+ *      Email address:
+ *         info@aspl.es - http://www.aspl.es/mqtt
+ *                        http://www.aspl.es/myqtt
+ */
+#include <myqtt.h>
+
+/* local/private includes */
+#include <myqtt-ctx-private.h>
+#include <myqtt-msg-private.h>
+
+#define LOG_DOMAIN "myqtt-metrics"
+
+/** 
+ * \defgroup myqtt_metrics MyQtt Metrics: counters and histograms to monitor a context
+ */
+
+/** 
+ * \addtogroup myqtt_metrics
+ * @{
+ */
+
+/** 
+ * @internal Metrics counters are striped over MYQTT_METRICS_SLOTS
+ * slots inside the context. Each thread gets a slot index the first
+ * time it updates a metric and it keeps using it, so threads
+ * routing messages update their own cache lines. Slots are only
+ * added together when metrics are read (myqtt_metrics_get).
+ */
+#if defined(_MSC_VER)
+# define MYQTT_METRICS_TLS __declspec(thread)
+#elif defined(__GNUC__)
+# define MYQTT_METRICS_TLS __thread
+#endif
+
+#if defined(MYQTT_METRICS_TLS)
+MYQTT_METRICS_TLS int __myqtt_metrics_thread_slot = -1;
+
+/** 
+ * @internal Set while the thread publishes $SYS topics so its own
+ * traffic is not accounted (see __myqtt_metrics_sys_publish).
+ */
+MYQTT_METRICS_TLS axl_bool __myqtt_metrics_thread_skip = axl_false;
+#endif
+int __myqtt_metrics_threads = 0;
+
+/** 
+ * @internal $SYS topics published by myqtt_metrics_publish_sys
+ * (keep in sync with values computed there and with
+ * MYQTT_METRICS_SYS_TOPICS).
+ */
+const char * __myqtt_metrics_sys_topics[MYQTT_METRICS_SYS_TOPICS] = {
+	"$SYS/broker/uptime",
+	"$SYS/broker/clients/connected",
+	"$SYS/broker/clients/accepted",
+	"$SYS/broker/clients/closed",
+	"$SYS/broker/messages/received",
+	"$SYS/broker/messages/received/qos0",
+	"$SYS/broker/messages/received/qos1",
+	"$SYS/broker/messages/received/qos2",
+	"$SYS/broker/messages/sent",
+	"$SYS/broker/messages/sent/qos0",
+	"$SYS/broker/messages/sent/qos1",
+	"$SYS/broker/messages/sent/qos2",
+	"$SYS/broker/messages/dropped",
+	"$SYS/broker/messages/queued",
+	"$SYS/broker/bytes/received",
+	"$SYS/broker/bytes/sent",
+	"$SYS/broker/store/messages/count",
+	"$SYS/broker/store/messages/bytes",
+	"$SYS/broker/subscriptions/count",
+	"$SYS/broker/subscriptions/offline",
+	"$SYS/broker/publish/fanout/p50",
+	"$SYS/broker/publish/fanout/p99",
+	"$SYS/broker/publish/latency/p50",
+	"$SYS/broker/publish/latency/p99"
+};
+
+/** 
+ * @internal Returns the slot the calling thread updates on the
+ * provided context.
+ */
+MyQttMetricsSlot * __myqtt_metrics_slot (MyQttCtx * ctx)
+{
+#if defined(MYQTT_METRICS_TLS)
+	if (__myqtt_metrics_thread_slot < 0)
+		__myqtt_metrics_thread_slot = (myqtt_atomic_add (&__myqtt_metrics_threads, 1) & 0x7fffffff) % MYQTT_METRICS_SLOTS;
+	return &ctx->metrics_slots[__myqtt_metrics_thread_slot];
+#else
+	return &ctx->metrics_slots[0];
+#endif
+}
+
+/** 
+ * @internal Returns axl_true if the calling thread is publishing
+ * $SYS topics, so messages it produces must not be accounted.
+ */
+axl_bool __myqtt_metrics_skipped        (void)
+{
+#if defined(MYQTT_METRICS_TLS)
+	return __myqtt_metrics_thread_skip;
+#else
+	return axl_false;
+#endif
+}
+
+/** 
+ * @internal Adds value to the provided counter (ignored while the
+ * calling thread publishes $SYS topics).
+ */
+void     __myqtt_metrics_add            (MyQttCtx     * ctx,
+					 MyQttMetric    metric,
+					 long           value)
+{
+	if (ctx == NULL || metric >= MYQTT_METRIC_COUNTERS || __myqtt_metrics_skipped ())
+		return;
+
+	myqtt_atomic_add (&__myqtt_metrics_slot (ctx)->counters[metric], value);
+	return;
+}
+
+/** 
+ * @internal Records how many subscribers a publication received was
+ * routed to (fanout) and how long it took (latency, microseconds).
+ */
+void     __myqtt_metrics_publish_add    (MyQttCtx     * ctx,
+					 int            fanout,
+					 long           latency)
+{
+	MyQttMetricsSlot * slot;
+
+	if (ctx == NULL)
+		return;
+
+	slot = __myqtt_metrics_slot (ctx);
+	__myqtt_thread_pool_histogram_add (slot->fanout, fanout);
+	__myqtt_thread_pool_histogram_add (slot->latency, latency);
+	return;
+}
+
+/** 
+ * @internal Counts subscriptions (items of the hashes) found on the
+ * provided subscription table. Must be called with subs_m locked.
+ */
+int      __myqtt_metrics_count_subs     (axlHash      * subs)
+{
+	axlHashCursor * cursor;
+	int             count = 0;
+
+	if (subs == NULL)
+		return 0;
+
+	cursor = axl_hash_cursor_new (subs);
+	axl_hash_cursor_first (cursor);
+	while (axl_hash_cursor_has_item (cursor)) {
+		count += axl_hash_items (axl_hash_cursor_get_value (cursor));
+		axl_hash_cursor_next (cursor);
+	} /* end while */
+	axl_hash_cursor_free (cursor);
+
+	return count;
+}
+
+/** 
+ * @brief Allows to get a snapshot of the metrics tracked by the
+ * provided context.
+ *
+ * Counters (see \ref MyQttMetric) and histograms are updated by the
+ * threads doing the work without locks (each thread on its own
+ * slot) and they are only added together by this function, so it is
+ * cheap to keep them but calling this function has a cost: do not
+ * call it for every message. Counters are never reset (compare two
+ * snapshots to get rates).
+ *
+ * Gauges (connections, subscriptions, storage usage, uptime) are
+ * computed at the moment of the call.
+ *
+ * See also \ref myqtt_metrics_set_sys_interval to have them
+ * published under $SYS/broker/ topics.
+ *
+ * @param ctx The context where to get metrics from.
+ *
+ * @param metrics Reference where the snapshot is written.
+ *
+ * @return axl_true if the snapshot was written, otherwise axl_false
+ * is returned (NULL parameters).
+ */
+axl_bool myqtt_metrics_get              (MyQttCtx     * ctx,
+					 MyQttMetrics * metrics)
+{
+	MyQttMetricsSlot * slot;
+	int                iterator;
+	int                bucket;
+
+	if (ctx == NULL || metrics == NULL)
+		return axl_false;
+
+	memset (metrics, 0, sizeof (MyQttMetrics));
+
+	/* add all slots */
+	iterator = 0;
+	while (iterator < MYQTT_METRICS_SLOTS) {
+		slot = &ctx->metrics_slots[iterator];
+
+		bucket = 0;
+		while (bucket < MYQTT_METRIC_COUNTERS) {
+			metrics->counters[bucket] += myqtt_atomic_get (&slot->counters[bucket]);
+			bucket++;
+		} /* end while */
+
+		bucket = 0;
+		while (bucket < MYQTT_METRICS_HISTOGRAM_BUCKETS) {
+			metrics->fanout[bucket]  += myqtt_atomic_get64 (&slot->fanout[bucket]);
+			metrics->latency[bucket] += myqtt_atomic_get64 (&slot->latency[bucket]);
+			bucket++;
+		} /* end while */
+
+		iterator++;
+	} /* end while */
+
+	/* gauges */
+	metrics->connections = (int) (metrics->counters[MYQTT_METRIC_CONNS_ACCEPTED] - metrics->counters[MYQTT_METRIC_CONNS_CLOSED]);
+	metrics->uptime      = (long) time (NULL) - ctx->metrics_started;
+	myqtt_storage_usage (ctx, &metrics->stored_messages, &metrics->stored_bytes);
+
+	myqtt_mutex_lock (&ctx->subs_m);
+	metrics->subscriptions         = __myqtt_metrics_count_subs (ctx->subs) + __myqtt_metrics_count_subs (ctx->wild_subs);
+	metrics->offline_subscriptions = __myqtt_metrics_count_subs (ctx->offline_subs) + __myqtt_metrics_count_subs (ctx->offline_wild_subs);
+	myqtt_mutex_unlock (&ctx->subs_m);
+
+	return axl_true;
+}
+
+/** 
+ * @internal Publishes the provided value as a retained message on
+ * the provided topic to connected subscribers (nothing is queued for
+ * offline sessions). Messages are sent with QoS 0 so the publisher
+ * never waits for subscribers' PUBACK, and they are not accounted on
+ * metrics (otherwise messages/sent and bytes/sent would change on
+ * every interval).
+ */
+axl_bool __myqtt_metrics_sys_publish (MyQttCtx * ctx, const char * topic, const char * value)
+{
+	MyQttMsg * msg;
+
+	/* prepare message */
+	msg = __myqtt_msg_new (ctx);
+	if (msg == NULL)
+		return axl_false;
+
+	/* configure message: retained so new subscribers get the last
+	 * value */
+	msg->type      = MYQTT_PUBLISH;
+	msg->qos       = MYQTT_QOS_0;
+	msg->retain    = axl_true;
+	msg->id        = __myqtt_msg_get_next_id (ctx, "get-next");
+	msg->ctx       = ctx;
+
+	/* acquire a reference to the context */
+	myqtt_ctx_ref2 (ctx, "new msg");
+
+	/* setup app messages and topic */
+	msg->app_message      = (unsigned char *) axl_strdup (value);
+	msg->app_message_size = strlen (value);
+	msg->size             = msg->app_message_size;
+	msg->payload          = msg->app_message;
+
+	msg->topic_name       = axl_strdup (topic);
+	msg->topic_name_size  = strlen (topic);
+
+	/* call to publish (skipping metrics) */
+#if defined(MYQTT_METRICS_TLS)
+	__myqtt_metrics_thread_skip = axl_true;
+#endif
+	__myqtt_reader_do_publish (ctx, NULL, msg, axl_false);
+#if defined(MYQTT_METRICS_TLS)
+	__myqtt_metrics_thread_skip = axl_false;
+#endif
+
+	/* release message */
+	myqtt_msg_unref (msg);
+
+	return axl_true;
+}
+
+/** 
+ * @brief Publishes current metrics of the provided context (see
+ * \ref myqtt_metrics_get) as retained messages under $SYS/broker/
+ * topics, for example: $SYS/broker/clients/connected,
+ * $SYS/broker/messages/received, $SYS/broker/messages/sent/qos1,
+ * $SYS/broker/bytes/sent, $SYS/broker/messages/dropped,
+ * $SYS/broker/store/messages/bytes, $SYS/broker/subscriptions/count
+ * or $SYS/broker/publish/latency/p99.
+ *
+ * Values are published as decimal strings with QoS 0 and only when
+ * they changed since the previous call. Messages are delivered to
+ * connected subscribers only (they are never queued for offline
+ * sessions) and they are not accounted on metrics themselves. Histogram percentiles report the upper bound of the
+ * bucket (see \ref myqtt_thread_pool_histogram_percentile).
+ *
+ * This is what the event installed by \ref
+ * myqtt_metrics_set_sys_interval runs. Call it directly to publish
+ * metrics at any time.
+ *
+ * @param ctx The context (broker) where metrics are published. Its
+ * storage must be loaded (\ref myqtt_storage_load).
+ *
+ * @return Number of topics published or -1 if it fails.
+ */
+int      myqtt_metrics_publish_sys      (MyQttCtx     * ctx)
+{
+	MyQttMetrics   metrics;
+	long           values[MYQTT_METRICS_SYS_TOPICS];
+	char           value[32];
+	int            iterator;
+	int            published = 0;
+
+	if (ctx == NULL || ctx->myqtt_exit || ! ctx->local_storage)
+		return -1;
+
+	if (! myqtt_metrics_get (ctx, &metrics))
+		return -1;
+
+	/* values in the same order as __myqtt_metrics_sys_topics */
+	values[0]  = metrics.uptime;
+	values[1]  = metrics.connections;
+	values[2]  = metrics.counters[MYQTT_METRIC_CONNS_ACCEPTED];
+	values[3]  = metrics.counters[MYQTT_METRIC_CONNS_CLOSED];
+	values[4]  = metrics.counters[MYQTT_METRIC_MSGS_RECEIVED_QOS0] + metrics.counters[MYQTT_METRIC_MSGS_RECEIVED_QOS1] + metrics.counters[MYQTT_METRIC_MSGS_RECEIVED_QOS2];
+	values[5]  = metrics.counters[MYQTT_METRIC_MSGS_RECEIVED_QOS0];
+	values[6]  = metrics.counters[MYQTT_METRIC_MSGS_RECEIVED_QOS1];
+	values[7]  = metrics.counters[MYQTT_METRIC_MSGS_RECEIVED_QOS2];
+	values[8]  = metrics.counters[MYQTT_METRIC_MSGS_SENT_QOS0] + metrics.counters[MYQTT_METRIC_MSGS_SENT_QOS1] + metrics.counters[MYQTT_METRIC_MSGS_SENT_QOS2];
+	values[9]  = metrics.counters[MYQTT_METRIC_MSGS_SENT_QOS0];
+	values[10] = metrics.counters[MYQTT_METRIC_MSGS_SENT_QOS1];
+	values[11] = metrics.counters[MYQTT_METRIC_MSGS_SENT_QOS2];
+	values[12] = metrics.counters[MYQTT_METRIC_MSGS_DROPPED];
+	values[13] = metrics.counters[MYQTT_METRIC_MSGS_QUEUED];
+	values[14] = metrics.counters[MYQTT_METRIC_BYTES_RECEIVED];
+	values[15] = metrics.counters[MYQTT_METRIC_BYTES_SENT];
+	values[16] = metrics.stored_messages;
+	values[17] = metrics.stored_bytes;
+	values[18] = metrics.subscriptions;
+	values[19] = metrics.offline_subscriptions;
+	values[20] = myqtt_thread_pool_histogram_percentile (metrics.fanout, 50);
+	values[21] = myqtt_thread_pool_histogram_percentile (metrics.fanout, 99);
+	values[22] = myqtt_thread_pool_histogram_percentile (metrics.latency, 50);
+	values[23] = myqtt_thread_pool_histogram_percentile (metrics.latency, 99);
+
+	/* serialize publishers (event and user calls) */
+	myqtt_mutex_lock (&ctx->metrics_m);
+
+#if defined(VERSION)
+	if (! ctx->metrics_sys_published && __myqtt_metrics_sys_publish (ctx, "$SYS/broker/version", "myqtt " VERSION))
+		published++;
+#endif
+
+	iterator = 0;
+	while (iterator < MYQTT_METRICS_SYS_TOPICS) {
+		/* skip values not changed */
+		if (ctx->metrics_sys_published && ctx->metrics_sys_last[iterator] == values[iterator]) {
+			iterator++;
+			continue;
+		} /* end if */
+
+		snprintf (value, sizeof (value), "%ld", values[iterator]);
+		if (__myqtt_metrics_sys_publish (ctx, __myqtt_metrics_sys_topics[iterator], value)) {
+			ctx->metrics_sys_last[iterator] = values[iterator];
+			published++;
+		} /* end if */
+		iterator++;
+	} /* end while */
+	ctx->metrics_sys_published = axl_true;
+
+	myqtt_mutex_unlock (&ctx->metrics_m);
+
+	return published;
+}
+
+/** 
+ * @internal Thread pool event publishing $SYS topics.
+ */
+axl_bool __myqtt_metrics_sys_event (MyQttCtx * ctx, axlPointer user_data, axlPointer user_data2)
+{
+	myqtt_metrics_publish_sys (ctx);
+	return axl_false; /* keep the event */
+}
+
+/** 
+ * @brief Allows to have metrics of the provided context (broker)
+ * published periodically under $SYS/broker/ topics (see \ref
+ * myqtt_metrics_publish_sys).
+ *
+ * Publication is done by a thread pool event, so threads receiving
+ * and routing messages never do it.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param seconds Seconds between publications. Use 0 to stop
+ * publishing.
+ *
+ * @return axl_true if the configuration was applied, otherwise
+ * axl_false is returned (wrong parameters or failure to install the
+ * event).
+ */
+axl_bool myqtt_metrics_set_sys_interval (MyQttCtx     * ctx,
+					 int            seconds)
+{
+	int event_id;
+
+	if (ctx == NULL || seconds < 0)
+		return axl_false;
+
+	myqtt_mutex_lock (&ctx->metrics_m);
+	event_id                  = ctx->metrics_sys_event_id;
+	ctx->metrics_sys_event_id = 0;
+	myqtt_mutex_unlock (&ctx->metrics_m);
+
+	/* remove previous event */
+	if (event_id)
+		myqtt_thread_pool_remove_event (ctx, event_id);
+
+	if (seconds == 0)
+		return axl_true;
+
+	event_id = myqtt_thread_pool_new_event (ctx, (long) seconds * 1000000, __myqtt_metrics_sys_event, NULL, NULL);
+	if (event_id == -1) {
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Unable to install $SYS metrics event, myqtt_thread_pool_new_event () failed");
+		return axl_false;
+	} /* end if */
+
+	myqtt_mutex_lock (&ctx->metrics_m);
+	ctx->metrics_sys_event_id = event_id;
+	myqtt_mutex_unlock (&ctx->metrics_m);
+
+	return axl_true;
+}
+
+/** 
+ * @}
+ */
@@ -0,0 +1,128 @@
+/* 
+ *  MyQtt: A high performance open source MQTT implementation
+ *  Copyright (C) 2016 Advanced Software Production Line, S.L.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307 USA
+ *  
+ *  You may find a copy of the license under this software is released
+ *  at COPYING file. This is LGPL software: you are welcome to develop
+ *  proprietary applications using this library without any royalty or
+ *  fee but returning back any change, improvement or addition in the
+ *  form of source code, project image, documentation patches, etc.
+ *
+ *  For commercial support on build MQTT enabled solutions contact us:
+ *          
+ *      Postal address:
+ *         Advanced Software Production Line, S.L.
+ *         C/ Antonio Suarez Nº 10, 
+ *         Edificio Alius A, Despacho 102
+ *         Alcalá de Henares 28802 (Madrid)
+ *         Spain
+ *
+ *      Email address:
+ *         info@aspl.es - http://www.aspl.es/mqtt
+ *                        http://www.aspl.es/myqtt
+ */
+#ifndef __MYQTT_METRICS_H__
+#define __MYQTT_METRICS_H__
+
+#include <myqtt.h>
+
+BEGIN_C_DECLS
+
+/** 
+ * @brief Number of buckets of histograms reported by \ref
+ * myqtt_metrics_get (same layout as thread pool histograms, so \ref
+ * myqtt_thread_pool_histogram_percentile can be used on them).
+ */
+#define MYQTT_METRICS_HISTOGRAM_BUCKETS MYQTT_THREAD_POOL_HISTOGRAM_BUCKETS
+
+/** 
+ * @brief Snapshot of the metrics of a context (see \ref
+ * myqtt_metrics_get).
+ */
+typedef struct _MyQttMetrics {
+	/** 
+	 * @brief Counters indexed by \ref MyQttMetric.
+	 */
+	long     counters[MYQTT_METRIC_COUNTERS];
+
+	/** 
+	 * @brief Incoming connections currently accepted.
+	 */
+	int      connections;
+
+	/** 
+	 * @brief Subscriptions of connected clients (one per
+	 * connection and topic filter).
+	 */
+	int      subscriptions;
+
+	/** 
+	 * @brief Subscriptions of persistent sessions whose client is
+	 * not connected.
+	 */
+	int      offline_subscriptions;
+
+	/** 
+	 * @brief Messages and bytes currently stored (see \ref
+	 * myqtt_storage_usage).
+	 */
+	int      stored_messages;
+	long     stored_bytes;
+
+	/** 
+	 * @brief Seconds since the context was created.
+	 */
+	long     uptime;
+
+	/** 
+	 * @brief Fan-out histogram: bucket 0 counts publications
+	 * received nobody was subscribed to and bucket n those
+	 * delivered or queued to [2^(n-1), 2^n) subscribers.
+	 */
+	long long fanout[MYQTT_METRICS_HISTOGRAM_BUCKETS];
+
+	/** 
+	 * @brief Routing latency histogram (microseconds): time since
+	 * a publication was received until it was delivered or queued
+	 * to all subscribers.
+	 */
+	long long latency[MYQTT_METRICS_HISTOGRAM_BUCKETS];
+} MyQttMetrics;
+
+axl_bool myqtt_metrics_get              (MyQttCtx     * ctx,
+					 MyQttMetrics * metrics);
+
+axl_bool myqtt_metrics_set_sys_interval (MyQttCtx     * ctx,
+					 int            seconds);
+
+int      myqtt_metrics_publish_sys      (MyQttCtx     * ctx);
+
+/* internal API */
+axl_bool __myqtt_metrics_skipped        (void);
+
+void     __myqtt_metrics_add            (MyQttCtx     * ctx,
+					 MyQttMetric    metric,
+					 long           value);
+
+void     __myqtt_metrics_publish_add    (MyQttCtx     * ctx,
+					 int            fanout,
+					 long           latency);
+
+END_C_DECLS
+
+#endif
@@ -40,6 +40,19 @@
 #ifndef __MYQTT_MSG_PRIVATE__
 #define __MYQTT_MSG_PRIVATE__
 
+/** 
+ * @internal Payloads smaller than this size are placed inside the
+ * MyQttMsg itself (see myqtt_msg_get_next) to avoid allocating a
+ * second buffer for small packets.
+ */
+#define MYQTT_MSG_INLINE_SIZE 128
+
+/** 
+ * @internal Max number of released MyQttMsg objects kept by each
+ * context to be reused by next messages.
+ */
+#define MYQTT_MSG_POOL_SIZE   256
+
 struct _MyQttMsg {
 	/**
 	 * Context where the msg was created.
@@ -60,15 +73,13 @@ struct _MyQttMsg {
 	 * and payload) */
 	int                  size;
 
-	MyQttMutex           mutex;
-
 	/* real reference to the memory allocated, having all the
 	 * msg received this is used to avoid double allocating memory
 	 * to receive the content and memory to place the content. See
 	 * myqtt_msg_get_next for more information. */
 	axlPointer           buffer;
 
-	/* msg reference counting */
+	/* msg reference counting (updated with myqtt_atomic_add) */
 	int                  ref_count;
 
 	/* message type */
@@ -90,8 +101,18 @@ struct _MyQttMsg {
 	int                   app_message_size;
 
 	/* reference to the topic name in the case this is a PUBLISH
-	 * message */
+	 * message. For received messages it is a view into buffer
+	 * (topic_name_view == axl_true, see
+	 * __myqtt_reader_get_utf8_view), otherwise it is allocated */
 	char                * topic_name;
+	int                   topic_name_size;
+	axl_bool              topic_name_view;
+
+	/* next msg in the context free list (ctx->msg_pool) */
+	struct _MyQttMsg    * next;
+
+	/* buffer used for small payloads (see MYQTT_MSG_INLINE_SIZE) */
+	unsigned char         inline_buffer[MYQTT_MSG_INLINE_SIZE];
 };
 
 #endif
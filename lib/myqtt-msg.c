@@ -38,6 +38,7 @@
  */
 #include <myqtt.h>
 #include <stdarg.h>
+#include <stddef.h>
 
 /* local include */
 #include <myqtt-ctx-private.h>
@@ -52,7 +53,9 @@
  * @brief Support function for msg identificators.  
  *
  * This is used to generate and return the next msg identifier, an
- * unique integer value to track msgs created.
+ * unique integer value to track msgs created. The counter is
+ * incremented atomically so building messages from several threads
+ * does not serialize on a global lock.
  *
  * @return Next msg identifier available.
  */
@@ -61,18 +64,105 @@ int  __myqtt_msg_get_next_id (MyQttCtx * ctx, char  * from)
 	/* get current context */
 	int         result;
 
-	myqtt_mutex_lock (&ctx->msg_id_mutex);
-	
-	result = ctx->msg_id;
-	ctx->msg_id++;
+	/* lock free: every caller gets a different value */
+	result = myqtt_atomic_add (&ctx->msg_id, 1) - 1;
 
 	myqtt_log (MYQTT_LEVEL_DEBUG, "Created msg id=%d", result);
 
-	myqtt_mutex_unlock (&ctx->msg_id_mutex);
-
 	return result;
 }
 
+/** 
+ * @internal Creates a new empty msg (ref count 1), reusing a
+ * previously released one from the context free list when possible.
+ *
+ * The msg doesn't hold a reference to the context yet (see
+ * myqtt_msg_get_next).
+ */
+MyQttMsg * __myqtt_msg_new (MyQttCtx * ctx)
+{
+	MyQttMsg * msg = NULL;
+
+	/* get from the free list */
+	myqtt_mutex_lock (&ctx->msg_pool_m);
+	if (ctx->msg_pool) {
+		msg            = ctx->msg_pool;
+		ctx->msg_pool  = msg->next;
+		ctx->msg_pool_count--;
+	} /* end if */
+	myqtt_mutex_unlock (&ctx->msg_pool_m);
+
+	if (msg) {
+		/* clear header (inline buffer is not required) */
+		memset (msg, 0, offsetof (MyQttMsg, inline_buffer));
+	} else {
+		msg = axl_new (MyQttMsg, 1);
+		if (msg == NULL)
+			return NULL;
+	} /* end if */
+
+	/* set initial ref count */
+	msg->ref_count = 1;
+
+	return msg;
+}
+
+/** 
+ * @internal Returns the msg to the context free list (or releases
+ * it if the list is full or the context is finishing).
+ */
+void __myqtt_msg_release (MyQttCtx * ctx, MyQttMsg * msg)
+{
+	if (ctx == NULL) {
+		axl_free (msg);
+		return;
+	} /* end if */
+
+	myqtt_mutex_lock (&ctx->msg_pool_m);
+	if (ctx->msg_pool_count < MYQTT_MSG_POOL_SIZE && ! ctx->myqtt_exit) {
+		msg->next     = ctx->msg_pool;
+		ctx->msg_pool = msg;
+		ctx->msg_pool_count++;
+		msg = NULL;
+	} /* end if */
+	myqtt_mutex_unlock (&ctx->msg_pool_m);
+
+	/* free list full */
+	axl_free (msg);
+	return;
+}
+
+/** 
+ * @internal Releases all msgs in the context free list (called
+ * when the context is finished).
+ */
+void __myqtt_msg_pool_cleanup (MyQttCtx * ctx)
+{
+	MyQttMsg * msg;
+
+	myqtt_mutex_lock (&ctx->msg_pool_m);
+	while (ctx->msg_pool) {
+		msg           = ctx->msg_pool;
+		ctx->msg_pool = msg->next;
+		axl_free (msg);
+	} /* end while */
+	ctx->msg_pool_count = 0;
+	myqtt_mutex_unlock (&ctx->msg_pool_m);
+
+	return;
+}
+
+/** 
+ * @internal Releases the buffer used to read msg content unless it
+ * is the buffer placed inside the msg.
+ */
+void __myqtt_msg_free_buffer (MyQttMsg * msg, unsigned char * buffer)
+{
+	if (buffer != NULL && buffer != msg->inline_buffer)
+		axl_free (buffer);
+	return;
+}
+
 /**
  * \defgroup myqtt_msg MyQtt Msg: Functions to manage messages received 
  */
@@ -548,6 +638,266 @@ void myqtt_msg_free_build (MyQttCtx * ctx, unsigned char * msg_build, int size)
 	return;
 }
 
+/** 
+ * @internal Writes the fixed header (control byte plus remaining
+ * length) into the buffer provided (if not NULL).
+ *
+ * @return Number of bytes of the fixed header or -1 if remaining is
+ * not supported by MQTT.
+ */
+int __myqtt_msg_encode_header (unsigned char * buffer, MyQttMsgType type, axl_bool dup, 
+			       MyQttQos qos, axl_bool retain, int remaining)
+{
+	int iterator = 1;
+
+	if (remaining < 0 || remaining > 268435455)
+		return -1;
+
+	if (buffer == NULL) {
+		/* only report size */
+		if (remaining <= 127)
+			return 2;
+		else if (remaining <= 16383)
+			return 3;
+		else if (remaining <= 2097151)
+			return 4;
+		return 5;
+	} /* end if */
+
+	/* control packet type and flags */
+	buffer[0] = (( 0x00000f & type) << 4) | (dup ? 0x08 : 0) | ((qos & 0x03) << 1) | (retain ? 0x01 : 0);
+
+	/* remaining length */
+	do {
+		buffer[iterator] = remaining % 128;
+		remaining        = remaining / 128;
+		if (remaining > 0)
+			buffer[iterator] |= 0x80;
+		iterator++;
+	} while (remaining > 0);
+
+	return iterator;
+}
+
+/** 
+ * @internal Encodes a PUBLISH packet into the buffer provided in a
+ * single pass, without allocating memory (see \ref myqtt_msg_build
+ * for the general builder).
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param buffer The buffer where the packet is written. If NULL, the
+ * function just reports the size required.
+ *
+ * @param buffer_size Buffer size available.
+ *
+ * @param dup Dup flag.
+ *
+ * @param qos Message QoS (packet_id is only written for QoS 1 and 2).
+ *
+ * @param retain Retain flag.
+ *
+ * @param packet_id Packet id.
+ *
+ * @param topic_name The topic name.
+ *
+ * @param topic_name_size Topic name length in bytes.
+ *
+ * @param app_msg The application message (can be NULL when
+ * app_msg_size is 0).
+ *
+ * @param app_msg_size Application message size.
+ *
+ * @return Bytes written (or required when buffer is NULL) or -1 if
+ * it fails (wrong parameters or buffer too small).
+ */
+int myqtt_msg_encode_publish (MyQttCtx            * ctx,
+			      unsigned char       * buffer,
+			      int                   buffer_size,
+			      axl_bool              dup,
+			      MyQttQos              qos,
+			      axl_bool              retain,
+			      int                   packet_id,
+			      const char          * topic_name,
+			      int                   topic_name_size,
+			      const unsigned char * app_msg,
+			      int                   app_msg_size)
+{
+	int remaining;
+	int header;
+
+	if (qos < MYQTT_QOS_0 || qos > MYQTT_QOS_2 || topic_name == NULL || topic_name_size < 0 || topic_name_size > 65535 ||
+	    app_msg_size < 0 || (app_msg == NULL && app_msg_size > 0))
+		return -1;
+
+	/* topic name + packet id + app message */
+	remaining = 2 + topic_name_size + (qos == MYQTT_QOS_0 ? 0 : 2) + app_msg_size;
+	header    = __myqtt_msg_encode_header (NULL, MYQTT_PUBLISH, dup, qos, retain, remaining);
+	if (header == -1)
+		return -1;
+	if (buffer == NULL)
+		return header + remaining;
+	if (buffer_size < header + remaining)
+		return -1;
+
+	/* write packet */
+	__myqtt_msg_encode_header (buffer, MYQTT_PUBLISH, dup, qos, retain, remaining);
+	myqtt_set_16bit (topic_name_size, buffer + header);
+	memcpy (buffer + header + 2, topic_name, topic_name_size);
+	header += 2 + topic_name_size;
+	if (qos != MYQTT_QOS_0) {
+		myqtt_set_16bit (packet_id, buffer + header);
+		header += 2;
+	} /* end if */
+	if (app_msg_size > 0)
+		memcpy (buffer + header, app_msg, app_msg_size);
+
+	return header + app_msg_size;
+}
+
+/** 
+ * @internal Creates a PUBLISH packet (allocating exactly the memory
+ * required) to be released with \ref myqtt_msg_free_build (or to be
+ * handled by the sequencer). See \ref myqtt_msg_encode_publish.
+ *
+ * @param size Reference where the packet size is reported.
+ *
+ * @return The packet or NULL if it fails.
+ */
+unsigned char * myqtt_msg_build_publish (MyQttCtx            * ctx,
+					 axl_bool              dup,
+					 MyQttQos              qos,
+					 axl_bool              retain,
+					 int                   packet_id,
+					 const char          * topic_name,
+					 const unsigned char * app_msg,
+					 int                   app_msg_size,
+					 int                 * size)
+{
+	unsigned char * result;
+	int             topic_name_size;
+
+	/* size is required to report the build */
+	if (size == NULL)
+		return NULL;
+	(*size) = 0;
+	if (topic_name == NULL)
+		return NULL;
+
+	topic_name_size = strlen (topic_name);
+	(*size)         = myqtt_msg_encode_publish (ctx, NULL, 0, dup, qos, retain, packet_id, topic_name, topic_name_size, app_msg, app_msg_size);
+	if ((*size) <= 0) {
+		(*size) = 0;
+		return NULL;
+	} /* end if */
+
+	result = axl_new (unsigned char, (*size) + 1);
+	if (result == NULL) {
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to allocate memory for msg, errno=%d", errno);
+		(*size) = 0;
+		return NULL;
+	} /* end if */
+	myqtt_msg_encode_publish (ctx, result, (*size), dup, qos, retain, packet_id, topic_name, topic_name_size, app_msg, app_msg_size);
+
+	return result;
+}
+
+/** 
+ * @internal Encodes a PUBACK, PUBREC, PUBREL, PUBCOMP or UNSUBACK
+ * packet (MYQTT_MSG_ACK_SIZE bytes) into the buffer provided.
+ *
+ * @return Bytes written or -1 if it fails.
+ */
+int myqtt_msg_encode_ack (MyQttCtx       * ctx,
+			  unsigned char  * buffer,
+			  int              buffer_size,
+			  MyQttMsgType     type,
+			  int              packet_id)
+{
+	if (buffer == NULL || buffer_size < MYQTT_MSG_ACK_SIZE)
+		return -1;
+	if (type != MYQTT_PUBACK && type != MYQTT_PUBREC && type != MYQTT_PUBREL && type != MYQTT_PUBCOMP && type != MYQTT_UNSUBACK)
+		return -1;
+
+	/* PUBREL requires flags 0010 (see MQTT 3.1.1, 3.6.1) */
+	__myqtt_msg_encode_header (buffer, type, axl_false, type == MYQTT_PUBREL ? MYQTT_QOS_1 : MYQTT_QOS_0, axl_false, 2);
+	myqtt_set_16bit (packet_id, buffer + 2);
+
+	return MYQTT_MSG_ACK_SIZE;
+}
+
+/** 
+ * @internal Encodes a SUBACK packet with the return codes provided.
+ *
+ * @param buffer The buffer where the packet is written. If NULL, the
+ * function just reports the size required.
+ *
+ * @return Bytes written (or required when buffer is NULL) or -1 if
+ * it fails.
+ */
+int myqtt_msg_encode_suback (MyQttCtx            * ctx,
+			     unsigned char       * buffer,
+			     int                   buffer_size,
+			     int                   packet_id,
+			     const unsigned char * return_codes,
+			     int                   return_codes_num)
+{
+	int header;
+
+	if (return_codes == NULL || return_codes_num <= 0)
+		return -1;
+
+	header = __myqtt_msg_encode_header (NULL, MYQTT_SUBACK, axl_false, MYQTT_QOS_0, axl_false, 2 + return_codes_num);
+	if (header == -1)
+		return -1;
+	if (buffer == NULL)
+		return header + 2 + return_codes_num;
+	if (buffer_size < header + 2 + return_codes_num)
+		return -1;
+
+	__myqtt_msg_encode_header (buffer, MYQTT_SUBACK, axl_false, MYQTT_QOS_0, axl_false, 2 + return_codes_num);
+	myqtt_set_16bit (packet_id, buffer + header);
+	memcpy (buffer + header + 2, return_codes, return_codes_num);
+
+	return header + 2 + return_codes_num;
+}
+
+/** 
+ * @internal Encodes a CONNACK packet (MYQTT_MSG_ACK_SIZE bytes).
+ *
+ * @return Bytes written or -1 if it fails.
+ */
+int myqtt_msg_encode_connack (MyQttCtx        * ctx,
+			      unsigned char   * buffer,
+			      int               buffer_size,
+			      axl_bool          session_present,
+			      int               return_code)
+{
+	if (buffer == NULL || buffer_size < MYQTT_MSG_ACK_SIZE)
+		return -1;
+
+	__myqtt_msg_encode_header (buffer, MYQTT_CONNACK, axl_false, MYQTT_QOS_0, axl_false, 2);
+	buffer[2] = session_present ? 1 : 0;
+	buffer[3] = return_code & 0xff;
+
+	return MYQTT_MSG_ACK_SIZE;
+}
+
+/** 
+ * @internal Encodes a PINGRESP packet (2 bytes).
+ *
+ * @return Bytes written or -1 if it fails.
+ */
+int myqtt_msg_encode_pingresp (MyQttCtx       * ctx,
+			       unsigned char  * buffer,
+			       int              buffer_size)
+{
+	if (buffer == NULL || buffer_size < 2)
+		return -1;
+
+	return __myqtt_msg_encode_header (buffer, MYQTT_PINGRESP, axl_false, MYQTT_QOS_0, axl_false, 0);
+}
+
 /** 
  * @internal
  * 
@@ -602,8 +952,8 @@ MyQttMsg * myqtt_msg_get_next     (MyQttConn * connection)
 
 		bytes_read = myqtt_msg_receive_raw (connection, buffer + bytes_read, remaining);
 		if (bytes_read == 0) {
+			__myqtt_msg_free_buffer (msg, buffer);
 			myqtt_msg_free (msg);
-			axl_free (buffer);
 
 			connection->buffer          = NULL;
 			connection->last_msg        = NULL;
@@ -794,17 +1144,13 @@ MyQttMsg * myqtt_msg_get_next     (MyQttConn * connection)
 	} /* end if */
 	
 	/* create a msg */
-	msg = axl_new (MyQttMsg, 1);
+	msg = __myqtt_msg_new (ctx);
 	if (msg == NULL) {
 		__myqtt_conn_shutdown_and_record_error (
 			connection, MyQttMemoryFail, "Failed to allocate memory for msg");
 		return NULL;
 	} /* end if */
 
-	/* set initial ref count */
-	msg->ref_count = 1;
-	myqtt_mutex_create (&(msg->mutex));
-
 	/* report the message type and qos */
 	msg->type    = msg_type;
 	msg->qos     = (header[0] & 0x06) >> 1;
@@ -814,8 +1160,7 @@ MyQttMsg * myqtt_msg_get_next     (MyQttConn * connection)
 	/* check qos value here */
 	if (msg->qos < MYQTT_QOS_0 || msg->qos > MYQTT_QOS_2) {
 		__myqtt_conn_shutdown_and_record_error (connection, MyQttProtocolError, "Received a message with an unsupported QoS. It is not 0, 1 nor 2");
-		myqtt_mutex_destroy (&(msg->mutex));
-		axl_free (msg);
+		__myqtt_msg_release (ctx, msg);
 		return NULL;
 	} /* end if */
 	
@@ -826,8 +1171,7 @@ MyQttMsg * myqtt_msg_get_next     (MyQttConn * connection)
 		/* call defined on header */
 		if (! ctx->on_header (ctx, connection, msg, ctx->on_header_data)) {
 			__myqtt_conn_shutdown_and_record_error (connection, MyQttConnectionForcedClose, "On header rejected message, closing connection");
-			myqtt_mutex_destroy (&(msg->mutex));
-			axl_free (msg);
+			__myqtt_msg_release (ctx, msg);
 			return NULL;
 		} /* end if */
 		/* message accepted by on header */
@@ -848,8 +1192,12 @@ MyQttMsg * myqtt_msg_get_next     (MyQttConn * connection)
 		return msg;
 	} /* end if */
 
-	/* allocate exactly msg->size + 1 bytes */
-	buffer = malloc (sizeof (unsigned char) * msg->size + 1);
+	/* small payloads are placed inside the msg, otherwise
+	 * allocate exactly msg->size + 1 bytes */
+	if (msg->size < MYQTT_MSG_INLINE_SIZE)
+		buffer = msg->inline_buffer;
+	else
+		buffer = malloc (sizeof (unsigned char) * msg->size + 1);
 	MYQTT_CHECK_REF2 (buffer, NULL, msg, axl_free);
 	
 	/* read the next msg content */
@@ -858,11 +1206,11 @@ MyQttMsg * myqtt_msg_get_next     (MyQttConn * connection)
 		__myqtt_conn_shutdown_and_record_error (
 			connection, MyQttProtocolError, "remote peer have closed connection while reading the rest of the msg");
 
+		/* unref buffer allocated */
+		__myqtt_msg_free_buffer (msg, buffer);
+
 		/* unref msg node allocated */
 		myqtt_msg_free (msg);
-
-		/* unref buffer allocated */
-		axl_free (buffer);
 		return NULL;
 	} /* end if */
 
@@ -1144,20 +1492,11 @@ axl_bool             myqtt_msg_send_raw     (MyQttConn * connection, const unsig
  */
 axl_bool           myqtt_msg_ref                   (MyQttMsg * msg)
 {
-	int result;
-
 	/* check reference received */
 	v_return_val_if_fail (msg, axl_false);
 
-	myqtt_mutex_lock (&msg->mutex);
-
 	/* increase the msg counting */
-	msg->ref_count++;
-	result = msg->ref_count;
-
-	myqtt_mutex_unlock (&msg->mutex);
-
-	return (result > 1);
+	return (myqtt_atomic_add (&msg->ref_count, 1) > 1);
 }
 
 /** 
@@ -1170,21 +1509,11 @@ axl_bool           myqtt_msg_ref                   (MyQttMsg * msg)
  */
 void          myqtt_msg_unref                 (MyQttMsg * msg)
 {
-	axl_bool release;
-
 	if (msg == NULL)
 		return;
 
-	myqtt_mutex_lock (&msg->mutex);
-	
-	/* decrease reference counting */
-	msg->ref_count--;
-	release = (msg->ref_count == 0);
-
-	myqtt_mutex_unlock (&msg->mutex);
-
-	/* check and dealloc */
-	if (release) 
+	/* decrease reference counting and check and dealloc */
+	if (myqtt_atomic_add (&msg->ref_count, -1) == 0) 
 		myqtt_msg_free (msg);
 	
 	return;
@@ -1201,14 +1530,9 @@ void          myqtt_msg_unref                 (MyQttMsg * msg)
  */
 int           myqtt_msg_ref_count             (MyQttMsg * msg)
 {
-	int value;
-
 	v_return_val_if_fail (msg, -1);
-	myqtt_mutex_lock (&msg->mutex);
-	value = msg->ref_count;
-	myqtt_mutex_unlock (&msg->mutex);
 
-	return value;
+	return myqtt_atomic_get (&msg->ref_count);
 }
 
 
@@ -1229,6 +1553,7 @@ int           myqtt_msg_ref_count             (MyQttMsg * msg)
 void          _myqtt_msg_free (MyQttMsg * msg, const char * caller)
 {
 	axlPointer ref;
+	MyQttCtx * ctx;
 
 	if (msg == NULL)
 		return;
@@ -1238,7 +1563,7 @@ void          _myqtt_msg_free (MyQttMsg * msg, const char * caller)
 	if (msg->buffer != NULL) {
 		ref = (axlPointer) msg->buffer;
 		msg->buffer = NULL;
-		axl_free (ref);
+		__myqtt_msg_free_buffer (msg, ref);
 	} else {
 		if (msg->payload != NULL) {
 			ref = (axlPointer) msg->payload;
@@ -1247,18 +1572,21 @@ void          _myqtt_msg_free (MyQttMsg * msg, const char * caller)
 		}
 	} /* end if */
 
-	/* release topic name if defined */
+	/* release topic name if defined (views point into the
+	 * buffer released above) */
 	if (msg->topic_name) {
 		ref = msg->topic_name;
 		msg->topic_name = NULL;
-		axl_free (ref);
+		if (! msg->topic_name_view)
+			axl_free (ref);
 	}
 
-	/* release reference to the context */
-	myqtt_ctx_unref2 (&msg->ctx, "end msg");
-
-	/* free the msg node itself */
-	axl_free (msg);
+	/* return the msg node itself to the free list and then
+	 * release reference to the context */
+	ctx      = msg->ctx;
+	msg->ctx = NULL;
+	__myqtt_msg_release (ctx, msg);
+	myqtt_ctx_unref2 (&ctx, "end msg");
 	return;
 }
 
@@ -1324,6 +1652,27 @@ const char *      myqtt_msg_get_topic    (MyQttMsg * msg)
 	return msg->topic_name;
 }
 
+/** 
+ * @brief Allows to get the topic name length (in bytes) of the
+ * provided PUBLISH message, without having to call strlen over
+ * myqtt_msg_get_topic.
+ *
+ * The topic name of a received message points into the message
+ * buffer (it is not copied), so it is only valid while the message
+ * is. Copy it if you need to keep it.
+ *
+ * @param msg The message where the operation takes place.
+ *
+ * @return Topic name length or -1 if it fails.
+ */
+int               myqtt_msg_get_topic_size (MyQttMsg * msg)
+{
+	if (msg == NULL || msg->type != MYQTT_PUBLISH || msg->topic_name == NULL)
+		return -1;
+
+	return msg->topic_name_size;
+}
+
 /** 
  * @brief Allows to get application message inside the provided
  * message (only for \ref MYQTT_PUBLISH type).
@@ -1378,7 +1727,10 @@ axl_bool          myqtt_msg_get_dup_flag (MyQttMsg * msg)
  *
  * For PUBLISH (\ref MYQTT_PUBLISH) message types, you can use \ref
  * myqtt_msg_get_app_msg and \ref myqtt_msg_get_app_msg_size to get a
- * reference to the application message.
+ * reference to the application message. Note that on received
+ * PUBLISH messages the topic name inside the variable header is
+ * rewritten in place as a NUL terminated string (see \ref
+ * myqtt_msg_get_topic).
  * 
  * Return actual msg payload. You must not free returned reference.
  *
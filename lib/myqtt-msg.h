@@ -94,6 +94,8 @@ int           myqtt_msg_get_app_msg_size      (MyQttMsg * msg);
 
 const char *      myqtt_msg_get_topic    (MyQttMsg * msg);
 
+int               myqtt_msg_get_topic_size (MyQttMsg * msg);
+
 const axlPointer  myqtt_msg_get_app_msg  (MyQttMsg * msg);
 
 MyQttQos          myqtt_msg_get_qos (MyQttMsg * msg);
@@ -107,6 +109,61 @@ int      myqtt_msg_decode_remaining_length (MyQttCtx * ctx, unsigned char * inpu
 
 int      __myqtt_msg_get_next_id (MyQttCtx * ctx, char  * from);
 
+/** 
+ * @internal Size of PUBACK, PUBREC, PUBREL, PUBCOMP, UNSUBACK and
+ * CONNACK packets.
+ */
+#define MYQTT_MSG_ACK_SIZE 4
+
+int      myqtt_msg_encode_publish  (MyQttCtx            * ctx,
+				    unsigned char       * buffer,
+				    int                   buffer_size,
+				    axl_bool              dup,
+				    MyQttQos              qos,
+				    axl_bool              retain,
+				    int                   packet_id,
+				    const char          * topic_name,
+				    int                   topic_name_size,
+				    const unsigned char * app_msg,
+				    int                   app_msg_size);
+
+unsigned char * myqtt_msg_build_publish (MyQttCtx            * ctx,
+					 axl_bool              dup,
+					 MyQttQos              qos,
+					 axl_bool              retain,
+					 int                   packet_id,
+					 const char          * topic_name,
+					 const unsigned char * app_msg,
+					 int                   app_msg_size,
+					 int                 * size);
+
+int      myqtt_msg_encode_ack      (MyQttCtx       * ctx,
+				    unsigned char  * buffer,
+				    int              buffer_size,
+				    MyQttMsgType     type,
+				    int              packet_id);
+
+int      myqtt_msg_encode_suback   (MyQttCtx            * ctx,
+				    unsigned char       * buffer,
+				    int                   buffer_size,
+				    int                   packet_id,
+				    const unsigned char * return_codes,
+				    int                   return_codes_num);
+
+int      myqtt_msg_encode_connack  (MyQttCtx        * ctx,
+				    unsigned char   * buffer,
+				    int               buffer_size,
+				    axl_bool          session_present,
+				    int               return_code);
+
+int      myqtt_msg_encode_pingresp (MyQttCtx       * ctx,
+				    unsigned char  * buffer,
+				    int              buffer_size);
+
+MyQttMsg * __myqtt_msg_new         (MyQttCtx * ctx);
+
+void     __myqtt_msg_pool_cleanup (MyQttCtx * ctx);
+
 /* @} */
 
 #endif
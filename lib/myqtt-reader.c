@@ -128,6 +128,46 @@ char * __myqtt_reader_get_utf8_string (MyQttCtx * ctx, const unsigned char * pay
 	return result;
 }
 
+/** 
+ * @internal Like __myqtt_reader_get_utf8_string but without copying:
+ * the string is moved two bytes back over its own length prefix and
+ * NUL terminated there, so the returned reference points into the
+ * provided payload and lives as long as it.
+ *
+ * @param ctx The context where the operation will take place.
+ *
+ * @param payload The payload where it is expected to find a MQTT
+ * utf-8 encoded string. It is modified.
+ *
+ * @param limit Bytes available at payload.
+ *
+ * @param length Optional reference where the string length is
+ * reported.
+ */
+char * __myqtt_reader_get_utf8_view (MyQttCtx * ctx, unsigned char * payload, int limit, int * length)
+{
+	int    size;
+
+	if (payload == NULL || limit < 2)
+		return NULL;
+
+	/* get the length to read */
+	size = myqtt_get_16bit (payload);
+	if (size > (limit - 2)) {
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Requested to read an utf-8 string of length %d but limit is %d", size, limit - 2);
+		return NULL;
+	} /* end if */
+
+	/* place the string at the start and terminate it where its
+	 * last two bytes were */
+	memmove (payload, payload + 2, size);
+	payload[size] = 0;
+
+	if (length)
+		(*length) = size;
+	return (char *) payload;
+}
+
 typedef struct _MyQttReaderAsyncData {
 
 	MyQttMsg            * msg;
@@ -300,7 +340,7 @@ axl_bool __myqtt_reader_check_client_id (MyQttCtx * ctx, MyQttConn * conn, MyQtt
 
 	/* register client identifier */
 	axl_hash_insert_full (ctx->client_ids, 
-			      axl_strdup (conn->client_identifier), axl_free,
+			      myqtt_support_intern (ctx, conn->client_identifier), myqtt_support_intern_release,
 			      conn, NULL);
 
 	/* not found, everything ok */
@@ -315,6 +355,10 @@ void __myqtt_reader_move_offline_to_online_aux (MyQttCtx * ctx, MyQttConn * conn
 	const char    * topic_filter;
 	axlHash       * sub_hash;
 
+	/* subscription hash not created */
+	if (hash == NULL)
+		return;
+
 	/* CONTEXT: lock subscribtions to remove connection subscription */
 	myqtt_mutex_lock (&ctx->subs_m);
 
@@ -351,7 +395,7 @@ void __myqtt_reader_move_offline_to_online (MyQttCtx * ctx, MyQttConn * conn)
 {
 	/* nothing to unsubscribe from offline because there is
 	 * nothing online */
-	if (axl_hash_items (conn->subs) == 0 && axl_hash_items (conn->wild_subs) == 0)
+	if (__myqtt_conn_hash_items (conn->subs) == 0 && __myqtt_conn_hash_items (conn->wild_subs) == 0)
 		return;
 
 	/* move offline subscriptions to online subs */
@@ -362,6 +406,57 @@ void __myqtt_reader_move_offline_to_online (MyQttCtx * ctx, MyQttConn * conn)
 	return;
 }
 
+void __myqtt_reader_remove_offline_subs_aux (MyQttCtx * ctx, const char * client_identifier, axlHash * offline_hash)
+{
+	axlHashCursor * cursor;
+	axlHash       * sub_hash;
+
+	/* remove client identifier from all offline subscriptions */
+	cursor = axl_hash_cursor_new (offline_hash);
+	while (axl_hash_cursor_has_item (cursor)) {
+		sub_hash = axl_hash_cursor_get_value (cursor);
+		if (sub_hash)
+			axl_hash_remove (sub_hash, (axlPointer) client_identifier);
+
+		/* delete sub hash if it is not storing any item */
+		if (sub_hash == NULL || axl_hash_items (sub_hash) == 0) {
+			axl_hash_cursor_remove (cursor);
+			continue;
+		} /* end if */
+
+		/* go for the next registry */
+		axl_hash_cursor_next (cursor);
+	} /* end while */
+	axl_hash_cursor_free (cursor);
+
+	return;
+}
+
+/** 
+ * @internal Removes all offline subscriptions registered for the
+ * provided client identifier (used when its session expires).
+ */
+void __myqtt_reader_remove_offline_subs (MyQttCtx * ctx, const char * client_identifier)
+{
+	if (ctx->offline_subs == NULL || ctx->offline_wild_subs == NULL)
+		return;
+
+	/* CONTEXT: lock subscribtions to remove client subscriptions */
+	myqtt_mutex_lock (&ctx->subs_m);
+
+	/* check no publish operation is taking place now */
+	while (ctx->publish_ops > 0)
+		myqtt_cond_timedwait (&ctx->subs_c, &ctx->subs_m, 10000);
+
+	__myqtt_reader_remove_offline_subs_aux (ctx, client_identifier, ctx->offline_subs);
+	__myqtt_reader_remove_offline_subs_aux (ctx, client_identifier, ctx->offline_wild_subs);
+
+	/* release lock */
+	myqtt_mutex_unlock (&ctx->subs_m);
+
+	return;
+}
+
 void __myqtt_reader_handle_connect (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg, axlPointer user_data) 
 {
 	/** 
@@ -549,6 +644,10 @@ void __myqtt_reader_recover_retained_message (MyQttCtx * ctx, MyQttConn * conn,
 	const char    * topic_name;
 	axl_bool        have_wild_cards;
 
+	/* wait for retained messages handed off to the storage
+	 * writer, so the subscriber gets the last value */
+	__myqtt_storage_writer_wait (ctx, &ctx->storage_writer_retained);
+
 	/* recover message with direct topic_filter */
 
 	/* get have wild card status */
@@ -618,28 +717,46 @@ void __myqtt_reader_recover_retained_message (MyQttCtx * ctx, MyQttConn * conn,
  *
  * @param qos The qos that is going to configured.
  *
+ * Topic filters and client identifiers stored in the subscription
+ * tables are interned (see myqtt_support_intern) so a topic filter
+ * used by many connections is only stored once.
  */
-void __myqtt_reader_subscribe (MyQttCtx * ctx, const char * client_identifier, MyQttConn * conn,  char * topic_filter, MyQttQos qos, axl_bool __is_offline)
+void __myqtt_reader_subscribe (MyQttCtx * ctx, const char * client_identifier, MyQttConn * conn,  char * __topic_filter, MyQttQos qos, axl_bool __is_offline)
 {
 	axlHash   * hash;
 	axlHash   * sub_hash;
-	axl_bool    should_release = axl_true;
+	char      * topic_filter;
 
-	if (ctx == NULL || topic_filter == NULL)
+	if (ctx == NULL || __topic_filter == NULL)
 		return;
 
 	/* if it is not an offline operation, check conn reference */
-	if (! __is_offline && conn == NULL)
+	if (! __is_offline && conn == NULL) {
+		axl_free (__topic_filter);
+		return;
+	} /* end if */
+
+	/* get shared copy: this reference is released at the end,
+	 * every table below acquires its own */
+	topic_filter = myqtt_support_intern (ctx, __topic_filter);
+	axl_free (__topic_filter);
+	if (topic_filter == NULL)
 		return;
 
 	if (! __is_offline) {
 		/** CONNECTION REGISTRY **/
 		/* reached this point, subscription is accepted */
 		myqtt_mutex_lock (&conn->op_mutex);
-		if ((strstr (topic_filter, "#") != NULL) || (strstr (topic_filter, "+") != NULL))
-			axl_hash_insert_full (conn->wild_subs, (axlPointer) topic_filter, axl_free, INT_TO_PTR (qos), NULL);
-		else
-			axl_hash_insert_full (conn->subs, (axlPointer) topic_filter, axl_free, INT_TO_PTR (qos), NULL);
+		if ((strstr (topic_filter, "#") != NULL) || (strstr (topic_filter, "+") != NULL)) {
+			/* created on first subscription */
+			if (conn->wild_subs == NULL)
+				conn->wild_subs = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+			axl_hash_insert_full (conn->wild_subs, myqtt_support_intern (ctx, topic_filter), myqtt_support_intern_release, INT_TO_PTR (qos), NULL);
+		} else {
+			if (conn->subs == NULL)
+				conn->subs = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+			axl_hash_insert_full (conn->subs, myqtt_support_intern (ctx, topic_filter), myqtt_support_intern_release, INT_TO_PTR (qos), NULL);
+		} /* end if */
 		myqtt_mutex_unlock (&conn->op_mutex);
 	} /* end if */
 
@@ -670,13 +787,12 @@ void __myqtt_reader_subscribe (MyQttCtx * ctx, const char * client_identifier, M
 		 * connections to do the delivery directly */
 		if (__is_offline) { /* offline */
 			sub_hash       = axl_hash_new (axl_hash_string, axl_hash_equal_string);
-			should_release = axl_false;
 		} else {  /* online*/
 			sub_hash       = axl_hash_new (axl_hash_int, axl_hash_equal_int);
 		}
 		axl_hash_insert_full (hash, 
 				      /* key and destroy */
-				      __is_offline ? topic_filter : axl_strdup (topic_filter), axl_free, 
+				      myqtt_support_intern (ctx, topic_filter), myqtt_support_intern_release,
 				      /* value and destroy */
 				      sub_hash, (axlDestroyFunc) axl_hash_free);
 		myqtt_log (MYQTT_LEVEL_DEBUG, "  ..created hash for topic_filter='%s' is %p", topic_filter, sub_hash);
@@ -685,7 +801,7 @@ void __myqtt_reader_subscribe (MyQttCtx * ctx, const char * client_identifier, M
 	/* record this connection and requested qos */
 	if (__is_offline) {
 		myqtt_log (MYQTT_LEVEL_DEBUG, "   ..storing client id %s with qos %d client id hash %p for topic_filter='%s'", client_identifier, qos, sub_hash, topic_filter);
-		axl_hash_insert_full (sub_hash, strdup (client_identifier), axl_free, INT_TO_PTR (qos), NULL);
+		axl_hash_insert_full (sub_hash, myqtt_support_intern (ctx, client_identifier), myqtt_support_intern_release, INT_TO_PTR (qos), NULL);
 	} else {
 		myqtt_log (MYQTT_LEVEL_DEBUG, "   ..storing connection %p with qos %d on conn hash %p for topic_filter='%s'", conn, qos, sub_hash, topic_filter);
 		axl_hash_insert (sub_hash, conn, INT_TO_PTR (qos));
@@ -698,10 +814,8 @@ void __myqtt_reader_subscribe (MyQttCtx * ctx, const char * client_identifier, M
 	   client */
 	__myqtt_reader_recover_retained_message (ctx, conn, topic_filter);
 
-	if (__is_offline && should_release) {
-		/* if offline and the hash was created, this reference then must be released */
-		axl_free (topic_filter);
-	} /* end if */
+	/* release our reference */
+	myqtt_support_intern_release (topic_filter);
 
 	return;
 }
@@ -840,10 +954,10 @@ void __myqtt_reader_handle_subscribe (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg
 	char                   * topic_filter;
 	MyQttQos                 qos;
 	int                      desp;
-	int                    * replies_mem = NULL;
+	unsigned char          * replies_mem = NULL;
 	int                      replies = 0;
 	unsigned char          * reply;
-	int                      iterator;
+	int                      size;
 
 	/* check if this is a listener */
 	if (conn->role != MyQttRoleListener) {
@@ -920,9 +1034,9 @@ void __myqtt_reader_handle_subscribe (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg
 			qos = ctx->on_subscribe (ctx, conn, topic_filter, qos, ctx->on_subscribe_data);
 
 		if (replies_mem == NULL) 
-			replies_mem = axl_new (int, 1);
+			replies_mem = axl_new (unsigned char, 1);
 		else
-			replies_mem = realloc (replies_mem, sizeof (int) * (replies + 1));
+			replies_mem = realloc (replies_mem, sizeof (unsigned char) * (replies + 1));
 
 		/* increase replies */
 		replies ++;
@@ -951,7 +1065,8 @@ void __myqtt_reader_handle_subscribe (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg
 	} /* end while */
 
 	/* build reply SUBACK */
-	reply = axl_new (unsigned char, replies + 4);
+	size  = myqtt_msg_encode_suback (ctx, NULL, 0, packet_id, replies_mem, replies);
+	reply = size > 0 ? axl_new (unsigned char, size) : NULL;
 	if (reply == NULL) {
 		myqtt_log (MYQTT_LEVEL_CRITICAL, "Unable to allocate memory to handle SUBACK reply from conn-id=%d from %s:%s", 
 			   conn->id, conn->host, conn->port);
@@ -962,25 +1077,8 @@ void __myqtt_reader_handle_subscribe (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg
 
 	} /* end if */
 	
-	/* configure header */
-	reply[0] = (( 0x00000f & MYQTT_SUBACK) << 4);
-
-	/* configure remaining length */
-	desp     = 0;
-	myqtt_msg_encode_remaining_length (ctx, reply + 1, replies + 2, &desp);
-
-	/* set packet id in reply */
-	/* myqtt_log (MYQTT_LEVEL_DEBUG, "Saving packet id %d on desp=%d", packet_id, desp + 1); */
-	myqtt_set_16bit (packet_id, reply + desp + 1);
-	desp   += 2;
-	
-	/* configure all subscription replies */
-	iterator = 0;
-	while (iterator < replies) {
-		reply[desp + iterator + 1] = replies_mem[iterator];
-		/* myqtt_log (MYQTT_LEVEL_DEBUG, "Saving sub reply %d on byte %d", replies_mem[iterator], desp+ iterator); */
-		iterator++;
-	} /* end if */
+	/* configure header, packet id and all subscription replies */
+	myqtt_msg_encode_suback (ctx, reply, size, packet_id, replies_mem, replies);
 
 	/* myqtt_show_byte (ctx, reply[0], "header");
 	   myqtt_show_byte (ctx, reply[1], "re.len");
@@ -992,7 +1090,7 @@ void __myqtt_reader_handle_subscribe (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg
 	axl_free (replies_mem);
 
 	/* send message */
-	if (! myqtt_sequencer_send (conn, MYQTT_SUBACK, reply, replies + 4))
+	if (! myqtt_sequencer_send (conn, MYQTT_SUBACK, reply, size))
 		myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to send SUBACK message, errno=%d", errno);
 
 	myqtt_log (MYQTT_LEVEL_DEBUG, "Sent SUBACK reply to conn-id=%d at %s:%s..", conn->id, conn->host, conn->port);
@@ -1006,6 +1104,10 @@ void __myqtt_reader_move_online_to_offline_aux (MyQttCtx * ctx, MyQttConn * conn
 	const char    * topic_filter;
 	MyQttQos        qos;
 
+	/* subscription hash not created */
+	if (hash == NULL)
+		return;
+
 	/* move online subscriptions to offline subs */
 	cursor = axl_hash_cursor_new (hash);
 	while (axl_hash_cursor_has_item (cursor)) {
@@ -1027,7 +1129,7 @@ void __myqtt_reader_move_online_to_offline_aux (MyQttCtx * ctx, MyQttConn * conn
 void __myqtt_reader_move_online_to_offline (MyQttCtx * ctx, MyQttConn * conn)
 {
 	/* skip step if no subscription is found */
-	if (axl_hash_items (conn->subs) == 0 && axl_hash_items (conn->wild_subs) == 0)
+	if (__myqtt_conn_hash_items (conn->subs) == 0 && __myqtt_conn_hash_items (conn->wild_subs) == 0)
 		return;
 
 	/* move online subscriptions to offline subs */
@@ -1072,6 +1174,7 @@ void __myqtt_reader_handle_disconnect (MyQttCtx * ctx, MyQttMsg * msg, MyQttConn
 void __myqtt_reader_handle_wait_reply (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg, axlPointer _data)
 {
 	MyQttAsyncQueue        * queue;
+	axlHash                * hash;
 
  	/* check if this is a listener */
 	if (conn->role != MyQttRoleInitiator) {
@@ -1158,11 +1261,14 @@ void __myqtt_reader_handle_wait_reply (MyQttCtx * ctx, MyQttConn * conn, MyQttMs
 		 *
 		 */
 		if (msg->type == MYQTT_PUBREL)
-			queue = axl_hash_get (conn->peer_wait_replies, INT_TO_PTR (msg->packet_id));
+			hash = conn->peer_wait_replies;
 		else {
 			/* rest of replies uses conn->wait_replies */
-			queue = axl_hash_get (conn->wait_replies, INT_TO_PTR (msg->packet_id));
+			hash = conn->wait_replies;
 		}
+
+		/* hashes are created on demand: no hash, no wait reply */
+		queue = hash ? axl_hash_get (hash, INT_TO_PTR (msg->packet_id)) : NULL;
 	}
 
 	/* acquire a reference to the queue during the push operation */
@@ -1213,7 +1319,7 @@ void __myqtt_reader_handle_unsubscribe (MyQttCtx * ctx, MyQttConn * conn, MyQttM
 	char                   * topic_filter;
 	int                      desp = 0;
 	axlHash                * sub_hash;
-	unsigned char          * reply;
+	unsigned char            reply[MYQTT_MSG_ACK_SIZE];
 	int                      size;
 
 	/* check if this is a listener */
@@ -1274,9 +1380,10 @@ void __myqtt_reader_handle_unsubscribe (MyQttCtx * ctx, MyQttConn * conn, MyQttM
 
 		/* CONNECTION CONTEXT: remove subscription from the connection */
 		myqtt_mutex_lock (&conn->op_mutex);
-		if ((strstr (topic_filter, "#") != NULL) || (strstr (topic_filter, "+") != NULL))
-			axl_hash_remove (conn->wild_subs, topic_filter);
-		else
+		if ((strstr (topic_filter, "#") != NULL) || (strstr (topic_filter, "+") != NULL)) {
+			if (conn->wild_subs)
+				axl_hash_remove (conn->wild_subs, topic_filter);
+		} else if (conn->subs)
 			axl_hash_remove (conn->subs, topic_filter);
 		myqtt_mutex_unlock (&conn->op_mutex);
 
@@ -1318,19 +1425,10 @@ void __myqtt_reader_handle_unsubscribe (MyQttCtx * ctx, MyQttConn * conn, MyQttM
 	} /* end if */
 
 	/* send reply */
-	reply = myqtt_msg_build (ctx, MYQTT_UNSUBACK, axl_false, 0, axl_false, &size, /* 2 bytes */
-				 MYQTT_PARAM_16BIT_INT, packet_id,
-				 MYQTT_PARAM_END);
-	if (reply == NULL) {
-		myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to allocate memory required for UNSUBSCRIBE reply for conn-id=%d from %s:%s, closing connection..", 
-			   conn->id, conn->host, conn->port);
-		myqtt_conn_shutdown (conn);
-			
-		return;
-	} /* end if */
+	size = myqtt_msg_encode_ack (ctx, reply, MYQTT_MSG_ACK_SIZE, MYQTT_UNSUBACK, packet_id);
 
 	/* send message */
-	if (! myqtt_sequencer_send (conn, MYQTT_UNSUBACK, reply, size))
+	if (! myqtt_sequencer_send_inline (conn, MYQTT_UNSUBACK, reply, size))
 		myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to send UNSUBACK message, errno=%d", errno);
 
 	myqtt_log (MYQTT_LEVEL_DEBUG, "Sent UNSUBACK reply to conn-id=%d at %s:%s..", conn->id, conn->host, conn->port);
@@ -1341,14 +1439,55 @@ void __myqtt_reader_handle_unsubscribe (MyQttCtx * ctx, MyQttConn * conn, MyQttM
 	return;
 }
 
-void __myqtt_reader_queue_offline (MyQttCtx * ctx, MyQttMsg * msg, axlHash * sub_hash)
+/** 
+ * @internal Offline publish handed off to the storage writer.
+ */
+typedef struct _MyQttReaderOfflinePub {
+	char     * client_identifier;
+	MyQttQos   qos;
+} MyQttReaderOfflinePub;
+
+axl_bool __myqtt_reader_queue_offline_job (MyQttCtx * ctx, axlPointer _msg, axlPointer _data)
+{
+	MyQttMsg              * msg  = _msg;
+	MyQttReaderOfflinePub * data = _data;
+
+	if (! myqtt_conn_offline_pub (ctx, data->client_identifier, msg->topic_name, (axlPointer) msg->app_message, msg->app_message_size, data->qos, axl_false)) {
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to queue offline PUBLISH message for client id %s", data->client_identifier);
+		__myqtt_metrics_add (ctx, MYQTT_METRIC_MSGS_DROPPED, 1);
+		return axl_false;
+	} /* end if */
+
+	__myqtt_metrics_add (ctx, MYQTT_METRIC_MSGS_QUEUED, 1);
+	return axl_true;
+}
+
+void __myqtt_reader_queue_offline_done (MyQttCtx * ctx, axl_bool status, axlPointer _msg, axlPointer _data)
+{
+	MyQttReaderOfflinePub * data = _data;
+
+	/* release references acquired to queue the operation */
+	myqtt_msg_unref ((MyQttMsg *) _msg);
+	axl_free (data->client_identifier);
+	axl_free (data);
+	return;
+}
+
+/** 
+ * @internal Queues the message for all offline subscriptions found
+ * in sub_hash, returning how many were found.
+ */
+int  __myqtt_reader_queue_offline (MyQttCtx * ctx, MyQttMsg * msg, axlHash * sub_hash)
 {
+	MyQttReaderOfflinePub * data;
+
 	axlHashCursor * cursor;
 	const char    * client_identifier;
 	MyQttQos        qos;
+	int             count = 0;
 
 	if (! sub_hash)
-		return;
+		return 0;
 
 	/* found topic registered, now iterate over all
 	 * registered connections to send the message */
@@ -1370,8 +1509,29 @@ void __myqtt_reader_queue_offline (MyQttCtx * ctx, MyQttMsg * msg, axlHash * sub
 		/* publish message */
 		myqtt_log (MYQTT_LEVEL_DEBUG, "Publishing offline topic name '%s', qos: %d (app msg size: %d) on client id session %p", 
 			   msg->topic_name, qos, msg->app_message_size, client_identifier);
-		if (! myqtt_conn_offline_pub (ctx, client_identifier, msg->topic_name, (axlPointer) msg->app_message, msg->app_message_size, qos, axl_false))
-			myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to send PUBLISH message, errno=%d", errno); 
+		if (ctx->storage_writer_started) {
+			/* hand off storage to the writer (the hash is
+			 * only stable during publish, so copy values) */
+			data = axl_new (MyQttReaderOfflinePub, 1);
+			if (data && myqtt_msg_ref (msg)) {
+				data->client_identifier = axl_strdup (client_identifier);
+				data->qos               = qos;
+				if (! myqtt_storage_writer_queue (ctx, __myqtt_reader_queue_offline_job, __myqtt_reader_queue_offline_done, msg, data)) {
+					__myqtt_reader_queue_offline_done (ctx, axl_false, msg, data);
+					__myqtt_metrics_add (ctx, MYQTT_METRIC_MSGS_DROPPED, 1);
+				} /* end if */
+			} else {
+				myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to queue offline PUBLISH message for client id %s (memory allocation failure)", client_identifier);
+				axl_free (data);
+				__myqtt_metrics_add (ctx, MYQTT_METRIC_MSGS_DROPPED, 1);
+			} /* end if */
+		} else if (! myqtt_conn_offline_pub (ctx, client_identifier, msg->topic_name, (axlPointer) msg->app_message, msg->app_message_size, qos, axl_false)) {
+			myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to send PUBLISH message, errno=%d", errno);
+			__myqtt_metrics_add (ctx, MYQTT_METRIC_MSGS_DROPPED, 1);
+		} else {
+			__myqtt_metrics_add (ctx, MYQTT_METRIC_MSGS_QUEUED, 1);
+		} /* end if */
+		count++;
 		
 		/* next item */
 		axl_hash_cursor_next (cursor);
@@ -1379,18 +1539,16 @@ void __myqtt_reader_queue_offline (MyQttCtx * ctx, MyQttMsg * msg, axlHash * sub
 
 	/* release cursor */
 	axl_hash_cursor_free (cursor);
-	return;
+	return count;
 }
 
 /** 
  * @internal Handle retained message (see if we have to store it,
  * release,..)
  */
-axl_bool __myqtt_reader_handle_retained_msg (MyQttCtx * ctx, MyQttMsg * msg)
+axl_bool __myqtt_reader_handle_retained_msg_job (MyQttCtx * ctx, axlPointer _msg, axlPointer user_data2)
 {
-	/* do nothing if retain flag is not set */
-	if (! msg->retain)
-		return axl_true;
+	MyQttMsg * msg = _msg;
 
 	if (msg->qos == MYQTT_QOS_0 || msg->app_message_size == 0) {
 		/* remove retained message if any */
@@ -1400,12 +1558,44 @@ axl_bool __myqtt_reader_handle_retained_msg (MyQttCtx * ctx, MyQttMsg * msg)
 
 	/* save message for later publication */
 	return myqtt_storage_retain_msg_set (ctx, msg->topic_name, msg->qos, msg->app_message, msg->app_message_size);
+}
+
+void __myqtt_reader_handle_retained_msg_done (MyQttCtx * ctx, axl_bool status, axlPointer _msg, axlPointer user_data2)
+{
+	/* release reference acquired to queue the operation */
+	myqtt_msg_unref ((MyQttMsg *) _msg);
+
+	/* let subscribers recovering retained messages continue */
+	myqtt_atomic_add (&ctx->storage_writer_retained, -1);
+	return;
+}
+
+axl_bool __myqtt_reader_handle_retained_msg (MyQttCtx * ctx, MyQttMsg * msg)
+{
+	/* do nothing if retain flag is not set */
+	if (! msg->retain)
+		return axl_true;
+
+	/* hand off storage to the writer if it is running */
+	if (ctx->storage_writer_started && myqtt_msg_ref (msg)) {
+		myqtt_atomic_add (&ctx->storage_writer_retained, 1);
+		if (! myqtt_storage_writer_queue (ctx, __myqtt_reader_handle_retained_msg_job, __myqtt_reader_handle_retained_msg_done, msg, NULL)) {
+			myqtt_atomic_add (&ctx->storage_writer_retained, -1);
+			myqtt_msg_unref (msg);
+			return axl_false;
+		} /* end if */
+		return axl_true;
+	} /* end if */
+
+	/* store or release now */
+	return __myqtt_reader_handle_retained_msg_job (ctx, msg, NULL);
 } /* end if */
 
 /** @internal call to do publish with the provided connection pointed
- * by the provided cursor and message
+ * by the provided cursor and message (returns axl_false if the
+ * connection was skipped)
  */
-void __myqtt_reader_do_publish_aux (MyQttCtx * ctx, axlHashCursor * cursor, MyQttMsg * msg)
+axl_bool __myqtt_reader_do_publish_aux (MyQttCtx * ctx, axlHashCursor * cursor, MyQttMsg * msg, MyQttConn * publisher)
 {
 	MyQttQos    qos;
 	MyQttConn * conn;
@@ -1415,7 +1605,7 @@ void __myqtt_reader_do_publish_aux (MyQttCtx * ctx, axlHashCursor * cursor, MyQt
 	
 	/* skip connection because it is not ok */
 	if (! myqtt_conn_is_ok (conn, axl_false)) 
-		return;
+		return axl_false;
 	
 	/* get qos to publish */
 	qos  = msg->qos;
@@ -1434,24 +1624,34 @@ void __myqtt_reader_do_publish_aux (MyQttCtx * ctx, axlHashCursor * cursor, MyQt
 		   msg->topic_name, qos, msg->app_message_size, conn);
 	
 	/* retain = axl_false always : MQTT-2.1.2-11 */
-	if (! myqtt_conn_pub (conn, msg->topic_name, (axlPointer) msg->app_message, msg->app_message_size, qos, axl_false, 60))
+	if (! myqtt_conn_pub (conn, msg->topic_name, (axlPointer) msg->app_message, msg->app_message_size, qos, axl_false, 60)) {
 		myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to publish message message, errno=%d", errno); 
+		__myqtt_metrics_add (ctx, MYQTT_METRIC_MSGS_DROPPED, 1);
+	} /* end if */
+
+	/* pause publisher reads if this subscriber can't keep up */
+	__myqtt_sequencer_check_backpressure (ctx, publisher, conn);
 	
-	return;
+	return axl_true;
 }
       
 
 /** 
- * @internal Fucntion to implement global publishing. ctx, conn and
- * msg must be defined.
+ * @internal Fucntion to implement global publishing. ctx and msg
+ * must be defined (conn is the publisher, if any). When offline is
+ * axl_false the message is not queued for offline subscriptions.
+ *
+ * Returns the number of subscribers the message was sent or queued
+ * to.
  */
-void __myqtt_reader_do_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg)
+int  __myqtt_reader_do_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg, axl_bool offline)
 {
 	axlHash                * sub_hash;
 	axlHashCursor          * cursor;
 	axlHashCursor          * cursor2;
 	const char             * topic_filter;
 	axl_bool                 someone_subscribed = axl_false;
+	int                      deliveries = 0;
 
 	/**** SERVER HANDLING ****
 	 *
@@ -1486,7 +1686,8 @@ void __myqtt_reader_do_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg
 		while (axl_hash_cursor_has_item (cursor)) {
 			
 			/* call to do publish */
-			__myqtt_reader_do_publish_aux (ctx, cursor, msg);
+			if (__myqtt_reader_do_publish_aux (ctx, cursor, msg, conn))
+				deliveries++;
 			someone_subscribed = axl_true;
 			
 			/* next item */
@@ -1518,7 +1719,8 @@ void __myqtt_reader_do_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg
 		while (axl_hash_cursor_has_item (cursor2)) {
 			
 			/* call to do publish */
-			__myqtt_reader_do_publish_aux (ctx, cursor2, msg);
+			if (__myqtt_reader_do_publish_aux (ctx, cursor2, msg, conn))
+				deliveries++;
 			someone_subscribed = axl_true;
 			
 			/* next connection */
@@ -1536,12 +1738,14 @@ void __myqtt_reader_do_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg
 	axl_hash_cursor_free (cursor);
 
 	/* publish on offline subs (if any) */
-	sub_hash = axl_hash_get (ctx->offline_subs, (axlPointer) msg->topic_name);
-	__myqtt_reader_queue_offline (ctx, msg, sub_hash);
+	if (offline) {
+		sub_hash    = axl_hash_get (ctx->offline_subs, (axlPointer) msg->topic_name);
+		deliveries += __myqtt_reader_queue_offline (ctx, msg, sub_hash);
+	} /* end if */
 
 	/* publish on offline wild subs */
 	cursor = axl_hash_cursor_new (ctx->offline_wild_subs);
-	while (axl_hash_cursor_has_item (cursor)) {
+	while (offline && axl_hash_cursor_has_item (cursor)) {
 		
 		/* get the topic filter and try a match */
 		topic_filter = axl_hash_cursor_get_key (cursor);
@@ -1554,7 +1758,7 @@ void __myqtt_reader_do_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg
 		/* filter matches, iterate the provided hash
 		 * to publish over all connections there */
 		sub_hash     = axl_hash_cursor_get_value (cursor);
-		__myqtt_reader_queue_offline (ctx, msg, sub_hash);
+		deliveries  += __myqtt_reader_queue_offline (ctx, msg, sub_hash);
 		someone_subscribed = axl_true;
 		
 		/* it doesn't match, go with the next */
@@ -1575,13 +1779,15 @@ void __myqtt_reader_do_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg
 	} /* end if */
 
 	/* finish don */
-	return;
+	return deliveries;
 }
 
 typedef struct __MyQttReaderOnwardDeliveryData {
-	MyQttMsg  * msg;
-	MyQttConn * conn;
-	MyQttCtx  * ctx;
+	MyQttMsg       * msg;
+	MyQttConn      * conn;
+	MyQttCtx       * ctx;
+	/* when the message was received (routing latency) */
+	struct timeval   stamp;
 } MyQttReaderOnwardDeliveryData;
 
 #if defined(ENABLE_INTERNAL_TRACE_CODE)
@@ -1630,6 +1836,7 @@ MyQttReaderOnwardDeliveryData * __myqtt_reader_prepare_delivery (MyQttCtx * ctx,
 	data->conn = conn;
 	data->ctx  = ctx;
 	data->msg  = msg;
+	gettimeofday (&data->stamp, NULL);
 
 	return data;
 }
@@ -1640,6 +1847,9 @@ axlPointer __myqtt_reader_initiate_onward_delivery (axlPointer _data)
 	MyQttConn                     * conn  = data->conn;
 	MyQttMsg                      * msg   = data->msg;
 	MyQttCtx                      * ctx   = data->ctx;
+	struct timeval                  stop;
+	struct timeval                  diff;
+	int                             deliveries;
 
 	if (conn->role == MyQttRoleInitiator) {
 		/**** CLIENT HANDLING **** 
@@ -1657,7 +1867,12 @@ axlPointer __myqtt_reader_initiate_onward_delivery (axlPointer _data)
 		 * we have received a publish package as server, notify to all subscribers */
 
 		/* call to do publish with all subscribers */
-		__myqtt_reader_do_publish (ctx, conn, msg);
+		deliveries = __myqtt_reader_do_publish (ctx, conn, msg, axl_true);
+
+		/* record fan-out and routing latency */
+		gettimeofday (&stop, NULL);
+		myqtt_timeval_substract (&stop, &data->stamp, &diff);
+		__myqtt_metrics_publish_add (ctx, deliveries, diff.tv_sec * 1000000 + diff.tv_usec);
 
 	} /* end if */
 
@@ -1677,14 +1892,16 @@ void __myqtt_reader_handle_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg *
 {
 	/* local variables */
 	int                              desp = 0;
-	unsigned char                  * reply;
+	unsigned char                    reply[MYQTT_MSG_ACK_SIZE];
 	MyQttMsg                       * response;
 	axl_bool                         have_wild_cards;
 	MyQttReaderOnwardDeliveryData  * data;
 	MyQttPublishCodes                pub_codes;
 
-	/* parse content received inside message */
-	msg->topic_name = __myqtt_reader_get_utf8_string (ctx, msg->payload, msg->size);
+	/* parse content received inside message: topic name is a
+	 * view into the message buffer (no copy) */
+	msg->topic_name      = __myqtt_reader_get_utf8_view (ctx, (unsigned char *) msg->payload, msg->size, &msg->topic_name_size);
+	msg->topic_name_view = axl_true;
 	if (! msg->topic_name ) {
 		myqtt_log (MYQTT_LEVEL_CRITICAL, "Received PUBLISH message without topic name closing conn-id=%d from %s:%s", conn->id, conn->host, conn->port);
 		myqtt_conn_shutdown (conn);
@@ -1702,14 +1919,14 @@ void __myqtt_reader_handle_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg *
 		return;
 	} /* end if */
 
-	if (! myqtt_support_is_utf8 (msg->topic_name, strlen (msg->topic_name))) {
+	if ((int) strlen (msg->topic_name) != msg->topic_name_size || ! myqtt_support_is_utf8 (msg->topic_name, msg->topic_name_size)) {
 		myqtt_log (MYQTT_LEVEL_CRITICAL, "Received PUBLISH message wrong UTF-8 encoding on topic name closing conn-id=%d from %s:%s", conn->id, conn->host, conn->port);
 		myqtt_conn_shutdown (conn);
 		return;
 	} /* end if */
 
 	/* increase desp */
-	desp       += (strlen (msg->topic_name) + 2);
+	desp       += (msg->topic_name_size + 2);
 
 	/* now, according to the qos, we have also a packet id */
 	if (msg->qos > MYQTT_QOS_0) {
@@ -1722,6 +1939,9 @@ void __myqtt_reader_handle_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg *
 	msg->app_message         = msg->payload + desp;
 	msg->app_message_size    = msg->size - desp;
 
+	/* account message received */
+	__myqtt_metrics_add (ctx, MYQTT_METRIC_MSGS_RECEIVED_QOS0 + msg->qos, 1);
+
 	myqtt_log (MYQTT_LEVEL_DEBUG, "PUBLISH: incoming publish request received (qos: %d, topic name: %s, packet id: %d, app msg size: %d, msg size: %d, conn-id=%d, conn=%p)",
 		   msg->qos, msg->topic_name, msg->packet_id, msg->app_message_size, msg->size, conn->id, conn);
 
@@ -1742,6 +1962,7 @@ void __myqtt_reader_handle_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg *
 			/* releaes message and return */
 			myqtt_log (MYQTT_LEVEL_WARNING, "On publish handler reported to discard msg-id=%d from conn-id=%d from %s:%s", 
 				   msg->id, conn->id, conn->host, conn->port);
+			__myqtt_metrics_add (ctx, MYQTT_METRIC_MSGS_DROPPED, 1);
 			return;
 		case MYQTT_PUBLISH_CONN_CLOSE:
 			/* connection close */
@@ -1783,23 +2004,8 @@ void __myqtt_reader_handle_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg *
 
 		/* save message localy */
 
-		/* configure header */
-		reply    = axl_new (unsigned char, 4);
-		if (reply == NULL) {
-			myqtt_log (MYQTT_LEVEL_CRITICAL, "PUBLISH: dropping publish request received (axl_new failed) (qos: %d, topic name: %s, packet id: %d, app msg size: %d, msg size: %d, conn-id=%d, conn=%p)",
-				   msg->qos, msg->topic_name, msg->packet_id, msg->app_message_size, msg->size, conn->id, conn);
-			return;
-		} /* end if */
-
-		/* prepare PUBREC reply */
-		reply[0] = (( 0x00000f & MYQTT_PUBREC) << 4);
-
-		/* configure remaining length */
-		reply[1] = 2;
-
-		/* set packet id in reply */
-		/* myqtt_log (MYQTT_LEVEL_DEBUG, "Saving packet id %d on desp=%d", packet_id, desp + 1); */
-		myqtt_set_16bit (msg->packet_id, reply + 2);
+			/* prepare PUBREC reply */
+		myqtt_msg_encode_ack (ctx, reply, MYQTT_MSG_ACK_SIZE, MYQTT_PUBREC, msg->packet_id);
 
 		/* prepare reply to receive: peer_ids = axl_true */
 		__myqtt_reader_prepare_wait_reply (conn, msg->packet_id, axl_true);
@@ -1808,7 +2014,7 @@ void __myqtt_reader_handle_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg *
 		myqtt_log (MYQTT_LEVEL_DEBUG, "Sending reply PUBCREC (%d) to packet-id=%d, conn-id=%d (%p)", 
 			   reply[1], msg->packet_id, conn->id, conn);
 
-		if (! myqtt_sequencer_send (conn, MYQTT_PUBREC, reply, 4)) {
+		if (! myqtt_sequencer_send_inline (conn, MYQTT_PUBREC, reply, MYQTT_MSG_ACK_SIZE)) {
 			/* release wait reply queue */
 			__myqtt_reader_remove_wait_reply (conn, msg->packet_id, axl_true);
 			
@@ -1823,6 +2029,7 @@ void __myqtt_reader_handle_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg *
 	if (data == NULL) {
 		myqtt_log (MYQTT_LEVEL_CRITICAL, "PUBLISH: dropping publish request received (__myqtt_reader_prepare_delivery failed) (qos: %d, topic name: %s, packet id: %d, app msg size: %d, msg size: %d, conn-id=%d, conn=%p)",
 			   msg->qos, msg->topic_name, msg->packet_id, msg->app_message_size, msg->size, conn->id, conn);
+		__myqtt_metrics_add (ctx, MYQTT_METRIC_MSGS_DROPPED, 1);
 		return; /* memory allocation failure */
 	} /* end if */
 
@@ -1872,23 +2079,7 @@ void __myqtt_reader_handle_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg *
 		} /* end if */
 
 		/* configure header to send PUBACK or PUBCOMP according to the QoS */
-		reply    = axl_new (unsigned char, 4);
-		if (reply == NULL) {
-			myqtt_log (MYQTT_LEVEL_CRITICAL, "PUBLISH: dropping/failed to continue publish request received (axl_new failed) (qos: %d, topic name: %s, packet id: %d, app msg size: %d, msg size: %d, conn-id=%d, conn=%p)",
-				   msg->qos, msg->topic_name, msg->packet_id, msg->app_message_size, msg->size, conn->id, conn);
-			return;
-		} /* end if */
-
-		if (msg->qos == MYQTT_QOS_1)
-			reply[0] = (( 0x00000f & MYQTT_PUBACK) << 4);
-		else
-			reply[0] = (( 0x00000f & MYQTT_PUBCOMP) << 4);
-
-		/* configure remaining length */
-		reply[1] = 2;
-
-		/* set packet id in reply */
-		myqtt_set_16bit (msg->packet_id, reply + 2);
+		myqtt_msg_encode_ack (ctx, reply, MYQTT_MSG_ACK_SIZE, (msg->qos == MYQTT_QOS_1) ? MYQTT_PUBACK : MYQTT_PUBCOMP, msg->packet_id);
 
 		/* send message */
 		myqtt_log (MYQTT_LEVEL_DEBUG, "Sending reply %s (%d) to packet-id=%d, conn-id=%d (%p)", 
@@ -1896,7 +2087,7 @@ void __myqtt_reader_handle_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg *
 
 		/* if (conn->role == MyQttRoleListener && msg->qos == MYQTT_QOS_2)
 		   printf ("PUBCOMP: sending PUBCOMP to conn-id=%d, conn=%p, ctx=%p,\n", conn->id, conn, ctx); */
-		if (! myqtt_sequencer_send (conn, (msg->qos == MYQTT_QOS_1) ? MYQTT_PUBACK : MYQTT_PUBCOMP, reply, 4))
+		if (! myqtt_sequencer_send_inline (conn, (msg->qos == MYQTT_QOS_1) ? MYQTT_PUBACK : MYQTT_PUBCOMP, reply, MYQTT_MSG_ACK_SIZE))
 			myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to send %s message, errno=%d", (msg->qos == MYQTT_QOS_1) ? "PUBACK" : "PUBCOMP", errno);
 
 		/* notification completed */
@@ -1908,7 +2099,7 @@ void __myqtt_reader_handle_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg *
 void __myqtt_reader_handle_pingreq (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg, axlPointer _data)
 {
 	/* local variables */
-	unsigned char          * reply;
+	unsigned char            reply[2];
 	int                      size;
 
 	/* check if this is a listener */
@@ -1919,18 +2110,11 @@ void __myqtt_reader_handle_pingreq (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg *
 		return;
 	} /* end if */
 
-	/* myqtt_msg_free_build (ctx, reply, size); */
-	reply = myqtt_msg_build (ctx, MYQTT_PINGRESP, axl_false, 0, axl_false, &size, /* 2 bytes */
-				 MYQTT_PARAM_END);
-	if (reply == NULL) {
-		myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to allocate memory required for PINGRESP reply for conn-id=%d from %s:%s, closing connection..", 
-			   conn->id, conn->host, conn->port);
-		myqtt_conn_shutdown (conn);
-		return;
-	} /* end if */
+	/* build reply */
+	size = myqtt_msg_encode_pingresp (ctx, reply, sizeof (reply));
 
 	/* send message */
-	if (! myqtt_sequencer_send (conn, MYQTT_PINGRESP, reply, size))
+	if (! myqtt_sequencer_send_inline (conn, MYQTT_PINGRESP, reply, size))
 		myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to send PINGRESP message, errno=%d", errno);
 
 	myqtt_log (MYQTT_LEVEL_DEBUG, "Sent PINGRESP reply to conn-id=%d at %s:%s..", conn->id, conn->host, conn->port);
@@ -2259,10 +2443,16 @@ void        __myqtt_reader_prepare_wait_reply (MyQttConn * conn, int packet_id,
 	/* register wait reply method */
 	myqtt_mutex_lock (&conn->op_mutex);
 
-	if (peer_ids)
+	/* wait reply hashes are created on demand */
+	if (peer_ids) {
+		if (conn->peer_wait_replies == NULL)
+			conn->peer_wait_replies = axl_hash_new (axl_hash_int, axl_hash_equal_int);
 		hash = conn->peer_wait_replies;
-	else
+	} else {
+		if (conn->wait_replies == NULL)
+			conn->wait_replies = axl_hash_new (axl_hash_int, axl_hash_equal_int);
 		hash = conn->wait_replies;
+	} /* end if */
 
 	/* check */
 	if (axl_hash_get (hash, INT_TO_PTR (packet_id)))
@@ -2301,7 +2491,7 @@ void        __myqtt_reader_remove_wait_reply (MyQttConn * conn, int packet_id, a
 		hash = conn->wait_replies;
 
 	/* get queue and remove it from the set of wait replies */
-	queue = axl_hash_get (hash, INT_TO_PTR (packet_id));
+	queue = hash ? axl_hash_get (hash, INT_TO_PTR (packet_id)) : NULL;
 	/** NOTE: you can remove here the queue: axl_hash_delete
 	    because it must be in the hash so the pusher finds it */
 
@@ -2350,7 +2540,7 @@ MyQttMsg  * __myqtt_reader_get_reply          (MyQttConn * conn, int packet_id,
 		hash = conn->wait_replies;
 
 	/* get queue and remove it from the set of wait replies */
-	queue = axl_hash_get (hash, INT_TO_PTR (packet_id));
+	queue = hash ? axl_hash_get (hash, INT_TO_PTR (packet_id)) : NULL;
 	/** NOTE: you can remove here the queue: axl_hash_delete
 	    because it must be in the hash so the pusher finds it */
 
@@ -2630,15 +2820,13 @@ void __myqtt_reader_check_and_trigger_will (MyQttCtx * ctx, MyQttConn * conn)
 		return;
 
 	/* prepare message */
-	msg = axl_new (MyQttMsg, 1);
+	msg = __myqtt_msg_new (ctx);
 	if (msg == NULL)
 		return;
 	
 	/* configure message */
 	msg->type      = MYQTT_PUBLISH;
 	msg->qos       = conn->will_qos;
-	msg->ref_count = 1;
-	myqtt_mutex_create (&(msg->mutex));
 	msg->id        = __myqtt_msg_get_next_id (ctx, "get-next");
 	msg->ctx       = ctx;
 
@@ -2653,9 +2841,10 @@ void __myqtt_reader_check_and_trigger_will (MyQttCtx * ctx, MyQttConn * conn)
 
 	/* configure topic */
 	msg->topic_name       = axl_strdup (conn->will_topic);
+	msg->topic_name_size  = msg->topic_name ? strlen (msg->topic_name) : 0;
 
 	/* call to publish */
-	__myqtt_reader_do_publish (ctx, conn, msg);
+	__myqtt_reader_do_publish (ctx, conn, msg, axl_true);
 
 	/* release message */
 	myqtt_msg_unref (msg);	
@@ -2675,7 +2864,7 @@ axlPointer __myqtt_reader_remove_conn_refs_aux (axlPointer _conn)
 	/* get context reference */
 	ctx = conn->ctx;
 
-	if (axl_hash_items (conn->subs) > 0) {
+	if (__myqtt_conn_hash_items (conn->subs) > 0) {
 		/* create cursor */
 		cursor = axl_hash_cursor_new (conn->subs);
 		axl_hash_cursor_first (cursor);
@@ -2695,7 +2884,7 @@ axlPointer __myqtt_reader_remove_conn_refs_aux (axlPointer _conn)
 		axl_hash_cursor_free (cursor);
 	} /* end if */
 
-	if (axl_hash_items (conn->wild_subs) > 0) {
+	if (__myqtt_conn_hash_items (conn->wild_subs) > 0) {
 		cursor = axl_hash_cursor_new (conn->wild_subs);
 		axl_hash_cursor_first (cursor);
 
@@ -2733,6 +2922,11 @@ void __myqtt_reader_remove_conn_refs (MyQttConn * conn)
 	axl_hash_remove (ctx->client_ids, conn->client_identifier); 
 	myqtt_mutex_unlock (&ctx->client_ids_m);
 
+	/* record when the persistent session was used for the last
+	 * time (only if session expiration is enabled) */
+	if (! conn->clean_session && conn->role == MyQttRoleListener)
+		__myqtt_storage_session_touch (ctx, conn->client_identifier);
+
 	/* skip any operation if we are about to finish */
 	if (ctx->myqtt_exit) {
 		/* connection isn't ok, unref it */
@@ -2832,8 +3026,8 @@ MYQTT_SOCKET __myqtt_reader_build_set_to_watch_aux (MyQttCtx     * ctx,
 		} /* end if */
 
 		/* check if the connection is blocked (no I/O read to
-		 * perform on it) */
-		if (myqtt_conn_is_blocked (connection)) {
+		 * perform on it) or paused by backpressure */
+		if (myqtt_conn_is_blocked (connection) || connection->backpressure_paused) {
 			/* myqtt_log (MYQTT_LEVEL_DEBUG, "connection id=%d has I/O read blocked (myqtt_conn_block)", 
 			   myqtt_conn_get_id (connection)); */
 			/* get the next */
@@ -3174,6 +3368,10 @@ axlPointer __myqtt_reader_run (MyQttCtx * ctx)
 	MYQTT_SOCKET      max_fds     = 0;
 	MYQTT_SOCKET      result;
 	int                error_tries = 0;
+	int                cpus_gen    = 0;
+
+	/* pin the reader (if configured) before allocating its state */
+	__myqtt_thread_check_cpus (ctx, MYQTT_THREAD_READER, &cpus_gen);
 
 	/* initialize the read set */
 	if (ctx->on_reading != NULL)
@@ -3199,6 +3397,9 @@ axlPointer __myqtt_reader_run (MyQttCtx * ctx)
 	}
 
 	while (axl_true) {
+		/* apply cpu set changes */
+		__myqtt_thread_check_cpus (ctx, MYQTT_THREAD_READER, &cpus_gen);
+
 		/* reset descriptor set */
 		myqtt_io_waiting_invoke_clear_fd_group (ctx, ctx->on_reading);
 
@@ -98,6 +98,10 @@ void               __myqtt_reader_subscribe (MyQttCtx   * ctx,
 
 void __myqtt_reader_move_offline_to_online  (MyQttCtx * ctx, MyQttConn * conn);
 
+void __myqtt_reader_remove_offline_subs     (MyQttCtx * ctx, const char * client_identifier);
+
+int  __myqtt_reader_do_publish              (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg, axl_bool offline);
+
 axl_bool myqtt_reader_is_wrong_topic  (const char * topic_filter);
 
 axl_bool myqtt_reader_topic_filter_match (const char * topic_name, const char * topic_filter);
@@ -44,6 +44,195 @@
 
 #define LOG_DOMAIN "myqtt-sequencer"
 
+/** 
+ * @internal Low watermark to use for the provided configuration:
+ * half the high watermark unless a lower value was configured.
+ */
+#define __MYQTT_SEQUENCER_LOW(high, low) (((low) > 0 && (low) < (high)) ? (low) : ((high) / 2))
+
+/** 
+ * @internal Watermark state for the provided bytes queued: over the
+ * high watermark sets it, below the low one clears it and in between
+ * the current state is kept.
+ */
+#define __MYQTT_SEQUENCER_OVER(over, bytes, high, low) (((high) <= 0) ? axl_false : \
+							 ((bytes) > (high)) ? axl_true : \
+							 ((bytes) <= __MYQTT_SEQUENCER_LOW (high, low)) ? axl_false : (over))
+
+/** 
+ * @internal Publisher whose reads were paused because the
+ * subscriber (or the whole context when subscriber is NULL) went
+ * over the high watermark.
+ */
+typedef struct _MyQttBackpressure {
+	MyQttConn * publisher;
+	MyQttConn * subscriber;
+} MyQttBackpressure;
+
+/** 
+ * @internal Accounts messages and bytes queued (positive values) or
+ * released (negative values) on the sequencer for the provided
+ * connection, updating the watermark state of the connection and
+ * the context.
+ *
+ * Watermark flags are recomputed from the counters while holding
+ * backpressure_m, so the last update leaves them in the right state
+ * and __myqtt_sequencer_check_backpressure never pauses a publisher
+ * after the queue that caused it was drained. Paused publishers are
+ * resumed as soon as a flag is cleared.
+ */
+void __myqtt_sequencer_account (MyQttCtx * ctx, MyQttConn * conn, int messages, int bytes)
+{
+	axl_bool cleared = axl_false;
+	axl_bool over;
+
+	myqtt_mutex_lock (&conn->op_mutex);
+	conn->sequencer_messages += messages;
+	myqtt_mutex_unlock (&conn->op_mutex);
+
+	myqtt_atomic_add (&conn->sequencer_bytes, bytes);
+	myqtt_atomic_add (&ctx->sequencer_bytes, bytes);
+
+	/* nothing to track */
+	if (ctx->conn_queue_high <= 0 && ctx->ctx_queue_high <= 0 && ! conn->sequencer_over_watermark && ! ctx->sequencer_over_watermark)
+		return;
+
+	myqtt_mutex_lock (&ctx->backpressure_m);
+	over    = __MYQTT_SEQUENCER_OVER (conn->sequencer_over_watermark, myqtt_atomic_get (&conn->sequencer_bytes), 
+					  ctx->conn_queue_high, ctx->conn_queue_low);
+	cleared = conn->sequencer_over_watermark && ! over;
+	conn->sequencer_over_watermark = over;
+
+	over    = __MYQTT_SEQUENCER_OVER (ctx->sequencer_over_watermark, myqtt_atomic_get (&ctx->sequencer_bytes), 
+					  ctx->ctx_queue_high, ctx->ctx_queue_low);
+	cleared = cleared || (ctx->sequencer_over_watermark && ! over);
+	ctx->sequencer_over_watermark = over;
+	myqtt_mutex_unlock (&ctx->backpressure_m);
+
+	/* resume publishers paused */
+	if (cleared)
+		__myqtt_sequencer_release_backpressure (ctx, axl_false);
+
+	return;
+}
+
+/** 
+ * @internal Called after delivering a message received from
+ * publisher to subscriber. If the subscriber (or the context) is
+ * over its high watermark, reads on the publisher are paused until
+ * queues drain (see __myqtt_sequencer_release_backpressure).
+ *
+ * The pause uses its own flag (backpressure_paused), so blocking
+ * requested by the application with myqtt_conn_block is kept. The
+ * reader is not restarted here (this may run inside the reader or
+ * while it is waited): it stops watching the publisher on its next
+ * loop.
+ *
+ * @return axl_true if the publisher is paused.
+ */
+axl_bool __myqtt_sequencer_check_backpressure (MyQttCtx * ctx, MyQttConn * publisher, MyQttConn * subscriber)
+{
+	MyQttBackpressure * entry;
+	axl_bool            conn_over;
+
+	/* nothing to do (quick check, confirmed below) */
+	if (publisher == NULL || subscriber == NULL || publisher == subscriber)
+		return axl_false;
+	if (! subscriber->sequencer_over_watermark && ! ctx->sequencer_over_watermark)
+		return axl_false;
+
+	myqtt_mutex_lock (&ctx->backpressure_m);
+	conn_over = subscriber->sequencer_over_watermark;
+	if (! conn_over && ! ctx->sequencer_over_watermark) {
+		myqtt_mutex_unlock (&ctx->backpressure_m);
+		return axl_false;
+	} /* end if */
+
+	if (publisher->backpressure_paused) {
+		myqtt_mutex_unlock (&ctx->backpressure_m);
+		return axl_true;
+	} /* end if */
+
+	entry = axl_new (MyQttBackpressure, 1);
+	if (entry == NULL || ! myqtt_conn_ref (publisher, "backpressure")) {
+		myqtt_mutex_unlock (&ctx->backpressure_m);
+		axl_free (entry);
+		return axl_false;
+	} /* end if */
+	entry->publisher = publisher;
+	if (conn_over && myqtt_conn_ref (subscriber, "backpressure"))
+		entry->subscriber = subscriber;
+
+	/* pause reads */
+	publisher->backpressure_paused = axl_true;
+	axl_list_append (ctx->backpressure_paused, entry);
+	myqtt_atomic_add (&ctx->backpressure_count, 1);
+	myqtt_mutex_unlock (&ctx->backpressure_m);
+
+	myqtt_log (MYQTT_LEVEL_WARNING, "pausing reads on publisher conn-id=%d, queued bytes: subscriber conn-id=%d %d, context %d",
+		   publisher->id, subscriber->id, myqtt_atomic_get (&subscriber->sequencer_bytes), myqtt_atomic_get (&ctx->sequencer_bytes));
+	return axl_true;
+}
+
+/** 
+ * @internal Resumes reads on paused publishers whose subscriber (and
+ * context) went below the low watermark or was closed, or all of
+ * them if force is axl_true. Entries of publishers closed are
+ * dropped. Called when watermark flags are cleared, when a
+ * connection is closed and when the sequencer stops.
+ */
+void __myqtt_sequencer_release_backpressure (MyQttCtx * ctx, axl_bool force)
+{
+	MyQttBackpressure * entry;
+	axlListCursor     * cursor;
+	axl_bool            resume;
+
+	/* quick check without locking */
+	if (myqtt_atomic_get (&ctx->backpressure_count) == 0)
+		return;
+
+	myqtt_mutex_lock (&ctx->backpressure_m);
+	cursor = axl_list_cursor_new (ctx->backpressure_paused);
+	while (axl_list_cursor_has_item (cursor)) {
+		entry  = axl_list_cursor_get (cursor);
+		resume = force || ! myqtt_conn_is_ok (entry->publisher, axl_false);
+		if (! resume && ! ctx->sequencer_over_watermark) {
+			resume = (entry->subscriber == NULL || ! entry->subscriber->sequencer_over_watermark || 
+				  ! myqtt_conn_is_ok (entry->subscriber, axl_false));
+		} /* end if */
+
+		if (! resume) {
+			axl_list_cursor_next (cursor);
+			continue;
+		} /* end if */
+
+		myqtt_log (MYQTT_LEVEL_DEBUG, "resuming reads on publisher conn-id=%d", entry->publisher->id);
+		entry->publisher->backpressure_paused = axl_false;
+		myqtt_conn_unref (entry->publisher, "backpressure");
+		if (entry->subscriber)
+			myqtt_conn_unref (entry->subscriber, "backpressure");
+		axl_free (entry);
+		axl_list_cursor_remove (cursor);
+		myqtt_atomic_add (&ctx->backpressure_count, -1);
+	} /* end while */
+	axl_list_cursor_free (cursor);
+	myqtt_mutex_unlock (&ctx->backpressure_m);
+
+	return;
+}
+
+/** 
+ * @internal Releases the message hold by the sequencer data unless
+ * it is placed inside the data itself.
+ */
+void __myqtt_sequencer_free_message (MyQttCtx * ctx, MyQttSequencerData * data)
+{
+	if (data->message != data->inline_message)
+		myqtt_msg_free_build (ctx, data->message, data->message_size);
+	data->message = NULL;
+	return;
+}
+
 axl_bool myqtt_sequencer_queue_data (MyQttCtx * ctx, MyQttSequencerData * data)
 {
 	v_return_val_if_fail (data, axl_false);
@@ -55,7 +244,7 @@ axl_bool myqtt_sequencer_queue_data (MyQttCtx * ctx, MyQttSequencerData * data)
 			   ctx->myqtt_exit);
 
 		/* axl_free (data->message); */
-		myqtt_msg_free_build (ctx, data->message, data->message_size);
+		__myqtt_sequencer_free_message (ctx, data);
 		axl_free (data);
 		myqtt_log (MYQTT_LEVEL_WARNING, "Not queueing data because this myqtt instance is finishing..");
 		return axl_false;
@@ -69,17 +258,15 @@ axl_bool myqtt_sequencer_queue_data (MyQttCtx * ctx, MyQttSequencerData * data)
 			   axl_check_undef (data->conn->host), 
 			   axl_check_undef (data->conn->port), data->conn->session);
 		/* axl_free (data->message); */
-		myqtt_msg_free_build (ctx, data->message, data->message_size);
+		__myqtt_sequencer_free_message (ctx, data);
 		axl_free (data);
 		return axl_false;
 	} /* end if */
 
 	/* increase pending messages to be sent : this is to help and
 	 * ensure myqtt_conn_close flushes all messages before closing
-	 * the connection */
-	myqtt_mutex_lock (&data->conn->op_mutex);
-	data->conn->sequencer_messages++;
-	myqtt_mutex_unlock (&data->conn->op_mutex);
+	 * the connection (bytes are accounted for backpressure) */
+	__myqtt_sequencer_account (ctx, data->conn, 1, data->message_size);
 
 	/* lock connection and queue message */
 	myqtt_mutex_lock (&ctx->pending_messages_m);
@@ -140,6 +327,7 @@ axl_bool myqtt_sequencer_send                     (MyQttConn            * conn,
 	data->message      = msg;
 	data->message_size = msg_size;
 	data->type         = type;
+	data->skip_metrics = __myqtt_metrics_skipped ();
 
 	if (! myqtt_sequencer_queue_data (ctx, data)) {
 		/* IMPORTANT NOTE: do not release msg here because
@@ -152,6 +340,44 @@ axl_bool myqtt_sequencer_send                     (MyQttConn            * conn,
 	return axl_true;
 }
 
+/** 
+ * @internal Same as \ref myqtt_sequencer_send but for small packets
+ * (up to MYQTT_SEQUENCER_INLINE_SIZE bytes) that are copied into the
+ * sequencer data, so the caller can build them on its stack (see
+ * myqtt_msg_encode_ack).
+ */
+axl_bool myqtt_sequencer_send_inline              (MyQttConn            * conn, 
+						   MyQttMsgType           type,
+						   const unsigned char  * msg, 
+						   int                    msg_size)
+{
+	MyQttSequencerData * data;
+	MyQttCtx           * ctx;
+
+	if (conn == NULL || msg == NULL || msg_size <= 0 || msg_size > MYQTT_SEQUENCER_INLINE_SIZE) 
+		return axl_false;
+
+	/* acquire reference to the context */
+	ctx = conn->ctx;
+
+	/* queue package to be sent */
+	data = axl_new (MyQttSequencerData, 1);
+	if (data == NULL) {
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to acquire memory to send message");
+		return axl_false;
+	} /* end if */
+
+	/* configure package to send */
+	memcpy (data->inline_message, msg, msg_size);
+	data->conn         = conn;
+	data->message      = data->inline_message;
+	data->message_size = msg_size;
+	data->type         = type;
+
+	/* msg is released by myqtt_sequencer_queue_data on failure */
+	return myqtt_sequencer_queue_data (ctx, data);
+}
+
 axlPointer __myqtt_sequencer_run (axlPointer _data)
 {
 
@@ -163,6 +389,10 @@ axlPointer __myqtt_sequencer_run (axlPointer _data)
 	MyQttSequencerData   * data;
 	MyQttConn            * conn;
 	int                    size;
+	int                    cpus_gen = 0;
+
+	/* pin the sequencer (if configured) before allocating its state */
+	__myqtt_thread_check_cpus (ctx, MYQTT_THREAD_SEQUENCER, &cpus_gen);
 
 	/* get a cursor */
 	cursor = axl_list_cursor_new (ctx->pending_messages);
@@ -171,6 +401,9 @@ axlPointer __myqtt_sequencer_run (axlPointer _data)
 	myqtt_mutex_lock (&ctx->pending_messages_m);
 
 	while (axl_true) {
+		/* apply cpu set changes */
+		__myqtt_thread_check_cpus (ctx, MYQTT_THREAD_SEQUENCER, &cpus_gen);
+
 		/* block until receive a new message to be sent (but
 		 * only if there are no ready events) */
 		myqtt_log (MYQTT_LEVEL_DEBUG, "sequencer locking (pending messages: %d, exit: %d)",
@@ -276,6 +509,10 @@ axlPointer __myqtt_sequencer_run (axlPointer _data)
 					} */
 			
 			
+			/* discount bytes myqtt_msg_send_raw accounted */
+			if (data->skip_metrics)
+				__myqtt_metrics_add (ctx, MYQTT_METRIC_BYTES_SENT, - (long) size);
+
 			/* increase step */
 			data->step += size;
 
@@ -287,17 +524,15 @@ axlPointer __myqtt_sequencer_run (axlPointer _data)
 				if (conn->on_msg_sent)
 					conn->on_msg_sent (ctx, conn, data->message, data->message_size, data->type, conn->on_msg_sent_data);
 
-				/* decrease pending messages to be sent */
-				myqtt_mutex_lock (&conn->op_mutex);
-				conn->sequencer_messages--;
-				myqtt_mutex_unlock (&conn->op_mutex);
+				/* decrease pending messages to be sent (paused
+				 * publishers are resumed if queues drained) */
+				__myqtt_sequencer_account (ctx, conn, -1, - data->message_size);
 
 				/* release connection */
 				myqtt_conn_unref (conn, "sequencer");
 
 				/* release message */
-				axl_free (data->message);
-				data->message = NULL;
+				__myqtt_sequencer_free_message (ctx, data);
 
 				/* release common container */
 				axl_free (data);
@@ -355,6 +590,9 @@ void myqtt_sequencer_stop (MyQttCtx * ctx)
 	/* terminate sequencer thread */
 	myqtt_thread_destroy (&ctx->sequencer_thread, axl_false);
 
+	/* release publishers still paused */
+	__myqtt_sequencer_release_backpressure (ctx, axl_true);
+
 	return; 
 }
 
@@ -49,6 +49,11 @@ axl_bool myqtt_sequencer_send                     (MyQttConn            * conn,
 						   unsigned char        * msg, 
 						   int                    msg_size);
 
+axl_bool myqtt_sequencer_send_inline              (MyQttConn            * conn, 
+						   MyQttMsgType           type,
+						   const unsigned char  * msg, 
+						   int                    msg_size);
+
 axl_bool myqtt_sequencer_run                      (MyQttCtx * ctx);
 
 void     myqtt_sequencer_stop                     (MyQttCtx * ctx);
@@ -58,6 +63,13 @@ axl_bool myqtt_sequencer_direct_send              (MyQttConn       * conn,
 
 void     myqtt_sequencer_signal_update            (MyQttConn    * conn);
 
+/*** internal API ***/
+void     __myqtt_sequencer_account                (MyQttCtx * ctx, MyQttConn * conn, int messages, int bytes);
+
+axl_bool __myqtt_sequencer_check_backpressure     (MyQttCtx * ctx, MyQttConn * publisher, MyQttConn * subscriber);
+
+void     __myqtt_sequencer_release_backpressure   (MyQttCtx * ctx, axl_bool force);
+
 #endif
 
 
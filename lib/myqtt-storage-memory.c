@@ -0,0 +1,730 @@
+/* 
+ *  MyQtt: A high performance open source MQTT implementation
+ *  Copyright (C) 2016 Advanced Software Production Line, S.L.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307 USA
+ *  
+ *  You may find a copy of the license under this software is released
+ *  at COPYING file. This is LGPL software: you are welcome to develop
+ *  proprietary applications using this library without any royalty or
+ *  fee but returning back any change, improvement or addition in the
+ *  form of source code, project image, documentation patches, etc.
+ *
+ *  For commercial support on build MQTT enabled solutions contact us:
+ *          
+ *      Postal address:
+ *         Advanced Software Production Line, S.L.
+ *         C/ Antonio Suarez Nº 10, 
+ *         Edificio Alius A, Despacho 102
+ *         Alcalá de Henares 28802 (Madrid)
+ *         Spain
+ *
+ *      Email address:
+ *         info@aspl.es - http://www.aspl.es/mqtt
+ *                        http://www.aspl.es/myqtt
+ */
+#include <myqtt-storage.h>
+#include <myqtt-conn-private.h>
+#include <myqtt-ctx-private.h>
+
+/** 
+ * @internal In-memory storage driver (see \ref MYQTT_STORAGE_TYPE_MEMORY).
+ *
+ * Everything is kept inside hashes protected by a single mutex
+ * stored at ctx->storage_backend_data. Notifications to upper layers
+ * (subscriptions and queued messages found) are done without holding
+ * the mutex, using copies of the stored data.
+ */
+
+typedef struct _MyQttStorageMemMsg {
+	char          * handle;
+	int             packet_id;
+	MyQttQos        qos;
+	unsigned char * app_msg;
+	int             app_msg_size;
+	/* when the message was stored (seconds) */
+	long            stamp;
+	/* arrival order links (see MyQttStorageMemSession) */
+	struct _MyQttStorageMemMsg * prev;
+	struct _MyQttStorageMemMsg * next;
+} MyQttStorageMemMsg;
+
+typedef struct _MyQttStorageMemSession {
+	/* topic filter -> qos */
+	axlHash       * subs;
+	/* handle -> MyQttStorageMemMsg (owns them), linked in
+	 * arrival order from first (oldest) to last so release is
+	 * done without walking queued messages */
+	axlHash       * msgs;
+	struct _MyQttStorageMemMsg * first;
+	struct _MyQttStorageMemMsg * last;
+	/* packet ids locked */
+	axlHash       * pkgids;
+	/* bytes used by queued messages */
+	int             quota;
+	/* last time the session was used (seconds) */
+	long            stamp;
+} MyQttStorageMemSession;
+
+typedef struct _MyQttStorageMem {
+	MyQttMutex      mutex;
+	/* client identifier -> MyQttStorageMemSession */
+	axlHash       * sessions;
+	/* topic name -> MyQttStorageMemMsg */
+	axlHash       * retained;
+	/* used to build unique message handles */
+	long            sequence;
+} MyQttStorageMem;
+
+void __myqtt_storage_mem_msg_free (axlPointer _msg)
+{
+	MyQttStorageMemMsg * msg = _msg;
+
+	if (msg == NULL)
+		return;
+	axl_free (msg->handle);
+	axl_free (msg->app_msg);
+	axl_free (msg);
+	return;
+}
+
+MyQttStorageMemMsg * __myqtt_storage_mem_msg_new (int packet_id, MyQttQos qos, const unsigned char * app_msg, int app_msg_size)
+{
+	MyQttStorageMemMsg * msg;
+
+	msg = axl_new (MyQttStorageMemMsg, 1);
+	if (msg == NULL)
+		return NULL;
+
+	/* copy content (keep a trailing zero as done by file storage) */
+	msg->app_msg = axl_new (unsigned char, app_msg_size + 1);
+	if (msg->app_msg == NULL) {
+		axl_free (msg);
+		return NULL;
+	} /* end if */
+	if (app_msg_size > 0)
+		memcpy (msg->app_msg, app_msg, app_msg_size);
+
+	msg->packet_id    = packet_id;
+	msg->qos          = qos;
+	msg->app_msg_size = app_msg_size;
+
+	return msg;
+}
+
+void __myqtt_storage_mem_session_free (axlPointer _session)
+{
+	MyQttStorageMemSession * session = _session;
+
+	if (session == NULL)
+		return;
+	axl_hash_free (session->subs);
+	axl_hash_free (session->msgs);
+	axl_hash_free (session->pkgids);
+	axl_free (session);
+	return;
+}
+
+/** 
+ * @internal Unlinks the provided message from the session (it is
+ * not released). Must be called holding the mutex.
+ */
+void __myqtt_storage_mem_msg_unlink (MyQttStorageMemSession * session, MyQttStorageMemMsg * msg)
+{
+	if (msg->prev)
+		msg->prev->next = msg->next;
+	else
+		session->first  = msg->next;
+	if (msg->next)
+		msg->next->prev = msg->prev;
+	else
+		session->last   = msg->prev;
+	msg->prev = NULL;
+	msg->next = NULL;
+
+	session->quota -= msg->app_msg_size;
+	axl_hash_delete (session->msgs, msg->handle);
+	return;
+}
+
+/** 
+ * @internal Gets the session for the provided client identifier,
+ * optionally creating it. Must be called holding the mutex.
+ */
+MyQttStorageMemSession * __myqtt_storage_mem_session (MyQttStorageMem * mem, const char * client_identifier, axl_bool create)
+{
+	MyQttStorageMemSession * session;
+
+	session = axl_hash_get (mem->sessions, (axlPointer) client_identifier);
+	if (session || ! create)
+		return session;
+
+	session = axl_new (MyQttStorageMemSession, 1);
+	if (session == NULL)
+		return NULL;
+	session->subs   = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+	session->msgs   = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+	session->pkgids = axl_hash_new (axl_hash_int, axl_hash_equal_int);
+	session->stamp  = (long) time (NULL);
+
+	axl_hash_insert_full (mem->sessions, axl_strdup (client_identifier), axl_free, session, __myqtt_storage_mem_session_free);
+	return session;
+}
+
+axl_bool __myqtt_storage_mem_start (MyQttCtx * ctx)
+{
+	MyQttStorageMem * mem;
+
+	mem = axl_new (MyQttStorageMem, 1);
+	if (mem == NULL)
+		return axl_false;
+
+	myqtt_mutex_create (&mem->mutex);
+	mem->sessions = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+	mem->retained = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+
+	ctx->storage_backend_data = mem;
+	return axl_true;
+}
+
+void __myqtt_storage_mem_stop (MyQttCtx * ctx)
+{
+	MyQttStorageMem * mem = ctx->storage_backend_data;
+
+	if (mem == NULL)
+		return;
+	ctx->storage_backend_data = NULL;
+
+	axl_hash_free (mem->sessions);
+	axl_hash_free (mem->retained);
+	myqtt_mutex_destroy (&mem->mutex);
+	axl_free (mem);
+	return;
+}
+
+axl_bool __myqtt_storage_mem_init (MyQttCtx * ctx, const char * client_identifier, MyQttStorage storage)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	MyQttStorageMemSession * session;
+
+	myqtt_mutex_lock (&mem->mutex);
+	session = __myqtt_storage_mem_session (mem, client_identifier, axl_true);
+	myqtt_mutex_unlock (&mem->mutex);
+
+	return session != NULL;
+}
+
+axl_bool __myqtt_storage_mem_clear (MyQttCtx * ctx, const char * client_identifier, MyQttStorage storage)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	MyQttStorageMemSession * session;
+
+	myqtt_mutex_lock (&mem->mutex);
+	session = __myqtt_storage_mem_session (mem, client_identifier, axl_false);
+	if (session == NULL) {
+		myqtt_mutex_unlock (&mem->mutex);
+		return axl_true;
+	} /* end if */
+
+	/* remove the entire session */
+	if ((storage & MYQTT_STORAGE_ALL) == MYQTT_STORAGE_ALL) {
+		axl_hash_remove (mem->sessions, (axlPointer) client_identifier);
+		myqtt_mutex_unlock (&mem->mutex);
+		return axl_true;
+	} /* end if */
+
+	/* messages */
+	if ((storage & MYQTT_STORAGE_MSGS) == MYQTT_STORAGE_MSGS) {
+		axl_hash_free (session->msgs);
+		session->msgs  = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+		session->first = NULL;
+		session->last  = NULL;
+		session->quota = 0;
+	} /* end if */
+
+	/* pkgids */
+	if ((storage & MYQTT_STORAGE_PKGIDS) == MYQTT_STORAGE_PKGIDS) {
+		axl_hash_free (session->pkgids);
+		session->pkgids = axl_hash_new (axl_hash_int, axl_hash_equal_int);
+	} /* end if */
+	myqtt_mutex_unlock (&mem->mutex);
+
+	return axl_true;
+}
+
+axl_bool __myqtt_storage_mem_sub (MyQttCtx * ctx, const char * client_identifier, const char * topic_filter, int topic_filter_len, MyQttQos qos)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	MyQttStorageMemSession * session;
+
+	myqtt_mutex_lock (&mem->mutex);
+	session = __myqtt_storage_mem_session (mem, client_identifier, axl_true);
+	if (session == NULL) {
+		myqtt_mutex_unlock (&mem->mutex);
+		return axl_false;
+	} /* end if */
+
+	/* record subscription if not found */
+	if (axl_hash_get (session->subs, (axlPointer) topic_filter) == NULL)
+		axl_hash_insert_full (session->subs, axl_strdup (topic_filter), axl_free, INT_TO_PTR (qos + 1), NULL);
+	myqtt_mutex_unlock (&mem->mutex);
+
+	return axl_true;
+}
+
+axl_bool __myqtt_storage_mem_sub_exists (MyQttCtx * ctx, const char * client_identifier, const char * topic_filter, int topic_filter_len, axl_bool remove_if_found)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	MyQttStorageMemSession * session;
+	axl_bool                 result = axl_false;
+
+	myqtt_mutex_lock (&mem->mutex);
+	session = __myqtt_storage_mem_session (mem, client_identifier, axl_false);
+	if (session && axl_hash_get (session->subs, (axlPointer) topic_filter)) {
+		result = axl_true;
+		if (remove_if_found)
+			axl_hash_remove (session->subs, (axlPointer) topic_filter);
+	} /* end if */
+	myqtt_mutex_unlock (&mem->mutex);
+
+	return result;
+}
+
+axl_bool __myqtt_storage_mem_sub_copy (axlPointer key, axlPointer data, axlPointer user_data, axlPointer user_data2)
+{
+	/* store topic filter and its qos at the same position */
+	axl_list_append (user_data, axl_strdup (key));
+	axl_list_append (user_data2, INT_TO_PTR (PTR_TO_INT (data) - 1));
+
+	return axl_false; /* keep iterating */
+}
+
+int __myqtt_storage_mem_sub_iterate (MyQttCtx * ctx, const char * client_identifier, MyQttStorageSubFound func, axlPointer user_data, axlPointer user_data2)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	MyQttStorageMemSession * session;
+	axlList                * topics;
+	axlList                * qos;
+	int                      total;
+	int                      iterator;
+
+	myqtt_mutex_lock (&mem->mutex);
+	session = __myqtt_storage_mem_session (mem, client_identifier, axl_false);
+	if (session == NULL) {
+		myqtt_mutex_unlock (&mem->mutex);
+		return -1;
+	} /* end if */
+
+	total = axl_hash_items (session->subs);
+	if (func == NULL || total == 0) {
+		myqtt_mutex_unlock (&mem->mutex);
+		return total;
+	} /* end if */
+
+	/* copy subscriptions to notify them without holding the mutex */
+	topics = axl_list_new (axl_list_always_return_1, axl_free);
+	qos    = axl_list_new (axl_list_always_return_1, NULL);
+	axl_hash_foreach2 (session->subs, __myqtt_storage_mem_sub_copy, topics, qos);
+	myqtt_mutex_unlock (&mem->mutex);
+
+	iterator = 0;
+	while (iterator < axl_list_length (topics)) {
+		func (ctx, client_identifier, axl_list_get_nth (topics, iterator), 
+		      PTR_TO_INT (axl_list_get_nth (qos, iterator)), user_data, user_data2);
+		iterator++;
+	} /* end while */
+	axl_list_free (topics);
+	axl_list_free (qos);
+
+	return total;
+}
+
+axlPointer __myqtt_storage_mem_store_msg (MyQttCtx * ctx, const char * client_identifier, int packet_id, MyQttQos qos, unsigned char * app_msg, int app_msg_size)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	MyQttStorageMemSession * session;
+	MyQttStorageMemMsg     * msg;
+
+	msg = __myqtt_storage_mem_msg_new (packet_id, qos, app_msg, app_msg_size);
+	if (msg == NULL)
+		return NULL;
+
+	myqtt_mutex_lock (&mem->mutex);
+	session = __myqtt_storage_mem_session (mem, client_identifier, axl_true);
+	if (session == NULL) {
+		myqtt_mutex_unlock (&mem->mutex);
+		__myqtt_storage_mem_msg_free (msg);
+		return NULL;
+	} /* end if */
+
+	/* build handle with the same prefix used by file storage */
+	mem->sequence++;
+	msg->handle     = axl_strdup_printf ("%d-%d-%d-%ld", packet_id, app_msg_size, qos, mem->sequence);
+	msg->stamp      = (long) time (NULL);
+	axl_hash_insert_full (session->msgs, msg->handle, NULL, msg, __myqtt_storage_mem_msg_free);
+	msg->prev       = session->last;
+	if (session->last)
+		session->last->next = msg;
+	else
+		session->first      = msg;
+	session->last   = msg;
+	session->quota += app_msg_size;
+	myqtt_mutex_unlock (&mem->mutex);
+
+	return axl_strdup (msg->handle);
+}
+
+void __myqtt_storage_mem_release_msg (MyQttCtx * ctx, const char * client_identifier, axlPointer handle)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	MyQttStorageMemSession * session;
+	MyQttStorageMemMsg     * msg;
+
+	myqtt_mutex_lock (&mem->mutex);
+	session = __myqtt_storage_mem_session (mem, client_identifier, axl_false);
+	if (session == NULL) {
+		myqtt_mutex_unlock (&mem->mutex);
+		return;
+	} /* end if */
+
+	msg = axl_hash_get (session->msgs, handle);
+	if (msg) {
+		__myqtt_storage_mem_msg_unlink (session, msg);
+		__myqtt_storage_mem_msg_free (msg);
+	} /* end if */
+	myqtt_mutex_unlock (&mem->mutex);
+
+	return;
+}
+
+int __myqtt_storage_mem_queued_messages (MyQttCtx * ctx, const char * client_identifier)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	MyQttStorageMemSession * session;
+	int                      result = 0;
+
+	myqtt_mutex_lock (&mem->mutex);
+	session = __myqtt_storage_mem_session (mem, client_identifier, axl_false);
+	if (session)
+		result = axl_hash_items (session->msgs);
+	myqtt_mutex_unlock (&mem->mutex);
+
+	return result;
+}
+
+int __myqtt_storage_mem_queued_quota (MyQttCtx * ctx, const char * client_identifier)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	MyQttStorageMemSession * session;
+	int                      result = 0;
+
+	myqtt_mutex_lock (&mem->mutex);
+	session = __myqtt_storage_mem_session (mem, client_identifier, axl_false);
+	if (session)
+		result = session->quota;
+	myqtt_mutex_unlock (&mem->mutex);
+
+	return result;
+}
+
+int __myqtt_storage_mem_msg_iterate (MyQttCtx * ctx, const char * client_identifier, MyQttStorageMsgFound func, axlPointer user_data)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	MyQttStorageMemSession * session;
+	MyQttStorageMemMsg     * msg;
+	MyQttStorageMemMsg     * copy;
+	axlList                * list;
+	int                      iterator;
+	int                      total;
+
+	myqtt_mutex_lock (&mem->mutex);
+	session = __myqtt_storage_mem_session (mem, client_identifier, axl_false);
+	if (session == NULL) {
+		myqtt_mutex_unlock (&mem->mutex);
+		return 0;
+	} /* end if */
+
+	/* copy messages to notify them without holding the mutex
+	 * (they stay stored until released) */
+	list     = axl_list_new (axl_list_always_return_1, NULL);
+	msg      = session->first;
+	while (msg) {
+		copy = __myqtt_storage_mem_msg_new (msg->packet_id, msg->qos, msg->app_msg, msg->app_msg_size);
+		if (copy) {
+			copy->handle = axl_strdup (msg->handle);
+			axl_list_append (list, copy);
+		} /* end if */
+		msg = msg->next;
+	} /* end while */
+	myqtt_mutex_unlock (&mem->mutex);
+
+	/* notify, transferring handle and content */
+	total    = axl_list_length (list);
+	iterator = 0;
+	while (iterator < total) {
+		copy = axl_list_get_nth (list, iterator);
+		func (ctx, client_identifier, copy->handle, copy->packet_id, copy->qos, copy->app_msg, copy->app_msg_size, user_data);
+		axl_free (copy);
+		iterator++;
+	} /* end while */
+	axl_list_free (list);
+
+	return total;
+}
+
+int __myqtt_storage_mem_msg_expire (MyQttCtx * ctx, const char * client_identifier, long stamp_limit, MyQttStorageMsgFound func, axlPointer user_data)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	MyQttStorageMemSession * session;
+	MyQttStorageMemMsg     * msg;
+	axlList                * list;
+	int                      iterator;
+	int                      total;
+
+	myqtt_mutex_lock (&mem->mutex);
+	session = __myqtt_storage_mem_session (mem, client_identifier, axl_false);
+	if (session == NULL) {
+		myqtt_mutex_unlock (&mem->mutex);
+		return 0;
+	} /* end if */
+
+	/* unlink expired messages (they are stored in arrival order) */
+	list = axl_list_new (axl_list_always_return_1, __myqtt_storage_mem_msg_free);
+	while (session->first && session->first->stamp <= stamp_limit) {
+		msg = session->first;
+		__myqtt_storage_mem_msg_unlink (session, msg);
+		axl_list_append (list, msg);
+	} /* end while */
+	myqtt_mutex_unlock (&mem->mutex);
+
+	/* notify, transferring handle */
+	total    = axl_list_length (list);
+	iterator = 0;
+	while (func && iterator < total) {
+		msg         = axl_list_get_nth (list, iterator);
+		func (ctx, client_identifier, msg->handle, msg->packet_id, msg->qos, NULL, msg->app_msg_size, user_data);
+		msg->handle = NULL;
+		iterator++;
+	} /* end while */
+	axl_list_free (list);
+
+	return total;
+}
+
+void __myqtt_storage_mem_session_touch (MyQttCtx * ctx, const char * client_identifier)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	MyQttStorageMemSession * session;
+
+	myqtt_mutex_lock (&mem->mutex);
+	session = __myqtt_storage_mem_session (mem, client_identifier, axl_false);
+	if (session)
+		session->stamp = (long) time (NULL);
+	myqtt_mutex_unlock (&mem->mutex);
+
+	return;
+}
+
+long __myqtt_storage_mem_session_stamp (MyQttCtx * ctx, const char * client_identifier)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	MyQttStorageMemSession * session;
+	long                     stamp = -1;
+
+	myqtt_mutex_lock (&mem->mutex);
+	session = __myqtt_storage_mem_session (mem, client_identifier, axl_false);
+	if (session)
+		stamp = session->stamp;
+	myqtt_mutex_unlock (&mem->mutex);
+
+	return stamp;
+}
+
+axl_bool __myqtt_storage_mem_lock_pkgid (MyQttCtx * ctx, const char * client_identifier, int pkg_id)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	MyQttStorageMemSession * session;
+	axl_bool                 result = axl_false;
+
+	myqtt_mutex_lock (&mem->mutex);
+	session = __myqtt_storage_mem_session (mem, client_identifier, axl_true);
+	if (session && axl_hash_get (session->pkgids, INT_TO_PTR (pkg_id)) == NULL) {
+		axl_hash_insert_full (session->pkgids, INT_TO_PTR (pkg_id), NULL, INT_TO_PTR (axl_true), NULL);
+		result = axl_true;
+	} /* end if */
+	myqtt_mutex_unlock (&mem->mutex);
+
+	return result;
+}
+
+void __myqtt_storage_mem_release_pkgid (MyQttCtx * ctx, const char * client_identifier, int pkg_id)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	MyQttStorageMemSession * session;
+
+	myqtt_mutex_lock (&mem->mutex);
+	session = __myqtt_storage_mem_session (mem, client_identifier, axl_false);
+	if (session)
+		axl_hash_remove (session->pkgids, INT_TO_PTR (pkg_id));
+	myqtt_mutex_unlock (&mem->mutex);
+
+	return;
+}
+
+axl_bool __myqtt_storage_mem_retain_set (MyQttCtx * ctx, const char * topic_name, int topic_name_len, MyQttQos qos, const unsigned char * app_msg, int app_msg_size)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	MyQttStorageMemMsg     * msg;
+
+	msg = __myqtt_storage_mem_msg_new (0, qos, app_msg, app_msg_size);
+	if (msg == NULL)
+		return axl_false;
+
+	/* replace previous retained message (if any) */
+	myqtt_mutex_lock (&mem->mutex);
+	axl_hash_remove (mem->retained, (axlPointer) topic_name);
+	axl_hash_insert_full (mem->retained, axl_strdup (topic_name), axl_free, msg, __myqtt_storage_mem_msg_free);
+	myqtt_mutex_unlock (&mem->mutex);
+
+	return axl_true;
+}
+
+axl_bool __myqtt_storage_mem_retain_recover (MyQttCtx * ctx, const char * topic_name, int topic_name_len, MyQttQos * qos, unsigned char ** app_msg, int * app_msg_size)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	MyQttStorageMemMsg     * msg;
+
+	myqtt_mutex_lock (&mem->mutex);
+	msg = axl_hash_get (mem->retained, (axlPointer) topic_name);
+	if (msg == NULL) {
+		myqtt_mutex_unlock (&mem->mutex);
+		return axl_false;
+	} /* end if */
+
+	/* report content, transferring it to the caller */
+	if (qos)
+		(*qos) = msg->qos;
+	if (app_msg) {
+		(*app_msg)      = msg->app_msg;
+		(*app_msg_size) = msg->app_msg_size;
+		msg->app_msg    = NULL;
+	} /* end if */
+
+	/* remove retained message */
+	axl_hash_remove (mem->retained, (axlPointer) topic_name);
+	myqtt_mutex_unlock (&mem->mutex);
+
+	return axl_true;
+}
+
+void __myqtt_storage_mem_retain_release (MyQttCtx * ctx, const char * topic_name, int topic_name_len)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+
+	myqtt_mutex_lock (&mem->mutex);
+	axl_hash_remove (mem->retained, (axlPointer) topic_name);
+	myqtt_mutex_unlock (&mem->mutex);
+
+	return;
+}
+
+axl_bool __myqtt_storage_mem_retained_topic_match (axlPointer key, axlPointer data, axlPointer user_data, axlPointer user_data2)
+{
+	/* add topic name if it matches */
+	if (myqtt_reader_topic_filter_match (key, user_data2))
+		axl_list_append (user_data, axl_strdup (key));
+
+	return axl_false; /* keep iterating */
+}
+
+axlList * __myqtt_storage_mem_retained_topics (MyQttCtx * ctx, const char * topic_filter)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	axlList                * list;
+
+	list = axl_list_new (axl_list_always_return_1, axl_free);
+	if (list == NULL)
+		return NULL;
+
+	myqtt_mutex_lock (&mem->mutex);
+	axl_hash_foreach2 (mem->retained, __myqtt_storage_mem_retained_topic_match, list, (axlPointer) topic_filter);
+	myqtt_mutex_unlock (&mem->mutex);
+
+	return list;
+}
+
+axl_bool __myqtt_storage_mem_session_copy (axlPointer key, axlPointer data, axlPointer user_data)
+{
+	axl_list_append (user_data, axl_strdup (key));
+	return axl_false; /* keep iterating */
+}
+
+axlList * __myqtt_storage_mem_sessions (MyQttCtx * ctx)
+{
+	MyQttStorageMem        * mem = ctx->storage_backend_data;
+	axlList                * list;
+
+	list = axl_list_new (axl_list_always_return_1, axl_free);
+	if (list == NULL)
+		return NULL;
+
+	myqtt_mutex_lock (&mem->mutex);
+	axl_hash_foreach (mem->sessions, __myqtt_storage_mem_session_copy, list);
+	myqtt_mutex_unlock (&mem->mutex);
+
+	return list;
+}
+
+/** 
+ * @internal In-memory storage driver table.
+ */
+MyQttStorageBackend __myqtt_storage_memory_backend = {
+	"memory",
+	__myqtt_storage_mem_start,
+	__myqtt_storage_mem_stop,
+	__myqtt_storage_mem_init,
+	__myqtt_storage_mem_clear,
+	__myqtt_storage_mem_sub,
+	__myqtt_storage_mem_sub_exists,
+	__myqtt_storage_mem_sub_iterate,
+	__myqtt_storage_mem_store_msg,
+	__myqtt_storage_mem_release_msg,
+	__myqtt_storage_mem_queued_messages,
+	__myqtt_storage_mem_queued_quota,
+	__myqtt_storage_mem_msg_iterate,
+	__myqtt_storage_mem_lock_pkgid,
+	__myqtt_storage_mem_release_pkgid,
+	__myqtt_storage_mem_retain_set,
+	__myqtt_storage_mem_retain_recover,
+	__myqtt_storage_mem_retain_release,
+	__myqtt_storage_mem_retained_topics,
+	__myqtt_storage_mem_sessions,
+	/* load: generic load is used */
+	NULL,
+	__myqtt_storage_mem_msg_expire,
+	__myqtt_storage_mem_session_touch,
+	__myqtt_storage_mem_session_stamp,
+	/* session_remove: clear (MYQTT_STORAGE_ALL) removes the session */
+	NULL
+};
+
+/** 
+ * @internal Allows to get a reference to the in-memory storage driver.
+ */
+MyQttStorageBackend * __myqtt_storage_backend_memory (void)
+{
+	return &__myqtt_storage_memory_backend;
+}
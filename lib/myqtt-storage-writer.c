@@ -0,0 +1,347 @@
+/* 
+ *  MyQtt: A high performance open source MQTT implementation
+ *  Copyright (C) 2016 Advanced Software Production Line, S.L.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this program; if not, write to the Free
+ *  Software Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+ *  02111-1307 USA
+ *  
+ *  You may find a copy of the license under this software is released
+ *  at COPYING file. This is LGPL software: you are welcome to develop
+ *  proprietary applications using this library without any royalty or
+ *  fee but returning back any change, improvement or addition in the
+ *  form of source code, project image, documentation patches, etc.
+ *
+ *  For commercial support on build MQTT enabled solutions contact us:
+ *          
+ *      Postal address:
+ *         Advanced Software Production Line, S.L.
+ *         C/ Antonio Suarez Nº 10, 
+ *         Edificio Alius A, Despacho 102
+ *         Alcalá de Henares 28802 (Madrid)
+ *         Spain
+ *
+ *      Email address:
+ *         info@aspl.es - http://www.aspl.es/mqtt
+ *                        http://www.aspl.es/myqtt
+ */
+#include <myqtt-storage.h>
+#include <myqtt-ctx-private.h>
+
+/** 
+ * @internal Storage writer: a dedicated thread that runs storage
+ * operations (offline queueing, retained messages,...) handed off by
+ * the threads routing messages, so a slow disk doesn't stall message
+ * delivery to online subscribers.
+ *
+ * Operations are kept in ctx->storage_writer_jobs (bounded to
+ * ctx->storage_writer_limit) and are run in the order they were
+ * queued.
+ */
+
+typedef struct _MyQttStorageWriterJob {
+	MyQttStorageJob       job;
+	MyQttStorageJobDone   on_done;
+	axlPointer            user_data;
+	axlPointer            user_data2;
+} MyQttStorageWriterJob;
+
+void __myqtt_storage_writer_run_job (MyQttCtx * ctx, MyQttStorageJob job, MyQttStorageJobDone on_done, axlPointer user_data, axlPointer user_data2)
+{
+	axl_bool status;
+
+	/* run operation and notify completion */
+	status = job (ctx, user_data, user_data2);
+	if (on_done)
+		on_done (ctx, status, user_data, user_data2);
+
+	return;
+}
+
+axlPointer __myqtt_storage_writer_run (axlPointer _ctx)
+{
+	MyQttCtx              * ctx = _ctx;
+	MyQttStorageWriterJob * job;
+
+	myqtt_mutex_lock (&ctx->storage_writer_m);
+	while (axl_true) {
+		/* wait for operations to run */
+		while (axl_list_length (ctx->storage_writer_jobs) == 0 && ! ctx->storage_writer_stop)
+			myqtt_cond_timedwait (&ctx->storage_writer_c, &ctx->storage_writer_m, 10000);
+
+		/* finish once all pending operations were done: from
+		 * now on operations are run by the caller (see
+		 * myqtt_storage_writer_queue) */
+		if (axl_list_length (ctx->storage_writer_jobs) == 0 && ctx->storage_writer_stop) {
+			ctx->storage_writer_started = axl_false;
+			myqtt_cond_broadcast (&ctx->storage_writer_c);
+			break;
+		} /* end if */
+
+		/* get next operation */
+		job = axl_list_get_first (ctx->storage_writer_jobs);
+		axl_list_unlink_first (ctx->storage_writer_jobs);
+		ctx->storage_writer_running_jobs++;
+
+		/* signal threads waiting for room in the queue */
+		myqtt_cond_broadcast (&ctx->storage_writer_c);
+		myqtt_mutex_unlock (&ctx->storage_writer_m);
+
+		__myqtt_storage_writer_run_job (ctx, job->job, job->on_done, job->user_data, job->user_data2);
+		axl_free (job);
+
+		myqtt_mutex_lock (&ctx->storage_writer_m);
+		ctx->storage_writer_running_jobs--;
+
+		/* signal threads waiting for the queue to be flushed */
+		myqtt_cond_broadcast (&ctx->storage_writer_c);
+	} /* end while */
+	myqtt_mutex_unlock (&ctx->storage_writer_m);
+
+	myqtt_log (MYQTT_LEVEL_DEBUG, "exiting myqtt storage writer thread ..");
+
+	/* release reference acquired at myqtt_storage_writer_start */
+	myqtt_ctx_unref2 (&ctx, "storage writer");
+
+	return NULL;
+}
+
+/** 
+ * @brief Starts the storage writer on the provided context.
+ *
+ * Once started, storage operations done while routing messages
+ * (queueing messages for offline subscribers and storing/removing
+ * retained messages) are handed off to a dedicated thread and
+ * routing continues without waiting for them. Operations are run in
+ * the same order they were queued.
+ *
+ * Up to queue_limit operations can be pending. When the queue is
+ * full, threads queueing new operations wait until there is room
+ * (backpressure).
+ *
+ * Retained messages and messages queued for offline clients are
+ * visible through the storage API once they are written. Queued
+ * messages are flushed (see \ref myqtt_storage_writer_flush) before
+ * they are delivered to a client that reconnects, and new
+ * subscriptions wait for retained messages pending before
+ * recovering them.
+ *
+ * The writer is stopped by \ref myqtt_exit_ctx, after running all
+ * operations pending.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param queue_limit Max number of operations pending (it must be > 0).
+ *
+ * @return axl_true if the writer was started (or it was already
+ * running, in that case queue_limit is updated), otherwise axl_false
+ * is returned.
+ */
+axl_bool myqtt_storage_writer_start (MyQttCtx * ctx, int queue_limit)
+{
+	if (ctx == NULL || queue_limit <= 0 || ctx->myqtt_exit)
+		return axl_false;
+
+	myqtt_mutex_lock (&ctx->storage_writer_m);
+	ctx->storage_writer_limit = queue_limit;
+	if (ctx->storage_writer_started) {
+		/* already running, just update limit */
+		myqtt_mutex_unlock (&ctx->storage_writer_m);
+		return axl_true;
+	} /* end if */
+
+	if (ctx->storage_writer_jobs == NULL)
+		ctx->storage_writer_jobs = axl_list_new (axl_list_always_return_1, NULL);
+	ctx->storage_writer_stop    = axl_false;
+	ctx->storage_writer_started = axl_true;
+
+	/* acquire a reference to the context during writer's life */
+	myqtt_ctx_ref2 (ctx, "storage writer");
+
+	if (! myqtt_thread_create (&ctx->storage_writer_thread,
+				   (MyQttThreadFunc) __myqtt_storage_writer_run,
+				   ctx,
+				   MYQTT_THREAD_CONF_END)) {
+		ctx->storage_writer_started = axl_false;
+		myqtt_mutex_unlock (&ctx->storage_writer_m);
+
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "unable to initialize the storage writer thread");
+		myqtt_ctx_unref2 (&ctx, "storage writer");
+		return axl_false;
+	} /* end if */
+	myqtt_mutex_unlock (&ctx->storage_writer_m);
+
+	return axl_true;
+}
+
+/** 
+ * @brief Queues a storage operation to be run by the storage writer
+ * (see \ref myqtt_storage_writer_start).
+ *
+ * If the writer is not running, the operation is run right away by
+ * the caller (along with on_done). If the queue is full, the caller
+ * waits until there is room. While the writer is being stopped,
+ * operations are still queued so they never overtake the ones
+ * pending.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param job The storage operation to run.
+ *
+ * @param on_done Optional completion handler.
+ *
+ * @param user_data User defined pointer passed to job and on_done.
+ *
+ * @param user_data2 Second user defined pointer passed to job and on_done.
+ *
+ * @return axl_true if the operation was queued or run, otherwise
+ * axl_false is returned (in that case neither job nor on_done are
+ * called).
+ */
+axl_bool myqtt_storage_writer_queue (MyQttCtx            * ctx, 
+				     MyQttStorageJob       job, 
+				     MyQttStorageJobDone   on_done, 
+				     axlPointer            user_data, 
+				     axlPointer            user_data2)
+{
+	MyQttStorageWriterJob * data;
+
+	if (ctx == NULL || job == NULL)
+		return axl_false;
+
+	myqtt_mutex_lock (&ctx->storage_writer_m);
+
+	/* apply backpressure when the queue is full (the writer
+	 * keeps running jobs while it is draining) */
+	while (ctx->storage_writer_started && 
+	       axl_list_length (ctx->storage_writer_jobs) >= ctx->storage_writer_limit)
+		myqtt_cond_timedwait (&ctx->storage_writer_c, &ctx->storage_writer_m, 10000);
+
+	if (! ctx->storage_writer_started) {
+		/* no writer running (or it already ran all pending
+		 * operations), do it now */
+		myqtt_mutex_unlock (&ctx->storage_writer_m);
+		__myqtt_storage_writer_run_job (ctx, job, on_done, user_data, user_data2);
+		return axl_true;
+	} /* end if */
+
+	data = axl_new (MyQttStorageWriterJob, 1);
+	if (data == NULL) {
+		myqtt_mutex_unlock (&ctx->storage_writer_m);
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to acquire memory to queue storage operation");
+		return axl_false;
+	} /* end if */
+	data->job        = job;
+	data->on_done    = on_done;
+	data->user_data  = user_data;
+	data->user_data2 = user_data2;
+
+	/* queue operation and signal writer */
+	axl_list_append (ctx->storage_writer_jobs, data);
+	myqtt_cond_broadcast (&ctx->storage_writer_c);
+	myqtt_mutex_unlock (&ctx->storage_writer_m);
+
+	return axl_true;
+}
+
+/** 
+ * @brief Waits until all operations queued into the storage writer
+ * have finished. It must not be called from a \ref MyQttStorageJob.
+ *
+ * @param ctx The context where the operation takes place.
+ */
+void     myqtt_storage_writer_flush (MyQttCtx * ctx)
+{
+	if (ctx == NULL)
+		return;
+
+	myqtt_mutex_lock (&ctx->storage_writer_m);
+	while (ctx->storage_writer_started && 
+	       (axl_list_length (ctx->storage_writer_jobs) > 0 || ctx->storage_writer_running_jobs > 0))
+		myqtt_cond_timedwait (&ctx->storage_writer_c, &ctx->storage_writer_m, 10000);
+	myqtt_mutex_unlock (&ctx->storage_writer_m);
+
+	return;
+}
+
+/** 
+ * @brief Allows to get the number of operations queued into the
+ * storage writer that have not finished yet.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @return Number of operations pending or -1 if it fails.
+ */
+int      myqtt_storage_writer_pending (MyQttCtx * ctx)
+{
+	int result;
+
+	if (ctx == NULL)
+		return -1;
+
+	myqtt_mutex_lock (&ctx->storage_writer_m);
+	result = ctx->storage_writer_running_jobs;
+	if (ctx->storage_writer_jobs)
+		result += axl_list_length (ctx->storage_writer_jobs);
+	myqtt_mutex_unlock (&ctx->storage_writer_m);
+
+	return result;
+}
+
+/** 
+ * @internal Waits until the provided counter of operations handed
+ * off to the storage writer (updated with myqtt_atomic_* by the
+ * operation's on_done handler) reaches 0. Unlike
+ * myqtt_storage_writer_flush, it returns right away when none of
+ * those operations is pending, no matter other operations queued.
+ * It must not be called from a MyQttStorageJob.
+ */
+void     __myqtt_storage_writer_wait (MyQttCtx * ctx, int * pending)
+{
+	if (ctx == NULL || pending == NULL || myqtt_atomic_get (pending) <= 0)
+		return;
+
+	/* the writer signals storage_writer_c after each operation */
+	myqtt_mutex_lock (&ctx->storage_writer_m);
+	while (myqtt_atomic_get (pending) > 0)
+		myqtt_cond_timedwait (&ctx->storage_writer_c, &ctx->storage_writer_m, 10000);
+	myqtt_mutex_unlock (&ctx->storage_writer_m);
+
+	return;
+}
+
+/** 
+ * @internal Stops the storage writer (if started) once all pending
+ * operations are done (called from myqtt_exit_ctx).
+ */
+void     __myqtt_storage_writer_stop (MyQttCtx * ctx)
+{
+	myqtt_mutex_lock (&ctx->storage_writer_m);
+	if (! ctx->storage_writer_started) {
+		myqtt_mutex_unlock (&ctx->storage_writer_m);
+		return;
+	} /* end if */
+	ctx->storage_writer_stop = axl_true;
+	myqtt_cond_broadcast (&ctx->storage_writer_c);
+	myqtt_mutex_unlock (&ctx->storage_writer_m);
+
+	/* wait writer to finish */
+	myqtt_thread_destroy (&ctx->storage_writer_thread, axl_false);
+
+	myqtt_mutex_lock (&ctx->storage_writer_m);
+	ctx->storage_writer_started = axl_false;
+	myqtt_mutex_unlock (&ctx->storage_writer_m);
+
+	return;
+}
@@ -40,6 +40,11 @@
 #include <myqtt-conn-private.h>
 #include <myqtt-ctx-private.h>
 #include <dirent.h>
+#include <sys/stat.h>
+#include <limits.h>
+#if defined(MYQTT_HAVE_LZ4)
+#include <lz4.h>
+#endif
 
 /*
  * @internal Allows to report an storage error, giving errno error,
@@ -116,12 +121,54 @@ int __myqtt_storage_check (MyQttCtx * ctx, const char * client_identifier, axl_b
 	return axl_true; /* everything ok */
 }
 
+/** 
+ * @internal Returns the path of the shard selected (0 is the path
+ * configured by myqtt_storage_set_path).
+ */
+const char * __myqtt_storage_shard_path (MyQttCtx * ctx, int shard)
+{
+	if (shard <= 0 || shard > ctx->storage_shards_count)
+		return ctx->storage_path;
+	return ctx->storage_shards[shard - 1];
+}
+
+/** 
+ * @internal Creates storage root directory and its retained
+ * directory when they do not exist. Called holding ref_mutex.
+ */
+axl_bool __myqtt_storage_init_root (MyQttCtx * ctx, const char * root)
+{
+	char       * full_path;
+
+	/* create base storage path directory */
+	if (! myqtt_support_file_test (root, FILE_EXISTS | FILE_IS_DIR)) {
+		if (myqtt_mkdir (ctx, root, 0700)) {
+			__myqtt_storage_error_report (ctx, "Unable to create storage directory %s", root);
+			return axl_false;
+		} /* end if */
+	} /* end if */
+	
+	/* create retained directory */
+	full_path = myqtt_support_build_filename (root, "retained", NULL);
+	if (! myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
+		if (myqtt_mkdir (ctx, full_path, 0700)) {
+			__myqtt_storage_error_report (ctx, "Unable to create storage directory %s for retained messages", full_path);
+			axl_free (full_path);
+			return axl_false;
+		} /* end if */
+	} /* end if */
+	axl_free (full_path);
+
+	return axl_true;
+}
+
 axl_bool __myqtt_storage_init_base_storage (MyQttCtx * ctx)
 {
 	char       * env;
-	char       * full_path;
+	int          iterator;
 
-	/* if path is defined and exists, report ok */
+	/* if path is defined and exists, report ok (shards are
+	 * created when configured) */
 	if (ctx->storage_path && myqtt_support_file_test (ctx->storage_path, FILE_EXISTS | FILE_IS_DIR))
 		return axl_true;
 
@@ -146,30 +193,16 @@ axl_bool __myqtt_storage_init_base_storage (MyQttCtx * ctx)
 		return axl_false;
 	}  /* end if */
 
-	/* create base storage path directory */
-	if (! myqtt_support_file_test (ctx->storage_path, FILE_EXISTS | FILE_IS_DIR)) {
-		if (myqtt_mkdir (ctx, ctx->storage_path, 0700)) {
-			/* release */
-			myqtt_mutex_unlock (&ctx->ref_mutex);
-
-			__myqtt_storage_error_report (ctx, "Unable to create storage directory %s", ctx->storage_path);
-			return axl_false;
-		} /* end if */
-	} /* end if */
-	
-	/* create retained directory */
-	full_path = myqtt_support_build_filename (ctx->storage_path, "retained", NULL);
-	if (! myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
-		if (myqtt_mkdir (ctx, full_path, 0700)) {
+	/* create storage directories (all shards) */
+	iterator = 0;
+	while (iterator <= ctx->storage_shards_count) {
+		if (! __myqtt_storage_init_root (ctx, __myqtt_storage_shard_path (ctx, iterator))) {
 			/* release */
 			myqtt_mutex_unlock (&ctx->ref_mutex);
-
-			__myqtt_storage_error_report (ctx, "Unable to create storage directory %s for retained messages", full_path);
-			axl_free (full_path);
 			return axl_false;
 		} /* end if */
-	} /* end if */
-	axl_free (full_path);
+		iterator++;
+	} /* end while */
 	
 	myqtt_mutex_unlock (&ctx->ref_mutex);
 
@@ -178,1552 +211,4352 @@ axl_bool __myqtt_storage_init_base_storage (MyQttCtx * ctx)
 }
 
 /** 
- * @brief Offline storage initialization for the provided client identifier.
- *
- * See \ref myqtt_storage_init for more information.
- *
- * @param ctx The context where the operation takes place.
- *
- * @param client_identifier The client identifier to initialize storage. 
- *
- * @param storage Part of the storage to initialize.
- *
- * @return If the function is not able to create default storage, the
- * function will fail, otherwise axl_true is returned. The function
- * also returns axl_false in the case client_id is NULL or empty or
- * the context is NULL too.
+ * @internal Returns the storage driver configured for the provided
+ * context (file storage by default).
  */
-axl_bool myqtt_storage_init_offline (MyQttCtx * ctx, const char * client_identifier, MyQttStorage storage)
+MyQttStorageBackend * __myqtt_storage_get (MyQttCtx * ctx)
 {
-	char       * full_path;
-	mode_t       umask_mode;
+	if (ctx->storage_backend)
+		return ctx->storage_backend;
+	return __myqtt_storage_backend_file ();
+}
 
-	/* check input parameters */
-	if (ctx == NULL || client_identifier == NULL || strlen (client_identifier) == 0)
-		return axl_false;
+/** 
+ * @internal Hash used to place keys on the consistent hashing ring
+ * (FNV-1a).
+ */
+unsigned int __myqtt_storage_ring_hash (const char * key)
+{
+	unsigned int hash = 2166136261u;
 
-	/* get previous umask and set a secure one by default during operations */
-	umask_mode = umask (0077);
+	while (key && (* key)) {
+		hash ^= (unsigned char) (* key);
+		hash *= 16777619u;
+		key++;
+	} /* end while */
 
-	/* lock during operation during this global configuration */
-	if (! __myqtt_storage_init_base_storage (ctx)) {
-		/* restore umask */
-		umask (umask_mode);
+	/* final mix to spread keys that only differ at the end */
+	hash ^= hash >> 15;
+	hash *= 0x2c1b3c6du;
+	hash ^= hash >> 12;
 
-		return axl_false;
-	} /* end if */
+	return hash;
+}
 
-	/* lock during check */
-	full_path = myqtt_support_build_filename (ctx->storage_path, client_identifier, NULL);
-	if (! myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
-		if (myqtt_mkdir (ctx, full_path, 0700)) {
-			/* restore umask */
-			umask (umask_mode);
+/** 
+ * @internal Virtual nodes placed on the ring for each shard.
+ */
+#define MYQTT_STORAGE_RING_REPLICAS 64
 
-			__myqtt_storage_error_report (ctx, "Unable to create storage directory %s", full_path);
-			axl_free (full_path);
-			return axl_false;
-		} /* end if */
+/** 
+ * @internal Rebuilds the consistent hashing ring with all shards
+ * configured. Called holding ref_mutex.
+ */
+axl_bool __myqtt_storage_ring_build (MyQttCtx * ctx)
+{
+	unsigned int   * points;
+	int            * shards;
+	int              size;
+	int              shard;
+	int              replica;
+	int              iterator;
+	int              pos;
+	char           * label;
+
+	size   = (ctx->storage_shards_count + 1) * MYQTT_STORAGE_RING_REPLICAS;
+	points = axl_new (unsigned int, size);
+	shards = axl_new (int, size);
+	if (points == NULL || shards == NULL) {
+		axl_free (points);
+		axl_free (shards);
+		return axl_false;
 	} /* end if */
 
-	myqtt_log (MYQTT_LEVEL_DEBUG, "Storage dir created at: %s", full_path);
-	axl_free (full_path);
+	/* place virtual nodes keeping the ring sorted (insertion,
+	 * only done while configuring) */
+	iterator = 0;
+	shard    = 0;
+	while (shard <= ctx->storage_shards_count) {
+		replica = 0;
+		while (replica < MYQTT_STORAGE_RING_REPLICAS) {
+			label = axl_strdup_printf ("%s#%d", __myqtt_storage_shard_path (ctx, shard), replica);
+			pos   = iterator;
+			while (pos > 0 && points[pos - 1] > __myqtt_storage_ring_hash (label)) {
+				points[pos] = points[pos - 1];
+				shards[pos] = shards[pos - 1];
+				pos--;
+			} /* end while */
+			points[pos] = __myqtt_storage_ring_hash (label);
+			shards[pos] = shard;
+			axl_free (label);
+
+			iterator++;
+			replica++;
+		} /* end while */
+		shard++;
+	} /* end while */
 
-	/* now create message directory, subs and will */
-	if ((storage & MYQTT_STORAGE_MSGS) == MYQTT_STORAGE_MSGS) {
-		full_path = myqtt_support_build_filename (ctx->storage_path, client_identifier, "msgs", NULL);
-		if (! myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
-			if (myqtt_mkdir (ctx, full_path, 0700)) {
-				/* restore umask */
-				umask (umask_mode);
+	/* replace ring */
+	axl_free (ctx->storage_ring_points);
+	axl_free (ctx->storage_ring_shards);
+	ctx->storage_ring_points = points;
+	ctx->storage_ring_shards = shards;
+	ctx->storage_ring_size   = size;
 
-				__myqtt_storage_error_report (ctx, "Unable to create storage directory %s for messages", full_path);
-				axl_free (full_path);
-				return axl_false;
-			} /* end if */
-		} /* end if */
-		axl_free (full_path);
-	} /* end if */
+	return axl_true;
+}
 
-	/* subs */
-	if ((storage & MYQTT_STORAGE_ALL) == MYQTT_STORAGE_ALL) {
-		full_path = myqtt_support_build_filename (ctx->storage_path, client_identifier, "subs", NULL);
-		if (! myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
-			if (myqtt_mkdir (ctx, full_path, 0700)) {
-				/* restore umask */
-				umask (umask_mode);
+/** 
+ * @internal Returns the storage root where the provided key (client
+ * identifier or retained topic name) is placed. Without additional
+ * shards this is always the storage path.
+ */
+const char * __myqtt_storage_root (MyQttCtx * ctx, const char * key)
+{
+	unsigned int hash;
+	int          low;
+	int          high;
+	int          middle;
+
+	if (ctx->storage_shards_count == 0 || ctx->storage_ring_size == 0)
+		return ctx->storage_path;
+
+	/* find first point on the ring equal or greater than the key */
+	hash = __myqtt_storage_ring_hash (key);
+	low  = 0;
+	high = ctx->storage_ring_size;
+	while (low < high) {
+		middle = (low + high) / 2;
+		if (ctx->storage_ring_points[middle] < hash)
+			low = middle + 1;
+		else
+			high = middle;
+	} /* end while */
 
-				__myqtt_storage_error_report (ctx, "Unable to create storage directory %s for subscriptions", full_path);
-				axl_free (full_path);
-				return axl_false;
-			} /* end if */
-		} /* end if */
-		axl_free (full_path);
-	} /* end if */
+	/* wrap around */
+	if (low == ctx->storage_ring_size)
+		low = 0;
 
-	/* will */
-	if ((storage & MYQTT_STORAGE_ALL) == MYQTT_STORAGE_ALL) {
-		full_path = myqtt_support_build_filename (ctx->storage_path, client_identifier, "will", NULL);
-		if (! myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
-			if (myqtt_mkdir (ctx, full_path, 0700)) {
-				/* restore umask */
-				umask (umask_mode);
+	return __myqtt_storage_shard_path (ctx, ctx->storage_ring_shards[low]);
+}
 
-				__myqtt_storage_error_report (ctx, "Unable to create storage directory %s for messages", full_path);
-				axl_free (full_path);
-				return axl_false;
-			} /* end if */
-		} /* end if */
-		axl_free (full_path);
-	} /* end if */
+/** 
+ * @internal Directory at the storage path holding the subscription
+ * and usage indexes. It is skipped when sessions are listed and it
+ * is not accepted as client identifier by the file storage.
+ */
+#define MYQTT_STORAGE_RESERVED_DIR  ".myqtt"
 
-	/* pkgids */
-	if ((storage & MYQTT_STORAGE_PKGIDS) == MYQTT_STORAGE_PKGIDS) {
-		full_path = myqtt_support_build_filename (ctx->storage_path, client_identifier, "pkgids", NULL);
-		if (! myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
-			if (myqtt_mkdir (ctx, full_path, 0700)) {
-				/* restore umask */
-				umask (umask_mode);
+/** 
+ * @internal Returns the path of the provided index file (placed at
+ * MYQTT_STORAGE_RESERVED_DIR), creating its directory when requested.
+ *
+ * @return A newly allocated path or NULL if it fails.
+ */
+char * __myqtt_storage_index_path (MyQttCtx * ctx, const char * name, axl_bool create)
+{
+	char * full_path;
 
-				__myqtt_storage_error_report (ctx, "Unable to create storage directory %s for messages", full_path);
-				axl_free (full_path);
-				return axl_false;
-			} /* end if */
+	if (create) {
+		full_path = myqtt_support_build_filename (ctx->storage_path, MYQTT_STORAGE_RESERVED_DIR, NULL);
+		if (full_path == NULL)
+			return NULL;
+		if (! myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR) && myqtt_mkdir (ctx, full_path, 0700)) {
+			__myqtt_storage_error_report (ctx, "Unable to create storage directory %s", full_path);
+			axl_free (full_path);
+			return NULL;
 		} /* end if */
 		axl_free (full_path);
 	} /* end if */
 
-	/* restore umask */
-	umask (umask_mode);
-
-	return axl_true;
+	return myqtt_support_build_filename (ctx->storage_path, MYQTT_STORAGE_RESERVED_DIR, name, NULL);
 }
 
-
 /** 
- * @brief Inits storage service for the provided client id.
- *
- * You can use \ref myqtt_storage_set_path to change default
- * location. If nothing is provided on the previous function, the
- * following locations are used to handle session storage:
- *
- * - ${HOME}/.myqtt-storage (if HOME variable is defined).
- * - .myqtt-storage
- * 
- *
- * @param ctx The context where the operation takes place. Cannot be NULL.
- *
- * @param conn The connection with a client identifier to init storage
- * services. Cannot be NULL
- *
- * @param storage Storage configuration to initialize
- *
- * @return If the function is not able to create default storage, the
- * function will fail, otherwise axl_true is returned. The function
- * also returns axl_false in the case client_id is NULL or empty or
- * the context is NULL too.
+ * @internal Usage counters kept for each client identifier. Seeding
+ * is set while counters are being read from the driver (see
+ * __myqtt_storage_usage_seed): updates found meanwhile are kept as
+ * pending and applied once seeding finishes.
  */
-axl_bool myqtt_storage_init (MyQttCtx * ctx, MyQttConn * conn, MyQttStorage storage)
-{
-	axl_bool result;
+typedef struct _MyQttStorageUsage {
+	int       messages;
+	int       bytes;
+	axl_bool  seeding;
+	int       pending_messages;
+	int       pending_bytes;
+} MyQttStorageUsage;
 
-	/* check input parameters */
-	if (ctx == NULL || conn == NULL || conn->client_identifier == NULL || strlen (conn->client_identifier) == 0)
-		return axl_false;
+/** 
+ * @internal Usage counters file name and header (the file is placed
+ * at MYQTT_STORAGE_RESERVED_DIR, next to the subscription index).
+ */
+#define MYQTT_STORAGE_USAGE_FILE    "usage.index"
+#define MYQTT_STORAGE_USAGE_HEADER  "MYQTT-USAGE-INDEX-1\n"
 
-	/* record storage was initilized */
-	if ((storage & conn->myqtt_storage_init) == storage)
-		return axl_true;
+/** 
+ * @internal Returns usage counters for the provided client
+ * identifier or NULL if they were not created. Must be called
+ * holding storage_usage_m.
+ */
+MyQttStorageUsage * __myqtt_storage_usage_get (MyQttCtx * ctx, const char * client_identifier)
+{
+	if (ctx->storage_usage == NULL)
+		return NULL;
+	return axl_hash_get (ctx->storage_usage, (axlPointer) client_identifier);
+}
 
-	/* create base storage path directory */
-	myqtt_mutex_lock (&conn->op_mutex);
+/** 
+ * @internal Reports usage counters for the provided client
+ * identifier. When they are not found they are seeded from what the
+ * driver reports (this is the only place where storage is scanned
+ * for a single session). The driver is queried without holding
+ * storage_usage_m: the entry is registered as seeding so updates
+ * found meanwhile are recorded as pending and added to what the
+ * driver reports.
+ */
+void __myqtt_storage_usage_seed (MyQttCtx * ctx, const char * client_identifier, int * messages, int * bytes)
+{
+	MyQttStorageBackend * backend;
+	MyQttStorageUsage   * usage;
+	MyQttStorageUsage   * seeding = NULL;
 
-	/* check again initialization */
-	if ((storage & conn->myqtt_storage_init) == storage) {
+	(* messages) = 0;
+	(* bytes)    = 0;
 
-		/* already initialized */
-		/* create base storage path directory */
-		myqtt_mutex_unlock (&conn->op_mutex);
+	/* no storage configured */
+	if (ctx->storage_backend == NULL && ctx->storage_path == NULL)
+		return;
 
-		return axl_true;
+	myqtt_mutex_lock (&ctx->storage_usage_m);
+	usage = __myqtt_storage_usage_get (ctx, client_identifier);
+	if (usage && ! usage->seeding) {
+		(* messages) = usage->messages;
+		(* bytes)    = usage->bytes;
+		myqtt_mutex_unlock (&ctx->storage_usage_m);
+		return;
 	} /* end if */
 
-	/* call to offline implementation */
-	result = myqtt_storage_init_offline (ctx, conn->client_identifier, storage);
+	if (usage == NULL) {
+		if (ctx->storage_usage == NULL)
+			ctx->storage_usage = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+		seeding = axl_new (MyQttStorageUsage, 1);
+		if (ctx->storage_usage && seeding) {
+			seeding->seeding = axl_true;
+			axl_hash_insert_full (ctx->storage_usage, axl_strdup (client_identifier), axl_free, seeding, axl_free);
+		} else {
+			axl_free (seeding);
+			seeding = NULL;
+		} /* end if */
+	} /* end if */
+	myqtt_mutex_unlock (&ctx->storage_usage_m);
+
+	/* seed from driver (another thread may be seeding this
+	 * client identifier, in such case only report) */
+	backend      = __myqtt_storage_get (ctx);
+	(* messages) = backend->queued_messages (ctx, client_identifier);
+	(* bytes)    = backend->queued_quota (ctx, client_identifier);
+	if (seeding == NULL)
+		return;
 
-	/* remember result only on ok event */
-	if (result) {
-		/* record storage was initilized */
-		conn->myqtt_storage_init |= storage;
+	myqtt_mutex_lock (&ctx->storage_usage_m);
+	/* skip it if counters were removed or replaced meanwhile */
+	if (__myqtt_storage_usage_get (ctx, client_identifier) == seeding && seeding->seeding) {
+		seeding->messages           = (* messages) + seeding->pending_messages;
+		seeding->bytes              = (* bytes) + seeding->pending_bytes;
+		seeding->seeding            = axl_false;
+		if (seeding->messages < 0)
+			seeding->messages = 0;
+		if (seeding->bytes < 0)
+			seeding->bytes = 0;
+		(* messages)                = seeding->messages;
+		(* bytes)                   = seeding->bytes;
+
+		/* update totals */
+		ctx->storage_usage_messages += seeding->messages;
+		ctx->storage_usage_bytes    += seeding->bytes;
 	} /* end if */
-	/* release */
-	myqtt_mutex_unlock (&conn->op_mutex);
-	
-	return result;
+	myqtt_mutex_unlock (&ctx->storage_usage_m);
+
+	return;
 }
 
 /** 
- * @brief Allows to clear current session storage associated to the provided connection.
- *
- * Cleaning session storage includes cleaning subscriptions, pending
- * messages and will configuration (if any).
- *
- * @param ctx The context where the operation takes place
- *
- * @param conn The connection with a client identifier to select the storage to clear
- *
- * @param storage The storage to remove. 
- *
- * @return axl_true If the operation completes, otherwise axl_false is
- * returned when a failure is found or parameters received aren't well defined.
+ * @internal Removes usage counters persisted at the storage path the
+ * first time counters change (they are no longer valid). They are
+ * written again by __myqtt_storage_usage_save.
  */
-axl_bool           myqtt_storage_clear            (MyQttCtx      * ctx,
-						   MyQttConn     * conn,
-						   MyQttStorage    storage)
+void __myqtt_storage_usage_claim (MyQttCtx * ctx)
 {
-	axl_bool result;
-
-	/* check input parameters */
-	if (ctx == NULL || conn == NULL || conn->client_identifier == NULL || strlen (conn->client_identifier) == 0)
-		return axl_false;
-
-	/* create base storage path directory */
-	myqtt_mutex_lock (&conn->op_mutex);
-
-	/* call to offline implementation */
-	result = myqtt_storage_clear_offline (ctx, conn->client_identifier, storage);
+	char * full_path;
 
-	/* release */
-	myqtt_mutex_unlock (&conn->op_mutex);
+	/* only file storage persists counters */
+	if (ctx->storage_backend || ctx->storage_path == NULL || myqtt_atomic_get (&ctx->storage_usage_claimed))
+		return;
+	if (! myqtt_atomic_cas (&ctx->storage_usage_claimed, 0, 1))
+		return;
 
-	return result;
+	full_path = __myqtt_storage_index_path (ctx, MYQTT_STORAGE_USAGE_FILE, axl_false);
+	if (full_path)
+		unlink (full_path);
+	axl_free (full_path);
+	return;
 }
 
-axl_bool __myqtt_storage_remove_files_from_dir (MyQttCtx * ctx, const char * clear_files_in_dir)
+/** 
+ * @internal Updates usage counters for the provided client
+ * identifier after a message was stored (positive values) or
+ * released (negative values). If counters were not yet created they
+ * are seeded from the driver, which already reflects the change.
+ */
+void __myqtt_storage_usage_update (MyQttCtx * ctx, const char * client_identifier, int messages, int bytes)
 {
-	struct dirent * entry;
-	DIR           * dir;
-	char          * full_path;
+	MyQttStorageUsage * usage;
+	int                 seeded_messages;
+	int                 seeded_bytes;
 
-	/* if directory does not exists, just say ok and leave it like
-	 * this */
-	if (! myqtt_support_file_test (clear_files_in_dir, FILE_EXISTS | FILE_IS_DIR))
-		return axl_true;
+	if (ctx == NULL || client_identifier == NULL)
+		return;
 
-	/* open dir */
-	dir = opendir (clear_files_in_dir);
-	if (dir == NULL) {
-		__myqtt_storage_error_report (ctx, "Failed to open directory %s for file deletion", clear_files_in_dir);
-		return axl_false;
-	}
-	
-	/* get first entry */
-	entry = readdir (dir);
-	while (entry) {
-		/* skip known directories we are not interested in */
-		if (axl_cmp (entry->d_name, ".") || axl_cmp (entry->d_name, "..")) {
-			/* get next entry */
-			entry = readdir (dir);
-			continue;
-		} /* end if */
+	__myqtt_storage_usage_claim (ctx);
 
-		/* check if we are talking about a file */
-		full_path = myqtt_support_build_filename (clear_files_in_dir, entry->d_name, NULL);
-		if (myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_REGULAR)) {
-			unlink (full_path);
-		} else if (myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR))
-			__myqtt_storage_remove_files_from_dir (ctx, full_path);
-		axl_free (full_path);
-		
-		/* get next entry */
-		entry = readdir (dir);
+	myqtt_mutex_lock (&ctx->storage_usage_m);
+	usage = __myqtt_storage_usage_get (ctx, client_identifier);
+	if (usage && usage->seeding) {
+		/* applied once the driver reports (see
+		 * __myqtt_storage_usage_seed) */
+		usage->pending_messages += messages;
+		usage->pending_bytes    += bytes;
+		myqtt_mutex_unlock (&ctx->storage_usage_m);
+		return;
 	} /* end if */
+	if (usage == NULL) {
+		myqtt_mutex_unlock (&ctx->storage_usage_m);
 
-	closedir (dir);
+		/* seed (includes this change) */
+		__myqtt_storage_usage_seed (ctx, client_identifier, &seeded_messages, &seeded_bytes);
+		return;
+	} /* end if */
 
-	return axl_true;
+	/* avoid going below zero */
+	if (usage->messages + messages < 0)
+		messages = - usage->messages;
+	if (usage->bytes + bytes < 0)
+		bytes = - usage->bytes;
+
+	usage->messages             += messages;
+	usage->bytes                += bytes;
+	ctx->storage_usage_messages += messages;
+	ctx->storage_usage_bytes    += bytes;
+	myqtt_mutex_unlock (&ctx->storage_usage_m);
+
+	return;
 }
 
 /** 
- * @brief Clears the storage associated to the provided client_identifier
- *
- * @param ctx The context where the operation will take place.
- *
- * @param client_identifier The client identifier for which the storage will be cleared.
- *
- * @param storage The part of the storage that have to be cleared.
- *
- * @return axl_true in the case clear operation took place without
- * errors, otherwise axl_false is returned.
+ * @internal Removes usage counters for the provided client
+ * identifier (its messages were removed).
  */
-axl_bool myqtt_storage_clear_offline    (MyQttCtx      * ctx, 
-					 const char    * client_identifier, 
-					 MyQttStorage    storage)
+void __myqtt_storage_usage_remove (MyQttCtx * ctx, const char * client_identifier)
 {
-	char      * full_path;
-	axl_bool    result;
+	MyQttStorageUsage * usage;
 
-	/* check input parameters */
 	if (ctx == NULL || client_identifier == NULL)
-		return axl_false;
-
-	/* lock during check */
-	full_path = myqtt_support_build_filename (ctx->storage_path, client_identifier, NULL);
-	result    = myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR);
-
-	/* release full path and check result */
-	axl_free (full_path);
-	if (! result) 
-		return axl_true;
+		return;
 
-	/* now create message directory, subs and will */
-	if ((storage & MYQTT_STORAGE_MSGS) == MYQTT_STORAGE_MSGS || 
-	    (storage & MYQTT_STORAGE_ALL) == MYQTT_STORAGE_ALL) {
-		full_path = myqtt_support_build_filename (ctx->storage_path, client_identifier, "msgs", NULL);
-		result    = __myqtt_storage_remove_files_from_dir (ctx, full_path);
+	__myqtt_storage_usage_claim (ctx);
 
-		/* release full path */
-		axl_free (full_path);
+	myqtt_mutex_lock (&ctx->storage_usage_m);
+	usage = __myqtt_storage_usage_get (ctx, client_identifier);
+	if (usage) {
+		ctx->storage_usage_messages -= usage->messages;
+		ctx->storage_usage_bytes    -= usage->bytes;
+		axl_hash_remove (ctx->storage_usage, (axlPointer) client_identifier);
 	} /* end if */
+	myqtt_mutex_unlock (&ctx->storage_usage_m);
 
-	/* subs */
-	if ((storage & MYQTT_STORAGE_ALL) == MYQTT_STORAGE_ALL) {
-		full_path = myqtt_support_build_filename (ctx->storage_path, client_identifier, "subs", NULL);
-		result    = __myqtt_storage_remove_files_from_dir (ctx, full_path);
+	return;
+}
 
-		/* release full path */
-		axl_free (full_path);
+/** 
+ * @internal Header placed in front of encoded payloads:
+ * magic (4 bytes), method (1 byte) and original size (4 bytes, big
+ * endian).
+ */
+#define MYQTT_STORAGE_PAYLOAD_MAGIC        "\x89MQZ"
+#define MYQTT_STORAGE_PAYLOAD_HEADER       9
+#define MYQTT_STORAGE_PAYLOAD_STORED       0
+#define MYQTT_STORAGE_PAYLOAD_LZ4          1
 
-	} /* end if */
+/** 
+ * @internal Builds an encoded payload with the provided method and
+ * size, leaving room for the content after the header.
+ */
+unsigned char * __myqtt_storage_payload_new (int method, int original_size, int content_size)
+{
+	unsigned char * result = axl_new (unsigned char, MYQTT_STORAGE_PAYLOAD_HEADER + content_size + 1);
 
-	/* will */
-	if ((storage & MYQTT_STORAGE_ALL) == MYQTT_STORAGE_ALL) {
-		full_path = myqtt_support_build_filename (ctx->storage_path, client_identifier, "will", NULL);
-		result    = __myqtt_storage_remove_files_from_dir (ctx, full_path);
+	if (result == NULL)
+		return NULL;
 
-		/* release full path */
-		axl_free (full_path);
+	memcpy (result, MYQTT_STORAGE_PAYLOAD_MAGIC, 4);
+	result[4] = method;
+	result[5] = (original_size >> 24) & 0xff;
+	result[6] = (original_size >> 16) & 0xff;
+	result[7] = (original_size >> 8)  & 0xff;
+	result[8] = original_size & 0xff;
 
-	} /* end if */
+	return result;
+}
 
-	/* pkgids */
-	if ((storage & MYQTT_STORAGE_PKGIDS) == MYQTT_STORAGE_PKGIDS || (storage & MYQTT_STORAGE_ALL) == MYQTT_STORAGE_ALL) {
-		full_path = myqtt_support_build_filename (ctx->storage_path, client_identifier, "pkgids", NULL);
-		result    = __myqtt_storage_remove_files_from_dir (ctx, full_path);
+/** 
+ * @internal Encodes the payload before handing it to the storage
+ * driver: it is compressed when configured and it pays off, or
+ * escaped when the raw payload starts like an encoded one.
+ *
+ * @return axl_true when the payload was encoded (result must be
+ * released by the caller with axl_free), otherwise axl_false is
+ * returned and the payload must be stored as is.
+ */
+axl_bool __myqtt_storage_payload_encode (MyQttCtx * ctx, const unsigned char * app_msg, int app_msg_size, unsigned char ** result, int * result_size)
+{
+#if defined(MYQTT_HAVE_LZ4)
+	int             bound;
+	int             size;
+#endif
 
-		/* release full path */
-		axl_free (full_path);
+	(* result)      = NULL;
+	(* result_size) = 0;
+	if (app_msg == NULL || app_msg_size <= 0)
+		return axl_false;
+
+#if defined(MYQTT_HAVE_LZ4)
+	if (ctx->storage_compression == MYQTT_STORAGE_COMPRESSION_LZ4 && app_msg_size >= ctx->storage_compression_threshold) {
+		bound     = LZ4_compressBound (app_msg_size);
+		(* result) = __myqtt_storage_payload_new (MYQTT_STORAGE_PAYLOAD_LZ4, app_msg_size, bound);
+		if ((* result) == NULL)
+			return axl_false;
+		size      = LZ4_compress_default ((const char *) app_msg, (char *) (* result) + MYQTT_STORAGE_PAYLOAD_HEADER, app_msg_size, bound);
 
+		/* only keep it when it saves space */
+		if (size > 0 && (size + MYQTT_STORAGE_PAYLOAD_HEADER) < app_msg_size) {
+			(* result_size) = size + MYQTT_STORAGE_PAYLOAD_HEADER;
+			return axl_true;
+		} /* end if */
+		axl_free (* result);
+		(* result) = NULL;
 	} /* end if */
+#endif
+
+	/* escape payloads that would be taken as encoded on recover */
+	if (app_msg_size < 4 || memcmp (app_msg, MYQTT_STORAGE_PAYLOAD_MAGIC, 4) != 0)
+		return axl_false;
+
+	(* result) = __myqtt_storage_payload_new (MYQTT_STORAGE_PAYLOAD_STORED, app_msg_size, app_msg_size);
+	if ((* result) == NULL)
+		return axl_false;
+	memcpy ((* result) + MYQTT_STORAGE_PAYLOAD_HEADER, app_msg, app_msg_size);
+	(* result_size) = app_msg_size + MYQTT_STORAGE_PAYLOAD_HEADER;
 
 	return axl_true;
 }
 
-void      __myqtt_storage_get_values_from_file_name (MyQttCtx * ctx, const char * file_name, 
-						     int * packet_id, int * size, int * qos)
+/** 
+ * @internal Decodes a payload recovered from the storage driver,
+ * replacing (and releasing) the provided one when it was encoded by
+ * __myqtt_storage_payload_encode.
+ *
+ * @return axl_false when the payload is encoded but it cannot be
+ * decoded (it is left untouched), otherwise axl_true.
+ */
+axl_bool __myqtt_storage_payload_decode (MyQttCtx * ctx, unsigned char ** app_msg, int * app_msg_size)
 {
-	int pos;
-	int desp = 0;
+	unsigned char * payload = (* app_msg);
+	unsigned char * result;
+	int             method;
+	int             size;
 
-	/* get packet_id */
-	pos          = 0;
-	myqtt_log (MYQTT_LEVEL_DEBUG, "Getting packet_id from position: %s", file_name + desp + 1);
-	(*packet_id) = __myqtt_storage_get_size_from_file_name (ctx, file_name, &pos);
-	desp         = pos;
-	
-	/* get size */
-	myqtt_log (MYQTT_LEVEL_DEBUG, "Getting size from position: %s", file_name + desp + 1);
-	(*size)      = __myqtt_storage_get_size_from_file_name (ctx, file_name + desp + 1, &pos);
-	desp        += (pos + 1);
-	
-	/* get qos */
-	myqtt_log (MYQTT_LEVEL_DEBUG, "Getting qos from position: %s", file_name + desp + 1);
-	(*qos)       = __myqtt_storage_get_size_from_file_name (ctx, file_name + desp + 1, &pos);
-	desp        += (pos + 1);
+	if (payload == NULL || (* app_msg_size) < MYQTT_STORAGE_PAYLOAD_HEADER || memcmp (payload, MYQTT_STORAGE_PAYLOAD_MAGIC, 4) != 0)
+		return axl_true;
 
-	return;
+	/* get method and original size */
+	method = payload[4];
+	size   = (payload[5] << 24) | (payload[6] << 16) | (payload[7] << 8) | payload[8];
+	if (size <= 0) {
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Unable to decode stored payload, wrong original size found (%d)", size);
+		return axl_false;
+	} /* end if */
+
+	result = axl_new (unsigned char, size + 1);
+	if (result == NULL)
+		return axl_false;
+
+	switch (method) {
+	case MYQTT_STORAGE_PAYLOAD_STORED:
+		if (((* app_msg_size) - MYQTT_STORAGE_PAYLOAD_HEADER) != size)
+			goto failed;
+		memcpy (result, payload + MYQTT_STORAGE_PAYLOAD_HEADER, size);
+		break;
+#if defined(MYQTT_HAVE_LZ4)
+	case MYQTT_STORAGE_PAYLOAD_LZ4:
+		if (LZ4_decompress_safe ((const char *) payload + MYQTT_STORAGE_PAYLOAD_HEADER, (char *) result, 
+					 (* app_msg_size) - MYQTT_STORAGE_PAYLOAD_HEADER, size) != size)
+			goto failed;
+		break;
+#endif
+	default:
+		goto failed;
+	} /* end switch */
+
+	/* replace payload */
+	axl_free (payload);
+	(* app_msg)      = result;
+	(* app_msg_size) = size;
+	return axl_true;
+
+ failed:
+	myqtt_log (MYQTT_LEVEL_CRITICAL, "Unable to decode stored payload (method %d, size %d, stored size %d)", method, size, (* app_msg_size));
+	axl_free (result);
+	return axl_false;
 }
 
-int      __myqtt_storage_get_size_from_file_name (MyQttCtx * ctx, const char * file_name, int * position)
-{
-	int  iterator = 0;
-	char buffer[10];
+/** 
+ * @internal Subscription index operations (see
+ * __myqtt_storage_index_append).
+ */
+#define MYQTT_STORAGE_INDEX_SUB     1
+#define MYQTT_STORAGE_INDEX_UNSUB   2
+#define MYQTT_STORAGE_INDEX_CLEAR   3
 
-	/* clear buffer */
-	memset (buffer, 0, 10);
-	while (file_name[iterator] && iterator < 10) {
-		if (file_name[iterator] < 48 || file_name[iterator] > 57) {
-			if (position)
-				(*position) = iterator;
-			return myqtt_support_strtod (buffer, NULL);
-		}
+/** 
+ * @internal Subscription index file name and header (the file is
+ * placed at MYQTT_STORAGE_RESERVED_DIR).
+ */
+#define MYQTT_STORAGE_INDEX_FILE    "subs.index"
+#define MYQTT_STORAGE_INDEX_HEADER  "MYQTT-SUBS-INDEX-1\n"
 
-		buffer[iterator] = file_name[iterator];
+/** 
+ * @internal Record header found in the subscription index, followed
+ * by client_identifier_len + topic_filter_len bytes.
+ */
+typedef struct _MyQttStorageIndexRecord {
+	int           op;
+	int           qos;
+	int           client_identifier_len;
+	int           topic_filter_len;
+	unsigned int  checksum;
+} MyQttStorageIndexRecord;
+
+/** 
+ * @internal FNV-1a checksum used to validate index records.
+ */
+unsigned int __myqtt_storage_index_checksum (unsigned int checksum, const unsigned char * data, int size)
+{
+	int iterator = 0;
+
+	while (iterator < size) {
+		checksum ^= data[iterator];
+		checksum *= 16777619;
 		iterator++;
-	}
+	} /* end while */
 
-	/* unable to identify value */
-	return -1;
+	return checksum;
 }
 
-axl_bool __myqtt_storage_read_content_into_reference (MyQttCtx * ctx, const char * file_path, unsigned char ** app_msg, int * app_msg_size)
+unsigned int __myqtt_storage_index_record_checksum (MyQttStorageIndexRecord * record, const char * client_identifier, const char * topic_filter)
 {
-	FILE         * handle;
-	struct stat    stat_ref;
+	unsigned int checksum = 2166136261U;
 
-	if (! app_msg)
-		return axl_false;
+	/* checksum header (without checksum field) and content */
+	checksum = __myqtt_storage_index_checksum (checksum, (const unsigned char *) record, sizeof (int) * 4);
+	checksum = __myqtt_storage_index_checksum (checksum, (const unsigned char *) client_identifier, record->client_identifier_len);
+	checksum = __myqtt_storage_index_checksum (checksum, (const unsigned char *) topic_filter, record->topic_filter_len);
 
-	/* clear received references */
-	*app_msg_size = -1;
-	*app_msg      = NULL;
+	return checksum;
+}
 
-	/* get size */
-	if (stat (file_path, &stat_ref) != 0) {
-		__myqtt_storage_error_report (ctx, "Failed to get stat(%s)", file_path);
-		return axl_false;
-	} /* end if */
+/** 
+ * @internal Writes a record into the provided index handle.
+ */
+axl_bool __myqtt_storage_index_write (FILE * handle, int op, const char * client_identifier, const char * topic_filter, MyQttQos qos)
+{
+	MyQttStorageIndexRecord record;
 
-	if (stat_ref.st_size > MYQTT_MAX_MSG_SIZE) {
-		myqtt_log (MYQTT_LEVEL_CRITICAL, "Unable to read content from %s, it has more size (%d) than allowed (%d)",
-			   file_path, stat_ref.st_size);
-		return axl_false;
-	}
-	
-	/* report st size */
-	if (app_msg_size)
-		(*app_msg_size) = stat_ref.st_size;
+	memset (&record, 0, sizeof (MyQttStorageIndexRecord));
+	record.op                    = op;
+	record.qos                   = qos;
+	record.client_identifier_len = strlen (client_identifier);
+	record.topic_filter_len      = topic_filter ? strlen (topic_filter) : 0;
+	record.checksum              = __myqtt_storage_index_record_checksum (&record, client_identifier, topic_filter);
 
-	/* open file */
-	handle = fopen (file_path, "r");
-	if (! handle) {
-		__myqtt_storage_error_report (ctx, "Unable to open file at %s", file_path);
+	if (fwrite (&record, sizeof (MyQttStorageIndexRecord), 1, handle) != 1)
 		return axl_false;
-	}
-	
-	/* read app message into app_msg */
-	(*app_msg) = axl_new (unsigned char, stat_ref.st_size + 1);
-	if ((*app_msg) == NULL) {
-		myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to allocate %d bytes to recover message", stat_ref.st_size);
-		fclose (handle);
+	if (fwrite (client_identifier, 1, record.client_identifier_len, handle) != record.client_identifier_len)
 		return axl_false;
-	} /* end if */
-
-	/* read entire content */
-	if (fread (*app_msg, 1, stat_ref.st_size, handle) != stat_ref.st_size) {
-		myqtt_log (MYQTT_LEVEL_CRITICAL, "fread (%p, 1, %d, %s) operation failed, expected to read %d, error was: %s", 
-			   *app_msg, stat_ref.st_size, file_path, stat_ref.st_size, myqtt_errno_get_error (errno));
-
-		fclose (handle);
-		axl_free (*app_msg);
+	if (record.topic_filter_len > 0 && fwrite (topic_filter, 1, record.topic_filter_len, handle) != record.topic_filter_len)
 		return axl_false;
-	} /* end if */
 
-	fclose (handle);
 	return axl_true;
 }
 
-axl_bool __myqtt_storage_sub_exists (MyQttCtx         * ctx, 
-				     const char       * full_path, 
-				     const char       * topic_filter, 
-				     int                topic_filter_len, 
-				     /* do not request for this parameter */
-				     /* MyQttQos     requested_qos,  */
-				     axl_bool           remove_if_found, 
-				     axl_bool           remove_msg_if_found,
-				     MyQttQos         * qos,
-				     unsigned char   ** app_msg,
-				     int              * app_msg_size)
+/** 
+ * @internal Appends a subscription change into the subscription
+ * index so myqtt_storage_load can restore offline subscriptions
+ * with a sequential read. Failures only disable the index (it is
+ * removed and rebuilt on next load with a directory walk).
+ */
+void __myqtt_storage_index_append (MyQttCtx * ctx, int op, const char * client_identifier, const char * topic_filter, MyQttQos qos)
 {
-	struct dirent * entry;
-	DIR           * sub_dir;
-	int             sub_size;
-	char            buffer[4096];
-	int             desp;
-	int             bytes_read;
-	FILE          * handle;
-	char          * aux_path, * aux_path2;
-	axl_bool        matches;
-	int             pos;
-	axl_bool        result = axl_false;
-
-	sub_dir = opendir (full_path);
-	if (sub_dir == NULL) {
-		/* myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to open directory %s for inspection, error was: %s", full_path, myqtt_errno_get_error (errno)); */
-		return axl_false;
-	} /* end if */
+	char * full_path;
 
-	/* clear buffer */
-	memset (buffer, 0, 4096);
+	if (ctx->storage_path == NULL)
+		return;
 
-	entry = readdir (sub_dir);
-	while (entry) {
-		/* skip known directories we are not interested in */
-		if (axl_cmp (entry->d_name, ".") || axl_cmp (entry->d_name, "..")) {
-			/* get next entry */
-			entry = readdir (sub_dir);
-			continue;
+	myqtt_mutex_lock (&ctx->storage_index_mutex);
+	full_path = __myqtt_storage_index_path (ctx, MYQTT_STORAGE_INDEX_FILE, axl_false);
+	if (ctx->storage_index == NULL) {
+		/* index is only appended once it was created by myqtt_storage_load */
+		if (full_path == NULL || ! myqtt_support_file_test (full_path, FILE_EXISTS)) {
+			myqtt_mutex_unlock (&ctx->storage_index_mutex);
+			axl_free (full_path);
+			return;
 		} /* end if */
 
-		/* skip .msg files */
-		if (strstr (entry->d_name, ".msg")) {
-			/* get next entry */
-			entry = readdir (sub_dir);
-			continue;
+		ctx->storage_index = fopen (full_path, "ab");
+		if (ctx->storage_index == NULL) {
+			__myqtt_storage_error_report (ctx, "Unable to open subscription index %s", full_path);
+			myqtt_mutex_unlock (&ctx->storage_index_mutex);
+			axl_free (full_path);
+			return;
 		} /* end if */
+	} /* end if */
 
-		/* get subscription size */
-		sub_size = __myqtt_storage_get_size_from_file_name (ctx, entry->d_name, &pos);
-
-		/* report qos if requested */
-		if (qos) 
-			(*qos) = __myqtt_storage_get_size_from_file_name (ctx, entry->d_name + pos + 1, NULL);
-
-		if (sub_size == topic_filter_len) {
-			/* ok, found a size match, try now to check content */
-			aux_path  = myqtt_support_build_filename (full_path, entry->d_name, NULL);
-
-			/* open the file */
-			handle    = fopen (aux_path, "r");
-			if (handle == NULL) {
-				/* get next entry */
-				entry = readdir (sub_dir);
-				axl_free (aux_path);
-				continue;
-			} /* end if */
+	if (! __myqtt_storage_index_write (ctx->storage_index, op, client_identifier, topic_filter, qos) || fflush (ctx->storage_index) != 0) {
+		/* index is no longer reliable, remove it to force a rebuild */
+		__myqtt_storage_error_report (ctx, "Failed to update subscription index %s, removing it", full_path);
+		fclose (ctx->storage_index);
+		ctx->storage_index = NULL;
+		unlink (full_path);
+	} /* end if */
 
+	myqtt_mutex_unlock (&ctx->storage_index_mutex);
+	axl_free (full_path);
+	return;
+}
 
-			desp    = 0;
-			matches = axl_true;
-			while (desp < topic_filter_len) {
+/** 
+ * @internal Closes subscription index handle (if opened).
+ */
+void __myqtt_storage_index_close (MyQttCtx * ctx)
+{
+	myqtt_mutex_lock (&ctx->storage_index_mutex);
+	if (ctx->storage_index)
+		fclose (ctx->storage_index);
+	ctx->storage_index = NULL;
+	myqtt_mutex_unlock (&ctx->storage_index_mutex);
+	return;
+}
 
-				/* read content from file into the buffer to do a partial check */
-				bytes_read = fread (buffer, 1, 4096, handle);
+/** 
+ * @internal Record found in the usage counters file, followed by
+ * client_identifier_len bytes.
+ */
+typedef struct _MyQttStorageUsageRecord {
+	int           messages;
+	int           bytes;
+	int           client_identifier_len;
+	unsigned int  checksum;
+} MyQttStorageUsageRecord;
+
+unsigned int __myqtt_storage_usage_record_checksum (MyQttStorageUsageRecord * record, const char * client_identifier)
+{
+	unsigned int checksum = 2166136261U;
 
-				/* do a partial check */
-				if (! axl_memcmp (buffer, topic_filter + desp, bytes_read)) {
-					/* mismatch found, this is not the file */
-					matches = axl_false;
-					break;
-				} /* end if */
-				
-				desp += bytes_read;
-			} /* end while */
+	/* checksum header (without checksum field) and content */
+	checksum = __myqtt_storage_index_checksum (checksum, (const unsigned char *) record, sizeof (int) * 3);
+	checksum = __myqtt_storage_index_checksum (checksum, (const unsigned char *) client_identifier, record->client_identifier_len);
 
-			/* close file handle anyway */
-			fclose (handle);
+	return checksum;
+}
 
-			myqtt_log (MYQTT_LEVEL_DEBUG, "Checking file %s, matches=%d", aux_path, matches);
+/** 
+ * @internal Reads usage counters persisted at the storage path into
+ * the provided hash.
+ *
+ * @return axl_false when the file is not found or fails validation.
+ */
+axl_bool __myqtt_storage_usage_read (MyQttCtx * ctx, axlHash * usage_hash, int * messages, long * bytes)
+{
+	char                    * full_path;
+	FILE                    * handle;
+	char                      header[sizeof (MYQTT_STORAGE_USAGE_HEADER)];
+	MyQttStorageUsageRecord   record;
+	MyQttStorageUsage       * usage;
+	char                    * client_identifier;
+	axl_bool                  result = axl_false;
+
+	full_path = __myqtt_storage_index_path (ctx, MYQTT_STORAGE_USAGE_FILE, axl_false);
+	handle    = full_path ? fopen (full_path, "rb") : NULL;
+	axl_free (full_path);
+	if (handle == NULL)
+		return axl_false;
 
-			/* if it matched, apply final actions */
-			if (matches) {
+	memset (header, 0, sizeof (header));
+	if (fread (header, 1, strlen (MYQTT_STORAGE_USAGE_HEADER), handle) != strlen (MYQTT_STORAGE_USAGE_HEADER) ||
+	    ! axl_cmp (header, MYQTT_STORAGE_USAGE_HEADER)) 
+		goto finish;
 
-				/* remove subscription */
-				if (remove_if_found) 
-					unlink (aux_path);
+	while (fread (&record, sizeof (MyQttStorageUsageRecord), 1, handle) == 1) {
+		if (record.messages < 0 || record.bytes < 0 || record.client_identifier_len <= 0 || record.client_identifier_len > 65535)
+			goto finish;
+
+		client_identifier = axl_new (char, record.client_identifier_len + 1);
+		if (client_identifier == NULL)
+			goto finish;
+		if (fread (client_identifier, 1, record.client_identifier_len, handle) != record.client_identifier_len ||
+		    __myqtt_storage_usage_record_checksum (&record, client_identifier) != record.checksum) {
+			axl_free (client_identifier);
+			goto finish;
+		} /* end if */
 
-				/* check to remove .msg if requested */
-				if (remove_msg_if_found || app_msg) {
-					aux_path2 = axl_strdup_printf ("%s.msg", aux_path);
+		usage = axl_new (MyQttStorageUsage, 1);
+		if (usage == NULL) {
+			axl_free (client_identifier);
+			goto finish;
+		} /* end if */
+		usage->messages = record.messages;
+		usage->bytes    = record.bytes;
+		axl_hash_insert_full (usage_hash, client_identifier, axl_free, usage, axl_free);
 
-					/* read content into reference */
-					if (app_msg) {
-						/* myqtt_log (MYQTT_LEVEL_DEBUG, "Calling to recover message %s", aux_path2); */
-						result = __myqtt_storage_read_content_into_reference (ctx, aux_path2, app_msg, app_msg_size);
-						myqtt_log (MYQTT_LEVEL_DEBUG, "Calling to recover message %s, status: %d", aux_path2, result);
-					}
+		(* messages) += usage->messages;
+		(* bytes)    += usage->bytes;
+	} /* end while */
 
-					unlink (aux_path2);
-					axl_free (aux_path2);
+	/* all records read */
+	result = feof (handle);
 
-					if (app_msg) {
-						if (! result && app_msg) {
-							/* nullify app message references */
-							(*app_msg) = NULL;
-							(*app_msg_size) = 0;
-						} /* end if */
+ finish:
+	fclose (handle);
+	return result;
+}
 
-						axl_free (aux_path);
-						closedir (sub_dir);
-						return result;
-					} /* end if */
-						
-				} /* end if */
+/** 
+ * @internal Loads usage counters for all sessions (called at
+ * myqtt_storage_load). File storage reads them from the file written
+ * by __myqtt_storage_usage_save at last stop. When it is not found
+ * (or other driver is used), sessions are walked. Storage is read
+ * without holding storage_usage_m.
+ */
+void __myqtt_storage_usage_load (MyQttCtx * ctx)
+{
+	MyQttStorageBackend * backend;
+	axlHash             * usage_hash;
+	axlList             * sessions;
+	MyQttStorageUsage   * usage;
+	const char          * client_identifier;
+	int                   iterator;
+	int                   messages = 0;
+	long                  bytes    = 0;
+
+	usage_hash = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+	if (usage_hash == NULL)
+		return;
 
-				axl_free (aux_path);
-				closedir (sub_dir);
-				return axl_true;
+	if (ctx->storage_backend || ctx->storage_path == NULL || myqtt_atomic_get (&ctx->storage_usage_claimed) ||
+	    ! __myqtt_storage_usage_read (ctx, usage_hash, &messages, &bytes)) {
+		/* walk all sessions */
+		axl_hash_free (usage_hash);
+		usage_hash = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+		if (usage_hash == NULL)
+			return;
+		messages = 0;
+		bytes    = 0;
+
+		backend  = __myqtt_storage_get (ctx);
+		sessions = backend->sessions (ctx);
+		iterator = 0;
+		while (sessions && iterator < axl_list_length (sessions)) {
+			client_identifier = axl_list_get_nth (sessions, iterator);
+			usage             = axl_new (MyQttStorageUsage, 1);
+			if (usage) {
+				usage->messages = backend->queued_messages (ctx, client_identifier);
+				usage->bytes    = backend->queued_quota (ctx, client_identifier);
+				axl_hash_insert_full (usage_hash, axl_strdup (client_identifier), axl_free, usage, axl_free);
+
+				messages += usage->messages;
+				bytes    += usage->bytes;
 			} /* end if */
+			iterator++;
+		} /* end while */
+		if (sessions)
+			axl_list_free (sessions);
+	} /* end if */
 
-			/* reached this point, we have found the file */
-			axl_free (aux_path);
+	/* install counters */
+	myqtt_mutex_lock (&ctx->storage_usage_m);
+	axl_hash_free (ctx->storage_usage);
+	ctx->storage_usage          = usage_hash;
+	ctx->storage_usage_messages = messages;
+	ctx->storage_usage_bytes    = bytes;
+	ctx->storage_usage_complete = axl_true;
+	myqtt_mutex_unlock (&ctx->storage_usage_m);
 
-		} /* end if */
+	return;
+}
 
+axl_bool __myqtt_storage_usage_write (axlPointer key, axlPointer data, axlPointer user_data)
+{
+	MyQttStorageUsage       * usage  = data;
+	FILE                   ** handle = user_data;
+	MyQttStorageUsageRecord   record;
 
-		/* get next entry */
-		entry = readdir (sub_dir);
-	}
+	/* nothing to record */
+	if (usage->seeding || (usage->messages == 0 && usage->bytes == 0))
+		return axl_false;
 
-	closedir (sub_dir);
+	memset (&record, 0, sizeof (MyQttStorageUsageRecord));
+	record.messages              = usage->messages;
+	record.bytes                 = usage->bytes;
+	record.client_identifier_len = strlen (key);
+	record.checksum              = __myqtt_storage_usage_record_checksum (&record, key);
+
+	if (fwrite (&record, sizeof (MyQttStorageUsageRecord), 1, (* handle)) != 1 ||
+	    fwrite (key, 1, record.client_identifier_len, (* handle)) != record.client_identifier_len) {
+		/* stop and report failure */
+		fclose (* handle);
+		(* handle) = NULL;
+		return axl_true;
+	} /* end if */
 
 	return axl_false;
 }
 
 /** 
- * @brief Function to record subscription for the provided client at
- * the current storage.
- *
- * @param ctx The context where the storage operation takes place.
- *
- * @param conn The connection for which the subscription will be stored.
- *
- * @param topic_filter The subscription's topic filter
- *
- * @param requested_qos The QoS requested by the application level.
- *
- * @return axl_true in the case the operation was completed otherwise
- * axl_false is returned.
+ * @internal Persists usage counters at the storage path so next
+ * myqtt_storage_load does not have to walk all sessions (called
+ * from myqtt_ctx_free once no thread is using the context). Counters
+ * are only written when they were loaded for all sessions.
  */
-axl_bool myqtt_storage_sub (MyQttCtx * ctx, MyQttConn * conn, const char * topic_filter, MyQttQos requested_qos)
+void __myqtt_storage_usage_save (MyQttCtx * ctx)
 {
-	if (conn == NULL)
-		return axl_false;
+	char     * full_path;
+	char     * tmp_path;
+	FILE     * handle;
 
-	/* call offline function */
-	return myqtt_storage_sub_offline (ctx, conn->client_identifier, topic_filter, requested_qos);
+	if (ctx->storage_backend || ctx->storage_path == NULL || ! ctx->storage_usage_complete)
+		return;
+	if (! myqtt_support_file_test (ctx->storage_path, FILE_EXISTS | FILE_IS_DIR))
+		return;
+
+	full_path = __myqtt_storage_index_path (ctx, MYQTT_STORAGE_USAGE_FILE, axl_true);
+	tmp_path  = full_path ? axl_strdup_printf ("%s.tmp", full_path) : NULL;
+	handle    = tmp_path ? fopen (tmp_path, "wb") : NULL;
+	if (handle == NULL) {
+		axl_free (full_path);
+		axl_free (tmp_path);
+		return;
+	} /* end if */
+
+	if (fwrite (MYQTT_STORAGE_USAGE_HEADER, 1, strlen (MYQTT_STORAGE_USAGE_HEADER), handle) != strlen (MYQTT_STORAGE_USAGE_HEADER)) {
+		fclose (handle);
+		handle = NULL;
+	} /* end if */
+	if (handle && ctx->storage_usage)
+		axl_hash_foreach (ctx->storage_usage, __myqtt_storage_usage_write, &handle);
+
+	if (handle && fclose (handle) == 0) {
+#if defined(AXL_OS_WIN32)
+		unlink (full_path);
+#endif
+		if (rename (tmp_path, full_path) != 0)
+			__myqtt_storage_error_report (ctx, "Unable to install usage counters at %s", full_path);
+	} else {
+		/* counters will be rebuilt on next load */
+		__myqtt_storage_error_report (ctx, "Unable to write usage counters at %s", tmp_path);
+		unlink (tmp_path);
+	} /* end if */
+
+	axl_free (full_path);
+	axl_free (tmp_path);
+	return;
 }
 
 /** 
- * @brief Offline function to record subscription for the provided
- * client identifer at the current storage.
- *
- * @param ctx The context where the storage operation takes place.
- *
- * @param client_identifier The client identifier where the store the subscription.
- *
- * @param topic_filter The subscription's topic filter
- *
- * @param requested_qos The QoS requested by the application level.
- *
- * @return axl_true in the case the operation was completed otherwise
- * axl_false is returned.
+ * @internal File storage implementation for init operation.
  */
-axl_bool myqtt_storage_sub_offline      (MyQttCtx      * ctx, 
-					 const char    * client_identifier,
-					 const char    * topic_filter, 
-					 MyQttQos        requested_qos)
+axl_bool __myqtt_storage_file_init (MyQttCtx * ctx, const char * client_identifier, MyQttStorage storage)
 {
-	char             * full_path;
-	char             * hash_value;
-	char             * path_item;
-	struct timeval     stamp;
-	int                topic_filter_len;
-	int                written;
-	FILE             * sub_file;
+	char       * full_path;
+	mode_t       umask_mode;
 
-	/* check input parameters */
-	topic_filter_len = __myqtt_storage_check (ctx, client_identifier, axl_true, topic_filter);
-	if (! topic_filter_len)
-		return axl_false;
+	/* get previous umask and set a secure one by default during operations */
+	umask_mode = umask (0077);
 
-	if (ctx == NULL || ctx->storage_path_hash_size == 0)
-		return axl_false;
+	/* lock during operation during this global configuration */
+	if (! __myqtt_storage_init_base_storage (ctx)) {
+		/* restore umask */
+		umask (umask_mode);
 
-	/* hash topic filter */
-	hash_value = axl_strdup_printf ("%u", axl_hash_string ((axlPointer) topic_filter) % ctx->storage_path_hash_size);
-	if (hash_value == NULL)
 		return axl_false;
+	} /* end if */
 
-	/* now create message directory */
-	full_path = myqtt_support_build_filename (ctx->storage_path, client_identifier, "subs", hash_value, NULL);
-	if (full_path == NULL) {
-		axl_free (hash_value);
+	/* the reserved directory cannot hold a session */
+	if (axl_cmp (client_identifier, MYQTT_STORAGE_RESERVED_DIR)) {
+		/* restore umask */
+		umask (umask_mode);
+
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Unable to create storage for client identifier %s, name is reserved", client_identifier);
 		return axl_false;
 	} /* end if */
 
-	/* create parent directory if it wasn't created */
+	/* lock during check */
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, NULL);
 	if (! myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
 		if (myqtt_mkdir (ctx, full_path, 0700)) {
-			/* get log */
-			__myqtt_storage_error_report (ctx, "Unable to create topic filter directory to store subscription: %s", full_path);
+			/* restore umask */
+			umask (umask_mode);
 
+			__myqtt_storage_error_report (ctx, "Unable to create storage directory %s", full_path);
 			axl_free (full_path);
-			axl_free (hash_value);
 			return axl_false;
 		} /* end if */
-	} else {
-		/* directory exists, check if the subscription is
-		 * already on the disk */
-		if (__myqtt_storage_sub_exists (ctx, full_path, topic_filter, topic_filter_len, axl_false, axl_false, NULL, NULL, NULL)) {
-			axl_free (full_path);
-			axl_free (hash_value);
-			return axl_true;
-		} /* end if */
-
 	} /* end if */
-	axl_free (full_path);
 
-	/* now storage subscription */
-	gettimeofday (&stamp, NULL);
-	path_item = axl_strdup_printf ("%d-%d-%d-%d-%d", topic_filter_len, requested_qos, hash_value, stamp.tv_sec, stamp.tv_usec);
+	myqtt_log (MYQTT_LEVEL_DEBUG, "Storage dir created at: %s", full_path);
+	axl_free (full_path);
 
-	if (path_item == NULL) {
-		axl_free (hash_value);
-		return axl_false;
+	/* now create message directory, subs and will */
+	if ((storage & MYQTT_STORAGE_MSGS) == MYQTT_STORAGE_MSGS) {
+		full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "msgs", NULL);
+		if (! myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
+			if (myqtt_mkdir (ctx, full_path, 0700)) {
+				/* restore umask */
+				umask (umask_mode);
+
+				__myqtt_storage_error_report (ctx, "Unable to create storage directory %s for messages", full_path);
+				axl_free (full_path);
+				return axl_false;
+			} /* end if */
+		} /* end if */
+		axl_free (full_path);
 	} /* end if */
 
-	/* build full path */
-	full_path = myqtt_support_build_filename (ctx->storage_path, client_identifier, "subs", hash_value, path_item, NULL);
-	axl_free (path_item);
-	axl_free (hash_value);
+	/* subs */
+	if ((storage & MYQTT_STORAGE_ALL) == MYQTT_STORAGE_ALL) {
+		full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "subs", NULL);
+		if (! myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
+			if (myqtt_mkdir (ctx, full_path, 0700)) {
+				/* restore umask */
+				umask (umask_mode);
 
-	if (full_path == NULL) 
-		return axl_false;
+				__myqtt_storage_error_report (ctx, "Unable to create storage directory %s for subscriptions", full_path);
+				axl_free (full_path);
+				return axl_false;
+			} /* end if */
+		} /* end if */
+		axl_free (full_path);
+	} /* end if */
 
-	/* open file and release path */
-	sub_file = fopen (full_path, "w");
-	if (sub_file == NULL) {
-		/* report log */
-		__myqtt_storage_error_report (ctx, "Unable to save subscription, failed to write to file '%s'", full_path);
+	/* will */
+	if ((storage & MYQTT_STORAGE_ALL) == MYQTT_STORAGE_ALL) {
+		full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "will", NULL);
+		if (! myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
+			if (myqtt_mkdir (ctx, full_path, 0700)) {
+				/* restore umask */
+				umask (umask_mode);
+
+				__myqtt_storage_error_report (ctx, "Unable to create storage directory %s for messages", full_path);
+				axl_free (full_path);
+				return axl_false;
+			} /* end if */
+		} /* end if */
 		axl_free (full_path);
-		return axl_false;
 	} /* end if */
-	axl_free (full_path);
 
-	written = fwrite (topic_filter, 1, topic_filter_len, sub_file);
-	if (written != topic_filter_len) {
-		/* report log */
-		__myqtt_storage_error_report (ctx, "fwrite() call failed to write expected bytes (%d), written (%d)", topic_filter_len, written);
-		return axl_false;
+	/* pkgids */
+	if ((storage & MYQTT_STORAGE_PKGIDS) == MYQTT_STORAGE_PKGIDS) {
+		full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "pkgids", NULL);
+		if (! myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
+			if (myqtt_mkdir (ctx, full_path, 0700)) {
+				/* restore umask */
+				umask (umask_mode);
+
+				__myqtt_storage_error_report (ctx, "Unable to create storage directory %s for messages", full_path);
+				axl_free (full_path);
+				return axl_false;
+			} /* end if */
+		} /* end if */
+		axl_free (full_path);
 	} /* end if */
 
-	fclose (sub_file);
+	/* restore umask */
+	umask (umask_mode);
 
 	return axl_true;
 }
 
 /** 
- * @brief Allows to check if the provided topic_filter is already subscribed for the provided connection and optionally removing it.
- *
- * @param ctx The context where operation takes place.
+ * @brief Offline storage initialization for the provided client identifier.
  *
- * @param conn The connection to check subscription.
+ * See \ref myqtt_storage_init for more information.
  *
- * @param topic_filter The topic filter to check.
+ * @param ctx The context where the operation takes place.
  *
- * @param requested_qos Requested QoS for the subscription.
+ * @param client_identifier The client identifier to initialize storage. 
  *
- * @param remove_if_found Remove the subscription if found.
+ * @param storage Part of the storage to initialize.
  *
- * @return axl_true if the subscription oepration was completed,
- * otherwise axl_false is reported.
+ * @return If the function is not able to create default storage, the
+ * function will fail, otherwise axl_true is returned. The function
+ * also returns axl_false in the case client_id is NULL or empty or
+ * the context is NULL too.
  */
-axl_bool myqtt_storage_sub_exists_common (MyQttCtx * ctx, MyQttConn * conn, const char * topic_filter, MyQttQos requested_qos, axl_bool remove_if_found)
+axl_bool myqtt_storage_init_offline (MyQttCtx * ctx, const char * client_identifier, MyQttStorage storage)
 {
-	int    topic_filter_len;
-	char * full_path;
-	char * hash_value;
-
-	if (ctx == NULL || ctx->storage_path_hash_size == 0)
+	/* check input parameters */
+	if (ctx == NULL || client_identifier == NULL || strlen (client_identifier) == 0)
 		return axl_false;
 
+	/* call to driver implementation */
+	return __myqtt_storage_get (ctx)->init (ctx, client_identifier, storage);
+}
+
+
+/** 
+ * @brief Inits storage service for the provided client id.
+ *
+ * You can use \ref myqtt_storage_set_path to change default
+ * location. If nothing is provided on the previous function, the
+ * following locations are used to handle session storage:
+ *
+ * - ${HOME}/.myqtt-storage (if HOME variable is defined).
+ * - .myqtt-storage
+ * 
+ *
+ * @param ctx The context where the operation takes place. Cannot be NULL.
+ *
+ * @param conn The connection with a client identifier to init storage
+ * services. Cannot be NULL
+ *
+ * @param storage Storage configuration to initialize
+ *
+ * @return If the function is not able to create default storage, the
+ * function will fail, otherwise axl_true is returned. The function
+ * also returns axl_false in the case client_id is NULL or empty or
+ * the context is NULL too.
+ */
+axl_bool myqtt_storage_init (MyQttCtx * ctx, MyQttConn * conn, MyQttStorage storage)
+{
+	axl_bool result;
+
 	/* check input parameters */
-	topic_filter_len = __myqtt_storage_check (ctx, conn->client_identifier, axl_true, topic_filter);
-	if (! topic_filter_len)
+	if (ctx == NULL || conn == NULL || conn->client_identifier == NULL || strlen (conn->client_identifier) == 0)
 		return axl_false;
 
-	/* hash topic filter */
-	hash_value = axl_strdup_printf ("%u", axl_hash_string ((axlPointer) topic_filter) % ctx->storage_path_hash_size);
-	if (hash_value == NULL)
-		return axl_false;
+	/* record storage was initilized */
+	if ((storage & conn->myqtt_storage_init) == storage)
+		return axl_true;
 
-	/* now create message directory */
-	full_path = myqtt_support_build_filename (ctx->storage_path, conn->client_identifier, "subs", hash_value, NULL);
-	axl_free (hash_value);
-	if (full_path == NULL) {
-		return axl_false;
-	} /* end if */
+	/* create base storage path directory */
+	myqtt_mutex_lock (&conn->op_mutex);
+
+	/* check again initialization */
+	if ((storage & conn->myqtt_storage_init) == storage) {
+
+		/* already initialized */
+		/* create base storage path directory */
+		myqtt_mutex_unlock (&conn->op_mutex);
 
-	/* call to check subscription in the provided directory */
-	if (__myqtt_storage_sub_exists (ctx, full_path, topic_filter, topic_filter_len, remove_if_found, axl_false, NULL, NULL, NULL)) {
-		axl_free (full_path);
 		return axl_true;
 	} /* end if */
 
-	axl_free (full_path);
+	/* wait if the session is being removed by the sweeper */
+	__myqtt_storage_expiring_wait (ctx, conn->client_identifier);
 
-	return axl_false;
+	/* call to offline implementation */
+	result = myqtt_storage_init_offline (ctx, conn->client_identifier, storage);
+
+	/* remember result only on ok event */
+	if (result) {
+		/* record storage was initilized */
+		conn->myqtt_storage_init |= storage;
+	} /* end if */
+	/* release */
+	myqtt_mutex_unlock (&conn->op_mutex);
+	
+	return result;
 }
 
 /** 
- * @brief Allows to check if the provided topic_filter is already
- * subscribed for the provided connection.
+ * @brief Allows to clear current session storage associated to the provided connection.
  *
- * @param ctx The context where operation takes place.
+ * Cleaning session storage includes cleaning subscriptions, pending
+ * messages and will configuration (if any).
  *
- * @param conn The connection to check subscription.
+ * @param ctx The context where the operation takes place
  *
- * @param topic_filter The topic filter to check.
+ * @param conn The connection with a client identifier to select the storage to clear
  *
- * @return axl_true if the subscription oepration was completed,
- * otherwise axl_false is reported.
+ * @param storage The storage to remove. 
+ *
+ * @return axl_true If the operation completes, otherwise axl_false is
+ * returned when a failure is found or parameters received aren't well defined.
  */
-axl_bool myqtt_storage_sub_exists (MyQttCtx * ctx, MyQttConn * conn, const char * topic_filter)
-{
-	/* call to check if it exists but without removing without caring about qos */
-	return myqtt_storage_sub_exists_common (ctx, conn, topic_filter, 0, axl_false);
-}
-
-void __myqtt_storage_sub_conn_register (MyQttCtx * ctx, const char * client_identifier, MyQttConn * conn, const char * file_name, const char * full_path, axl_bool __is_offline)
+axl_bool           myqtt_storage_clear            (MyQttCtx      * ctx,
+						   MyQttConn     * conn,
+						   MyQttStorage    storage)
 {
-	/* get qos from file name */
-	int        pos           = 0;
-	int        size          = __myqtt_storage_get_size_from_file_name (ctx, file_name, &pos);
-	MyQttQos   qos           = MYQTT_QOS_0;
-	char     * topic_filter;
-	FILE     * _file;
-
-	/* get qos */
-	if (pos >= (strlen (file_name) + 1))
-		return;
-
-	qos = __myqtt_storage_get_size_from_file_name (ctx, file_name + pos + 1, NULL);
-	topic_filter = axl_new (char, size + 1);
-	if (topic_filter == NULL)
-		return;
+	axl_bool result;
 
-	_file = fopen (full_path, "r");
-	if (_file == NULL) {
-		axl_free (topic_filter);
-		return;
-	} /* end if */
+	/* check input parameters */
+	if (ctx == NULL || conn == NULL || conn->client_identifier == NULL || strlen (conn->client_identifier) == 0)
+		return axl_false;
 
-	if (fread (topic_filter, 1, size, _file) != size) {
-		fclose (_file);
-		axl_free (topic_filter);
-		return;
-	} /* end if */
-	fclose (_file);
+	/* create base storage path directory */
+	myqtt_mutex_lock (&conn->op_mutex);
 
-	/* call to register */
-	myqtt_log (MYQTT_LEVEL_DEBUG, "Recovering subs for %s qos=%d sub=%s", client_identifier, qos, topic_filter);
-	/* printf ("**\n** __myqtt_storage_sub_conn_register : calling to __myqtt_reader_subscribe (ctx=%p, conn=%p)..\n**\n", ctx, conn); */
-	__myqtt_reader_subscribe (ctx, client_identifier, conn, topic_filter, qos, __is_offline);
+	/* call to offline implementation */
+	result = myqtt_storage_clear_offline (ctx, conn->client_identifier, storage);
 
-	/* it is not required to release topic_filter here, that
-	 * reference is not owned by __myqtt_reader_subscribe */
+	/* release */
+	myqtt_mutex_unlock (&conn->op_mutex);
 
-	return;
+	return result;
 }
 
-int __myqtt_storage_sub_count_aux (MyQttCtx * ctx, const char * client_identifier, MyQttConn * conn, const char * aux_path, axl_bool __register, axl_bool __is_offline)
+axl_bool __myqtt_storage_remove_files_from_dir (MyQttCtx * ctx, const char * clear_files_in_dir)
 {
-	DIR           * files;
 	struct dirent * entry;
+	DIR           * dir;
 	char          * full_path;
-	int             count = 0;
 
-	files = opendir (aux_path);
-	entry = readdir (files);
-	while (files && entry) {
+	/* if directory does not exists, just say ok and leave it like
+	 * this */
+	if (! myqtt_support_file_test (clear_files_in_dir, FILE_EXISTS | FILE_IS_DIR))
+		return axl_true;
 
-		/* get next entry and skip those we are not interested in */
-		if (axl_cmp (".", entry->d_name) || axl_cmp ("..", entry->d_name)) {
-			entry = readdir (files);
-			continue;
-		} /* end if */
-		
-		/* build path */
-#if defined(_DIRENT_HAVE_D_TYPE)
-		if ((entry->d_type & DT_REG) == DT_REG)
+	/* open dir */
+	dir = opendir (clear_files_in_dir);
+	if (dir == NULL) {
+		__myqtt_storage_error_report (ctx, "Failed to open directory %s for file deletion", clear_files_in_dir);
+		return axl_false;
+	}
+	
+	/* get first entry */
+	entry = readdir (dir);
+	while (entry) {
+		/* skip known directories we are not interested in */
+		if (axl_cmp (entry->d_name, ".") || axl_cmp (entry->d_name, "..")) {
+			/* get next entry */
+			entry = readdir (dir);
+			continue;
+		} /* end if */
+
+		/* check if we are talking about a file */
+		full_path = myqtt_support_build_filename (clear_files_in_dir, entry->d_name, NULL);
+		if (myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_REGULAR)) {
+			unlink (full_path);
+		} else if (myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR))
+			__myqtt_storage_remove_files_from_dir (ctx, full_path);
+		axl_free (full_path);
+		
+		/* get next entry */
+		entry = readdir (dir);
+	} /* end if */
+
+	closedir (dir);
+
+	return axl_true;
+}
+
+/** 
+ * @internal Removes the provided directory and all directories
+ * inside it (they must not contain files).
+ */
+void __myqtt_storage_remove_dirs (MyQttCtx * ctx, const char * dir_path)
+{
+	struct dirent * entry;
+	DIR           * dir;
+	char          * full_path;
+
+	dir = opendir (dir_path);
+	if (dir == NULL)
+		return;
+
+	entry = readdir (dir);
+	while (entry) {
+		if (! axl_cmp (entry->d_name, ".") && ! axl_cmp (entry->d_name, "..")) {
+			full_path = myqtt_support_build_filename (dir_path, entry->d_name, NULL);
+			if (myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR))
+				__myqtt_storage_remove_dirs (ctx, full_path);
+			axl_free (full_path);
+		} /* end if */
+
+		/* get next entry */
+		entry = readdir (dir);
+	} /* end while */
+	closedir (dir);
+
+	rmdir (dir_path);
+	return;
+}
+
+/** 
+ * @brief Clears the storage associated to the provided client_identifier
+ *
+ * @param ctx The context where the operation will take place.
+ *
+ * @param client_identifier The client identifier for which the storage will be cleared.
+ *
+ * @param storage The part of the storage that have to be cleared.
+ *
+ * @return axl_true in the case clear operation took place without
+ * errors, otherwise axl_false is returned.
+ */
+axl_bool myqtt_storage_clear_offline    (MyQttCtx      * ctx, 
+					 const char    * client_identifier, 
+					 MyQttStorage    storage)
+{
+	axl_bool result;
+
+	/* check input parameters */
+	if (ctx == NULL || client_identifier == NULL)
+		return axl_false;
+
+	/* call to driver implementation */
+	result = __myqtt_storage_get (ctx)->clear (ctx, client_identifier, storage);
+
+	/* messages were removed, drop usage counters */
+	if ((storage & MYQTT_STORAGE_MSGS) == MYQTT_STORAGE_MSGS)
+		__myqtt_storage_usage_remove (ctx, client_identifier);
+
+	return result;
+}
+
+/** 
+ * @internal File storage implementation for clear operation.
+ */
+axl_bool __myqtt_storage_file_clear (MyQttCtx * ctx, const char * client_identifier, MyQttStorage storage)
+{
+	char      * full_path;
+	axl_bool    result;
+
+	/* lock during check */
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, NULL);
+	result    = myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR);
+
+	/* release full path and check result */
+	axl_free (full_path);
+	if (! result) 
+		return axl_true;
+
+	/* now create message directory, subs and will */
+	if ((storage & MYQTT_STORAGE_MSGS) == MYQTT_STORAGE_MSGS || 
+	    (storage & MYQTT_STORAGE_ALL) == MYQTT_STORAGE_ALL) {
+		full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "msgs", NULL);
+		result    = __myqtt_storage_remove_files_from_dir (ctx, full_path);
+
+		/* release full path */
+		axl_free (full_path);
+	} /* end if */
+
+	/* subs */
+	if ((storage & MYQTT_STORAGE_ALL) == MYQTT_STORAGE_ALL) {
+		full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "subs", NULL);
+		result    = __myqtt_storage_remove_files_from_dir (ctx, full_path);
+
+		/* release full path */
+		axl_free (full_path);
+
+		/* record subscriptions removal into the index */
+		__myqtt_storage_index_append (ctx, MYQTT_STORAGE_INDEX_CLEAR, client_identifier, NULL, 0);
+
+	} /* end if */
+
+	/* will */
+	if ((storage & MYQTT_STORAGE_ALL) == MYQTT_STORAGE_ALL) {
+		full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "will", NULL);
+		result    = __myqtt_storage_remove_files_from_dir (ctx, full_path);
+
+		/* release full path */
+		axl_free (full_path);
+
+	} /* end if */
+
+	/* pkgids */
+	if ((storage & MYQTT_STORAGE_PKGIDS) == MYQTT_STORAGE_PKGIDS || (storage & MYQTT_STORAGE_ALL) == MYQTT_STORAGE_ALL) {
+		full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "pkgids", NULL);
+		result    = __myqtt_storage_remove_files_from_dir (ctx, full_path);
+
+		/* release full path */
+		axl_free (full_path);
+
+	} /* end if */
+
+	return axl_true;
+}
+
+void      __myqtt_storage_get_values_from_file_name (MyQttCtx * ctx, const char * file_name, 
+						     int * packet_id, int * size, int * qos)
+{
+	int pos;
+	int desp = 0;
+
+	/* get packet_id */
+	pos          = 0;
+	myqtt_log (MYQTT_LEVEL_DEBUG, "Getting packet_id from position: %s", file_name + desp + 1);
+	(*packet_id) = __myqtt_storage_get_size_from_file_name (ctx, file_name, &pos);
+	desp         = pos;
+	
+	/* get size */
+	myqtt_log (MYQTT_LEVEL_DEBUG, "Getting size from position: %s", file_name + desp + 1);
+	(*size)      = __myqtt_storage_get_size_from_file_name (ctx, file_name + desp + 1, &pos);
+	desp        += (pos + 1);
+	
+	/* get qos */
+	myqtt_log (MYQTT_LEVEL_DEBUG, "Getting qos from position: %s", file_name + desp + 1);
+	(*qos)       = __myqtt_storage_get_size_from_file_name (ctx, file_name + desp + 1, &pos);
+	desp        += (pos + 1);
+
+	return;
+}
+
+int      __myqtt_storage_get_size_from_file_name (MyQttCtx * ctx, const char * file_name, int * position)
+{
+	int  iterator = 0;
+	char buffer[10];
+
+	/* clear buffer */
+	memset (buffer, 0, 10);
+	while (file_name[iterator] && iterator < 10) {
+		if (file_name[iterator] < 48 || file_name[iterator] > 57) {
+			if (position)
+				(*position) = iterator;
+			return myqtt_support_strtod (buffer, NULL);
+		}
+
+		buffer[iterator] = file_name[iterator];
+		iterator++;
+	}
+
+	/* unable to identify value */
+	return -1;
+}
+
+/** 
+ * @internal Gets the stamp (seconds) when the message was stored
+ * from its file name (pkgid-size-qos-sec-usec) or -1 if it is not
+ * found.
+ */
+long     __myqtt_storage_get_stamp_from_file_name (MyQttCtx * ctx, const char * file_name)
+{
+	int iterator = 0;
+	int dashes   = 0;
+
+	/* skip packet id, size and qos */
+	while (file_name[iterator] && dashes < 3) {
+		if (file_name[iterator] == '-')
+			dashes++;
+		iterator++;
+	} /* end while */
+
+	if (dashes < 3 || file_name[iterator] < 48 || file_name[iterator] > 57)
+		return -1;
+
+	return strtol (file_name + iterator, NULL, 10);
+}
+
+axl_bool __myqtt_storage_read_content_into_reference (MyQttCtx * ctx, const char * file_path, unsigned char ** app_msg, int * app_msg_size)
+{
+	FILE         * handle;
+	struct stat    stat_ref;
+
+	if (! app_msg)
+		return axl_false;
+
+	/* clear received references */
+	*app_msg_size = -1;
+	*app_msg      = NULL;
+
+	/* get size */
+	if (stat (file_path, &stat_ref) != 0) {
+		__myqtt_storage_error_report (ctx, "Failed to get stat(%s)", file_path);
+		return axl_false;
+	} /* end if */
+
+	if (stat_ref.st_size > MYQTT_MAX_MSG_SIZE) {
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Unable to read content from %s, it has more size (%d) than allowed (%d)",
+			   file_path, stat_ref.st_size);
+		return axl_false;
+	}
+	
+	/* report st size */
+	if (app_msg_size)
+		(*app_msg_size) = stat_ref.st_size;
+
+	/* open file */
+	handle = fopen (file_path, "r");
+	if (! handle) {
+		__myqtt_storage_error_report (ctx, "Unable to open file at %s", file_path);
+		return axl_false;
+	}
+	
+	/* read app message into app_msg */
+	(*app_msg) = axl_new (unsigned char, stat_ref.st_size + 1);
+	if ((*app_msg) == NULL) {
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to allocate %d bytes to recover message", stat_ref.st_size);
+		fclose (handle);
+		return axl_false;
+	} /* end if */
+
+	/* read entire content */
+	if (fread (*app_msg, 1, stat_ref.st_size, handle) != stat_ref.st_size) {
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "fread (%p, 1, %d, %s) operation failed, expected to read %d, error was: %s", 
+			   *app_msg, stat_ref.st_size, file_path, stat_ref.st_size, myqtt_errno_get_error (errno));
+
+		fclose (handle);
+		axl_free (*app_msg);
+		return axl_false;
+	} /* end if */
+
+	fclose (handle);
+	return axl_true;
+}
+
+axl_bool __myqtt_storage_sub_exists (MyQttCtx         * ctx, 
+				     const char       * full_path, 
+				     const char       * topic_filter, 
+				     int                topic_filter_len, 
+				     /* do not request for this parameter */
+				     /* MyQttQos     requested_qos,  */
+				     axl_bool           remove_if_found, 
+				     axl_bool           remove_msg_if_found,
+				     MyQttQos         * qos,
+				     unsigned char   ** app_msg,
+				     int              * app_msg_size)
+{
+	struct dirent * entry;
+	DIR           * sub_dir;
+	int             sub_size;
+	char            buffer[4096];
+	int             desp;
+	int             bytes_read;
+	FILE          * handle;
+	char          * aux_path, * aux_path2;
+	axl_bool        matches;
+	int             pos;
+	axl_bool        result = axl_false;
+
+	sub_dir = opendir (full_path);
+	if (sub_dir == NULL) {
+		/* myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to open directory %s for inspection, error was: %s", full_path, myqtt_errno_get_error (errno)); */
+		return axl_false;
+	} /* end if */
+
+	/* clear buffer */
+	memset (buffer, 0, 4096);
+
+	entry = readdir (sub_dir);
+	while (entry) {
+		/* skip known directories we are not interested in */
+		if (axl_cmp (entry->d_name, ".") || axl_cmp (entry->d_name, "..")) {
+			/* get next entry */
+			entry = readdir (sub_dir);
+			continue;
+		} /* end if */
+
+		/* skip .msg files */
+		if (strstr (entry->d_name, ".msg")) {
+			/* get next entry */
+			entry = readdir (sub_dir);
+			continue;
+		} /* end if */
+
+		/* get subscription size */
+		sub_size = __myqtt_storage_get_size_from_file_name (ctx, entry->d_name, &pos);
+
+		/* report qos if requested */
+		if (qos) 
+			(*qos) = __myqtt_storage_get_size_from_file_name (ctx, entry->d_name + pos + 1, NULL);
+
+		if (sub_size == topic_filter_len) {
+			/* ok, found a size match, try now to check content */
+			aux_path  = myqtt_support_build_filename (full_path, entry->d_name, NULL);
+
+			/* open the file */
+			handle    = fopen (aux_path, "r");
+			if (handle == NULL) {
+				/* get next entry */
+				entry = readdir (sub_dir);
+				axl_free (aux_path);
+				continue;
+			} /* end if */
+
+
+			desp    = 0;
+			matches = axl_true;
+			while (desp < topic_filter_len) {
+
+				/* read content from file into the buffer to do a partial check */
+				bytes_read = fread (buffer, 1, 4096, handle);
+
+				/* do a partial check */
+				if (! axl_memcmp (buffer, topic_filter + desp, bytes_read)) {
+					/* mismatch found, this is not the file */
+					matches = axl_false;
+					break;
+				} /* end if */
+				
+				desp += bytes_read;
+			} /* end while */
+
+			/* close file handle anyway */
+			fclose (handle);
+
+			myqtt_log (MYQTT_LEVEL_DEBUG, "Checking file %s, matches=%d", aux_path, matches);
+
+			/* if it matched, apply final actions */
+			if (matches) {
+
+				/* remove subscription */
+				if (remove_if_found) 
+					unlink (aux_path);
+
+				/* check to remove .msg if requested */
+				if (remove_msg_if_found || app_msg) {
+					aux_path2 = axl_strdup_printf ("%s.msg", aux_path);
+
+					/* read content into reference */
+					if (app_msg) {
+						/* myqtt_log (MYQTT_LEVEL_DEBUG, "Calling to recover message %s", aux_path2); */
+						result = __myqtt_storage_read_content_into_reference (ctx, aux_path2, app_msg, app_msg_size);
+						myqtt_log (MYQTT_LEVEL_DEBUG, "Calling to recover message %s, status: %d", aux_path2, result);
+					}
+
+					unlink (aux_path2);
+					axl_free (aux_path2);
+
+					if (app_msg) {
+						if (! result && app_msg) {
+							/* nullify app message references */
+							(*app_msg) = NULL;
+							(*app_msg_size) = 0;
+						} /* end if */
+
+						axl_free (aux_path);
+						closedir (sub_dir);
+						return result;
+					} /* end if */
+						
+				} /* end if */
+
+				axl_free (aux_path);
+				closedir (sub_dir);
+				return axl_true;
+			} /* end if */
+
+			/* reached this point, we have found the file */
+			axl_free (aux_path);
+
+		} /* end if */
+
+
+		/* get next entry */
+		entry = readdir (sub_dir);
+	}
+
+	closedir (sub_dir);
+
+	return axl_false;
+}
+
+/** 
+ * @brief Function to record subscription for the provided client at
+ * the current storage.
+ *
+ * @param ctx The context where the storage operation takes place.
+ *
+ * @param conn The connection for which the subscription will be stored.
+ *
+ * @param topic_filter The subscription's topic filter
+ *
+ * @param requested_qos The QoS requested by the application level.
+ *
+ * @return axl_true in the case the operation was completed otherwise
+ * axl_false is returned.
+ */
+axl_bool myqtt_storage_sub (MyQttCtx * ctx, MyQttConn * conn, const char * topic_filter, MyQttQos requested_qos)
+{
+	if (conn == NULL)
+		return axl_false;
+
+	/* call offline function */
+	return myqtt_storage_sub_offline (ctx, conn->client_identifier, topic_filter, requested_qos);
+}
+
+/** 
+ * @brief Offline function to record subscription for the provided
+ * client identifer at the current storage.
+ *
+ * @param ctx The context where the storage operation takes place.
+ *
+ * @param client_identifier The client identifier where the store the subscription.
+ *
+ * @param topic_filter The subscription's topic filter
+ *
+ * @param requested_qos The QoS requested by the application level.
+ *
+ * @return axl_true in the case the operation was completed otherwise
+ * axl_false is returned.
+ */
+axl_bool myqtt_storage_sub_offline      (MyQttCtx      * ctx, 
+					 const char    * client_identifier,
+					 const char    * topic_filter, 
+					 MyQttQos        requested_qos)
+{
+	int                topic_filter_len;
+
+	/* check input parameters */
+	topic_filter_len = __myqtt_storage_check (ctx, client_identifier, axl_true, topic_filter);
+	if (! topic_filter_len)
+		return axl_false;
+
+	/* call to driver implementation */
+	return __myqtt_storage_get (ctx)->sub (ctx, client_identifier, topic_filter, topic_filter_len, requested_qos);
+}
+
+/** 
+ * @internal File storage implementation for sub operation.
+ */
+axl_bool __myqtt_storage_file_sub (MyQttCtx      * ctx, 
+				   const char    * client_identifier,
+				   const char    * topic_filter, 
+				   int             topic_filter_len,
+				   MyQttQos        requested_qos)
+{
+	char             * full_path;
+	char             * hash_value;
+	char             * path_item;
+	struct timeval     stamp;
+	int                written;
+	FILE             * sub_file;
+
+	if (ctx->storage_path_hash_size == 0)
+		return axl_false;
+
+	/* hash topic filter */
+	hash_value = axl_strdup_printf ("%u", axl_hash_string ((axlPointer) topic_filter) % ctx->storage_path_hash_size);
+	if (hash_value == NULL)
+		return axl_false;
+
+	/* now create message directory */
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "subs", hash_value, NULL);
+	if (full_path == NULL) {
+		axl_free (hash_value);
+		return axl_false;
+	} /* end if */
+
+	/* create parent directory if it wasn't created */
+	if (! myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
+		if (myqtt_mkdir (ctx, full_path, 0700)) {
+			/* get log */
+			__myqtt_storage_error_report (ctx, "Unable to create topic filter directory to store subscription: %s", full_path);
+
+			axl_free (full_path);
+			axl_free (hash_value);
+			return axl_false;
+		} /* end if */
+	} else {
+		/* directory exists, check if the subscription is
+		 * already on the disk */
+		if (__myqtt_storage_sub_exists (ctx, full_path, topic_filter, topic_filter_len, axl_false, axl_false, NULL, NULL, NULL)) {
+			axl_free (full_path);
+			axl_free (hash_value);
+			return axl_true;
+		} /* end if */
+
+	} /* end if */
+	axl_free (full_path);
+
+	/* now storage subscription */
+	gettimeofday (&stamp, NULL);
+	path_item = axl_strdup_printf ("%d-%d-%d-%d-%d", topic_filter_len, requested_qos, hash_value, stamp.tv_sec, stamp.tv_usec);
+
+	if (path_item == NULL) {
+		axl_free (hash_value);
+		return axl_false;
+	} /* end if */
+
+	/* build full path */
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "subs", hash_value, path_item, NULL);
+	axl_free (path_item);
+	axl_free (hash_value);
+
+	if (full_path == NULL) 
+		return axl_false;
+
+	/* open file and release path */
+	sub_file = fopen (full_path, "w");
+	if (sub_file == NULL) {
+		/* report log */
+		__myqtt_storage_error_report (ctx, "Unable to save subscription, failed to write to file '%s'", full_path);
+		axl_free (full_path);
+		return axl_false;
+	} /* end if */
+	axl_free (full_path);
+
+	written = fwrite (topic_filter, 1, topic_filter_len, sub_file);
+	if (written != topic_filter_len) {
+		/* report log */
+		__myqtt_storage_error_report (ctx, "fwrite() call failed to write expected bytes (%d), written (%d)", topic_filter_len, written);
+		return axl_false;
+	} /* end if */
+
+	fclose (sub_file);
+
+	/* record subscription into the index */
+	__myqtt_storage_index_append (ctx, MYQTT_STORAGE_INDEX_SUB, client_identifier, topic_filter, requested_qos);
+
+	return axl_true;
+}
+
+/** 
+ * @brief Allows to check if the provided topic_filter is already subscribed for the provided connection and optionally removing it.
+ *
+ * @param ctx The context where operation takes place.
+ *
+ * @param conn The connection to check subscription.
+ *
+ * @param topic_filter The topic filter to check.
+ *
+ * @param requested_qos Requested QoS for the subscription.
+ *
+ * @param remove_if_found Remove the subscription if found.
+ *
+ * @return axl_true if the subscription oepration was completed,
+ * otherwise axl_false is reported.
+ */
+axl_bool myqtt_storage_sub_exists_common (MyQttCtx * ctx, MyQttConn * conn, const char * topic_filter, MyQttQos requested_qos, axl_bool remove_if_found)
+{
+	int    topic_filter_len;
+
+	if (ctx == NULL || conn == NULL)
+		return axl_false;
+
+	/* check input parameters */
+	topic_filter_len = __myqtt_storage_check (ctx, conn->client_identifier, axl_true, topic_filter);
+	if (! topic_filter_len)
+		return axl_false;
+
+	/* call to driver implementation */
+	return __myqtt_storage_get (ctx)->sub_exists (ctx, conn->client_identifier, topic_filter, topic_filter_len, remove_if_found);
+}
+
+/** 
+ * @internal File storage implementation for sub_exists operation.
+ */
+axl_bool __myqtt_storage_file_sub_exists (MyQttCtx   * ctx, 
+					  const char * client_identifier, 
+					  const char * topic_filter, 
+					  int          topic_filter_len, 
+					  axl_bool     remove_if_found)
+{
+	char * full_path;
+	char * hash_value;
+
+	if (ctx->storage_path_hash_size == 0)
+		return axl_false;
+
+	/* hash topic filter */
+	hash_value = axl_strdup_printf ("%u", axl_hash_string ((axlPointer) topic_filter) % ctx->storage_path_hash_size);
+	if (hash_value == NULL)
+		return axl_false;
+
+	/* now create message directory */
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "subs", hash_value, NULL);
+	axl_free (hash_value);
+	if (full_path == NULL) {
+		return axl_false;
+	} /* end if */
+
+	/* call to check subscription in the provided directory */
+	if (__myqtt_storage_sub_exists (ctx, full_path, topic_filter, topic_filter_len, remove_if_found, axl_false, NULL, NULL, NULL)) {
+		axl_free (full_path);
+
+		/* record subscription removal into the index */
+		if (remove_if_found)
+			__myqtt_storage_index_append (ctx, MYQTT_STORAGE_INDEX_UNSUB, client_identifier, topic_filter, 0);
+		return axl_true;
+	} /* end if */
+
+	axl_free (full_path);
+
+	return axl_false;
+}
+
+/** 
+ * @brief Allows to check if the provided topic_filter is already
+ * subscribed for the provided connection.
+ *
+ * @param ctx The context where operation takes place.
+ *
+ * @param conn The connection to check subscription.
+ *
+ * @param topic_filter The topic filter to check.
+ *
+ * @return axl_true if the subscription oepration was completed,
+ * otherwise axl_false is reported.
+ */
+axl_bool myqtt_storage_sub_exists (MyQttCtx * ctx, MyQttConn * conn, const char * topic_filter)
+{
+	/* call to check if it exists but without removing without caring about qos */
+	return myqtt_storage_sub_exists_common (ctx, conn, topic_filter, 0, axl_false);
+}
+
+void __myqtt_storage_sub_conn_register (MyQttCtx      * ctx, 
+					const char    * client_identifier, 
+					const char    * topic_filter, 
+					MyQttQos        qos, 
+					axlPointer      user_data, 
+					axlPointer      user_data2)
+{
+	MyQttConn * conn         = user_data;
+	axl_bool    __is_offline = PTR_TO_INT (user_data2);
+
+	/* call to register */
+	myqtt_log (MYQTT_LEVEL_DEBUG, "Recovering subs for %s qos=%d sub=%s", client_identifier, qos, topic_filter);
+	/* printf ("**\n** __myqtt_storage_sub_conn_register : calling to __myqtt_reader_subscribe (ctx=%p, conn=%p)..\n**\n", ctx, conn); */
+	__myqtt_reader_subscribe (ctx, client_identifier, conn, axl_strdup (topic_filter), qos, __is_offline);
+
+	/* it is not required to release topic_filter copy here, that
+	 * reference is now owned by __myqtt_reader_subscribe */
+
+	return;
+}
+
+void __myqtt_storage_file_sub_read (MyQttCtx             * ctx, 
+				    const char           * client_identifier, 
+				    const char           * file_name, 
+				    const char           * full_path, 
+				    MyQttStorageSubFound   func, 
+				    axlPointer             user_data, 
+				    axlPointer             user_data2)
+{
+	/* get qos from file name */
+	int        pos           = 0;
+	int        size          = __myqtt_storage_get_size_from_file_name (ctx, file_name, &pos);
+	MyQttQos   qos           = MYQTT_QOS_0;
+	char     * topic_filter;
+	FILE     * _file;
+
+	/* get qos */
+	if (pos >= (strlen (file_name) + 1))
+		return;
+
+	qos = __myqtt_storage_get_size_from_file_name (ctx, file_name + pos + 1, NULL);
+	topic_filter = axl_new (char, size + 1);
+	if (topic_filter == NULL)
+		return;
+
+	_file = fopen (full_path, "r");
+	if (_file == NULL) {
+		axl_free (topic_filter);
+		return;
+	} /* end if */
+
+	if (fread (topic_filter, 1, size, _file) != size) {
+		fclose (_file);
+		axl_free (topic_filter);
+		return;
+	} /* end if */
+	fclose (_file);
+
+	/* notify subscription found */
+	func (ctx, client_identifier, topic_filter, qos, user_data, user_data2);
+	axl_free (topic_filter);
+
+	return;
+}
+
+int __myqtt_storage_sub_count_aux (MyQttCtx             * ctx, 
+				   const char           * client_identifier, 
+				   const char           * aux_path, 
+				   MyQttStorageSubFound   func, 
+				   axlPointer             user_data, 
+				   axlPointer             user_data2)
+{
+	DIR           * files;
+	struct dirent * entry;
+	char          * full_path;
+	int             count = 0;
+
+	files = opendir (aux_path);
+	if (files == NULL)
+		return 0;
+	entry = readdir (files);
+	while (entry) {
+
+		/* get next entry and skip those we are not interested in */
+		if (axl_cmp (".", entry->d_name) || axl_cmp ("..", entry->d_name)) {
+			entry = readdir (files);
+			continue;
+		} /* end if */
+		
+		/* build path */
+#if defined(_DIRENT_HAVE_D_TYPE)
+		if ((entry->d_type & DT_REG) == DT_REG)
+			count ++;
+
+		if (func) {
+			/* notify subscription */
+			full_path = myqtt_support_build_filename (aux_path, entry->d_name, NULL);
+			__myqtt_storage_file_sub_read (ctx, client_identifier, entry->d_name, full_path, func, user_data, user_data2);
+			axl_free (full_path);
+		} /* end if */
+#else 
+		full_path = myqtt_support_build_filename (aux_path, entry->d_name, NULL);
+		if (myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_REGULAR)) {
 			count ++;
+		} /* end if */
+
+		/* notify subscription */
+		if (func)
+			__myqtt_storage_file_sub_read (ctx, client_identifier, entry->d_name, full_path, func, user_data, user_data2);
+
+		axl_free (full_path);
+#endif
+		/* next file */
+		entry = readdir (files);
+	}
+
+	closedir (files);
+
+	return count;
+}
+
+/** 
+ * @internal File storage implementation for sub_iterate operation.
+ */
+int __myqtt_storage_file_sub_iterate (MyQttCtx             * ctx, 
+				      const char           * client_identifier, 
+				      MyQttStorageSubFound   func, 
+				      axlPointer             user_data, 
+				      axlPointer             user_data2)
+{
+	char          * full_path;
+	char          * aux_path;
+	DIR           * sub_dir;
+	struct dirent * entry;
+	int             total = 0;
+
+	/* get full path to subscriptions */
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "subs", NULL);
+	if (full_path == NULL) 
+		return -1; /* allocation failure */
+
+	if (! myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
+		axl_free (full_path);
+		return -1; /* directory do not exists */
+	} /* end if */
+
+	/* try to open path */
+	sub_dir = opendir (full_path);
+	if (sub_dir == NULL) {
+		__myqtt_storage_error_report (ctx, "Unable to open %s", full_path);
+		axl_free (full_path);
+		return -1;
+	} /* end if */
+	entry   = readdir (sub_dir);
+	while (entry) {
+
+		/* get next entry and skip those we are not interested in */
+		if (axl_cmp (".", entry->d_name) || axl_cmp ("..", entry->d_name)) {
+			entry = readdir (sub_dir);
+			continue;
+		} /* end if */
+
+		/* check if it is a directory */
+#if defined(_DIRENT_HAVE_D_TYPE)
+		if ((entry->d_type & DT_DIR) == DT_DIR) {
+			/* count subscriptions */
+			aux_path  = myqtt_support_build_filename (full_path, entry->d_name, NULL);
+			total    += __myqtt_storage_sub_count_aux (ctx, client_identifier, aux_path, func, user_data, user_data2);
+			axl_free (aux_path);
+		}
+#else 
+		aux_path = myqtt_support_build_filename (full_path, entry->d_name, NULL);
+		if (myqtt_support_file_test (aux_path, FILE_EXISTS | FILE_IS_DIR)) {
+			/* count subscriptions */
+			total += __myqtt_storage_sub_count_aux (ctx, client_identifier, aux_path, func, user_data, user_data2);
+		}
+		axl_free (aux_path);
+#endif
+
+		/* get next entry */
+		entry   = readdir (sub_dir);
+	}
+
+	closedir (sub_dir);
+	axl_free (full_path);
+
+	return total;
+}
+
+/** 
+ * @internal Function to iterate over all subscriptions to restore
+ * connection state.
+ *
+ * @param ctx The context where the operation will take place
+ *
+ * @param conn The connection where the operation will be implemented.
+ */
+int __myqtt_storage_iteration (MyQttCtx * ctx, const char * client_identifier, MyQttConn * conn, axl_bool __register, axl_bool __is_offline) {
+
+	int             total;
+
+	/* check input parameters */
+	if (! __myqtt_storage_check (ctx, client_identifier, axl_false, NULL))
+		return axl_false;
+
+	/* call to driver implementation */
+	total = __myqtt_storage_get (ctx)->sub_iterate (ctx, client_identifier, 
+							__register ? __myqtt_storage_sub_conn_register : NULL, 
+							conn, INT_TO_PTR (__is_offline));
+	if (total < 0)
+		return axl_false; /* no storage for this client */
+
+	if (__register)
+		return total > 0 ? total : __register;
+
+	return total;
+}
+
+/** 
+ * @brief Allows to get current number of subscriptions registered on
+ * the storage for the provided client identifier.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param client_identifier The client identifier to get subscription count from.
+ *
+ * @return Number of subscriptions.
+ */
+int      myqtt_storage_sub_count_offline (MyQttCtx      * ctx, 
+					  const char    * client_identifier)
+{
+	return __myqtt_storage_iteration (ctx, client_identifier, NULL, /* register */ axl_false, /* offline */ axl_true);
+}
+
+/** 
+ * @brief Allows to get current number of subscriptions registered on
+ * the storage for the provided connection.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param conn Connection to get subscription count from.
+ *
+ * @return Number of subscriptions.
+ */
+int      myqtt_storage_sub_count (MyQttCtx * ctx, MyQttConn * conn)
+{
+	if (conn == NULL)
+		return 0;
+
+	/* call to iterate and count */
+	return __myqtt_storage_iteration (ctx, conn->client_identifier, NULL, /* register */ axl_false, /* offline */ axl_false);
+}
+
+/** 
+ * @brief Function to unsubscribe the provided topic filter on the
+ * provided connection.
+ *
+ * @param ctx The context where the operation will take place.
+ *
+ * @param conn The connection for which the subscription will be stored.
+ *
+ * @param topic_filter The unsubscription' topic filter
+ *
+ * @return axl_true in the case the operation was completed otherwise
+ * axl_false is returned.
+ */
+axl_bool myqtt_storage_unsub (MyQttCtx * ctx, MyQttConn * conn, const char * topic_filter) 
+{
+	/* call to remove subscription */
+	return myqtt_storage_sub_exists_common (ctx, conn, topic_filter, 0, axl_true);
+}
+
+/** 
+ * @brief Allows to storage the provided message on the local session
+ * storage associated to the provided connection.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param client_identifier The client id for which the operation is requested.
+ *
+ * @param packet_id The packet id associated to the message.
+ *
+ * @param qos The QoS of the operation requested.
+ *
+ * @param app_msg The application message to store.
+ *
+ * @param app_msg_size The size of the application message to store.
+ *
+ * @return The function return NULL on failure and a handler that
+ * points to the message stored.
+ */
+axlPointer myqtt_storage_store_msg_offline (MyQttCtx      * ctx, 
+					    const char    * client_identifier,
+					    int             packet_id, 
+					    MyQttQos        qos, 
+					    unsigned char * app_msg, 
+					    int             app_msg_size)
+{
+	axlPointer      handle;
+	unsigned char * encoded;
+	int             encoded_size;
+
+	/* check input values:
+	 *
+	 * don't check here for (pkg_id > 65536) because we use values
+	 * over that to store QoS0 messages that do not need a valid
+	 * pkg_id but we need a different value to store them */
+	if (ctx == NULL || client_identifier == NULL || strlen (client_identifier) == 0 || packet_id < 0 || app_msg_size <= 0 || app_msg == NULL)
+		return NULL;
+
+	if (ctx->on_store && !(qos && MYQTT_QOS_SKIP_STOREAGE_NOTIFY)) {
+		/* call to check if we can store the message */
+		if (! ctx->on_store (ctx, NULL, client_identifier, packet_id, qos, app_msg, app_msg_size, ctx->on_store_data))
+			return NULL;
+	} /* end if */
+
+	/* compress payload when configured (quota accounts what is
+	 * really stored) */
+	if (__myqtt_storage_payload_encode (ctx, app_msg, app_msg_size, &encoded, &encoded_size)) {
+		app_msg      = encoded;
+		app_msg_size = encoded_size;
+	} /* end if */
+
+	/* call to driver implementation */
+	handle = __myqtt_storage_get (ctx)->store_msg (ctx, client_identifier, packet_id, qos, app_msg, app_msg_size);
+	if (handle)
+		__myqtt_storage_usage_update (ctx, client_identifier, 1, app_msg_size);
+	axl_free (encoded);
+
+	return handle;
+}
+
+/** 
+ * @internal File storage implementation for store_msg operation.
+ */
+axlPointer __myqtt_storage_file_store_msg (MyQttCtx      * ctx, 
+					   const char    * client_identifier,
+					   int             packet_id, 
+					   MyQttQos        qos, 
+					   unsigned char * app_msg, 
+					   int             app_msg_size)
+{
+	char            * full_path;
+	char            * ref;
+	struct timeval    stamp;
+	FILE            * handle;
+
+	/* call to init message store */
+	if (! myqtt_storage_init_offline (ctx, client_identifier, MYQTT_STORAGE_MSGS))
+		return NULL;
+
+	/* build path */
+	gettimeofday (&stamp, NULL);
+	ref       = axl_strdup_printf ("%d-%d-%d-%d-%d", packet_id, app_msg_size, qos, stamp.tv_sec, stamp.tv_usec);
+	if (! ref)
+		return NULL;
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "msgs", ref, NULL);
+	axl_free (ref);
+	if (! full_path) 
+		return NULL;
+
+	/* save file */
+	handle = fopen (full_path, "w");
+	if (! handle) {
+		/* report failure */
+		__myqtt_storage_error_report (ctx, "Failed to store message at %s", full_path);
+		axl_free (full_path);
+		return NULL;
+	} /* end if */
+	
+	if (fwrite (app_msg, 1, app_msg_size, handle) != app_msg_size) {
+		__myqtt_storage_error_report (ctx, "Failed to storage message at %s", full_path);
+		fclose (handle);
+		axl_free (full_path);
+		return NULL;
+	} /* end if */
+
+	/* message saved */
+	fclose (handle);
+	return full_path;	
+}
+
+/** 
+ * @brief Allows to storage the provided message on the local session
+ * storage associated to the provided connection.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param conn The connection to select local session storage.
+ *
+ * @param packet_id The packet id associated to the message.
+ *
+ * @param qos QoS of the message to be stored.
+ *
+ * @param app_msg The application message to store.
+ *
+ * @param app_msg_size The size of the application message to store.
+ *
+ * @return The function return NULL on failure and a handler that
+ * points to the message stored.
+ */
+axlPointer myqtt_storage_store_msg   (MyQttCtx * ctx, MyQttConn * conn, int packet_id, MyQttQos qos, unsigned char * app_msg, int app_msg_size)
+{
+	/* avoid segfault when conn reference is NULL */
+	if (conn == NULL)
+		return axl_false; 
+
+	if (ctx->on_store) {
+		/* call to check if we can store the message */
+		if (! ctx->on_store (ctx, conn, conn->client_identifier, packet_id, qos, app_msg, app_msg_size, ctx->on_store_data))
+			return NULL;
+	} /* end if */
+
+	return myqtt_storage_store_msg_offline (ctx, conn->client_identifier, packet_id, qos | MYQTT_QOS_SKIP_STOREAGE_NOTIFY, app_msg, app_msg_size);
+}
+
+/** 
+ * @brief Allows to release the provided message on the local session
+ * storage associated to the provided connection.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param conn The connection to select local session storage.
+ *
+ * @param handle Reference to the message as returned by \ref myqtt_storage_store_msg
+ *
+ * @param app_msg The application message to be released.
+ *
+ * @param app_msg_size Application message size to be released.
+ *
+ * @return axl_true if the message was successfully stored, otherwise
+ * axl_false is returned.
+ */
+axl_bool myqtt_storage_release_msg   (MyQttCtx      * ctx, 
+				      MyQttConn     * conn, 
+				      axlPointer      handle,
+				      unsigned char * app_msg,
+				      int             app_msg_size)
+{
+	MyQttQos     qos;
+	int          packet_id;
+	int          pos;
+	int          stored_size;
+	const char * name;
+
+	/* check input values */
+	if (ctx == NULL || conn == NULL)
+		return axl_false;
+
+	/* call to init message store */
+	if (! myqtt_storage_init (ctx, conn, MYQTT_STORAGE_MSGS))
+		return axl_false;
+
+	/* release the message */
+	if (handle) {
+		/* check and call on release message */
+		if (ctx->on_release) {
+			/* get packet id */
+			packet_id = __myqtt_storage_get_size_from_file_name (ctx, handle, NULL);
+			pos       = __myqtt_storage_strpos (ctx, handle, '-');
+
+			/* get next post to skip over app msg size */
+			pos       = __myqtt_storage_strpos (ctx, handle + pos + 1, '-');
+
+			/* get qos */
+			qos       = __myqtt_storage_get_size_from_file_name (ctx, handle + pos + 1, NULL);
+
+			/* call to notify release */
+			ctx->on_release (ctx, conn, conn->client_identifier, packet_id, qos, app_msg, app_msg_size, ctx->on_release_data);
+
+		} /* end if */
+
+		/* get size used by the message on the storage (it may be
+		 * compressed): handle ends with pkgid-size-qos-... */
+		name        = strrchr ((const char *) handle, '/');
+		name        = name ? name + 1 : (const char *) handle;
+		stored_size = -1;
+		pos         = __myqtt_storage_strpos (ctx, name, '-');
+		if (pos > 0)
+			stored_size = __myqtt_storage_get_size_from_file_name (ctx, name + pos + 1, NULL);
+		if (stored_size < 0)
+			stored_size = app_msg_size;
+
+		/* call to driver implementation */
+		__myqtt_storage_get (ctx)->release_msg (ctx, conn->client_identifier, handle);
+		axl_free ((char *) handle);
+
+		/* update usage */
+		__myqtt_storage_usage_update (ctx, conn->client_identifier, -1, - stored_size);
+	} /* end if */
+
+	return axl_true;
+}
+
+/** 
+ * @internal File storage implementation for release_msg operation.
+ */
+void __myqtt_storage_file_release_msg (MyQttCtx * ctx, const char * client_identifier, axlPointer handle)
+{
+	unlink ((const char *) handle);
+	return;
+}
+
+/** 
+ * @internal Latest retained value for a topic kept in memory when
+ * write-behind is enabled.
+ */
+typedef struct _MyQttStorageRetained {
+	MyQttQos          qos;
+	unsigned char   * app_msg;
+	int               app_msg_size;
+	/* retained message was removed (release or recover) */
+	axl_bool          released;
+	/* changed since last flush */
+	axl_bool          dirty;
+	int               version;
+} MyQttStorageRetained;
+
+void __myqtt_storage_retained_free (MyQttStorageRetained * retained)
+{
+	if (retained == NULL)
+		return;
+	axl_free (retained->app_msg);
+	axl_free (retained);
+	return;
+}
+
+/** 
+ * @internal Updates the retained value for the topic in the
+ * write-behind cache (app_msg NULL to record it was removed).
+ *
+ * @return axl_false when write-behind is not enabled (the caller
+ * must go to the storage driver).
+ */
+axl_bool __myqtt_storage_retain_cache_set (MyQttCtx            * ctx,
+					   const char          * topic_name,
+					   MyQttQos              qos,
+					   const unsigned char * app_msg,
+					   int                   app_msg_size)
+{
+	MyQttStorageRetained * retained;
+
+	myqtt_mutex_lock (&ctx->storage_retain_m);
+	if (! ctx->storage_retain_write_behind) {
+		myqtt_mutex_unlock (&ctx->storage_retain_m);
+		return axl_false;
+	} /* end if */
+
+	if (ctx->storage_retain_cache == NULL)
+		ctx->storage_retain_cache = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+	retained = ctx->storage_retain_cache ? axl_hash_get (ctx->storage_retain_cache, (axlPointer) topic_name) : NULL;
+	if (retained == NULL) {
+		retained = axl_new (MyQttStorageRetained, 1);
+		if (retained == NULL || ctx->storage_retain_cache == NULL) {
+			axl_free (retained);
+			myqtt_mutex_unlock (&ctx->storage_retain_m);
+			return axl_false;
+		} /* end if */
+		axl_hash_insert_full (ctx->storage_retain_cache, axl_strdup (topic_name), axl_free, 
+				      retained, (axlDestroyFunc) __myqtt_storage_retained_free);
+	} /* end if */
+
+	/* replace value */
+	axl_free (retained->app_msg);
+	retained->app_msg      = NULL;
+	retained->app_msg_size = 0;
+	retained->released     = (app_msg == NULL);
+	if (app_msg) {
+		retained->app_msg      = axl_new (unsigned char, app_msg_size + 1);
+		memcpy (retained->app_msg, app_msg, app_msg_size);
+		retained->app_msg_size = app_msg_size;
+	} /* end if */
+	retained->qos          = qos;
+	retained->dirty        = axl_true;
+	retained->version++;
+	myqtt_mutex_unlock (&ctx->storage_retain_m);
+
+	return axl_true;
+}
+
+/** 
+ * @internal Recovers (and removes, like storage drivers do) the
+ * retained value for the topic from the write-behind cache.
+ *
+ * @return 1 if the value was found and reported, 0 if the topic is
+ * known to have no retained message and -1 if it is not cached (the
+ * caller must go to the storage driver).
+ */
+int __myqtt_storage_retain_cache_recover (MyQttCtx        * ctx,
+					  const char      * topic_name,
+					  MyQttQos        * qos,
+					  unsigned char  ** app_msg,
+					  int             * app_msg_size)
+{
+	MyQttStorageRetained * retained;
+
+	myqtt_mutex_lock (&ctx->storage_retain_m);
+	retained = ctx->storage_retain_cache ? axl_hash_get (ctx->storage_retain_cache, (axlPointer) topic_name) : NULL;
+	if (retained == NULL) {
+		myqtt_mutex_unlock (&ctx->storage_retain_m);
+		return -1;
+	} /* end if */
+	if (retained->released) {
+		myqtt_mutex_unlock (&ctx->storage_retain_m);
+		return 0;
+	} /* end if */
+
+	/* report value, it is now removed */
+	if (qos)
+		(* qos)      = retained->qos;
+	(* app_msg)          = retained->app_msg;
+	(* app_msg_size)     = retained->app_msg_size;
+	retained->app_msg      = NULL;
+	retained->app_msg_size = 0;
+	retained->released     = axl_true;
+	retained->dirty        = axl_true;
+	retained->version++;
+	myqtt_mutex_unlock (&ctx->storage_retain_m);
+
+	return 1;
+}
+
+/** 
+ * @internal Context used to update the list of retained topics with
+ * values found on the write-behind cache. Topics in the list are
+ * indexed (topic -> the same string, NULL once released) so each
+ * cached value is merged without walking the list.
+ */
+typedef struct _MyQttStorageRetainedMerge {
+	axlList     * list;
+	axlHash     * index;
+	int           removed;
+	const char  * topic_filter;
+} MyQttStorageRetainedMerge;
+
+axl_bool __myqtt_storage_retain_cache_merge (axlPointer key, axlPointer data, axlPointer user_data)
+{
+	MyQttStorageRetainedMerge * merge    = user_data;
+	MyQttStorageRetained      * retained = data;
+	char                      * topic;
+
+	if (! myqtt_reader_topic_filter_match ((const char *) key, merge->topic_filter))
+		return axl_false; /* keep iterating */
+
+	/* only list strings are used as index keys (cache keys may
+	 * be released once the lock is left) */
+	topic = axl_hash_get (merge->index, key);
+	if (retained->released && topic) {
+		/* flag it, removed from the list once merged */
+		axl_hash_insert (merge->index, topic, NULL);
+		merge->removed++;
+	} else if (! retained->released && ! axl_hash_exists (merge->index, key)) {
+		topic = axl_strdup (key);
+		axl_list_append (merge->list, topic);
+		axl_hash_insert (merge->index, topic, topic);
+	} /* end if */
+
+	return axl_false; /* keep iterating */
+}
+
+/** 
+ * @internal Stores the retained message using the storage driver
+ * (see myqtt_storage_retain_msg_set).
+ */
+axl_bool __myqtt_storage_retain_write (MyQttCtx            * ctx,
+				       const char          * topic_name,
+				       int                   topic_filter_len,
+				       MyQttQos              qos,
+				       const unsigned char * app_msg,
+				       int                   app_msg_size)
+{
+	unsigned char   * encoded;
+	int               encoded_size;
+	axl_bool          result;
+
+	/* compress payload when configured */
+	if (__myqtt_storage_payload_encode (ctx, app_msg, app_msg_size, &encoded, &encoded_size)) {
+		app_msg      = encoded;
+		app_msg_size = encoded_size;
+	} /* end if */
+
+	/* call to driver implementation */
+	result = __myqtt_storage_get (ctx)->retain_set (ctx, topic_name, topic_filter_len, qos, app_msg, app_msg_size);
+	axl_free (encoded);
+
+	return result;
+}
+
+/** 
+ * @brief Allows to store retain message for the provided topic name
+ * so every new subscription on that topic will receive that message.
+ *
+ * The function will replace the previous retained message. If you
+ * want to remove an existing message call to \ref myqtt_storage_retain_msg_release
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param topic_name The topic name for the message and at the same
+ * time the subscription for which the message will be stored as
+ * retained.
+ *
+ * @param qos The app message qos.
+ *
+ * @param app_msg The application message to store.
+ *
+ * @param app_msg_size Application message size.
+ *
+ *
+ * @return axl_true in the case retain message was configured without errors, otherwise axl_false is returned.
+ */
+axl_bool       myqtt_storage_retain_msg_set (MyQttCtx            * ctx,
+					     const char          * topic_name,
+					     MyQttQos              qos,
+					     const unsigned char * app_msg,
+					     int                   app_msg_size)
+{
+	int               topic_filter_len;
+
+	if (ctx == NULL || topic_name == NULL || app_msg_size < 0)
+		return axl_false;
+
+	/* get topic filter len */
+	topic_filter_len = strlen (topic_name);
+	if (topic_filter_len == 0)
+		return axl_false;
+
+	/* keep it in memory when write-behind is enabled */
+	if (ctx->storage_retain_write_behind && 
+	    __myqtt_storage_retain_cache_set (ctx, topic_name, qos, app_msg ? app_msg : (const unsigned char *) "", app_msg_size))
+		return axl_true;
+
+	return __myqtt_storage_retain_write (ctx, topic_name, topic_filter_len, qos, app_msg, app_msg_size);
+}
+
+/** 
+ * @internal File storage implementation for retain_set operation.
+ */
+axl_bool __myqtt_storage_file_retain_set (MyQttCtx            * ctx,
+					  const char          * topic_name,
+					  int                   topic_filter_len,
+					  MyQttQos              qos,
+					  const unsigned char * app_msg,
+					  int                   app_msg_size)
+{
+	char            * hash_value;
+	char            * full_path;
+	char            * aux_path;
+	char            * path_item;
+	struct timeval    stamp;
+	FILE            * handle;
+
+	if (ctx->storage_path_hash_size == 0)
+		return axl_false;
+
+	/* hash topic filter */
+	hash_value = axl_strdup_printf ("%u", axl_hash_string ((axlPointer) topic_name) % ctx->storage_path_hash_size);
+	if (hash_value == NULL)
+		return axl_false;
+
+	/* call to check subscription in the provided directory. If it exists, remove it */	
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, topic_name), "retained", hash_value, NULL);
+	if (full_path == NULL) {
+		axl_free (hash_value);
+		return axl_false;
+	} /* end if */
+
+	/* remove the retained message if it does exists */
+	if (myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
+		/* directory exists, check to remove previous subscription */
+		__myqtt_storage_sub_exists (ctx, full_path, topic_name, strlen (topic_name), axl_true, axl_true, NULL, NULL, NULL);
+	} else {
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Found path %s does not exists, calling myqtt_mkdir ()", full_path);
+		
+		/* directory is not present, try to create it */
+		if (myqtt_mkdir (ctx, full_path, 0700)) {
+			__myqtt_storage_error_report (ctx, "Failed to create directory %s, unable to storage retained message, mkdir() failed", full_path);
+			axl_free (hash_value);
+			axl_free (full_path);
+			return axl_false;
+		} /* end if */
+	} /* end if */
+
+	/* release base path */
+	axl_free (full_path);
+
+	/* now save retained message, first subscription topic and qos */
+	gettimeofday (&stamp, NULL);
+	path_item = axl_strdup_printf ("%d-%d-%d-%d-%d", topic_filter_len, qos, hash_value, stamp.tv_sec, stamp.tv_usec);
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, topic_name), "retained", hash_value, path_item, NULL);
+	axl_free (path_item);
+	axl_free (hash_value);
+
+	/* open handle */
+	myqtt_log (MYQTT_LEVEL_DEBUG, "Saving retained message at %s", full_path);
+	handle = fopen (full_path, "w");
+	if (! handle) {
+		__myqtt_storage_error_report (ctx, "Failed to open file %s", full_path);
+		axl_free (full_path);
+		return axl_false;
+	} /* end if */
+
+	/* write subscription */
+	if (fwrite (topic_name, 1, topic_filter_len, handle) != topic_filter_len) {
+		fclose (handle);
+		__myqtt_storage_error_report (ctx, "Unable to store topic filter value at %s", full_path);
+		axl_free (full_path);
+		return axl_false;
+	} /* end if */
+
+	/* close this initial file */
+	fclose (handle);
+	
+	/* now write message content */
+	aux_path = axl_strdup_printf ("%s.msg", full_path);
+	axl_free (full_path);
+
+	/* open handle */
+	handle = fopen (aux_path, "w");
+	if (! handle) {
+		__myqtt_storage_error_report (ctx, "Failed to open file %s", aux_path);
+		axl_free (full_path);
+		return axl_false;
+	} /* end if */
+
+	/* write subscription */
+	if (fwrite (app_msg, 1, app_msg_size, handle) != app_msg_size) {
+		fclose (handle);
+		__myqtt_storage_error_report (ctx, "Unable to store topic filter value at %s", full_path);
+		axl_free (full_path);
+		return axl_false;
+	}
+	fclose (handle);
+
+	axl_free (aux_path);
+	
+	return axl_true;
+}
+
+/** 
+ * @brief Allows to release retain message (if any) associated to the
+ * provided topic_filter.
+ */
+void       myqtt_storage_retain_msg_release (MyQttCtx      * ctx,
+					     const char    * topic_name)
+{
+	int               topic_filter_len;
+
+	if (ctx == NULL || topic_name == NULL)
+		return;
+
+	/* get topic filter len */
+	topic_filter_len = strlen (topic_name);
+	if (topic_filter_len == 0)
+		return;
+
+	/* record removal in memory when write-behind is enabled */
+	if (ctx->storage_retain_write_behind && __myqtt_storage_retain_cache_set (ctx, topic_name, 0, NULL, 0))
+		return;
+
+	/* call to driver implementation */
+	__myqtt_storage_get (ctx)->retain_release (ctx, topic_name, topic_filter_len);
+	return;
+}
+
+/** 
+ * @internal File storage implementation for retain_release operation.
+ */
+void __myqtt_storage_file_retain_release (MyQttCtx * ctx, const char * topic_name, int topic_filter_len)
+{
+	char            * hash_value;
+	char            * full_path;
+
+	if (ctx->storage_path_hash_size == 0)
+		return;
+	
+	/* hash topic filter */
+	hash_value = axl_strdup_printf ("%u", axl_hash_string ((axlPointer) topic_name) % ctx->storage_path_hash_size);
+	if (hash_value == NULL)
+		return;
+
+	/* call to check subscription in the provided directory. If it exists, remove it */	
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, topic_name), "retained", hash_value, NULL);
+	axl_free (hash_value);
+	if (full_path == NULL) 
+		return;
+
+	/* remove subscription (well, in fact topic name) and message associated if it exists */
+	myqtt_log (MYQTT_LEVEL_DEBUG, "Releasing retained message for subscription %s at %s", topic_name, full_path);
+	__myqtt_storage_sub_exists (ctx, full_path, topic_name, topic_filter_len, axl_true, axl_true, NULL, NULL, NULL);
+	axl_free (full_path);
+
+	return;
+}
+
+/** 
+ * @brief Allows to recover retained message for the provided topic (if any).
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param topic_name The topic name for which the retain message recovery will be attempted
+ *
+ * @param qos A referece to hold recovered qos
+ *
+ * @param app_msg A referece to hold recovered application message.
+ *
+ * @param app_msg_size A reference to hold recovered application message size.
+ *
+ * @return The function reports axl_true when the message was
+ * recovered. Otherwise, axl_false is reported.
+ */
+axl_bool      myqtt_storage_retain_msg_recover (MyQttCtx       * ctx,
+						const char     * topic_name,
+						MyQttQos       * qos,
+						unsigned char ** app_msg,
+						int            * app_msg_size)
+{
+	int               topic_filter_len;
+
+	if (ctx == NULL || topic_name == NULL)
+		return axl_false;
+
+	/* get topic filter len */
+	topic_filter_len = strlen (topic_name);
+	if (topic_filter_len == 0)
+		return axl_false;
+
+	/* check values kept in memory first */
+	if (ctx->storage_retain_write_behind || ctx->storage_retain_cache) {
+		switch (__myqtt_storage_retain_cache_recover (ctx, topic_name, qos, app_msg, app_msg_size)) {
+		case 1:
+			return axl_true;
+		case 0:
+			return axl_false;
+		default:
+			break;
+		} /* end switch */
+	} /* end if */
+
+	/* call to driver implementation */
+	if (! __myqtt_storage_get (ctx)->retain_recover (ctx, topic_name, topic_filter_len, qos, app_msg, app_msg_size))
+		return axl_false;
+
+	/* decompress payload if needed */
+	if (! __myqtt_storage_payload_decode (ctx, app_msg, app_msg_size)) {
+		axl_free (* app_msg);
+		(* app_msg)      = NULL;
+		(* app_msg_size) = 0;
+		return axl_false;
+	} /* end if */
+
+	return axl_true;
+}
+
+/** 
+ * @internal File storage implementation for retain_recover operation.
+ */
+axl_bool __myqtt_storage_file_retain_recover (MyQttCtx       * ctx,
+					      const char     * topic_name,
+					      int              topic_filter_len,
+					      MyQttQos       * qos,
+					      unsigned char ** app_msg,
+					      int            * app_msg_size)
+{
+	char            * hash_value;
+	char            * full_path;
+	axl_bool          result;
+
+	if (ctx->storage_path_hash_size == 0)
+		return axl_false;
+
+	/* hash topic filter */
+	hash_value = axl_strdup_printf ("%u", axl_hash_string ((axlPointer) topic_name) % ctx->storage_path_hash_size);
+	if (hash_value == NULL)
+		return axl_false;
+	
+	/* call to check subscription in the provided directory. If it exists, remove it */	
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, topic_name), "retained", hash_value, NULL);
+	axl_free (hash_value);
+	if (full_path == NULL) 
+		return axl_false;
+	
+	/* remove subscription (well, in fact topic name) and message associated if it exists */
+	myqtt_log (MYQTT_LEVEL_DEBUG, "Recovering retained message for subscription %s at %s", topic_name, full_path);
+	result = __myqtt_storage_sub_exists (ctx, full_path, topic_name, topic_filter_len, axl_true, axl_true, qos, app_msg, app_msg_size);
+	axl_free (full_path);
+	
+	return result; /* by default report error */
+}
+
+/** 
+ * @brief Allows to get current queued messages pending to be
+ * redelivered on next connection (offline version).
+ *
+ * Like \ref myqtt_storage_queued_messages_quota_offline, the value
+ * is reported from usage counters kept in memory.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param client_identifier The client identifier to select the right
+ * local session according to its client identifier.
+ *
+ * @return Amount of messages stored on the provided client_identifier.
+ */
+int      myqtt_storage_queued_messages_offline (MyQttCtx   * ctx, 
+						const char * client_identifier)
+{
+	int messages;
+	int bytes;
+
+	/* check input values:
+	 *
+	 * don't check here for (pkg_id > 65536) because we use values
+	 * over that to store QoS0 messages that do not need a valid
+	 * pkg_id but we need a different value to store them */
+	if (ctx == NULL || client_identifier == NULL || strlen (client_identifier) == 0)
+		return 0;
+
+	__myqtt_storage_usage_seed (ctx, client_identifier, &messages, &bytes);
+
+	return messages;
+}
+
+/** 
+ * @internal File storage implementation for queued_messages operation.
+ */
+int __myqtt_storage_file_queued_messages (MyQttCtx * ctx, const char * client_identifier)
+{
+	char            * full_path;
+	DIR             * sub_dir;
+	int               count;
+	struct dirent   * entry;
+#if !defined(_DIRENT_HAVE_D_TYPE)
+	char            * aux_path;
+#endif
+
+	/* build path */
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "msgs", NULL);
+	if (! full_path) 
+		return 0;
+
+	/* open directory */
+	sub_dir = opendir (full_path);
+	if (sub_dir == NULL)  {
+		axl_free (full_path);
+		return 0;
+	} /* end if */
+	
+	/* count files inside messages directory */
+	count = 0;
+	entry = readdir (sub_dir);
+	while (entry) {
+
+#if defined(_DIRENT_HAVE_D_TYPE)
+		if ((entry->d_type & DT_REG) == DT_REG) 
+			count++;
+#else 
+		aux_path = myqtt_support_build_filename (full_path, entry->d_name, NULL);
+		if (myqtt_support_file_test (aux_path, FILE_EXISTS | FILE_IS_REGULAR)) {
+			/* count subscriptions */
+			count++;
+		}
+		axl_free (aux_path);
+#endif
+
+		/* get next entry */
+		entry = readdir (sub_dir);
+	}
+	axl_free (full_path);
+
+	closedir (sub_dir);
+
+	return count;
+}
+
+/** 
+ * @brief Allows to get current queued messages pending to be
+ * redelivered on next connection.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param conn Connection reference to select the right local session
+ * according to its client identifier.
+ *
+ * @return Number of queued messages associated to the client id
+ * running the provided connection or -1 if it fails
+ */
+int      myqtt_storage_queued_messages         (MyQttCtx   * ctx, 
+						MyQttConn  * conn)
+{
+	if (conn == NULL)
+		return -1;
+
+	return myqtt_storage_queued_messages_offline (ctx, conn->client_identifier);
+}
+
+/** 
+ * @brief Allows to get current storage quota used by queued messages
+ * pending to be redelivered on next connection.
+ *
+ * The value is reported from usage counters kept in memory: storage
+ * is only scanned the first time a client identifier is accounted.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param client_identifier The client identifier to select the right
+ * local session according to its client identifier.
+ *
+ * @return Quota used by the storage selected by the provided client_identifier.
+ */
+int      myqtt_storage_queued_messages_quota_offline   (MyQttCtx   * ctx, 
+							const char * client_identifier)
+{
+	int messages;
+	int bytes;
+
+	/* check input values:
+	 *
+	 * don't check here for (pkg_id > 65536) because we use values
+	 * over that to store QoS0 messages that do not need a valid
+	 * pkg_id but we need a different value to store them */
+	if (ctx == NULL || client_identifier == NULL || strlen (client_identifier) == 0)
+		return 0;
+
+	__myqtt_storage_usage_seed (ctx, client_identifier, &messages, &bytes);
+
+	return bytes;
+}
+
+/** 
+ * @internal File storage implementation for queued_quota operation.
+ */
+int __myqtt_storage_file_queued_quota (MyQttCtx * ctx, const char * client_identifier)
+{
+	char            * full_path;
+	DIR             * sub_dir;
+	int               count;
+	struct dirent   * entry;
+	int               pos;
+#if !defined(_DIRENT_HAVE_D_TYPE)
+	char            * aux_path;
+#endif
+
+	/* build path */
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "msgs", NULL);
+	if (! full_path) 
+		return 0;
+
+	/* open directory */
+	sub_dir = opendir (full_path);
+	if (sub_dir == NULL)  {
+		axl_free (full_path);
+		return 0;
+	} /* end if */
+	
+	/* count files inside messages directory */
+	count = 0;
+	entry = readdir (sub_dir);
+	while (entry) {
+#if defined(_DIRENT_HAVE_D_TYPE)
+		if ((entry->d_type & DT_REG) == DT_REG)  {
+			pos = __myqtt_storage_strpos (ctx, entry->d_name, '-');
+			count += __myqtt_storage_get_size_from_file_name (ctx, entry->d_name + pos + 1, NULL);
+		}
+#else 
+		aux_path = myqtt_support_build_filename (full_path, entry->d_name, NULL);
+		if (myqtt_support_file_test (aux_path, FILE_EXISTS | FILE_IS_REGULAR)) {
+			/* count subscriptions */
+			pos = __myqtt_storage_strpos (ctx, aux_path, '-');
+			count += __myqtt_storage_get_size_from_file_name (ctx, aux_path + pos + 1, NULL);
+		}
+		axl_free (aux_path);
+#endif
+
+		/* get next entry */
+		entry = readdir (sub_dir);
+	}
+	axl_free (full_path);
+
+	closedir (sub_dir);
+
+	return count;	
+}
+
+/** 
+ * @brief Allows to get current storage quota used by queued messages
+ * pending to be redelivered on next connection.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param conn Connection reference to select the right local session
+ * according to its client identifier.
+ *
+ * @return Number of queued messages associated to the client id
+ * running the provided connection.
+ */
+int      myqtt_storage_queued_messages_quota   (MyQttCtx   * ctx, 
+						MyQttConn  * conn)
+{
+	if (conn == NULL)
+		return -1;
+	return myqtt_storage_queued_messages_quota_offline (ctx, conn->client_identifier);
+}
+
+/** 
+ * @internal File storage implementation for msg_iterate operation.
+ */
+int __myqtt_storage_file_msg_iterate (MyQttCtx             * ctx, 
+				      const char           * client_identifier, 
+				      MyQttStorageMsgFound   func, 
+				      axlPointer             user_data)
+{
+	/* local parameters */
+	char            * full_path;
+	DIR             * sub_dir;
+	int               count;
+	struct dirent   * entry;
+	char            * aux_path;
+
+	int               qos;
+	int               packet_id;
+	unsigned char   * msg;
+	int               size;
+
+	FILE            * _fcontent;
+
+	/* build path */
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "msgs", NULL);
+	if (! full_path) 
+		return 0;
+
+	/* open directory */
+	sub_dir = opendir (full_path);
+	if (sub_dir == NULL)  {
+		axl_free (full_path);
+		return 0;
+	} /* end if */
+	
+	/* count files inside messages directory */
+	count = 0;
+	entry = readdir (sub_dir);
+	while (entry) {
+
+		aux_path = myqtt_support_build_filename (full_path, entry->d_name, NULL);
+		if (myqtt_support_file_test (aux_path, FILE_EXISTS | FILE_IS_REGULAR)) {
+			/* ok, now parse each message to get */
+
+			/* get packet_id */
+			__myqtt_storage_get_values_from_file_name (ctx, entry->d_name, &packet_id, &size, &qos);
+
+			/* open message into memory */
+			_fcontent  = fopen (aux_path, "r");
+			if (_fcontent == NULL) {
+				axl_free (aux_path);
+
+				/* get next entry */
+				entry = readdir (sub_dir);
+				continue;
+			} /* end if */
+			msg        = axl_new (unsigned char, size + 1);
+			if (fread (msg, 1, size, _fcontent) != size) 
+				myqtt_log (MYQTT_LEVEL_CRITICAL, "Expected to read %d from file but found different size read, error was: %s",
+					   size, myqtt_errno_get_error (errno));
+			fclose (_fcontent);
+
+			/* notify message found: handle and msg are
+			 * now owned by the handler */
+			func (ctx, client_identifier, aux_path, packet_id, qos, msg, size, user_data);
+			
+			/* nullify to avoid double-free on next call */
+			aux_path = NULL;
+
+			/* count messages */
+			count++;
+		}
+		axl_free (aux_path);
+
+		/* get next entry */
+		entry = readdir (sub_dir);
+	}
+	axl_free (full_path);
+
+	closedir (sub_dir);
+
+	return count;
+}
+
+void __myqtt_storage_queued_flush_msg (MyQttCtx      * ctx, 
+				       const char    * client_identifier, 
+				       axlPointer      handle, 
+				       int             packet_id, 
+				       MyQttQos        qos, 
+				       unsigned char * msg, 
+				       int             size, 
+				       axlPointer      user_data)
+{
+	MyQttConn * conn = user_data;
+
+	/* decompress payload if needed */
+	if (! __myqtt_storage_payload_decode (ctx, &msg, &size))
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to decode queued message %s, sending it as stored", (const char *) handle);
+
+	myqtt_log (MYQTT_LEVEL_DEBUG, "Sending offline queued message to conn-id=%d conn=%p packet_id=%d size=%d qos=%d handle=%s",
+		   conn->id, conn, packet_id, size, qos, (const char *) handle);
+
+	/* call to resend */
+	if (! __myqtt_conn_pub_send_and_handle_reply (ctx, conn, packet_id, qos, handle, 60, msg, size)) 
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "failed to resend queued message, __myqtt_conn_pub_send_and_handle_reply() failed");
+
+	/* no need to release msg, or handle here...this is already
+	 * done by __myqtt_conn_pub_send_and_handle_reply() */
+	return;
+}
+
+/** 
+ * @internal Handler called for each message removed because it
+ * expired: accounts the release (no connection is involved) and
+ * releases the packet id it was using.
+ */
+void __myqtt_storage_expired_msg (MyQttCtx      * ctx, 
+				  const char    * client_identifier, 
+				  axlPointer      handle, 
+				  int             packet_id, 
+				  MyQttQos        qos, 
+				  unsigned char * msg, 
+				  int             size, 
+				  axlPointer      user_data)
+{
+	myqtt_log (MYQTT_LEVEL_DEBUG, "Removed expired message for client_identifier=%s packet_id=%d size=%d qos=%d",
+		   client_identifier, packet_id, size, qos);
+
+	/* notify release */
+	if (ctx->on_release)
+		ctx->on_release (ctx, NULL, client_identifier, packet_id, qos, msg, size, ctx->on_release_data);
+
+	/* release packet id locked when the message was queued */
+	myqtt_storage_release_pkgid_offline (ctx, client_identifier, packet_id);
+
+	/* update usage */
+	__myqtt_storage_usage_update (ctx, client_identifier, -1, - size);
+
+	axl_free (handle);
+	axl_free (msg);
+	return;
+}
+
+void myqtt_storage_queued_flush_work (MyQttCtx * ctx, MyQttConn * conn)
+{
+	/* check input values:
+	 *
+	 * don't check here for (pkg_id > 65536) because we use values
+	 * over that to store QoS0 messages that do not need a valid
+	 * pkg_id but we need a different value to store them */
+	if (ctx == NULL || conn == NULL || conn->client_identifier == NULL || strlen (conn->client_identifier) == 0)
+		return;
+
+	/* wait for messages handed off to the storage writer */
+	myqtt_storage_writer_flush (ctx);
+
+	/* drop expired messages before delivering (file storage
+	 * only checks file names, no content is read) */
+	if (ctx->storage_msg_ttl > 0 && __myqtt_storage_get (ctx)->msg_expire)
+		__myqtt_storage_get (ctx)->msg_expire (ctx, conn->client_identifier, (long) time (NULL) - ctx->storage_msg_ttl, 
+						       __myqtt_storage_expired_msg, NULL);
+
+	/* call to driver implementation */
+	__myqtt_storage_get (ctx)->msg_iterate (ctx, conn->client_identifier, __myqtt_storage_queued_flush_msg, conn);
+
+	return;
+}
+
+axlPointer __myqtt_storage_queued_flush_proxy (axlPointer _conn)
+{
+	MyQttConn * conn = _conn;
+	MyQttCtx  * ctx  = conn->ctx;
+
+	/* call local function */
+	myqtt_storage_queued_flush_work (ctx, conn);
+
+	/* signal we have finished flushing */
+	conn->flushing = axl_false;
+
+	/* release reference */
+	myqtt_conn_unref (conn, "flushing queue");
+
+	return NULL;
+}
+
+/** 
+ * @brief Allows to redeliver all queued messages associated to the
+ * connected session provided.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param conn The connection that may have pending messages to be redeliver...
+ *
+ * @return Number of flushed messages, or -1 if it fails.
+ */
+void      myqtt_storage_queued_flush            (MyQttCtx   * ctx, 
+						 MyQttConn  * conn)
+{
+	if (ctx == NULL || conn == NULL)
+		return;
+
+	/* skip if there is another process flushing */
+	if (conn->flushing)
+		return;
+
+	/* ensure only one process is flushing */
+	myqtt_mutex_lock (&conn->op_mutex);
+	if (conn->flushing) {
+		myqtt_mutex_unlock (&conn->op_mutex);
+		return;
+	} /* end if */
+
+	if (! myqtt_conn_ref (conn, "flushing queue")) {
+		myqtt_mutex_unlock (&conn->op_mutex);
+		return;
+	} /* end if */
+
+	/* flag we are flushing */
+	conn->flushing = axl_true;
+	myqtt_mutex_unlock (&conn->op_mutex);
+
+	myqtt_log (MYQTT_LEVEL_DEBUG, "Flushing queued messages for conn-id=%d, conn=%p",
+		   conn->id, conn);
+
+	/* call to flush */
+	myqtt_thread_pool_new_task (ctx, __myqtt_storage_queued_flush_proxy, conn);
+
+	return;
+}
+
+/** 
+ * @brief Allows to lock the provided id or fail if it is already in
+ * use.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param client_identifier The client identifer where to lock the provided pkgid.
+ *
+ * @param pkg_id The packet id to lock. 
+ *
+ * @return axl_true if the pkgid was locked, otherwise axl_false is returned. 
+ */
+axl_bool myqtt_storage_lock_pkgid_offline (MyQttCtx      * ctx, 
+					   const char    * client_identifier,
+					   int             pkg_id)
+{
+	/* don't check here for (pkg_id > 65536) because we use values
+	 * over that to store QoS0 messages that do not need a valid
+	 * pkg_id but we need a different value to store them */
+	if (ctx == NULL || client_identifier == NULL || strlen (client_identifier) == 0 || pkg_id < 1)
+		return axl_false;
+
+	/* call to driver implementation */
+	return __myqtt_storage_get (ctx)->lock_pkgid (ctx, client_identifier, pkg_id);
+}
+
+/** 
+ * @internal File storage implementation for lock_pkgid operation.
+ */
+axl_bool __myqtt_storage_file_lock_pkgid (MyQttCtx * ctx, const char * client_identifier, int pkg_id)
+{
+	int    handle;
+	char * full_path;
+	char * ref;
+
+	/* create full path to lock pkgid */
+	ref       = axl_strdup_printf ("%d", pkg_id);
+	if (ref == NULL)
+		return axl_false;
+
+	/* build path */
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "pkgids", ref, NULL);
+	axl_free (ref);
+	if (full_path == NULL) 
+		return axl_false;
+
+	/* open directory handle */
+	myqtt_log (MYQTT_LEVEL_DEBUG, "Attempting to lock pkgid file at: %s", full_path);
+	handle = open (full_path, O_CREAT | O_EXCL, 0600);
+	axl_free (full_path);
+	if (handle < 0)
+		return axl_false;
+	close (handle);
+
+	return axl_true;	
+}
+
+/** 
+ * @brief Allows to lock the provided id or fail if it is already in
+ * use.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param conn The connection where the operation takes place, using its session.
+ *
+ * @param pkg_id The packet id to lock. 
+ *
+ * @return axl_true if the pkgid was locked, otherwise axl_false is returned. 
+ */
+axl_bool myqtt_storage_lock_pkgid (MyQttCtx * ctx, MyQttConn * conn, int pkg_id)
+{
+	/* avoid segfault when conn reference is NULL */
+	if (conn == NULL)
+		return axl_false;
 
-		if (__register) {
-			/* register subscription */
-			full_path = myqtt_support_build_filename (aux_path, entry->d_name, NULL);
-			__myqtt_storage_sub_conn_register (ctx, client_identifier, conn, entry->d_name, full_path, __is_offline);
-			axl_free (full_path);
-		} /* end if */
-#else 
-		full_path = myqtt_support_build_filename (aux_path, entry->d_name, NULL);
-		if (myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_REGULAR)) {
-			count ++;
-		} /* end if */
+	return myqtt_storage_lock_pkgid_offline (ctx, conn->client_identifier, pkg_id);
+}
+
+/** 
+ * @brief Allows to release the provided id from the current session
+ * associated to the provided connection.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param client_identifier Client identifier for which the release operation will be applied
+ *
+ * @param pkg_id The packet id to release. 
+ *
+ * @return axl_true if the pkgid was releaseed, otherwise axl_false is returned. 
+ */
+void     myqtt_storage_release_pkgid_offline    (MyQttCtx      * ctx, 
+						 const char    * client_identifier,
+						 int             pkg_id)
+{
+	/* don't check here for (pkg_id > 65536) because we use values
+	 * over that to store QoS0 messages that do not need a valid
+	 * pkg_id but we need a different value to store them */
+	if (ctx == NULL || client_identifier == NULL || strlen (client_identifier) == 0 || pkg_id < 1)
+		return;
 
-		/* call to register */
-		if (__register)
-			__myqtt_storage_sub_conn_register (ctx, conn, entry->d_name, full_path, __is_offline);
+	/* call to driver implementation */
+	__myqtt_storage_get (ctx)->release_pkgid (ctx, client_identifier, pkg_id);
+	return;
+}
 
-		axl_free (full_path);
-#endif
-		/* next file */
-		entry = readdir (files);
-	}
+/** 
+ * @internal File storage implementation for release_pkgid operation.
+ */
+void __myqtt_storage_file_release_pkgid (MyQttCtx * ctx, const char * client_identifier, int pkg_id)
+{
+	char * full_path;
+	char * ref;
 
-	closedir (files);
+	/* create full path to lock pkgid */
+	ref       = axl_strdup_printf ("%d", pkg_id);
+	if (ref == NULL)
+		return;
+
+	/* build path */
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "pkgids", ref, NULL);
+	axl_free (ref);
+	if (full_path == NULL) 
+		return;
+
+	/* open directory handle */
+	unlink (full_path);
+	axl_free (full_path);
+
+	return;
 
-	return count;
 }
 
 /** 
- * @internal Function to iterate over all subscriptions to restore
- * connection state.
+ * @brief Allows to release the provided id from the current session
+ * associated to the provided connection.
  *
- * @param ctx The context where the operation will take place
+ * @param ctx The context where the operation takes place.
  *
- * @param conn The connection where the operation will be implemented.
+ * @param conn The connection where the operation takes place, using its session.
+ *
+ * @param pkg_id The packet id to release. 
+ *
+ * @return axl_true if the pkgid was releaseed, otherwise axl_false is returned. 
  */
-int __myqtt_storage_iteration (MyQttCtx * ctx, const char * client_identifier, MyQttConn * conn, axl_bool __register, axl_bool __is_offline) {
+void     myqtt_storage_release_pkgid (MyQttCtx * ctx, MyQttConn * conn, int pkg_id)
+{
+	/* avoid segfault when conn reference is NULL */
+	if (conn == NULL)
+		return;
+	return myqtt_storage_release_pkgid_offline (ctx, conn->client_identifier, pkg_id);
+}
 
-	char          * full_path;
-	char          * aux_path;
-	DIR           * sub_dir;
-	struct dirent * entry;
-	int             total = 0;
+/** 
+ * @brief Allows to recover session stored by the server with current
+ * storage for the provided connection.
+ *
+ * @param ctx The context where the operation will take place.
+ *
+ * @param conn The connection that is requested to recover session. 
+ *
+ * @return axl_true if session was recovered, otherwise axl_false is
+ * returned.
+ */
+axl_bool myqtt_storage_session_recover (MyQttCtx * ctx, MyQttConn * conn)
+{
+	/* call to iterate and count */
+	return __myqtt_storage_iteration (ctx, conn->client_identifier, conn, /* register */ axl_true, /* offline */ axl_false);
+}
 
-	/* check input parameters */
-	if (! __myqtt_storage_check (ctx, client_identifier, axl_false, NULL))
-		return axl_false;
+/** 
+ * @internal State used to list sessions found on a storage root
+ * (one thread for each shard).
+ */
+typedef struct _MyQttStorageShardScan {
+	MyQttCtx    * ctx;
+	int           shard;
+	axlList     * list;
+	MyQttThread   thread;
+} MyQttStorageShardScan;
 
-	/* get full path to subscriptions */
-	full_path = myqtt_support_build_filename (ctx->storage_path, client_identifier, "subs", NULL);
-	if (full_path == NULL) 
-		return axl_false; /* allocation failure */
+/** 
+ * @internal Lists sessions found on the storage root of the
+ * provided shard.
+ */
+axlPointer __myqtt_storage_file_sessions_shard (MyQttStorageShardScan * scan)
+{
+	MyQttCtx      * ctx  = scan->ctx;
+	const char    * root = __myqtt_storage_shard_path (ctx, scan->shard);
+	DIR           * sub_dir;
+	struct dirent * entry;
+	axlList       * list;
+#if !defined(_DIRENT_HAVE_D_TYPE)
+	char          * aux_path;
+#endif
 
-	if (! myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
-		axl_free (full_path);
-		return axl_false; /* directory do not exists */
-	} /* end if */
+	sub_dir = opendir (root);
+	if (sub_dir == NULL)
+		return NULL;
 
-	/* try to open path */
-	sub_dir = opendir (full_path);
-	if (sub_dir == NULL) {
-		__myqtt_storage_error_report (ctx, "Unable to open %s", full_path);
-		axl_free (full_path);
-		return axl_false;
+	/* create list */
+	list = axl_list_new (axl_list_always_return_1, axl_free);
+	if (list == NULL) {
+		closedir (sub_dir);
+		return NULL;
 	} /* end if */
-	entry   = readdir (sub_dir);
-	while (sub_dir && entry) {
 
-		/* get next entry and skip those we are not interested in */
-		if (axl_cmp (".", entry->d_name) || axl_cmp ("..", entry->d_name)) {
-			entry = readdir (sub_dir);
-			continue;
-		} /* end if */
+	/* get next entry */
+	entry = readdir (sub_dir);
+	while (entry) {
+		/* skip default directories */
+		if (axl_cmp (entry->d_name, ".") || axl_cmp (entry->d_name, "..") || axl_cmp (entry->d_name, "retained") ||
+		    axl_cmp (entry->d_name, MYQTT_STORAGE_RESERVED_DIR))
+			goto next_entry;
 
-		/* check if it is a directory */
 #if defined(_DIRENT_HAVE_D_TYPE)
-		if ((entry->d_type & DT_DIR) == DT_DIR) {
-			/* count subscriptions */
-			aux_path  = myqtt_support_build_filename (full_path, entry->d_name, NULL);
-			total    += __myqtt_storage_sub_count_aux (ctx, client_identifier, conn, aux_path, __register, __is_offline);
+		if ((entry->d_type & DT_DIR) != DT_DIR) 
+			goto next_entry;
+#else
+		aux_path = myqtt_support_build_filename (root, entry->d_name, NULL);
+		if (! myqtt_support_file_test (aux_path, FILE_EXISTS | FILE_IS_DIR)) {
 			axl_free (aux_path);
-		}
-#else 
-		aux_path = myqtt_support_build_filename (full_path, entry->d_name, NULL);
-		if (myqtt_support_file_test (aux_path, FILE_EXISTS | FILE_IS_DIR)) {
-			/* count subscriptions */
-			total += __myqtt_storage_sub_count_aux (ctx, conn, aux_path, __register, __is_offline);
-		}
+			goto next_entry;
+		} /* end if */
 		axl_free (aux_path);
 #endif
 
-		/* get next entry */
-		entry   = readdir (sub_dir);
-	}
+		/* sessions are only accessed on the shard they are
+		 * hashed to */
+		if (ctx->storage_shards_count > 0 && __myqtt_storage_root (ctx, entry->d_name) != root) {
+			myqtt_log (MYQTT_LEVEL_CRITICAL, "Skipping session %s found at %s: it is placed on %s (storage shards changed?)",
+				   entry->d_name, root, __myqtt_storage_root (ctx, entry->d_name));
+			goto next_entry;
+		} /* end if */
+
+		/* found directory (a session identifier) */
+		axl_list_append (list, axl_strdup (entry->d_name));
+
+	next_entry:
+		/* next entry */
+		entry = readdir (sub_dir);
+	} /* end while */
 
 	closedir (sub_dir);
-	axl_free (full_path);
 
-	if (__register)
-		return total > 0 ? total : __register;
+	scan->list = list;
+	return NULL;
+}
 
-	return total;
+/** 
+ * @internal File storage implementation for sessions operation:
+ * shards are scanned in parallel.
+ */
+axlList * __myqtt_storage_file_sessions (MyQttCtx * ctx)
+{
+	MyQttStorageShardScan * scans;
+	axlList               * list;
+	int                     count = ctx->storage_shards_count + 1;
+	int                     iterator;
+
+	scans = axl_new (MyQttStorageShardScan, count);
+	if (scans == NULL)
+		return NULL;
+
+	/* scan shards, one thread each (first shard is scanned
+	 * by the caller while the others run) */
+	iterator = count - 1;
+	while (iterator >= 0) {
+		scans[iterator].ctx   = ctx;
+		scans[iterator].shard = iterator;
+		if (iterator == 0 || 
+		    ! myqtt_thread_create (&scans[iterator].thread, (MyQttThreadFunc) __myqtt_storage_file_sessions_shard, &scans[iterator],
+					   MYQTT_THREAD_CONF_END)) {
+			/* scan it here */
+			__myqtt_storage_file_sessions_shard (&scans[iterator]);
+			scans[iterator].shard = -1;
+		} /* end if */
+		iterator--;
+	} /* end while */
+
+	/* wait for threads and join results */
+	list     = scans[0].list;
+	iterator = 1;
+	while (iterator < count) {
+		if (scans[iterator].shard != -1)
+			myqtt_thread_destroy (&scans[iterator].thread, axl_false);
+
+		/* move sessions found */
+		while (scans[iterator].list && axl_list_length (scans[iterator].list) > 0) {
+			if (list == NULL)
+				list = axl_list_new (axl_list_always_return_1, axl_free);
+			axl_list_append (list, axl_list_get_first (scans[iterator].list));
+			axl_list_unlink_first (scans[iterator].list);
+		} /* end while */
+		if (scans[iterator].list)
+			axl_list_free (scans[iterator].list);
+		iterator++;
+	} /* end while */
+	axl_free (scans);
+
+	return list;
 }
 
 /** 
- * @brief Allows to get current number of subscriptions registered on
- * the storage for the provided client identifier.
- *
- * @param ctx The context where the operation takes place.
- *
- * @param client_identifier The client identifier to get subscription count from.
- *
- * @return Number of subscriptions.
+ * @internal State used while loading the subscription index.
  */
-int      myqtt_storage_sub_count_offline (MyQttCtx      * ctx, 
-					  const char    * client_identifier)
+typedef struct _MyQttStorageIndexLoad {
+	MyQttCtx              * ctx;
+	FILE                  * handle;
+	MyQttStorageSubFound    func;
+	axlPointer              user_data;
+	axlPointer              user_data2;
+	int                     count;
+	const char            * client_identifier;
+} MyQttStorageIndexLoad;
+
+/** 
+ * @internal Applies an index operation into the sessions hash
+ * (client identifier -> hash (topic filter -> qos + 1)).
+ */
+void __myqtt_storage_index_apply (axlHash * sessions, int op, const char * client_identifier, const char * topic_filter, MyQttQos qos)
 {
-	return __myqtt_storage_iteration (ctx, client_identifier, NULL, /* register */ axl_false, /* offline */ axl_true);
+	axlHash * subs;
+
+	switch (op) {
+	case MYQTT_STORAGE_INDEX_SUB:
+		subs = axl_hash_get (sessions, (axlPointer) client_identifier);
+		if (subs == NULL) {
+			subs = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+			axl_hash_insert_full (sessions, axl_strdup (client_identifier), axl_free, subs, (axlDestroyFunc) axl_hash_free);
+		} /* end if */
+		axl_hash_remove (subs, (axlPointer) topic_filter);
+		axl_hash_insert_full (subs, axl_strdup (topic_filter), axl_free, INT_TO_PTR (qos + 1), NULL);
+		break;
+	case MYQTT_STORAGE_INDEX_UNSUB:
+		subs = axl_hash_get (sessions, (axlPointer) client_identifier);
+		if (subs)
+			axl_hash_remove (subs, (axlPointer) topic_filter);
+		break;
+	case MYQTT_STORAGE_INDEX_CLEAR:
+		axl_hash_remove (sessions, (axlPointer) client_identifier);
+		break;
+	} /* end switch */
+
+	return;
 }
 
 /** 
- * @brief Allows to get current number of subscriptions registered on
- * the storage for the provided connection.
- *
- * @param ctx The context where the operation takes place.
+ * @internal Replays the subscription index into the provided
+ * sessions hash.
  *
- * @param conn Connection to get subscription count from.
- *
- * @return Number of subscriptions.
+ * @return Number of records read, or -1 when the index is not
+ * present or is corrupted. When the last record is incomplete
+ * (process stopped while appending), the function reports records
+ * read so far and sets truncated to axl_true.
  */
-int      myqtt_storage_sub_count (MyQttCtx * ctx, MyQttConn * conn)
+int __myqtt_storage_index_replay (MyQttCtx * ctx, const char * full_path, axlHash * sessions, axl_bool * truncated)
 {
-	if (conn == NULL)
-		return 0;
+	FILE                    * handle;
+	char                      header[sizeof (MYQTT_STORAGE_INDEX_HEADER)];
+	MyQttStorageIndexRecord   record;
+	char                    * client_identifier;
+	char                    * topic_filter;
+	int                       records = 0;
+	size_t                    bytes_read;
+
+	(*truncated) = axl_false;
+
+	handle = fopen (full_path, "rb");
+	if (handle == NULL)
+		return -1;
+
+	/* check header */
+	memset (header, 0, sizeof (header));
+	if (fread (header, 1, strlen (MYQTT_STORAGE_INDEX_HEADER), handle) != strlen (MYQTT_STORAGE_INDEX_HEADER) ||
+	    ! axl_cmp (header, MYQTT_STORAGE_INDEX_HEADER)) {
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Subscription index %s has an unknown header, skipping it", full_path);
+		fclose (handle);
+		return -1;
+	} /* end if */
+
+	while (axl_true) {
+		/* read record header */
+		bytes_read = fread (&record, 1, sizeof (MyQttStorageIndexRecord), handle);
+		if (bytes_read == 0)
+			break; /* end of index */
+		if (bytes_read != sizeof (MyQttStorageIndexRecord)) {
+			(*truncated) = axl_true;
+			break;
+		} /* end if */
+
+		/* check values */
+		if (record.op < MYQTT_STORAGE_INDEX_SUB || record.op > MYQTT_STORAGE_INDEX_CLEAR ||
+		    record.client_identifier_len <= 0 || record.client_identifier_len > 65535 ||
+		    record.topic_filter_len < 0 || record.topic_filter_len > 65535) {
+			myqtt_log (MYQTT_LEVEL_CRITICAL, "Subscription index %s is corrupted (record %d)", full_path, records);
+			fclose (handle);
+			return -1;
+		} /* end if */
+
+		/* read content */
+		client_identifier = axl_new (char, record.client_identifier_len + 1);
+		topic_filter      = axl_new (char, record.topic_filter_len + 1);
+		if (client_identifier == NULL || topic_filter == NULL) {
+			axl_free (client_identifier);
+			axl_free (topic_filter);
+			fclose (handle);
+			return -1;
+		} /* end if */
+
+		if (fread (client_identifier, 1, record.client_identifier_len, handle) != record.client_identifier_len ||
+		    fread (topic_filter, 1, record.topic_filter_len, handle) != record.topic_filter_len) {
+			axl_free (client_identifier);
+			axl_free (topic_filter);
+			(*truncated) = axl_true;
+			break;
+		} /* end if */
+
+		/* validate checksum */
+		if (__myqtt_storage_index_record_checksum (&record, client_identifier, topic_filter) != record.checksum) {
+			myqtt_log (MYQTT_LEVEL_CRITICAL, "Subscription index %s failed checksum validation (record %d)", full_path, records);
+			axl_free (client_identifier);
+			axl_free (topic_filter);
+			fclose (handle);
+			return -1;
+		} /* end if */
+
+		/* apply operation */
+		__myqtt_storage_index_apply (sessions, record.op, client_identifier, topic_filter, record.qos);
+		axl_free (client_identifier);
+		axl_free (topic_filter);
+
+		records++;
+	} /* end while */
+
+	fclose (handle);
+
+	return records;
+}
+
+axl_bool __myqtt_storage_index_collect_sub (axlPointer key, axlPointer data, axlPointer user_data)
+{
+	MyQttStorageIndexLoad * load = user_data;
+
+	if (load->handle) {
+		/* write subscription into the index being rebuilt */
+		if (! __myqtt_storage_index_write (load->handle, MYQTT_STORAGE_INDEX_SUB, load->client_identifier, key, PTR_TO_INT (data) - 1)) {
+			fclose (load->handle);
+			load->handle = NULL;
+		} /* end if */
+	} /* end if */
+
+	if (load->func) {
+		/* notify subscription found */
+		load->func (load->ctx, load->client_identifier, key, PTR_TO_INT (data) - 1, load->user_data, load->user_data2);
+	} /* end if */
+
+	load->count++;
+	return axl_false; /* keep iterating */
+}
+
+axl_bool __myqtt_storage_index_collect (axlPointer key, axlPointer data, axlPointer user_data)
+{
+	MyQttStorageIndexLoad * load = user_data;
+
+	/* iterate over all subscriptions for this client identifier */
+	load->client_identifier = key;
+	axl_hash_foreach (data, __myqtt_storage_index_collect_sub, load);
 
-	/* call to iterate and count */
-	return __myqtt_storage_iteration (ctx, conn->client_identifier, NULL, /* register */ axl_false, /* offline */ axl_false);
+	return axl_false; /* keep iterating */
+}
+
+void __myqtt_storage_index_walk_sub (MyQttCtx      * ctx, 
+				     const char    * client_identifier, 
+				     const char    * topic_filter, 
+				     MyQttQos        qos, 
+				     axlPointer      user_data, 
+				     axlPointer      user_data2)
+{
+	/* record subscription found on disk */
+	__myqtt_storage_index_apply (user_data, MYQTT_STORAGE_INDEX_SUB, client_identifier, topic_filter, qos);
+	return;
 }
 
 /** 
- * @brief Function to unsubscribe the provided topic filter on the
- * provided connection.
- *
- * @param ctx The context where the operation will take place.
- *
- * @param conn The connection for which the subscription will be stored.
- *
- * @param topic_filter The unsubscription' topic filter
- *
- * @return axl_true in the case the operation was completed otherwise
- * axl_false is returned.
+ * @internal Removes an index file left at the storage path by
+ * previous versions (only regular files: a directory with that name
+ * is a session).
  */
-axl_bool myqtt_storage_unsub (MyQttCtx * ctx, MyQttConn * conn, const char * topic_filter) 
+void __myqtt_storage_index_remove_legacy (MyQttCtx * ctx, const char * name)
 {
-	/* call to remove subscription */
-	return myqtt_storage_sub_exists_common (ctx, conn, topic_filter, 0, axl_true);
+	char * full_path;
+
+	full_path = myqtt_support_build_filename (ctx->storage_path, name, NULL);
+	if (full_path && myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_REGULAR))
+		unlink (full_path);
+	axl_free (full_path);
+	return;
 }
 
 /** 
- * @brief Allows to storage the provided message on the local session
- * storage associated to the provided connection.
- *
- * @param ctx The context where the operation takes place.
- *
- * @param client_identifier The client id for which the operation is requested.
- *
- * @param packet_id The packet id associated to the message.
- *
- * @param qos The QoS of the operation requested.
- *
- * @param app_msg The application message to store.
- *
- * @param app_msg_size The size of the application message to store.
- *
- * @return The function return NULL on failure and a handler that
- * points to the message stored.
+ * @internal File storage implementation for load operation.
+ *
+ * Offline subscriptions are restored from the subscription index
+ * (MYQTT_STORAGE_INDEX_FILE) with a sequential read. The index is
+ * rebuilt walking all session directories when it is not found or
+ * fails validation, and compacted when it holds many stale
+ * records. Removing the index file forces a directory walk on next
+ * load.
  */
-axlPointer myqtt_storage_store_msg_offline (MyQttCtx      * ctx, 
-					    const char    * client_identifier,
-					    int             packet_id, 
-					    MyQttQos        qos, 
-					    unsigned char * app_msg, 
-					    int             app_msg_size)
+int __myqtt_storage_file_load (MyQttCtx * ctx, MyQttStorageSubFound func, axlPointer user_data, axlPointer user_data2)
 {
-	char            * full_path;
-	char            * ref;
-	struct timeval    stamp;
-	FILE            * handle;
+	axlHash               * sessions;
+	axlList               * list;
+	int                     iterator;
+	int                     records;
+	axl_bool                truncated = axl_false;
+	axl_bool                rebuild   = axl_false;
+	char                  * full_path;
+	char                  * tmp_path;
+	MyQttStorageIndexLoad   load;
+
+	/* nothing to load (index is created on next load) */
+	if (! myqtt_support_file_test (ctx->storage_path, FILE_EXISTS | FILE_IS_DIR))
+		return 0;
 
-	/* check input values:
-	 *
-	 * don't check here for (pkg_id > 65536) because we use values
-	 * over that to store QoS0 messages that do not need a valid
-	 * pkg_id but we need a different value to store them */
-	if (ctx == NULL || client_identifier == NULL || strlen (client_identifier) == 0 || packet_id < 0 || app_msg_size <= 0 || app_msg == NULL)
-		return NULL;
+	/* indexes were placed at the storage path by previous
+	 * versions (they could collide with a client identifier) */
+	__myqtt_storage_index_remove_legacy (ctx, MYQTT_STORAGE_INDEX_FILE);
+	__myqtt_storage_index_remove_legacy (ctx, MYQTT_STORAGE_USAGE_FILE);
 
-	if (ctx->on_store && !(qos && MYQTT_QOS_SKIP_STOREAGE_NOTIFY)) {
-		/* call to check if we can store the message */
-		if (! ctx->on_store (ctx, NULL, client_identifier, packet_id, qos, app_msg, app_msg_size, ctx->on_store_data))
-			return NULL;
+	full_path = __myqtt_storage_index_path (ctx, MYQTT_STORAGE_INDEX_FILE, axl_true);
+	tmp_path  = full_path ? axl_strdup_printf ("%s.tmp", full_path) : NULL;
+	if (full_path == NULL || tmp_path == NULL) {
+		axl_free (full_path);
+		axl_free (tmp_path);
+		return -1;
 	} /* end if */
 
-	/* call to init message store */
-	if (! myqtt_storage_init_offline (ctx, client_identifier, MYQTT_STORAGE_MSGS))
-		return NULL;
+	/* block index updates until loaded */
+	myqtt_mutex_lock (&ctx->storage_index_mutex);
+	if (ctx->storage_index) {
+		fclose (ctx->storage_index);
+		ctx->storage_index = NULL;
+	} /* end if */
 
-	/* build path */
-	gettimeofday (&stamp, NULL);
-	ref       = axl_strdup_printf ("%d-%d-%d-%d-%d", packet_id, app_msg_size, qos, stamp.tv_sec, stamp.tv_usec);
-	if (! ref)
-		return NULL;
-	full_path = myqtt_support_build_filename (ctx->storage_path, client_identifier, "msgs", ref, NULL);
-	axl_free (ref);
-	if (! full_path) 
-		return NULL;
+	sessions = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+	records  = __myqtt_storage_index_replay (ctx, full_path, sessions, &truncated);
+	if (records < 0) {
+		/* index not found or corrupted: walk all sessions */
+		myqtt_log (MYQTT_LEVEL_DEBUG, "Subscription index not available at %s, loading storage from directories", full_path);
+		axl_hash_free (sessions);
+		sessions = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+
+		list = __myqtt_storage_file_sessions (ctx);
+		iterator = 0;
+		while (list && iterator < axl_list_length (list)) {
+			__myqtt_storage_file_sub_iterate (ctx, axl_list_get_nth (list, iterator), __myqtt_storage_index_walk_sub, sessions, NULL);
+			iterator++;
+		} /* end while */
+		if (list)
+			axl_list_free (list);
+		rebuild = axl_true;
+	} /* end if */
 
-	/* save file */
-	handle = fopen (full_path, "w");
-	if (! handle) {
-		/* report failure */
-		__myqtt_storage_error_report (ctx, "Failed to store message at %s", full_path);
-		axl_free (full_path);
-		return NULL;
+	/* prepare load */
+	memset (&load, 0, sizeof (MyQttStorageIndexLoad));
+	load.ctx = ctx;
+
+	/* count live subscriptions */
+	axl_hash_foreach (sessions, __myqtt_storage_index_collect, &load);
+
+	/* compact the index when it is mostly holding stale records
+	 * or its last record was left incomplete */
+	if (truncated || records > (2 * load.count + 1024))
+		rebuild = axl_true;
+
+	if (rebuild) {
+		myqtt_log (MYQTT_LEVEL_DEBUG, "Writing subscription index at %s (records=%d, subscriptions=%d, truncated=%d)", 
+			   full_path, records, load.count, truncated);
+		load.handle = fopen (tmp_path, "wb");
+		if (load.handle && fwrite (MYQTT_STORAGE_INDEX_HEADER, 1, strlen (MYQTT_STORAGE_INDEX_HEADER), load.handle) != strlen (MYQTT_STORAGE_INDEX_HEADER)) {
+			fclose (load.handle);
+			load.handle = NULL;
+		} /* end if */
 	} /* end if */
-	
-	if (fwrite (app_msg, 1, app_msg_size, handle) != app_msg_size) {
-		__myqtt_storage_error_report (ctx, "Failed to storage message at %s", full_path);
-		fclose (handle);
-		axl_free (full_path);
-		return NULL;
+
+	/* notify subscriptions (writing them into the new index if requested) */
+	load.count      = 0;
+	load.func       = func;
+	load.user_data  = user_data;
+	load.user_data2 = user_data2;
+	axl_hash_foreach (sessions, __myqtt_storage_index_collect, &load);
+	axl_hash_free (sessions);
+
+	if (rebuild) {
+		if (load.handle && fclose (load.handle) == 0) {
+#if defined(AXL_OS_WIN32)
+			unlink (full_path);
+#endif
+			if (rename (tmp_path, full_path) != 0) 
+				__myqtt_storage_error_report (ctx, "Unable to install subscription index at %s", full_path);
+		} else {
+			/* failed to write index: it will be rebuilt on next load */
+			__myqtt_storage_error_report (ctx, "Unable to write subscription index at %s", tmp_path);
+			unlink (tmp_path);
+			unlink (full_path);
+		} /* end if */
 	} /* end if */
 
-	/* message saved */
-	fclose (handle);
-	return full_path;	
+	myqtt_mutex_unlock (&ctx->storage_index_mutex);
+	axl_free (full_path);
+	axl_free (tmp_path);
+
+	return load.count;
 }
 
 /** 
- * @brief Allows to storage the provided message on the local session
- * storage associated to the provided connection.
- *
- * @param ctx The context where the operation takes place.
- *
- * @param conn The connection to select local session storage.
- *
- * @param packet_id The packet id associated to the message.
- *
- * @param qos QoS of the message to be stored.
- *
- * @param app_msg The application message to store.
- *
- * @param app_msg_size The size of the application message to store.
+ * @internal Function that allows to recover client identifiers and
+ * subscriptions from local storage. This function is only useful for
+ * server side and it is not meant to be used directly by API
+ * consumers.
  *
- * @return The function return NULL on failure and a handler that
- * points to the message stored.
+ * @return Return the number of subscription that were loaded.
  */
-axlPointer myqtt_storage_store_msg   (MyQttCtx * ctx, MyQttConn * conn, int packet_id, MyQttQos qos, unsigned char * app_msg, int app_msg_size)
+int     myqtt_storage_load             (MyQttCtx      * ctx)
 {
-	/* avoid segfault when conn reference is NULL */
-	if (conn == NULL)
-		return axl_false; 
+	axlList       * sessions;
+	const char    * client_identifier;
+	int             iterator;
+	int             entries = 0;
 
-	if (ctx->on_store) {
-		/* call to check if we can store the message */
-		if (! ctx->on_store (ctx, conn, conn->client_identifier, packet_id, qos, app_msg, app_msg_size, ctx->on_store_data))
-			return NULL;
+	if (ctx == NULL || (ctx->storage_backend == NULL && ! ctx->storage_path)) {
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Unable to load local storage because context (%p) is not defined or storage path is empty: %s",
+			   ctx, (ctx && ctx->storage_path) ? ctx->storage_path : "<not defined>");
+		return 0;
 	} /* end if */
 
-	return myqtt_storage_store_msg_offline (ctx, conn->client_identifier, packet_id, qos | MYQTT_QOS_SKIP_STOREAGE_NOTIFY, app_msg, app_msg_size);
-}
-
-/** 
- * @brief Allows to release the provided message on the local session
- * storage associated to the provided connection.
- *
- * @param ctx The context where the operation takes place.
- *
- * @param conn The connection to select local session storage.
- *
- * @param handle Reference to the message as returned by \ref myqtt_storage_store_msg
- *
- * @param app_msg The application message to be released.
- *
- * @param app_msg_size Application message size to be released.
- *
- * @return axl_true if the message was successfully stored, otherwise
- * axl_false is returned.
- */
-axl_bool myqtt_storage_release_msg   (MyQttCtx      * ctx, 
-				      MyQttConn     * conn, 
-				      axlPointer      handle,
-				      unsigned char * app_msg,
-				      int             app_msg_size)
-{
-	MyQttQos qos;
-	int      packet_id;
-	int      pos;
+	/* skip local storage loading if already done previously */
+	if (ctx->local_storage)
+		return 0;
 
-	/* check input values */
-	if (ctx == NULL || conn == NULL)
-		return axl_false;
+	myqtt_mutex_lock (&ctx->ref_mutex);
+	if (ctx->local_storage) {
+		myqtt_mutex_unlock (&ctx->ref_mutex);
+		return 0;
+	} /* end if */
 
-	/* call to init message store */
-	if (! myqtt_storage_init (ctx, conn, MYQTT_STORAGE_MSGS))
-		return axl_false;
+	/* init server side hashs to handle subscriptions */
+	/*** on-line subscriptions ***/
+	ctx->subs              = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+	ctx->wild_subs         = axl_hash_new (axl_hash_string, axl_hash_equal_string);
 
-	/* release the message */
-	if (handle) {
-		/* check and call on release message */
-		if (ctx->on_release) {
-			/* get packet id */
-			packet_id = __myqtt_storage_get_size_from_file_name (ctx, handle, NULL);
-			pos       = __myqtt_storage_strpos (ctx, handle, '-');
+	/*** off-line subscriptiosn ***/
+	ctx->offline_subs      = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+	ctx->offline_wild_subs = axl_hash_new (axl_hash_string, axl_hash_equal_string);
 
-			/* get next post to skip over app msg size */
-			pos       = __myqtt_storage_strpos (ctx, handle + pos + 1, '-');
+	/* now find all local identifiers that have at least one
+	 * subscription */
+	myqtt_log (MYQTT_LEVEL_DEBUG, "Loading storage (%s) from: %s", 
+		   __myqtt_storage_get (ctx)->backend_type, ctx->storage_path ? ctx->storage_path : "<null>");
+	if (__myqtt_storage_get (ctx)->load) {
+		/* driver provides a way to report all subscriptions at once */
+		entries = __myqtt_storage_get (ctx)->load (ctx, __myqtt_storage_sub_conn_register, NULL, INT_TO_PTR (axl_true));
+		if (entries >= 0)
+			goto finish;
+		entries = 0;
+	} /* end if */
 
-			/* get qos */
-			qos       = __myqtt_storage_get_size_from_file_name (ctx, handle + pos + 1, NULL);
+	sessions = __myqtt_storage_get (ctx)->sessions (ctx);
+	if (sessions == NULL)
+		goto finish;
 
-			/* call to notify release */
-			ctx->on_release (ctx, conn, conn->client_identifier, packet_id, qos, app_msg, app_msg_size, ctx->on_release_data);
+	iterator = 0;
+	while (iterator < axl_list_length (sessions)) {
+		/* get session identifier */
+		client_identifier = axl_list_get_nth (sessions, iterator);
 
+		if (myqtt_storage_sub_count_offline (ctx, client_identifier) > 0)  {
+			/* found entry with subscriptions */
+			myqtt_log (MYQTT_LEVEL_DEBUG, "Checking subscriptions for %s (%d)", client_identifier, myqtt_storage_sub_count_offline (ctx, client_identifier)); 
+			entries += __myqtt_storage_iteration (ctx, client_identifier, NULL, /* register */ axl_true, /* offline */ axl_true);
 		} /* end if */
 
-		unlink ((const char *) handle);
-		axl_free ((char *) handle);
-	} /* end if */
+		/* next session */
+		iterator++;
+	} /* end while */
+	axl_list_free (sessions);
 
-	return axl_true;
+finish:
+	/* notify it is already loaded */
+	ctx->local_storage = axl_true;
+	myqtt_mutex_unlock (&ctx->ref_mutex);
+
+	/* load usage counters (persisted or from sessions found) */
+	__myqtt_storage_usage_load (ctx);
+
+	return entries;
 }
 
+
 /** 
- * @brief Allows to store retain message for the provided topic name
- * so every new subscription on that topic will receive that message.
+ * @brief Allows to configure the storage location for the provided
+ * MyQtt context.
  *
- * The function will replace the previous retained message. If you
- * want to remove an existing message call to \ref myqtt_storage_retain_msg_release
+ * @param ctx The context where the operation takes place. It cannot be NULL.
  *
- * @param ctx The context where the operation takes place.
+ * @param storage_path The storage dir to configure. It cannot be NULL
+ * or empty.
  *
- * @param topic_name The topic name for the message and at the same
- * time the subscription for which the message will be stored as
- * retained.
+ * @param hash_size Hashing size for the storage path used. This value
+ * will be used to split internal storage in the given values.
+ * Recomended value is 4096.
  *
- * @param qos The app message qos.
  *
- * @param app_msg The application message to store.
+ * @return axl_true if the path was correctly set, otherwise axl_false is returned.
+ */
+axl_bool     myqtt_storage_set_path (MyQttCtx * ctx, const char * storage_path, int hash_size)
+{
+	if (ctx == NULL || storage_path == NULL || strlen (storage_path) == 0) {
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Unable to configure storage path, context is NULL(%d), or storage path is not defined (%s)",
+			   ctx, (ctx && ctx->storage_path) ? ctx->storage_path : "<undefined>");
+		return axl_false;
+	}
+
+	/* lock during operation */
+	myqtt_mutex_lock (&ctx->ref_mutex);
+
+	/* update storage path */
+	if (ctx->storage_path)
+		axl_free (ctx->storage_path);
+	ctx->storage_path = axl_strdup (storage_path);
+
+	/* update hash size */
+	ctx->storage_path_hash_size = hash_size;
+
+	/* shard placement depends on paths */
+	if (ctx->storage_shards_count > 0)
+		__myqtt_storage_ring_build (ctx);
+
+	/* now unlock */
+	myqtt_mutex_unlock (&ctx->ref_mutex);
+
+	return axl_true;
+}
+
+/** 
+ * @brief Allows to add an additional storage root (shard) to spread
+ * persistence I/O over several directories or devices.
+ *
+ * The path configured with \ref myqtt_storage_set_path is the first
+ * shard. Client identifiers (all their session data) and retained
+ * topics are placed on shards by consistent hashing, so adding a
+ * shard only moves a small fraction of them. Placement is computed
+ * from the path strings (not their position), so paths must never
+ * change once used: sessions found on a shard they are not placed on
+ * are skipped at load (they have to be moved by hand). The
+ * subscription index is kept on the first shard (\ref
+ * myqtt_storage_set_path).
+ *
+ * \ref myqtt_storage_load lists sessions of each shard in parallel
+ * (one directory scan per shard). Loading those sessions is then
+ * done sequentially.
+ *
+ * This function must be called before the storage is used (before
+ * \ref myqtt_storage_load and before any connection is handled).
  *
- * @param app_msg_size Application message size.
+ * @param ctx The context where the operation takes place. It cannot be NULL.
  *
+ * @param storage_path The storage dir to add. It cannot be NULL, empty
+ * or already configured.
  *
- * @return axl_true in the case retain message was configured without errors, otherwise axl_false is returned.
+ * @return axl_true if the shard was added, otherwise axl_false is returned.
  */
-axl_bool       myqtt_storage_retain_msg_set (MyQttCtx            * ctx,
-					     const char          * topic_name,
-					     MyQttQos              qos,
-					     const unsigned char * app_msg,
-					     int                   app_msg_size)
+axl_bool     myqtt_storage_add_path (MyQttCtx * ctx, const char * storage_path)
 {
-	char            * hash_value;
-	int               topic_filter_len;
-	char            * full_path;
-	char            * aux_path;
-	char            * path_item;
-	struct timeval    stamp;
-	FILE            * handle;
-
-	if (ctx == NULL || topic_name == NULL || app_msg_size < 0)
-		return axl_false;
-
-	if (ctx == NULL || ctx->storage_path_hash_size == 0)
-		return axl_false;
-
-	/* get topic filter len */
-	topic_filter_len = strlen (topic_name);
-	if (topic_filter_len == 0)
-		return axl_false;
+	char     ** shards;
+	int         iterator;
 
-	/* hash topic filter */
-	hash_value = axl_strdup_printf ("%u", axl_hash_string ((axlPointer) topic_name) % ctx->storage_path_hash_size);
-	if (hash_value == NULL)
+	if (ctx == NULL || storage_path == NULL || strlen (storage_path) == 0)
 		return axl_false;
 
-	/* call to check subscription in the provided directory. If it exists, remove it */	
-	full_path = myqtt_support_build_filename (ctx->storage_path, "retained", hash_value, NULL);
-	if (full_path == NULL) {
-		axl_free (hash_value);
-		return axl_false;
-	} /* end if */
+	myqtt_mutex_lock (&ctx->ref_mutex);
 
-	/* remove the retained message if it does exists */
-	if (myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
-		/* directory exists, check to remove previous subscription */
-		__myqtt_storage_sub_exists (ctx, full_path, topic_name, strlen (topic_name), axl_true, axl_true, NULL, NULL, NULL);
-	} else {
-		myqtt_log (MYQTT_LEVEL_CRITICAL, "Found path %s does not exists, calling myqtt_mkdir ()", full_path);
-		
-		/* directory is not present, try to create it */
-		if (myqtt_mkdir (ctx, full_path, 0700)) {
-			__myqtt_storage_error_report (ctx, "Failed to create directory %s, unable to storage retained message, mkdir() failed", full_path);
-			axl_free (hash_value);
-			axl_free (full_path);
+	/* check it is not already configured */
+	iterator = 0;
+	while (iterator <= ctx->storage_shards_count) {
+		if (axl_cmp (__myqtt_storage_shard_path (ctx, iterator), storage_path)) {
+			myqtt_mutex_unlock (&ctx->ref_mutex);
+			myqtt_log (MYQTT_LEVEL_CRITICAL, "Unable to add storage path %s, it is already configured", storage_path);
 			return axl_false;
 		} /* end if */
-	} /* end if */
-
-	/* release base path */
-	axl_free (full_path);
-
-	/* now save retained message, first subscription topic and qos */
-	gettimeofday (&stamp, NULL);
-	path_item = axl_strdup_printf ("%d-%d-%d-%d-%d", topic_filter_len, qos, hash_value, stamp.tv_sec, stamp.tv_usec);
-	full_path = myqtt_support_build_filename (ctx->storage_path, "retained", hash_value, path_item, NULL);
-	axl_free (path_item);
-	axl_free (hash_value);
-
-	/* open handle */
-	myqtt_log (MYQTT_LEVEL_DEBUG, "Saving retained message at %s", full_path);
-	handle = fopen (full_path, "w");
-	if (! handle) {
-		__myqtt_storage_error_report (ctx, "Failed to open file %s", full_path);
-		axl_free (full_path);
-		return axl_false;
-	} /* end if */
+		iterator++;
+	} /* end while */
 
-	/* write subscription */
-	if (fwrite (topic_name, 1, topic_filter_len, handle) != topic_filter_len) {
-		fclose (handle);
-		__myqtt_storage_error_report (ctx, "Unable to store topic filter value at %s", full_path);
-		axl_free (full_path);
+	/* add shard */
+	shards = axl_realloc (ctx->storage_shards, sizeof (char *) * (ctx->storage_shards_count + 1));
+	if (shards == NULL) {
+		myqtt_mutex_unlock (&ctx->ref_mutex);
 		return axl_false;
 	} /* end if */
-
-	/* close this initial file */
-	fclose (handle);
-	
-	/* now write message content */
-	aux_path = axl_strdup_printf ("%s.msg", full_path);
-	axl_free (full_path);
-
-	/* open handle */
-	handle = fopen (aux_path, "w");
-	if (! handle) {
-		__myqtt_storage_error_report (ctx, "Failed to open file %s", aux_path);
-		axl_free (full_path);
+	ctx->storage_shards                              = shards;
+	ctx->storage_shards[ctx->storage_shards_count]  = axl_strdup (storage_path);
+	ctx->storage_shards_count++;
+
+	/* rebuild placement and create directories */
+	if (! __myqtt_storage_ring_build (ctx) || ! __myqtt_storage_init_root (ctx, storage_path)) {
+		ctx->storage_shards_count--;
+		axl_free (ctx->storage_shards[ctx->storage_shards_count]);
+		__myqtt_storage_ring_build (ctx);
+		myqtt_mutex_unlock (&ctx->ref_mutex);
 		return axl_false;
 	} /* end if */
 
-	/* write subscription */
-	if (fwrite (app_msg, 1, app_msg_size, handle) != app_msg_size) {
-		fclose (handle);
-		__myqtt_storage_error_report (ctx, "Unable to store topic filter value at %s", full_path);
-		axl_free (full_path);
-		return axl_false;
-	}
-	fclose (handle);
+	myqtt_mutex_unlock (&ctx->ref_mutex);
 
-	axl_free (aux_path);
-	
 	return axl_true;
 }
 
 /** 
- * @brief Allows to release retain message (if any) associated to the
- * provided topic_filter.
+ * @brief Returns the number of storage roots (shards) configured
+ * (see \ref myqtt_storage_add_path).
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @return Number of storage roots (1 when only the storage path is
+ * configured) or -1 if it fails.
  */
-void       myqtt_storage_retain_msg_release (MyQttCtx      * ctx,
-					     const char    * topic_name)
+int          myqtt_storage_shards (MyQttCtx * ctx)
 {
-	char            * hash_value;
-	int               topic_filter_len;
-	char            * full_path;
+	if (ctx == NULL)
+		return -1;
+	return ctx->storage_shards_count + 1;
+}
 
+void __myqtt_storage_get_retained_topics_dir (MyQttCtx * ctx, const char * topic_filter, const char * full_path, axlList * list)
+{
+	unsigned char * topic_name = NULL;
+	int             ref_size   = 0;
+	DIR           * sub_dir;
+	struct dirent * entry;
+	char          * aux_path;
+	axl_bool        added_to_the_list;
 
-	if (ctx == NULL || topic_name == NULL)
+	/* try to open path */
+	sub_dir = opendir (full_path);
+	if (sub_dir == NULL) {
+		__myqtt_storage_error_report (ctx, "Unable to open %s", full_path);
 		return;
+	} /* end if */
 
-	if (ctx == NULL || ctx->storage_path_hash_size == 0)
-		return;
+	entry   = readdir (sub_dir);
+	while (sub_dir && entry) {
 
-	/* get topic filter len */
-	topic_filter_len = strlen (topic_name);
-	if (topic_filter_len == 0)
-		return;
-	
-	/* hash topic filter */
-	hash_value = axl_strdup_printf ("%u", axl_hash_string ((axlPointer) topic_name) % ctx->storage_path_hash_size);
-	if (hash_value == NULL)
-		return;
+		/* get next entry and skip those we are not interested in */
+		if (axl_cmp (".", entry->d_name) || axl_cmp ("..", entry->d_name)) {
+			entry = readdir (sub_dir);
+			continue;
+		} /* end if */
 
-	/* call to check subscription in the provided directory. If it exists, remove it */	
-	full_path = myqtt_support_build_filename (ctx->storage_path, "retained", hash_value, NULL);
-	axl_free (hash_value);
-	if (full_path == NULL) 
-		return;
+		/* create full path and do some checks */
+		aux_path = myqtt_support_build_filename (full_path, entry->d_name, NULL);
+		if (! myqtt_support_file_test (aux_path, FILE_EXISTS | FILE_IS_REGULAR)) {
+			entry = readdir (sub_dir);
+			axl_free (aux_path);
+			continue;
+		} /* end if */
 
-	/* remove subscription (well, in fact topic name) and message associated if it exists */
-	myqtt_log (MYQTT_LEVEL_DEBUG, "Releasing retained message for subscription %s at %s", topic_name, full_path);
-	__myqtt_storage_sub_exists (ctx, full_path, topic_name, strlen (topic_name), axl_true, axl_true, NULL, NULL, NULL);
-	axl_free (full_path);
+		/* skip those files that includes .msg (which is the content of the message retained) */
+		if (strstr (aux_path, ".msg")) {
+			entry = readdir (sub_dir);
+			axl_free (aux_path);
+			continue;
+		}
+		
+		/* skip known extensions that aren't valid */
+		if (strstr (aux_path, "~")) {
+			entry = readdir (sub_dir);
+			axl_free (aux_path);
+			continue;
+		}
+
+		/* call to load the content from the file */
+		topic_name = NULL;
+		__myqtt_storage_read_content_into_reference (ctx, aux_path, &topic_name, &ref_size);
+		axl_free (aux_path);
+		added_to_the_list = axl_false;
+		
+		/* save into the list the topic name recovered */
+		if (topic_name && strlen ((const char *) topic_name) > 0) {
+			/* check if the topic matches with the filter */
+			if (myqtt_reader_topic_filter_match ((const char *) topic_name, topic_filter)) {
+				axl_list_append (list, topic_name);
+				/* notify added to the list */
+				added_to_the_list = axl_true;
+			}
+		} /* end if */
+
+		if (! added_to_the_list) {
+			/* release if it wasn't added to the list */
+			axl_free (topic_name);
+		} /* end if */
+
+		/* get next entry */
+		entry   = readdir (sub_dir);
+	} /* end if */
+
+	closedir (sub_dir);
 
 	return;
 }
 
 /** 
- * @brief Allows to recover retained message for the provided topic (if any).
- *
- * @param ctx The context where the operation takes place.
- *
- * @param topic_name The topic name for which the retain message recovery will be attempted
- *
- * @param qos A referece to hold recovered qos
+ * @brief Allows to get the list of topics with message retention
+ * stored, filtered by the provided topic_filter
  *
- * @param app_msg A referece to hold recovered application message.
+ * @param ctx The context where the operation takes place
  *
- * @param app_msg_size A reference to hold recovered application message size.
+ * @param topic_filter The filter to allow selecting those topics that
+ * matches and have a message pending due to retain flag configured in
+ * the last publish
  *
- * @return The function reports axl_true when the message was
- * recovered. Otherwise, axl_false is reported.
+ * @return A list of retained topics or NULL if it fails. The list
+ * returned may be empty. Use axl_list_free (to release result
+ * reported).
  */
-axl_bool      myqtt_storage_retain_msg_recover (MyQttCtx       * ctx,
-						const char     * topic_name,
-						MyQttQos       * qos,
-						unsigned char ** app_msg,
-						int            * app_msg_size)
+axlList * myqtt_storage_get_retained_topics (MyQttCtx * ctx, const char * topic_filter)
 {
-	char            * hash_value;
-	int               topic_filter_len;
-	char            * full_path;
-	axl_bool          result;
-
-	if (ctx == NULL || topic_name == NULL)
-		return axl_false;
+	MyQttStorageRetainedMerge   merge;
+	axlListCursor             * cursor;
+	axlList                   * released;
+	int                         cached;
 
-	/* get topic filter len */
-	topic_filter_len = strlen (topic_name);
-	if (topic_filter_len == 0)
-		return axl_false;
+	if (ctx == NULL || topic_filter == NULL)
+		return NULL;
 
-	if (ctx == NULL || ctx->storage_path_hash_size == 0)
-		return axl_false;
+	/* no flush in between the driver listing and the merge: a
+	 * topic written and removed from memory meanwhile would be
+	 * missed by both */
+	myqtt_mutex_lock (&ctx->storage_retain_flush_m);
+
+	/* call to driver implementation */
+	merge.list         = __myqtt_storage_get (ctx)->retained_topics (ctx, topic_filter);
+	merge.topic_filter = topic_filter;
+	merge.removed      = 0;
+
+	/* check for values kept in memory (not flushed yet) */
+	myqtt_mutex_lock (&ctx->storage_retain_m);
+	cached = ctx->storage_retain_cache ? axl_hash_items (ctx->storage_retain_cache) : 0;
+	myqtt_mutex_unlock (&ctx->storage_retain_m);
+	if (cached == 0) {
+		myqtt_mutex_unlock (&ctx->storage_retain_flush_m);
+		return merge.list;
+	} /* end if */
 
-	/* hash topic filter */
-	hash_value = axl_strdup_printf ("%u", axl_hash_string ((axlPointer) topic_name) % ctx->storage_path_hash_size);
-	if (hash_value == NULL)
-		return axl_false;
-	
-	/* call to check subscription in the provided directory. If it exists, remove it */	
-	full_path = myqtt_support_build_filename (ctx->storage_path, "retained", hash_value, NULL);
-	axl_free (hash_value);
-	if (full_path == NULL) 
-		return axl_false;
-	
-	/* remove subscription (well, in fact topic name) and message associated if it exists */
-	myqtt_log (MYQTT_LEVEL_DEBUG, "Recovering retained message for subscription %s at %s", topic_name, full_path);
-	result = __myqtt_storage_sub_exists (ctx, full_path, topic_name, strlen (topic_name), axl_true, axl_true, qos, app_msg, app_msg_size);
-	axl_free (full_path);
-	
-	return result; /* by default report error */
+	/* index topics reported by the driver (outside storage_retain_m) */
+	if (merge.list == NULL)
+		merge.list = axl_list_new (axl_list_always_return_1, axl_free);
+	merge.index = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+	if (merge.list == NULL || merge.index == NULL) {
+		myqtt_mutex_unlock (&ctx->storage_retain_flush_m);
+		axl_hash_free (merge.index);
+		return merge.list;
+	} /* end if */
+	cursor = axl_list_cursor_new (merge.list);
+	while (axl_list_cursor_has_item (cursor)) {
+		axl_hash_insert (merge.index, axl_list_cursor_get (cursor), axl_list_cursor_get (cursor));
+		axl_list_cursor_next (cursor);
+	} /* end while */
+
+	/* update with values kept in memory */
+	myqtt_mutex_lock (&ctx->storage_retain_m);
+	if (ctx->storage_retain_cache)
+		axl_hash_foreach (ctx->storage_retain_cache, __myqtt_storage_retain_cache_merge, &merge);
+	myqtt_mutex_unlock (&ctx->storage_retain_m);
+	myqtt_mutex_unlock (&ctx->storage_retain_flush_m);
+
+	/* drop topics released in memory (one pass; strings are
+	 * released after the index that references them) */
+	released = NULL;
+	if (merge.removed > 0) {
+		released = axl_list_new (axl_list_always_return_1, axl_free);
+		axl_list_cursor_first (cursor);
+		while (released && axl_list_cursor_has_item (cursor)) {
+			if (axl_hash_get (merge.index, axl_list_cursor_get (cursor)) == NULL) {
+				axl_list_append (released, axl_list_cursor_get (cursor));
+				axl_list_cursor_unlink (cursor);
+				continue;
+			} /* end if */
+			axl_list_cursor_next (cursor);
+		} /* end while */
+	} /* end if */
+	axl_list_cursor_free (cursor);
+	axl_hash_free (merge.index);
+	axl_list_free (released);
+
+	return merge.list;
 }
 
 /** 
- * @brief Allows to get current queued messages pending to be
- * redelivered on next connection (offline version).
- *
- * @param ctx The context where the operation takes place.
- *
- * @param client_identifier The client identifier to select the right
- * local session according to its client identifier.
- *
- * @return Amount of messages stored on the provided client_identifier.
+ * @internal Collects retained topics found on the provided storage
+ * root matching the topic filter (list is created on first root
+ * found).
  */
-int      myqtt_storage_queued_messages_offline (MyQttCtx   * ctx, 
-						const char * client_identifier)
+void __myqtt_storage_file_retained_topics_shard (MyQttCtx * ctx, const char * root, const char * topic_filter, axlList ** result)
 {
-	char            * full_path;
-	DIR             * sub_dir;
-	int               count;
-	struct dirent   * entry;
-#if !defined(_DIRENT_HAVE_D_TYPE)
-	char            * aux_path;
-#endif
 
-	/* check input values:
-	 *
-	 * don't check here for (pkg_id > 65536) because we use values
-	 * over that to store QoS0 messages that do not need a valid
-	 * pkg_id but we need a different value to store them */
-	if (ctx == NULL || client_identifier == NULL || strlen (client_identifier) == 0)
-		return 0;
+	char          * full_path;
+	char          * aux_path;
+	DIR           * sub_dir;
+	struct dirent * entry;
+	axlList       * list;
 
-	/* build path */
-	full_path = myqtt_support_build_filename (ctx->storage_path, client_identifier, "msgs", NULL);
-	if (! full_path) 
-		return 0;
+	/* get full path to subscriptions */
+	full_path = myqtt_support_build_filename (root, "retained", NULL);
+	if (full_path == NULL) 
+		return; /* allocation failure */
 
-	/* open directory */
+	if (! myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
+		axl_free (full_path);
+		return; /* directory do not exists */
+	} /* end if */
+
+	/* try to open path */
 	sub_dir = opendir (full_path);
-	if (sub_dir == NULL)  {
+	if (sub_dir == NULL) {
+		__myqtt_storage_error_report (ctx, "Unable to open %s", full_path);
 		axl_free (full_path);
-		return 0;
+		return;
 	} /* end if */
-	
-	/* count files inside messages directory */
-	count = 0;
-	entry = readdir (sub_dir);
-	while (entry) {
 
+	/* create list */
+	if ((* result) == NULL)
+		(* result) = axl_list_new (axl_list_always_return_1, axl_free);
+	list = (* result);
+
+	entry   = readdir (sub_dir);
+	while (sub_dir && entry) {
+
+		/* get next entry and skip those we are not interested in */
+		if (axl_cmp (".", entry->d_name) || axl_cmp ("..", entry->d_name)) {
+			entry = readdir (sub_dir);
+			continue;
+		} /* end if */
+
+		/* check if it is a directory */
 #if defined(_DIRENT_HAVE_D_TYPE)
-		if ((entry->d_type & DT_REG) == DT_REG) 
-			count++;
+		if ((entry->d_type & DT_DIR) == DT_DIR) {
+			/* count subscriptions */
+			aux_path  = myqtt_support_build_filename (full_path, entry->d_name, NULL);
+			__myqtt_storage_get_retained_topics_dir (ctx, topic_filter, aux_path, list);
+			axl_free (aux_path);
+		}
 #else 
 		aux_path = myqtt_support_build_filename (full_path, entry->d_name, NULL);
-		if (myqtt_support_file_test (aux_path, FILE_EXISTS | FILE_IS_REGULAR)) {
-			/* count subscriptions */
-			count++;
+		if (myqtt_support_file_test (aux_path, FILE_EXISTS | FILE_IS_DIR)) {
+			/* load into list topic filters found */
+			__myqtt_storage_get_retained_topics_dir (ctx, topic_filter, aux_path, list);
 		}
 		axl_free (aux_path);
 #endif
 
 		/* get next entry */
-		entry = readdir (sub_dir);
+		entry   = readdir (sub_dir);
 	}
-	axl_free (full_path);
 
 	closedir (sub_dir);
+	axl_free (full_path);
 
-	return count;
+	return;
 }
 
 /** 
- * @brief Allows to get current queued messages pending to be
- * redelivered on next connection.
- *
- * @param ctx The context where the operation takes place.
- *
- * @param conn Connection reference to select the right local session
- * according to its client identifier.
- *
- * @return Number of queued messages associated to the client id
- * running the provided connection or -1 if it fails
+ * @internal File storage implementation for retained_topics operation.
  */
-int      myqtt_storage_queued_messages         (MyQttCtx   * ctx, 
-						MyQttConn  * conn)
+axlList * __myqtt_storage_file_retained_topics (MyQttCtx * ctx, const char * topic_filter)
 {
-	if (conn == NULL)
-		return -1;
+	axlList       * list = NULL;
+	int             iterator;
 
-	return myqtt_storage_queued_messages_offline (ctx, conn->client_identifier);
+	/* collect retained topics from all shards */
+	iterator = 0;
+	while (iterator <= ctx->storage_shards_count) {
+		__myqtt_storage_file_retained_topics_shard (ctx, __myqtt_storage_shard_path (ctx, iterator), topic_filter, &list);
+		iterator++;
+	} /* end while */
+
+	return list;
 }
 
 /** 
- * @brief Allows to get current storage quota used by queued messages
- * pending to be redelivered on next connection.
- *
- * @param ctx The context where the operation takes place.
- *
- * @param client_identifier The client identifier to select the right
- * local session according to its client identifier.
- *
- * @return Quota used by the storage selected by the provided client_identifier.
+ * @internal File storage implementation for msg_expire
+ * operation. Stamps are taken from message file names so no
+ * content is read.
  */
-int      myqtt_storage_queued_messages_quota_offline   (MyQttCtx   * ctx, 
-							const char * client_identifier)
+int __myqtt_storage_file_msg_expire (MyQttCtx             * ctx, 
+				     const char           * client_identifier, 
+				     long                   stamp_limit,
+				     MyQttStorageMsgFound   func, 
+				     axlPointer             user_data)
 {
 	char            * full_path;
+	char            * aux_path;
 	DIR             * sub_dir;
-	int               count;
 	struct dirent   * entry;
-	int               pos;
-#if !defined(_DIRENT_HAVE_D_TYPE)
-	char            * aux_path;
-#endif
+	long              stamp;
+	int               count = 0;
 
-	/* check input values:
-	 *
-	 * don't check here for (pkg_id > 65536) because we use values
-	 * over that to store QoS0 messages that do not need a valid
-	 * pkg_id but we need a different value to store them */
-	if (ctx == NULL || client_identifier == NULL || strlen (client_identifier) == 0)
-		return 0;
+	int               qos;
+	int               packet_id;
+	int               size;
 
 	/* build path */
-	full_path = myqtt_support_build_filename (ctx->storage_path, client_identifier, "msgs", NULL);
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "msgs", NULL);
 	if (! full_path) 
 		return 0;
 
@@ -1733,636 +4566,890 @@ int      myqtt_storage_queued_messages_quota_offline   (MyQttCtx   * ctx,
 		axl_free (full_path);
 		return 0;
 	} /* end if */
-	
-	/* count files inside messages directory */
-	count = 0;
+
 	entry = readdir (sub_dir);
 	while (entry) {
-#if defined(_DIRENT_HAVE_D_TYPE)
-		if ((entry->d_type & DT_REG) == DT_REG)  {
-			pos = __myqtt_storage_strpos (ctx, entry->d_name, '-');
-			count += __myqtt_storage_get_size_from_file_name (ctx, entry->d_name + pos + 1, NULL);
-		}
-#else 
+		/* skip default entries and messages not expired */
+		stamp = __myqtt_storage_get_stamp_from_file_name (ctx, entry->d_name);
+		if (entry->d_name[0] == '.' || stamp < 0 || stamp > stamp_limit) {
+			entry = readdir (sub_dir);
+			continue;
+		} /* end if */
+
+		/* remove message */
 		aux_path = myqtt_support_build_filename (full_path, entry->d_name, NULL);
-		if (myqtt_support_file_test (aux_path, FILE_EXISTS | FILE_IS_REGULAR)) {
-			/* count subscriptions */
-			pos = __myqtt_storage_strpos (ctx, aux_path, '-');
-			count += __myqtt_storage_get_size_from_file_name (ctx, aux_path + pos + 1, NULL);
-		}
-		axl_free (aux_path);
-#endif
+		if (aux_path == NULL || unlink (aux_path) != 0) {
+			axl_free (aux_path);
+			entry = readdir (sub_dir);
+			continue;
+		} /* end if */
+		count++;
+
+		/* notify message removed, handle is now owned by func */
+		__myqtt_storage_get_values_from_file_name (ctx, entry->d_name, &packet_id, &size, &qos);
+		if (func)
+			func (ctx, client_identifier, aux_path, packet_id, qos, NULL, size, user_data);
+		else
+			axl_free (aux_path);
 
 		/* get next entry */
 		entry = readdir (sub_dir);
-	}
-	axl_free (full_path);
+	} /* end while */
 
 	closedir (sub_dir);
+	axl_free (full_path);
 
-	return count;	
+	return count;
 }
 
 /** 
- * @brief Allows to get current storage quota used by queued messages
- * pending to be redelivered on next connection.
- *
- * @param ctx The context where the operation takes place.
- *
- * @param conn Connection reference to select the right local session
- * according to its client identifier.
- *
- * @return Number of queued messages associated to the client id
- * running the provided connection.
+ * @internal File storage implementation for session_touch
+ * operation: updates <client-id>/seen modification time.
  */
-int      myqtt_storage_queued_messages_quota   (MyQttCtx   * ctx, 
-						MyQttConn  * conn)
-{
-	if (conn == NULL)
-		return -1;
-	return myqtt_storage_queued_messages_quota_offline (ctx, conn->client_identifier);
-}
-
-void myqtt_storage_queued_flush_work (MyQttCtx * ctx, MyQttConn * conn)
+void __myqtt_storage_file_session_touch (MyQttCtx * ctx, const char * client_identifier)
 {
-	/* local parameters */
-	char            * full_path;
-	DIR             * sub_dir;
-	int               count;
-	struct dirent   * entry;
-	char            * aux_path;
-
-	int               qos;
-	int               packet_id;
-	unsigned char   * msg;
-	int               size;
-
-	FILE            * _fcontent;
+	char * full_path;
+	FILE * handle;
 
-	/* check input values:
-	 *
-	 * don't check here for (pkg_id > 65536) because we use values
-	 * over that to store QoS0 messages that do not need a valid
-	 * pkg_id but we need a different value to store them */
-	if (ctx == NULL || conn == NULL || conn->client_identifier == NULL || strlen (conn->client_identifier) == 0)
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "seen", NULL);
+	if (! full_path)
 		return;
 
-	/* build path */
-	full_path = myqtt_support_build_filename (ctx->storage_path, conn->client_identifier, "msgs", NULL);
-	if (! full_path) 
-		return;
+	/* fails when there is no storage for this client identifier */
+	handle = fopen (full_path, "w");
+	if (handle)
+		fclose (handle);
+	axl_free (full_path);
 
-	/* open directory */
-	sub_dir = opendir (full_path);
-	if (sub_dir == NULL)  {
-		axl_free (full_path);
-		return;
-	} /* end if */
-	
-	/* count files inside messages directory */
-	count = 0;
-	entry = readdir (sub_dir);
-	while (entry) {
+	return;
+}
 
-		aux_path = myqtt_support_build_filename (full_path, entry->d_name, NULL);
-		if (myqtt_support_file_test (aux_path, FILE_EXISTS | FILE_IS_REGULAR)) {
-			/* ok, now parse each message to get */
+/** 
+ * @internal File storage implementation for session_stamp
+ * operation: uses <client-id>/seen modification time or the client
+ * identifier directory's if the session was never touched.
+ */
+long __myqtt_storage_file_session_stamp (MyQttCtx * ctx, const char * client_identifier)
+{
+	char        * full_path;
+	struct stat   info;
+	long          stamp = -1;
 
-			/* get packet_id */
-			__myqtt_storage_get_values_from_file_name (ctx, entry->d_name, &packet_id, &size, &qos);
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "seen", NULL);
+	if (full_path && stat (full_path, &info) == 0)
+		stamp = (long) info.st_mtime;
+	axl_free (full_path);
 
-			myqtt_log (MYQTT_LEVEL_DEBUG, "Sending offline queued message to conn-id=%d conn=%p packet_id=%d size=%d qos=%d handle=%s",
-				   conn->id, conn, packet_id, size, qos, entry->d_name);
+	if (stamp >= 0)
+		return stamp;
 
-			/* open message into memory */
-			msg        = axl_new (unsigned char, size + 1);
-			_fcontent  = fopen (aux_path, "r");
-			if (fread (msg, 1, size, _fcontent) != size) 
-				myqtt_log (MYQTT_LEVEL_CRITICAL, "Expected to read %d from file but found different size read, error was: %s",
-					   size, myqtt_errno_get_error (errno));
-			fclose (_fcontent);
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, NULL);
+	if (full_path && stat (full_path, &info) == 0)
+		stamp = (long) info.st_mtime;
+	axl_free (full_path);
 
-			/* call to resend */
-			if (! __myqtt_conn_pub_send_and_handle_reply (ctx, conn, packet_id, qos, aux_path, 60, msg, size)) 
-				myqtt_log (MYQTT_LEVEL_CRITICAL, "failed to resend queued message, __myqtt_conn_pub_send_and_handle_reply() failed");
-			
-			/* nullify to avoid double-free on next call */
-			aux_path = NULL;
+	return stamp;
+}
 
-			/* no need to release msg, or aux_paht
-			 * here...this is already done by
-			 * __myqtt_conn_pub_send_and_handle_reply() */
+/** 
+ * @internal File storage implementation for session_remove
+ * operation: clears all storage parts and removes the (now empty)
+ * client identifier directory.
+ */
+void __myqtt_storage_file_session_remove (MyQttCtx * ctx, const char * client_identifier)
+{
+	const char * parts[] = {"msgs", "subs", "will", "pkgids", NULL};
+	char       * full_path;
+	int          iterator;
 
-			/* count subscriptions */
-			count++;
-		}
-		axl_free (aux_path);
+	/* remove all files */
+	__myqtt_storage_file_clear (ctx, client_identifier, MYQTT_STORAGE_ALL);
 
-		/* get next entry */
-		entry = readdir (sub_dir);
-	}
+	/* now remove directories (subs may contain one directory per
+	 * subscription hash that is already empty) */
+	iterator = 0;
+	while (parts[iterator]) {
+		full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, parts[iterator], NULL);
+		__myqtt_storage_remove_dirs (ctx, full_path);
+		axl_free (full_path);
+		iterator++;
+	} /* end while */
+
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, "seen", NULL);
+	unlink (full_path);
 	axl_free (full_path);
 
-	closedir (sub_dir);
+	full_path = myqtt_support_build_filename (__myqtt_storage_root (ctx, client_identifier), client_identifier, NULL);
+	if (rmdir (full_path) != 0)
+		__myqtt_storage_error_report (ctx, "Failed to remove expired session directory %s", full_path);
+	axl_free (full_path);
 
 	return;
 }
 
-axlPointer __myqtt_storage_queued_flush_proxy (axlPointer _conn)
+/** 
+ * @internal File storage start operation: nothing to prepare, base
+ * storage is created on demand by __myqtt_storage_init_base_storage.
+ */
+axl_bool __myqtt_storage_file_start (MyQttCtx * ctx)
 {
-	MyQttConn * conn = _conn;
-	MyQttCtx  * ctx  = conn->ctx;
-
-	/* call local function */
-	myqtt_storage_queued_flush_work (ctx, conn);
+	return axl_true;
+}
 
-	/* signal we have finished flushing */
-	conn->flushing = axl_false;
+/** 
+ * @internal File storage stop operation.
+ */
+void __myqtt_storage_file_stop (MyQttCtx * ctx)
+{
+	return;
+}
 
-	/* release reference */
-	myqtt_conn_unref (conn, "flushing queue");
+/** 
+ * @internal Default storage driver table, implemented on top of the
+ * local file system (see \ref myqtt_storage_set_path).
+ */
+MyQttStorageBackend __myqtt_storage_file_backend = {
+	"file",
+	__myqtt_storage_file_start,
+	__myqtt_storage_file_stop,
+	__myqtt_storage_file_init,
+	__myqtt_storage_file_clear,
+	__myqtt_storage_file_sub,
+	__myqtt_storage_file_sub_exists,
+	__myqtt_storage_file_sub_iterate,
+	__myqtt_storage_file_store_msg,
+	__myqtt_storage_file_release_msg,
+	__myqtt_storage_file_queued_messages,
+	__myqtt_storage_file_queued_quota,
+	__myqtt_storage_file_msg_iterate,
+	__myqtt_storage_file_lock_pkgid,
+	__myqtt_storage_file_release_pkgid,
+	__myqtt_storage_file_retain_set,
+	__myqtt_storage_file_retain_recover,
+	__myqtt_storage_file_retain_release,
+	__myqtt_storage_file_retained_topics,
+	__myqtt_storage_file_sessions,
+	__myqtt_storage_file_load,
+	__myqtt_storage_file_msg_expire,
+	__myqtt_storage_file_session_touch,
+	__myqtt_storage_file_session_stamp,
+	__myqtt_storage_file_session_remove
+};
 
-	return NULL;
+/** 
+ * @internal Allows to get a reference to the file storage driver.
+ */
+MyQttStorageBackend * __myqtt_storage_backend_file (void)
+{
+	return &__myqtt_storage_file_backend;
 }
 
 /** 
- * @brief Allows to redeliver all queued messages associated to the
- * connected session provided.
+ * @brief Allows to install a custom storage driver on the provided
+ * context.
+ *
+ * The storage driver replaces the default file system based
+ * implementation for all myqtt_storage_* operations (sessions,
+ * subscriptions, queued messages, packet ids and retained
+ * messages). Public myqtt_storage_* functions still check their
+ * parameters and call to the on store/on release handlers
+ * configured, so drivers only have to implement the persistence
+ * part.
+ *
+ * The function must be called before the context starts serving
+ * connections (that is, before \ref myqtt_storage_load is
+ * called). The previous driver (if any) is stopped and the new one
+ * started.
  *
  * @param ctx The context where the operation takes place.
  *
- * @param conn The connection that may have pending messages to be redeliver...
+ * @param backend The storage driver to install. The reference must
+ * be valid during the context's life (usually a static
+ * structure). Passing NULL restores the default file storage.
  *
- * @return Number of flushed messages, or -1 if it fails.
+ * @return axl_true if the driver was installed, otherwise axl_false
+ * is returned (NULL context, storage already loaded, incomplete
+ * driver table or start operation failure).
  */
-void      myqtt_storage_queued_flush            (MyQttCtx   * ctx, 
-						 MyQttConn  * conn)
+axl_bool  myqtt_storage_set_backend (MyQttCtx * ctx, MyQttStorageBackend * backend)
 {
-	if (ctx == NULL || conn == NULL)
-		return;
+	MyQttStorageBackend * previous;
 
-	/* skip if there is another process flushing */
-	if (conn->flushing)
-		return;
+	if (ctx == NULL)
+		return axl_false;
 
-	/* ensure only one process is flushing */
-	myqtt_mutex_lock (&conn->op_mutex);
-	if (conn->flushing) {
-		myqtt_mutex_unlock (&conn->op_mutex);
-		return;
+	/* check driver table is complete */
+	if (backend && (backend->init == NULL || backend->clear == NULL ||
+			backend->sub == NULL || backend->sub_exists == NULL || backend->sub_iterate == NULL ||
+			backend->store_msg == NULL || backend->release_msg == NULL || backend->queued_messages == NULL ||
+			backend->queued_quota == NULL || backend->msg_iterate == NULL || backend->lock_pkgid == NULL ||
+			backend->release_pkgid == NULL || backend->retain_set == NULL || backend->retain_recover == NULL ||
+			backend->retain_release == NULL || backend->retained_topics == NULL || backend->sessions == NULL)) {
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Unable to install storage driver %s, driver table is not complete", 
+			   backend->backend_type ? backend->backend_type : "<undefined>");
+		return axl_false;
 	} /* end if */
 
-	if (! myqtt_conn_ref (conn, "flushing queue")) {
-		myqtt_mutex_unlock (&conn->op_mutex);
-		return;
+	myqtt_mutex_lock (&ctx->ref_mutex);
+	if (ctx->local_storage) {
+		myqtt_mutex_unlock (&ctx->ref_mutex);
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Unable to change storage driver, storage was already loaded");
+		return axl_false;
 	} /* end if */
 
-	/* flag we are flushing */
-	conn->flushing = axl_true;
-	myqtt_mutex_unlock (&conn->op_mutex);
+	/* stop previous driver */
+	previous = ctx->storage_backend ? ctx->storage_backend : __myqtt_storage_backend_file ();
+	if (previous->stop)
+		previous->stop (ctx);
+
+	/* start new driver */
+	if (backend == NULL)
+		backend = __myqtt_storage_backend_file ();
+	if (backend->start && ! backend->start (ctx)) {
+		/* restore default driver */
+		ctx->storage_backend = NULL;
+		ctx->storage_type    = MYQTT_STORAGE_TYPE_FILE;
+		myqtt_mutex_unlock (&ctx->ref_mutex);
 
-	myqtt_log (MYQTT_LEVEL_DEBUG, "Flushing queued messages for conn-id=%d, conn=%p",
-		   conn->id, conn);
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to start storage driver %s", backend->backend_type);
+		return axl_false;
+	} /* end if */
 
-	/* call to flush */
-	myqtt_thread_pool_new_task (ctx, __myqtt_storage_queued_flush_proxy, conn);
+	/* configure driver */
+	if (backend == __myqtt_storage_backend_file ()) {
+		ctx->storage_backend = NULL;
+		ctx->storage_type    = MYQTT_STORAGE_TYPE_FILE;
+	} else {
+		ctx->storage_backend = backend;
+		ctx->storage_type    = (backend == __myqtt_storage_backend_memory ()) ? MYQTT_STORAGE_TYPE_MEMORY : MYQTT_STORAGE_TYPE_CUSTOM;
+	} /* end if */
+	myqtt_mutex_unlock (&ctx->ref_mutex);
 
-	return;
+	myqtt_log (MYQTT_LEVEL_DEBUG, "Storage driver configured: %s", backend->backend_type);
+
+	return axl_true;
 }
 
 /** 
- * @brief Allows to lock the provided id or fail if it is already in
- * use.
+ * @brief Allows to select one of the storage drivers provided by the
+ * library for the provided context.
  *
- * @param ctx The context where the operation takes place.
+ * By default, every context uses \ref MYQTT_STORAGE_TYPE_FILE. Use
+ * \ref MYQTT_STORAGE_TYPE_MEMORY to keep sessions, subscriptions,
+ * queued messages and retained messages in memory only (nothing
+ * survives a restart but no disk I/O is done). See \ref
+ * myqtt_storage_set_backend to install your own driver.
  *
- * @param client_identifier The client identifer where to lock the provided pkgid.
+ * @param ctx The context where the operation takes place.
  *
- * @param pkg_id The packet id to lock. 
+ * @param storage_type The storage type to use.
  *
- * @return axl_true if the pkgid was locked, otherwise axl_false is returned. 
+ * @return axl_true if the storage was configured, otherwise axl_false is returned.
  */
-axl_bool myqtt_storage_lock_pkgid_offline (MyQttCtx      * ctx, 
-					   const char    * client_identifier,
-					   int             pkg_id)
+axl_bool  myqtt_storage_use (MyQttCtx * ctx, MyQttStorageType storage_type)
 {
-	int    handle;
-	char * full_path;
-	char * ref;
-
-	/* don't check here for (pkg_id > 65536) because we use values
-	 * over that to store QoS0 messages that do not need a valid
-	 * pkg_id but we need a different value to store them */
-	if (ctx == NULL || client_identifier == NULL || strlen (client_identifier) == 0 || pkg_id < 1)
-		return axl_false;
-
-	/* create full path to lock pkgid */
-	ref       = axl_strdup_printf ("%d", pkg_id);
-	if (ref == NULL)
-		return axl_false;
-
-	/* build path */
-	full_path = myqtt_support_build_filename (ctx->storage_path, client_identifier, "pkgids", ref, NULL);
-	axl_free (ref);
-	if (full_path == NULL) 
-		return axl_false;
-
-	/* open directory handle */
-	myqtt_log (MYQTT_LEVEL_DEBUG, "Attempting to lock pkgid file at: %s", full_path);
-	handle = open (full_path, O_CREAT | O_EXCL, 0600);
-	axl_free (full_path);
-	if (handle < 0)
-		return axl_false;
-	close (handle);
+	switch (storage_type) {
+	case MYQTT_STORAGE_TYPE_FILE:
+		return myqtt_storage_set_backend (ctx, NULL);
+	case MYQTT_STORAGE_TYPE_MEMORY:
+		return myqtt_storage_set_backend (ctx, __myqtt_storage_backend_memory ());
+	default:
+		/* custom drivers must be configured with myqtt_storage_set_backend */
+		break;
+	} /* end switch */
 
-	return axl_true;	
+	return axl_false;
 }
 
 /** 
- * @brief Allows to lock the provided id or fail if it is already in
- * use.
+ * @brief Allows to get current storage driver used by the provided
+ * context.
  *
  * @param ctx The context where the operation takes place.
  *
- * @param conn The connection where the operation takes place, using its session.
+ * @return Reference to the storage driver or NULL if the context is NULL.
+ */
+MyQttStorageBackend * myqtt_storage_get_backend (MyQttCtx * ctx)
+{
+	if (ctx == NULL)
+		return NULL;
+	return __myqtt_storage_get (ctx);
+}
+
+/** 
+ * @brief Allows to get current storage type used by the provided
+ * context.
  *
- * @param pkg_id The packet id to lock. 
+ * @param ctx The context where the operation takes place.
  *
- * @return axl_true if the pkgid was locked, otherwise axl_false is returned. 
+ * @return The storage type (\ref MYQTT_STORAGE_TYPE_FILE by default).
  */
-axl_bool myqtt_storage_lock_pkgid (MyQttCtx * ctx, MyQttConn * conn, int pkg_id)
+MyQttStorageType myqtt_storage_get_type (MyQttCtx * ctx)
 {
-	/* avoid segfault when conn reference is NULL */
-	if (conn == NULL)
-		return axl_false;
+	if (ctx == NULL || ctx->storage_backend == NULL)
+		return MYQTT_STORAGE_TYPE_FILE;
+	return ctx->storage_type;
+}
 
-	return myqtt_storage_lock_pkgid_offline (ctx, conn->client_identifier, pkg_id);
+/** 
+ * @internal Thread pool event used to run the storage sweeper
+ * periodically (see \ref myqtt_storage_set_expiry).
+ */
+axl_bool __myqtt_storage_expire_event (MyQttCtx * ctx, axlPointer user_data, axlPointer user_data2)
+{
+	/* run sweeper */
+	myqtt_storage_expire (ctx);
+
+	return axl_false; /* keep the event */
 }
 
 /** 
- * @brief Allows to release the provided id from the current session
- * associated to the provided connection.
+ * @brief Allows to configure expiration for queued messages and
+ * sessions stored by the provided context, along with the period
+ * used to run the sweeper that reclaims them.
+ *
+ * Messages queued for a client identifier for more than
+ * message_ttl seconds are removed (on release handler is called
+ * for each one, with a NULL connection, so quota accounting is
+ * kept). They are removed in bulk by the sweeper and they are also
+ * skipped when queued messages are flushed to a client that
+ * reconnects.
+ *
+ * Persistent sessions (clean session disabled) not used for more
+ * than session_expiry seconds are removed entirely: queued
+ * messages, subscriptions and packet ids. The session is
+ * considered used while the client is connected and the idle time
+ * is counted from the moment it disconnects.
  *
  * @param ctx The context where the operation takes place.
  *
- * @param client_identifier Client identifier for which the release operation will be applied
+ * @param message_ttl Seconds a message can stay queued (0 to disable).
  *
- * @param pkg_id The packet id to release. 
+ * @param session_expiry Seconds a disconnected session is kept (0 to disable).
  *
- * @return axl_true if the pkgid was releaseed, otherwise axl_false is returned. 
+ * @param sweep_period Seconds between sweeper runs. Use 0 to avoid
+ * running the sweeper in the background (you can call \ref
+ * myqtt_storage_expire at any time).
+ *
+ * @return axl_true if the configuration was applied, otherwise
+ * axl_false is returned (wrong parameters or failure to install
+ * sweeper event).
  */
-void     myqtt_storage_release_pkgid_offline    (MyQttCtx      * ctx, 
-						 const char    * client_identifier,
-						 int             pkg_id)
+axl_bool myqtt_storage_set_expiry (MyQttCtx * ctx, int message_ttl, int session_expiry, int sweep_period)
 {
-	char * full_path;
-	char * ref;
+	int event_id;
 
-	/* don't check here for (pkg_id > 65536) because we use values
-	 * over that to store QoS0 messages that do not need a valid
-	 * pkg_id but we need a different value to store them */
-	if (ctx == NULL || client_identifier == NULL || strlen (client_identifier) == 0 || pkg_id < 1)
-		return;
+	if (ctx == NULL || message_ttl < 0 || session_expiry < 0)
+		return axl_false;
 
-	/* create full path to lock pkgid */
-	ref       = axl_strdup_printf ("%d", pkg_id);
-	if (ref == NULL)
-		return;
+	myqtt_mutex_lock (&ctx->ref_mutex);
+	ctx->storage_msg_ttl          = message_ttl;
+	ctx->storage_session_expiry   = session_expiry;
+	event_id                      = ctx->storage_expiry_event_id;
+	ctx->storage_expiry_event_id  = 0;
+	myqtt_mutex_unlock (&ctx->ref_mutex);
 
-	/* build path */
-	full_path = myqtt_support_build_filename (ctx->storage_path, client_identifier, "pkgids", ref, NULL);
-	axl_free (ref);
-	if (full_path == NULL) 
-		return;
+	/* remove previous sweeper */
+	if (event_id)
+		myqtt_thread_pool_remove_event (ctx, event_id);
 
-	/* open directory handle */
-	unlink (full_path);
-	axl_free (full_path);
+	/* check if we have to install the sweeper */
+	if (sweep_period <= 0 || (message_ttl == 0 && session_expiry == 0))
+		return axl_true;
 
-	return;
+	event_id = myqtt_thread_pool_new_event (ctx, (long) sweep_period * 1000000, __myqtt_storage_expire_event, NULL, NULL);
+	if (event_id == -1) {
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Unable to install storage sweeper event, myqtt_thread_pool_new_event () failed");
+		return axl_false;
+	} /* end if */
+
+	myqtt_mutex_lock (&ctx->ref_mutex);
+	ctx->storage_expiry_event_id = event_id;
+	myqtt_mutex_unlock (&ctx->ref_mutex);
 
+	return axl_true;
 }
 
 /** 
- * @brief Allows to release the provided id from the current session
- * associated to the provided connection.
- *
- * @param ctx The context where the operation takes place.
- *
- * @param conn The connection where the operation takes place, using its session.
- *
- * @param pkg_id The packet id to release. 
- *
- * @return axl_true if the pkgid was releaseed, otherwise axl_false is returned. 
+ * @internal Flags the session as being removed by the storage
+ * sweeper. Must be called with client_ids_m locked, after checking
+ * the client is not connected. Returns axl_false if it was already
+ * flagged.
  */
-void     myqtt_storage_release_pkgid (MyQttCtx * ctx, MyQttConn * conn, int pkg_id)
+axl_bool __myqtt_storage_expiring_claim (MyQttCtx * ctx, const char * client_identifier)
 {
-	/* avoid segfault when conn reference is NULL */
-	if (conn == NULL)
-		return;
-	return myqtt_storage_release_pkgid_offline (ctx, conn->client_identifier, pkg_id);
+	myqtt_mutex_lock (&ctx->storage_expiring_m);
+	if (ctx->storage_expiring == NULL)
+		ctx->storage_expiring = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+	if (ctx->storage_expiring == NULL || axl_hash_get (ctx->storage_expiring, (axlPointer) client_identifier)) {
+		myqtt_mutex_unlock (&ctx->storage_expiring_m);
+		return axl_false;
+	} /* end if */
+	axl_hash_insert_full (ctx->storage_expiring, axl_strdup (client_identifier), axl_free, INT_TO_PTR (1), NULL);
+	myqtt_mutex_unlock (&ctx->storage_expiring_m);
+
+	return axl_true;
 }
 
 /** 
- * @brief Allows to recover session stored by the server with current
- * storage for the provided connection.
- *
- * @param ctx The context where the operation will take place.
- *
- * @param conn The connection that is requested to recover session. 
- *
- * @return axl_true if session was recovered, otherwise axl_false is
- * returned.
+ * @internal Removes the flag set by __myqtt_storage_expiring_claim,
+ * waking up connections waiting for the session.
  */
-axl_bool myqtt_storage_session_recover (MyQttCtx * ctx, MyQttConn * conn)
+void     __myqtt_storage_expiring_release (MyQttCtx * ctx, const char * client_identifier)
 {
-	/* call to iterate and count */
-	return __myqtt_storage_iteration (ctx, conn->client_identifier, conn, /* register */ axl_true, /* offline */ axl_false);
+	myqtt_mutex_lock (&ctx->storage_expiring_m);
+	axl_hash_remove (ctx->storage_expiring, (axlPointer) client_identifier);
+	myqtt_cond_broadcast (&ctx->storage_expiring_c);
+	myqtt_mutex_unlock (&ctx->storage_expiring_m);
+
+	return;
 }
 
 /** 
- * @internal Function that allows to recover client identifiers and
- * subscriptions from local storage. This function is only useful for
- * server side and it is not meant to be used directly by API
- * consumers.
+ * @internal Waits until the sweeper finishes removing the session
+ * (if it is doing it), so a client connecting gets a clean one.
+ */
+void     __myqtt_storage_expiring_wait (MyQttCtx * ctx, const char * client_identifier)
+{
+	myqtt_mutex_lock (&ctx->storage_expiring_m);
+	while (ctx->storage_expiring && axl_hash_get (ctx->storage_expiring, (axlPointer) client_identifier))
+		myqtt_cond_timedwait (&ctx->storage_expiring_c, &ctx->storage_expiring_m, 10000);
+	myqtt_mutex_unlock (&ctx->storage_expiring_m);
+
+	return;
+}
+
+/** 
+ * @brief Runs the storage sweeper once, removing expired queued
+ * messages and sessions according to \ref myqtt_storage_set_expiry
+ * configuration. Sessions of connected clients are skipped and
+ * clients connecting while their session is removed wait until it
+ * is done.
  *
- * @return Return the number of subscription that were loaded.
+ * @param ctx The context where the operation takes place.
+ *
+ * @return Number of queued messages removed or -1 if it fails.
  */
-int     myqtt_storage_load             (MyQttCtx      * ctx)
+int      myqtt_storage_expire (MyQttCtx * ctx)
 {
-	DIR           * sub_dir;
-	struct dirent * entry;
-	int             entries = 0;
+	MyQttStorageBackend * backend;
+	axlList             * sessions;
+	const char          * client_identifier;
+	long                  now;
+	long                  stamp;
+	axl_bool              expired;
+	int                   iterator;
+	int                   count   = 0;
+	int                   removed = 0;
+
+	if (ctx == NULL)
+		return -1;
 
-	if (ctx == NULL || ! ctx->storage_path) {
-		myqtt_log (MYQTT_LEVEL_CRITICAL, "Unable to load local storage because context (%p) is not defined or storage path is empty: %s",
-			   ctx, ctx->storage_path ? ctx->storage_path : "<not defined>");
+	/* nothing to expire or no storage configured */
+	if (ctx->storage_msg_ttl <= 0 && ctx->storage_session_expiry <= 0)
 		return 0;
-	} /* end if */
-
-	/* skip local storage loading if already done previously */
-	if (ctx->local_storage)
+	if (ctx->storage_backend == NULL && ctx->storage_path == NULL)
 		return 0;
 
-	myqtt_mutex_lock (&ctx->ref_mutex);
-	if (ctx->local_storage) {
-		myqtt_mutex_unlock (&ctx->ref_mutex);
+	backend  = __myqtt_storage_get (ctx);
+	sessions = backend->sessions (ctx);
+	if (sessions == NULL)
 		return 0;
-	} /* end if */
-
-	/* init server side hashs to handle subscriptions */
-	/*** on-line subscriptions ***/
-	ctx->subs              = axl_hash_new (axl_hash_string, axl_hash_equal_string);
-	ctx->wild_subs         = axl_hash_new (axl_hash_string, axl_hash_equal_string);
-
-	/*** off-line subscriptiosn ***/
-	ctx->offline_subs      = axl_hash_new (axl_hash_string, axl_hash_equal_string);
-	ctx->offline_wild_subs = axl_hash_new (axl_hash_string, axl_hash_equal_string);
-
-	/* now find all local identifiers that have at least one
-	 * subscription */
-	myqtt_log (MYQTT_LEVEL_DEBUG, "Loading storage from: %s", ctx->storage_path ? ctx->storage_path : "<null>");
-	sub_dir = opendir (ctx->storage_path);
-	if (sub_dir == NULL)
-		goto finish;
-
-	/* get next entry */
-	entry = readdir (sub_dir);
-	while (entry) {
-		/* skip default directories */
-		if (axl_cmp (entry->d_name, ".") || axl_cmp (entry->d_name, ".."))
-			goto next_entry;
 
-#if defined(_DIRENT_HAVE_D_TYPE)
-		if ((entry->d_type & DT_DIR) != DT_DIR) 
-			goto next_entry;
-#else
-		aux_path = myqtt_support_build_filename (full_path, entry->d_name, NULL);
-		if (myqtt_support_file_test (aux_path, FILE_EXISTS | FILE_IS_DIR)) {
-			axl_free (aux_path);
-			goto next_entry;
+	now      = (long) time (NULL);
+	iterator = 0;
+	while (iterator < axl_list_length (sessions)) {
+		client_identifier = axl_list_get_nth (sessions, iterator);
+		iterator++;
+
+		/* check session expiration */
+		expired = axl_false;
+		if (ctx->storage_session_expiry > 0 && backend->session_stamp) {
+			stamp   = backend->session_stamp (ctx, client_identifier);
+			expired = (stamp >= 0 && (stamp + ctx->storage_session_expiry) <= now);
 		} /* end if */
-		axl_free (aux_path);
-#endif
 
-		/* found directory (a session identifier) */
-		if (myqtt_storage_sub_count_offline (ctx, entry->d_name) > 0)  {
-			/* found entry with subscriptions */
-			myqtt_log (MYQTT_LEVEL_DEBUG, "Checking subscriptions for %s (%d)", entry->d_name, myqtt_storage_sub_count_offline (ctx, entry->d_name)); 
-			entries += __myqtt_storage_iteration (ctx, entry->d_name, NULL, /* register */ axl_true, /* offline */ axl_true);
+		/* skip connected clients and flag expired sessions so
+		 * they can't be taken while they are removed (see
+		 * myqtt_storage_init). Nothing else is done with
+		 * client ids locked */
+		myqtt_mutex_lock (&ctx->client_ids_m);
+		if (ctx->client_ids && axl_hash_get (ctx->client_ids, (axlPointer) client_identifier)) {
+			/* connected, skip it */
+			myqtt_mutex_unlock (&ctx->client_ids_m);
+			continue;
+		} /* end if */
+		if (expired)
+			expired = __myqtt_storage_expiring_claim (ctx, client_identifier);
+		myqtt_mutex_unlock (&ctx->client_ids_m);
+
+		if (expired) {
+			/* check again: the session may have been used
+			 * before it was flagged */
+			stamp = backend->session_stamp (ctx, client_identifier);
+			if (stamp >= 0 && (stamp + ctx->storage_session_expiry) <= now) {
+				/* release messages still queued to keep
+				 * quota accounting */
+				if (backend->msg_expire)
+					count += backend->msg_expire (ctx, client_identifier, LONG_MAX, __myqtt_storage_expired_msg, NULL);
+
+				/* remove session */
+				if (backend->session_remove)
+					backend->session_remove (ctx, client_identifier);
+				else
+					backend->clear (ctx, client_identifier, MYQTT_STORAGE_ALL);
+				__myqtt_storage_usage_remove (ctx, client_identifier);
+
+				/* remove offline subscriptions loaded */
+				__myqtt_reader_remove_offline_subs (ctx, client_identifier);
+				__myqtt_storage_expiring_release (ctx, client_identifier);
+				removed++;
+				continue;
+			} /* end if */
+			__myqtt_storage_expiring_release (ctx, client_identifier);
 		} /* end if */
 
-	next_entry:
-		/* next entry */
-		entry = readdir (sub_dir);
+		/* check messages expiration (each message is removed
+		 * once, even if the client connects meanwhile) */
+		if (ctx->storage_msg_ttl > 0 && backend->msg_expire)
+			count += backend->msg_expire (ctx, client_identifier, now - ctx->storage_msg_ttl, __myqtt_storage_expired_msg, NULL);
 	} /* end while */
+	axl_list_free (sessions);
 
-finish:
-	/* notify it is already loaded */
-	ctx->local_storage = axl_true;
-	myqtt_mutex_unlock (&ctx->ref_mutex);
-	closedir (sub_dir);
+	if (count > 0 || removed > 0)
+		myqtt_log (MYQTT_LEVEL_DEBUG, "Storage sweeper removed %d expired messages and %d expired sessions", count, removed);
 
-	return entries;
+	return count;
 }
 
-
 /** 
- * @brief Allows to configure the storage location for the provided
- * MyQtt context.
+ * @brief Allows to configure compression for payloads stored
+ * (messages queued and retained messages).
  *
- * @param ctx The context where the operation takes place. It cannot be NULL.
+ * Compression is applied inside the storage layer, before handing the
+ * payload to the storage driver, and reverted transparently when
+ * messages are recovered. Quota reported (\ref
+ * myqtt_storage_queued_messages_quota_offline) accounts compressed
+ * bytes. Payloads that do not shrink are stored as received.
  *
- * @param storage_path The storage dir to configure. It cannot be NULL
- * or empty.
+ * Payloads already stored can always be recovered, even after
+ * disabling compression.
  *
- * @param hash_size Hashing size for the storage path used. This value
- * will be used to split internal storage in the given values.
- * Recomended value is 4096.
+ * @param ctx The context where the operation takes place.
  *
+ * @param compression The compression method to use (\ref MYQTT_STORAGE_COMPRESSION_NONE to disable).
  *
- * @return axl_true if the path was correctly set, otherwise axl_false is returned.
+ * @param threshold Minimum payload size (bytes) to apply compression.
+ *
+ * @return axl_true if the configuration was applied, otherwise
+ * axl_false is returned (wrong parameters or method not supported by
+ * this build).
  */
-axl_bool     myqtt_storage_set_path (MyQttCtx * ctx, const char * storage_path, int hash_size)
+axl_bool myqtt_storage_set_compression (MyQttCtx * ctx, MyQttStorageCompression compression, int threshold)
 {
-	if (ctx == NULL || storage_path == NULL || strlen (storage_path) == 0) {
-		myqtt_log (MYQTT_LEVEL_CRITICAL, "Unable to configure storage path, context is NULL(%d), or storage path is not defined (%s)",
-			   ctx, (ctx && ctx->storage_path) ? ctx->storage_path : "<undefined>");
+	if (ctx == NULL || threshold < 0)
 		return axl_false;
-	}
-
-	/* lock during operation */
-	myqtt_mutex_lock (&ctx->ref_mutex);
 
-	/* update storage path */
-	if (ctx->storage_path)
-		axl_free (ctx->storage_path);
-	ctx->storage_path = axl_strdup (storage_path);
-
-	/* update hash size */
-	ctx->storage_path_hash_size = hash_size;
+	switch (compression) {
+	case MYQTT_STORAGE_COMPRESSION_NONE:
+		break;
+	case MYQTT_STORAGE_COMPRESSION_LZ4:
+#if defined(MYQTT_HAVE_LZ4)
+		break;
+#else
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Unable to enable LZ4 storage compression, library was built without lz4 support");
+		return axl_false;
+#endif
+	default:
+		return axl_false;
+	} /* end switch */
 
-	/* now unlock */
-	myqtt_mutex_unlock (&ctx->ref_mutex);
+	ctx->storage_compression           = compression;
+	ctx->storage_compression_threshold = threshold;
 
 	return axl_true;
 }
 
-void __myqtt_storage_get_retained_topics_dir (MyQttCtx * ctx, const char * topic_filter, const char * full_path, axlList * list)
+/** 
+ * @internal Retained value taken from the write-behind cache to be
+ * written by myqtt_storage_retain_flush.
+ */
+typedef struct _MyQttStorageRetainedFlush {
+	char            * topic_name;
+	MyQttQos          qos;
+	unsigned char   * app_msg;
+	int               app_msg_size;
+	axl_bool          released;
+	int               version;
+} MyQttStorageRetainedFlush;
+
+void __myqtt_storage_retained_flush_free (MyQttStorageRetainedFlush * flush)
 {
-	unsigned char * topic_name = NULL;
-	int             ref_size   = 0;
-	DIR           * sub_dir;
-	struct dirent * entry;
-	char          * aux_path;
-	axl_bool        added_to_the_list;
+	axl_free (flush->topic_name);
+	axl_free (flush->app_msg);
+	axl_free (flush);
+	return;
+}
 
-	/* try to open path */
-	sub_dir = opendir (full_path);
-	if (sub_dir == NULL) {
-		__myqtt_storage_error_report (ctx, "Unable to open %s", full_path);
-		return;
+axl_bool __myqtt_storage_retain_flush_collect (axlPointer key, axlPointer data, axlPointer user_data)
+{
+	MyQttStorageRetained      * retained = data;
+	MyQttStorageRetainedFlush * flush;
+
+	if (! retained->dirty)
+		return axl_false; /* keep iterating */
+
+	flush = axl_new (MyQttStorageRetainedFlush, 1);
+	if (flush == NULL)
+		return axl_false;
+	flush->topic_name   = axl_strdup (key);
+	flush->qos          = retained->qos;
+	flush->released     = retained->released;
+	flush->version      = retained->version;
+	if (retained->app_msg) {
+		flush->app_msg      = axl_new (unsigned char, retained->app_msg_size + 1);
+		memcpy (flush->app_msg, retained->app_msg, retained->app_msg_size);
+		flush->app_msg_size = retained->app_msg_size;
 	} /* end if */
+	axl_list_append (user_data, flush);
 
-	entry   = readdir (sub_dir);
-	while (sub_dir && entry) {
+	/* value is now being written */
+	retained->dirty = axl_false;
 
-		/* get next entry and skip those we are not interested in */
-		if (axl_cmp (".", entry->d_name) || axl_cmp ("..", entry->d_name)) {
-			entry = readdir (sub_dir);
-			continue;
-		} /* end if */
+	return axl_false; /* keep iterating */
+}
 
-		/* create full path and do some checks */
-		aux_path = myqtt_support_build_filename (full_path, entry->d_name, NULL);
-		if (! myqtt_support_file_test (aux_path, FILE_EXISTS | FILE_IS_REGULAR)) {
-			entry = readdir (sub_dir);
-			axl_free (aux_path);
-			continue;
-		} /* end if */
+axl_bool __myqtt_storage_retain_flush_event (MyQttCtx * ctx, axlPointer user_data, axlPointer user_data2)
+{
+	/* flush changed topics */
+	myqtt_storage_retain_flush (ctx);
 
-		/* skip those files that includes .msg (which is the content of the message retained) */
-		if (strstr (aux_path, ".msg")) {
-			entry = readdir (sub_dir);
-			axl_free (aux_path);
-			continue;
-		}
-		
-		/* skip known extensions that aren't valid */
-		if (strstr (aux_path, "~")) {
-			entry = readdir (sub_dir);
-			axl_free (aux_path);
-			continue;
-		}
+	return axl_false; /* keep the event */
+}
 
-		/* call to load the content from the file */
-		topic_name = NULL;
-		__myqtt_storage_read_content_into_reference (ctx, aux_path, &topic_name, &ref_size);
-		axl_free (aux_path);
-		added_to_the_list = axl_false;
-		
-		/* save into the list the topic name recovered */
-		if (topic_name && strlen ((const char *) topic_name) > 0) {
-			/* check if the topic matches with the filter */
-			if (myqtt_reader_topic_filter_match ((const char *) topic_name, topic_filter)) {
-				axl_list_append (list, topic_name);
-				/* notify added to the list */
-				added_to_the_list = axl_true;
-			}
-		} /* end if */
+/** 
+ * @brief Writes to the storage driver all retained messages changed
+ * since last flush (see \ref myqtt_storage_set_retain_write_behind).
+ *
+ * Only the last value set for each topic is written. Values not
+ * changed while they were written are removed from memory.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @return Number of topics written (or removed) or -1 if it fails.
+ */
+int      myqtt_storage_retain_flush (MyQttCtx * ctx)
+{
+	axlList                   * pending;
+	MyQttStorageRetainedFlush * flush;
+	MyQttStorageRetained      * retained;
+	int                         iterator;
+	int                         count;
 
-		if (! added_to_the_list) {
-			/* release if it wasn't added to the list */
-			axl_free (topic_name);
-		} /* end if */
+	if (ctx == NULL)
+		return -1;
 
-		/* get next entry */
-		entry   = readdir (sub_dir);
+	/* one flush at a time so values are written in order */
+	myqtt_mutex_lock (&ctx->storage_retain_flush_m);
+
+	/* take values changed */
+	pending = axl_list_new (axl_list_always_return_1, (axlDestroyFunc) __myqtt_storage_retained_flush_free);
+	if (pending == NULL) {
+		myqtt_mutex_unlock (&ctx->storage_retain_flush_m);
+		return -1;
 	} /* end if */
+	myqtt_mutex_lock (&ctx->storage_retain_m);
+	if (ctx->storage_retain_cache)
+		axl_hash_foreach (ctx->storage_retain_cache, __myqtt_storage_retain_flush_collect, pending);
+	myqtt_mutex_unlock (&ctx->storage_retain_m);
+
+	/* write them */
+	count    = axl_list_length (pending);
+	iterator = 0;
+	while (iterator < count) {
+		flush = axl_list_get_nth (pending, iterator);
+		if (flush->released)
+			__myqtt_storage_get (ctx)->retain_release (ctx, flush->topic_name, strlen (flush->topic_name));
+		else if (! __myqtt_storage_retain_write (ctx, flush->topic_name, strlen (flush->topic_name), flush->qos, flush->app_msg, flush->app_msg_size))
+			myqtt_log (MYQTT_LEVEL_CRITICAL, "Failed to write retained message for topic %s", flush->topic_name);
+		iterator++;
+	} /* end while */
 
-	closedir (sub_dir);
+	/* drop values from memory that didn't change meanwhile */
+	myqtt_mutex_lock (&ctx->storage_retain_m);
+	iterator = 0;
+	while (iterator < count) {
+		flush    = axl_list_get_nth (pending, iterator);
+		retained = axl_hash_get (ctx->storage_retain_cache, flush->topic_name);
+		if (retained && ! retained->dirty && retained->version == flush->version)
+			axl_hash_remove (ctx->storage_retain_cache, flush->topic_name);
+		iterator++;
+	} /* end while */
+	myqtt_mutex_unlock (&ctx->storage_retain_m);
+	axl_list_free (pending);
 
-	return;
+	myqtt_mutex_unlock (&ctx->storage_retain_flush_m);
+
+	if (count > 0)
+		myqtt_log (MYQTT_LEVEL_DEBUG, "Flushed %d retained topics", count);
+
+	return count;
 }
 
 /** 
- * @brief Allows to get the list of topics with message retention
- * stored, filtered by the provided topic_filter
+ * @brief Enables write-behind for retained messages: the latest
+ * retained value of each topic is kept in memory and only written to
+ * the storage every flush_period seconds, at shutdown (\ref
+ * myqtt_exit_ctx) or when \ref myqtt_storage_retain_flush is called.
  *
- * @param ctx The context where the operation takes place
+ * This avoids writing to disk retained values that are going to be
+ * replaced right away (devices publishing retained state often to
+ * the same topic). Retained messages are recovered and listed from
+ * memory first, so behaviour is the same. Values not flushed are
+ * lost if the process is killed.
  *
- * @param topic_filter The filter to allow selecting those topics that
- * matches and have a message pending due to retain flag configured in
- * the last publish
+ * @param ctx The context where the operation takes place.
  *
- * @return A list of retained topics or NULL if it fails. The list
- * returned may be empty. Use axl_list_free (to release result
- * reported).
+ * @param flush_period Seconds between flushes. Use 0 to only flush
+ * at shutdown (or by calling \ref myqtt_storage_retain_flush) and -1
+ * to disable write-behind (pending values are flushed).
+ *
+ * @return axl_true if the configuration was applied, otherwise
+ * axl_false is returned.
  */
-axlList * myqtt_storage_get_retained_topics (MyQttCtx * ctx, const char * topic_filter)
+axl_bool myqtt_storage_set_retain_write_behind (MyQttCtx * ctx, int flush_period)
 {
+	int event_id;
 
-	char          * full_path;
-	char          * aux_path;
-	DIR           * sub_dir;
-	struct dirent * entry;
-	axlList       * list;
+	if (ctx == NULL)
+		return axl_false;
 
-	/* get full path to subscriptions */
-	full_path = myqtt_support_build_filename (ctx->storage_path, "retained", NULL);
-	if (full_path == NULL) 
-		return NULL; /* allocation failure */
+	myqtt_mutex_lock (&ctx->storage_retain_m);
+	ctx->storage_retain_write_behind = (flush_period >= 0);
+	event_id                         = ctx->storage_retain_event_id;
+	ctx->storage_retain_event_id     = 0;
+	myqtt_mutex_unlock (&ctx->storage_retain_m);
 
-	if (! myqtt_support_file_test (full_path, FILE_EXISTS | FILE_IS_DIR)) {
-		axl_free (full_path);
-		return NULL; /* directory do not exists */
+	/* remove previous flush event */
+	if (event_id)
+		myqtt_thread_pool_remove_event (ctx, event_id);
+
+	/* disabled: write pending values */
+	if (flush_period < 0) {
+		myqtt_storage_retain_flush (ctx);
+		return axl_true;
 	} /* end if */
 
-	/* try to open path */
-	sub_dir = opendir (full_path);
-	if (sub_dir == NULL) {
-		__myqtt_storage_error_report (ctx, "Unable to open %s", full_path);
-		axl_free (full_path);
-		return NULL;
+	if (flush_period == 0)
+		return axl_true;
+
+	event_id = myqtt_thread_pool_new_event (ctx, (long) flush_period * 1000000, __myqtt_storage_retain_flush_event, NULL, NULL);
+	if (event_id == -1) {
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "Unable to install retained flush event, myqtt_thread_pool_new_event () failed");
+		return axl_false;
 	} /* end if */
 
-	/* create list */
-	list = axl_list_new (axl_list_always_return_1, axl_free);
+	myqtt_mutex_lock (&ctx->storage_retain_m);
+	ctx->storage_retain_event_id = event_id;
+	myqtt_mutex_unlock (&ctx->storage_retain_m);
 
-	entry   = readdir (sub_dir);
-	while (sub_dir && entry) {
+	return axl_true;
+}
 
-		/* get next entry and skip those we are not interested in */
-		if (axl_cmp (".", entry->d_name) || axl_cmp ("..", entry->d_name)) {
-			entry = readdir (sub_dir);
-			continue;
-		} /* end if */
+/** 
+ * @internal Disables retained write-behind flushing pending values
+ * (called from myqtt_exit_ctx).
+ */
+void __myqtt_storage_retain_stop (MyQttCtx * ctx)
+{
+	if (ctx == NULL || (! ctx->storage_retain_write_behind && ctx->storage_retain_cache == NULL))
+		return;
 
-		/* check if it is a directory */
-#if defined(_DIRENT_HAVE_D_TYPE)
-		if ((entry->d_type & DT_DIR) == DT_DIR) {
-			/* count subscriptions */
-			aux_path  = myqtt_support_build_filename (full_path, entry->d_name, NULL);
-			__myqtt_storage_get_retained_topics_dir (ctx, topic_filter, aux_path, list);
-			axl_free (aux_path);
-		}
-#else 
-		aux_path = myqtt_support_build_filename (full_path, entry->d_name, NULL);
-		if (myqtt_support_file_test (aux_path, FILE_EXISTS | FILE_IS_DIR)) {
-			/* load into list topic filters found */
-			__myqtt_storage_get_retained_topics_dir (ctx, topic_filter, aux_path, list);
-		}
-		axl_free (aux_path);
-#endif
+	myqtt_storage_set_retain_write_behind (ctx, -1);
+	return;
+}
 
-		/* get next entry */
-		entry   = readdir (sub_dir);
-	}
+/** 
+ * @brief Allows to get storage usage for the whole context: number of
+ * messages queued and bytes used by them (for all client
+ * identifiers).
+ *
+ * Values are maintained in memory as messages are stored and
+ * released so calling this function does not access the
+ * storage. Client identifiers are accounted since storage was loaded
+ * or since they were first used. With file storage, counters are
+ * persisted when the context is finished and read back by \ref
+ * myqtt_storage_load (sessions are only walked when they are not
+ * found, for example, after a crash).
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @param messages Optional reference where to report the number of messages queued.
+ *
+ * @param bytes Optional reference where to report the bytes used by queued messages.
+ */
+void     myqtt_storage_usage (MyQttCtx * ctx, int * messages, long * bytes)
+{
+	if (messages)
+		(* messages) = 0;
+	if (bytes)
+		(* bytes) = 0;
+	if (ctx == NULL)
+		return;
 
-	closedir (sub_dir);
-	axl_free (full_path);
+	myqtt_mutex_lock (&ctx->storage_usage_m);
+	if (messages)
+		(* messages) = ctx->storage_usage_messages;
+	if (bytes)
+		(* bytes)    = ctx->storage_usage_bytes;
+	myqtt_mutex_unlock (&ctx->storage_usage_m);
 
-	return list;
+	return;
+}
+
+/** 
+ * @internal Records the session associated to the client identifier
+ * was used now (only when session expiration is enabled).
+ */
+void __myqtt_storage_session_touch (MyQttCtx * ctx, const char * client_identifier)
+{
+	MyQttStorageBackend * backend;
+
+	if (ctx == NULL || client_identifier == NULL || ctx->storage_session_expiry <= 0)
+		return;
+	if (ctx->storage_backend == NULL && ctx->storage_path == NULL)
+		return;
+
+	backend = __myqtt_storage_get (ctx);
+	if (backend->session_touch)
+		backend->session_touch (ctx, client_identifier);
+	return;
+}
+
+/** 
+ * @internal Stops storage driver configured on the provided context
+ * (called from myqtt_ctx_free).
+ */
+void __myqtt_storage_cleanup (MyQttCtx * ctx)
+{
+	if (ctx == NULL)
+		return;
+
+	/* close subscription index */
+	__myqtt_storage_index_close (ctx);
+
+	/* persist usage counters */
+	__myqtt_storage_usage_save (ctx);
+
+	if (ctx->storage_backend == NULL)
+		return;
+
+	/* stop driver */
+	if (ctx->storage_backend->stop)
+		ctx->storage_backend->stop (ctx);
+	ctx->storage_backend = NULL;
+
+	return;
 }
        
 /** 
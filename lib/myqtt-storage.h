@@ -41,6 +41,200 @@
 
 #include <myqtt.h>
 
+/** 
+ * @brief Storage driver definition. All persistence done by the
+ * storage module (\ref myqtt_storage) is delegated to the driver
+ * configured on the context (see \ref myqtt_storage_set_backend and
+ * \ref myqtt_storage_use).
+ *
+ * Public storage functions check their parameters and call
+ * MyQttCtx's on store/release handlers before reaching the driver,
+ * so drivers only have to implement the operation itself. All
+ * handlers are mandatory except start, stop, load and the expiry
+ * handlers (msg_expire, session_touch, session_stamp and
+ * session_remove) used by \ref myqtt_storage_expire.
+ */
+struct _MyQttStorageBackend {
+	/** 
+	 * @brief Label to identify the driver.
+	 */
+	const char * backend_type;
+
+	/** 
+	 * @brief Optional handler called when the driver is installed
+	 * on a context. Returning axl_false cancels installation.
+	 */
+	axl_bool   (* start)           (MyQttCtx * ctx);
+
+	/** 
+	 * @brief Optional handler called when the driver is removed
+	 * from a context or the context is released.
+	 */
+	void       (* stop)            (MyQttCtx * ctx);
+
+	/** 
+	 * @brief Prepares the storage parts (\ref MyQttStorage) for the
+	 * provided client identifier.
+	 */
+	axl_bool   (* init)            (MyQttCtx * ctx, const char * client_identifier, MyQttStorage storage);
+
+	/** 
+	 * @brief Removes the storage parts (\ref MyQttStorage) for the
+	 * provided client identifier.
+	 */
+	axl_bool   (* clear)           (MyQttCtx * ctx, const char * client_identifier, MyQttStorage storage);
+
+	/** 
+	 * @brief Records a subscription. Must report axl_true without
+	 * changes when the subscription is already stored.
+	 */
+	axl_bool   (* sub)             (MyQttCtx * ctx, const char * client_identifier, 
+					const char * topic_filter, int topic_filter_len, MyQttQos qos);
+
+	/** 
+	 * @brief Checks if a subscription is stored, optionally
+	 * removing it.
+	 */
+	axl_bool   (* sub_exists)      (MyQttCtx * ctx, const char * client_identifier, 
+					const char * topic_filter, int topic_filter_len, axl_bool remove_if_found);
+
+	/** 
+	 * @brief Iterates over all subscriptions stored for the
+	 * client identifier calling func (when defined) for each of
+	 * them. Returns the number of subscriptions found or -1 when
+	 * there is no subscription storage for that client.
+	 */
+	int        (* sub_iterate)     (MyQttCtx * ctx, const char * client_identifier, 
+					MyQttStorageSubFound func, axlPointer user_data, axlPointer user_data2);
+
+	/** 
+	 * @brief Stores a message returning a handle allocated with
+	 * axl_strdup/axl_new that identifies it (the caller releases
+	 * it with axl_free). The handle string must start with
+	 * "packet_id-app_msg_size-qos".
+	 */
+	axlPointer (* store_msg)       (MyQttCtx * ctx, const char * client_identifier, 
+					int packet_id, MyQttQos qos, unsigned char * app_msg, int app_msg_size);
+
+	/** 
+	 * @brief Removes the message pointed by the handle. It must
+	 * not release the handle.
+	 */
+	void       (* release_msg)     (MyQttCtx * ctx, const char * client_identifier, axlPointer handle);
+
+	/** 
+	 * @brief Reports the number of messages queued for the client
+	 * identifier. Only used to seed usage counters (once per
+	 * client identifier and at load).
+	 */
+	int        (* queued_messages) (MyQttCtx * ctx, const char * client_identifier);
+
+	/** 
+	 * @brief Reports the bytes used by messages queued for the
+	 * client identifier. Only used to seed usage counters.
+	 */
+	int        (* queued_quota)    (MyQttCtx * ctx, const char * client_identifier);
+
+	/** 
+	 * @brief Iterates over all queued messages for the client
+	 * identifier, transferring handle and content to func.
+	 */
+	int        (* msg_iterate)     (MyQttCtx * ctx, const char * client_identifier, 
+					MyQttStorageMsgFound func, axlPointer user_data);
+
+	/** 
+	 * @brief Locks the packet id or fails if it is already in use.
+	 */
+	axl_bool   (* lock_pkgid)      (MyQttCtx * ctx, const char * client_identifier, int pkg_id);
+
+	/** 
+	 * @brief Releases a packet id previously locked.
+	 */
+	void       (* release_pkgid)   (MyQttCtx * ctx, const char * client_identifier, int pkg_id);
+
+	/** 
+	 * @brief Stores (replacing) the retained message for the topic name.
+	 */
+	axl_bool   (* retain_set)      (MyQttCtx * ctx, const char * topic_name, int topic_name_len, 
+					MyQttQos qos, const unsigned char * app_msg, int app_msg_size);
+
+	/** 
+	 * @brief Recovers (and removes) the retained message for the
+	 * topic name. Content reported must be allocated with axl_new.
+	 */
+	axl_bool   (* retain_recover)  (MyQttCtx * ctx, const char * topic_name, int topic_name_len, 
+					MyQttQos * qos, unsigned char ** app_msg, int * app_msg_size);
+
+	/** 
+	 * @brief Removes the retained message for the topic name.
+	 */
+	void       (* retain_release)  (MyQttCtx * ctx, const char * topic_name, int topic_name_len);
+
+	/** 
+	 * @brief Reports the list of topic names with a retained
+	 * message matching the topic filter (list created with
+	 * axl_free as destroy function).
+	 */
+	axlList  * (* retained_topics) (MyQttCtx * ctx, const char * topic_filter);
+
+	/** 
+	 * @brief Reports the list of client identifiers with storage
+	 * (list created with axl_free as destroy function). Used by
+	 * \ref myqtt_storage_load.
+	 */
+	axlList  * (* sessions)        (MyQttCtx * ctx);
+
+	/** 
+	 * @brief Optional handler that reports, at once, all
+	 * subscriptions stored for all sessions (used by \ref
+	 * myqtt_storage_load instead of calling sessions and
+	 * sub_iterate for each session). Returns the number of
+	 * subscriptions reported or -1 to request the generic load.
+	 */
+	int        (* load)            (MyQttCtx * ctx, MyQttStorageSubFound func, axlPointer user_data, axlPointer user_data2);
+
+	/** 
+	 * @brief Optional handler that removes all queued messages
+	 * for the client identifier stored at or before stamp_limit
+	 * (seconds since epoch), notifying each one removed to func
+	 * (when defined) with app_msg set to NULL (handle ownership
+	 * is transferred). Returns the number of messages removed.
+	 */
+	int        (* msg_expire)      (MyQttCtx * ctx, const char * client_identifier, long stamp_limit,
+					MyQttStorageMsgFound func, axlPointer user_data);
+
+	/** 
+	 * @brief Optional handler that records the client identifier
+	 * session was used now (called when a persistent session
+	 * disconnects).
+	 */
+	void       (* session_touch)   (MyQttCtx * ctx, const char * client_identifier);
+
+	/** 
+	 * @brief Optional handler that reports when the client
+	 * identifier session was used for the last time (seconds
+	 * since epoch) or -1 if it is unknown.
+	 */
+	long       (* session_stamp)   (MyQttCtx * ctx, const char * client_identifier);
+
+	/** 
+	 * @brief Optional handler that removes the client identifier
+	 * session entirely (used on session expiration). When not
+	 * defined, clear is called with \ref MYQTT_STORAGE_ALL.
+	 */
+	void       (* session_remove)  (MyQttCtx * ctx, const char * client_identifier);
+};
+
+axl_bool myqtt_storage_use              (MyQttCtx          * ctx,
+					 MyQttStorageType    type);
+
+axl_bool myqtt_storage_set_backend      (MyQttCtx          * ctx,
+					 MyQttStorageBackend * backend);
+
+MyQttStorageBackend * myqtt_storage_get_backend (MyQttCtx  * ctx);
+
+MyQttStorageType myqtt_storage_get_type (MyQttCtx          * ctx);
+
 axl_bool myqtt_storage_init             (MyQttCtx      * ctx, 
 					 MyQttConn     * conn, 
 					 MyQttStorage    storage);
@@ -157,8 +351,46 @@ axl_bool myqtt_storage_set_path         (MyQttCtx      * ctx,
 					 const char    * storage_path, 
 					 int             hash_size);
 
+axl_bool myqtt_storage_add_path         (MyQttCtx      * ctx, 
+					 const char    * storage_path);
+
+int      myqtt_storage_shards           (MyQttCtx      * ctx);
+
 axlList  * myqtt_storage_get_retained_topics  (MyQttCtx * ctx, const char * topic_filter);
 
+axl_bool myqtt_storage_set_expiry       (MyQttCtx      * ctx,
+					 int             message_ttl,
+					 int             session_expiry,
+					 int             sweep_period);
+
+int      myqtt_storage_expire           (MyQttCtx      * ctx);
+
+void     myqtt_storage_usage            (MyQttCtx      * ctx,
+					 int           * messages,
+					 long          * bytes);
+
+axl_bool myqtt_storage_set_compression  (MyQttCtx                * ctx,
+					 MyQttStorageCompression   compression,
+					 int                       threshold);
+
+axl_bool myqtt_storage_set_retain_write_behind (MyQttCtx      * ctx,
+						int             flush_period);
+
+int      myqtt_storage_retain_flush     (MyQttCtx      * ctx);
+
+axl_bool myqtt_storage_writer_start     (MyQttCtx            * ctx,
+					 int                   queue_limit);
+
+axl_bool myqtt_storage_writer_queue     (MyQttCtx            * ctx,
+					 MyQttStorageJob       job,
+					 MyQttStorageJobDone   on_done,
+					 axlPointer            user_data,
+					 axlPointer            user_data2);
+
+void     myqtt_storage_writer_flush     (MyQttCtx            * ctx);
+
+int      myqtt_storage_writer_pending   (MyQttCtx            * ctx);
+
 /*** internal API: don't use it, it may change at any time ***/
 void     __myqtt_storage_get_values_from_file_name (MyQttCtx * ctx, const char * file_name, int * packet_id, int * size, int * qos);
 
@@ -166,4 +398,36 @@ int      __myqtt_storage_get_size_from_file_name (MyQttCtx * ctx, const char * f
 
 void     __myqtt_storage_error_report (MyQttCtx * ctx, const char * format, ...);
 
+MyQttStorageBackend * __myqtt_storage_backend_file   (void);
+
+MyQttStorageBackend * __myqtt_storage_backend_memory (void);
+
+MyQttStorageBackend * __myqtt_storage_get            (MyQttCtx * ctx);
+
+const char          * __myqtt_storage_root           (MyQttCtx * ctx, const char * key);
+
+void     __myqtt_storage_cleanup (MyQttCtx * ctx);
+
+void     __myqtt_storage_session_touch (MyQttCtx * ctx, const char * client_identifier);
+
+void     __myqtt_storage_usage_update (MyQttCtx * ctx, const char * client_identifier, int messages, int bytes);
+
+void     __myqtt_storage_usage_remove (MyQttCtx * ctx, const char * client_identifier);
+
+axl_bool __myqtt_storage_expiring_claim (MyQttCtx * ctx, const char * client_identifier);
+
+void     __myqtt_storage_expiring_release (MyQttCtx * ctx, const char * client_identifier);
+
+void     __myqtt_storage_expiring_wait (MyQttCtx * ctx, const char * client_identifier);
+
+axl_bool __myqtt_storage_payload_encode (MyQttCtx * ctx, const unsigned char * app_msg, int app_msg_size, unsigned char ** result, int * result_size);
+
+axl_bool __myqtt_storage_payload_decode (MyQttCtx * ctx, unsigned char ** app_msg, int * app_msg_size);
+
+void     __myqtt_storage_writer_wait (MyQttCtx * ctx, int * pending);
+
+void     __myqtt_storage_writer_stop (MyQttCtx * ctx);
+
+void     __myqtt_storage_retain_stop (MyQttCtx * ctx);
+
 #endif
@@ -42,6 +42,9 @@
 /* local include */
 #include <myqtt-ctx-private.h>
 
+/* offsetof */
+#include <stddef.h>
+
 #define LOG_DOMAIN "myqtt-support"
 
 
@@ -1228,4 +1231,129 @@ axl_bool myqtt_support_is_utf8                    (const char * utf8_string,
 
 }
 
+/** 
+ * @internal Interned string node: the string returned to the caller
+ * is value, so the node can be found again from it (see
+ * myqtt_support_intern_release).
+ */
+typedef struct _MyQttInternStr {
+	MyQttCtx   * ctx;
+	int          refs;
+	char         value[1];
+} MyQttInternStr;
+
+#define MYQTT_INTERN_NODE(str) ((MyQttInternStr *) (((char *) (str)) - offsetof (MyQttInternStr, value)))
+
+/** 
+ * @brief Returns a shared copy of the provided string, owned by the
+ * context intern table, acquiring a reference to it.
+ *
+ * Repeated strings (topic filters, client identifiers) are stored
+ * once no matter how many tables hold them. The value returned must
+ * not be modified and must be released with \ref
+ * myqtt_support_intern_release, which also works as an
+ * axlDestroyFunc, so interned strings can be used as hash keys:
+ *
+ * \code
+ * axl_hash_insert_full (hash, myqtt_support_intern (ctx, topic), myqtt_support_intern_release, data, NULL);
+ * \endcode
+ *
+ * Passing an interned string just acquires a new reference to it.
+ *
+ * @param ctx The context where the string is interned.
+ *
+ * @param value The string to intern.
+ *
+ * @return A reference to the interned string or NULL if it fails.
+ */
+char   * myqtt_support_intern                     (MyQttCtx   * ctx,
+						    const char * value)
+{
+	MyQttInternStr * node;
+	int              length;
+
+	if (ctx == NULL || value == NULL)
+		return NULL;
+
+	myqtt_mutex_lock (&ctx->intern_m);
+	if (ctx->intern == NULL)
+		ctx->intern = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+
+	/* already interned */
+	node = axl_hash_get (ctx->intern, (axlPointer) value);
+	if (node) {
+		node->refs++;
+		myqtt_mutex_unlock (&ctx->intern_m);
+		return node->value;
+	} /* end if */
+
+	/* create node (value is placed at the end) */
+	length = strlen (value);
+	node   = (MyQttInternStr *) axl_new (char, sizeof (MyQttInternStr) + length);
+	if (node == NULL) {
+		myqtt_mutex_unlock (&ctx->intern_m);
+		return NULL;
+	} /* end if */
+	node->ctx  = ctx;
+	node->refs = 1;
+	memcpy (node->value, value, length + 1);
+
+	/* node is released by the hash */
+	axl_hash_insert_full (ctx->intern, node->value, NULL, node, axl_free);
+	myqtt_mutex_unlock (&ctx->intern_m);
+
+	return node->value;
+}
+
+/** 
+ * @brief Releases a reference acquired by \ref myqtt_support_intern,
+ * removing the string from the intern table when no reference is
+ * left.
+ *
+ * @param value The interned string to release.
+ */
+void     myqtt_support_intern_release             (axlPointer   value)
+{
+	MyQttInternStr * node;
+	MyQttCtx       * ctx;
+
+	if (value == NULL)
+		return;
+
+	node = MYQTT_INTERN_NODE (value);
+	ctx  = node->ctx;
+
+	myqtt_mutex_lock (&ctx->intern_m);
+	node->refs--;
+	if (node->refs == 0) {
+		/* this releases the node */
+		axl_hash_remove (ctx->intern, node->value);
+	} /* end if */
+	myqtt_mutex_unlock (&ctx->intern_m);
+
+	return;
+}
+
+/** 
+ * @brief Allows to get the number of different strings currently
+ * interned on the provided context.
+ *
+ * @param ctx The context to check.
+ *
+ * @return Number of interned strings or -1 if it fails.
+ */
+int      myqtt_support_intern_count               (MyQttCtx   * ctx)
+{
+	int count;
+
+	if (ctx == NULL)
+		return -1;
+
+	myqtt_mutex_lock (&ctx->intern_m);
+	count = ctx->intern ? axl_hash_items (ctx->intern) : 0;
+	myqtt_mutex_unlock (&ctx->intern_m);
+
+	return count;
+}
+
 /* @} */
@@ -133,6 +133,13 @@ int      myqtt_support_pipe                       (MyQttCtx * ctx, int descf[2])
 axl_bool myqtt_support_is_utf8                    (const char * utf8_string, 
 						   int utf8_len);
 
+char   * myqtt_support_intern                     (MyQttCtx   * ctx,
+						    const char * value);
+
+void     myqtt_support_intern_release             (axlPointer   value);
+
+int      myqtt_support_intern_count               (MyQttCtx   * ctx);
+
 #define copy_if_not_null(arg) (arg != NULL) ? axl_strdup (arg) : NULL;
 
 /* @} */
@@ -44,6 +44,49 @@
 
 #define LOG_DOMAIN "myqtt-thread-pool"
 
+/* max number of worker slots handled by the work-stealing mode */
+#define MYQTT_THREAD_POOL_MAX_WORKERS 256
+
+/* myqtt thread pool struct used by myqtt library to notify to tasks
+ * to be performed to myqtt thread pool */
+typedef struct _MyQttThreadPoolTask {
+	MyQttThreadFunc    func;
+	axlPointer         data;
+	axlDestroyFunc     destroy_data;
+
+	/* next task (used by the work-stealing injection queue) */
+	struct _MyQttThreadPoolTask * next;
+
+	/* when it was queued (queue wait stats) */
+	struct timeval     queued;
+} MyQttThreadPoolTask;
+
+/* per thread deque used by the work-stealing mode: the owner pops
+ * from the head (keeping submission order for its own tasks) while
+ * other workers steal from the tail */
+typedef struct _MyQttThreadPoolWorker {
+	MyQttThreadPool       * pool;
+	MyQttMutex              mutex;
+	MyQttCond               cond;
+	MyQttThreadPoolTask  ** ring;
+	int                     size;
+	int                     head;
+	int                     count;
+
+	/* worker state: sleeping (waiting on cond), stopped (removed
+	 * from the pool) and exited (slot can be reused) */
+	axl_bool                sleeping;
+	axl_bool                stopped;
+	int                     exited;
+
+	/* busy time (microseconds, only updated by the worker thread)
+	 * and the values seen by the last
+	 * myqtt_thread_pool_busy_stats call */
+	long long               busy;
+	long long               busy_last;
+	struct timeval          last;
+} MyQttThreadPoolWorker;
+
 struct _MyQttThreadPool {
 	/* new tasks to be procesed */
 	MyQttAsyncQueue * queue;
@@ -54,9 +97,10 @@ struct _MyQttThreadPool {
 	axlList          * stopped;
 	MyQttMutex        stopped_mutex;
 
-	/* list of events */
-	axlList          * events;
-	axlListCursor    * events_cursor;
+	/* events (min-heap ordered by next_step) */
+	struct _MyQttThreadPoolEvent ** events;
+	int                events_num;
+	int                events_size;
 	axl_bool           processing_events;
 
 	/* context */
@@ -74,16 +118,39 @@ struct _MyQttThreadPool {
 	axl_bool           preemtive;
 	struct timeval     last;
 
+	/* work-stealing mode (see myqtt_thread_pool_set_work_stealing) */
+	axl_bool                 work_stealing;
+	MyQttThreadPoolWorker  * workers[MYQTT_THREAD_POOL_MAX_WORKERS];
+	int                      workers_num;
+	int                      steal_seed;
+
+	/* injection queue for tasks submitted from outside the pool
+	 * while no worker is idle */
+	MyQttMutex               inject_mutex;
+	MyQttThreadPoolTask    * inject_first;
+	MyQttThreadPoolTask    * inject_last;
+
+	/* references held by the owner context and by every
+	 * dispatcher thread running (see __myqtt_thread_pool_unref) */
+	int                      refs;
+
+	/* counters updated with myqtt_atomic_* */
+	int                      idle;
+	int                      pending;
+	int                      remove_requests;
+	int                      collect_requests;
+
+	/* stats (updated with myqtt_atomic_*64, never reset): queue
+	 * wait and run time histograms and automatic resize
+	 * decisions */
+	long long                queue_wait[MYQTT_THREAD_POOL_HISTOGRAM_BUCKETS];
+	long long                run_time[MYQTT_THREAD_POOL_HISTOGRAM_BUCKETS];
+	long long                resize_checks;
+	long long                resize_added;
+	long long                resize_removed;
+	long long                resize_limit_reached;
 };
 
-/* myqtt thread pool struct used by myqtt library to notify to tasks
- * to be performed to myqtt thread pool */
-typedef struct _MyQttThreadPoolTask {
-	MyQttThreadFunc    func;
-	axlPointer         data;
-	axlDestroyFunc     destroy_data;
-} MyQttThreadPoolTask;
-
 /* struct used to represent async events */
 typedef struct _MyQttThreadPoolEvent {
 	MyQttThreadAsyncEvent   func;
@@ -92,14 +159,30 @@ typedef struct _MyQttThreadPoolEvent {
 	long                     delay;
 	struct timeval           next_step;
 	int                      ref_count;
+
+	/* position inside the heap (-1 when removed) */
+	int                      index;
 } MyQttThreadPoolEvent;
 
 typedef struct _MyQttThreadPoolStarter {
-	MyQttThreadPool * pool;
-	MyQttThread     * thread;
-	MyQttAsyncQueue * queue;
+	MyQttThreadPool       * pool;
+	MyQttThread           * thread;
+	MyQttAsyncQueue       * queue;
+	MyQttThreadPoolWorker * worker;
 } MyQttThreadPoolStarter;
 
+/* worker running on the current thread (if any) so tasks queued from
+ * inside a task go to the local deque */
+#if defined(_MSC_VER)
+# define MYQTT_THREAD_POOL_TLS __declspec(thread)
+#elif defined(__GNUC__)
+# define MYQTT_THREAD_POOL_TLS __thread
+#endif
+
+#if defined(MYQTT_THREAD_POOL_TLS)
+MYQTT_THREAD_POOL_TLS MyQttThreadPoolWorker * __myqtt_thread_pool_current_worker = NULL;
+#endif
+
 /* update next step to the appropiate value */
 void __myqtt_thread_pool_increase_stamp (MyQttThreadPoolEvent * event)
 {
@@ -124,6 +207,148 @@ void __myqtt_thread_pool_unref_event (axlPointer _event)
 	return;
 }
 
+/** 
+ * @internal Returns axl_true if event a must fire before event b.
+ */
+axl_bool __myqtt_thread_pool_event_before (MyQttThreadPoolEvent * a, MyQttThreadPoolEvent * b)
+{
+	if (a->next_step.tv_sec != b->next_step.tv_sec)
+		return a->next_step.tv_sec < b->next_step.tv_sec;
+	return a->next_step.tv_usec < b->next_step.tv_usec;
+}
+
+/** 
+ * @internal Swaps two positions of the event heap, updating the
+ * index stored in each event.
+ */
+void __myqtt_thread_pool_heap_swap (MyQttThreadPool * pool, int a, int b)
+{
+	MyQttThreadPoolEvent * event = pool->events[a];
+
+	pool->events[a]        = pool->events[b];
+	pool->events[b]        = event;
+	pool->events[a]->index = a;
+	pool->events[b]->index = b;
+	return;
+}
+
+/** 
+ * @internal Moves the event at the provided position up until its
+ * parent fires before it.
+ */
+void __myqtt_thread_pool_heap_up (MyQttThreadPool * pool, int index)
+{
+	int parent;
+
+	while (index > 0) {
+		parent = (index - 1) / 2;
+		if (! __myqtt_thread_pool_event_before (pool->events[index], pool->events[parent]))
+			break;
+		__myqtt_thread_pool_heap_swap (pool, index, parent);
+		index = parent;
+	} /* end while */
+	return;
+}
+
+/** 
+ * @internal Moves the event at the provided position down until its
+ * children fire after it.
+ */
+void __myqtt_thread_pool_heap_down (MyQttThreadPool * pool, int index)
+{
+	int child;
+
+	while (axl_true) {
+		child = index * 2 + 1;
+		if (child >= pool->events_num)
+			break;
+		if ((child + 1) < pool->events_num && __myqtt_thread_pool_event_before (pool->events[child + 1], pool->events[child]))
+			child++;
+		if (! __myqtt_thread_pool_event_before (pool->events[child], pool->events[index]))
+			break;
+		__myqtt_thread_pool_heap_swap (pool, index, child);
+		index = child;
+	} /* end while */
+	return;
+}
+
+/** 
+ * @internal Adds the event into the heap. Called with pool->mutex
+ * locked.
+ */
+axl_bool __myqtt_thread_pool_heap_add (MyQttThreadPool * pool, MyQttThreadPoolEvent * event)
+{
+	MyQttThreadPoolEvent ** events;
+
+	if (pool->events_num == pool->events_size) {
+		events = axl_new (MyQttThreadPoolEvent *, pool->events_size > 0 ? pool->events_size * 2 : 16);
+		if (events == NULL)
+			return axl_false;
+		if (pool->events_num > 0)
+			memcpy (events, pool->events, sizeof (MyQttThreadPoolEvent *) * pool->events_num);
+		axl_free (pool->events);
+		pool->events      = events;
+		pool->events_size = pool->events_size > 0 ? pool->events_size * 2 : 16;
+	} /* end if */
+
+	event->index                     = pool->events_num;
+	pool->events[pool->events_num++] = event;
+	__myqtt_thread_pool_heap_up (pool, event->index);
+	return axl_true;
+}
+
+/** 
+ * @internal Removes the event at the provided position from the heap,
+ * releasing the reference hold by the heap. Called with pool->mutex
+ * locked.
+ */
+void __myqtt_thread_pool_heap_remove (MyQttThreadPool * pool, int index)
+{
+	MyQttThreadPoolEvent * event = pool->events[index];
+
+	pool->events_num--;
+	if (index != pool->events_num) {
+		/* move last event into the hole and restore order */
+		pool->events[index]        = pool->events[pool->events_num];
+		pool->events[index]->index = index;
+		__myqtt_thread_pool_heap_down (pool, index);
+		__myqtt_thread_pool_heap_up (pool, index);
+	} /* end if */
+	pool->events[pool->events_num] = NULL;
+
+	event->index = -1;
+	__myqtt_thread_pool_unref_event (event);
+	return;
+}
+
+/** 
+ * @internal Returns how long (microseconds) a thread waiting for work
+ * may sleep before the next event is due (never more than 100ms, which
+ * is the precision used to check automatic resize).
+ */
+long __myqtt_thread_pool_next_wait (MyQttThreadPool * pool)
+{
+	struct timeval   now;
+	long             wait = 100000;
+	long             next;
+
+	myqtt_mutex_lock (&pool->mutex);
+	if (pool->events_num > 0) {
+		gettimeofday (&now, NULL);
+		next = (pool->events[0]->next_step.tv_sec - now.tv_sec) * 1000000 +
+			(pool->events[0]->next_step.tv_usec - now.tv_usec);
+		if (next < wait)
+			wait = next;
+	} /* end if */
+	myqtt_mutex_unlock (&pool->mutex);
+
+	/* do not spin if the event is due but other thread is
+	 * processing events */
+	if (wait < 1000)
+		wait = 1000;
+	return wait;
+}
+
 void __myqtt_thread_pool_process_events (MyQttCtx * ctx, MyQttThreadPool * pool)
 {
 	int                     length;
@@ -143,81 +368,67 @@ void __myqtt_thread_pool_process_events (MyQttCtx * ctx, MyQttThreadPool * pool)
 	/* acquire lock */
 	myqtt_mutex_lock (&pool->mutex);
 	/* ensure again we can continue */
-	if (pool->processing_events || axl_list_length (pool->events) == 0 || myqtt_is_exiting (ctx)) {
+	if (pool->processing_events || pool->events_num == 0 || myqtt_is_exiting (ctx)) {
 		myqtt_mutex_unlock (&pool->mutex);
 		return;
 	} /* end if */
 
 	/* flag we are processing */
 	pool->processing_events = axl_true;
-	length = axl_list_length (pool->events);
+	length = pool->events_num;
 	myqtt_mutex_unlock (&pool->mutex);
 	
 	/* get current stamp */
 	gettimeofday (&now, NULL);
 	iterator = 0;
-	/* myqtt_log2 (MYQTT_LEVEL_DEBUG, "Found (%d) events to process: now (%d, %d)..", length, (int) now.tv_sec, (int) now.tv_usec); */
+	/* call each event at most once per round */
 	while (iterator < length) {
 
-		/* get event reference */
+		/* get next event to fire (heap head) */
 		myqtt_mutex_lock (&pool->mutex);
-		event = axl_list_get_nth (pool->events, iterator);
-		if (event == NULL) {
+		event = pool->events_num > 0 ? pool->events[0] : NULL;
+		if (event == NULL ||
+		    (now.tv_sec < event->next_step.tv_sec) ||
+		    ((now.tv_sec == event->next_step.tv_sec) &&
+		     (now.tv_usec < event->next_step.tv_usec))) {
+			/* no more events due */
 			myqtt_mutex_unlock (&pool->mutex);
 			break;
-		}
+		} /* end if */
 
 		/* increase ref count now we have the look */
 		event->ref_count++;
 
-		/* get stamp */
-		if ((now.tv_sec > event->next_step.tv_sec) ||
-		    ((now.tv_sec == event->next_step.tv_sec) &&
-		     (now.tv_usec >= event->next_step.tv_usec))) {
-
-			func  = event->func;
-			data  = event->data;
-			data2 = event->data2;
-
-			/* unlock before calling */
-			myqtt_mutex_unlock (&pool->mutex);
+		func  = event->func;
+		data  = event->data;
+		data2 = event->data2;
 
-			/* call to notify event */
-			if (func (ctx, data, data2)) {
-				myqtt_mutex_lock (&pool->mutex);
-
-				/* remove event using the pointer not
-				 * the position because it may be
-				 * pointing to a different location
-				 * (i.e: someone removed or added an
-				 * event durint the last func()
-				 * call) */
-				axl_list_remove_ptr (pool->events, event);
+		/* schedule next call now so the heap stays ordered
+		 * while the handler runs */
+		__myqtt_thread_pool_increase_stamp (event);
+		__myqtt_thread_pool_heap_down (pool, 0);
 
-				/* decrease local reference */
-				__myqtt_thread_pool_unref_event (event);
+		/* unlock before calling */
+		myqtt_mutex_unlock (&pool->mutex);
 
-				myqtt_mutex_unlock (&pool->mutex);
+		/* call to notify event */
+		if (func (ctx, data, data2)) {
+			myqtt_mutex_lock (&pool->mutex);
 
-				/* don't update iterator to manage next position */
-				continue;
-			}
+			/* remove event unless someone removed it
+			 * during the last func() call */
+			if (event->index >= 0)
+				__myqtt_thread_pool_heap_remove (pool, event->index);
 
-			/* now recalculate event to be executed in the
-			 * future (because the user did selected to
-			 * keep it) */
-			myqtt_mutex_lock (&pool->mutex);
-			__myqtt_thread_pool_increase_stamp (event);
-			
+			myqtt_mutex_unlock (&pool->mutex);
 		} /* end if */
 
 		/* decrease local reference */
+		myqtt_mutex_lock (&pool->mutex);
 		__myqtt_thread_pool_unref_event (event);
-
-		/* unlock for the next lock */
 		myqtt_mutex_unlock (&pool->mutex);
 
-		/* next position */
+		/* next event */
 		iterator++;
 	}
 
@@ -228,6 +439,26 @@ void __myqtt_thread_pool_process_events (MyQttCtx * ctx, MyQttThreadPool * pool)
 	return;
 }
 
+/** 
+ * @internal Returns the number of threads waiting for work.
+ */
+int __myqtt_thread_pool_waiting (MyQttThreadPool * pool)
+{
+	if (pool->work_stealing)
+		return myqtt_atomic_get (&pool->idle);
+	return myqtt_async_queue_waiters (pool->queue);
+}
+
+/** 
+ * @internal Returns the number of tasks queued but not started yet.
+ */
+int __myqtt_thread_pool_pending (MyQttThreadPool * pool)
+{
+	if (pool->work_stealing)
+		return myqtt_atomic_get (&pool->pending);
+	return myqtt_async_queue_items (pool->queue);
+}
+
 /** 
  * @internal Code that resizes the thread pool adding or removing
  * threads according to current status and user configuration.
@@ -256,8 +487,9 @@ void __myqtt_thread_pool_automatic_resize (MyQttCtx * ctx)
 	}
 
 	running_threads = axl_list_length (ctx->thread_pool->threads);
-	waiting_threads = myqtt_async_queue_waiters (ctx->thread_pool->queue);
-	pending_tasks   = myqtt_async_queue_items (ctx->thread_pool->queue);
+	waiting_threads = __myqtt_thread_pool_waiting (ctx->thread_pool);
+	pending_tasks   = __myqtt_thread_pool_pending (ctx->thread_pool);
+	myqtt_atomic_add64 (&ctx->thread_pool->resize_checks, 1);
 
 	/* now get difference in diff */
 	gettimeofday (&now, NULL);
@@ -282,6 +514,7 @@ void __myqtt_thread_pool_automatic_resize (MyQttCtx * ctx)
 		/* add a thread to the pool (call internal unlocked) */
 		myqtt_thread_pool_add_internal (ctx, ctx->thread_pool->thread_add_step);
 		gettimeofday (&(ctx->thread_pool->last), NULL);
+		myqtt_atomic_add64 (&ctx->thread_pool->resize_added, 1);
 
 	} else if (ctx->thread_pool->auto_remove && 
 		   pending_tasks == 0 && 
@@ -301,7 +534,12 @@ void __myqtt_thread_pool_automatic_resize (MyQttCtx * ctx)
 		/* remove a thread from the pool */
 		myqtt_thread_pool_remove_internal (ctx, ctx->thread_pool->thread_remove_step);
 		gettimeofday (&(ctx->thread_pool->last), NULL);
+		myqtt_atomic_add64 (&ctx->thread_pool->resize_removed, 1);
 
+	} else if (running_threads >= ctx->thread_pool->thread_max_limit &&
+		   waiting_threads == 0 && pending_tasks > 0) {
+		/* more threads needed but limit reached */
+		myqtt_atomic_add64 (&ctx->thread_pool->resize_limit_reached, 1);
 	} /* end if */
 
 	/* unlock the mutex */
@@ -310,6 +548,587 @@ void __myqtt_thread_pool_automatic_resize (MyQttCtx * ctx)
 	return;
 }
 
+/** 
+ * @internal Adds the value (microseconds) into the histogram
+ * provided: bucket 0 holds values under 1us and bucket n values in
+ * [2^(n-1), 2^n) us (last bucket holds everything above).
+ */
+void __myqtt_thread_pool_histogram_add (long long * histogram, long value)
+{
+	int bucket = 0;
+
+	while (value > 0 && bucket < (MYQTT_THREAD_POOL_HISTOGRAM_BUCKETS - 1)) {
+		value = value >> 1;
+		bucket++;
+	} /* end while */
+
+	myqtt_atomic_add64 (&histogram[bucket], 1);
+	return;
+}
+
+/** 
+ * @internal Runs the task provided, releasing it before calling the
+ * handler, and then processes events and the automatic resize.
+ */
+void __myqtt_thread_pool_run_task (MyQttCtx * ctx, MyQttThreadPool * pool, MyQttThreadPoolWorker * worker, MyQttThreadPoolTask * task)
+{
+	MyQttThreadFunc       func;
+	axlPointer            data;
+	struct timeval        start;
+	struct timeval        stop;
+	struct timeval        diff;
+	long                  elapsed;
+
+	myqtt_log (MYQTT_LEVEL_DEBUG, "--> thread from pool processing new job");
+
+	/* queue wait */
+	gettimeofday (&start, NULL);
+	myqtt_timeval_substract (&start, &task->queued, &diff);
+	__myqtt_thread_pool_histogram_add (pool->queue_wait, diff.tv_sec * 1000000 + diff.tv_usec);
+
+	/* grab references to release before call */
+	func = task->func;
+	data = task->data;
+	axl_free (task);
+
+	/* do automatic reasize (preemtive) */
+	if (ctx && ctx->thread_pool && ctx->thread_pool->preemtive)
+		__myqtt_thread_pool_automatic_resize (ctx);
+
+	/* at this point we already are executing inside a thread */
+	if (! ctx->thread_pool_being_stopped && ! ctx->myqtt_exit) {
+		func (data);
+
+		/* run time */
+		gettimeofday (&stop, NULL);
+		myqtt_timeval_substract (&stop, &start, &diff);
+		elapsed = diff.tv_sec * 1000000 + diff.tv_usec;
+		__myqtt_thread_pool_histogram_add (pool->run_time, elapsed);
+		if (worker)
+			myqtt_atomic_add64 (&worker->busy, elapsed);
+	} /* end if */
+
+	/* call to process events after finishing tasks */
+	__myqtt_thread_pool_process_events (ctx, pool);
+
+	/* do automatic reasize */
+	if (ctx && ctx->thread_pool && ! ctx->thread_pool->preemtive)
+		__myqtt_thread_pool_automatic_resize (ctx);
+
+	myqtt_log (MYQTT_LEVEL_DEBUG, "--> thread from pool waiting for jobs");
+	return;
+}
+
+/** 
+ * @internal Pushes the task at the tail of the worker deque, growing
+ * it when full. Must be called with worker->mutex locked.
+ */
+axl_bool __myqtt_thread_pool_worker_push (MyQttThreadPoolWorker * worker, MyQttThreadPoolTask * task)
+{
+	MyQttThreadPoolTask ** ring;
+	int                    iterator;
+
+	if (worker->count == worker->size) {
+		ring = axl_new (MyQttThreadPoolTask *, worker->size * 2);
+		if (ring == NULL)
+			return axl_false;
+
+		/* copy in order so head starts at 0 */
+		iterator = 0;
+		while (iterator < worker->count) {
+			ring[iterator] = worker->ring[(worker->head + iterator) % worker->size];
+			iterator++;
+		} /* end while */
+
+		axl_free (worker->ring);
+		worker->ring  = ring;
+		worker->head  = 0;
+		worker->size  = worker->size * 2;
+	} /* end if */
+
+	worker->ring[(worker->head + worker->count) % worker->size] = task;
+	worker->count++;
+	return axl_true;
+}
+
+/** 
+ * @internal Gets next task from the worker deque: the owner takes it
+ * from the head while thieves (steal == axl_true) take it from the
+ * tail.
+ */
+MyQttThreadPoolTask * __myqtt_thread_pool_worker_pop (MyQttThreadPoolWorker * worker, axl_bool steal)
+{
+	MyQttThreadPoolTask * task = NULL;
+
+	/* unlocked check to skip empty deques */
+	if (worker->count == 0)
+		return NULL;
+
+	myqtt_mutex_lock (&worker->mutex);
+	if (worker->count > 0) {
+		if (steal) {
+			task = worker->ring[(worker->head + worker->count - 1) % worker->size];
+		} else {
+			task         = worker->ring[worker->head];
+			worker->head = (worker->head + 1) % worker->size;
+		} /* end if */
+		worker->count--;
+	} /* end if */
+	myqtt_mutex_unlock (&worker->mutex);
+
+	return task;
+}
+
+/** 
+ * @internal Appends the task to the injection queue.
+ */
+void __myqtt_thread_pool_inject_push (MyQttThreadPool * pool, MyQttThreadPoolTask * task)
+{
+	task->next = NULL;
+
+	myqtt_mutex_lock (&pool->inject_mutex);
+	if (pool->inject_last)
+		pool->inject_last->next = task;
+	else
+		pool->inject_first = task;
+	pool->inject_last = task;
+	myqtt_mutex_unlock (&pool->inject_mutex);
+
+	return;
+}
+
+/** 
+ * @internal Gets first task from the injection queue.
+ */
+MyQttThreadPoolTask * __myqtt_thread_pool_inject_pop (MyQttThreadPool * pool)
+{
+	MyQttThreadPoolTask * task;
+
+	/* unlocked check to skip the lock when empty */
+	if (pool->inject_first == NULL)
+		return NULL;
+
+	myqtt_mutex_lock (&pool->inject_mutex);
+	task = pool->inject_first;
+	if (task) {
+		pool->inject_first = task->next;
+		if (pool->inject_first == NULL)
+			pool->inject_last = NULL;
+	} /* end if */
+	myqtt_mutex_unlock (&pool->inject_mutex);
+
+	return task;
+}
+
+/** 
+ * @internal Wakes up a sleeping worker, handing it the task
+ * provided (if any). Returns axl_false when no worker was sleeping.
+ */
+axl_bool __myqtt_thread_pool_wake_worker (MyQttThreadPool * pool, MyQttThreadPoolTask * task)
+{
+	MyQttThreadPoolWorker * worker;
+	unsigned int            start;
+	int                     total;
+	int                     iterator;
+
+	total = myqtt_atomic_get (&pool->workers_num);
+	if (total == 0 || myqtt_atomic_get (&pool->idle) == 0)
+		return axl_false;
+
+	/* spread wake ups across workers */
+	start    = (unsigned int) myqtt_atomic_add (&pool->steal_seed, 1);
+	iterator = 0;
+	while (iterator < total) {
+		worker = pool->workers[(start + iterator) % total];
+		iterator++;
+
+		if (! worker->sleeping)
+			continue;
+
+		myqtt_mutex_lock (&worker->mutex);
+		if (worker->sleeping && ! worker->stopped && (task == NULL || __myqtt_thread_pool_worker_push (worker, task))) {
+			/* claim it so next submitter picks another one */
+			worker->sleeping = axl_false;
+			myqtt_cond_signal (&worker->cond);
+			myqtt_mutex_unlock (&worker->mutex);
+			return axl_true;
+		} /* end if */
+		myqtt_mutex_unlock (&worker->mutex);
+	} /* end while */
+
+	return axl_false;
+}
+
+/** 
+ * @internal Queues a task on a work-stealing pool: tasks created from
+ * a pool thread go to its own deque, the rest are handed to a
+ * sleeping worker or left in the injection queue.
+ */
+void __myqtt_thread_pool_ws_push (MyQttThreadPool * pool, MyQttThreadPoolTask * task)
+{
+#if defined(MYQTT_THREAD_POOL_TLS)
+	MyQttThreadPoolWorker * worker = __myqtt_thread_pool_current_worker;
+#endif
+
+	myqtt_atomic_add (&pool->pending, 1);
+
+#if defined(MYQTT_THREAD_POOL_TLS)
+	if (worker && worker->pool == pool) {
+		myqtt_mutex_lock (&worker->mutex);
+		if (! worker->stopped && __myqtt_thread_pool_worker_push (worker, task)) {
+			myqtt_mutex_unlock (&worker->mutex);
+
+			/* let an idle worker steal it */
+			__myqtt_thread_pool_wake_worker (pool, NULL);
+			return;
+		} /* end if */
+		myqtt_mutex_unlock (&worker->mutex);
+	} /* end if */
+#endif
+
+	if (__myqtt_thread_pool_wake_worker (pool, task))
+		return;
+
+	__myqtt_thread_pool_inject_push (pool, task);
+
+	/* a worker may have gone to sleep in between */
+	__myqtt_thread_pool_wake_worker (pool, NULL);
+	return;
+}
+
+/** 
+ * @internal Gets next task for the worker: from its own deque, then
+ * from the injection queue and finally stealing from other workers.
+ */
+MyQttThreadPoolTask * __myqtt_thread_pool_next_task (MyQttThreadPool * pool, MyQttThreadPoolWorker * worker)
+{
+	MyQttThreadPoolTask   * task;
+	MyQttThreadPoolWorker * victim;
+	unsigned int            start;
+	int                     total;
+	int                     iterator;
+
+	task = __myqtt_thread_pool_worker_pop (worker, axl_false);
+	if (task == NULL)
+		task = __myqtt_thread_pool_inject_pop (pool);
+
+	if (task == NULL) {
+		total    = myqtt_atomic_get (&pool->workers_num);
+		start    = (unsigned int) myqtt_atomic_add (&pool->steal_seed, 1);
+		iterator = 0;
+		while (task == NULL && iterator < total) {
+			victim = pool->workers[(start + iterator) % total];
+			if (victim != worker)
+				task = __myqtt_thread_pool_worker_pop (victim, axl_true);
+			iterator++;
+		} /* end while */
+	} /* end if */
+
+	if (task)
+		myqtt_atomic_add (&pool->pending, -1);
+	return task;
+}
+
+/** 
+ * @internal Removes the worker (and its thread) from the pool because
+ * it was reduced: pending tasks are moved to the injection queue and
+ * the thread is left for other worker to collect it.
+ */
+void __myqtt_thread_pool_worker_stop (MyQttThreadPool * pool, MyQttThreadPoolWorker * worker, MyQttThread * thread)
+{
+	MyQttThreadPoolTask * task;
+
+	/* flag it so no more tasks are handed to this worker */
+	myqtt_mutex_lock (&worker->mutex);
+	worker->stopped = axl_true;
+	myqtt_mutex_unlock (&worker->mutex);
+
+	while ((task = __myqtt_thread_pool_worker_pop (worker, axl_false)) != NULL)
+		__myqtt_thread_pool_inject_push (pool, task);
+
+	/* remove thread from the pool */
+	myqtt_mutex_lock (&pool->stopped_mutex);
+	myqtt_mutex_lock (&pool->mutex);
+	axl_list_unlink_ptr (pool->threads, thread);
+	myqtt_mutex_unlock (&pool->mutex);
+	axl_list_append (pool->stopped, thread);
+	myqtt_mutex_unlock (&pool->stopped_mutex);
+
+	/* ask someone to collect it (and to run tasks moved) */
+	myqtt_atomic_add (&pool->collect_requests, 1);
+	__myqtt_thread_pool_wake_worker (pool, NULL);
+	return;
+}
+
+/** 
+ * @internal Reallocates the worker deque from its own thread (once
+ * pinned) so it is placed on the thread's local NUMA node.
+ */
+void __myqtt_thread_pool_worker_localize (MyQttThreadPoolWorker * worker)
+{
+	MyQttThreadPoolTask ** ring;
+	int                    iterator;
+
+	myqtt_mutex_lock (&worker->mutex);
+	ring = axl_new (MyQttThreadPoolTask *, worker->size);
+	if (ring) {
+		iterator = 0;
+		while (iterator < worker->count) {
+			ring[iterator] = worker->ring[(worker->head + iterator) % worker->size];
+			iterator++;
+		} /* end while */
+		axl_free (worker->ring);
+		worker->ring = ring;
+		worker->head = 0;
+	} /* end if */
+	myqtt_mutex_unlock (&worker->mutex);
+
+	return;
+}
+
+/** 
+ * @internal Resets busy stats when the worker thread starts.
+ */
+void __myqtt_thread_pool_worker_stats_init (MyQttThreadPool * pool, MyQttThreadPoolWorker * worker)
+{
+	if (worker == NULL)
+		return;
+
+	myqtt_mutex_lock (&pool->mutex);
+	worker->busy      = 0;
+	worker->busy_last = 0;
+	gettimeofday (&worker->last, NULL);
+	myqtt_mutex_unlock (&pool->mutex);
+
+	return;
+}
+
+/** 
+ * @internal Releases a reference to the pool. The last one (the
+ * context or a detached dispatcher finishing after
+ * myqtt_thread_pool_exit) releases worker slots, pending tasks and
+ * the pool itself.
+ */
+void __myqtt_thread_pool_unref (MyQttThreadPool * pool)
+{
+	MyQttThreadPoolTask   * task;
+	MyQttThreadPoolWorker * worker;
+	int                     iterator;
+
+	if (myqtt_atomic_add (&pool->refs, -1) != 0)
+		return;
+
+	while (pool->events_num > 0)
+		__myqtt_thread_pool_heap_remove (pool, 0);
+	axl_free (pool->events);
+
+	/* unref the queue */
+	while (myqtt_async_queue_items (pool->queue) > 0) {
+		/* call to get pending task */
+		task = myqtt_async_queue_pop (pool->queue);
+
+		/* skip operating over beacons (stop beacon == 1, thread stopper == 2,
+		 * thread collect == 3, event installed == 4) */
+		if (PTR_TO_INT (task) >= 1 && PTR_TO_INT (task) <= 4)
+			continue;
+
+		/* if destroy function is defined, call to release */
+		if (task->destroy_data)
+			task->destroy_data (task->data);
+
+		/* release pool task data */
+		axl_free (task);
+	} /* end while */
+	myqtt_async_queue_unref (pool->queue);
+
+	/* release work-stealing deques and pending tasks */
+	iterator = 0;
+	while (iterator < pool->workers_num) {
+		worker = pool->workers[iterator];
+		while ((task = __myqtt_thread_pool_worker_pop (worker, axl_false)) != NULL) {
+			if (task->destroy_data)
+				task->destroy_data (task->data);
+			axl_free (task);
+		} /* end while */
+		myqtt_mutex_destroy (&worker->mutex);
+		myqtt_cond_destroy (&worker->cond);
+		axl_free (worker->ring);
+		axl_free (worker);
+		iterator++;
+	} /* end while */
+	while ((task = __myqtt_thread_pool_inject_pop (pool)) != NULL) {
+		if (task->destroy_data)
+			task->destroy_data (task->data);
+		axl_free (task);
+	} /* end while */
+
+	/* terminate mutex */
+	myqtt_mutex_destroy (&pool->mutex);
+	myqtt_mutex_destroy (&pool->stopped_mutex);
+	myqtt_mutex_destroy (&pool->inject_mutex);
+
+	/* free the node itself */
+	axl_free (pool);
+	return;
+}
+
+/** 
+ * @internal Gets a worker slot for a new thread, reusing slots from
+ * threads already finished. Called with pool->mutex locked.
+ */
+MyQttThreadPoolWorker * __myqtt_thread_pool_worker_get (MyQttThreadPool * pool)
+{
+	MyQttThreadPoolWorker * worker;
+	int                     iterator;
+
+	iterator = 0;
+	while (iterator < pool->workers_num) {
+		worker = pool->workers[iterator];
+		if (myqtt_atomic_cas (&worker->exited, 1, 0)) {
+			myqtt_mutex_lock (&worker->mutex);
+			worker->stopped  = axl_false;
+			worker->sleeping = axl_false;
+			myqtt_mutex_unlock (&worker->mutex);
+			return worker;
+		} /* end if */
+		iterator++;
+	} /* end while */
+
+	if (pool->workers_num == MYQTT_THREAD_POOL_MAX_WORKERS)
+		return NULL;
+
+	worker = axl_new (MyQttThreadPoolWorker, 1);
+	if (worker == NULL)
+		return NULL;
+	worker->size = 64;
+	worker->ring = axl_new (MyQttThreadPoolTask *, worker->size);
+	if (worker->ring == NULL) {
+		axl_free (worker);
+		return NULL;
+	} /* end if */
+	worker->pool = pool;
+	myqtt_mutex_create (&worker->mutex);
+	myqtt_cond_create (&worker->cond);
+
+	/* publish the slot */
+	pool->workers[pool->workers_num] = worker;
+	myqtt_atomic_add (&pool->workers_num, 1);
+
+	return worker;
+}
+
+/** 
+ * @internal
+ * 
+ * Dispatcher used by work-stealing pools (see
+ * myqtt_thread_pool_set_work_stealing).
+ **/
+axlPointer __myqtt_thread_pool_ws_dispatcher (MyQttThreadPoolStarter * _data)
+{
+	MyQttThreadPoolTask   * task;
+	MyQttThread           * thread = _data->thread;
+	MyQttThreadPool       * pool   = _data->pool;
+	MyQttThreadPoolWorker * worker = _data->worker;
+	MyQttCtx              * ctx    = pool->ctx;
+	MyQttAsyncQueue       * queue  = _data->queue;
+	int                     requests;
+	axl_bool                signaled;
+	long                    wait;
+	int                     cpus_gen = 0;
+
+	axl_free (_data);
+
+#if defined(MYQTT_THREAD_POOL_TLS)
+	__myqtt_thread_pool_current_worker = worker;
+#endif
+
+	/* pin the thread (if configured) and move its deque to the
+	 * local node */
+	if (__myqtt_thread_check_cpus (ctx, MYQTT_THREAD_POOL, &cpus_gen))
+		__myqtt_thread_pool_worker_localize (worker);
+
+	/* init busy stats */
+	__myqtt_thread_pool_worker_stats_init (pool, worker);
+
+	myqtt_log (MYQTT_LEVEL_DEBUG, "thread from pool started (work-stealing)");
+
+	while (! ctx->thread_pool_being_stopped) {
+
+		/* apply cpu set changes */
+		__myqtt_thread_check_cpus (ctx, MYQTT_THREAD_POOL, &cpus_gen);
+
+		/* check to stop current thread because pool was reduced */
+		requests = myqtt_atomic_get (&pool->remove_requests);
+		if (requests > 0 && myqtt_atomic_cas (&pool->remove_requests, requests, requests - 1)) {
+			myqtt_log (MYQTT_LEVEL_DEBUG, "--> thread from pool stoping, found thread stop request");
+			__myqtt_thread_pool_worker_stop (pool, worker, thread);
+			break;
+		} /* end if */
+
+		/* collect thread data terminated */
+		requests = myqtt_atomic_get (&pool->collect_requests);
+		if (requests > 0 && myqtt_atomic_cas (&pool->collect_requests, requests, requests - 1)) {
+			myqtt_mutex_lock (&pool->stopped_mutex);
+			axl_list_remove_first (pool->stopped);
+			myqtt_mutex_unlock (&pool->stopped_mutex);
+			continue;
+		} /* end if */
+
+		task = __myqtt_thread_pool_next_task (pool, worker);
+		if (task) {
+			__myqtt_thread_pool_run_task (ctx, pool, worker, task);
+			continue;
+		} /* end if */
+
+		/* nothing to do, wait for work or until next event is
+		 * due (precision=100ms) */
+		wait     = __myqtt_thread_pool_next_wait (pool);
+		signaled = axl_true;
+		myqtt_mutex_lock (&worker->mutex);
+		if (worker->count == 0 && ! ctx->thread_pool_being_stopped) {
+			worker->sleeping = axl_true;
+			myqtt_atomic_add (&pool->idle, 1);
+
+			/* check again once flagged as idle so a task
+			 * queued in between is not missed */
+			if (myqtt_atomic_get (&pool->pending) == 0 && 
+			    myqtt_atomic_get (&pool->remove_requests) == 0 &&
+			    myqtt_atomic_get (&pool->collect_requests) == 0)
+				MYQTT_COND_TIMEDWAIT (signaled, &worker->cond, &worker->mutex, wait);
+
+			worker->sleeping = axl_false;
+			myqtt_atomic_add (&pool->idle, -1);
+		} /* end if */
+		myqtt_mutex_unlock (&worker->mutex);
+
+		/* woken up by myqtt_thread_pool_exit: do not run
+		 * events or resize a pool being released */
+		if (ctx->thread_pool_being_stopped)
+			break;
+
+		/* call to process events */
+		__myqtt_thread_pool_process_events (ctx, pool);
+
+		/* do automatic reasize */
+		if (! signaled)
+			__myqtt_thread_pool_automatic_resize (ctx);
+	} /* end while */
+
+#if defined(MYQTT_THREAD_POOL_TLS)
+	__myqtt_thread_pool_current_worker = NULL;
+#endif
+
+	/* flag the slot as reusable (worker is not touched after this) */
+	myqtt_atomic_cas (&worker->exited, 0, 1);
+
+	/* unref the queue and return */
+	myqtt_async_queue_unref (queue);
+	__myqtt_thread_pool_unref (pool);
+
+	myqtt_ctx_unref2 (&ctx, "end pool dispatcher");
+	return NULL;
+}
+
 /** 
  * @internal
  * 
@@ -323,20 +1142,29 @@ axlPointer __myqtt_thread_pool_dispatcher (MyQttThreadPoolStarter * _data)
 	MyQttThreadPool     * pool   = _data->pool;
 	MyQttCtx            * ctx    = pool->ctx;
 	MyQttAsyncQueue     * queue  = _data->queue;
-
-	/* local pointers to release soon data object */
-	MyQttThreadFunc       func;
-	axlPointer             data;
+	MyQttThreadPoolWorker * worker = _data->worker;
+	int                   cpus_gen = 0;
 
 	axl_free (_data);
 
 	myqtt_log (MYQTT_LEVEL_DEBUG, "thread from pool started");
 
+	/* init busy stats */
+	__myqtt_thread_pool_worker_stats_init (pool, worker);
+
 	/* get a reference to the queue, waiting for the next work */
 	while (axl_true) {
+		/* pin the thread (if configured) */
+		__myqtt_thread_check_cpus (ctx, MYQTT_THREAD_POOL, &cpus_gen);
 
-		/* get next task to process: precision=100ms */
-		task = myqtt_async_queue_timedpop (queue, 100000);
+		/* get next task to process: wait until next event is
+		 * due (precision=100ms) */
+		task = myqtt_async_queue_timedpop (queue, __myqtt_thread_pool_next_wait (pool));
+
+		/* the finish beacon may have been taken by another
+		 * thread: stop as well once the pool is being stopped */
+		if (task == NULL && ctx->thread_pool_being_stopped)
+			task = INT_TO_PTR (1);
 		
 		if (task == NULL) {
 			/* call to process events */
@@ -348,11 +1176,17 @@ axlPointer __myqtt_thread_pool_dispatcher (MyQttThreadPoolStarter * _data)
 			continue;
 		}
 
+		if (PTR_TO_INT (task) == 4) {
+			/* an event sooner than expected was installed */
+			__myqtt_thread_pool_process_events (ctx, pool);
+			continue;
+		}
+
 		if (PTR_TO_INT (task) == 3) {
 			/* collect thread data terminated */
-			myqtt_mutex_lock (&(ctx->thread_pool->stopped_mutex));
+			myqtt_mutex_lock (&pool->stopped_mutex);
 			axl_list_remove_first (pool->stopped);
-			myqtt_mutex_unlock (&(ctx->thread_pool->stopped_mutex));
+			myqtt_mutex_unlock (&pool->stopped_mutex);
 			continue;
 		}
 
@@ -362,7 +1196,7 @@ axlPointer __myqtt_thread_pool_dispatcher (MyQttThreadPoolStarter * _data)
 
 			/* do not lock because this is already done by
 			 * myqtt_thread_pool_remove .. */
-			myqtt_mutex_lock (&(ctx->thread_pool->stopped_mutex));
+			myqtt_mutex_lock (&pool->stopped_mutex);
 
 			/* remove thread from the pool */
 			myqtt_mutex_lock (&pool->mutex);
@@ -370,12 +1204,17 @@ axlPointer __myqtt_thread_pool_dispatcher (MyQttThreadPoolStarter * _data)
 			myqtt_mutex_unlock (&pool->mutex);
 
 			axl_list_append (pool->stopped, thread);
-			myqtt_mutex_unlock (&(ctx->thread_pool->stopped_mutex));
+			myqtt_mutex_unlock (&pool->stopped_mutex);
 
 			myqtt_async_queue_push (queue, INT_TO_PTR (3));
 
+			/* flag the slot as reusable */
+			if (worker)
+				myqtt_atomic_cas (&worker->exited, 0, 1);
+
 			/* unref the queue and return */
 			myqtt_async_queue_unref (queue);
+			__myqtt_thread_pool_unref (pool);
 
 			/* unref ctx */
 			myqtt_ctx_unref2 (&ctx, "end pool dispatcher");
@@ -386,40 +1225,25 @@ axlPointer __myqtt_thread_pool_dispatcher (MyQttThreadPoolStarter * _data)
 		if ((PTR_TO_INT (task) == 1) && ctx->thread_pool_being_stopped) {
 			myqtt_log (MYQTT_LEVEL_DEBUG, "--> thread from pool stoping, found finish beacon");
 
+			/* flag the slot as reusable */
+			if (worker)
+				myqtt_atomic_cas (&worker->exited, 0, 1);
+
 			/* unref the queue and return */
 			myqtt_async_queue_unref (queue);
+			__myqtt_thread_pool_unref (pool);
 			
 			myqtt_ctx_unref2 (&ctx, "end pool dispatcher");
 			return NULL;
 		} /* end if */
 
-		myqtt_log (MYQTT_LEVEL_DEBUG, "--> thread from pool processing new job");
-
-		/* grab references to release before call */
-		func = task->func;
-		data = task->data;
-		axl_free (task);
-
-		/* do automatic reasize (preemtive) */
-		if (ctx && ctx->thread_pool && ctx->thread_pool->preemtive)
-			__myqtt_thread_pool_automatic_resize (ctx);
-
-		/* at this point we already are executing inside a thread */
-		if (! ctx->thread_pool_being_stopped && ! ctx->myqtt_exit) 
-			func (data);
-
-		/* call to process events after finishing tasks */
-		__myqtt_thread_pool_process_events (ctx, pool);
-
-		/* do automatic reasize */
-		if (ctx && ctx->thread_pool && ! ctx->thread_pool->preemtive)
-			__myqtt_thread_pool_automatic_resize (ctx);
-
-		myqtt_log (MYQTT_LEVEL_DEBUG, "--> thread from pool waiting for jobs");
+		/* run the task */
+		__myqtt_thread_pool_run_task (ctx, pool, worker, task);
 
 	} /* end if */
 		
 	/* That's all! */
+	__myqtt_thread_pool_unref (pool);
 	myqtt_ctx_unref2 (&ctx, "end pool dispatcher");
 	return NULL;
 }
@@ -457,17 +1281,6 @@ void __myqtt_thread_pool_terminate_thread (axlPointer _thread)
  * @{
  */
 
-int  __myqtt_thread_pool_soon_events_first (axlPointer a, axlPointer b)
-{
-	MyQttThreadPoolEvent * event_a = a;
-	MyQttThreadPoolEvent * event_b = a;
-
-	/* first a if microseconds is sort */
-	if (event_a->delay < event_b->delay)
-		return -1;
-	return 1;
-}
-
 /**
  * @brief Init the MyQtt Thread Pool subsystem.
  * 
@@ -488,8 +1301,10 @@ void myqtt_thread_pool_init     (MyQttCtx * ctx,
 	myqtt_log (MYQTT_LEVEL_DEBUG, "creating thread pool threads=%d", max_threads);
 
 	/* create the thread pool and its internal values */
-	if (ctx->thread_pool == NULL)
+	if (ctx->thread_pool == NULL) {
 		ctx->thread_pool      = axl_new (MyQttThreadPool, 1);
+		ctx->thread_pool->refs = 1;
+	} /* end if */
 
 	if (ctx->thread_pool->threads != NULL) {
 		/* clear list */
@@ -504,15 +1319,13 @@ void myqtt_thread_pool_init     (MyQttCtx * ctx,
 			axl_free (thread);
 		} /* end while */
 		axl_list_free (ctx->thread_pool->threads);
-		axl_list_free (ctx->thread_pool->events);
-		axl_list_cursor_free (ctx->thread_pool->events_cursor);
+		while (ctx->thread_pool->events_num > 0)
+			__myqtt_thread_pool_heap_remove (ctx->thread_pool, 0);
 		axl_list_free (ctx->thread_pool->stopped);
 	} /* end if */
 
 	ctx->thread_pool->threads       = axl_list_new (axl_list_always_return_1, __myqtt_thread_pool_terminate_thread);
 	ctx->thread_pool->stopped       = axl_list_new (axl_list_always_return_1, __myqtt_thread_pool_terminate_thread);
-	ctx->thread_pool->events        = axl_list_new (__myqtt_thread_pool_soon_events_first, __myqtt_thread_pool_unref_event);
-	ctx->thread_pool->events_cursor = axl_list_cursor_new (ctx->thread_pool->events);
 	ctx->thread_pool->ctx           = ctx;
 
 	/* init the queue */
@@ -523,6 +1336,11 @@ void myqtt_thread_pool_init     (MyQttCtx * ctx,
 	/* init mutex */
 	myqtt_mutex_create (&(ctx->thread_pool->mutex));
 	myqtt_mutex_create (&(ctx->thread_pool->stopped_mutex));
+	myqtt_mutex_create (&(ctx->thread_pool->inject_mutex));
+
+	/* configure pool mode */
+	ctx->thread_pool->work_stealing = ctx->thread_pool_work_stealing;
+	myqtt_log (MYQTT_LEVEL_DEBUG, "thread pool mode: %s", ctx->thread_pool->work_stealing ? "work-stealing" : "shared queue");
 	
 	/* init all threads required */
 	myqtt_thread_pool_add (ctx, max_threads);
@@ -643,6 +1461,7 @@ void myqtt_thread_pool_add_internal                 (MyQttCtx        * ctx,
 	int                       iterator;
 	MyQttThread            * thread;
 	MyQttThreadPoolStarter * starter;
+	MyQttThreadPoolWorker  * worker = NULL;
 	MyQttCtx               * local_ctx;
 
 	v_return_if_fail (ctx);
@@ -665,27 +1484,49 @@ void myqtt_thread_pool_add_internal                 (MyQttCtx        * ctx,
 		starter->thread = thread;
 		starter->pool   = ctx->thread_pool;
 
+		/* get a slot for the thread: it holds its stats and
+		 * its deque (only required by work-stealing mode) */
+		worker = __myqtt_thread_pool_worker_get (ctx->thread_pool);
+		if (worker == NULL && ctx->thread_pool->work_stealing) {
+			myqtt_log (MYQTT_LEVEL_CRITICAL, "unable to add more threads to the pool, limit reached (%d)", MYQTT_THREAD_POOL_MAX_WORKERS);
+			axl_free (starter);
+			axl_free (thread);
+			break;
+		} /* end if */
+		starter->worker = worker;
+
 		/* update the reference counting for this thread to
 		 * the queue */
 		if (! myqtt_async_queue_ref (ctx->thread_pool->queue)) {
+			if (worker)
+				myqtt_atomic_cas (&worker->exited, 0, 1);
 			axl_free (thread);
 			break;
 		}
 		starter->queue = ctx->thread_pool->queue;
 
-		/* acquire a reference to the context */
+		/* acquire a reference to the context and to the pool
+		 * (released by the dispatcher when it finishes) */
 		myqtt_ctx_ref2 (ctx, "begin pool dispatcher");
+		myqtt_atomic_add (&ctx->thread_pool->refs, 1);
 
 		if (! myqtt_thread_create (thread,
 					    /* function to execute */
+					    ctx->thread_pool->work_stealing ? 
+					    (MyQttThreadFunc)__myqtt_thread_pool_ws_dispatcher :
 					    (MyQttThreadFunc)__myqtt_thread_pool_dispatcher,
 					    /* a reference to the thread pool and the thread reference started */
 					    starter,
 					    /* finish thread configuration */
 					    MYQTT_THREAD_CONF_END)) {
 
-			/* unref the queue */
+			/* unref the queue and the pool */
 			myqtt_async_queue_unref (ctx->thread_pool->queue);
+			myqtt_atomic_add (&ctx->thread_pool->refs, -1);
+
+			/* release the slot */
+			if (worker)
+				myqtt_atomic_cas (&worker->exited, 0, 1);
 
 			/* failed, release ctx */
 			local_ctx = ctx;
@@ -754,10 +1595,14 @@ void myqtt_thread_pool_remove_internal        (MyQttCtx        * ctx,
 	if (ctx == NULL || threads <= 0)
 		return;
 
-	threads_running = axl_list_length (ctx->thread_pool->threads);
+	threads_running = axl_list_length (ctx->thread_pool->threads) - myqtt_atomic_get (&ctx->thread_pool->remove_requests);
 	while (threads > 0 && threads_running > 1) {
 		/* push a task to stop one thread */
-		myqtt_async_queue_push (ctx->thread_pool->queue, INT_TO_PTR (2));
+		if (ctx->thread_pool->work_stealing) {
+			myqtt_atomic_add (&ctx->thread_pool->remove_requests, 1);
+			__myqtt_thread_pool_wake_worker (ctx->thread_pool, NULL);
+		} else
+			myqtt_async_queue_push (ctx->thread_pool->queue, INT_TO_PTR (2));
 		threads--;
 		threads_running--;
 	} /* end if */
@@ -804,7 +1649,8 @@ void myqtt_thread_pool_exit (MyQttCtx * ctx)
 	/* get current context */
 	int                    iterator;
 	MyQttThread          * thread;
-	MyQttThreadPoolTask  * task;
+	MyQttThreadPool      * pool;
+	MyQttThreadPoolWorker * worker;
 
 
 	myqtt_log (MYQTT_LEVEL_DEBUG, "stopping thread pool..");
@@ -814,9 +1660,19 @@ void myqtt_thread_pool_exit (MyQttCtx * ctx)
 	ctx->thread_pool_being_stopped = axl_true;
 	myqtt_mutex_unlock (&ctx->thread_pool->mutex);
 
+	/* wake up workers so they notice the stop flag */
+	iterator = 0;
+	while (ctx->thread_pool->work_stealing && iterator < ctx->thread_pool->workers_num) {
+		worker = ctx->thread_pool->workers[iterator];
+		myqtt_mutex_lock (&worker->mutex);
+		myqtt_cond_signal (&worker->cond);
+		myqtt_mutex_unlock (&worker->mutex);
+		iterator++;
+	} /* end while */
+
 	/* push beacons to notify eacy thread created to stop */
 	iterator = 0;
-	while (iterator < axl_list_length (ctx->thread_pool->threads)) {
+	while (! ctx->thread_pool->work_stealing && iterator < axl_list_length (ctx->thread_pool->threads)) {
 		myqtt_log (MYQTT_LEVEL_DEBUG, "pushing beacon to stop thread from the pool..");
 		/* push a notifier */
 		myqtt_async_queue_push (ctx->thread_pool->queue, INT_TO_PTR (1));
@@ -847,35 +1703,14 @@ void myqtt_thread_pool_exit (MyQttCtx * ctx)
 	} /* end if */
 
 	axl_list_free (ctx->thread_pool->threads);
-	axl_list_free (ctx->thread_pool->events);
-	axl_list_cursor_free (ctx->thread_pool->events_cursor);
 	axl_list_free (ctx->thread_pool->stopped);
 
-	/* unref the queue */
-	while (myqtt_async_queue_items (ctx->thread_pool->queue) > 0) {
-		/* call to get pending task */
-		task = myqtt_async_queue_pop (ctx->thread_pool->queue);
-
-		/* skip operating over these two values (stop beacon == 1, thread stopper == 2) */
-		if (PTR_TO_INT (task) == 1 || PTR_TO_INT (task) == 2)
-			continue;
-
-		/* if destroy function is defined, call to release */
-		if (task->destroy_data)
-			task->destroy_data (task->data);
-
-		/* release pool task data */
-		axl_free (task);
-	} /* end while */
-	myqtt_async_queue_unref (ctx->thread_pool->queue);
-
-	/* terminate mutex */
-	myqtt_mutex_destroy (&ctx->thread_pool->mutex);
-	myqtt_mutex_destroy (&(ctx->thread_pool->stopped_mutex));
-
-	/* free the node itself */
-	axl_free (ctx->thread_pool);
+	/* release the context reference: when threads were detached
+	 * (skip thread pool wait) worker slots, events and pending
+	 * tasks are released by the last dispatcher finishing */
+	pool             = ctx->thread_pool;
 	ctx->thread_pool = NULL;
+	__myqtt_thread_pool_unref (pool);
 
 	myqtt_log (MYQTT_LEVEL_DEBUG, "thread pool is stopped..");
 	return;
@@ -943,6 +1778,14 @@ axl_bool myqtt_thread_pool_new_task_full       (MyQttCtx        * ctx,
 	task->func = func;
 	task->data = data;
 	task->destroy_data = destroy_data;
+	task->next = NULL;
+	gettimeofday (&task->queued, NULL);
+
+	/* work-stealing pool */
+	if (ctx->thread_pool->work_stealing) {
+		__myqtt_thread_pool_ws_push (ctx->thread_pool, task);
+		return axl_true;
+	} /* end if */
 
 	/* queue the task for the next available thread */
 	myqtt_async_queue_push (ctx->thread_pool->queue, task);
@@ -1023,6 +1866,7 @@ int  myqtt_thread_pool_new_event           (MyQttCtx              * ctx,
 {
 	/* get current context */
 	MyQttThreadPoolEvent * event;
+	axl_bool               first = axl_false;
 
 	/* check parameters */
 	if (event_handler == NULL || ctx == NULL || ctx->thread_pool == NULL || ctx->thread_pool_being_stopped) 
@@ -1045,13 +1889,26 @@ int  myqtt_thread_pool_new_event           (MyQttCtx              * ctx,
 		/* update next step to the appropiate value */
 		__myqtt_thread_pool_increase_stamp (event);
 
-		/* add into the event event */
-		axl_list_add (ctx->thread_pool->events, event);
+		/* add into the event heap */
+		if (! __myqtt_thread_pool_heap_add (ctx->thread_pool, event)) {
+			axl_free (event);
+			event = NULL;
+		} else 
+			first = (event->index == 0);
 	} /* end if */
 
 	/* (un)lock the thread pool */
 	myqtt_mutex_unlock (&(ctx->thread_pool->mutex));
 
+	/* new event is the next one to fire: wake up a thread so it
+	 * recalculates how long to wait */
+	if (first) {
+		if (ctx->thread_pool->work_stealing)
+			__myqtt_thread_pool_wake_worker (ctx->thread_pool, NULL);
+		else
+			myqtt_async_queue_push (ctx->thread_pool->queue, INT_TO_PTR (4));
+	} /* end if */
+
 	/* in case of failure */
 	if (event == NULL)
 		return PTR_TO_INT (-1);
@@ -1072,25 +1929,23 @@ int  myqtt_thread_pool_new_event           (MyQttCtx              * ctx,
 axl_bool myqtt_thread_pool_remove_event        (MyQttCtx              * ctx,
 						 int                      event_id)
 {
-	MyQttThreadPoolEvent * event;
+	int                     iterator;
 	v_return_val_if_fail (ctx, axl_false);
 
 	/* lock the thread pool */
 	myqtt_mutex_lock (&(ctx->thread_pool->mutex));
 
-	/* reset cursor list */
-	axl_list_cursor_first (ctx->thread_pool->events_cursor);
-	while (axl_list_cursor_has_item (ctx->thread_pool->events_cursor)) {
-
-		/* get event at the current position */
-		event = axl_list_cursor_get (ctx->thread_pool->events_cursor);
+	/* look for the event (the id is not dereferenced because it
+	 * may be already released) */
+	iterator = 0;
+	while (iterator < ctx->thread_pool->events_num) {
 
-		if (PTR_TO_INT (event) == event_id) {
+		if (PTR_TO_INT (ctx->thread_pool->events[iterator]) == event_id) {
 			/* found event to remove */
-			axl_list_cursor_remove (ctx->thread_pool->events_cursor);
+			__myqtt_thread_pool_heap_remove (ctx->thread_pool, iterator);
 
 			myqtt_log (MYQTT_LEVEL_DEBUG, "Removing event id %d, total events registered after removal: %d",
-				    event_id, axl_list_length (ctx->thread_pool->events));
+				    event_id, ctx->thread_pool->events_num);
 
 			/* unlock the thread pool */
 			myqtt_mutex_unlock (&(ctx->thread_pool->mutex));
@@ -1099,7 +1954,7 @@ axl_bool myqtt_thread_pool_remove_event        (MyQttCtx              * ctx,
 		} /* end if */
 		
 		/* next position */
-		axl_list_cursor_next (ctx->thread_pool->events_cursor);
+		iterator++;
 	} /* end if */
 
 	/* unlock the thread pool */
@@ -1150,9 +2005,9 @@ void myqtt_thread_pool_stats               (MyQttCtx        * ctx,
 	if (running_threads)
 		*running_threads = axl_list_length (ctx->thread_pool->threads);
 	if (waiting_threads)
-		*waiting_threads = myqtt_async_queue_waiters (ctx->thread_pool->queue);
+		*waiting_threads = __myqtt_thread_pool_waiting (ctx->thread_pool);
 	if (pending_tasks)
-		*pending_tasks = myqtt_async_queue_items (ctx->thread_pool->queue);
+		*pending_tasks = __myqtt_thread_pool_pending (ctx->thread_pool);
 
 	/* lock the thread pool */
 	myqtt_mutex_unlock (&(ctx->thread_pool->mutex));
@@ -1179,7 +2034,7 @@ void myqtt_thread_pool_event_stats         (MyQttCtx        * ctx,
 
 	/* update values */
 	if (events_installed)
-		*events_installed = axl_list_length (ctx->thread_pool->events);
+		*events_installed = ctx->thread_pool->events_num;
 
 	/* lock the thread pool */
 	myqtt_mutex_unlock (&(ctx->thread_pool->mutex));
@@ -1187,6 +2042,188 @@ void myqtt_thread_pool_event_stats         (MyQttCtx        * ctx,
 	return;
 }
 
+/** 
+ * @brief Allows to get queue wait and run time histograms of tasks
+ * executed by the thread pool.
+ *
+ * Each histogram has \ref MYQTT_THREAD_POOL_HISTOGRAM_BUCKETS
+ * buckets counting tasks by microseconds: bucket 0 counts tasks under
+ * 1us, bucket n counts tasks in [2^(n-1), 2^n) us and the last bucket
+ * counts the rest. Counters are updated without locks and they are
+ * never reset (compare two calls to get rates). See also \ref
+ * myqtt_thread_pool_histogram_percentile.
+ *
+ * @param ctx The context where the thread pool is running.
+ *
+ * @param queue_wait Optional array (of \ref
+ * MYQTT_THREAD_POOL_HISTOGRAM_BUCKETS items) where to copy how long
+ * tasks waited since queued until a thread picked them.
+ *
+ * @param run_time Optional array (of \ref
+ * MYQTT_THREAD_POOL_HISTOGRAM_BUCKETS items) where to copy how long
+ * tasks took to run.
+ *
+ * @return Tasks executed (sum of run_time histogram) or -1 if ctx is
+ * NULL or has no thread pool.
+ */
+long long myqtt_thread_pool_latency_stats  (MyQttCtx        * ctx,
+					     long long       * queue_wait,
+					     long long       * run_time)
+{
+	int       iterator;
+	long long value;
+	long long tasks = 0;
+
+	if (ctx == NULL || ctx->thread_pool == NULL)
+		return -1;
+
+	iterator = 0;
+	while (iterator < MYQTT_THREAD_POOL_HISTOGRAM_BUCKETS) {
+		if (queue_wait)
+			queue_wait[iterator] = myqtt_atomic_get64 (&ctx->thread_pool->queue_wait[iterator]);
+		value  = myqtt_atomic_get64 (&ctx->thread_pool->run_time[iterator]);
+		tasks += value;
+		if (run_time)
+			run_time[iterator] = value;
+		iterator++;
+	} /* end while */
+
+	return tasks;
+}
+
+/** 
+ * @brief Returns the percentile (approximated to the upper bound of
+ * its bucket, in microseconds) of an histogram reported by \ref
+ * myqtt_thread_pool_latency_stats.
+ *
+ * @param histogram The histogram (of \ref
+ * MYQTT_THREAD_POOL_HISTOGRAM_BUCKETS items).
+ *
+ * @param percentile The percentile to get (1..100).
+ *
+ * @return The upper bound in microseconds, 0 if the histogram is
+ * empty or -1 for wrong parameters.
+ */
+long myqtt_thread_pool_histogram_percentile (const long long * histogram,
+					     int               percentile)
+{
+	long long total = 0;
+	long long count = 0;
+	int       iterator;
+
+	if (histogram == NULL || percentile <= 0 || percentile > 100)
+		return -1;
+
+	iterator = 0;
+	while (iterator < MYQTT_THREAD_POOL_HISTOGRAM_BUCKETS) {
+		total += histogram[iterator];
+		iterator++;
+	} /* end while */
+	if (total == 0)
+		return 0;
+
+	iterator = 0;
+	while (iterator < MYQTT_THREAD_POOL_HISTOGRAM_BUCKETS) {
+		count += histogram[iterator];
+		if (count * 100 >= total * percentile)
+			break;
+		iterator++;
+	} /* end while */
+
+	if (iterator >= MYQTT_THREAD_POOL_HISTOGRAM_BUCKETS)
+		iterator = MYQTT_THREAD_POOL_HISTOGRAM_BUCKETS - 1;
+	return 1L << iterator;
+}
+
+/** 
+ * @brief Allows to get how busy each thread from the pool was since
+ * the last call to this function (or since it started).
+ *
+ * @param ctx The context where the thread pool is running.
+ *
+ * @param ratios Array where busy ratio (0..100 percent) of each
+ * thread is placed.
+ *
+ * @param max Number of items available in ratios.
+ *
+ * @return Number of ratios reported or -1 if ctx is NULL or has no
+ * thread pool.
+ */
+int  myqtt_thread_pool_busy_stats          (MyQttCtx        * ctx,
+					     int             * ratios,
+					     int               max)
+{
+	MyQttThreadPoolWorker * worker;
+	struct timeval          now;
+	struct timeval          diff;
+	long long               busy;
+	long long               elapsed;
+	int                     iterator;
+	int                     count = 0;
+
+	if (ctx == NULL || ctx->thread_pool == NULL || ratios == NULL)
+		return -1;
+
+	/* lock to serialize readers (workers do not lock to update) */
+	myqtt_mutex_lock (&(ctx->thread_pool->mutex));
+	gettimeofday (&now, NULL);
+	iterator = 0;
+	while (iterator < ctx->thread_pool->workers_num && count < max) {
+		worker = ctx->thread_pool->workers[iterator];
+		iterator++;
+		if (myqtt_atomic_get (&worker->exited))
+			continue;
+
+		busy    = myqtt_atomic_get64 (&worker->busy);
+		myqtt_timeval_substract (&now, &worker->last, &diff);
+		elapsed = diff.tv_sec * 1000000 + diff.tv_usec;
+
+		ratios[count] = elapsed > 0 ? (int) (((busy - worker->busy_last) * 100) / elapsed) : 0;
+		if (ratios[count] > 100)
+			ratios[count] = 100;
+		count++;
+
+		/* next window */
+		worker->busy_last = busy;
+		worker->last      = now;
+	} /* end while */
+	myqtt_mutex_unlock (&(ctx->thread_pool->mutex));
+
+	return count;
+}
+
+/** 
+ * @brief Allows to get counters about automatic resize decisions (see
+ * \ref myqtt_thread_pool_setup).
+ *
+ * @param ctx The context where the thread pool is running.
+ *
+ * @param checks Optional: times the pool status was checked.
+ *
+ * @param added Optional: times threads were added.
+ *
+ * @param removed Optional: times threads were removed.
+ *
+ * @param limit_reached Optional: times threads were required but max
+ * limit was reached.
+ */
+void myqtt_thread_pool_resize_stats        (MyQttCtx        * ctx,
+					     long long       * checks,
+					     long long       * added,
+					     long long       * removed,
+					     long long       * limit_reached)
+{
+	if (checks)
+		*checks = ctx && ctx->thread_pool ? myqtt_atomic_get64 (&ctx->thread_pool->resize_checks) : -1;
+	if (added)
+		*added = ctx && ctx->thread_pool ? myqtt_atomic_get64 (&ctx->thread_pool->resize_added) : -1;
+	if (removed)
+		*removed = ctx && ctx->thread_pool ? myqtt_atomic_get64 (&ctx->thread_pool->resize_removed) : -1;
+	if (limit_reached)
+		*limit_reached = ctx && ctx->thread_pool ? myqtt_atomic_get64 (&ctx->thread_pool->resize_limit_reached) : -1;
+	return;
+}
+
 /**
  * @brief Returns the running threads the given pool have.
  * 
@@ -1301,6 +2338,39 @@ void myqtt_thread_pool_set_exclusive_pool  (MyQttCtx * ctx,
 
 	return;
 }
+
+/** 
+ * @brief Allows to select the work-stealing thread pool.
+ *
+ * By default, all threads in the pool take their tasks from a single
+ * shared queue. With work-stealing enabled, each thread has its own
+ * deque: tasks queued from inside a pool thread are placed on that
+ * thread's deque, tasks queued from outside are handed to an idle
+ * thread (or left on a global injection queue when all are busy),
+ * and idle threads steal work from busy ones. This reduces contention
+ * on the shared queue when there are many threads and tasks are short.
+ *
+ * The work-stealing pool supports up to 256 threads.
+ *
+ * This function must be called before \ref myqtt_init_ctx to take
+ * effect (the mode is selected at \ref myqtt_thread_pool_init).
+ *
+ * @param ctx The context where the operation will be performed.
+ *
+ * @param value axl_true to use the work-stealing pool, axl_false to
+ * use the shared queue pool (default).
+ */
+void myqtt_thread_pool_set_work_stealing   (MyQttCtx * ctx,
+					    axl_bool    value)
+{
+	if (ctx == NULL)
+		return;
+
+	/* set the new value */
+	ctx->thread_pool_work_stealing = value;
+
+	return;
+}
        
 
 /* @} */
@@ -93,6 +93,29 @@ void myqtt_thread_pool_stats               (MyQttCtx        * ctx,
 					     int              * waiting_threads,
 					     int              * pending_tasks);
 
+/** 
+ * @brief Number of buckets of histograms reported by \ref
+ * myqtt_thread_pool_latency_stats (last one counts values over ~4s).
+ */
+#define MYQTT_THREAD_POOL_HISTOGRAM_BUCKETS 24
+
+long long myqtt_thread_pool_latency_stats  (MyQttCtx        * ctx,
+					     long long       * queue_wait,
+					     long long       * run_time);
+
+long myqtt_thread_pool_histogram_percentile (const long long * histogram,
+					     int               percentile);
+
+int  myqtt_thread_pool_busy_stats          (MyQttCtx        * ctx,
+					     int             * ratios,
+					     int               max);
+
+void myqtt_thread_pool_resize_stats        (MyQttCtx        * ctx,
+					     long long       * checks,
+					     long long       * added,
+					     long long       * removed,
+					     long long       * limit_reached);
+
 void myqtt_thread_pool_event_stats         (MyQttCtx        * ctx,
 					     int              * events_installed);
 
@@ -102,6 +125,9 @@ void myqtt_thread_pool_set_num             (int  number);
 
 int  myqtt_thread_pool_get_num             (void);
 
+void myqtt_thread_pool_set_work_stealing   (MyQttCtx        * ctx,
+					    axl_bool          value);
+
 void myqtt_thread_pool_set_exclusive_pool  (MyQttCtx        * ctx,
 					     axl_bool         value);
 
@@ -113,6 +139,9 @@ void myqtt_thread_pool_remove_internal     (MyQttCtx        * ctx,
 
 void __myqtt_thread_pool_automatic_resize  (MyQttCtx * ctx);
 
+void __myqtt_thread_pool_histogram_add     (long long       * histogram,
+					     long              value);
+
 END_C_DECLS
 
 #endif
@@ -36,10 +36,28 @@
  *         info@aspl.es - http://www.aspl.es/mqtt
  *                        http://www.aspl.es/myqtt
  */
+#if defined(MYQTT_HAVE_AFFINITY) && ! defined(_GNU_SOURCE)
+/* required to get pthread_setaffinity_np (3) and cpu_set_t */
+#define _GNU_SOURCE
+#endif
 #include <myqtt.h>
 
+/* local include */
+#include <myqtt-ctx-private.h>
+
 #define LOG_DOMAIN "myqtt-thread"
 
+/* max cpu number handled by myqtt_thread_set_cpus */
+#define MYQTT_THREAD_MAX_CPUS 1024
+
+#if defined(MYQTT_HAVE_AFFINITY)
+/* affinity found when the first context was created (restored on
+ * thread classes without cpu set, see __myqtt_thread_init_cpus) */
+cpu_set_t       __myqtt_thread_startup_cpus;
+axl_bool        __myqtt_thread_startup_cpus_found = axl_false;
+pthread_once_t  __myqtt_thread_startup_cpus_once  = PTHREAD_ONCE_INIT;
+#endif
+
 /** 
  * \defgroup myqtt_thread MyQtt Thread: Portable threading API for myqtt
  */
@@ -409,6 +427,234 @@ void myqtt_thread_set_destroy (MyQttThreadDestroyFunc destroy_fn)
 		__myqtt_thread_destroy = myqtt_thread_destroy_internal;
 }
 
+/** 
+ * @internal Parses a cpu list ("0-3,8,10-11") into the mask provided
+ * (one byte per cpu, MYQTT_THREAD_MAX_CPUS entries).
+ *
+ * @return axl_true if the list is valid and has at least one cpu.
+ */
+axl_bool __myqtt_thread_parse_cpus (const char * cpus, char * mask)
+{
+	const char * cursor = cpus;
+	char       * end;
+	long         first;
+	long         last;
+	axl_bool     found  = axl_false;
+
+	memset (mask, 0, MYQTT_THREAD_MAX_CPUS);
+	while (*cursor) {
+		/* skip separators */
+		while (*cursor == ' ' || *cursor == ',')
+			cursor++;
+		if (*cursor == 0)
+			break;
+
+		/* get first cpu and optional range end */
+		first = strtol (cursor, &end, 10);
+		if (end == cursor || first < 0 || first >= MYQTT_THREAD_MAX_CPUS)
+			return axl_false;
+		last   = first;
+		cursor = end;
+		if (*cursor == '-') {
+			cursor++;
+			last = strtol (cursor, &end, 10);
+			if (end == cursor || last < first || last >= MYQTT_THREAD_MAX_CPUS)
+				return axl_false;
+			cursor = end;
+		} /* end if */
+
+		if (*cursor != 0 && *cursor != ',' && *cursor != ' ')
+			return axl_false;
+
+		while (first <= last) {
+			mask[first] = 1;
+			found       = axl_true;
+			first++;
+		} /* end while */
+	} /* end while */
+
+	return found;
+}
+
+#if defined(MYQTT_HAVE_AFFINITY)
+void __myqtt_thread_startup_cpus_capture (void)
+{
+	__myqtt_thread_startup_cpus_found = (pthread_getaffinity_np (pthread_self (), sizeof (cpu_set_t), &__myqtt_thread_startup_cpus) == 0);
+	return;
+}
+#endif
+
+/** 
+ * @internal Captures the affinity of the process the first time a
+ * context is created (called from myqtt_ctx_new), so thread classes
+ * whose cpu set is removed go back to it.
+ */
+void __myqtt_thread_init_cpus (void)
+{
+#if defined(MYQTT_HAVE_AFFINITY)
+	pthread_once (&__myqtt_thread_startup_cpus_once, __myqtt_thread_startup_cpus_capture);
+#endif
+	return;
+}
+
+/** 
+ * @internal Pins the calling thread to the cpu set configured for its
+ * class (or to the affinity found at startup when none is
+ * configured).
+ *
+ * Memory allocated by the thread after this call is first touched on
+ * its local NUMA node (kernel default policy), so this is called when
+ * threads start, before they allocate their own state.
+ */
+axl_bool __myqtt_thread_apply_cpus (MyQttCtx * ctx, MyQttThreadClass thread_class)
+{
+#if defined(MYQTT_HAVE_AFFINITY)
+	cpu_set_t   set;
+	char        mask[MYQTT_THREAD_MAX_CPUS];
+	char      * cpus;
+	axl_bool    configured = axl_false;
+	int         iterator;
+	int         rc;
+
+	cpus = myqtt_thread_get_cpus (ctx, thread_class);
+	if (cpus)
+		configured = __myqtt_thread_parse_cpus (cpus, mask);
+
+	CPU_ZERO (&set);
+	if (configured) {
+		iterator = 0;
+		while (iterator < MYQTT_THREAD_MAX_CPUS && iterator < CPU_SETSIZE) {
+			if (mask[iterator])
+				CPU_SET (iterator, &set);
+			iterator++;
+		} /* end while */
+	} else if (__myqtt_thread_startup_cpus_found) {
+		/* restore affinity found at startup */
+		memcpy (&set, &__myqtt_thread_startup_cpus, sizeof (cpu_set_t));
+	} else {
+		iterator = 0;
+		while (iterator < CPU_SETSIZE) {
+			CPU_SET (iterator, &set);
+			iterator++;
+		} /* end while */
+	} /* end if */
+
+	rc = pthread_setaffinity_np (pthread_self (), sizeof (cpu_set_t), &set);
+	if (rc != 0) {
+		myqtt_log (MYQTT_LEVEL_WARNING, "unable to set cpu affinity for thread class %d (%s): %s",
+			   thread_class, configured ? cpus : "startup", strerror (rc));
+		axl_free (cpus);
+		return axl_false;
+	} /* end if */
+
+	myqtt_log (MYQTT_LEVEL_DEBUG, "thread class %d pinned to cpus: %s", 
+		   thread_class, configured ? cpus : "startup");
+	axl_free (cpus);
+	return axl_true;
+#else
+	return axl_false;
+#endif
+}
+
+/** 
+ * @internal Applies the cpu set configured for the thread class if
+ * the configuration changed since the generation provided (0 when
+ * the thread starts).
+ *
+ * @return axl_true if the thread was pinned.
+ */
+axl_bool __myqtt_thread_check_cpus (MyQttCtx * ctx, MyQttThreadClass thread_class, int * gen)
+{
+	int current = myqtt_atomic_get (&ctx->thread_cpus_gen[thread_class]);
+
+	/* nothing changed */
+	if (current == *gen)
+		return axl_false;
+
+	*gen = current;
+	return __myqtt_thread_apply_cpus (ctx, thread_class);
+}
+
+/** 
+ * @brief Allows to pin a class of threads created by the library
+ * (reader, sequencer or thread pool) to a set of cpus.
+ *
+ * The cpu set is provided as a list of cpus and ranges, for example:
+ * "0-3,8". Threads apply it when they start (before allocating their
+ * own state, so memory they allocate stays on the local NUMA node)
+ * and running threads apply it shortly after it changes, so it can be
+ * configured before or after \ref myqtt_init_ctx.
+ *
+ * @param ctx The context where the operation will be performed.
+ *
+ * @param thread_class The class of threads to configure.
+ *
+ * @param cpus The list of cpus. NULL or empty string removes the
+ * configuration (threads go back to the affinity the process had
+ * when the first context was created).
+ *
+ * @return axl_true if the cpu set was configured. The function
+ * returns axl_false when wrong parameters are received or when the
+ * platform does not support thread affinity.
+ */
+axl_bool myqtt_thread_set_cpus (MyQttCtx         * ctx, 
+				MyQttThreadClass   thread_class,
+				const char       * cpus)
+{
+	char mask[MYQTT_THREAD_MAX_CPUS];
+
+	if (ctx == NULL || thread_class < MYQTT_THREAD_READER || thread_class > MYQTT_THREAD_POOL)
+		return axl_false;
+
+	/* check the list before accepting it */
+	if (cpus && strlen (cpus) > 0 && ! __myqtt_thread_parse_cpus (cpus, mask)) {
+		myqtt_log (MYQTT_LEVEL_CRITICAL, "wrong cpu list received for thread class %d: %s", thread_class, cpus);
+		return axl_false;
+	} /* end if */
+
+	myqtt_mutex_lock (&ctx->thread_cpus_mutex);
+	axl_free (ctx->thread_cpus[thread_class]);
+	ctx->thread_cpus[thread_class] = (cpus && strlen (cpus) > 0) ? axl_strdup (cpus) : NULL;
+	myqtt_mutex_unlock (&ctx->thread_cpus_mutex);
+
+	/* notify running threads of this class */
+	myqtt_atomic_add (&ctx->thread_cpus_gen[thread_class], 1);
+
+#if defined(MYQTT_HAVE_AFFINITY)
+	return axl_true;
+#else
+	myqtt_log (MYQTT_LEVEL_WARNING, "thread affinity is not supported on this platform, ignoring cpu list for thread class %d", thread_class);
+	return axl_false;
+#endif
+}
+
+/** 
+ * @brief Returns the cpu set configured for the thread class (see
+ * \ref myqtt_thread_set_cpus).
+ *
+ * @param ctx The context where the operation will be performed.
+ *
+ * @param thread_class The class of threads.
+ *
+ * @return A copy of the cpu list configured (release it with
+ * axl_free) or NULL if none was configured.
+ */
+char       * myqtt_thread_get_cpus (MyQttCtx         * ctx, 
+				    MyQttThreadClass   thread_class)
+{
+	char * result = NULL;
+
+	if (ctx == NULL || thread_class < MYQTT_THREAD_READER || thread_class > MYQTT_THREAD_POOL)
+		return NULL;
+
+	myqtt_mutex_lock (&ctx->thread_cpus_mutex);
+	if (ctx->thread_cpus[thread_class])
+		result = axl_strdup (ctx->thread_cpus[thread_class]);
+	myqtt_mutex_unlock (&ctx->thread_cpus_mutex);
+
+	return result;
+}
+
 /** 
  * @brief Allows to create a new mutex to protect critical sections to
  * be executed by several threads at the same time.
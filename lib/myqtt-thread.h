@@ -60,6 +60,19 @@ void               myqtt_thread_set_create (MyQttThreadCreateFunc  create_fn);
 
 void               myqtt_thread_set_destroy(MyQttThreadDestroyFunc destroy_fn);
 
+axl_bool           myqtt_thread_set_cpus (MyQttCtx         * ctx, 
+					   MyQttThreadClass   thread_class,
+					   const char       * cpus);
+
+char             * myqtt_thread_get_cpus (MyQttCtx         * ctx, 
+					   MyQttThreadClass   thread_class);
+
+void               __myqtt_thread_init_cpus (void);
+
+axl_bool           __myqtt_thread_check_cpus (MyQttCtx         * ctx, 
+					       MyQttThreadClass   thread_class,
+					       int              * gen);
+
 axl_bool           myqtt_mutex_create    (MyQttMutex       * mutex_def);
 
 axl_bool           myqtt_mutex_destroy   (MyQttMutex       * mutex_def);
@@ -68,6 +81,70 @@ void               myqtt_mutex_lock      (MyQttMutex       * mutex_def);
 
 void               myqtt_mutex_unlock    (MyQttMutex       * mutex_def);
 
+/** 
+ * @brief Atomically adds value to the int pointed by ptr, returning
+ * the resulting value (full acquire/release barrier).
+ *
+ * @param ptr Reference to the int to update.
+ * @param value The value to add (use negative values to subtract).
+ */
+#if defined(_MSC_VER)
+#define myqtt_atomic_add(ptr, value) (InterlockedExchangeAdd ((volatile LONG *) (ptr), (value)) + (value))
+#else
+#define myqtt_atomic_add(ptr, value) __atomic_add_fetch ((ptr), (value), __ATOMIC_ACQ_REL)
+#endif
+
+/** 
+ * @brief Atomically reads the int pointed by ptr.
+ *
+ * @param ptr Reference to the int to read.
+ */
+#if defined(_MSC_VER)
+#define myqtt_atomic_get(ptr) InterlockedCompareExchange ((volatile LONG *) (ptr), 0, 0)
+#else
+#define myqtt_atomic_get(ptr) __atomic_load_n ((ptr), __ATOMIC_ACQUIRE)
+#endif
+
+/** 
+ * @brief Atomically replaces the int pointed by ptr with value if it
+ * still holds expected (full barrier).
+ *
+ * @param ptr Reference to the int to update.
+ * @param expected The value ptr must hold.
+ * @param value The new value.
+ *
+ * @return axl_true if the value was replaced.
+ */
+#if defined(_MSC_VER)
+#define myqtt_atomic_cas(ptr, expected, value) (InterlockedCompareExchange ((volatile LONG *) (ptr), (value), (expected)) == (expected))
+#else
+#define myqtt_atomic_cas(ptr, expected, value) __sync_bool_compare_and_swap ((ptr), (expected), (value))
+#endif
+
+/** 
+ * @brief Same as \ref myqtt_atomic_add but for long long counters
+ * (64 bits on all platforms).
+ *
+ * @param ptr Reference to the long long to update.
+ * @param value The value to add (use negative values to subtract).
+ */
+#if defined(_MSC_VER)
+#define myqtt_atomic_add64(ptr, value) (InterlockedExchangeAdd64 ((volatile LONGLONG *) (ptr), (value)) + (value))
+#else
+#define myqtt_atomic_add64(ptr, value) __atomic_add_fetch ((ptr), (long long) (value), __ATOMIC_ACQ_REL)
+#endif
+
+/** 
+ * @brief Same as \ref myqtt_atomic_get but for long long counters.
+ *
+ * @param ptr Reference to the long long to read.
+ */
+#if defined(_MSC_VER)
+#define myqtt_atomic_get64(ptr) InterlockedCompareExchange64 ((volatile LONGLONG *) (ptr), 0, 0)
+#else
+#define myqtt_atomic_get64(ptr) __atomic_load_n ((ptr), __ATOMIC_ACQUIRE)
+#endif
+
 axl_bool           myqtt_cond_create     (MyQttCond        * cond);
 
 void               myqtt_cond_signal     (MyQttCond        * cond);
@@ -166,6 +166,12 @@ typedef struct _MyQttHash MyQttHash;
  */
 typedef struct _MyQttConnOpts MyQttConnOpts;
 
+/** 
+ * @brief Set of handlers implementing a storage driver (see \ref
+ * myqtt_storage_set_backend).
+ */
+typedef struct _MyQttStorageBackend MyQttStorageBackend;
+
 /** 
  * @brief MyQtt Operation Status.
  * 
@@ -526,6 +532,25 @@ typedef enum  {
 	MYQTT_THREAD_CONF_DETACHED = 2,
 }MyQttThreadConf;
 
+/** 
+ * @brief Thread classes created by the library that can be pinned to
+ * a CPU set (see \ref myqtt_thread_set_cpus).
+ */
+typedef enum {
+	/** 
+	 * @brief Reader thread (I/O loop).
+	 */
+	MYQTT_THREAD_READER    = 1,
+	/** 
+	 * @brief Sequencer thread (outbound delivery).
+	 */
+	MYQTT_THREAD_SEQUENCER = 2,
+	/** 
+	 * @brief Threads from the thread pool.
+	 */
+	MYQTT_THREAD_POOL      = 3,
+} MyQttThreadClass;
+
 /** 
  * @brief Enumeration type that allows to use the waiting mechanism to
  * be used by the core library to perform wait on changes on sockets
@@ -888,8 +913,116 @@ typedef enum {
 	
 } MyQttStorage;
 
+/** 
+ * @brief Built-in storage drivers that can be selected for a
+ * context using \ref myqtt_storage_use.
+ */
+typedef enum {
+	/** 
+	 * @brief Default storage driver: sessions, messages and
+	 * retained messages are stored on the local filesystem under
+	 * the path configured by \ref myqtt_storage_set_path.
+	 */
+	MYQTT_STORAGE_TYPE_FILE   = 1,
+	/** 
+	 * @brief In-memory storage driver: everything is kept in RAM
+	 * and lost when the context is released. Useful for
+	 * deployments that do not need durability and for testing.
+	 */
+	MYQTT_STORAGE_TYPE_MEMORY = 2,
+	/** 
+	 * @brief A user defined driver installed with \ref
+	 * myqtt_storage_set_backend.
+	 */
+	MYQTT_STORAGE_TYPE_CUSTOM = 3
+} MyQttStorageType;
+
+/** 
+ * @brief Compression methods that can be applied to payloads stored
+ * (see \ref myqtt_storage_set_compression).
+ */
+typedef enum {
+	/** 
+	 * @brief Payloads are stored as received (default).
+	 */
+	MYQTT_STORAGE_COMPRESSION_NONE = 0,
+	/** 
+	 * @brief Payloads are compressed with LZ4 (only available
+	 * when the library was built with lz4 support).
+	 */
+	MYQTT_STORAGE_COMPRESSION_LZ4  = 1
+} MyQttStorageCompression;
+
+/** 
+ * @brief Counters tracked by the metrics registry of each context
+ * (see \ref myqtt_metrics_get). All of them are totals since the
+ * context was created.
+ */
+typedef enum {
+	/** 
+	 * @brief Incoming connections accepted (CONNACK accepted sent).
+	 */
+	MYQTT_METRIC_CONNS_ACCEPTED     = 0,
+	/** 
+	 * @brief Accepted incoming connections that were closed.
+	 */
+	MYQTT_METRIC_CONNS_CLOSED       = 1,
+	/** 
+	 * @brief PUBLISH messages received with QoS 0.
+	 */
+	MYQTT_METRIC_MSGS_RECEIVED_QOS0 = 2,
+	/** 
+	 * @brief PUBLISH messages received with QoS 1.
+	 */
+	MYQTT_METRIC_MSGS_RECEIVED_QOS1 = 3,
+	/** 
+	 * @brief PUBLISH messages received with QoS 2.
+	 */
+	MYQTT_METRIC_MSGS_RECEIVED_QOS2 = 4,
+	/** 
+	 * @brief PUBLISH messages sent with QoS 0 (\ref myqtt_conn_pub).
+	 */
+	MYQTT_METRIC_MSGS_SENT_QOS0     = 5,
+	/** 
+	 * @brief PUBLISH messages sent with QoS 1 (\ref myqtt_conn_pub).
+	 */
+	MYQTT_METRIC_MSGS_SENT_QOS1     = 6,
+	/** 
+	 * @brief PUBLISH messages sent with QoS 2 (\ref myqtt_conn_pub).
+	 */
+	MYQTT_METRIC_MSGS_SENT_QOS2     = 7,
+	/** 
+	 * @brief Bytes read from all connections.
+	 */
+	MYQTT_METRIC_BYTES_RECEIVED     = 8,
+	/** 
+	 * @brief Bytes written to all connections.
+	 */
+	MYQTT_METRIC_BYTES_SENT         = 9,
+	/** 
+	 * @brief Messages that were not delivered or queued: discarded
+	 * by the on publish handler or failed to be sent or queued to
+	 * a subscriber.
+	 */
+	MYQTT_METRIC_MSGS_DROPPED       = 10,
+	/** 
+	 * @brief Messages queued for offline subscribers.
+	 */
+	MYQTT_METRIC_MSGS_QUEUED        = 11,
+	/** 
+	 * @brief Number of counters (not a counter).
+	 */
+	MYQTT_METRIC_COUNTERS           = 12
+} MyQttMetric;
+
 /***** INTERNAL TYPES: don't use them because they may change at any time without change API notification ****/
 
+/** 
+ * @internal Max size of packets that can be placed inside
+ * MyQttSequencerData (see myqtt_sequencer_send_inline).
+ */
+#define MYQTT_SEQUENCER_INLINE_SIZE 8
+
 /** 
  * @internal
  */
@@ -924,6 +1057,19 @@ typedef struct _MyQttSequencerData {
 	 */
 	MyQttMsgType         type;
 
+	/** 
+	 * @brief Buffer used to hold small control packets (acks,
+	 * PINGRESP) so they don't require a separate allocation (see
+	 * myqtt_sequencer_send_inline).
+	 */
+	unsigned char        inline_message[MYQTT_SEQUENCER_INLINE_SIZE];
+
+	/** 
+	 * @brief Bytes sent are not accounted on context metrics
+	 * (message queued while publishing $SYS topics).
+	 */
+	axl_bool             skip_metrics;
+
 } MyQttSequencerData;
 
 /**
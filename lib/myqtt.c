@@ -81,6 +81,27 @@ void __myqtt_sigpipe_do_nothing (int _signal)
 }
 #endif
 
+/** 
+ * @internal Returns levels reported on the provided context
+ * according to log status, handler and filter configured (checking
+ * MYQTT_DEBUG and MYQTT_DEBUG_FILTER when they were not). Called by
+ * myqtt_init_ctx and by log setters, never from the log path.
+ */
+int __myqtt_log_levels (MyQttCtx * ctx)
+{
+	int levels = MYQTT_LOG_LEVELS_ALL;
+
+	/* nothing is reported */
+	if (! myqtt_log_is_enabled (ctx) && ctx->debug_handler == NULL) 
+		return 0;
+
+	/* remove filtered levels */
+	if (myqtt_log_filter_is_enabled (ctx))
+		levels &= ~ctx->debug_filter;
+
+	return levels;
+}
+
 /** 
  * @brief Allows to get current status for log debug info to console.
  * 
@@ -161,6 +182,7 @@ void     myqtt_log_enable       (MyQttCtx * ctx, axl_bool      status)
 
 	ctx->debug         = status;
 	ctx->debug_checked = axl_true;
+	ctx->log_levels    = __myqtt_log_levels (ctx);
 	return;
 #else
 	/* just return */
@@ -289,6 +311,7 @@ void     myqtt_log_filter_level (MyQttCtx * ctx, const char * filter_string)
 	/* enable all levels */
 	if (filter_string == NULL) {
 		ctx->debug_filter_is_enabled = axl_false;
+		ctx->log_levels              = __myqtt_log_levels (ctx);
 		return;
 	} /* end if */
 
@@ -302,6 +325,7 @@ void     myqtt_log_filter_level (MyQttCtx * ctx, const char * filter_string)
 
 	/* set as enabled */
 	ctx->debug_filter_is_enabled = axl_true;
+	ctx->log_levels              = __myqtt_log_levels (ctx);
 	return;
 }
 
@@ -328,6 +352,34 @@ axl_bool    myqtt_log_filter_is_enabled (MyQttCtx * ctx)
 	return ctx->debug_filter_is_enabled;
 }
 
+/** 
+ * @brief Allows to check if a log with the provided level would be
+ * reported on the provided context (console log or handler enabled
+ * and level not filtered).
+ *
+ * myqtt_log calls it before evaluating its arguments so disabled
+ * logs only cost a branch. The value is updated when log settings
+ * change (\ref myqtt_log_enable, \ref myqtt_log_set_handler and
+ * \ref myqtt_log_filter_level).
+ *
+ * @param ctx The context where the check is done.
+ *
+ * @param level The log level to check.
+ *
+ * @return axl_true if the level is reported, otherwise axl_false.
+ */
+axl_bool    myqtt_log_level_enabled (MyQttCtx * ctx, MyQttDebugLevel level)
+{
+#ifdef ENABLE_MYQTT_LOG	
+	/* logs without context are always reported */
+	if (ctx == NULL)
+		return axl_true;
+	return (ctx->log_levels & level) != 0;
+#else
+	return axl_false;
+#endif
+}
+
 /** 
  * @brief Allows to get a myqtt configuration, providing a valid
  * myqtt item.
@@ -412,6 +464,33 @@ axl_bool       myqtt_conf_get             (MyQttCtx      * ctx,
 	case MYQTT_SKIP_THREAD_POOL_WAIT:
 		*value = ctx->skip_thread_pool_wait;
 		return axl_true;
+	case MYQTT_LISTENER_ACCEPT_BATCH:
+		*value = ctx->listener_accept_batch;
+		return axl_true;
+	case MYQTT_LISTENER_REUSE_PORT:
+		*value = ctx->listener_reuse_port;
+		return axl_true;
+	case MYQTT_LISTENER_SNDBUF:
+	case MYQTT_LISTENER_RCVBUF:
+	case MYQTT_LISTENER_DEFER_ACCEPT:
+	case MYQTT_LISTENER_FASTOPEN:
+	case MYQTT_LISTENER_BUSY_POLL:
+	case MYQTT_LISTENER_USER_TIMEOUT:
+	case MYQTT_LISTENER_NOTSENT_LOWAT:
+		*value = ctx->listener_sock_opts[item - MYQTT_LISTENER_SNDBUF];
+		return axl_true;
+	case MYQTT_CONN_QUEUE_HIGH_WATERMARK:
+		*value = ctx->conn_queue_high;
+		return axl_true;
+	case MYQTT_CONN_QUEUE_LOW_WATERMARK:
+		*value = ctx->conn_queue_low;
+		return axl_true;
+	case MYQTT_CTX_QUEUE_HIGH_WATERMARK:
+		*value = ctx->ctx_queue_high;
+		return axl_true;
+	case MYQTT_CTX_QUEUE_LOW_WATERMARK:
+		*value = ctx->ctx_queue_low;
+		return axl_true;
 	default:
 		/* configuration found, return axl_false */
 		myqtt_log (MYQTT_LEVEL_CRITICAL, "found a requested for a non existent configuration item");
@@ -523,6 +602,41 @@ axl_bool       myqtt_conf_set             (MyQttCtx      * ctx,
 	case MYQTT_SKIP_THREAD_POOL_WAIT:
 		ctx->skip_thread_pool_wait = value;
 		return axl_true;
+	case MYQTT_LISTENER_ACCEPT_BATCH:
+		/* at least one connection per notification */
+		if (value < 1)
+			return axl_false;
+		ctx->listener_accept_batch = value;
+		return axl_true;
+	case MYQTT_LISTENER_REUSE_PORT:
+		ctx->listener_reuse_port = value;
+		return axl_true;
+	case MYQTT_LISTENER_SNDBUF:
+	case MYQTT_LISTENER_RCVBUF:
+	case MYQTT_LISTENER_DEFER_ACCEPT:
+	case MYQTT_LISTENER_FASTOPEN:
+	case MYQTT_LISTENER_BUSY_POLL:
+	case MYQTT_LISTENER_USER_TIMEOUT:
+	case MYQTT_LISTENER_NOTSENT_LOWAT:
+		if (value < 0)
+			return axl_false;
+		ctx->listener_sock_opts[item - MYQTT_LISTENER_SNDBUF] = value;
+		return axl_true;
+	case MYQTT_CONN_QUEUE_HIGH_WATERMARK:
+	case MYQTT_CONN_QUEUE_LOW_WATERMARK:
+	case MYQTT_CTX_QUEUE_HIGH_WATERMARK:
+	case MYQTT_CTX_QUEUE_LOW_WATERMARK:
+		if (value < 0)
+			return axl_false;
+		if (item == MYQTT_CONN_QUEUE_HIGH_WATERMARK)
+			ctx->conn_queue_high = value;
+		else if (item == MYQTT_CONN_QUEUE_LOW_WATERMARK)
+			ctx->conn_queue_low = value;
+		else if (item == MYQTT_CTX_QUEUE_HIGH_WATERMARK)
+			ctx->ctx_queue_high = value;
+		else
+			ctx->ctx_queue_low = value;
+		return axl_true;
 	default:
 		/* configuration found, return axl_false */
 		myqtt_log (MYQTT_LEVEL_CRITICAL, "found a requested for a non existent configuration item");
@@ -608,6 +722,7 @@ void     myqtt_log_set_handler      (MyQttCtx        * ctx,
 	/* configure status */
 	ctx->debug_handler = handler;
 	ctx->debug_handler_user_data = user_data;
+	ctx->log_levels    = __myqtt_log_levels (ctx);
 
 	return;
 }
@@ -901,11 +1016,13 @@ axl_bool    myqtt_init_ctx (MyQttCtx * ctx)
 	if (myqtt_init_check (ctx)) 
 		return axl_true;
 
+	/* levels checked by myqtt_log (environment included) */
+	ctx->log_levels = __myqtt_log_levels (ctx);
+
 	/**** myqtt_io.c: init io module */
 	myqtt_io_init (ctx);
 
 	/**** myqtt.c: init global mutex *****/
-	myqtt_mutex_create (&ctx->msg_id_mutex);
 	myqtt_mutex_create (&ctx->connection_id_mutex);
 	myqtt_mutex_create (&ctx->listener_mutex);
 	myqtt_mutex_create (&ctx->listener_unlock);
@@ -1083,6 +1200,12 @@ void myqtt_exit_ctx (MyQttCtx * ctx, axl_bool  free_ctx)
 	/* stop myqtt sequencer */
 	myqtt_sequencer_stop (ctx);
 
+	/* stop storage writer (running pending operations) */
+	__myqtt_storage_writer_stop (ctx);
+
+	/* flush retained messages kept in memory */
+	__myqtt_storage_retain_stop (ctx);
+
 	/* clean up myqtt modules */
 	myqtt_log (MYQTT_LEVEL_DEBUG, "shutting down myqtt xml subsystem");
 
@@ -1118,7 +1241,6 @@ void myqtt_exit_ctx (MyQttCtx * ctx, axl_bool  free_ctx)
 	myqtt_support_cleanup (ctx);
 
 	/* destroy global mutex */
-	myqtt_mutex_destroy (&ctx->msg_id_mutex);
 	myqtt_mutex_destroy (&ctx->connection_id_mutex);
 	myqtt_mutex_destroy (&ctx->listener_mutex);
 	myqtt_mutex_destroy (&ctx->listener_unlock);
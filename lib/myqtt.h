@@ -249,6 +249,7 @@ BEGIN_C_DECLS
 #include <myqtt-sequencer.h>
 #include <myqtt-msg.h>
 #include <myqtt-storage.h>
+#include <myqtt-metrics.h>
 
 END_C_DECLS
 
@@ -267,14 +268,25 @@ END_C_DECLS
 #define errno (WSAGetLastError())
 #endif
 
+/* levels built into log statements: building with
+ * -DMYQTT_LOG_COMPILED_LEVELS=6 (warning and critical) removes all
+ * debug statements (see --disable-myqtt-debug-log) */
+#if !defined(MYQTT_LOG_COMPILED_LEVELS)
+# define MYQTT_LOG_COMPILED_LEVELS 7
+#endif
+
+/* runtime level check done before evaluating log arguments (the
+ * library replaces it by a direct read of the context) */
+#define MYQTT_LOG_LEVEL_ENABLED(c, l) myqtt_log_level_enabled (c, l)
+
 /* console debug support:
  *
  * If enabled, the log reporting is activated as usual. If log is
  * stripped from myqtt building all instructions are removed.
  */
 #if defined(ENABLE_MYQTT_LOG)
-# define myqtt_log(l, m, ...)   do{_myqtt_log  (ctx, __AXL_FILE__, __AXL_LINE__, l, m, ##__VA_ARGS__);}while(0)
-# define myqtt_log2(l, m, ...)   do{_myqtt_log2  (ctx, __AXL_FILE__, __AXL_LINE__, l, m, ##__VA_ARGS__);}while(0)
+# define myqtt_log(l, m, ...)   do{if (((l) & MYQTT_LOG_COMPILED_LEVELS) && MYQTT_LOG_LEVEL_ENABLED (ctx, l)) _myqtt_log  (ctx, __AXL_FILE__, __AXL_LINE__, l, m, ##__VA_ARGS__);}while(0)
+# define myqtt_log2(l, m, ...)   do{if (((l) & MYQTT_LOG_COMPILED_LEVELS) && MYQTT_LOG_LEVEL_ENABLED (ctx, l)) _myqtt_log2  (ctx, __AXL_FILE__, __AXL_LINE__, l, m, ##__VA_ARGS__);}while(0)
 #else
 # if defined(AXL_OS_WIN32) && !( defined(__GNUC__) || _MSC_VER >= 1400)
 /* default case where '...' is not supported but log is still
@@ -387,6 +399,8 @@ void     myqtt_log_filter_level     (MyQttCtx * ctx, const char * filter_string)
 
 axl_bool    myqtt_log_filter_is_enabled (MyQttCtx * ctx);
 
+axl_bool    myqtt_log_level_enabled (MyQttCtx * ctx, MyQttDebugLevel level);
+
 /**
  * @brief Allowed items to use for \ref myqtt_conf_get.
  */
@@ -454,9 +468,135 @@ typedef enum {
 	 * myqtt_conf_set (ctx, MYQTT_SKIP_THREAD_POOL_WAIT, axl_true, NULL);
 	 * \endcode
 	 */
-	MYQTT_SKIP_THREAD_POOL_WAIT = 6
+	MYQTT_SKIP_THREAD_POOL_WAIT = 6,
+	/** 
+	 * @brief Gets/sets the maximum number of connections accepted
+	 * by a listener each time it is reported as ready by the
+	 * reader loop. The default value is 64.
+	 *
+	 * The listener keeps on calling accept () until the backlog
+	 * is drained (EAGAIN) or this limit is reached, so a burst of
+	 * reconnecting clients is consumed without doing a full
+	 * reader loop pass for each one of them. Using 1 restores
+	 * the one accept per notification behaviour.
+	 *
+	 * \code
+	 * myqtt_conf_set (ctx, MYQTT_LISTENER_ACCEPT_BATCH, 256, NULL);
+	 * \endcode
+	 */
+	MYQTT_LISTENER_ACCEPT_BATCH = 7,
+	/** 
+	 * @brief Gets/sets SO_REUSEPORT support for listeners created
+	 * after this option is configured (only on platforms
+	 * supporting it).
+	 *
+	 * When enabled, several listeners can be bound to the same
+	 * address and port. Creating one listener on each of several
+	 * contexts (each one with its own reader loop) makes the
+	 * kernel to spread incoming connections across them.
+	 *
+	 * \code
+	 * myqtt_conf_set (ctx, MYQTT_LISTENER_REUSE_PORT, axl_true, NULL);
+	 * \endcode
+	 */
+	MYQTT_LISTENER_REUSE_PORT = 8,
+	/** 
+	 * @brief Gets/sets SO_SNDBUF (bytes) for listeners created
+	 * after this option is configured. Accepted connections
+	 * inherit the value from the listener socket.
+	 *
+	 * This value and the following listener socket options
+	 * (up to \ref MYQTT_LISTENER_NOTSENT_LOWAT) are context wide
+	 * defaults: 0 (default) leaves the kernel configuration
+	 * untouched. They can be configured for a particular
+	 * listener with \ref myqtt_conn_opts_set_sock_opt. Options
+	 * not supported by the platform are reported and skipped.
+	 *
+	 * \code
+	 * myqtt_conf_set (ctx, MYQTT_LISTENER_SNDBUF, 262144, NULL);
+	 * \endcode
+	 */
+	MYQTT_LISTENER_SNDBUF = 9,
+	/** 
+	 * @brief Gets/sets SO_RCVBUF (bytes) for listeners (see \ref MYQTT_LISTENER_SNDBUF).
+	 */
+	MYQTT_LISTENER_RCVBUF = 10,
+	/** 
+	 * @brief Gets/sets TCP_DEFER_ACCEPT (seconds) for listeners:
+	 * connections are only reported once the client sends data
+	 * (the CONNECT packet) or the timeout expires.
+	 */
+	MYQTT_LISTENER_DEFER_ACCEPT = 11,
+	/** 
+	 * @brief Gets/sets TCP_FASTOPEN (length of the pending fast
+	 * open requests queue) for listeners.
+	 */
+	MYQTT_LISTENER_FASTOPEN = 12,
+	/** 
+	 * @brief Gets/sets SO_BUSY_POLL (microseconds) for listeners
+	 * and the connections they accept.
+	 */
+	MYQTT_LISTENER_BUSY_POLL = 13,
+	/** 
+	 * @brief Gets/sets TCP_USER_TIMEOUT (milliseconds) for
+	 * listeners and the connections they accept: maximum time
+	 * sent data may remain unacknowledged before the connection
+	 * is closed.
+	 */
+	MYQTT_LISTENER_USER_TIMEOUT = 14,
+	/** 
+	 * @brief Gets/sets TCP_NOTSENT_LOWAT (bytes) for listeners
+	 * and the connections they accept: limits the amount of
+	 * unsent data queued in the kernel for each connection.
+	 */
+	MYQTT_LISTENER_NOTSENT_LOWAT = 15,
+	/** 
+	 * @brief Gets/sets the high watermark (bytes queued on the
+	 * sequencer pending to be sent) for a single connection. 0
+	 * (default) disables it.
+	 *
+	 * When a PUBLISH received is delivered to a subscriber that
+	 * is over this watermark, reads on the publisher connection
+	 * are paused until the subscriber queue drains below \ref
+	 * MYQTT_CONN_QUEUE_LOW_WATERMARK or the subscriber is
+	 * closed. This keeps memory bounded when publishers are
+	 * faster than subscribers. The pause does not change the
+	 * state reported by \ref myqtt_conn_is_blocked.
+	 *
+	 * \code
+	 * myqtt_conf_set (ctx, MYQTT_CONN_QUEUE_HIGH_WATERMARK, 4 * 1024 * 1024, NULL);
+	 * \endcode
+	 */
+	MYQTT_CONN_QUEUE_HIGH_WATERMARK = 16,
+	/** 
+	 * @brief Gets/sets the low watermark for a single connection
+	 * (see \ref MYQTT_CONN_QUEUE_HIGH_WATERMARK). When not
+	 * configured (or not lower than the high watermark), half the
+	 * high watermark is used.
+	 */
+	MYQTT_CONN_QUEUE_LOW_WATERMARK = 17,
+	/** 
+	 * @brief Gets/sets the high watermark for all bytes queued on
+	 * the sequencer of the context. 0 (default) disables it. Over
+	 * this value, every publisher delivering messages is paused
+	 * until the context queue drains below \ref
+	 * MYQTT_CTX_QUEUE_LOW_WATERMARK.
+	 */
+	MYQTT_CTX_QUEUE_HIGH_WATERMARK = 18,
+	/** 
+	 * @brief Gets/sets the low watermark for all bytes queued on
+	 * the context (see \ref MYQTT_CTX_QUEUE_HIGH_WATERMARK). When
+	 * not configured, half the high watermark is used.
+	 */
+	MYQTT_CTX_QUEUE_LOW_WATERMARK = 19
 } MyQttConfItem;
 
+/** 
+ * @internal Number of listener socket options, from \ref
+ * MYQTT_LISTENER_SNDBUF to \ref MYQTT_LISTENER_NOTSENT_LOWAT.
+ */
+#define MYQTT_LISTENER_SOCK_OPTS (MYQTT_LISTENER_NOTSENT_LOWAT - MYQTT_LISTENER_SNDBUF + 1)
+
 axl_bool  myqtt_conf_get             (MyQttCtx      * ctx,
 				       MyQttConfItem   item, 
 				       int            * value);
@@ -104,9 +104,16 @@ axlNode *  __mod_ssl_get_certificate_node_by_name (MyQttdCtx * ctx, const char *
 MyQttConn * __mod_ssl_start_listener (MyQttdCtx * ctx, MyQttCtx * my_ctx, axlNode * port_node, 
 				      const char * bind_addr, const char * port, axlPointer user_data)
 {
-	MyQttConn   * listener;
-	axlNode     * node;
-	const char  * crt, * key, * chain;
+	MyQttConn     * listener;
+	MyQttConnOpts * opts;
+	axlNode       * node;
+	const char    * crt, * key, * chain;
+
+	/* socket options declared at <port>: the listener adopts
+	 * them as its TLS options too, so keep client certificate
+	 * verification disabled as it is without options */
+	opts = myqttd_run_listener_opts (ctx, port_node);
+	myqtt_tls_opts_ssl_peer_verify (opts, axl_false);
 
 	/* create listener on the port indicated */
 	listener = myqtt_tls_listener_new (
@@ -118,7 +125,7 @@ MyQttConn * __mod_ssl_start_listener (MyQttdCtx * ctx, MyQttCtx * my_ctx, axlNod
 		  /* port to use */
 		  port,
 		  /* opts */
-		  NULL,
+		  opts,
 		  /* on ready callbacks */
 		  NULL, NULL);
 
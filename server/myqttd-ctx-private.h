@@ -84,6 +84,29 @@ struct _MyQttdCtx {
 	MyQttdLoop         * log_manager;
 	axl_bool             use_syslog;
 
+	/* asynchronous file logging: per-thread rings drained by a
+	 * single writer thread (see myqttd-log.c) */
+	axl_bool             log_async;
+	int                  log_ring_size;
+	struct _MyQttdLogRing * log_rings;
+	int                  log_rings_num;
+	MyQttMutex           log_mutex;
+	MyQttCond            log_cond;
+	MyQttThread          log_writer;
+	int                  log_writer_running;
+	axl_bool             log_writer_stop;
+	int                  log_dropped;
+	int                  log_dropped_reported;
+
+	/* LogReportType bits with a log file or syslog configured
+	 * (see MYQTTD_LOG_ENABLED) */
+	int                  log_reports;
+
+	/* report one out of log_publish_sample published messages
+	 * (1: all, 0: none) */
+	int                  log_publish_sample;
+	int                  log_publish_count;
+
 	/*** myqttd config module ***/
 	axlDoc             * config;
 	char               * config_path;
@@ -272,6 +295,29 @@ struct _MyQttdDomainSetting {
 	/* quota for number of messages per day and montly */
 	int         month_message_quota;
 	int         day_message_quota;
+
+	/* expiration for queued messages and disconnected sessions
+	 * (seconds) and period for the storage sweeper */
+	int         message_ttl;
+	int         session_expiry;
+	int         storage_sweep_period;
+
+	/* max pending operations for the storage writer (disabled
+	 * when <= 0) */
+	int         storage_writer_queue;
+
+	/* minimum payload size (bytes) to compress payloads stored
+	 * (disabled when < 0) */
+	int         storage_compression_threshold;
+
+	/* seconds between retained messages flushes when they are
+	 * kept in memory (disabled when < 0, only at shutdown when
+	 * 0) */
+	int         retained_flush_period;
+
+	/* seconds between publications of broker metrics under
+	 * $SYS/broker/ topics (disabled when <= 0) */
+	int         sys_interval;
 	
 };
 
@@ -280,4 +326,11 @@ typedef struct _MyQttdHandlePtr {
 	axlPointer ptr;
 } MyQttdHandlerPtr;
 
+/** 
+ * @internal Inside myqttd, check if a message is reported reading
+ * the context directly (see myqttd_log_type_enabled).
+ */
+#undef  MYQTTD_LOG_ENABLED
+#define MYQTTD_LOG_ENABLED(c, t) ((c) != NULL && ((c)->console_enabled || ((c)->log_reports & (t))))
+
 #endif
@@ -92,6 +92,9 @@ MyQttdCtx * myqttd_ctx_new ()
 	ctx->error_log   = -1;
 	ctx->access_log  = -1;
 	ctx->myqtt_log  = -1;
+	myqtt_mutex_create (&ctx->log_mutex);
+	myqtt_cond_create (&ctx->log_cond);
+	ctx->log_publish_sample = 1;
 
 	/* init wait queue */
 	ctx->wait_queue    = myqtt_async_queue_new ();
@@ -681,6 +684,10 @@ void            myqttd_ctx_free (MyQttdCtx * ctx)
 	ctx->data = NULL;
 	myqtt_mutex_destroy (&ctx->data_mutex);
 
+	/* release log writer sync */
+	myqtt_mutex_destroy (&ctx->log_mutex);
+	myqtt_cond_destroy (&ctx->log_cond);
+
 	/* release wait queue */
 	myqtt_async_queue_unref (ctx->wait_queue);
 
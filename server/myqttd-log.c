@@ -42,10 +42,512 @@
 #include <myqttd.h>
 #include <stdlib.h>
 #include <syslog.h>
+#include <sys/uio.h>
 
 /* local include */
 #include <myqttd-ctx-private.h>
 
+/* default size (bytes) of each per-thread log ring */
+#define MYQTTD_LOG_RING_SIZE    65536
+/* smallest ring size accepted from configuration */
+#define MYQTTD_LOG_RING_MIN     4096
+/* max number of rings created: bounds memory used by the pipeline
+ * to MYQTTD_LOG_MAX_RINGS * ring size */
+#define MYQTTD_LOG_MAX_RINGS    64
+/* line size formatted without allocating */
+#define MYQTTD_LOG_LINE_SIZE    2048
+/* max lines written by a single writev call */
+#define MYQTTD_LOG_IOV          64
+/* microseconds the writer sleeps when no line is pending */
+#define MYQTTD_LOG_WRITER_WAIT  10000
+
+#define MYQTTD_LOG_ALIGN(n)     (((n) + 7) & ~7)
+
+/* timestamp cached so ctime_r is only called once per second */
+typedef struct _MyQttdLogStamp {
+	time_t   stamp;
+	char     value[32];
+} MyQttdLogStamp;
+
+/* record header stored in the ring before each line, length == -1
+ * signals the writer to continue at the beginning of the ring */
+typedef struct _MyQttdLogRecord {
+	int      type;
+	int      length;
+} MyQttdLogRecord;
+
+/* log ring: lines are appended by the thread that holds the ring
+ * (busy == 1) and removed by the writer thread, so no lock is
+ * required to report */
+typedef struct _MyQttdLogRing {
+	MyQttdCtx              * ctx;
+	int                      busy;
+	char                   * data;
+	int                      size;
+	/* next record to write (updated by the writer) and next free
+	 * position (updated by the producer) */
+	int                      head;
+	int                      tail;
+	MyQttdLogStamp           stamp;
+	struct _MyQttdLogRing  * next;
+} MyQttdLogRing;
+
+/* ring used by the current thread */
+#if defined(__GNUC__)
+# define MYQTTD_LOG_TLS __thread
+#endif
+
+/* bumped every time rings are released so cached references are
+ * no longer used */
+int __myqttd_log_rings_gen = 1;
+
+#if defined(MYQTTD_LOG_TLS)
+MYQTTD_LOG_TLS MyQttdLogRing * __myqttd_log_current_ring = NULL;
+MYQTTD_LOG_TLS int             __myqttd_log_current_gen  = 0;
+/* published messages seen by this thread (publish-sample) */
+MYQTTD_LOG_TLS int             __myqttd_log_publish_count = 0;
+#endif
+
+/** 
+ * @internal Reads log settings from <log-reporting>: async="no"
+ * keeps writing each line from the reporting thread,
+ * ring-size="bytes" configures the size of each per-thread ring and
+ * publish-sample="N" reports one out of N published messages.
+ */
+void __myqttd_log_conf (MyQttdCtx * ctx)
+{
+	axlNode * node = axl_doc_get (myqttd_config_get (ctx), "/myqtt/global-settings/log-reporting");
+	int       size;
+
+	ctx->log_async     = ! HAS_ATTR_VALUE (node, "async", "no");
+	ctx->log_ring_size = MYQTTD_LOG_RING_SIZE;
+	if (HAS_ATTR (node, "ring-size")) {
+		size = atoi (ATTR_VALUE (node, "ring-size"));
+		if (size < MYQTTD_LOG_RING_MIN) {
+			wrn ("ring-size=%d at <log-reporting> is too small, using %d", size, MYQTTD_LOG_RING_MIN);
+			size = MYQTTD_LOG_RING_MIN;
+		} /* end if */
+		ctx->log_ring_size = MYQTTD_LOG_ALIGN (size);
+	} /* end if */
+
+	ctx->log_publish_sample = 1;
+	if (HAS_ATTR (node, "publish-sample")) 
+		ctx->log_publish_sample = atoi (ATTR_VALUE (node, "publish-sample"));
+
+	return;
+}
+
+/** 
+ * @internal Updates log types with a destination configured (checked
+ * by MYQTTD_LOG_ENABLED).
+ */
+void __myqttd_log_reports_update (MyQttdCtx * ctx)
+{
+	int reports = 0;
+
+	if (ctx->use_syslog) {
+		reports = LOG_REPORT_GENERAL | LOG_REPORT_ACCESS | LOG_REPORT_MYQTT | LOG_REPORT_ERROR | LOG_REPORT_WARNING;
+	} else {
+		if (ctx->general_log >= 0)
+			reports |= LOG_REPORT_GENERAL;
+		if (ctx->error_log >= 0)
+			reports |= LOG_REPORT_ERROR | LOG_REPORT_WARNING;
+		if (ctx->access_log >= 0)
+			reports |= LOG_REPORT_ACCESS;
+		if (ctx->myqtt_log >= 0)
+			reports |= LOG_REPORT_MYQTT;
+	} /* end if */
+
+	ctx->log_reports = reports;
+	return;
+}
+
+/** 
+ * @internal Returns the descriptor where lines of the provided type
+ * are written.
+ */
+int __myqttd_log_descriptor (MyQttdCtx * ctx, LogReportType type)
+{
+	switch (type) {
+	case LOG_REPORT_GENERAL:
+		return ctx->general_log;
+	case LOG_REPORT_ERROR:
+	case LOG_REPORT_WARNING:
+		return ctx->error_log;
+	case LOG_REPORT_ACCESS:
+		return ctx->access_log;
+	case LOG_REPORT_MYQTT:
+		return ctx->myqtt_log;
+	} /* end switch */
+
+	return -1;
+}
+
+/** 
+ * @internal Formats a log line into the buffer provided:
+ * "<date> [<pid>] (<file>:<line>) <message>\n".
+ *
+ * @return The line length or, when it is larger than size, the
+ * amount of bytes required (-1 on failure). args is not consumed.
+ */
+int __myqttd_log_format (MyQttdCtx      * ctx,
+			 MyQttdLogStamp * stamp,
+			 char           * buffer,
+			 int              size,
+			 const char     * message,
+			 va_list          args,
+			 const char     * file,
+			 int              line)
+{
+	time_t  now = time (NULL);
+	va_list copy;
+	int     length;
+	int     written;
+
+	/* refresh timestamp only when the second changes */
+	if (now != stamp->stamp) {
+		stamp->stamp = now;
+		if (ctime_r (&now, stamp->value) == NULL)
+			stamp->value[0] = 0;
+		/* remove trailing \n */
+		length = strlen (stamp->value);
+		if (length > 0 && stamp->value[length - 1] == '\n')
+			stamp->value[length - 1] = 0;
+	} /* end if */
+
+	length = snprintf (buffer, size, "%s [%d] (%s:%d) ", stamp->value, ctx->pid, file, line);
+	if (length < 0 || length >= size)
+		return -1;
+
+	va_copy (copy, args);
+	written = vsnprintf (buffer + length, size - length, message, copy);
+	va_end (copy);
+	if (written < 0)
+		return -1;
+
+	/* replace trailing \0 by \n when it fits */
+	length += written + 1;
+	if (length <= size)
+		buffer[length - 1] = '\n';
+	return length;
+}
+
+/** 
+ * @internal Appends a line into the ring. Only called by the thread
+ * holding the ring.
+ *
+ * @return axl_false when there is no room for the line.
+ */
+axl_bool __myqttd_log_ring_push (MyQttdLogRing * ring, LogReportType type, const char * line, int length)
+{
+	MyQttdLogRecord * record;
+	int               head     = myqtt_atomic_get (&ring->head);
+	int               tail     = ring->tail;
+	int               need     = MYQTTD_LOG_ALIGN (sizeof (MyQttdLogRecord) + length);
+	int               position = tail;
+
+	/* head == tail means empty, so never fill the ring completely */
+	if (tail >= head) {
+		if ((ring->size - tail) < need || ((ring->size - tail) == need && head == 0)) {
+			/* no room until the end, continue at the
+			 * beginning if there is room before head */
+			if (head <= need)
+				return axl_false;
+			record         = (MyQttdLogRecord *) (ring->data + tail);
+			record->type   = 0;
+			record->length = -1;
+			position       = 0;
+		} /* end if */
+	} else if ((head - tail) <= need)
+		return axl_false;
+
+	record         = (MyQttdLogRecord *) (ring->data + position);
+	record->type   = type;
+	record->length = length;
+	memcpy (ring->data + position + sizeof (MyQttdLogRecord), line, length);
+
+	/* publish the record to the writer */
+	position += need;
+	if (position == ring->size)
+		position = 0;
+	myqtt_atomic_add (&ring->tail, position - tail);
+
+	return axl_true;
+}
+
+/** 
+ * @internal Writes all lines available in the ring, grouping
+ * consecutive lines for the same log into a single writev call.
+ *
+ * @return Number of lines written.
+ */
+int __myqttd_log_ring_drain (MyQttdCtx * ctx, MyQttdLogRing * ring)
+{
+	struct iovec      iov[MYQTTD_LOG_IOV];
+	MyQttdLogRecord * record;
+	int               head  = ring->head;
+	int               tail  = myqtt_atomic_get (&ring->tail);
+	int               items = 0;
+	int               type  = 0;
+	int               lines = 0;
+	int               log;
+
+	while (head != tail) {
+		record = (MyQttdLogRecord *) (ring->data + head);
+		if (record->length < 0) {
+			/* producer continued at the beginning */
+			head = 0;
+			continue;
+		} /* end if */
+
+		/* flush pending lines when the log changes */
+		if (items > 0 && (record->type != type || items == MYQTTD_LOG_IOV)) {
+			log = __myqttd_log_descriptor (ctx, type);
+			if (log >= 0 && writev (log, iov, items) == -1) {
+				/* nothing to do, as done by previous
+				 * synchronous writes */
+			} /* end if */
+			items = 0;
+		} /* end if */
+
+		type                = record->type;
+		iov[items].iov_base = ring->data + head + sizeof (MyQttdLogRecord);
+		iov[items].iov_len  = record->length;
+		items++;
+		lines++;
+
+		head += MYQTTD_LOG_ALIGN (sizeof (MyQttdLogRecord) + record->length);
+		if (head == ring->size)
+			head = 0;
+	} /* end while */
+
+	if (items > 0) {
+		log = __myqttd_log_descriptor (ctx, type);
+		if (log >= 0 && writev (log, iov, items) == -1) {
+			/* nothing to do */
+		} /* end if */
+	} /* end if */
+
+	/* release space written to the producer */
+	if (head != ring->head)
+		myqtt_atomic_add (&ring->head, head - ring->head);
+
+	return lines;
+}
+
+/** 
+ * @internal Waits the writer to write all lines queued on the ring
+ * (only called by the thread holding it) so a line written by the
+ * reporting thread is not placed ahead of them.
+ */
+void __myqttd_log_ring_flush (MyQttdCtx * ctx, MyQttdLogRing * ring)
+{
+	while (myqtt_atomic_get (&ring->head) != ring->tail && myqtt_atomic_get (&ctx->log_writer_running)) {
+		/* wake up the writer */
+		myqtt_mutex_lock (&ctx->log_mutex);
+		myqtt_cond_signal (&ctx->log_cond);
+		myqtt_mutex_unlock (&ctx->log_mutex);
+
+		myqtt_sleep (1000);
+	} /* end while */
+
+	return;
+}
+
+/** 
+ * @internal Writes pending lines of all rings.
+ */
+int __myqttd_log_drain (MyQttdCtx * ctx)
+{
+	MyQttdLogRing * ring;
+	int             lines = 0;
+
+	/* rings are only added at the head of the list while the
+	 * writer is running, so walk them without holding the lock */
+	myqtt_mutex_lock (&ctx->log_mutex);
+	ring = ctx->log_rings;
+	myqtt_mutex_unlock (&ctx->log_mutex);
+
+	while (ring != NULL) {
+		lines += __myqttd_log_ring_drain (ctx, ring);
+		ring   = ring->next;
+	} /* end while */
+
+	return lines;
+}
+
+/** 
+ * @internal Returns a ring to report from the current thread
+ * (marked busy) or NULL if the max number of rings was reached and
+ * all are in use.
+ */
+MyQttdLogRing * __myqttd_log_ring_acquire (MyQttdCtx * ctx)
+{
+	MyQttdLogRing * ring;
+	int             gen = myqtt_atomic_get (&__myqttd_log_rings_gen);
+
+#if defined(MYQTTD_LOG_TLS)
+	/* fast path: ring already used by this thread */
+	ring = __myqttd_log_current_ring;
+	if (ring != NULL && __myqttd_log_current_gen == gen && ring->ctx == ctx && myqtt_atomic_cas (&ring->busy, 0, 1)) {
+		/* rings released meanwhile (see myqttd_log_cleanup) */
+		if (myqtt_atomic_get (&__myqttd_log_rings_gen) == gen)
+			return ring;
+		myqtt_atomic_cas (&ring->busy, 1, 0);
+	} /* end if */
+#endif
+
+	myqtt_mutex_lock (&ctx->log_mutex);
+	ring = NULL;
+	if (ctx->log_rings_num < MYQTTD_LOG_MAX_RINGS) {
+		/* create a ring for this thread */
+		ring       = axl_new (MyQttdLogRing, 1);
+		if (ring != NULL) {
+			ring->data = axl_new (char, ctx->log_ring_size);
+			if (ring->data == NULL) {
+				axl_free (ring);
+				ring = NULL;
+			} /* end if */
+		} /* end if */
+
+		if (ring != NULL) {
+			ring->ctx       = ctx;
+			ring->size      = ctx->log_ring_size;
+			ring->busy      = 1;
+			ring->next      = ctx->log_rings;
+			ctx->log_rings  = ring;
+			ctx->log_rings_num++;
+		} /* end if */
+	} else {
+		/* limit reached: use any ring not in use */
+		ring = ctx->log_rings;
+		while (ring != NULL && ! myqtt_atomic_cas (&ring->busy, 0, 1))
+			ring = ring->next;
+	} /* end if */
+	myqtt_mutex_unlock (&ctx->log_mutex);
+
+#if defined(MYQTTD_LOG_TLS)
+	if (ring != NULL) {
+		__myqttd_log_current_ring = ring;
+		__myqttd_log_current_gen  = gen;
+	} /* end if */
+#endif
+
+	return ring;
+}
+
+/** 
+ * @internal Writes a line synchronously (used by the writer to
+ * report dropped lines).
+ */
+void __myqttd_log_write (MyQttdCtx * ctx, LogReportType type, const char * file, int line, const char * message, ...)
+{
+	MyQttdLogStamp stamp;
+	char           buffer[MYQTTD_LOG_LINE_SIZE];
+	va_list        args;
+	int            log = __myqttd_log_descriptor (ctx, type);
+	int            length;
+
+	if (log < 0)
+		return;
+
+	memset (&stamp, 0, sizeof (MyQttdLogStamp));
+	va_start (args, message);
+	length = __myqttd_log_format (ctx, &stamp, buffer, MYQTTD_LOG_LINE_SIZE, message, args, file, line);
+	va_end (args);
+
+	if (length > 0 && length <= MYQTTD_LOG_LINE_SIZE && write (log, buffer, length) == -1) {
+		/* nothing to do */
+	} /* end if */
+	return;
+}
+
+/** 
+ * @internal Log writer thread: writes lines queued by reporting
+ * threads until it is stopped.
+ */
+axlPointer __myqttd_log_writer (MyQttdCtx * ctx)
+{
+	int lines;
+	int dropped;
+
+	while (axl_true) {
+		lines = __myqttd_log_drain (ctx);
+
+		/* report lines lost because rings were full */
+		dropped = myqtt_atomic_get (&ctx->log_dropped);
+		if (dropped != ctx->log_dropped_reported) {
+			__myqttd_log_write (ctx, LOG_REPORT_ERROR, __AXL_FILE__, __AXL_LINE__, 
+					    "log rings full, %d lines dropped", dropped - ctx->log_dropped_reported);
+			ctx->log_dropped_reported = dropped;
+		} /* end if */
+
+		myqtt_mutex_lock (&ctx->log_mutex);
+		if (ctx->log_writer_stop) {
+			myqtt_mutex_unlock (&ctx->log_mutex);
+			break;
+		} /* end if */
+
+		/* nothing written: wait a bit (reporting threads do
+		 * not signal to avoid taking the lock) */
+		if (lines == 0)
+			myqtt_cond_timedwait (&ctx->log_cond, &ctx->log_mutex, MYQTTD_LOG_WRITER_WAIT);
+		myqtt_mutex_unlock (&ctx->log_mutex);
+	} /* end while */
+
+	/* write lines queued before stopping */
+	__myqttd_log_drain (ctx);
+
+	return NULL;
+}
+
+/** 
+ * @internal Starts the log writer thread if asynchronous logging is
+ * enabled and it is not running.
+ */
+void __myqttd_log_writer_start (MyQttdCtx * ctx)
+{
+	if (ctx->use_syslog || ! ctx->log_async)
+		return;
+
+	myqtt_mutex_lock (&ctx->log_mutex);
+	if (myqtt_atomic_get (&ctx->log_writer_running) == 0) {
+		ctx->log_writer_stop = axl_false;
+		if (myqtt_thread_create (&ctx->log_writer, 
+					 (MyQttThreadFunc) __myqttd_log_writer,
+					 ctx, 
+					 MYQTT_THREAD_CONF_END)) 
+			myqtt_atomic_cas (&ctx->log_writer_running, 0, 1);
+		else
+			error ("unable to start log writer thread, writing logs synchronously");
+	} /* end if */
+	myqtt_mutex_unlock (&ctx->log_mutex);
+
+	return;
+}
+
+/** 
+ * @internal Stops the log writer thread (if running), writing all
+ * pending lines.
+ */
+void __myqttd_log_writer_stop (MyQttdCtx * ctx)
+{
+	myqtt_mutex_lock (&ctx->log_mutex);
+	/* from now on, lines are written by the reporting thread */
+	if (! myqtt_atomic_cas (&ctx->log_writer_running, 1, 0)) {
+		myqtt_mutex_unlock (&ctx->log_mutex);
+		return;
+	} /* end if */
+	ctx->log_writer_stop = axl_true;
+	myqtt_cond_signal (&ctx->log_cond);
+	myqtt_mutex_unlock (&ctx->log_mutex);
+
+	/* wait writer to finish */
+	myqtt_thread_destroy (&ctx->log_writer, axl_false);
+
+	return;
+}
+
 /** 
  * @brief Init the myqttd log module.
  */
@@ -80,6 +582,8 @@ void myqttd_log_init (MyQttdCtx * ctx)
 	if (ctx->use_syslog) {
 		/* open syslog */
 		openlog ("myqttd", LOG_PID, LOG_DAEMON);
+		__myqttd_log_conf (ctx);
+		__myqttd_log_reports_update (ctx);
 		msg ("Using syslog facility for logging");
 		return;
 	} /* end if */
@@ -124,6 +628,11 @@ void myqttd_log_init (MyQttdCtx * ctx)
 		msg ("opened log: %s", ATTR_VALUE (node, "file"));
 	} /* end if */
 	node      = axl_node_get_parent (node);
+
+	/* start log writer */
+	__myqttd_log_conf (ctx);
+	__myqttd_log_reports_update (ctx);
+	__myqttd_log_writer_start (ctx);
 	
 	return;
 }
@@ -161,6 +670,11 @@ void      myqttd_log_configure (MyQttdCtx * ctx,
 		ctx->myqtt_log = descriptor;
 		break;
 	} /* end switch */
+
+	/* start log writer (child process) */
+	__myqttd_log_conf (ctx);
+	__myqttd_log_reports_update (ctx);
+	__myqttd_log_writer_start (ctx);
 	return;
 }
 
@@ -293,22 +807,21 @@ void      myqttd_log_manager_register (MyQttdCtx * ctx,
 
 
 /** 
- * @internal macro that allows to report a message to the particular
- * log, appending date information.
+ * @internal Reports a message to the particular log, appending date
+ * information. When the log writer is running the line is queued
+ * into the ring of the current thread (no lock, no allocation),
+ * otherwise it is written from the calling thread.
  */
-void REPORT (axl_bool use_syslog, LogReportType type, int log, const char * message, va_list args, const char * file, int line) 
+void REPORT (MyQttdCtx * ctx, LogReportType type, int log, const char * message, va_list args, const char * file, int line) 
 {
-	/* get myqttd context */
-	time_t             time_val;
-	char             * time_str;
+	MyQttdLogRing    * ring = NULL;
+	MyQttdLogStamp     stamp;
+	char               buffer[MYQTTD_LOG_LINE_SIZE];
 	char             * string;
-	char             * string2;
-	char             * result;
+	int                size   = MYQTTD_LOG_LINE_SIZE;
 	int                length;
-	int                length2;
-	int                total;
 
-	if (use_syslog) {
+	if (ctx->use_syslog) {
 		string = axl_strdup_printfv (message, args);
 		if (string == NULL)
 			return;
@@ -331,54 +844,47 @@ void REPORT (axl_bool use_syslog, LogReportType type, int log, const char * mess
 	if (log < 0)
 		return;
 
-	/* create timestamp */
-	time_val = time (NULL);
-	time_str = axl_strdup (ctime (&time_val));
-	if (time_str == NULL)
-		return;
-	time_str [strlen (time_str) - 1] = 0;
+	/* get ring for this thread */
+	if (myqtt_atomic_get (&ctx->log_writer_running))
+		ring = __myqttd_log_ring_acquire (ctx);
+	if (ring == NULL)
+		memset (&stamp, 0, sizeof (MyQttdLogStamp));
 
-	/* write stamp */
-	string = axl_strdup_printf ("%s [%d] (%s:%d) ", time_str, getpid (), file, line);
-	axl_free (time_str);
-	if (string == NULL)
-		return;
-	length = strlen (string);
+	/* build line */
+	string = buffer;
+	length = __myqttd_log_format (ctx, ring ? &ring->stamp : &stamp, string, size, message, args, file, line);
+	if (length > size) {
+		/* line larger than the stack buffer */
+		size   = length;
+		string = axl_new (char, size);
+		if (string != NULL)
+			length = __myqttd_log_format (ctx, ring ? &ring->stamp : &stamp, string, size, message, args, file, line);
+	} /* end if */
 
-	/* create message */
-	string2 = axl_strdup_printfv (message, args);
-	if (string2 == NULL) {
-		axl_free (string);
-		return;
-	}
+	if (string != NULL && length > 0 && length <= size) {
+		if (ring == NULL || length > (ring->size / 4)) {
+			/* keep order with lines already queued by
+			 * this thread */
+			if (ring != NULL)
+				__myqttd_log_ring_flush (ctx, ring);
 
-	length2 = strlen (string2);
+			/* write content: do it in a single operation
+			 * to avoid mixing content from different logs
+			 * at the log file. */
+			if (write (log, string, length) == -1) {
+				/* nothing to do */
+			} /* end if */
+		} else if (! __myqttd_log_ring_push (ring, type, string, length)) {
+			/* ring full: the writer reports lines lost */
+			myqtt_atomic_add (&ctx->log_dropped, 1);
+		} /* end if */
+	} /* end if */
 
-	/* build final log message */
-	total  = length + length2 + 1;
-	result = axl_new (char, total + 1);
-	if (result == NULL) {
+	/* release ring */
+	if (ring != NULL)
+		myqtt_atomic_cas (&ring->busy, 1, 0);
+	if (string != buffer)
 		axl_free (string);
-		axl_free (string2);
-		return;
-	}
-
-	memcpy (result, string, length);
-	memcpy (result + length, string2, length2);
-	memcpy (result + length + length2, "\n", 1);
-
-	axl_free (string);
-	axl_free (string2);
-	
-	/* write content: do it in a single operation to avoid mixing
-	 * content from different logs at the log file. */
-	if (write (log, result, total) == -1) {
-		axl_free (result);
-		return;
-	}
-	
-	/* release memory used */
-	axl_free (result);
 	return;
 } 
 
@@ -401,19 +907,19 @@ void myqttd_log_report (MyQttdCtx   * ctx,
 {
 	/* according to the type received report */
 	if ((type & LOG_REPORT_GENERAL) == LOG_REPORT_GENERAL) 
-		REPORT (ctx->use_syslog, LOG_REPORT_GENERAL, ctx->general_log, message, args, file, line);
+		REPORT (ctx, LOG_REPORT_GENERAL, ctx->general_log, message, args, file, line);
 	
 	/* handle error and warning through the same log file */
 	if ((type & LOG_REPORT_ERROR) == LOG_REPORT_ERROR) 
-		REPORT (ctx->use_syslog, LOG_REPORT_ERROR, ctx->error_log, message, args, file, line);
+		REPORT (ctx, LOG_REPORT_ERROR, ctx->error_log, message, args, file, line);
 	if ((type & LOG_REPORT_WARNING) == LOG_REPORT_WARNING) 
-		REPORT (ctx->use_syslog, LOG_REPORT_WARNING, ctx->error_log, message, args, file, line);
+		REPORT (ctx, LOG_REPORT_WARNING, ctx->error_log, message, args, file, line);
 	
 	if ((type & LOG_REPORT_ACCESS) == LOG_REPORT_ACCESS) 
-		REPORT (ctx->use_syslog, LOG_REPORT_ACCESS, ctx->access_log, message, args, file, line);
+		REPORT (ctx, LOG_REPORT_ACCESS, ctx->access_log, message, args, file, line);
 
 	if ((type & LOG_REPORT_MYQTT) == LOG_REPORT_MYQTT) {
-		REPORT (ctx->use_syslog, LOG_REPORT_MYQTT, ctx->myqtt_log, message, args, file, line);
+		REPORT (ctx, LOG_REPORT_MYQTT, ctx->myqtt_log, message, args, file, line);
 	}
 	return;
 }
@@ -442,8 +948,80 @@ axl_bool   myqttd_log_is_enabled    (MyQttdCtx * ctx)
 	return myqttd_config_is_attr_positive (ctx, node, "enabled");
 }
 
+/** 
+ * @brief Allows to get the number of log lines dropped because the
+ * reporting thread found its log ring full (the log writer thread
+ * was not able to keep up). Only file logging configured with
+ * asynchronous writes (default) drops lines.
+ *
+ * @param ctx The context where the operation takes place.
+ *
+ * @return Number of lines dropped since the process started or -1
+ * if ctx is NULL.
+ */
+int       myqttd_log_dropped       (MyQttdCtx * ctx)
+{
+	if (ctx == NULL)
+		return -1;
+	return myqtt_atomic_get (&ctx->log_dropped);
+}
+
+/** 
+ * @brief Allows to check if a message of the provided type is
+ * reported, either on the console or to a log (file or syslog).
+ *
+ * msg, msg2 and tbc_access check it before building their arguments
+ * so disabled messages only cost a branch.
+ *
+ * @param ctx The context where the check is done.
+ *
+ * @param type The type of message to check.
+ *
+ * @return axl_true if the message is reported, otherwise axl_false.
+ */
+axl_bool  myqttd_log_type_enabled  (MyQttdCtx * ctx, LogReportType type)
+{
+	if (ctx == NULL)
+		return axl_false;
+	return ctx->console_enabled || (ctx->log_reports & type);
+}
+
+/** 
+ * @brief Allows to check if the current published message must be
+ * reported according to <log-reporting publish-sample="N">: one out
+ * of N messages is reported (N=1, default, reports all, N=0 none).
+ *
+ * Sampling is done per thread to avoid sharing a counter.
+ *
+ * @param ctx The context where the check is done.
+ *
+ * @return axl_true if the message must be reported.
+ */
+axl_bool  myqttd_log_publish_sampled (MyQttdCtx * ctx)
+{
+	int sample;
+
+	if (ctx == NULL)
+		return axl_false;
+
+	sample = ctx->log_publish_sample;
+	if (sample == 1)
+		return axl_true;
+	if (sample <= 0)
+		return axl_false;
+
+#if defined(MYQTTD_LOG_TLS)
+	__myqttd_log_publish_count++;
+	return (__myqttd_log_publish_count % sample) == 0;
+#else
+	return (myqtt_atomic_add (&ctx->log_publish_count, 1) % sample) == 0;
+#endif
+}
+
 void __myqttd_log_close (MyQttdCtx * ctx)
 {
+	/* write pending lines before closing */
+	__myqttd_log_writer_stop (ctx);
 
 	/* check if we are running with syslog support */
 	if (ctx->use_syslog) {
@@ -451,6 +1029,9 @@ void __myqttd_log_close (MyQttdCtx * ctx)
 		return;
 	}
 
+	/* nothing else reported to files */
+	ctx->log_reports = 0;
+
 	/* close the general log */
 	if (ctx->general_log >= 0)
 		close (ctx->general_log);
@@ -488,15 +1069,51 @@ void __myqttd_log_reopen (MyQttdCtx * ctx)
 	return;
 }
 
+/** 
+ * @internal Called on the child process right after fork: the
+ * writer thread only exists on the parent, so from now on lines are
+ * written by the reporting thread. Rings inherited (and lines queued
+ * on them) are left to the parent writer.
+ */
+void __myqttd_log_fork_child (MyQttdCtx * ctx)
+{
+	ctx->log_writer_running = 0;
+	ctx->log_rings          = NULL;
+	ctx->log_rings_num      = 0;
+	myqtt_atomic_add (&__myqttd_log_rings_gen, 1);
+	return;
+}
+
 /** 
  * @internal
  * @brief Stops and dealloc all resources hold by the module.
  */
 void myqttd_log_cleanup (MyQttdCtx * ctx)
 {
+	MyQttdLogRing * ring;
+	MyQttdLogRing * next;
+
 	/* call to close current logs */
 	__myqttd_log_close (ctx);
 
+	/* release rings (writer is stopped): threads caching a ring
+	 * will get a new one */
+	myqtt_atomic_add (&__myqttd_log_rings_gen, 1);
+	myqtt_mutex_lock (&ctx->log_mutex);
+	ring               = ctx->log_rings;
+	ctx->log_rings     = NULL;
+	ctx->log_rings_num = 0;
+	myqtt_mutex_unlock (&ctx->log_mutex);
+	while (ring != NULL) {
+		next = ring->next;
+		/* wait threads still reporting on this ring */
+		while (! myqtt_atomic_cas (&ring->busy, 0, 1))
+			myqtt_sleep (1000);
+		axl_free (ring->data);
+		axl_free (ring);
+		ring = next;
+	} /* end while */
+
 	/* now finish log manager */
 	myqttd_loop_close (ctx->log_manager, axl_true);
 	ctx->log_manager = NULL;
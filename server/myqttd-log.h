@@ -71,8 +71,16 @@ void      myqttd_log_manager_register (MyQttdCtx * ctx,
 
 axl_bool  myqttd_log_is_enabled    (MyQttdCtx * ctx);
 
+int       myqttd_log_dropped       (MyQttdCtx * ctx);
+
+axl_bool  myqttd_log_type_enabled  (MyQttdCtx * ctx, LogReportType type);
+
+axl_bool  myqttd_log_publish_sampled (MyQttdCtx * ctx);
+
 void      myqttd_log_cleanup       (MyQttdCtx * ctx);
 
 void      __myqttd_log_reopen      (MyQttdCtx * ctx);
 
+void      __myqttd_log_fork_child  (MyQttdCtx * ctx);
+
 #endif
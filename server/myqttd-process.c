@@ -1425,6 +1425,10 @@ void myqttd_process_create_child (MyQttdCtx           * ctx,
 
 	/**** CHILD CODE ****/
 
+	/* log writer thread is not running on the child: write logs
+	 * directly before anything is reported */
+	__myqttd_log_fork_child (ctx);
+
 	/* reconfigure pids */
 	ctx->pid = getpid ();
 
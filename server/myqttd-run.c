@@ -246,6 +246,54 @@ void myqttd_run_load_modules (MyQttdCtx * ctx, axlDoc * doc)
 	return;
 }
 
+/** 
+ * @brief Builds listener options with the socket options declared
+ * on the provided <port> node, so listener activators can apply
+ * them. Supported attributes are: sndbuf, rcvbuf, defer-accept,
+ * fastopen, busy-poll, user-timeout and notsent-lowat (see \ref
+ * MYQTT_LISTENER_SNDBUF and following configuration items). For
+ * example:
+ *
+ * \code
+ * <port proto="mqtt" sndbuf="262144" defer-accept="5" notsent-lowat="16384">1883</port>
+ * \endcode
+ *
+ * @param ctx The myqttd context.
+ *
+ * @param port_node The <port> node being activated.
+ *
+ * @return New options to be passed to the listener (which takes
+ * ownership) or NULL if the node does not declare socket options.
+ */
+MyQttConnOpts * myqttd_run_listener_opts (MyQttdCtx * ctx, axlNode * port_node)
+{
+	const char    * attrs[] = {"sndbuf", "rcvbuf", "defer-accept", "fastopen", "busy-poll", "user-timeout", "notsent-lowat", NULL};
+	MyQttConnOpts * opts    = NULL;
+	int             iterator;
+	int             value;
+
+	if (port_node == NULL)
+		return NULL;
+
+	/* attributes follow MyQttConfItem order */
+	iterator = 0;
+	while (attrs[iterator]) {
+		if (HAS_ATTR (port_node, attrs[iterator])) {
+			value = myqtt_support_strtod (ATTR_VALUE (port_node, attrs[iterator]), NULL);
+			if (opts == NULL)
+				opts = myqtt_conn_opts_new ();
+			if (! myqtt_conn_opts_set_sock_opt (opts, MYQTT_LISTENER_SNDBUF + iterator, value))
+				wrn ("wrong value for listener option %s='%s' at port %s, ignoring", 
+				     attrs[iterator], ATTR_VALUE (port_node, attrs[iterator]), axl_node_get_content (port_node, NULL));
+			else
+				msg ("listener option %s=%d for port %s", attrs[iterator], value, axl_node_get_content (port_node, NULL));
+		} /* end if */
+		iterator++;
+	} /* end while */
+
+	return opts;
+}
+
 MyQttConn * __myqttd_run_start_mqtt_listener (MyQttdCtx * ctx, MyQttCtx * my_ctx, axlNode * port_node, 
 					      const char * bind_addr, const char * port, axlPointer user_data)
 {
@@ -258,7 +306,7 @@ MyQttConn * __myqttd_run_start_mqtt_listener (MyQttdCtx * ctx, MyQttCtx * my_ctx
 		  /* port to use */
 		  port,
 		  /* opts */
-		  NULL,
+		  myqttd_run_listener_opts (ctx, port_node),
 		  /* on ready callbacks */
 		  NULL, NULL);
 }
@@ -451,9 +499,12 @@ MyQttPublishCodes __myqttd_run_on_publish_msg (MyQttCtx * myqtt_ctx, MyQttConn *
 		iterator++;
 	} /* end while */
 
-	msg ("PUB id %d (%s:%s) -> [%s] (qos %d, size %d, total %d, domain: %s) : ok", myqtt_msg_get_id (msg), 
-	     myqtt_conn_get_host (conn), myqtt_conn_get_port (conn), myqtt_msg_get_topic (msg),
-	     myqtt_msg_get_qos (msg), myqtt_msg_get_app_msg_size (msg), myqtt_msg_get_payload_size (msg), domain->name);
+	/* per message log, sampled (see publish-sample) */
+	if (MYQTTD_LOG_ENABLED (ctx, LOG_REPORT_GENERAL) && myqttd_log_publish_sampled (ctx)) {
+		msg ("PUB id %d (%s:%s) -> [%s] (qos %d, size %d, total %d, domain: %s) : ok", myqtt_msg_get_id (msg), 
+		     myqtt_conn_get_host (conn), myqtt_conn_get_port (conn), myqtt_msg_get_topic (msg),
+		     myqtt_msg_get_qos (msg), myqtt_msg_get_app_msg_size (msg), myqtt_msg_get_payload_size (msg), domain->name);
+	} /* end if */
 	
 	return MYQTT_PUBLISH_OK; /* allow publish */
 }
@@ -558,82 +609,43 @@ axl_bool __myqttd_run_on_store_msg (MyQttCtx * myqtt_ctx, MyQttConn * conn,
 	MyQttdDomain        * domain   = _domain;
 	MyQttdCtx           * ctx      = domain->ctx;
 	int                   value    = 0;
-	char                * key;
 
 	/* check if domain has settings and message limit */
-	if (domain->initialized && domain->use_settings) {
-		if (domain->settings && domain->settings->storage_quota_limit > 0) {
-
-			key   = axl_strdup_printf ("%s_str:qt", client_identifier);
-			value = PTR_TO_INT (myqtt_ctx_get_data (myqtt_ctx, key));
+	if (domain->initialized && domain->use_settings && domain->settings) {
+		/* check number of messages queued (usage counters,
+		 * see myqtt_storage_queued_messages_offline) */
+		if (domain->settings->storage_messages_limit > 0) {
+			value = myqtt_storage_queued_messages_offline (myqtt_ctx, client_identifier);
+			if (value + 1 > domain->settings->storage_messages_limit) {
+				error ("Storage messages limit reached (%d >= %d) qos %d, packet_id %d : rejecting storing message for %s (domain %s)",
+				       value, domain->settings->storage_messages_limit,
+				       qos, packet_id, client_identifier, domain->name);
+				return axl_false;
+			} /* end if */
+		} /* end if */
 
-			/* get current storage quota used */
-			if (value == 0) 
-				value = myqtt_storage_queued_messages_quota_offline (myqtt_ctx, client_identifier);
+		/* check quota used */
+		if (domain->settings->storage_quota_limit > 0) {
+			value = myqtt_storage_queued_messages_quota_offline (myqtt_ctx, client_identifier);
 			if (value + app_msg_size > (domain->settings->storage_quota_limit * 1024)) {
 				error ("Quota exceeded (%d > %d) qos %d, app_msg_size %d, packet_id %d : rejecting storing message for %s (domain %s)",
 				       value + app_msg_size, domain->settings->storage_quota_limit * 1024,
 				       qos, app_msg_size, packet_id, client_identifier, domain->name);
-				axl_free (key);
 				return axl_false;
 			} /* end if */
-
-			/* save values */
-			value += app_msg_size;
-			myqtt_ctx_set_data_full (myqtt_ctx, key, INT_TO_PTR (value), axl_free, NULL);
-			
-			/* store operation allowed */
 		} /* end if */
 	} /* end if */
 
 	return axl_true; /* store operation allowed */
 }
 
-void __myqttd_run_on_release_msg (MyQttCtx * myqtt_ctx, MyQttConn * conn, 
-				  const char * client_identifier, 
-				  int packet_id, MyQttQos qos, 
-				  unsigned char * app_msg, int app_msg_size, axlPointer _domain)
-{
-	MyQttdDomain        * domain   = _domain;
-	int                   value    = 0;
-	char                * key;
-	
-	/* check if domain has settings and message limit */
-	if (domain->initialized && domain->use_settings) {
-		if (domain->settings && domain->settings->storage_quota_limit > 0) {
-
-			/* get key and value */
-			key   = axl_strdup_printf ("%s_str:qt", client_identifier);
-			value = PTR_TO_INT (myqtt_ctx_get_data (myqtt_ctx, key));
-
-			if (value == 0) {
-				/* get current storage quota used of nothing was found cached */
-				value = myqtt_storage_queued_messages_quota_offline (myqtt_ctx, client_identifier);
-			} /* end if */
-
-			/* save values */
-			value -= app_msg_size;
-			if (value > 0) {
-				/* update stored valued */
-				myqtt_ctx_set_data_full (myqtt_ctx, key, INT_TO_PTR (value), axl_free, NULL);
-			} else {
-				/* delete key because it is not going
-				 * to be stored */
-				myqtt_hash_remove (myqtt_ctx->data, key);
-				axl_free (key);
-			}
-			
-			/* release operation accounted */
-		} /* end if */
-	} /* end if */
-
-	return;
-}
-
 void __myqttd_init_domain_context (MyQttdCtx * ctx, MyQttdDomain * domain)
 {
 	int      subs;
 	axl_bool debug_was_not_requested;
+	char  ** paths;
+	char   * cpus;
+	int      iterator;
 
 	if (domain->initialized)
 		return;
@@ -641,6 +653,16 @@ void __myqttd_init_domain_context (MyQttdCtx * ctx, MyQttdDomain * domain)
 	/* init context */
 	domain->myqtt_ctx = myqtt_ctx_new ();
 
+	/* use same cpu sets as the main context */
+	iterator = MYQTT_THREAD_READER;
+	while (iterator <= MYQTT_THREAD_POOL) {
+		cpus = myqtt_thread_get_cpus (ctx->myqtt_ctx, iterator);
+		if (cpus)
+			myqtt_thread_set_cpus (domain->myqtt_ctx, iterator, cpus);
+		axl_free (cpus);
+		iterator++;
+	} /* end while */
+
 	/* init this context */
 	if (! myqtt_init_ctx (domain->myqtt_ctx)) {
 		myqtt_exit_ctx (domain->myqtt_ctx, axl_true);
@@ -662,15 +684,37 @@ void __myqttd_init_domain_context (MyQttdCtx * ctx, MyQttdDomain * domain)
 		myqtt_color_log_enable (domain->myqtt_ctx, myqtt_color_log_is_enabled (ctx->myqtt_ctx));
 	}
 
-	/* configure storage path */
-	msg ("Setting storage path=%s for domain=%s", domain->storage_path, domain->name);
-	if (! myqtt_storage_set_path (domain->myqtt_ctx, domain->storage_path, 4096)) {
-		error ("Unable to configure storage path at %s, myqtt_storage_set_path failed", domain->storage_path);
+	/* configure storage path: storage="path1,path2,..." spreads
+	 * storage over several roots (shards) */
+	paths = axl_split (domain->storage_path, 1, ",");
+	if (paths == NULL || paths[0] == NULL) {
+		error ("Unable to configure storage path at %s, failed to parse storage paths", domain->storage_path);
+		axl_freev (paths);
 		myqtt_exit_ctx (domain->myqtt_ctx, axl_true);
 		domain->myqtt_ctx = NULL;
 		return;
 	} /* end if */
 
+	iterator = 0;
+	while (paths[iterator]) {
+		axl_stream_trim (paths[iterator]);
+		if (strlen (paths[iterator]) == 0) {
+			iterator++;
+			continue;
+		} /* end if */
+
+		msg ("Setting storage path=%s for domain=%s", paths[iterator], domain->name);
+		if (iterator == 0 ? ! myqtt_storage_set_path (domain->myqtt_ctx, paths[iterator], 4096) : ! myqtt_storage_add_path (domain->myqtt_ctx, paths[iterator])) {
+			error ("Unable to configure storage path at %s, myqtt_storage_set_path/add_path failed", paths[iterator]);
+			axl_freev (paths);
+			myqtt_exit_ctx (domain->myqtt_ctx, axl_true);
+			domain->myqtt_ctx = NULL;
+			return;
+		} /* end if */
+		iterator++;
+	} /* end while */
+	axl_freev (paths);
+
 	/* call to load local storage first (before an incoming
 	 * connection) */
 	msg ("Loading storage myqtt_ctx=%p", domain->myqtt_ctx);
@@ -687,13 +731,51 @@ void __myqttd_init_domain_context (MyQttdCtx * ctx, MyQttdDomain * domain)
 	myqtt_ctx_set_on_subscribe (domain->myqtt_ctx, __myqttd_run_on_subscribe_msg, domain);
 	myqtt_ctx_set_on_unsubscribe (domain->myqtt_ctx, __myqttd_run_on_unsubscribe_msg, domain);
 
-	/* configure store and release */
+	/* configure store limits */
 	myqtt_ctx_set_on_store (domain->myqtt_ctx, __myqttd_run_on_store_msg, domain);
-	myqtt_ctx_set_on_release (domain->myqtt_ctx, __myqttd_run_on_release_msg, domain);
 
 	/* get reference to the domain settings (if any) */
 	domain->settings = myqtt_hash_lookup (ctx->domain_settings, (axlPointer) domain->use_settings);
 
+	/* configure message and session expiration */
+	if (domain->settings && (domain->settings->message_ttl > 0 || domain->settings->session_expiry > 0)) {
+		msg ("Configuring storage expiration for domain=%s (message-ttl=%d, session-expiry=%d, sweep period=%d)",
+		     domain->name, domain->settings->message_ttl, domain->settings->session_expiry, domain->settings->storage_sweep_period);
+		if (! myqtt_storage_set_expiry (domain->myqtt_ctx, 
+						domain->settings->message_ttl > 0 ? domain->settings->message_ttl : 0, 
+						domain->settings->session_expiry > 0 ? domain->settings->session_expiry : 0,
+						domain->settings->storage_sweep_period))
+			error ("Unable to configure storage expiration for domain %s, myqtt_storage_set_expiry failed", domain->name);
+	} /* end if */
+
+	/* hand off storage operations to a dedicated writer */
+	if (domain->settings && domain->settings->storage_writer_queue > 0) {
+		msg ("Starting storage writer for domain=%s (queue limit=%d)", domain->name, domain->settings->storage_writer_queue);
+		if (! myqtt_storage_writer_start (domain->myqtt_ctx, domain->settings->storage_writer_queue))
+			error ("Unable to start storage writer for domain %s, myqtt_storage_writer_start failed", domain->name);
+	} /* end if */
+
+	/* compress stored payloads */
+	if (domain->settings && domain->settings->storage_compression_threshold >= 0) {
+		msg ("Enabling storage compression for domain=%s (threshold=%d bytes)", domain->name, domain->settings->storage_compression_threshold);
+		if (! myqtt_storage_set_compression (domain->myqtt_ctx, MYQTT_STORAGE_COMPRESSION_LZ4, domain->settings->storage_compression_threshold))
+			error ("Unable to enable storage compression for domain %s, myqtt_storage_set_compression failed", domain->name);
+	} /* end if */
+
+	/* keep retained messages in memory and flush them periodically */
+	if (domain->settings && domain->settings->retained_flush_period >= 0) {
+		msg ("Enabling retained write-behind for domain=%s (flush period=%d secs)", domain->name, domain->settings->retained_flush_period);
+		if (! myqtt_storage_set_retain_write_behind (domain->myqtt_ctx, domain->settings->retained_flush_period))
+			error ("Unable to enable retained write-behind for domain %s, myqtt_storage_set_retain_write_behind failed", domain->name);
+	} /* end if */
+
+	/* publish broker metrics under $SYS/broker/ */
+	if (domain->settings && domain->settings->sys_interval > 0) {
+		msg ("Enabling $SYS metrics for domain=%s (interval=%d secs)", domain->name, domain->settings->sys_interval);
+		if (! myqtt_metrics_set_sys_interval (domain->myqtt_ctx, domain->settings->sys_interval))
+			error ("Unable to enable $SYS metrics for domain %s, myqtt_metrics_set_sys_interval failed", domain->name);
+	} /* end if */
+
 	/* flag domain as initialized */
 	domain->initialized = axl_true;
 
@@ -1029,7 +1111,7 @@ MyQttConnAckTypes    myqttd_run_send_connection_to_domain (MyQttdCtx      * ctx,
 
 	/* insert into connections table */
 	axl_hash_insert_full (domain->myqtt_ctx->client_ids, 
-			      axl_strdup (conn2->client_identifier), axl_free,
+			      myqtt_support_intern (domain->myqtt_ctx, conn2->client_identifier), myqtt_support_intern_release,
 			      conn2, NULL);
 	/* release lock */
 	myqtt_mutex_unlock (&domain->myqtt_ctx->client_ids_m);
@@ -1246,6 +1328,22 @@ axl_bool myqttd_run_domain_settings_load (MyQttdCtx * ctx, axlDoc * doc)
 	__myqttd_run_get_value (ctx, doc, "/myqtt/domain-settings/global-settings/month-message-quota", "int", &(ctx->default_setting->month_message_quota), -1);
 	/* day-message-quota */
 	__myqttd_run_get_value (ctx, doc, "/myqtt/domain-settings/global-settings/day-message-quota", "int", &(ctx->default_setting->day_message_quota), -1);
+	/* message-ttl */
+	__myqttd_run_get_value (ctx, doc, "/myqtt/domain-settings/global-settings/message-ttl", "int", &(ctx->default_setting->message_ttl), -1);
+	/* session-expiry */
+	__myqttd_run_get_value (ctx, doc, "/myqtt/domain-settings/global-settings/session-expiry", "int", &(ctx->default_setting->session_expiry), -1);
+	/* storage-sweep-period */
+	__myqttd_run_get_value (ctx, doc, "/myqtt/domain-settings/global-settings/storage-sweep-period", "int", &(ctx->default_setting->storage_sweep_period), 60);
+	/* storage-writer-queue */
+	__myqttd_run_get_value (ctx, doc, "/myqtt/domain-settings/global-settings/storage-writer-queue", "int", &(ctx->default_setting->storage_writer_queue), -1);
+	/* storage-compression-threshold */
+	__myqttd_run_get_value (ctx, doc, "/myqtt/domain-settings/global-settings/storage-compression-threshold", "int", &(ctx->default_setting->storage_compression_threshold), -1);
+
+	/* retained-flush-period */
+	__myqttd_run_get_value (ctx, doc, "/myqtt/domain-settings/global-settings/retained-flush-period", "int", &(ctx->default_setting->retained_flush_period), -1);
+
+	/* sys-interval */
+	__myqttd_run_get_value (ctx, doc, "/myqtt/domain-settings/global-settings/sys-interval", "int", &(ctx->default_setting->sys_interval), -1);
 
 	/* get first definition */
 	node = axl_doc_get (doc, "/myqtt/domain-settings/domain-setting");
@@ -1307,6 +1405,34 @@ axl_bool myqttd_run_domain_settings_load (MyQttdCtx * ctx, axlDoc * doc)
 		__myqttd_run_get_value_by_node (ctx, node, "day-message-quota", "int", &(setting->day_message_quota),
 						ctx->default_setting->day_message_quota);
 
+		/* message-ttl : seconds a message can stay queued for an offline client */
+		__myqttd_run_get_value_by_node (ctx, node, "message-ttl", "int", &(setting->message_ttl),
+						ctx->default_setting->message_ttl);
+
+		/* session-expiry : seconds a disconnected session is kept */
+		__myqttd_run_get_value_by_node (ctx, node, "session-expiry", "int", &(setting->session_expiry),
+						ctx->default_setting->session_expiry);
+
+		/* storage-sweep-period : seconds between storage sweeper runs */
+		__myqttd_run_get_value_by_node (ctx, node, "storage-sweep-period", "int", &(setting->storage_sweep_period),
+						ctx->default_setting->storage_sweep_period);
+
+		/* storage-writer-queue : max storage operations pending for the storage writer */
+		__myqttd_run_get_value_by_node (ctx, node, "storage-writer-queue", "int", &(setting->storage_writer_queue),
+						ctx->default_setting->storage_writer_queue);
+
+		/* storage-compression-threshold : min payload size to compress payloads stored */
+		__myqttd_run_get_value_by_node (ctx, node, "storage-compression-threshold", "int", &(setting->storage_compression_threshold),
+						ctx->default_setting->storage_compression_threshold);
+
+		/* retained-flush-period : seconds between retained messages flushes */
+		__myqttd_run_get_value_by_node (ctx, node, "retained-flush-period", "int", &(setting->retained_flush_period),
+						ctx->default_setting->retained_flush_period);
+
+		/* sys-interval : seconds between $SYS/broker/ metrics publications */
+		__myqttd_run_get_value_by_node (ctx, node, "sys-interval", "int", &(setting->sys_interval),
+						ctx->default_setting->sys_interval);
+
 		/* get next module */
 		node = axl_node_get_next_called (node, "domain-setting");
 	} /* end while */
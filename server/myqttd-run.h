@@ -67,6 +67,8 @@ void myqttd_run_cleanup   (MyQttdCtx * ctx);
 axl_bool myqttd_run_check_no_load_module (MyQttdCtx  * ctx, 
 					  const char * module_to_check);
 
+MyQttConnOpts * myqttd_run_listener_opts (MyQttdCtx * ctx, axlNode * port_node);
+
 /** 
  * @}
  */
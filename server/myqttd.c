@@ -104,6 +104,32 @@ void __myqttd_thread_pool_conf (MyQttdCtx * ctx)
 	return;
 }
 
+/* configure cpu sets for reader, sequencer and pool threads */
+void __myqttd_thread_affinity_conf (MyQttdCtx * ctx)
+{
+	axlNode          * node;
+	const char       * attrs[]   = {"reader", "sequencer", "pool"};
+	MyQttThreadClass   classes[] = {MYQTT_THREAD_READER, MYQTT_THREAD_SEQUENCER, MYQTT_THREAD_POOL};
+	int                iterator;
+
+	node = axl_doc_get (ctx->config, "/myqtt/global-settings/thread-affinity");
+	if (node == NULL)
+		return;
+
+	iterator = 0;
+	while (iterator < 3) {
+		if (HAS_ATTR (node, attrs[iterator])) {
+			msg ("Setting %s threads cpu set to %s", attrs[iterator], ATTR_VALUE (node, attrs[iterator]));
+			if (! myqtt_thread_set_cpus (ctx->myqtt_ctx, classes[iterator], ATTR_VALUE (node, attrs[iterator])))
+				error ("Unable to configure %s threads cpu set to %s (wrong cpu list or not supported)", 
+				       attrs[iterator], ATTR_VALUE (node, attrs[iterator]));
+		} /* end if */
+		iterator++;
+	} /* end while */
+
+	return;
+}
+
 /* configure here back log */
 void __myqttd_server_backlog (MyQttdCtx * ctx)
 {
@@ -235,6 +261,9 @@ axl_bool  myqttd_init (MyQttdCtx   * ctx,
 	/* configure thread pool here */
 	__myqttd_thread_pool_conf (ctx);
 
+	/* configure thread cpu sets */
+	__myqttd_thread_affinity_conf (ctx);
+
 	/* configure serveral limits */
 	__myqttd_acquire_limits (ctx);
 
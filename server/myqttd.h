@@ -120,6 +120,13 @@ void  myqttd_error (MyQttdCtx * ctx, axl_bool ignore_debug, const char * file, i
  */
 #define abort_error(m,...) do{myqttd_error (ctx, axl_true, __AXL_FILE__, __AXL_LINE__, m, ##__VA_ARGS__);}while(0)
 
+/** 
+ * @internal Checks if a message of the provided type (\ref
+ * LogReportType) is reported (console or log) so msg, msg2 and
+ * tbc_access skip building their arguments otherwise.
+ */
+#define MYQTTD_LOG_ENABLED(c, t) myqttd_log_type_enabled (c, t)
+
 /** 
  * Drop a msg to the console stdout.
  *
@@ -130,7 +137,7 @@ void  myqttd_error (MyQttdCtx * ctx, axl_bool ignore_debug, const char * file, i
  * 
  * @param m The console message to output.
  */
-#define msg(m,...)   do{myqttd_msg (ctx, __AXL_FILE__, __AXL_LINE__, m, ##__VA_ARGS__);}while(0)
+#define msg(m,...)   do{if (MYQTTD_LOG_ENABLED (ctx, LOG_REPORT_GENERAL)) myqttd_msg (ctx, __AXL_FILE__, __AXL_LINE__, m, ##__VA_ARGS__);}while(0)
 void  myqttd_msg   (MyQttdCtx * ctx, const char * file, int line, const char * format, ...);
 
 /** 
@@ -143,7 +150,7 @@ void  myqttd_msg   (MyQttdCtx * ctx, const char * file, int line, const char * f
  * 
  * @param m The console message to output.
  */
-#define msg2(m,...)   do{myqttd_msg2 (ctx, __AXL_FILE__, __AXL_LINE__, m, ##__VA_ARGS__);}while(0)
+#define msg2(m,...)   do{if (MYQTTD_LOG_ENABLED (ctx, LOG_REPORT_GENERAL)) myqttd_msg2 (ctx, __AXL_FILE__, __AXL_LINE__, m, ##__VA_ARGS__);}while(0)
 void  myqttd_msg2   (MyQttdCtx * ctx, const char * file, int line, const char * format, ...);
 
 
@@ -187,7 +194,7 @@ void  myqttd_wrn_sl   (MyQttdCtx * ctx, const char * file, int line, const char
  * 
  * @param m The console message to output.
  */
-#define tbc_access(m,...)   do{myqttd_access (ctx, __AXL_FILE__, __AXL_LINE__, m, ##__VA_ARGS__);}while(0)
+#define tbc_access(m,...)   do{if (MYQTTD_LOG_ENABLED (ctx, LOG_REPORT_ACCESS)) myqttd_access (ctx, __AXL_FILE__, __AXL_LINE__, m, ##__VA_ARGS__);}while(0)
 void  myqttd_access   (MyQttdCtx * ctx, const char * file, int line, const char * format, ...);
 
 /** 
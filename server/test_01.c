@@ -1623,8 +1623,8 @@ axl_bool  test_09 (void) {
 		return axl_false;
 	} /* end if */
 
-	value = PTR_TO_INT (myqtt_ctx_get_data (domain->myqtt_ctx, "test_05_str:qt"));
-	printf ("Test 09: stored cached value for test_05 is: %d\n", value);
+	value = myqtt_storage_queued_messages_quota_offline (domain->myqtt_ctx, "test_05");
+	printf ("Test 09: quota used by test_05 is: %d\n", value);
 
 	/* close message */
 	printf ("Test 09: closing connection..\n");
@@ -1677,8 +1677,8 @@ axl_bool  test_09 (void) {
 	while (iterator < 10) {
 		iterator++;
 
-		value = PTR_TO_INT (myqtt_ctx_get_data (domain->myqtt_ctx, (axlPointer) "test_05_str:qt"));
-		printf ("Test 09: stored cached value for test_05 after removing is: %d\n", value);
+		value = myqtt_storage_queued_messages_quota_offline (domain->myqtt_ctx, "test_05");
+		printf ("Test 09: quota used by test_05 after removing is: %d\n", value);
 		if (value != 0) {
 			/* wait a bit..*/
 			if (iterator < 10) {
@@ -1987,8 +1987,10 @@ MyQttPublishCodes   test_10b_handle_publish  (MyQttdCtx * ctx,       MyQttdDomai
 			exit (-1);
 		}
 
+		/* connection subscription hashes are created on demand */
+		cursor = NULL;
 		if (axl_cmp ("get-subscriptions", myqtt_msg_get_topic (msg)))
-			cursor = axl_hash_cursor_new (conn->subs);
+			cursor = conn->subs ? axl_hash_cursor_new (conn->subs) : NULL;
 		else if (axl_cmp ("get-subscriptions-ctx", myqtt_msg_get_topic (msg)))
 			cursor = axl_hash_cursor_new (conn->ctx->subs);
 		else if (axl_cmp ("get-subscriptions-domain", myqtt_msg_get_topic (msg)))
@@ -1998,7 +2000,7 @@ MyQttPublishCodes   test_10b_handle_publish  (MyQttdCtx * ctx,       MyQttdDomai
 		iterator = 0;
 		while (iterator < 2) {
 			
-			while (axl_hash_cursor_has_item (cursor)) {
+			while (cursor && axl_hash_cursor_has_item (cursor)) {
 				if (axl_cmp ("get-subscriptions", myqtt_msg_get_topic (msg)))
 					aux = axl_strdup_printf ("%s.%d", axl_hash_cursor_get_key (cursor), axl_hash_cursor_get_value (cursor));
 				else if (axl_cmp ("get-subscriptions-ctx", myqtt_msg_get_topic (msg)))
@@ -2020,14 +2022,16 @@ MyQttPublishCodes   test_10b_handle_publish  (MyQttdCtx * ctx,       MyQttdDomai
 				/* next cursor */
 				axl_hash_cursor_next (cursor);
 			}
-			axl_hash_cursor_free (cursor);
+			if (cursor)
+				axl_hash_cursor_free (cursor);
+			cursor = NULL;
 
 			iterator++;
 
 			/* now get wild card subscriptions */
 			if (iterator == 1) {
 				if (axl_cmp ("get-subscriptions", myqtt_msg_get_topic (msg)))
-					cursor = axl_hash_cursor_new (conn->wild_subs);
+					cursor = conn->wild_subs ? axl_hash_cursor_new (conn->wild_subs) : NULL;
 				else if (axl_cmp ("get-subscriptions-ctx", myqtt_msg_get_topic (msg)))
 					cursor = axl_hash_cursor_new (conn->ctx->wild_subs);
 				else if (axl_cmp ("get-subscriptions-domain", myqtt_msg_get_topic (msg)))
@@ -2346,6 +2350,76 @@ axl_bool  test_11 (void) {
 	
 	return axl_true;
 }
+
+axl_bool  test_11a (void) {
+	
+	MyQttAsyncQueue * queue;
+	MyQttdCtx       * ctx;
+	MyQttCtx        * myqtt_ctx;
+	MyQttConn       * conn;
+	MyQttConnOpts   * opts;
+	int               sub_result;
+
+	/* call to init the base library and close it */
+	printf ("Test 11-a: init library and server engine (using test_23.conf)..\n");
+	ctx       = common_init_ctxd (NULL, "test_23.conf");
+	if (ctx == NULL) {
+		printf ("Test 11-a: failed to start library and server engine..\n");
+		return axl_false;
+	} /* end if */
+
+	myqtt_ctx = common_init_ctx ();
+	if (! myqtt_init_ctx (myqtt_ctx)) {
+		printf ("Error: unable to initialize MyQtt library..\n");
+		return axl_false;
+	} /* end if */
+	
+	/* disable verification (no client certificate is provided) */
+	opts = myqtt_conn_opts_new ();
+	myqtt_tls_opts_ssl_peer_verify (opts, axl_false);
+	myqtt_tls_opts_set_server_name (opts, "test_01.context");
+
+	/* the TLS port declares socket options (sndbuf, rcvbuf):
+	 * clients without certificate must still be accepted */
+	conn = myqtt_tls_conn_new (myqtt_ctx, "test_01", axl_false, 30, listener_host, listener_tls_port, opts, NULL, NULL);
+	if (! myqtt_conn_is_ok (conn, axl_false)) {
+		printf ("ERROR: expected being able to connect to %s:%s without client certificate..\n", listener_host, listener_tls_port);
+		return axl_false;
+	} /* end if */
+
+	/* create queue */
+	queue  = common_configure_reception (conn);
+
+	/* subscribe and publish to check the connection works */
+	if (! myqtt_conn_sub (conn, 10, "myqtt/test", 0, &sub_result)) {
+		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d", sub_result);
+		return axl_false;
+	} /* end if */	
+
+	if (! common_send_msg (conn, "myqtt/test", "test", MYQTT_QOS_0)) {
+		printf ("ERROR: expected to be able to send a message but it failed..\n");
+		return axl_false;
+	} /* end if */
+
+	if (! common_receive_and_check (queue, "myqtt/test", "test", MYQTT_QOS_0, axl_false)) {
+		printf ("ERROR: expected to receive different message..\n");
+		return axl_false;
+	}
+
+	/* release queue */
+	myqtt_async_queue_unref (queue);
+
+	/* close connection */
+	myqtt_conn_close (conn);
+
+	/* release context */
+	myqtt_exit_ctx (myqtt_ctx, axl_true);
+	printf ("Test 11-a: finishing MyQttdCtx..\n");
+	/* finish server */
+	myqttd_exit (ctx, axl_true, axl_true);
+	
+	return axl_true;
+}
 #endif
 
 #if defined(ENABLE_WEBSOCKET_SUPPORT)
@@ -3622,6 +3696,205 @@ axl_bool test_22 (void) {
 	return axl_true;
 }
 
+/** 
+ * @internal Checks lines reported by test 23 found at the provided
+ * log: they must keep the order they were reported (values above
+ * last) and their payload must be complete.
+ *
+ * @return Number of lines found or -1 if it fails.
+ */
+int test_23_check_lines (const char * path, int * last)
+{
+	FILE * handle;
+	char   line[8192];
+	char * marker;
+	int    value;
+	int    size;
+	int    found = 0;
+
+	handle = fopen (path, "r");
+	if (handle == NULL) {
+		printf ("ERROR: unable to open %s\n", path);
+		return -1;
+	} /* end if */
+
+	while (fgets (line, sizeof (line), handle)) {
+		marker = strstr (line, "test23-line ");
+		if (marker == NULL)
+			continue;
+		if (sscanf (marker, "test23-line %d %d ", &value, &size) != 2) {
+			printf ("ERROR: unable to parse line found at %s: %s\n", path, line);
+			fclose (handle);
+			return -1;
+		} /* end if */
+
+		/* lines must be found in the order they were reported */
+		if (value <= (*last)) {
+			printf ("ERROR: found line %d after line %d at %s\n", value, (*last), path);
+			fclose (handle);
+			return -1;
+		} /* end if */
+		(*last) = value;
+
+		/* payload is the last item */
+		marker = strrchr (line, ' ');
+		if (marker == NULL || (int) strlen (marker + 1) != size + 1 || marker[size + 1] != '\n') {
+			printf ("ERROR: line %d found at %s is not complete (expected %d bytes)\n", value, path, size);
+			fclose (handle);
+			return -1;
+		} /* end if */
+		found++;
+	} /* end while */
+
+	fclose (handle);
+	return found;
+}
+
+axlPointer test_23_pipe_reader (axlPointer _fds)
+{
+	int  * fds = _fds;
+	char   buffer[4096];
+	int    size;
+	FILE * handle;
+
+	/* copy everything written into the pipe until it is closed */
+	handle = fopen ("reg-test-23/pipe.log", "w");
+	while ((size = read (fds[0], buffer, sizeof (buffer))) > 0) {
+		if (handle && fwrite (buffer, 1, size, handle) != (size_t) size) {
+			fclose (handle);
+			handle = NULL;
+		} /* end if */
+	} /* end while */
+	if (handle)
+		fclose (handle);
+
+	return NULL;
+}
+
+axl_bool test_23 (void) {
+
+	MyQttdCtx       * ctx;
+	MyQttThread       reader;
+	char            * payload;
+	int               fds[2];
+	int               iterator;
+	int               size;
+	int               dropped;
+	int               found;
+	int               total;
+	int               last;
+
+	/* clean previous runs */
+	if (system ("rm -rf reg-test-23 && mkdir reg-test-23") != 0)
+		return axl_false;
+
+	/* call to init the base library and close it */
+	printf ("Test 23: init library and server engine (log ring size 4096)..\n");
+	ctx       = common_init_ctxd (NULL, "test_24.conf");
+	if (ctx == NULL) {
+		printf ("Test 23: failed to start library and server engine..\n");
+		return axl_false;
+	} /* end if */
+
+	payload = axl_new (char, 1501);
+	memset (payload, 'x', 1500);
+
+	/* mixed line sizes: most lines are queued (wrapping the ring
+	 * many times) while every 50th line is larger than a quarter
+	 * of the ring (written by the reporting thread) */
+	printf ("Test 23: reporting 2000 lines with mixed sizes..\n");
+	dropped  = myqttd_log_dropped (ctx);
+	iterator = 0;
+	while (iterator < 2000) {
+		size = (iterator % 50) == 49 ? 1500 : 1 + ((iterator * 37) % 600);
+		tbc_access ("test23-line %d %d %.*s", iterator, size, size, payload);
+
+		/* let the writer keep up */
+		if ((iterator % 4) == 3)
+			myqtt_sleep (1000);
+		iterator++;
+	} /* end while */
+
+	/* stop the writer (queued lines are written) and reopen */
+	__myqttd_log_reopen (ctx);
+	dropped = myqttd_log_dropped (ctx) - dropped;
+	last    = -1;
+	found   = test_23_check_lines ("reg-test-23/access.log", &last);
+	printf ("Test 23: found %d lines (dropped %d)..\n", found, dropped);
+	if (found < 0 || (2000 - found) > dropped) {
+		printf ("ERROR: expected to find every line not dropped (found %d, dropped %d)\n", found, dropped);
+		return axl_false;
+	} /* end if */
+
+	/* block the writer on a pipe nobody reads until lines are
+	 * dropped */
+	printf ("Test 23: filling log ring until lines are dropped..\n");
+	if (pipe (fds) != 0)
+		return axl_false;
+	close (ctx->access_log);
+	myqttd_log_configure (ctx, LOG_REPORT_ACCESS, fds[1]);
+	dropped  = myqttd_log_dropped (ctx);
+	iterator = 0;
+	while (myqttd_log_dropped (ctx) == dropped && iterator < 100000) {
+		tbc_access ("test23-line %d %d %.*s", 2000 + iterator, 200, 200, payload);
+		iterator++;
+	} /* end while */
+	if (myqttd_log_dropped (ctx) == dropped) {
+		printf ("ERROR: expected lines to be dropped after reporting %d lines\n", iterator);
+		return axl_false;
+	} /* end if */
+
+	/* read the pipe while the writer is stopped: every line
+	 * queued must be written before the pipe is closed */
+	if (! myqtt_thread_create (&reader, test_23_pipe_reader, fds, MYQTT_THREAD_CONF_END))
+		return axl_false;
+	__myqttd_log_reopen (ctx);
+	myqtt_thread_destroy (&reader, axl_false);
+	close (fds[0]);
+
+	dropped = myqttd_log_dropped (ctx) - dropped;
+	last    = 1999;
+	found   = test_23_check_lines ("reg-test-23/pipe.log", &last);
+	printf ("Test 23: found %d lines written to the pipe out of %d (dropped %d)..\n", found, iterator, dropped);
+	if (found < 0 || (iterator - found) > dropped || found == iterator) {
+		printf ("ERROR: expected to find every line not dropped (reported %d, found %d, dropped %d)\n", iterator, found, dropped);
+		return axl_false;
+	} /* end if */
+
+	/* lines lost are reported by the writer */
+	if (system ("grep -q 'log rings full' reg-test-23/error.log") != 0) {
+		printf ("ERROR: expected to find dropped lines reported at the error log\n");
+		return axl_false;
+	} /* end if */
+
+	/* writer was started again on reopen */
+	printf ("Test 23: reporting after reopening logs..\n");
+	last     = -1;
+	total    = test_23_check_lines ("reg-test-23/access.log", &last);
+	dropped  = myqttd_log_dropped (ctx);
+	iterator = 0;
+	while (iterator < 100) {
+		tbc_access ("test23-line %d %d %.*s", 200000 + iterator, 100, 100, payload);
+		iterator++;
+	} /* end while */
+	__myqttd_log_reopen (ctx);
+	dropped = myqttd_log_dropped (ctx) - dropped;
+	last    = -1;
+	found   = test_23_check_lines ("reg-test-23/access.log", &last);
+	if (total < 0 || found < 0 || (100 - (found - total)) > dropped) {
+		printf ("ERROR: expected to find lines reported after reopening (found %d, before %d, dropped %d)\n", found, total, dropped);
+		return axl_false;
+	} /* end if */
+
+	axl_free (payload);
+
+	/* finish server */
+	printf ("Test 23: finishing context..\n");
+	myqttd_exit (ctx, axl_true, axl_true);
+
+	return axl_true;
+}
+
 
 #define CHECK_TEST(name) if (run_test_name == NULL || axl_cmp (run_test_name, name))
 
@@ -3769,6 +4042,9 @@ int main (int argc, char ** argv)
 #if defined(ENABLE_TLS_SUPPORT)
 	CHECK_TEST("test_11")
 	run_test (test_11, "Test 11: checking domain activation when connected with TLS (hostname == domain name)");
+
+	CHECK_TEST("test_11a")
+	run_test (test_11a, "Test 11-a: TLS port with socket options accepts clients without certificate");
 #endif
 
 #if defined(ENABLE_WEBSOCKET_SUPPORT)
@@ -3808,6 +4084,9 @@ int main (int argc, char ** argv)
 	CHECK_TEST("test_22")
 	run_test (test_22, "Test 22: time tracking (day and month change) ");
 
+	CHECK_TEST("test_23")
+	run_test (test_23, "Test 23: log rings (wraparound, dropped lines and reopen) ");
+
 	/* check support to limit amount of subscriptions a user can
 	 * do */
 
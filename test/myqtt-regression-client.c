@@ -37,6 +37,10 @@
  *                        http://www.aspl.es/myqtt
  */
 
+#if defined(__linux__) && ! defined(_GNU_SOURCE)
+/* required to get pthread_getaffinity_np (3) and cpu_set_t */
+#define _GNU_SOURCE
+#endif
 #include <myqtt.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -165,6 +169,10 @@ int test_count_in_dir (const char * directory, RegTestMyQttCountTypes  count_typ
 #include <myqtt-conn-private.h>
 #include <myqtt-ctx-private.h>
 
+#if defined(AXL_OS_UNIX)
+#include <netinet/tcp.h>
+#endif
+
 axl_bool test_common_enable_debug = axl_false;
 
 /* default listener location */
@@ -798,1637 +806,3141 @@ axl_bool test_01 (void) {
 }
 
 
-axl_bool test_02 (void) {
+typedef struct _Test01aRefs {
+	MyQttCtx    * ctx;
+	MyQttConn   * conn;
+	MyQttThread   thread;
+	axl_bool      result;
+} Test01aRefs;
+
+axlPointer test_01a_refs (Test01aRefs * refs)
+{
+	int iterator = 0;
+	int msg_id;
+	int last_id  = -1;
+
+	refs->result = axl_true;
+	while (iterator < 100000) {
+		/* msg ids are handed out without a lock: they must
+		 * always grow */
+		msg_id = __myqtt_msg_get_next_id (refs->ctx, "test_01a");
+		if (msg_id <= last_id) {
+			refs->result = axl_false;
+			return NULL;
+		} /* end if */
+		last_id = msg_id;
+
+		/* take and drop references like the reader and fan-out
+		 * loops do */
+		if (! myqtt_conn_ref (refs->conn, "test_01a") || ! myqtt_ctx_ref2 (refs->ctx, "test_01a")) {
+			refs->result = axl_false;
+			return NULL;
+		} /* end if */
+		myqtt_conn_uncheck_ref (refs->conn);
+		myqtt_conn_unref (refs->conn, "test_01a");
+		myqtt_ctx_unref2 (&refs->ctx, "test_01a");
+		myqtt_conn_unref (refs->conn, "test_01a");
+		iterator++;
+	} /* end while */
+
+	return NULL;
+}
+
+axl_bool test_01a (void) {
+
+	MyQttCtx    * ctx = init_ctx ();
+	MyQttConn   * conn;
+	Test01aRefs   refs[8];
+	int           ctx_refs;
+	int           conn_refs;
+	int           iterator;
+	int           msg_id;
 
-	MyQttCtx  * ctx = init_ctx ();
-	MyQttConn * conn;
-	int         sub_result;
 	if (! ctx)
 		return axl_false;
 
-	printf ("Test 02: creating connection..\n");
-
-	/* now connect to the listener:
-	   client_identifier -> test_02
-	   clean_session -> axl_true
-	   keep_alive -> 30 */
-	conn = myqtt_conn_new (ctx, "test_02", axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
+	conn = myqtt_conn_new (ctx, "test_01a", axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
 	if (! myqtt_conn_is_ok (conn, axl_false)) {
 		printf ("ERROR: unable to connect to %s:%s..\n", listener_host, listener_port);
 		return axl_false;
 	} /* end if */
 
-	printf ("Test 02: connected without problems..\n");
+	/* hammer references from several threads */
+	ctx_refs  = myqtt_ctx_ref_count (ctx);
+	conn_refs = myqtt_conn_ref_count (conn);
+	msg_id    = __myqtt_msg_get_next_id (ctx, "test_01a");
+	iterator  = 0;
+	while (iterator < 8) {
+		refs[iterator].ctx  = ctx;
+		refs[iterator].conn = conn;
+		if (! myqtt_thread_create (&refs[iterator].thread, (MyQttThreadFunc) test_01a_refs, &refs[iterator], MYQTT_THREAD_CONF_END)) {
+			printf ("ERROR: failed to create thread..\n");
+			return axl_false;
+		} /* end if */
+		iterator++;
+	} /* end while */
 
-	/* subscribe to a topic */
-	if (! myqtt_conn_sub (conn, 10, "myqtt/test", 0, &sub_result)) {
-		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+	iterator = 0;
+	while (iterator < 8) {
+		myqtt_thread_destroy (&refs[iterator].thread, axl_false);
+		if (! refs[iterator].result) {
+			printf ("ERROR: failed to acquire reference or msg ids went backwards..\n");
+			return axl_false;
+		} /* end if */
+		iterator++;
+	} /* end while */
+
+	/* references must be balanced */
+	printf ("Test 01a: refs after stress: ctx=%d (expected %d), conn=%d (expected %d)\n", 
+		myqtt_ctx_ref_count (ctx), ctx_refs, myqtt_conn_ref_count (conn), conn_refs);
+	if (myqtt_ctx_ref_count (ctx) != ctx_refs || myqtt_conn_ref_count (conn) != conn_refs) {
+		printf ("ERROR: reference counting is not balanced..\n");
 		return axl_false;
 	} /* end if */
 
-	/* close connection */
-	printf ("Test 02: closing connection..\n");
-	myqtt_conn_close (conn);
+	/* no msg id may have been lost */
+	if ((__myqtt_msg_get_next_id (ctx, "test_01a") - msg_id) < (8 * 100000 + 1)) {
+		printf ("ERROR: msg ids were lost while generated concurrently..\n");
+		return axl_false;
+	} /* end if */
 
-	/* release context */
-	printf ("Test 02: releasing context..\n");
+	myqtt_conn_close (conn);
 	myqtt_exit_ctx (ctx, axl_true);
 
+	return axl_true;
+}
 
+long test_01b_resident_bytes (void)
+{
+#if defined(AXL_OS_UNIX)
+	FILE * file;
+	long   size     = 0;
+	long   resident = -1;
 
-	return axl_true;
+	/* second value is the resident set size in pages */
+	file = fopen ("/proc/self/statm", "r");
+	if (file == NULL)
+		return -1;
+	if (fscanf (file, "%ld %ld", &size, &resident) != 2)
+		resident = -1;
+	fclose (file);
+
+	if (resident < 0)
+		return -1;
+	return resident * sysconf (_SC_PAGESIZE);
+#else
+	return -1;
+#endif
 }
 
-axl_bool test_02_a (void) {
+axl_bool test_01b (void) {
+
+	MyQttCtx    * ctx = init_ctx ();
+	MyQttConn   * listener;
+	MyQttConn   * conns[400];
+	const char  * local_host = "127.0.0.1";
+	const char  * local_port = "27892";
+	char        * client_id;
+	long          before;
+	long          after;
+	int           iterator;
 
-	MyQttCtx  * ctx = init_ctx ();
-	MyQttConn * conn;
-	int         sub_result;
 	if (! ctx)
 		return axl_false;
 
-	printf ("Test 02-a: creating connection..\n");
-
-	/* now connect to the listener:
-	   client_identifier -> test_02
-	   clean_session -> axl_true
-	   keep_alive -> 30 */
-	conn = myqtt_conn_new (ctx, "test_02", axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
-	if (! myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: unable to connect to %s:%s..\n", listener_host, listener_port);
+	/* create a local listener so both sides of each connection
+	 * are accounted in this process */
+	listener = myqtt_listener_new (ctx, local_host, local_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (listener, axl_false)) {
+		printf ("ERROR: failed to start listener at myqtt_listener_new () %s:%s..\n", local_host, local_port);
 		return axl_false;
 	} /* end if */
 
-	printf ("Test 02-a: connected without problems..\n");
-
-	/* subscribe to a topic */
-	if (! myqtt_conn_sub (conn, 10, "myqtt/+", 0, &sub_result)) {
-		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+	/* warm up: first connection pays thread pool and reader setup */
+	conns[0] = myqtt_conn_new (ctx, "test_01b-warm-up", axl_true, 0, local_host, local_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (conns[0], axl_false)) {
+		printf ("ERROR: unable to connect to %s:%s..\n", local_host, local_port);
 		return axl_false;
 	} /* end if */
+	myqtt_conn_close (conns[0]);
 
-	/* subscribe to a topic */
-	if (! myqtt_conn_sub (conn, 10, "test/#", 0, &sub_result)) {
-		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
-		return axl_false;
+	before   = test_01b_resident_bytes ();
+	iterator = 0;
+	while (iterator < 400) {
+		client_id         = axl_strdup_printf ("test_01b-%d", iterator);
+		conns[iterator]   = myqtt_conn_new (ctx, client_id, axl_true, 0, local_host, local_port, NULL, NULL, NULL);
+		axl_free (client_id);
+		if (! myqtt_conn_is_ok (conns[iterator], axl_false)) {
+			printf ("ERROR: unable to connect to %s:%s (iterator=%d)..\n", local_host, local_port, iterator);
+			return axl_false;
+		} /* end if */
+
+		/* idle connections must not create subscription hashes */
+		if (conns[iterator]->subs || conns[iterator]->wild_subs) {
+			printf ("ERROR: found subscription hashes created on an idle connection..\n");
+			return axl_false;
+		} /* end if */
+		iterator++;
+	} /* end while */
+	after    = test_01b_resident_bytes ();
+
+	if (before < 0 || after < 0) 
+		printf ("Test 01b: resident memory not available on this platform, skipping report\n");
+	else {
+		printf ("Test 01b: sizeof (MyQttConn) = %d bytes\n", (int) sizeof (MyQttConn));
+		printf ("Test 01b: resident bytes for 400 idle connections (client and broker side): %ld\n", after - before);
+		printf ("Test 01b: resident bytes per idle connection pair: %ld (250000 connections ~ %ld MB)\n", 
+			(after - before) / 400, ((after - before) / 400) * 250000 / (1024 * 1024));
 	} /* end if */
 
-	/* close connection */
-	printf ("Test 02-a: closing connection..\n");
-	myqtt_conn_close (conn);
+	iterator = 0;
+	while (iterator < 400) {
+		myqtt_conn_close (conns[iterator]);
+		iterator++;
+	} /* end while */
 
-	/* release context */
-	printf ("Test 02-a: releasing context..\n");
 	myqtt_exit_ctx (ctx, axl_true);
 
+	return axl_true;
+}
 
-
+axl_bool test_01c_on_accept (MyQttConn * conn, axlPointer user_data)
+{
+	/* count connections accepted by this context */
+	myqtt_atomic_add ((int *) user_data, 1);
 	return axl_true;
 }
 
-void test_03_on_message (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg, axlPointer user_data)
+/* connects clients at once against host:port and returns the
+ * microseconds needed until all of them are reported as accepted
+ * on the counters provided (or -1 on timeout) */
+long test_01c_storm (const char * host, const char * port, int clients, int * accepted, int * accepted2)
 {
-	MyQttAsyncQueue * queue = user_data;
+	MYQTT_SOCKET       socks[300];
+	struct sockaddr_in saddr;
+	struct timeval     start, stop, diff;
+	int                iterator;
+	long               elapsed = -1;
+	int                total;
+
+	memset (&saddr, 0, sizeof (saddr));
+	saddr.sin_family      = AF_INET;
+	saddr.sin_port        = htons ((uint16_t) atoi (port));
+	saddr.sin_addr.s_addr = inet_addr (host);
 
-	/* push message received */
-	myqtt_msg_ref (msg);
-	myqtt_async_queue_push (queue, msg);
-	return;
-} 
+	gettimeofday (&start, NULL);
+	iterator = 0;
+	while (iterator < clients) {
+		socks[iterator] = socket (AF_INET, SOCK_STREAM, 0);
+		if (socks[iterator] != MYQTT_INVALID_SOCKET && connect (socks[iterator], (struct sockaddr *) &saddr, sizeof (saddr)) != 0) {
+			printf ("ERROR: connect () failed for client %d (errno=%d)\n", iterator, errno);
+			myqtt_close_socket (socks[iterator]);
+			socks[iterator] = MYQTT_INVALID_SOCKET;
+		} /* end if */
+		iterator++;
+	} /* end while */
 
-void test_03_fail (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg, axlPointer user_data)
-{
-	printf ("ERROR: this handler shouldn't be called because this connection has no subscriptions..\n");
-	printf ("ERROR: received message with topic=%s and content=%s\n", myqtt_msg_get_topic (msg), (const char *) myqtt_msg_get_app_msg (msg));
-	exit (-1);
-	return;
-} 
+	/* wait (up to 10 seconds) for the listener to catch up */
+	while (axl_true) {
+		total = myqtt_atomic_get (accepted) + (accepted2 ? myqtt_atomic_get (accepted2) : 0);
+		gettimeofday (&stop, NULL);
+		myqtt_timeval_substract (&stop, &start, &diff);
+		if (total >= clients) {
+			elapsed = diff.tv_sec * 1000000 + diff.tv_usec;
+			break;
+		} /* end if */
+		if (diff.tv_sec >= 10) {
+			printf ("ERROR: only %d connections of %d were accepted after 10 seconds\n", total, clients);
+			break;
+		} /* end if */
+		myqtt_sleep (1000);
+	} /* end while */
 
-axl_bool test_03_common (int wildcard) {
+	iterator = 0;
+	while (iterator < clients) {
+		myqtt_close_socket (socks[iterator]);
+		iterator++;
+	} /* end while */
 
-	MyQttCtx        * ctx = init_ctx ();
-	MyQttConn       * conn;
-	MyQttConn       * conn2;
-	int               sub_result;
-	MyQttAsyncQueue * queue;
-	MyQttMsg        * msg;
-	const char      * label;
+	return elapsed;
+}
+
+axl_bool test_01c (void) {
+
+	MyQttCtx    * ctx = init_ctx ();
+	MyQttCtx    * ctx2;
+	MyQttConn   * listener;
+	const char  * local_host = "127.0.0.1";
+	const char  * local_port = "27893";
+	int           accepted   = 0;
+	int           accepted2  = 0;
+	int           batch;
+	long          elapsed;
 
 	if (! ctx)
 		return axl_false;
 
-	printf ("Test 03: creating connection..\n");
+	/* room for the whole storm in the backlog */
+	myqtt_conf_set (ctx, MYQTT_LISTENER_BACKLOG, 1024, NULL);
+	myqtt_listener_set_on_connection_accepted (ctx, test_01c_on_accept, &accepted);
 
-	/* now connect to the listener:
-	   client_identifier -> test_03
-	   clean_session -> axl_true
-	   keep_alive -> 30 */
-	conn = myqtt_conn_new (ctx, "test_03", axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
-	if (! myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: unable to connect to %s:%s..\n", listener_host, listener_port);
+	listener = myqtt_listener_new (ctx, local_host, local_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (listener, axl_false)) {
+		printf ("ERROR: failed to start listener at myqtt_listener_new () %s:%s..\n", local_host, local_port);
 		return axl_false;
 	} /* end if */
 
-	printf ("Test 03: connected without problems..\n");
-
-	/* now connect to the listener:
-	   client_identifier -> test_03
-	   clean_session -> axl_true
-	   keep_alive -> 30 */
-	conn2 = myqtt_conn_new (ctx, "test_03-2", axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
-	if (! myqtt_conn_is_ok (conn2, axl_false)) {
-		printf ("ERROR: unable to connect to %s:%s..\n", listener_host, listener_port);
+	/* default accept batch */
+	myqtt_conf_get (ctx, MYQTT_LISTENER_ACCEPT_BATCH, &batch);
+	if (batch != 64) {
+		printf ("ERROR: expected default accept batch 64 but found %d\n", batch);
 		return axl_false;
 	} /* end if */
 
-	printf ("Test 03: connected without problems (without subscriptions)..\n");
+	/* one accept per reader loop pass */
+	myqtt_conf_set (ctx, MYQTT_LISTENER_ACCEPT_BATCH, 1, NULL);
+	elapsed = test_01c_storm (local_host, local_port, 300, &accepted, NULL);
+	if (elapsed < 0)
+		return axl_false;
+	printf ("Test 01c: reconnect storm of 300 clients, accept batch=1: %ld us\n", elapsed);
 
-	/* subscribe to a topic */
-	label = "myqtt/test";
-	if (wildcard == 1)
-		label = "myqtt/+";
-	else if (wildcard == 2)
-		label = "myqtt/#";
+	/* let the reader release closed connections */
+	myqtt_sleep (200000);
 
-	printf ("Test 03: subscribing to %s\n", label);
-	if (! myqtt_conn_sub (conn, 10, label, 0, &sub_result)) {
-		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+	/* batched accepts */
+	accepted = 0;
+	myqtt_conf_set (ctx, MYQTT_LISTENER_ACCEPT_BATCH, 64, NULL);
+	elapsed = test_01c_storm (local_host, local_port, 300, &accepted, NULL);
+	if (elapsed < 0)
 		return axl_false;
-	} /* end if */
+	printf ("Test 01c: reconnect storm of 300 clients, accept batch=64: %ld us\n", elapsed);
 
-	/* register on message handler */
-	queue = myqtt_async_queue_new ();
-	myqtt_conn_set_on_msg (conn, test_03_on_message, queue);
-	myqtt_conn_set_on_msg (conn2, test_03_fail, NULL);
+	myqtt_exit_ctx (ctx, axl_true);
 
-	/* publish application message (the message sent here is
-	 * bigger than 24, this is on purpose) */
-	if (! myqtt_conn_pub (conn, "myqtt/test", "This is test message........", 24, MYQTT_QOS_0, axl_false, 0)) {
-		printf ("ERROR: unable to publish message, myqtt_conn_pub() failed\n");
+#if defined(SO_REUSEPORT)
+	/* two contexts (two reader loops) sharing the same port */
+	local_port = "27894";
+	accepted   = 0;
+	ctx        = init_ctx ();
+	ctx2       = init_ctx ();
+	if (! ctx || ! ctx2)
+		return axl_false;
+
+	myqtt_conf_set (ctx, MYQTT_LISTENER_REUSE_PORT, axl_true, NULL);
+	myqtt_conf_set (ctx2, MYQTT_LISTENER_REUSE_PORT, axl_true, NULL);
+	myqtt_conf_set (ctx, MYQTT_LISTENER_BACKLOG, 1024, NULL);
+	myqtt_conf_set (ctx2, MYQTT_LISTENER_BACKLOG, 1024, NULL);
+	myqtt_listener_set_on_connection_accepted (ctx, test_01c_on_accept, &accepted);
+	myqtt_listener_set_on_connection_accepted (ctx2, test_01c_on_accept, &accepted2);
+
+	listener = myqtt_listener_new (ctx, local_host, local_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (listener, axl_false)) {
+		printf ("ERROR: failed to start first SO_REUSEPORT listener at %s:%s..\n", local_host, local_port);
+		return axl_false;
+	} /* end if */
+	listener = myqtt_listener_new (ctx2, local_host, local_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (listener, axl_false)) {
+		printf ("ERROR: failed to start second SO_REUSEPORT listener at %s:%s..\n", local_host, local_port);
 		return axl_false;
 	} /* end if */
 
-	/* waiting for reply */
-	printf ("Test 03: waiting for reply..\n");
-	msg   = myqtt_async_queue_pop (queue);
-	if (msg == NULL) {
-		printf ("ERROR: expected to find message from queue, but NULL was found..\n");
+	elapsed = test_01c_storm (local_host, local_port, 300, &accepted, &accepted2);
+	if (elapsed < 0)
+		return axl_false;
+	printf ("Test 01c: reconnect storm of 300 clients, SO_REUSEPORT over 2 contexts: %ld us (accepted %d + %d)\n", 
+		elapsed, accepted, accepted2);
+
+	myqtt_exit_ctx (ctx2, axl_true);
+	myqtt_exit_ctx (ctx, axl_true);
+#endif
+
+	return axl_true;
+}
+
+axl_bool test_01d (void) {
+
+	MyQttCtx      * ctx = init_ctx ();
+	MyQttConn     * listener;
+	MyQttConnOpts * opts;
+	const char    * local_host = "127.0.0.1";
+	const char    * local_port = "27895";
+	int             value;
+	socklen_t       value_size;
+
+	if (! ctx)
+		return axl_false;
+
+	/* context wide defaults */
+	if (! myqtt_conf_set (ctx, MYQTT_LISTENER_RCVBUF, 131072, NULL)) {
+		printf ("ERROR: unable to configure MYQTT_LISTENER_RCVBUF..\n");
+		return axl_false;
+	} /* end if */
+	myqtt_conf_get (ctx, MYQTT_LISTENER_RCVBUF, &value);
+	if (value != 131072) {
+		printf ("ERROR: expected MYQTT_LISTENER_RCVBUF=131072 but found %d\n", value);
+		return axl_false;
+	} /* end if */
+	if (myqtt_conf_set (ctx, MYQTT_LISTENER_SNDBUF, -1, NULL)) {
+		printf ("ERROR: expected negative MYQTT_LISTENER_SNDBUF to be rejected..\n");
 		return axl_false;
 	} /* end if */
 
-	/* check content */
-	if (myqtt_msg_get_app_msg_size (msg) != 24) {
-		printf ("ERROR: expected payload size of 24 but found %d\n", myqtt_msg_get_app_msg_size (msg));
+	/* listener level values */
+	opts = myqtt_conn_opts_new ();
+	if (myqtt_conn_opts_set_sock_opt (opts, MYQTT_LISTENER_BACKLOG, 10)) {
+		printf ("ERROR: expected MYQTT_LISTENER_BACKLOG to be rejected as listener socket option..\n");
 		return axl_false;
 	} /* end if */
+	myqtt_conn_opts_set_sock_opt (opts, MYQTT_LISTENER_SNDBUF, 262144);
+#if defined(TCP_USER_TIMEOUT)
+	myqtt_conn_opts_set_sock_opt (opts, MYQTT_LISTENER_USER_TIMEOUT, 15000);
+#endif
 
-	if (myqtt_msg_get_type (msg) != MYQTT_PUBLISH) {
-		printf ("ERROR: expected to receive PUBLISH message but found: %s\n", myqtt_msg_get_type_str (msg));
+	listener = myqtt_listener_new (ctx, local_host, local_port, opts, NULL, NULL);
+	if (! myqtt_conn_is_ok (listener, axl_false)) {
+		printf ("ERROR: failed to start listener at myqtt_listener_new () %s:%s..\n", local_host, local_port);
 		return axl_false;
 	} /* end if */
 
-	/* check content */
-	if (! axl_cmp ((const char *) myqtt_msg_get_app_msg (msg), "This is test message....")) {
-		printf ("ERROR: expected to find different content..\n");
+	/* the kernel may round (or double) buffer sizes */
+	value_size = sizeof (value);
+	getsockopt (myqtt_conn_get_socket (listener), SOL_SOCKET, SO_SNDBUF, &value, &value_size);
+	printf ("Test 01d: listener SO_SNDBUF=%d (requested 262144)\n", value);
+	if (value < 262144) {
+		printf ("ERROR: SO_SNDBUF was not configured on listener socket..\n");
 		return axl_false;
 	} /* end if */
 
-	/* release message */
-	printf ("Test 03: releasing references=%d\n", myqtt_msg_ref_count (msg));
-	myqtt_msg_unref (msg);
- 
-	/* close connection */
-	printf ("Test 03: closing connection..\n");
-	myqtt_conn_close (conn);
-	myqtt_conn_close (conn2);
+	value_size = sizeof (value);
+	getsockopt (myqtt_conn_get_socket (listener), SOL_SOCKET, SO_RCVBUF, &value, &value_size);
+	printf ("Test 01d: listener SO_RCVBUF=%d (requested 131072)\n", value);
+	if (value < 131072) {
+		printf ("ERROR: SO_RCVBUF was not configured on listener socket..\n");
+		return axl_false;
+	} /* end if */
 
-	myqtt_async_queue_unref (queue);
+#if defined(TCP_USER_TIMEOUT)
+	value_size = sizeof (value);
+	getsockopt (myqtt_conn_get_socket (listener), IPPROTO_TCP, TCP_USER_TIMEOUT, &value, &value_size);
+	if (value != 15000) {
+		printf ("ERROR: expected TCP_USER_TIMEOUT=15000 but found %d\n", value);
+		return axl_false;
+	} /* end if */
+#endif
 
-	/* release context */
-	printf ("Test 03: releasing context refs=%d..\n", myqtt_ctx_ref_count (ctx));
 	myqtt_exit_ctx (ctx, axl_true);
 
-
-
 	return axl_true;
 }
 
-axl_bool test_03 (void) {
-	/* wildcard = 0 */
-	return test_03_common (0);
-}
+axl_bool test_01e (void) {
 
-axl_bool test_03a (void) {
-	/* wildcard = 1 -> + */
-	return test_03_common (1);
-}
+	MyQttCtx    * ctx = init_ctx ();
+	MyQttConn   * listener;
+	MyQttConn   * conn_a;
+	MyQttConn   * conn_b;
+	MyQttConn   * conn_c;
+	const char  * local_host = "127.0.0.1";
+	const char  * local_port = "27896";
 
-axl_bool test_03b (void) {
-	/* wildcard = 2 -> # */
-	return test_03_common (2);
-}
+	if (! ctx)
+		return axl_false;
 
-axl_bool test_04_common (int wildcard) {
+	/* conn watermarks: 1000 (low 500), context: 2500 (low 1250) */
+	myqtt_conf_set (ctx, MYQTT_CONN_QUEUE_HIGH_WATERMARK, 1000, NULL);
+	myqtt_conf_set (ctx, MYQTT_CTX_QUEUE_HIGH_WATERMARK, 2500, NULL);
 
-	MyQttCtx        * ctx = init_ctx ();
-	MyQttConn       * conn;
-	int               sub_result;
-	MyQttAsyncQueue * queue;
-	MyQttMsg        * msg;
-	const char      * sub_topic;
-	const char      * test_label;
-
-	if (! ctx)
+	listener = myqtt_listener_new (ctx, local_host, local_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (listener, axl_false)) {
+		printf ("ERROR: failed to start listener at myqtt_listener_new () %s:%s..\n", local_host, local_port);
 		return axl_false;
+	} /* end if */
 
-	test_label = "04";
-	if (wildcard == 1)
-		test_label = "04-a";
-	if (wildcard == 2)
-		test_label = "04-b";
-	
+	conn_a = myqtt_conn_new (ctx, "test_01e-a", axl_true, 0, local_host, local_port, NULL, NULL, NULL);
+	conn_b = myqtt_conn_new (ctx, "test_01e-b", axl_true, 0, local_host, local_port, NULL, NULL, NULL);
+	conn_c = myqtt_conn_new (ctx, "test_01e-c", axl_true, 0, local_host, local_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (conn_a, axl_false) || ! myqtt_conn_is_ok (conn_b, axl_false) || ! myqtt_conn_is_ok (conn_c, axl_false)) {
+		printf ("ERROR: unable to connect to %s:%s..\n", local_host, local_port);
+		return axl_false;
+	} /* end if */
 
-	printf ("Test %s: creating connection..\n", test_label);
+	/* blocking requested by the application must be kept */
+	myqtt_conn_block (conn_a, axl_true);
 
-	/* now connect to the listener:
-	   client_identifier -> test_03
-	   clean_session -> axl_true
-	   keep_alive -> 30 */
-	conn = myqtt_conn_new (ctx, "test_03", axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
-	if (! myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: unable to connect to %s:%s..\n", listener_host, listener_port);
+	/* subscriber b goes over its high watermark: publisher a is paused */
+	__myqtt_sequencer_account (ctx, conn_b, 1, 2000);
+	if (! __myqtt_sequencer_check_backpressure (ctx, conn_a, conn_b) || ! conn_a->backpressure_paused) {
+		printf ("ERROR: expected publisher to be paused when subscriber is over its high watermark..\n");
 		return axl_false;
 	} /* end if */
 
-	printf ("Test %s: connected without problems..\n", test_label);
-
-	sub_topic = "myqtt/test";
-	if (wildcard == 1)
-		sub_topic = "myqtt/+";
-	if (wildcard == 2)
-		sub_topic = "myqtt/#";
+	/* still over the low watermark */
+	__myqtt_sequencer_account (ctx, conn_b, 0, -1200);
+	__myqtt_sequencer_release_backpressure (ctx, axl_false);
+	if (! conn_a->backpressure_paused) {
+		printf ("ERROR: publisher resumed before subscriber queue went below the low watermark..\n");
+		return axl_false;
+	} /* end if */
 
-	if (! myqtt_conn_sub (conn, 10, sub_topic, 0, &sub_result)) {
-		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+	/* drained: resumed without calling release */
+	__myqtt_sequencer_account (ctx, conn_b, -1, -800);
+	if (conn_a->backpressure_paused || ctx->backpressure_count != 0) {
+		printf ("ERROR: publisher not resumed after subscriber queue drained..\n");
 		return axl_false;
 	} /* end if */
+	if (! myqtt_conn_is_blocked (conn_a)) {
+		printf ("ERROR: backpressure release cleared blocking requested by the application..\n");
+		return axl_false;
+	} /* end if */
+	myqtt_conn_block (conn_a, axl_false);
 
-	if (! myqtt_conn_unsub (conn, sub_topic, 10)) {
-		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+	/* queue drained before the publisher is checked: no pause */
+	__myqtt_sequencer_account (ctx, conn_b, 1, 2000);
+	__myqtt_sequencer_account (ctx, conn_b, -1, -2000);
+	if (__myqtt_sequencer_check_backpressure (ctx, conn_a, conn_b) || conn_a->backpressure_paused) {
+		printf ("ERROR: publisher paused after subscriber queue drained..\n");
 		return axl_false;
 	} /* end if */
 
-	/* register on message handler */
-	myqtt_conn_set_on_msg (conn, test_03_fail, NULL);
+	/* no connection over its watermark but the context is */
+	__myqtt_sequencer_account (ctx, conn_a, 1, 900);
+	__myqtt_sequencer_account (ctx, conn_b, 1, 900);
+	__myqtt_sequencer_account (ctx, conn_c, 1, 900);
+	if (! __myqtt_sequencer_check_backpressure (ctx, conn_a, conn_c) || ! conn_a->backpressure_paused) {
+		printf ("ERROR: expected publisher to be paused when context is over its high watermark..\n");
+		return axl_false;
+	} /* end if */
 
-	/* publish application message */
-	if (! myqtt_conn_pub (conn, "myqtt/test", "This is test message....", 24, MYQTT_QOS_0, axl_false, 0)) {
-		printf ("ERROR: unable to publish message, myqtt_conn_pub() failed\n");
+	__myqtt_sequencer_account (ctx, conn_a, -1, -900);
+	__myqtt_sequencer_release_backpressure (ctx, axl_false);
+	if (! conn_a->backpressure_paused) {
+		printf ("ERROR: publisher resumed before context queue went below the low watermark..\n");
 		return axl_false;
 	} /* end if */
 
-	/* waiting for reply */
-	printf ("Test %s: waiting for reply (we shouldn't get one, waiting 3 seconds)..\n", test_label);
-	queue = myqtt_async_queue_new ();
-	msg   = myqtt_async_queue_timedpop (queue, 3000000);
-	myqtt_async_queue_unref (queue);
-	if (msg != NULL) {
-		printf ("ERROR: expected to find message from queue, but NULL was found..\n");
+	__myqtt_sequencer_account (ctx, conn_b, -1, -900);
+	__myqtt_sequencer_account (ctx, conn_c, -1, -900);
+	if (conn_a->backpressure_paused) {
+		printf ("ERROR: publisher not resumed after context queue drained..\n");
 		return axl_false;
 	} /* end if */
 
-	/* close connection */
-	printf ("Test %s: closing connection..\n", test_label);
-	myqtt_conn_close (conn);
+	/* connections still work */
+	if (! myqtt_conn_pub (conn_a, "test_01e", "hello", 5, MYQTT_QOS_0, axl_false, 0)) {
+		printf ("ERROR: failed to publish after backpressure was released..\n");
+		return axl_false;
+	} /* end if */
 
-	/* release context */
-	printf ("Test %s: releasing context..\n", test_label);
+	myqtt_conn_close (conn_a);
+	myqtt_conn_close (conn_b);
+	myqtt_conn_close (conn_c);
 	myqtt_exit_ctx (ctx, axl_true);
 
 	return axl_true;
 }
 
-axl_bool test_04 (void) {
-	return test_04_common (0);
-}
-
-axl_bool test_04a (void) {
-	return test_04_common (1);
-}
+void test_01f_on_message (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg, axlPointer user_data)
+{
+	int * received = user_data;
 
-axl_bool test_04b (void) {
-	return test_04_common (2);
+	myqtt_atomic_add (received, 1);
+	return;
 }
 
-axl_bool test_05 (void) {
+axl_bool test_01f (void) {
 
-	MyQttCtx        * ctx = init_ctx ();
-	MyQttConn       * conn;
-	struct timeval    start;
-	struct timeval    stop;
-	struct timeval    diff;
+	MyQttCtx      * ctx        = init_ctx ();
+	MyQttCtx      * client_ctx = init_ctx ();
+	MyQttConn     * listener;
+	MyQttConn     * publisher;
+	MyQttConn     * subscriber;
+	const char    * local_host = "127.0.0.1";
+	const char    * local_port = "27898";
+	char            payload[16384];
+	int             sub_result;
+	int             received   = 0;
+	int             published  = 0;
+	int             iterator;
 
-	if (! ctx)
+	if (! ctx || ! client_ctx)
 		return axl_false;
 
-	printf ("Test 05: creating connection..\n");
-
-	/* now connect to the listener:
-	   client_identifier -> test_05
-	   clean_session -> axl_true
-	   keep_alive -> 30 */
-	gettimeofday (&start, NULL);
-	conn = myqtt_conn_new (ctx, "test_05", axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
-	if (! myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: unable to connect to %s:%s..\n", listener_host, listener_port);
+	/* broker with subscriber watermark: 512K (low 256K) */
+	myqtt_conf_set (ctx, MYQTT_CONN_QUEUE_HIGH_WATERMARK, 524288, NULL);
+	if (! myqtt_storage_use (ctx, MYQTT_STORAGE_TYPE_MEMORY)) {
+		printf ("ERROR: failed to configure memory storage..\n");
+		return axl_false;
+	} /* end if */
+	listener = myqtt_listener_new (ctx, local_host, local_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (listener, axl_false)) {
+		printf ("ERROR: failed to start listener at myqtt_listener_new () %s:%s..\n", local_host, local_port);
 		return axl_false;
 	} /* end if */
-	gettimeofday (&stop, NULL);
-	myqtt_timeval_substract (&stop, &start, &diff);
 
-	printf ("Test 05: connected without problems in %.2f ms, sending ping..\n", (double) diff.tv_usec / (double) 1000);
-	gettimeofday (&start, NULL);
-	if (! myqtt_conn_ping (conn, 10)) {
-		printf ("ERROR: failed to send PING request or reply wasn't received after wait period..\n");
+	publisher  = myqtt_conn_new (client_ctx, "test_01f-pub", axl_true, 0, local_host, local_port, NULL, NULL, NULL);
+	subscriber = myqtt_conn_new (client_ctx, "test_01f-sub", axl_true, 0, local_host, local_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (publisher, axl_false) || ! myqtt_conn_is_ok (subscriber, axl_false)) {
+		printf ("ERROR: unable to connect to %s:%s..\n", local_host, local_port);
+		return axl_false;
+	} /* end if */
+	myqtt_conn_set_on_msg (subscriber, test_01f_on_message, &received);
+	if (! myqtt_conn_sub (subscriber, 10, "test_01f", 0, &sub_result)) {
+		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
 		return axl_false;
 	} /* end if */
-	gettimeofday (&stop, NULL);
-	myqtt_timeval_substract (&stop, &start, &diff);
 
-	printf ("Test 05: received ping reply in in %.2f ms..\n", (double)diff.tv_usec / (double) 1000);
+	/* slow subscriber: stop reading its socket */
+	myqtt_conn_block (subscriber, axl_true);
 
-	/* close connection */
-	printf ("Test 05: closing connection..\n");
-	myqtt_conn_close (conn);
+	/* flood until the broker pauses the publisher */
+	memset (payload, 'a', sizeof (payload));
+	while (published < 4096 && myqtt_atomic_get (&ctx->backpressure_count) == 0) {
+		if (! myqtt_conn_pub (publisher, "test_01f", payload, sizeof (payload), MYQTT_QOS_0, axl_false, 0)) {
+			printf ("ERROR: failed to publish message %d..\n", published);
+			return axl_false;
+		} /* end if */
+		published++;
 
-	/* release context */
-	printf ("Test 05: releasing context..\n");
+		/* give the broker some time to catch up */
+		if ((published % 64) == 0)
+			myqtt_sleep (10000);
+	} /* end while */
+
+	iterator = 0;
+	while (iterator < 500 && myqtt_atomic_get (&ctx->backpressure_count) == 0) {
+		myqtt_sleep (10000);
+		iterator++;
+	} /* end while */
+	printf ("Test 01f: publisher paused after %d messages (queued %d bytes, received %d)..\n", 
+		published, myqtt_atomic_get (&ctx->sequencer_bytes), myqtt_atomic_get (&received));
+	if (myqtt_atomic_get (&ctx->backpressure_count) != 1) {
+		printf ("ERROR: expected publisher to be paused by a slow subscriber (paused %d)..\n", myqtt_atomic_get (&ctx->backpressure_count));
+		return axl_false;
+	} /* end if */
+
+	/* subscriber reads again: publisher must be resumed and all
+	 * messages delivered */
+	myqtt_conn_block (subscriber, axl_false);
+	iterator = 0;
+	while (iterator < 3000 && (myqtt_atomic_get (&received) != published || myqtt_atomic_get (&ctx->backpressure_count) != 0)) {
+		myqtt_sleep (10000);
+		iterator++;
+	} /* end while */
+	if (myqtt_atomic_get (&ctx->backpressure_count) != 0 || myqtt_atomic_get (&received) != published) {
+		printf ("ERROR: expected publisher to be resumed and %d messages received but found %d (paused %d)..\n",
+			published, myqtt_atomic_get (&received), myqtt_atomic_get (&ctx->backpressure_count));
+		return axl_false;
+	} /* end if */
+
+	myqtt_conn_close (publisher);
+	myqtt_conn_close (subscriber);
+	myqtt_exit_ctx (client_ctx, axl_true);
 	myqtt_exit_ctx (ctx, axl_true);
 
 	return axl_true;
 }
 
-axl_bool test_06 (void) {
-
-	MyQttCtx        * ctx = init_ctx ();
-	MyQttConn       * conn;
-	MyQttConn       * conn2;
-	MyQttConn       * conn3;
-	MyQttMsg        * msg;
+axl_bool test_02 (void) {
 
+	MyQttCtx  * ctx = init_ctx ();
+	MyQttConn * conn;
+	int         sub_result;
 	if (! ctx)
 		return axl_false;
 
-	printf ("Test 06: creating connection..\n");
+	printf ("Test 02: creating connection..\n");
 
 	/* now connect to the listener:
-	   client_identifier -> test_06.identifier
+	   client_identifier -> test_02
 	   clean_session -> axl_true
 	   keep_alive -> 30 */
-	conn = myqtt_conn_new (ctx, "test_06.identifier", axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
+	conn = myqtt_conn_new (ctx, "test_02", axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
 	if (! myqtt_conn_is_ok (conn, axl_false)) {
 		printf ("ERROR: unable to connect to %s:%s..\n", listener_host, listener_port);
 		return axl_false;
 	} /* end if */
 
-	/* call to get client identifier */
-	if (! myqtt_conn_pub (conn, "myqtt/admin/get-client-identifier", "", 0, MYQTT_QOS_0, axl_false, 0)) {
-		printf ("ERROR: unable to publish message to get client identifier..\n");
+	printf ("Test 02: connected without problems..\n");
+
+	/* subscribe to a topic */
+	if (! myqtt_conn_sub (conn, 10, "myqtt/test", 0, &sub_result)) {
+		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
 		return axl_false;
 	} /* end if */
 
-	/* push a message to ask for clientid identifier */
-	msg   = myqtt_conn_get_next (conn, 10000);
+	/* close connection */
+	printf ("Test 02: closing connection..\n");
+	myqtt_conn_close (conn);
 
-	printf ("Test 06: message reference is: %p (%s) (expecting client identifier)\n", msg, (const char *) myqtt_msg_get_app_msg (msg));
-	if (! axl_cmp ("test_06.identifier", (const char *) myqtt_msg_get_app_msg (msg))) {
-		printf ("ERROR: expected client identifier test_06.identifier, but found: %s\n", (const char *) myqtt_msg_get_app_msg (msg));
-		return axl_false;
-	} /* end if */
+	/* release context */
+	printf ("Test 02: releasing context..\n");
+	myqtt_exit_ctx (ctx, axl_true);
 
-	/* call to release message */
-	myqtt_msg_unref (msg);
 
-	printf ("Test 06: checking that is not accepted two connections with the same client identifier..\n");
 
-	/* now try to connect again with the same identifier */
-	conn2 = myqtt_conn_new (ctx, "test_06.identifier", axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
-	if (myqtt_conn_is_ok (conn2, axl_false)) {
-		printf ("ERROR: expected to find connection error for same identifier but found connection ok\n");
-		return axl_false;
-	} /* end if */
+	return axl_true;
+}
 
-	printf ("Test 06: Error reported by myqtt_conn_new = %d\n", myqtt_conn_get_last_err (conn2));
-	if (myqtt_conn_get_last_err (conn2) != MYQTT_CONNACK_IDENTIFIER_REJECTED) {
-		printf ("ERROR: expected identifier rejected..but found different error\n");
+axl_bool test_02_a (void) {
+
+	MyQttCtx  * ctx = init_ctx ();
+	MyQttConn * conn;
+	int         sub_result;
+	if (! ctx)
 		return axl_false;
-	} /* end if */
 
-	printf ("Test 06: OK, now check automatic client ids..\n");
+	printf ("Test 02-a: creating connection..\n");
 
-	/* ok, connect with a NULL client id */
-	conn3 = myqtt_conn_new (ctx, NULL, axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
-	if (! myqtt_conn_is_ok (conn3, axl_false)) {
-		printf ("ERROR: expected to find OK connection but found error\n");
+	/* now connect to the listener:
+	   client_identifier -> test_02
+	   clean_session -> axl_true
+	   keep_alive -> 30 */
+	conn = myqtt_conn_new (ctx, "test_02", axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (conn, axl_false)) {
+		printf ("ERROR: unable to connect to %s:%s..\n", listener_host, listener_port);
 		return axl_false;
 	} /* end if */
 
-	/* call to get client identifier */
-	if (! myqtt_conn_pub (conn3, "myqtt/admin/get-client-identifier", "", 0, MYQTT_QOS_0, axl_false, 0)) {
-		printf ("ERROR: unable to publish message to get client identifier..\n");
+	printf ("Test 02-a: connected without problems..\n");
+
+	/* subscribe to a topic */
+	if (! myqtt_conn_sub (conn, 10, "myqtt/+", 0, &sub_result)) {
+		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
 		return axl_false;
 	} /* end if */
 
-	/* push a message to ask for clientid identifier */
-	msg   = myqtt_conn_get_next (conn3, 10000);
-	if (msg == NULL || myqtt_msg_get_app_msg (msg) == NULL) {
-		printf ("ERROR: expected to received msg defined but found NULL\n");
+	/* subscribe to a topic */
+	if (! myqtt_conn_sub (conn, 10, "test/#", 0, &sub_result)) {
+		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
 		return axl_false;
 	} /* end if */
 
-	printf ("Test 06: automatic id assigned is: %s (%p)\n", (const char *) myqtt_msg_get_app_msg (msg), msg);
-	myqtt_msg_unref (msg);
-
-	myqtt_conn_close (conn3);
-	myqtt_conn_close (conn2);
-
 	/* close connection */
-	printf ("Test 06: closing connection..\n");
+	printf ("Test 02-a: closing connection..\n");
 	myqtt_conn_close (conn);
 
 	/* release context */
-	printf ("Test 06: releasing context..\n");
+	printf ("Test 02-a: releasing context..\n");
 	myqtt_exit_ctx (ctx, axl_true);
 
+
+
 	return axl_true;
 }
 
-axl_bool test_07 (void) {
+void test_03_on_message (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg, axlPointer user_data)
+{
+	MyQttAsyncQueue * queue = user_data;
+
+	/* push message received */
+	myqtt_msg_ref (msg);
+	myqtt_async_queue_push (queue, msg);
+	return;
+} 
+
+void test_03_fail (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg, axlPointer user_data)
+{
+	printf ("ERROR: this handler shouldn't be called because this connection has no subscriptions..\n");
+	printf ("ERROR: received message with topic=%s and content=%s\n", myqtt_msg_get_topic (msg), (const char *) myqtt_msg_get_app_msg (msg));
+	exit (-1);
+	return;
+} 
+
+axl_bool test_03_common (int wildcard) {
 
 	MyQttCtx        * ctx = init_ctx ();
 	MyQttConn       * conn;
+	MyQttConn       * conn2;
+	int               sub_result;
+	MyQttAsyncQueue * queue;
 	MyQttMsg        * msg;
-	MyQttConnOpts   * opts;
+	const char      * label;
 
 	if (! ctx)
 		return axl_false;
 
-	printf ("Test 07: creating connection..\n");
-	
+	printf ("Test 03: creating connection..\n");
+
 	/* now connect to the listener:
-	   client_identifier -> NULL
+	   client_identifier -> test_03
 	   clean_session -> axl_true
 	   keep_alive -> 30 */
-	opts = myqtt_conn_opts_new ();
-	myqtt_conn_opts_set_auth (opts, "aspl", "wrong-password");
-	conn = myqtt_conn_new (ctx, NULL, axl_true, 30, listener_host, listener_port, opts, NULL, NULL);
-	if (myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: expected wrong LOGIN but found OK operation to %s:%s..\n", listener_host, listener_port);
+	conn = myqtt_conn_new (ctx, "test_03", axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (conn, axl_false)) {
+		printf ("ERROR: unable to connect to %s:%s..\n", listener_host, listener_port);
 		return axl_false;
 	} /* end if */
-	myqtt_conn_close (conn);
 
-	printf ("Test 07: login failed, this is expected, so OK\n");
+	printf ("Test 03: connected without problems..\n");
 
-	/* try again login with the right password */
-	opts = myqtt_conn_opts_new ();
-	myqtt_conn_opts_set_auth (opts, "aspl", "test");
-	conn = myqtt_conn_new (ctx, NULL, axl_true, 30, listener_host, listener_port, opts, NULL, NULL);
-	if (! myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: OK LOGIN but found ERROR operation to %s:%s..\n", listener_host, listener_port);
+	/* now connect to the listener:
+	   client_identifier -> test_03
+	   clean_session -> axl_true
+	   keep_alive -> 30 */
+	conn2 = myqtt_conn_new (ctx, "test_03-2", axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (conn2, axl_false)) {
+		printf ("ERROR: unable to connect to %s:%s..\n", listener_host, listener_port);
 		return axl_false;
 	} /* end if */
 
-	printf ("Test 07: login OK, now get auth user..\n");
+	printf ("Test 03: connected without problems (without subscriptions)..\n");
 
-	/* call to get client identifier */
-	if (! myqtt_conn_pub (conn, "myqtt/admin/get-conn-user", "", 0, MYQTT_QOS_0, axl_false, 0)) {
-		printf ("ERROR: unable to publish message to get client identifier..\n");
+	/* subscribe to a topic */
+	label = "myqtt/test";
+	if (wildcard == 1)
+		label = "myqtt/+";
+	else if (wildcard == 2)
+		label = "myqtt/#";
+
+	printf ("Test 03: subscribing to %s\n", label);
+	if (! myqtt_conn_sub (conn, 10, label, 0, &sub_result)) {
+		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
 		return axl_false;
 	} /* end if */
 
-	/* push a message to ask for clientid identifier */
-	msg   = myqtt_conn_get_next (conn, 10000);
+	/* register on message handler */
+	queue = myqtt_async_queue_new ();
+	myqtt_conn_set_on_msg (conn, test_03_on_message, queue);
+	myqtt_conn_set_on_msg (conn2, test_03_fail, NULL);
 
-	printf ("Test 07: auth user reported is: %p (%s)\n", msg, (const char *) myqtt_msg_get_app_msg (msg));
-	if (! axl_cmp ("aspl", (const char *) myqtt_msg_get_app_msg (msg))) {
-		printf ("ERROR: expected client identifier test_06.identifier, but found: %s\n", (const char *) myqtt_msg_get_app_msg (msg));
+	/* publish application message (the message sent here is
+	 * bigger than 24, this is on purpose) */
+	if (! myqtt_conn_pub (conn, "myqtt/test", "This is test message........", 24, MYQTT_QOS_0, axl_false, 0)) {
+		printf ("ERROR: unable to publish message, myqtt_conn_pub() failed\n");
 		return axl_false;
 	} /* end if */
 
-	/* call to release message */
-	myqtt_msg_unref (msg);
+	/* waiting for reply */
+	printf ("Test 03: waiting for reply..\n");
+	msg   = myqtt_async_queue_pop (queue);
+	if (msg == NULL) {
+		printf ("ERROR: expected to find message from queue, but NULL was found..\n");
+		return axl_false;
+	} /* end if */
 
-	printf ("Test 07: checking server reports the connection is authenticated..\n");
+	/* check content */
+	if (myqtt_msg_get_app_msg_size (msg) != 24) {
+		printf ("ERROR: expected payload size of 24 but found %d\n", myqtt_msg_get_app_msg_size (msg));
+		return axl_false;
+	} /* end if */
+
+	if (myqtt_msg_get_type (msg) != MYQTT_PUBLISH) {
+		printf ("ERROR: expected to receive PUBLISH message but found: %s\n", myqtt_msg_get_type_str (msg));
+		return axl_false;
+	} /* end if */
+
+	/* check content */
+	if (! axl_cmp ((const char *) myqtt_msg_get_app_msg (msg), "This is test message....")) {
+		printf ("ERROR: expected to find different content..\n");
+		return axl_false;
+	} /* end if */
 
+	/* release message */
+	printf ("Test 03: releasing references=%d\n", myqtt_msg_ref_count (msg));
+	myqtt_msg_unref (msg);
+ 
 	/* close connection */
-	printf ("Test 07: closing connection..\n");
+	printf ("Test 03: closing connection..\n");
 	myqtt_conn_close (conn);
+	myqtt_conn_close (conn2);
+
+	myqtt_async_queue_unref (queue);
 
 	/* release context */
-	printf ("Test 07: releasing context..\n");
+	printf ("Test 03: releasing context refs=%d..\n", myqtt_ctx_ref_count (ctx));
 	myqtt_exit_ctx (ctx, axl_true);
 
+
+
 	return axl_true;
 }
 
-void test_08_should_not_receive (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg, axlPointer user_data)
-{
-	printf ("ERROR: received a message on a handler that shouldn't have been called\n");
-	return;
+axl_bool test_03 (void) {
+	/* wildcard = 0 */
+	return test_03_common (0);
 }
 
-void test_08_should_receive (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg, axlPointer user_data)
-{
-
-	printf ("Test 08: received will..\n");
-	myqtt_msg_ref (msg);
-	myqtt_async_queue_push (user_data, msg);
-	return;
+axl_bool test_03a (void) {
+	/* wildcard = 1 -> + */
+	return test_03_common (1);
 }
 
+axl_bool test_03b (void) {
+	/* wildcard = 2 -> # */
+	return test_03_common (2);
+}
 
-axl_bool test_08 (void) {
+axl_bool test_04_common (int wildcard) {
 
 	MyQttCtx        * ctx = init_ctx ();
-	MyQttConn       * conn, * conn2, * conn3;
-	MyQttMsg        * msg; 
-	MyQttConnOpts   * opts;
+	MyQttConn       * conn;
 	int               sub_result;
 	MyQttAsyncQueue * queue;
-	
+	MyQttMsg        * msg;
+	const char      * sub_topic;
+	const char      * test_label;
 
 	if (! ctx)
 		return axl_false;
 
-	printf ("Test 08: creating connection..\n");
-	
-	/* set will message */
-	opts = myqtt_conn_opts_new ();
+	test_label = "04";
+	if (wildcard == 1)
+		test_label = "04-a";
+	if (wildcard == 2)
+		test_label = "04-b";
 	
-	/* set will */
-	myqtt_conn_opts_set_will (opts, MYQTT_QOS_2, "I lost connection", "Hey I lost connection, this is my status:....", axl_false);
+
+	printf ("Test %s: creating connection..\n", test_label);
 
 	/* now connect to the listener:
-	   client_identifier -> NULL
+	   client_identifier -> test_03
 	   clean_session -> axl_true
 	   keep_alive -> 30 */
-	conn = myqtt_conn_new (ctx, NULL, axl_true, 30, listener_host, listener_port, opts, NULL, NULL);
+	conn = myqtt_conn_new (ctx, "test_03", axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
 	if (! myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: expected LOGIN but found FAILURE operation from %s:%s..\n", listener_host, listener_port);
+		printf ("ERROR: unable to connect to %s:%s..\n", listener_host, listener_port);
 		return axl_false;
 	} /* end if */
 
-	/* now create a new connection and subscribe to the will */
-	conn2 = myqtt_conn_new (ctx, NULL, axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
-	if (! myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: expected LOGIN but found FAILURE operation from %s:%s..\n", listener_host, listener_port);
-		return axl_false;
-	}
+	printf ("Test %s: connected without problems..\n", test_label);
 
-	if (! myqtt_conn_sub (conn2, 10, "I lost connection", 0, &sub_result)) {
+	sub_topic = "myqtt/test";
+	if (wildcard == 1)
+		sub_topic = "myqtt/+";
+	if (wildcard == 2)
+		sub_topic = "myqtt/#";
+
+	if (! myqtt_conn_sub (conn, 10, sub_topic, 0, &sub_result)) {
 		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
 		return axl_false;
 	} /* end if */
 
-	/* now create a third connection but without subscription */
-	conn3 = myqtt_conn_new (ctx, NULL, axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
-	if (! myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: unable connect to MQTT server..\n");
+	if (! myqtt_conn_unsub (conn, sub_topic, 10)) {
+		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
 		return axl_false;
 	} /* end if */
 
-	printf ("Test 08: 3 links connected, now close connection with will\n");
-	/* set on publish handler */	
-	queue  = myqtt_async_queue_new ();
-	myqtt_conn_set_on_msg (conn2, test_08_should_receive, queue);
-	myqtt_conn_set_on_msg (conn3, test_08_should_not_receive, NULL);
-
-	/* shutdown connection */
-	myqtt_conn_shutdown (conn);
-
-	/* wait for message */
-	printf ("Test 08: waiting for will... (3 seconds at most)\n");
-	msg = myqtt_async_queue_timedpop (queue, 3000000);
-	if (msg == NULL) {
-		printf ("ERROR: expected to receive msg reference but found NULL value..\n");
-		return axl_false;
-	} /* end if */
+	/* register on message handler */
+	myqtt_conn_set_on_msg (conn, test_03_fail, NULL);
 
-	if (! axl_cmp (myqtt_msg_get_topic (msg), "I lost connection")) {
-		printf ("ERROR: expected to find topic name 'I lost connection' but found: '%s'\n", myqtt_msg_get_topic (msg));
+	/* publish application message */
+	if (! myqtt_conn_pub (conn, "myqtt/test", "This is test message....", 24, MYQTT_QOS_0, axl_false, 0)) {
+		printf ("ERROR: unable to publish message, myqtt_conn_pub() failed\n");
 		return axl_false;
 	} /* end if */
 
-	if (! axl_cmp (myqtt_msg_get_app_msg (msg), "Hey I lost connection, this is my status:....")) {
-		printf ("ERROR: expected to find topic name 'Hey I lost connection, this is my status:....' but found: '%s'\n", (const char *) myqtt_msg_get_app_msg (msg));
+	/* waiting for reply */
+	printf ("Test %s: waiting for reply (we shouldn't get one, waiting 3 seconds)..\n", test_label);
+	queue = myqtt_async_queue_new ();
+	msg   = myqtt_async_queue_timedpop (queue, 3000000);
+	myqtt_async_queue_unref (queue);
+	if (msg != NULL) {
+		printf ("ERROR: expected to find message from queue, but NULL was found..\n");
 		return axl_false;
 	} /* end if */
 
-	/* release message and queue */
-	myqtt_async_queue_unref (queue);
-	myqtt_msg_unref (msg);
-
 	/* close connection */
-	printf ("Test 08: closing connections..\n");
+	printf ("Test %s: closing connection..\n", test_label);
 	myqtt_conn_close (conn);
-	myqtt_conn_close (conn2);
-	myqtt_conn_close (conn3);
 
 	/* release context */
-	printf ("Test 08: releasing context..\n");
+	printf ("Test %s: releasing context..\n", test_label);
 	myqtt_exit_ctx (ctx, axl_true);
 
 	return axl_true;
 }
 
-axl_bool test_09 (void) {
+axl_bool test_04 (void) {
+	return test_04_common (0);
+}
+
+axl_bool test_04a (void) {
+	return test_04_common (1);
+}
+
+axl_bool test_04b (void) {
+	return test_04_common (2);
+}
+
+axl_bool test_05 (void) {
 
 	MyQttCtx        * ctx = init_ctx ();
-	MyQttConn       * conn, * conn2;
-	MyQttMsg        * msg; 
-	MyQttConnOpts   * opts;
-	int               sub_result;
-	MyQttAsyncQueue * queue;
-	
+	MyQttConn       * conn;
+	struct timeval    start;
+	struct timeval    stop;
+	struct timeval    diff;
 
 	if (! ctx)
 		return axl_false;
 
-	printf ("Test 09: creating connections..\n");
-	
-	/* set will message */
-	opts = myqtt_conn_opts_new ();
-	
-	/* set will */
-	myqtt_conn_opts_set_will (opts, MYQTT_QOS_2, "I lost connection", "Hey I lost connection, this is my status:....", axl_false);
+	printf ("Test 05: creating connection..\n");
 
 	/* now connect to the listener:
-	   client_identifier -> NULL
+	   client_identifier -> test_05
 	   clean_session -> axl_true
 	   keep_alive -> 30 */
-	conn = myqtt_conn_new (ctx, NULL, axl_true, 30, listener_host, listener_port, opts, NULL, NULL);
+	gettimeofday (&start, NULL);
+	conn = myqtt_conn_new (ctx, "test_05", axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
 	if (! myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: expected LOGIN but found FAILURE operation from %s:%s..\n", listener_host, listener_port);
+		printf ("ERROR: unable to connect to %s:%s..\n", listener_host, listener_port);
 		return axl_false;
 	} /* end if */
+	gettimeofday (&stop, NULL);
+	myqtt_timeval_substract (&stop, &start, &diff);
 
-	/* now create a new connection and subscribe to the will */
-	conn2 = myqtt_conn_new (ctx, NULL, axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
-	if (! myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: expected LOGIN but found FAILURE operation from %s:%s..\n", listener_host, listener_port);
-		return axl_false;
-	}
-
-	if (! myqtt_conn_sub (conn2, 10, "I lost connection", 0, &sub_result)) {
-		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+	printf ("Test 05: connected without problems in %.2f ms, sending ping..\n", (double) diff.tv_usec / (double) 1000);
+	gettimeofday (&start, NULL);
+	if (! myqtt_conn_ping (conn, 10)) {
+		printf ("ERROR: failed to send PING request or reply wasn't received after wait period..\n");
 		return axl_false;
 	} /* end if */
+	gettimeofday (&stop, NULL);
+	myqtt_timeval_substract (&stop, &start, &diff);
 
-	/* set on publish handler */	
-	queue  = myqtt_async_queue_new ();
-	myqtt_conn_set_on_msg (conn2, test_08_should_not_receive, queue);
+	printf ("Test 05: received ping reply in in %.2f ms..\n", (double)diff.tv_usec / (double) 1000);
 
 	/* close connection */
+	printf ("Test 05: closing connection..\n");
 	myqtt_conn_close (conn);
 
-	/* wait for message */
-	printf ("Test 09: we shouldn't receive a will message... (3 seconds at most)\n");
-	msg = myqtt_async_queue_timedpop (queue, 3000000);
-	if (msg != NULL) {
-		printf ("ERROR: expected to NOT receive msg reference but found reference value..\n");
-		return axl_false;
-	} /* end if */
-
-	/* release message and queue */
-	myqtt_async_queue_unref (queue);
-
-	/* close connection */
-	printf ("Test 09: closing connections..\n");
-	myqtt_conn_close (conn2);
-
-
 	/* release context */
-	printf ("Test 09: releasing context..\n");
+	printf ("Test 05: releasing context..\n");
 	myqtt_exit_ctx (ctx, axl_true);
 
 	return axl_true;
 }
 
-axl_bool test_10 (void) {
+axl_bool test_06 (void) {
 
 	MyQttCtx        * ctx = init_ctx ();
 	MyQttConn       * conn;
-	int               iterator;
-	char            * sub_str;
-	int               pos;
-	
-	int               packet_id;
-	int               qos;
-	int               size;
-
+	MyQttConn       * conn2;
+	MyQttConn       * conn3;
+	MyQttMsg        * msg;
 
 	if (! ctx)
 		return axl_false;
 
-	printf ("Test 10: checking numbers from file names..\n");
-	if (__myqtt_storage_get_size_from_file_name (ctx, "14-16856208-1408293505-274202", &pos) != 14 || pos != 2) {
-		printf ("ERROR: failed conversion: %d...\n", __myqtt_storage_get_size_from_file_name (ctx, "14-16856208-1408293505-274202", NULL));
-		return axl_false;
-	}
-	if (__myqtt_storage_get_size_from_file_name (ctx, "1-16856208-1408293505-274202", &pos) != 1 || pos != 1) {
-		printf ("ERROR: failed conversion: %d...\n", __myqtt_storage_get_size_from_file_name (ctx, "1-16856208-1408293505-274202", NULL));
-		return axl_false;
-	}
-	if (__myqtt_storage_get_size_from_file_name (ctx, "1432969-16856208-1408293505-274202", &pos) != 1432969 || pos != 7) {
-		printf ("ERROR: failed conversion: %d...\n", __myqtt_storage_get_size_from_file_name (ctx, "1432969-16856208-1408293505-274202", NULL));
-		return axl_false;
-	}
-
-	__myqtt_storage_get_values_from_file_name (ctx, "10-47-2-1438039660-798316", &packet_id, &size, &qos);
-	printf ("Test 10: values received from test packet_id=%d, size=%d, qos=%d\n",
-		packet_id, size, qos);
-	if (packet_id != 10 || size != 47 || qos != 2) {
-		printf ("ERROR: expected diffferent values for packet_id or size or qos (1)\n");
-		return axl_false;
-	}
-
-	printf ("Test 10: creating connection to simulate storage on this side\n");
+	printf ("Test 06: creating connection..\n");
 
-	/* create connection to simulate storage on this side */
-	conn = myqtt_conn_new (ctx, "test10@identifier.com", axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
+	/* now connect to the listener:
+	   client_identifier -> test_06.identifier
+	   clean_session -> axl_true
+	   keep_alive -> 30 */
+	conn = myqtt_conn_new (ctx, "test_06.identifier", axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
 	if (! myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: expected FAILURE but found LOGIN operation from %s:%s..\n", listener_host, listener_port);
+		printf ("ERROR: unable to connect to %s:%s..\n", listener_host, listener_port);
 		return axl_false;
 	} /* end if */
 
-	/* configure storage */
-	myqtt_storage_set_path (ctx, ".myqtt-test-10", 4096);
-
-	/* init storage for this user */
-	if (! myqtt_storage_init (ctx, conn, MYQTT_STORAGE_ALL)) {
-		printf ("ERROR: unable to initialize storage for the provided connection..\n");
+	/* call to get client identifier */
+	if (! myqtt_conn_pub (conn, "myqtt/admin/get-client-identifier", "", 0, MYQTT_QOS_0, axl_false, 0)) {
+		printf ("ERROR: unable to publish message to get client identifier..\n");
 		return axl_false;
 	} /* end if */
 
-	if (system ("find .myqtt-test-10 -type f -exec rm {} \\;"))
-		printf ("WARNING: clean subscriptions failed (reported non-zero value)\n");
-
-	/* check if the subscription exists */
-	if (myqtt_storage_sub_exists (ctx, conn, "this/is/a/test")) {
-		printf ("ERROR (1): expected to not find subscription but it was..\n");
-		return axl_false;
-	}
+	/* push a message to ask for clientid identifier */
+	msg   = myqtt_conn_get_next (conn, 10000);
 
-	/* check subscription */
-	if (! myqtt_storage_sub (ctx, conn, "this/is/a/test", MYQTT_QOS_2)) {
-		printf ("ERROR (2): expected to be able to register subscription, but error was found\n");
+	printf ("Test 06: message reference is: %p (%s) (expecting client identifier)\n", msg, (const char *) myqtt_msg_get_app_msg (msg));
+	if (! axl_cmp ("test_06.identifier", (const char *) myqtt_msg_get_app_msg (msg))) {
+		printf ("ERROR: expected client identifier test_06.identifier, but found: %s\n", (const char *) myqtt_msg_get_app_msg (msg));
 		return axl_false;
 	} /* end if */
 
-	/* check if the subscription exists */
-	printf ("Test 10: checking if test/is/a/test is present in storage...\n");
-	if (! myqtt_storage_sub_exists (ctx, conn, "this/is/a/test")) {
-		printf ("ERROR (3): expected to find subscription but it wasn't..\n");
-		return axl_false;
-	}
-
-	/* check subscription */
-	if (! myqtt_storage_sub (ctx, conn, "this/is/a/test", MYQTT_QOS_1)) {
-		printf ("ERROR (4): expected to be able to register subscription, but error was found\n");
-		return axl_false;
-	} /* end if */
+	/* call to release message */
+	myqtt_msg_unref (msg);
 
-	/* call to unsubscribe */
-	if (! myqtt_storage_unsub (ctx, conn, "this/is/a/test")) {
-		printf ("ERROR (5): expected to be able to register subscription, but error was found\n");
-		return axl_false;
-	} /* end if */
+	printf ("Test 06: checking that is not accepted two connections with the same client identifier..\n");
 
-	/* check if the subscription exists */
-	if (myqtt_storage_sub_exists (ctx, conn, "this/is/a/test")) {
-		printf ("ERROR (6): expected to NOT find subscription but it was....\n");
+	/* now try to connect again with the same identifier */
+	conn2 = myqtt_conn_new (ctx, "test_06.identifier", axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
+	if (myqtt_conn_is_ok (conn2, axl_false)) {
+		printf ("ERROR: expected to find connection error for same identifier but found connection ok\n");
 		return axl_false;
 	} /* end if */
 
-	/* get the number of subscriptions */
-	if (myqtt_storage_sub_count (ctx, conn) != 0) {
-		printf ("ERROR (7): expected to receive sub count 0 but found: %d\n", myqtt_storage_sub_count (ctx, conn));
+	printf ("Test 06: Error reported by myqtt_conn_new = %d\n", myqtt_conn_get_last_err (conn2));
+	if (myqtt_conn_get_last_err (conn2) != MYQTT_CONNACK_IDENTIFIER_REJECTED) {
+		printf ("ERROR: expected identifier rejected..but found different error\n");
 		return axl_false;
 	} /* end if */
 
-	/* do several subscriptions */
-	iterator = 0;
-	while (iterator < 100) {
-		sub_str = axl_strdup_printf ("this/is/a/test/%d", iterator);
-		myqtt_storage_sub (ctx, conn, sub_str, MYQTT_QOS_1);
-		axl_free (sub_str);
-		iterator++;
-	} /* end while */
+	printf ("Test 06: OK, now check automatic client ids..\n");
 
-	/* get the number of subscriptions */
-	if (myqtt_storage_sub_count (ctx, conn) != 100) {
-		printf ("ERROR (8): expected to receive sub count 100 but found: %d\n", myqtt_storage_sub_count (ctx, conn));
+	/* ok, connect with a NULL client id */
+	conn3 = myqtt_conn_new (ctx, NULL, axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (conn3, axl_false)) {
+		printf ("ERROR: expected to find OK connection but found error\n");
 		return axl_false;
 	} /* end if */
 
-	/* check if the subscription exists */
-	if (! myqtt_storage_sub_exists (ctx, conn, "this/is/a/test/49")) {
-		printf ("ERROR (9): expected to find subscription but it wasn't FOUND....\n");
-		return axl_false;
-	} /* end if */
-	if (! myqtt_storage_sub_exists (ctx, conn, "this/is/a/test/99")) {
-		printf ("ERROR (9): expected to find subscription but it wasn't FOUND....\n");
-		return axl_false;
-	} /* end if */
-	if (myqtt_storage_sub_exists (ctx, conn, "this/is/a/test/149")) {
-		printf ("ERROR (9): expected NOT to find subscription but it was FOUND....\n");
+	/* call to get client identifier */
+	if (! myqtt_conn_pub (conn3, "myqtt/admin/get-client-identifier", "", 0, MYQTT_QOS_0, axl_false, 0)) {
+		printf ("ERROR: unable to publish message to get client identifier..\n");
 		return axl_false;
 	} /* end if */
 
-	/* close connection */
-	printf ("Test 10: closing connections..\n");
-	myqtt_conn_close (conn);
-
-	/* create connection to simulate storage on this side */
-	conn = myqtt_conn_new (ctx, "test10@identifier.com", axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
-	if (! myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: expected FAILURE but found LOGIN operation from %s:%s..\n", listener_host, listener_port);
+	/* push a message to ask for clientid identifier */
+	msg   = myqtt_conn_get_next (conn3, 10000);
+	if (msg == NULL || myqtt_msg_get_app_msg (msg) == NULL) {
+		printf ("ERROR: expected to received msg defined but found NULL\n");
 		return axl_false;
 	} /* end if */
 
-	/* call to load local storage first (before an incoming connection) */
-	myqtt_storage_load (ctx);
-
-	/* now open the connection and restore subscriptions */
-	printf ("Test 10: recovering connection..\n");
-	if (! myqtt_storage_session_recover (ctx, conn)) {
-		printf ("ERROR (10): expected to find proper session recovery but found a failure..\n");
-		return axl_false;
-	} /* end if */
+	printf ("Test 06: automatic id assigned is: %s (%p)\n", (const char *) myqtt_msg_get_app_msg (msg), msg);
+	myqtt_msg_unref (msg);
 
-	/* check connection state */
-	printf ("Test 10: checking connection recovery..\n");
-	if (axl_hash_items (conn->subs) != 100) {
-		printf ("Test 10: expected to find 100 subscriptions on connection but found %d\n", axl_hash_items (conn->subs));
-		return axl_false;
-	}
+	myqtt_conn_close (conn3);
+	myqtt_conn_close (conn2);
 
-	/* check connection state */
-	printf ("Test 10: Checking context recovery..\n");
-	if (axl_hash_items (ctx->subs) != 100) {
-		printf ("Test 10: expected to find 100 subscriptions on context but found %d\n", axl_hash_items (ctx->subs));
-		return axl_false;
-	}
-	
 	/* close connection */
-	printf ("Test 10: closing connection after recovery..\n");
+	printf ("Test 06: closing connection..\n");
 	myqtt_conn_close (conn);
 
 	/* release context */
-	printf ("Test 10: releasing context..\n");
+	printf ("Test 06: releasing context..\n");
 	myqtt_exit_ctx (ctx, axl_true);
 
 	return axl_true;
 }
 
-axl_bool test_11 (void) {
+axl_bool test_07 (void) {
 
 	MyQttCtx        * ctx = init_ctx ();
 	MyQttConn       * conn;
-	MyQttMsg        * msg; 
-	int               sub_result;
-	MyQttAsyncQueue * queue;
-	int               iterator;
+	MyQttMsg        * msg;
+	MyQttConnOpts   * opts;
 
 	if (! ctx)
 		return axl_false;
 
-	printf ("Test 11: creating connections..\n");
+	printf ("Test 07: creating connection..\n");
 	
 	/* now connect to the listener:
 	   client_identifier -> NULL
-	   clean_session -> axl_false ... so we want session
+	   clean_session -> axl_true
 	   keep_alive -> 30 */
-	conn = myqtt_conn_new (ctx, NULL, axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
-	if (! myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: expected LOGIN but found FAILURE operation from %s:%s..it shouldn't have worked because we are requesting session and providing NULL identifier...\n", listener_host, listener_port);
+	opts = myqtt_conn_opts_new ();
+	myqtt_conn_opts_set_auth (opts, "aspl", "wrong-password");
+	conn = myqtt_conn_new (ctx, NULL, axl_true, 30, listener_host, listener_port, opts, NULL, NULL);
+	if (myqtt_conn_is_ok (conn, axl_false)) {
+		printf ("ERROR: expected wrong LOGIN but found OK operation to %s:%s..\n", listener_host, listener_port);
 		return axl_false;
 	} /* end if */
 	myqtt_conn_close (conn);
 
-	/* now try again connecting with session but providing a client identifier */
-	/* client_identifier -> "test11@identifier.com", clean_session -> axl_false */
-	conn = myqtt_conn_new (ctx, "test11@identifier.com", axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
+	printf ("Test 07: login failed, this is expected, so OK\n");
+
+	/* try again login with the right password */
+	opts = myqtt_conn_opts_new ();
+	myqtt_conn_opts_set_auth (opts, "aspl", "test");
+	conn = myqtt_conn_new (ctx, NULL, axl_true, 30, listener_host, listener_port, opts, NULL, NULL);
 	if (! myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: expected FAILURE but found LOGIN operation from %s:%s..\n", listener_host, listener_port);
+		printf ("ERROR: OK LOGIN but found ERROR operation to %s:%s..\n", listener_host, listener_port);
 		return axl_false;
 	} /* end if */
 
-	if (! myqtt_conn_sub (conn, 10, "a/subs/1", 0, &sub_result)) {
-		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
-		return axl_false;
-	} /* end if */
+	printf ("Test 07: login OK, now get auth user..\n");
 
-	if (! myqtt_conn_sub (conn, 10, "a/subs/2", 0, &sub_result)) {
-		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+	/* call to get client identifier */
+	if (! myqtt_conn_pub (conn, "myqtt/admin/get-conn-user", "", 0, MYQTT_QOS_0, axl_false, 0)) {
+		printf ("ERROR: unable to publish message to get client identifier..\n");
 		return axl_false;
 	} /* end if */
 
-	if (! myqtt_conn_sub (conn, 10, "a/subs/3", 0, &sub_result)) {
-		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+	/* push a message to ask for clientid identifier */
+	msg   = myqtt_conn_get_next (conn, 10000);
+
+	printf ("Test 07: auth user reported is: %p (%s)\n", msg, (const char *) myqtt_msg_get_app_msg (msg));
+	if (! axl_cmp ("aspl", (const char *) myqtt_msg_get_app_msg (msg))) {
+		printf ("ERROR: expected client identifier test_06.identifier, but found: %s\n", (const char *) myqtt_msg_get_app_msg (msg));
 		return axl_false;
 	} /* end if */
 
-	/* now close and reconnect and check if we have those subscriptions */
+	/* call to release message */
+	myqtt_msg_unref (msg);
+
+	printf ("Test 07: checking server reports the connection is authenticated..\n");
+
+	/* close connection */
+	printf ("Test 07: closing connection..\n");
 	myqtt_conn_close (conn);
 
-	/* now try again connecting with session but providing a client identifier */
-	/* client_identifier -> "test11@identifier.com", clean_session -> axl_false */
-	conn = myqtt_conn_new (ctx, "test11@identifier.com", axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
-	if (! myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: expected FAILURE but found LOGIN operation from %s:%s..\n", listener_host, listener_port);
+	/* release context */
+	printf ("Test 07: releasing context..\n");
+	myqtt_exit_ctx (ctx, axl_true);
+
+	return axl_true;
+}
+
+void test_08_should_not_receive (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg, axlPointer user_data)
+{
+	printf ("ERROR: received a message on a handler that shouldn't have been called\n");
+	return;
+}
+
+void test_08_should_receive (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg, axlPointer user_data)
+{
+
+	printf ("Test 08: received will..\n");
+	myqtt_msg_ref (msg);
+	myqtt_async_queue_push (user_data, msg);
+	return;
+}
+
+
+axl_bool test_08 (void) {
+
+	MyQttCtx        * ctx = init_ctx ();
+	MyQttConn       * conn, * conn2, * conn3;
+	MyQttMsg        * msg; 
+	MyQttConnOpts   * opts;
+	int               sub_result;
+	MyQttAsyncQueue * queue;
+	
+
+	if (! ctx)
 		return axl_false;
-	} /* end if */
 
-	/* set on publish handler */	
-	queue  = myqtt_async_queue_new ();
-	myqtt_conn_set_on_msg (conn, test_03_on_message, queue);
+	printf ("Test 08: creating connection..\n");
+	
+	/* set will message */
+	opts = myqtt_conn_opts_new ();
+	
+	/* set will */
+	myqtt_conn_opts_set_will (opts, MYQTT_QOS_2, "I lost connection", "Hey I lost connection, this is my status:....", axl_false);
 
-	/* send message to get subscriptions */
-	if (! myqtt_conn_pub (conn, "myqtt/admin/get-conn-subs", "", 0, MYQTT_QOS_0, axl_false, 0)) {
-		printf ("ERROR: unable to publish message to get client subscriptions..\n");
+	/* now connect to the listener:
+	   client_identifier -> NULL
+	   clean_session -> axl_true
+	   keep_alive -> 30 */
+	conn = myqtt_conn_new (ctx, NULL, axl_true, 30, listener_host, listener_port, opts, NULL, NULL);
+	if (! myqtt_conn_is_ok (conn, axl_false)) {
+		printf ("ERROR: expected LOGIN but found FAILURE operation from %s:%s..\n", listener_host, listener_port);
 		return axl_false;
 	} /* end if */
 
-	/* wait for message */
-	printf ("Test 11: we have to receive subscriptions...\n");
-	msg = myqtt_async_queue_timedpop (queue, 3000000);
-	if (msg == NULL) {
-		printf ("ERROR: expected to NOT receive msg reference but found reference value..\n");
+	/* now create a new connection and subscribe to the will */
+	conn2 = myqtt_conn_new (ctx, NULL, axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (conn, axl_false)) {
+		printf ("ERROR: expected LOGIN but found FAILURE operation from %s:%s..\n", listener_host, listener_port);
 		return axl_false;
-	} /* end if */
+	}
 
-	/* check subscriptions here */
-	if (! axl_cmp (myqtt_msg_get_app_msg (msg), "0: a/subs/1\n0: a/subs/2\n0: a/subs/3\n")) {
-		printf ("ERROR: expected to find a set of subscriptions that weren't found..\n");
+	if (! myqtt_conn_sub (conn2, 10, "I lost connection", 0, &sub_result)) {
+		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
 		return axl_false;
 	} /* end if */
 
-	/* release message */
-	myqtt_msg_unref (msg);
-
-	/* close connection */
-	printf ("Test 11: closing connections..\n");
-	myqtt_conn_close (conn);
-
-	printf ("Test 11: connect again and check subscriptions are recovered\n");
-	conn = myqtt_conn_new (ctx, "test11@identifier.com", axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
+	/* now create a third connection but without subscription */
+	conn3 = myqtt_conn_new (ctx, NULL, axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
 	if (! myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: expected FAILURE but found LOGIN operation from %s:%s..\n", listener_host, listener_port);
+		printf ("ERROR: unable connect to MQTT server..\n");
 		return axl_false;
 	} /* end if */
 
-	myqtt_conn_set_on_msg (conn, test_03_on_message, queue);
+	printf ("Test 08: 3 links connected, now close connection with will\n");
+	/* set on publish handler */	
+	queue  = myqtt_async_queue_new ();
+	myqtt_conn_set_on_msg (conn2, test_08_should_receive, queue);
+	myqtt_conn_set_on_msg (conn3, test_08_should_not_receive, NULL);
 
-	printf ("Test 11: publishing messages on recovered subscriptions..\n");
+	/* shutdown connection */
+	myqtt_conn_shutdown (conn);
 
-	/* publish messages */
-	if (! myqtt_conn_pub (conn, "a/subs/1", "this is a test on sub1", 22, MYQTT_QOS_0, axl_false, 0)) {
-		printf ("ERROR: unable to publish message to get client subscriptions..\n");
+	/* wait for message */
+	printf ("Test 08: waiting for will... (3 seconds at most)\n");
+	msg = myqtt_async_queue_timedpop (queue, 3000000);
+	if (msg == NULL) {
+		printf ("ERROR: expected to receive msg reference but found NULL value..\n");
 		return axl_false;
 	} /* end if */
 
-	/* publish messages */
-	if (! myqtt_conn_pub (conn, "a/subs/2", "this is a test on sub2", 22, MYQTT_QOS_0, axl_false, 0)) {
-		printf ("ERROR: unable to publish message to get client subscriptions..\n");
+	if (! axl_cmp (myqtt_msg_get_topic (msg), "I lost connection")) {
+		printf ("ERROR: expected to find topic name 'I lost connection' but found: '%s'\n", myqtt_msg_get_topic (msg));
 		return axl_false;
 	} /* end if */
 
-	/* publish messages */
-	if (! myqtt_conn_pub (conn, "a/subs/3", "this is a test on sub3", 22, MYQTT_QOS_0, axl_false, 0)) {
-		printf ("ERROR: unable to publish message to get client subscriptions..\n");
+	/* topic is a view into the received frame: check reported size */
+	if (myqtt_msg_get_topic_size (msg) != strlen ("I lost connection")) {
+		printf ("ERROR: expected topic size %d but found %d\n", (int) strlen ("I lost connection"), myqtt_msg_get_topic_size (msg));
 		return axl_false;
 	} /* end if */
 
-	iterator = 0;
-	while (iterator < 3) {
-		/* get message */
-		msg = myqtt_async_queue_timedpop (queue, 3000000);
-
-		printf ("Test 11: message received: %s (id: %d), topic: %s\n", myqtt_msg_get_type_str (msg), myqtt_msg_get_id (msg), myqtt_msg_get_topic (msg));
-
-		/* check for msg 1 */
-		if (axl_cmp (myqtt_msg_get_topic (msg), "a/subs/1")) {
-			printf ("Test 11: received message 1..checking\n");
-			if (! axl_cmp (myqtt_msg_get_app_msg (msg), "this is a test on sub1")) {
-				printf ("ERROR: expected message 1..but found: %s\n", (char *) myqtt_msg_get_app_msg (msg));
-				return axl_false;
-			}
-		} /* end if */
-
-		/* check for msg 2 */
-		if (axl_cmp (myqtt_msg_get_topic (msg), "a/subs/2")) {
-			printf ("Test 11: received message 2..checking\n");
-			if (! axl_cmp (myqtt_msg_get_app_msg (msg), "this is a test on sub2")) {
-				printf ("ERROR: expected message 2..but found: %s\n", (char *) myqtt_msg_get_app_msg (msg));
-				return axl_false;
-			}
-		} /* end if */
-
-		/* check for msg 3 */
-		if (axl_cmp (myqtt_msg_get_topic (msg), "a/subs/3")) {
-			printf ("Test 11: received message 3..checking\n");
-			if (! axl_cmp (myqtt_msg_get_app_msg (msg), "this is a test on sub3")) {
-				printf ("ERROR: expected message 3..but found: %s\n", (char *) myqtt_msg_get_app_msg (msg));
-				return axl_false;
-			}
-		} /* end if */
+	if (! axl_cmp (myqtt_msg_get_app_msg (msg), "Hey I lost connection, this is my status:....")) {
+		printf ("ERROR: expected to find topic name 'Hey I lost connection, this is my status:....' but found: '%s'\n", (const char *) myqtt_msg_get_app_msg (msg));
+		return axl_false;
+	} /* end if */
 
-		myqtt_msg_unref (msg);
-		iterator++;
-	}
+	/* release message and queue */
+	myqtt_async_queue_unref (queue);
+	myqtt_msg_unref (msg);
 
 	/* close connection */
+	printf ("Test 08: closing connections..\n");
 	myqtt_conn_close (conn);
-
-	/* release message and queue */
-	myqtt_async_queue_unref (queue);
+	myqtt_conn_close (conn2);
+	myqtt_conn_close (conn3);
 
 	/* release context */
-	printf ("Test 11: releasing context..\n");
+	printf ("Test 08: releasing context..\n");
 	myqtt_exit_ctx (ctx, axl_true);
 
 	return axl_true;
 }
 
-axl_bool test_12_common (int wildcard) {
+axl_bool test_09 (void) {
 
 	MyQttCtx        * ctx = init_ctx ();
-	MyQttConn       * conn;
+	MyQttConn       * conn, * conn2;
 	MyQttMsg        * msg; 
+	MyQttConnOpts   * opts;
 	int               sub_result;
 	MyQttAsyncQueue * queue;
-	const char      * sub_topic;
-	const char      * test_label = "12";
+	
 
 	if (! ctx)
 		return axl_false;
 
-	if (wildcard == 0)
-		test_label = "12";
-	else if (wildcard == 1)
-		test_label = "12-a";
-	else if (wildcard == 2)
-		test_label = "12-b";
-
-	printf ("Test %s: creating connections..\n", test_label);
+	printf ("Test 09: creating connections..\n");
 	
-	/* now try again connecting with session but providing a client identifier */
-	/* client_identifier -> "test12@identifier.com", clean_session -> axl_false */
-	conn = myqtt_conn_new (ctx, "test12@identifier.com", axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
+	/* set will message */
+	opts = myqtt_conn_opts_new ();
+	
+	/* set will */
+	myqtt_conn_opts_set_will (opts, MYQTT_QOS_2, "I lost connection", "Hey I lost connection, this is my status:....", axl_false);
+
+	/* now connect to the listener:
+	   client_identifier -> NULL
+	   clean_session -> axl_true
+	   keep_alive -> 30 */
+	conn = myqtt_conn_new (ctx, NULL, axl_true, 30, listener_host, listener_port, opts, NULL, NULL);
 	if (! myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: expected FAILURE but found LOGIN operation from %s:%s..\n", listener_host, listener_port);
+		printf ("ERROR: expected LOGIN but found FAILURE operation from %s:%s..\n", listener_host, listener_port);
 		return axl_false;
 	} /* end if */
 
-	sub_topic = "a/subs/1";
-	if (wildcard == 1)
-		sub_topic = "a/subs/+";
-	if (wildcard == 2)
-		sub_topic = "a/subs/#";
-	
-	printf ("Test %s: subscribing to topic: %s\n", test_label, sub_topic);
-	if (! myqtt_conn_sub (conn, 10, sub_topic, MYQTT_QOS_2, &sub_result)) {
+	/* now create a new connection and subscribe to the will */
+	conn2 = myqtt_conn_new (ctx, NULL, axl_true, 30, listener_host, listener_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (conn, axl_false)) {
+		printf ("ERROR: expected LOGIN but found FAILURE operation from %s:%s..\n", listener_host, listener_port);
+		return axl_false;
+	}
+
+	if (! myqtt_conn_sub (conn2, 10, "I lost connection", 0, &sub_result)) {
 		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
 		return axl_false;
 	} /* end if */
 
 	/* set on publish handler */	
 	queue  = myqtt_async_queue_new ();
-	myqtt_conn_set_on_msg (conn, test_03_on_message, queue);
+	myqtt_conn_set_on_msg (conn2, test_08_should_not_receive, queue);
 
-	/* publish QoS 1 messages */
-	if (! myqtt_conn_pub (conn, "a/subs/1", "This is a test message", 22, MYQTT_QOS_1, axl_false, 10)) {
-		printf ("ERROR: pub message failed..\n");
-		return axl_false;
-	} /* end if */
+	/* close connection */
+	myqtt_conn_close (conn);
 
-	/* get message */
-	printf ("Test %s: get QoS 1 message from server (limit wait to 3 seconds)\n", test_label);
+	/* wait for message */
+	printf ("Test 09: we shouldn't receive a will message... (3 seconds at most)\n");
 	msg = myqtt_async_queue_timedpop (queue, 3000000);
-
-	if (msg == NULL) {
-		printf ("ERROR: expected to receive a message but NULL reference was found\n");
+	if (msg != NULL) {
+		printf ("ERROR: expected to NOT receive msg reference but found reference value..\n");
 		return axl_false;
 	} /* end if */
-	
-#define test_12_check_msg "This is a test message"
 
-	if (! axl_cmp (myqtt_msg_get_app_msg (msg), test_12_check_msg)) {
-		printf ("ERROR (12.1): expected to receive different message content ('%s') but found: '%s'\n", 
-			test_12_check_msg,
-			(char *) myqtt_msg_get_app_msg (msg));
-		return axl_false;
-	} /* end if */
+	/* release message and queue */
+	myqtt_async_queue_unref (queue);
 
-	/* check message quality of service */
-	if (myqtt_msg_get_qos (msg) != MYQTT_QOS_1) {
-		printf ("ERROR: expected to receive quality of service 1 but found: %d\n", myqtt_msg_get_qos (msg));
-		return axl_false;
-	} /* end if */
+	/* close connection */
+	printf ("Test 09: closing connections..\n");
+	myqtt_conn_close (conn2);
 
-	/* check dup flag */
-	if (myqtt_msg_get_dup_flag (msg) != axl_false) {
-		printf ("ERROR: expected to find no dup flag fount it was found: %d\n", myqtt_msg_get_dup_flag (msg));
-		return axl_false;
-	} /* end if */
-
-	/* release message */
-	myqtt_msg_unref (msg);
-
-	/* check pkgids on this connection */
-	printf ("Test %s: checking local sending packet ids: %d..\n", test_label, axl_list_length (conn->sent_pkgids));
-	if (axl_list_length (conn->sent_pkgids) != 0) {
-		printf ("ERROR: expected to find sent pkgid ids list 0 but found pending %d\n", axl_list_length (conn->sent_pkgids));
-		return axl_false;
-	} /* end if */
-
-
-	/* unsubscribe */
-	if (! myqtt_conn_unsub (conn, sub_topic, 10)) {
-		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
-		return axl_false;
-	} /* end if */
-
-	/* close connection */
-	myqtt_conn_close (conn);
-
-	/* release message and queue */
-	myqtt_async_queue_unref (queue);
 
 	/* release context */
-	printf ("Test %s: releasing context..\n", test_label);
+	printf ("Test 09: releasing context..\n");
 	myqtt_exit_ctx (ctx, axl_true);
 
 	return axl_true;
 }
 
-axl_bool test_12 (void){
-	return test_12_common (0);
-}
-
-axl_bool test_12a (void){
-	return test_12_common (1);
-}
-
-axl_bool test_12b (void){
-	return test_12_common (2);
-}
-
-axl_bool test_13_common (int wildcard) {
+axl_bool test_10 (void) {
 
 	MyQttCtx        * ctx = init_ctx ();
 	MyQttConn       * conn;
-	MyQttMsg        * msg; 
-	int               sub_result;
-	MyQttAsyncQueue * queue;
+	int               iterator;
+	char            * sub_str;
+	int               pos;
 	
-	const char      * sub_topic;
-	const char      * test_label;
+	int               packet_id;
+	int               qos;
+	int               size;
 
-	sub_topic = "a/subs/1";
-	test_label = "13";
-	if (wildcard == 1) {
-		sub_topic = "a/subs/+";
-		test_label = "13-a";
+
+	if (! ctx)
+		return axl_false;
+
+	printf ("Test 10: checking numbers from file names..\n");
+	if (__myqtt_storage_get_size_from_file_name (ctx, "14-16856208-1408293505-274202", &pos) != 14 || pos != 2) {
+		printf ("ERROR: failed conversion: %d...\n", __myqtt_storage_get_size_from_file_name (ctx, "14-16856208-1408293505-274202", NULL));
+		return axl_false;
 	}
-	if (wildcard == 2) {
-		sub_topic = "a/subs/#";
-		test_label = "13-b";
+	if (__myqtt_storage_get_size_from_file_name (ctx, "1-16856208-1408293505-274202", &pos) != 1 || pos != 1) {
+		printf ("ERROR: failed conversion: %d...\n", __myqtt_storage_get_size_from_file_name (ctx, "1-16856208-1408293505-274202", NULL));
+		return axl_false;
+	}
+	if (__myqtt_storage_get_size_from_file_name (ctx, "1432969-16856208-1408293505-274202", &pos) != 1432969 || pos != 7) {
+		printf ("ERROR: failed conversion: %d...\n", __myqtt_storage_get_size_from_file_name (ctx, "1432969-16856208-1408293505-274202", NULL));
+		return axl_false;
 	}
-		
 
-	if (! ctx)
+	__myqtt_storage_get_values_from_file_name (ctx, "10-47-2-1438039660-798316", &packet_id, &size, &qos);
+	printf ("Test 10: values received from test packet_id=%d, size=%d, qos=%d\n",
+		packet_id, size, qos);
+	if (packet_id != 10 || size != 47 || qos != 2) {
+		printf ("ERROR: expected diffferent values for packet_id or size or qos (1)\n");
 		return axl_false;
+	}
 
-	printf ("Test %s: creating connections..\n", test_label);
-	
-	/* now try again connecting with session but providing a client identifier */
-	/* client_identifier -> "test13@identifier.com", clean_session -> axl_false */
-	conn = myqtt_conn_new (ctx, "test13@identifier.com", axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
+	printf ("Test 10: creating connection to simulate storage on this side\n");
+
+	/* create connection to simulate storage on this side */
+	conn = myqtt_conn_new (ctx, "test10@identifier.com", axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
 	if (! myqtt_conn_is_ok (conn, axl_false)) {
 		printf ("ERROR: expected FAILURE but found LOGIN operation from %s:%s..\n", listener_host, listener_port);
 		return axl_false;
 	} /* end if */
 
-	if (! myqtt_conn_sub (conn, 10, sub_topic, MYQTT_QOS_2, &sub_result)) {
-		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+	/* configure storage */
+	myqtt_storage_set_path (ctx, ".myqtt-test-10", 4096);
+
+	/* init storage for this user */
+	if (! myqtt_storage_init (ctx, conn, MYQTT_STORAGE_ALL)) {
+		printf ("ERROR: unable to initialize storage for the provided connection..\n");
 		return axl_false;
 	} /* end if */
 
-	/* set on publish handler */	
-	queue  = myqtt_async_queue_new ();
-	myqtt_conn_set_on_msg (conn, test_03_on_message, queue);
+	if (system ("find .myqtt-test-10 -type f -exec rm {} \\;"))
+		printf ("WARNING: clean subscriptions failed (reported non-zero value)\n");
 
-	/* publish QoS 1 messages */
-	if (! myqtt_conn_pub (conn, "a/subs/1", "This is a test message", 22, MYQTT_QOS_2, axl_false, 10)) {
-		printf ("ERROR: pub message failed..\n");
+	/* check if the subscription exists */
+	if (myqtt_storage_sub_exists (ctx, conn, "this/is/a/test")) {
+		printf ("ERROR (1): expected to not find subscription but it was..\n");
+		return axl_false;
+	}
+
+	/* check subscription */
+	if (! myqtt_storage_sub (ctx, conn, "this/is/a/test", MYQTT_QOS_2)) {
+		printf ("ERROR (2): expected to be able to register subscription, but error was found\n");
 		return axl_false;
 	} /* end if */
 
-	/* get message */
-	printf ("Test %s: get QoS 2 message from server (limit wait to 3 seconds)\n", test_label);
-	msg = myqtt_async_queue_timedpop (queue, 3000000);
+	/* check if the subscription exists */
+	printf ("Test 10: checking if test/is/a/test is present in storage...\n");
+	if (! myqtt_storage_sub_exists (ctx, conn, "this/is/a/test")) {
+		printf ("ERROR (3): expected to find subscription but it wasn't..\n");
+		return axl_false;
+	}
 
-	if (msg == NULL) {
-		printf ("ERROR: expected to receive a message but NULL reference was found\n");
+	/* check subscription */
+	if (! myqtt_storage_sub (ctx, conn, "this/is/a/test", MYQTT_QOS_1)) {
+		printf ("ERROR (4): expected to be able to register subscription, but error was found\n");
 		return axl_false;
 	} /* end if */
 
-	if (! axl_cmp (myqtt_msg_get_app_msg (msg), "This is a test message")) {
-		printf ("ERROR: expected to receive different message content but found: '%s'\n", (char *) myqtt_msg_get_app_msg (msg));
+	/* call to unsubscribe */
+	if (! myqtt_storage_unsub (ctx, conn, "this/is/a/test")) {
+		printf ("ERROR (5): expected to be able to register subscription, but error was found\n");
 		return axl_false;
 	} /* end if */
 
-	/* check message quality of service */
-	if (myqtt_msg_get_qos (msg) != MYQTT_QOS_2) {
-		printf ("ERROR: expected to receive quality of service 1 but found: %d\n", myqtt_msg_get_qos (msg));
+	/* check if the subscription exists */
+	if (myqtt_storage_sub_exists (ctx, conn, "this/is/a/test")) {
+		printf ("ERROR (6): expected to NOT find subscription but it was....\n");
 		return axl_false;
 	} /* end if */
 
-	/* check dup flag */
-	if (myqtt_msg_get_dup_flag (msg) != axl_false) {
-		printf ("ERROR: expected to find no dup flag fount it was found: %d\n", myqtt_msg_get_dup_flag (msg));
+	/* get the number of subscriptions */
+	if (myqtt_storage_sub_count (ctx, conn) != 0) {
+		printf ("ERROR (7): expected to receive sub count 0 but found: %d\n", myqtt_storage_sub_count (ctx, conn));
 		return axl_false;
 	} /* end if */
 
-	/* release message */
-	myqtt_msg_unref (msg);
+	/* do several subscriptions */
+	iterator = 0;
+	while (iterator < 100) {
+		sub_str = axl_strdup_printf ("this/is/a/test/%d", iterator);
+		myqtt_storage_sub (ctx, conn, sub_str, MYQTT_QOS_1);
+		axl_free (sub_str);
+		iterator++;
+	} /* end while */
 
-	/* check pkgids on this connection */
-	printf ("Test %s: checking local sending packet ids: %d..\n", test_label, axl_list_length (conn->sent_pkgids));
-	if (axl_list_length (conn->sent_pkgids) != 0) {
-		printf ("ERROR: expected to find sent pkgid ids list 0 but found pending %d\n", axl_list_length (conn->sent_pkgids));
+	/* get the number of subscriptions */
+	if (myqtt_storage_sub_count (ctx, conn) != 100) {
+		printf ("ERROR (8): expected to receive sub count 100 but found: %d\n", myqtt_storage_sub_count (ctx, conn));
 		return axl_false;
 	} /* end if */
 
-	/* unsubscribe */
-	if (! myqtt_conn_unsub (conn, sub_topic, 10)) {
-		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+	/* check if the subscription exists */
+	if (! myqtt_storage_sub_exists (ctx, conn, "this/is/a/test/49")) {
+		printf ("ERROR (9): expected to find subscription but it wasn't FOUND....\n");
+		return axl_false;
+	} /* end if */
+	if (! myqtt_storage_sub_exists (ctx, conn, "this/is/a/test/99")) {
+		printf ("ERROR (9): expected to find subscription but it wasn't FOUND....\n");
+		return axl_false;
+	} /* end if */
+	if (myqtt_storage_sub_exists (ctx, conn, "this/is/a/test/149")) {
+		printf ("ERROR (9): expected NOT to find subscription but it was FOUND....\n");
 		return axl_false;
 	} /* end if */
 
 	/* close connection */
+	printf ("Test 10: closing connections..\n");
 	myqtt_conn_close (conn);
 
-	/* release message and queue */
-	myqtt_async_queue_unref (queue);
+	/* create connection to simulate storage on this side */
+	conn = myqtt_conn_new (ctx, "test10@identifier.com", axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (conn, axl_false)) {
+		printf ("ERROR: expected FAILURE but found LOGIN operation from %s:%s..\n", listener_host, listener_port);
+		return axl_false;
+	} /* end if */
 
-	/* release context */
-	printf ("Test %s: releasing context..\n", test_label);
-	myqtt_exit_ctx (ctx, axl_true);
+	/* call to load local storage first (before an incoming connection) */
+	myqtt_storage_load (ctx);
 
-	return axl_true;
-}
+	/* now open the connection and restore subscriptions */
+	printf ("Test 10: recovering connection..\n");
+	if (! myqtt_storage_session_recover (ctx, conn)) {
+		printf ("ERROR (10): expected to find proper session recovery but found a failure..\n");
+		return axl_false;
+	} /* end if */
 
-axl_bool test_13 (void) {
-	return test_13_common (0);
-}
+	/* check connection state */
+	printf ("Test 10: checking connection recovery..\n");
+	if (axl_hash_items (conn->subs) != 100) {
+		printf ("Test 10: expected to find 100 subscriptions on connection but found %d\n", axl_hash_items (conn->subs));
+		return axl_false;
+	}
 
-axl_bool test_13a (void) {
-	return test_13_common (1);
-}
+	/* check connection state */
+	printf ("Test 10: Checking context recovery..\n");
+	if (axl_hash_items (ctx->subs) != 100) {
+		printf ("Test 10: expected to find 100 subscriptions on context but found %d\n", axl_hash_items (ctx->subs));
+		return axl_false;
+	}
+	
+	/* close connection */
+	printf ("Test 10: closing connection after recovery..\n");
+	myqtt_conn_close (conn);
 
-axl_bool test_13b (void) {
-	return test_13_common (2);
+	/* release context */
+	printf ("Test 10: releasing context..\n");
+	myqtt_exit_ctx (ctx, axl_true);
+
+	return axl_true;
 }
 
-axl_bool test_14_common (int wildcard) {
+axl_bool test_11 (void) {
 
 	MyQttCtx        * ctx = init_ctx ();
 	MyQttConn       * conn;
-	MyQttConn       * conn2;
 	MyQttMsg        * msg; 
-	int               iterator;
 	int               sub_result;
-	MyQttAsyncQueue * queue; 
-	int               value;
-	const char      * msg_str;
-	
-	const char      * sub_topic = NULL;
-	const char      * test_label = "14";
-
-	if (wildcard == 1) {
-		sub_topic = "test/message/+";
-		test_label = "14-a";
-	}
-	if (wildcard == 2) {
-		sub_topic = "test/message/#";
-		test_label = "14-b";
-	}
-
+	MyQttAsyncQueue * queue;
+	int               iterator;
 
 	if (! ctx)
 		return axl_false;
 
-	printf ("Test %s: queueing 3 messages (offline PUB)..\n", test_label);
-	if (system ("find .myqtt-regression-client/test14@identifier.com/msgs/ -type f -exec rm {} \\;") != 0)
-		printf ("WARNING: failed to clean messages from local storage..\n");
-
-	if (! myqtt_conn_offline_pub (ctx, "test14@identifier.com", "test/message/1", "This is a test message 1 for offline publication..", 50, MYQTT_QOS_0, axl_false)) {
-		printf ("ERROR: failed to publish offline message..\n");
-		return axl_false;
-	} /* end if */
+	printf ("Test 11: creating connections..\n");
+	
+	/* now connect to the listener:
+	   client_identifier -> NULL
+	   clean_session -> axl_false ... so we want session
+	   keep_alive -> 30 */
+	conn = myqtt_conn_new (ctx, NULL, axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (conn, axl_false)) {
+		printf ("ERROR: expected LOGIN but found FAILURE operation from %s:%s..it shouldn't have worked because we are requesting session and providing NULL identifier...\n", listener_host, listener_port);
+		return axl_false;
+	} /* end if */
+	myqtt_conn_close (conn);
 
-	if (! myqtt_conn_offline_pub (ctx, "test14@identifier.com", "test/message/2", "This is a test message 2 for offline publication..", 50, MYQTT_QOS_0, axl_false)) {
-		printf ("ERROR: failed to publish offline message..\n");
+	/* now try again connecting with session but providing a client identifier */
+	/* client_identifier -> "test11@identifier.com", clean_session -> axl_false */
+	conn = myqtt_conn_new (ctx, "test11@identifier.com", axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (conn, axl_false)) {
+		printf ("ERROR: expected FAILURE but found LOGIN operation from %s:%s..\n", listener_host, listener_port);
 		return axl_false;
 	} /* end if */
 
-	if (! myqtt_conn_offline_pub (ctx, "test14@identifier.com", "test/message/3", "This is a test message 3 for offline publication..", 50, MYQTT_QOS_0, axl_false)) {
-		printf ("ERROR: failed to publish offline message..\n");
+	if (! myqtt_conn_sub (conn, 10, "a/subs/1", 0, &sub_result)) {
+		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
 		return axl_false;
 	} /* end if */
 
-	/* get number of queued messages */
-	if (myqtt_storage_queued_messages_offline (ctx, "test14@identifier.com") != 3) {
-		printf ("ERROR: expected to find 3 queued messages (waiting to be sent on next connection..) but found: %d..\n", 
-			myqtt_storage_queued_messages_offline (ctx, "test14@identifier.com"));
+	if (! myqtt_conn_sub (conn, 10, "a/subs/2", 0, &sub_result)) {
+		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
 		return axl_false;
-	}
+	} /* end if */
 
-	/* get quota used */
-	value = myqtt_storage_queued_messages_quota_offline (ctx, "test14@identifier.com");
-	if (value != 204) {
-		printf ("ERROR: expected to find different quota size, but found: %d\n", value);
+	if (! myqtt_conn_sub (conn, 10, "a/subs/3", 0, &sub_result)) {
+		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
 		return axl_false;
 	} /* end if */
 
-	/* now connect with a different client id and subscribe to previous messages */
-	/* client_identifier -> "test13@identifier.com", clean_session -> axl_false */
-	printf ("Test %s: now connect with a second connection that expects to receive those queued messages for the other identifier..\n", test_label);
-	conn = myqtt_conn_new (ctx, "test14-2@identifier.com", axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
+	/* now close and reconnect and check if we have those subscriptions */
+	myqtt_conn_close (conn);
+
+	/* now try again connecting with session but providing a client identifier */
+	/* client_identifier -> "test11@identifier.com", clean_session -> axl_false */
+	conn = myqtt_conn_new (ctx, "test11@identifier.com", axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
 	if (! myqtt_conn_is_ok (conn, axl_false)) {
-		printf ("ERROR: expected LOGIN  but found LOGIN FAILURE operation from %s:%s..\n", listener_host, listener_port);
+		printf ("ERROR: expected FAILURE but found LOGIN operation from %s:%s..\n", listener_host, listener_port);
 		return axl_false;
 	} /* end if */
 
-	/* subscribe to the topics referenced before */
-	printf ("Test %s: subscribing to the topics (%s)..\n", test_label, sub_topic ? sub_topic : "test/message/1,2,3");
-	switch (wildcard) {
-	case 0:
-		if (! myqtt_conn_sub (conn, 10, "test/message/1", MYQTT_QOS_2, &sub_result)) {
-			printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
-			return axl_false;
-		} /* end if */
-		
-		if (! myqtt_conn_sub (conn, 10, "test/message/2", MYQTT_QOS_2, &sub_result)) {
-			printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
-			return axl_false;
-		} /* end if */
-		
-		if (! myqtt_conn_sub (conn, 10, "test/message/3", MYQTT_QOS_2, &sub_result)) {
-			printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
-			return axl_false;
-		} /* end if */
-		break;
-	case 1:
-	case 2:
-		if (! myqtt_conn_sub (conn, 10, sub_topic, MYQTT_QOS_2, &sub_result)) {
-			printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
-			return axl_false;
-		} /* end if */
-		break;
-	}
-		
-
 	/* set on publish handler */	
 	queue  = myqtt_async_queue_new ();
 	myqtt_conn_set_on_msg (conn, test_03_on_message, queue);
 
-	/* now connect with the client id with queued messages */
-	printf ("Test %s: now connect with the initial connection that has queued messages..\n", test_label);
-	conn2 = myqtt_conn_new (ctx, "test14@identifier.com", axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
-	if (! myqtt_conn_is_ok (conn2, axl_false)) {
-		printf ("ERROR: expected LOGIN  but found LOGIN FAILURE operation from %s:%s..\n", listener_host, listener_port);
+	/* send message to get subscriptions */
+	if (! myqtt_conn_pub (conn, "myqtt/admin/get-conn-subs", "", 0, MYQTT_QOS_0, axl_false, 0)) {
+		printf ("ERROR: unable to publish message to get client subscriptions..\n");
+		return axl_false;
+	} /* end if */
+
+	/* wait for message */
+	printf ("Test 11: we have to receive subscriptions...\n");
+	msg = myqtt_async_queue_timedpop (queue, 3000000);
+	if (msg == NULL) {
+		printf ("ERROR: expected to NOT receive msg reference but found reference value..\n");
+		return axl_false;
+	} /* end if */
+
+	/* check subscriptions here */
+	if (! axl_cmp (myqtt_msg_get_app_msg (msg), "0: a/subs/1\n0: a/subs/2\n0: a/subs/3\n")) {
+		printf ("ERROR: expected to find a set of subscriptions that weren't found..\n");
+		return axl_false;
+	} /* end if */
+
+	/* release message */
+	myqtt_msg_unref (msg);
+
+	/* close connection */
+	printf ("Test 11: closing connections..\n");
+	myqtt_conn_close (conn);
+
+	printf ("Test 11: connect again and check subscriptions are recovered\n");
+	conn = myqtt_conn_new (ctx, "test11@identifier.com", axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (conn, axl_false)) {
+		printf ("ERROR: expected FAILURE but found LOGIN operation from %s:%s..\n", listener_host, listener_port);
+		return axl_false;
+	} /* end if */
+
+	myqtt_conn_set_on_msg (conn, test_03_on_message, queue);
+
+	printf ("Test 11: publishing messages on recovered subscriptions..\n");
+
+	/* publish messages */
+	if (! myqtt_conn_pub (conn, "a/subs/1", "this is a test on sub1", 22, MYQTT_QOS_0, axl_false, 0)) {
+		printf ("ERROR: unable to publish message to get client subscriptions..\n");
+		return axl_false;
+	} /* end if */
+
+	/* publish messages */
+	if (! myqtt_conn_pub (conn, "a/subs/2", "this is a test on sub2", 22, MYQTT_QOS_0, axl_false, 0)) {
+		printf ("ERROR: unable to publish message to get client subscriptions..\n");
+		return axl_false;
+	} /* end if */
+
+	/* publish messages */
+	if (! myqtt_conn_pub (conn, "a/subs/3", "this is a test on sub3", 22, MYQTT_QOS_0, axl_false, 0)) {
+		printf ("ERROR: unable to publish message to get client subscriptions..\n");
 		return axl_false;
 	} /* end if */
 
-	/* check we receive those messages that were queued */ 
 	iterator = 0;
 	while (iterator < 3) {
-		/* next message on queue */
-		printf ("Test %s: waiting for messages to arrive (at most 3 seconds waiting before failing..\n", test_label);
+		/* get message */
 		msg = myqtt_async_queue_timedpop (queue, 3000000);
-		if (msg == NULL || myqtt_msg_get_type (msg) != MYQTT_PUBLISH) {
-			printf ("ERROR: received NULL message or wrong type..\n");
-			return axl_false;
-		} /* end if */
 
-		/* more checks here */
-		if (axl_cmp (myqtt_msg_get_topic (msg), "test/message/1")) {
-			msg_str = "This is a test message 1 for offline publication..";
-			if (! axl_cmp (myqtt_msg_get_app_msg (msg), msg_str)) {
-				printf ("ERROR: 14.1, expected different test but found (1): %s\n", (char *) myqtt_msg_get_app_msg (msg));
-				printf ("       message expected: %s\n", msg_str);
+		printf ("Test 11: message received: %s (id: %d), topic: %s\n", myqtt_msg_get_type_str (msg), myqtt_msg_get_id (msg), myqtt_msg_get_topic (msg));
+
+		/* check for msg 1 */
+		if (axl_cmp (myqtt_msg_get_topic (msg), "a/subs/1")) {
+			printf ("Test 11: received message 1..checking\n");
+			if (! axl_cmp (myqtt_msg_get_app_msg (msg), "this is a test on sub1")) {
+				printf ("ERROR: expected message 1..but found: %s\n", (char *) myqtt_msg_get_app_msg (msg));
 				return axl_false;
-			} /* end if */
-		} else if (axl_cmp (myqtt_msg_get_topic (msg), "test/message/2")) {
-			msg_str = "This is a test message 2 for offline publication..";
-			if (! axl_cmp (myqtt_msg_get_app_msg (msg), msg_str)) {
-				printf ("ERROR: 14.2, expected different test but found (2): %s\n", (char *) myqtt_msg_get_app_msg (msg));
-				printf ("       message expected: %s\n", msg_str);
+			}
+		} /* end if */
+
+		/* check for msg 2 */
+		if (axl_cmp (myqtt_msg_get_topic (msg), "a/subs/2")) {
+			printf ("Test 11: received message 2..checking\n");
+			if (! axl_cmp (myqtt_msg_get_app_msg (msg), "this is a test on sub2")) {
+				printf ("ERROR: expected message 2..but found: %s\n", (char *) myqtt_msg_get_app_msg (msg));
 				return axl_false;
-			} /* end if */
-		} else if (axl_cmp (myqtt_msg_get_topic (msg), "test/message/3")) {
-			msg_str = "This is a test message 3 for offline publication..";
-			if (! axl_cmp (myqtt_msg_get_app_msg (msg), msg_str)) {
-				printf ("ERROR: 14.3, expected different test but found (3): %s\n", (char *) myqtt_msg_get_app_msg (msg));
-				printf ("       message expected: %s\n", msg_str);
+			}
+		} /* end if */
+
+		/* check for msg 3 */
+		if (axl_cmp (myqtt_msg_get_topic (msg), "a/subs/3")) {
+			printf ("Test 11: received message 3..checking\n");
+			if (! axl_cmp (myqtt_msg_get_app_msg (msg), "this is a test on sub3")) {
+				printf ("ERROR: expected message 3..but found: %s\n", (char *) myqtt_msg_get_app_msg (msg));
 				return axl_false;
-			} /* end if */
-		} else {
-			printf ("ERROR: expected different content at the topic but found: %s\n", myqtt_msg_get_topic (msg));
-			return axl_false;
+			}
 		} /* end if */
 
-		if (myqtt_msg_get_app_msg_size (msg) != 50) {
-			printf ("ERROR: expected different content size but found: %d\n", myqtt_msg_get_app_msg_size (msg));
+		myqtt_msg_unref (msg);
+		iterator++;
+	}
+
+	/* close connection */
+	myqtt_conn_close (conn);
+
+	/* release message and queue */
+	myqtt_async_queue_unref (queue);
+
+	/* release context */
+	printf ("Test 11: releasing context..\n");
+	myqtt_exit_ctx (ctx, axl_true);
+
+	return axl_true;
+}
+
+axl_bool test_12_common (int wildcard) {
+
+	MyQttCtx        * ctx = init_ctx ();
+	MyQttConn       * conn;
+	MyQttMsg        * msg; 
+	int               sub_result;
+	MyQttAsyncQueue * queue;
+	const char      * sub_topic;
+	const char      * test_label = "12";
+
+	if (! ctx)
+		return axl_false;
+
+	if (wildcard == 0)
+		test_label = "12";
+	else if (wildcard == 1)
+		test_label = "12-a";
+	else if (wildcard == 2)
+		test_label = "12-b";
+
+	printf ("Test %s: creating connections..\n", test_label);
+	
+	/* now try again connecting with session but providing a client identifier */
+	/* client_identifier -> "test12@identifier.com", clean_session -> axl_false */
+	conn = myqtt_conn_new (ctx, "test12@identifier.com", axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (conn, axl_false)) {
+		printf ("ERROR: expected FAILURE but found LOGIN operation from %s:%s..\n", listener_host, listener_port);
+		return axl_false;
+	} /* end if */
+
+	sub_topic = "a/subs/1";
+	if (wildcard == 1)
+		sub_topic = "a/subs/+";
+	if (wildcard == 2)
+		sub_topic = "a/subs/#";
+	
+	printf ("Test %s: subscribing to topic: %s\n", test_label, sub_topic);
+	if (! myqtt_conn_sub (conn, 10, sub_topic, MYQTT_QOS_2, &sub_result)) {
+		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+		return axl_false;
+	} /* end if */
+
+	/* set on publish handler */	
+	queue  = myqtt_async_queue_new ();
+	myqtt_conn_set_on_msg (conn, test_03_on_message, queue);
+
+	/* publish QoS 1 messages */
+	if (! myqtt_conn_pub (conn, "a/subs/1", "This is a test message", 22, MYQTT_QOS_1, axl_false, 10)) {
+		printf ("ERROR: pub message failed..\n");
+		return axl_false;
+	} /* end if */
+
+	/* get message */
+	printf ("Test %s: get QoS 1 message from server (limit wait to 3 seconds)\n", test_label);
+	msg = myqtt_async_queue_timedpop (queue, 3000000);
+
+	if (msg == NULL) {
+		printf ("ERROR: expected to receive a message but NULL reference was found\n");
+		return axl_false;
+	} /* end if */
+	
+#define test_12_check_msg "This is a test message"
+
+	if (! axl_cmp (myqtt_msg_get_app_msg (msg), test_12_check_msg)) {
+		printf ("ERROR (12.1): expected to receive different message content ('%s') but found: '%s'\n", 
+			test_12_check_msg,
+			(char *) myqtt_msg_get_app_msg (msg));
+		return axl_false;
+	} /* end if */
+
+	/* check message quality of service */
+	if (myqtt_msg_get_qos (msg) != MYQTT_QOS_1) {
+		printf ("ERROR: expected to receive quality of service 1 but found: %d\n", myqtt_msg_get_qos (msg));
+		return axl_false;
+	} /* end if */
+
+	/* check dup flag */
+	if (myqtt_msg_get_dup_flag (msg) != axl_false) {
+		printf ("ERROR: expected to find no dup flag fount it was found: %d\n", myqtt_msg_get_dup_flag (msg));
+		return axl_false;
+	} /* end if */
+
+	/* release message */
+	myqtt_msg_unref (msg);
+
+	/* check pkgids on this connection */
+	printf ("Test %s: checking local sending packet ids: %d..\n", test_label, axl_list_length (conn->sent_pkgids));
+	if (axl_list_length (conn->sent_pkgids) != 0) {
+		printf ("ERROR: expected to find sent pkgid ids list 0 but found pending %d\n", axl_list_length (conn->sent_pkgids));
+		return axl_false;
+	} /* end if */
+
+
+	/* unsubscribe */
+	if (! myqtt_conn_unsub (conn, sub_topic, 10)) {
+		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+		return axl_false;
+	} /* end if */
+
+	/* close connection */
+	myqtt_conn_close (conn);
+
+	/* release message and queue */
+	myqtt_async_queue_unref (queue);
+
+	/* release context */
+	printf ("Test %s: releasing context..\n", test_label);
+	myqtt_exit_ctx (ctx, axl_true);
+
+	return axl_true;
+}
+
+axl_bool test_12 (void){
+	return test_12_common (0);
+}
+
+axl_bool test_12a (void){
+	return test_12_common (1);
+}
+
+axl_bool test_12b (void){
+	return test_12_common (2);
+}
+
+axl_bool test_13_common (int wildcard) {
+
+	MyQttCtx        * ctx = init_ctx ();
+	MyQttConn       * conn;
+	MyQttMsg        * msg; 
+	int               sub_result;
+	MyQttAsyncQueue * queue;
+	
+	const char      * sub_topic;
+	const char      * test_label;
+
+	sub_topic = "a/subs/1";
+	test_label = "13";
+	if (wildcard == 1) {
+		sub_topic = "a/subs/+";
+		test_label = "13-a";
+	}
+	if (wildcard == 2) {
+		sub_topic = "a/subs/#";
+		test_label = "13-b";
+	}
+		
+
+	if (! ctx)
+		return axl_false;
+
+	printf ("Test %s: creating connections..\n", test_label);
+	
+	/* now try again connecting with session but providing a client identifier */
+	/* client_identifier -> "test13@identifier.com", clean_session -> axl_false */
+	conn = myqtt_conn_new (ctx, "test13@identifier.com", axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (conn, axl_false)) {
+		printf ("ERROR: expected FAILURE but found LOGIN operation from %s:%s..\n", listener_host, listener_port);
+		return axl_false;
+	} /* end if */
+
+	if (! myqtt_conn_sub (conn, 10, sub_topic, MYQTT_QOS_2, &sub_result)) {
+		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+		return axl_false;
+	} /* end if */
+
+	/* set on publish handler */	
+	queue  = myqtt_async_queue_new ();
+	myqtt_conn_set_on_msg (conn, test_03_on_message, queue);
+
+	/* publish QoS 1 messages */
+	if (! myqtt_conn_pub (conn, "a/subs/1", "This is a test message", 22, MYQTT_QOS_2, axl_false, 10)) {
+		printf ("ERROR: pub message failed..\n");
+		return axl_false;
+	} /* end if */
+
+	/* get message */
+	printf ("Test %s: get QoS 2 message from server (limit wait to 3 seconds)\n", test_label);
+	msg = myqtt_async_queue_timedpop (queue, 3000000);
+
+	if (msg == NULL) {
+		printf ("ERROR: expected to receive a message but NULL reference was found\n");
+		return axl_false;
+	} /* end if */
+
+	if (! axl_cmp (myqtt_msg_get_app_msg (msg), "This is a test message")) {
+		printf ("ERROR: expected to receive different message content but found: '%s'\n", (char *) myqtt_msg_get_app_msg (msg));
+		return axl_false;
+	} /* end if */
+
+	/* check message quality of service */
+	if (myqtt_msg_get_qos (msg) != MYQTT_QOS_2) {
+		printf ("ERROR: expected to receive quality of service 1 but found: %d\n", myqtt_msg_get_qos (msg));
+		return axl_false;
+	} /* end if */
+
+	/* check dup flag */
+	if (myqtt_msg_get_dup_flag (msg) != axl_false) {
+		printf ("ERROR: expected to find no dup flag fount it was found: %d\n", myqtt_msg_get_dup_flag (msg));
+		return axl_false;
+	} /* end if */
+
+	/* release message */
+	myqtt_msg_unref (msg);
+
+	/* check pkgids on this connection */
+	printf ("Test %s: checking local sending packet ids: %d..\n", test_label, axl_list_length (conn->sent_pkgids));
+	if (axl_list_length (conn->sent_pkgids) != 0) {
+		printf ("ERROR: expected to find sent pkgid ids list 0 but found pending %d\n", axl_list_length (conn->sent_pkgids));
+		return axl_false;
+	} /* end if */
+
+	/* unsubscribe */
+	if (! myqtt_conn_unsub (conn, sub_topic, 10)) {
+		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+		return axl_false;
+	} /* end if */
+
+	/* close connection */
+	myqtt_conn_close (conn);
+
+	/* release message and queue */
+	myqtt_async_queue_unref (queue);
+
+	/* release context */
+	printf ("Test %s: releasing context..\n", test_label);
+	myqtt_exit_ctx (ctx, axl_true);
+
+	return axl_true;
+}
+
+axl_bool test_13 (void) {
+	return test_13_common (0);
+}
+
+axl_bool test_13a (void) {
+	return test_13_common (1);
+}
+
+axl_bool test_13b (void) {
+	return test_13_common (2);
+}
+
+axl_bool test_14_common (int wildcard) {
+
+	MyQttCtx        * ctx = init_ctx ();
+	MyQttConn       * conn;
+	MyQttConn       * conn2;
+	MyQttMsg        * msg; 
+	int               iterator;
+	int               sub_result;
+	MyQttAsyncQueue * queue; 
+	int               value;
+	const char      * msg_str;
+	
+	const char      * sub_topic = NULL;
+	const char      * test_label = "14";
+
+	if (wildcard == 1) {
+		sub_topic = "test/message/+";
+		test_label = "14-a";
+	}
+	if (wildcard == 2) {
+		sub_topic = "test/message/#";
+		test_label = "14-b";
+	}
+
+
+	if (! ctx)
+		return axl_false;
+
+	printf ("Test %s: queueing 3 messages (offline PUB)..\n", test_label);
+	if (system ("find .myqtt-regression-client/test14@identifier.com/msgs/ -type f -exec rm {} \\;") != 0)
+		printf ("WARNING: failed to clean messages from local storage..\n");
+
+	if (! myqtt_conn_offline_pub (ctx, "test14@identifier.com", "test/message/1", "This is a test message 1 for offline publication..", 50, MYQTT_QOS_0, axl_false)) {
+		printf ("ERROR: failed to publish offline message..\n");
+		return axl_false;
+	} /* end if */
+
+	if (! myqtt_conn_offline_pub (ctx, "test14@identifier.com", "test/message/2", "This is a test message 2 for offline publication..", 50, MYQTT_QOS_0, axl_false)) {
+		printf ("ERROR: failed to publish offline message..\n");
+		return axl_false;
+	} /* end if */
+
+	if (! myqtt_conn_offline_pub (ctx, "test14@identifier.com", "test/message/3", "This is a test message 3 for offline publication..", 50, MYQTT_QOS_0, axl_false)) {
+		printf ("ERROR: failed to publish offline message..\n");
+		return axl_false;
+	} /* end if */
+
+	/* get number of queued messages */
+	if (myqtt_storage_queued_messages_offline (ctx, "test14@identifier.com") != 3) {
+		printf ("ERROR: expected to find 3 queued messages (waiting to be sent on next connection..) but found: %d..\n", 
+			myqtt_storage_queued_messages_offline (ctx, "test14@identifier.com"));
+		return axl_false;
+	}
+
+	/* get quota used */
+	value = myqtt_storage_queued_messages_quota_offline (ctx, "test14@identifier.com");
+	if (value != 204) {
+		printf ("ERROR: expected to find different quota size, but found: %d\n", value);
+		return axl_false;
+	} /* end if */
+
+	/* now connect with a different client id and subscribe to previous messages */
+	/* client_identifier -> "test13@identifier.com", clean_session -> axl_false */
+	printf ("Test %s: now connect with a second connection that expects to receive those queued messages for the other identifier..\n", test_label);
+	conn = myqtt_conn_new (ctx, "test14-2@identifier.com", axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (conn, axl_false)) {
+		printf ("ERROR: expected LOGIN  but found LOGIN FAILURE operation from %s:%s..\n", listener_host, listener_port);
+		return axl_false;
+	} /* end if */
+
+	/* subscribe to the topics referenced before */
+	printf ("Test %s: subscribing to the topics (%s)..\n", test_label, sub_topic ? sub_topic : "test/message/1,2,3");
+	switch (wildcard) {
+	case 0:
+		if (! myqtt_conn_sub (conn, 10, "test/message/1", MYQTT_QOS_2, &sub_result)) {
+			printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+			return axl_false;
+		} /* end if */
+		
+		if (! myqtt_conn_sub (conn, 10, "test/message/2", MYQTT_QOS_2, &sub_result)) {
+			printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+			return axl_false;
+		} /* end if */
+		
+		if (! myqtt_conn_sub (conn, 10, "test/message/3", MYQTT_QOS_2, &sub_result)) {
+			printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+			return axl_false;
+		} /* end if */
+		break;
+	case 1:
+	case 2:
+		if (! myqtt_conn_sub (conn, 10, sub_topic, MYQTT_QOS_2, &sub_result)) {
+			printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+			return axl_false;
+		} /* end if */
+		break;
+	}
+		
+
+	/* set on publish handler */	
+	queue  = myqtt_async_queue_new ();
+	myqtt_conn_set_on_msg (conn, test_03_on_message, queue);
+
+	/* now connect with the client id with queued messages */
+	printf ("Test %s: now connect with the initial connection that has queued messages..\n", test_label);
+	conn2 = myqtt_conn_new (ctx, "test14@identifier.com", axl_false, 30, listener_host, listener_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (conn2, axl_false)) {
+		printf ("ERROR: expected LOGIN  but found LOGIN FAILURE operation from %s:%s..\n", listener_host, listener_port);
+		return axl_false;
+	} /* end if */
+
+	/* check we receive those messages that were queued */ 
+	iterator = 0;
+	while (iterator < 3) {
+		/* next message on queue */
+		printf ("Test %s: waiting for messages to arrive (at most 3 seconds waiting before failing..\n", test_label);
+		msg = myqtt_async_queue_timedpop (queue, 3000000);
+		if (msg == NULL || myqtt_msg_get_type (msg) != MYQTT_PUBLISH) {
+			printf ("ERROR: received NULL message or wrong type..\n");
+			return axl_false;
+		} /* end if */
+
+		/* more checks here */
+		if (axl_cmp (myqtt_msg_get_topic (msg), "test/message/1")) {
+			msg_str = "This is a test message 1 for offline publication..";
+			if (! axl_cmp (myqtt_msg_get_app_msg (msg), msg_str)) {
+				printf ("ERROR: 14.1, expected different test but found (1): %s\n", (char *) myqtt_msg_get_app_msg (msg));
+				printf ("       message expected: %s\n", msg_str);
+				return axl_false;
+			} /* end if */
+		} else if (axl_cmp (myqtt_msg_get_topic (msg), "test/message/2")) {
+			msg_str = "This is a test message 2 for offline publication..";
+			if (! axl_cmp (myqtt_msg_get_app_msg (msg), msg_str)) {
+				printf ("ERROR: 14.2, expected different test but found (2): %s\n", (char *) myqtt_msg_get_app_msg (msg));
+				printf ("       message expected: %s\n", msg_str);
+				return axl_false;
+			} /* end if */
+		} else if (axl_cmp (myqtt_msg_get_topic (msg), "test/message/3")) {
+			msg_str = "This is a test message 3 for offline publication..";
+			if (! axl_cmp (myqtt_msg_get_app_msg (msg), msg_str)) {
+				printf ("ERROR: 14.3, expected different test but found (3): %s\n", (char *) myqtt_msg_get_app_msg (msg));
+				printf ("       message expected: %s\n", msg_str);
+				return axl_false;
+			} /* end if */
+		} else {
+			printf ("ERROR: expected different content at the topic but found: %s\n", myqtt_msg_get_topic (msg));
+			return axl_false;
+		} /* end if */
+
+		if (myqtt_msg_get_app_msg_size (msg) != 50) {
+			printf ("ERROR: expected different content size but found: %d\n", myqtt_msg_get_app_msg_size (msg));
+			return axl_false;
+		} /* end if */
+
+		/* release message */
+		myqtt_msg_unref (msg);
+
+		/* next iterator */
+		iterator++;
+	} /* end while */
+
+	/* now check pending messages for test14@identifier.com */
+	if (myqtt_storage_queued_messages (ctx, conn) != 0) {
+		printf ("ERROR: expected to not find any queued message but found: %d\n", myqtt_storage_queued_messages (ctx, conn));
+		return axl_false;
+	} /* end if */
+
+	/* close both connections */
+	myqtt_conn_close (conn2);
+
+
+
+	switch (wildcard) {
+	case 0:
+		/* unsubscribe */
+		if (! myqtt_conn_unsub (conn, "test/message/1", 10)) {
+			printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+			return axl_false;
+		} /* end if */
+
+		if (! myqtt_conn_unsub (conn, "test/message/2", 10)) {
+			printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+			return axl_false;
+		} /* end if */
+
+		if (! myqtt_conn_unsub (conn, "test/message/3", 10)) {
+			printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+			return axl_false;
+		} /* end if */
+
+
+
+		break;
+	case 1:
+	case 2:
+		/* unsubscribe */
+		if (! myqtt_conn_unsub (conn, sub_topic, 10)) {
+			printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+			return axl_false;
+		} /* end if */
+		break;
+	}
+
+	myqtt_conn_close (conn);
+
+	/* release queue */
+	myqtt_async_queue_unref (queue);
+	
+	/* release context */
+	printf ("Test %s: releasing context..\n", test_label);
+	myqtt_exit_ctx (ctx, axl_true);
+
+	return axl_true;
+}
+
+axl_bool test_14 (void) {
+	return test_14_common (0);
+}
+
+axl_bool test_14b (void) {
+	return test_14_common (1);
+}
+
+axl_bool test_14c (void) {
+	return test_14_common (2);
+}
+
+axl_bool test_14a_subs (MyQttCtx * ctx, const char * client_id)
+{
+	/* store some subscriptions */
+	if (! myqtt_storage_sub_offline (ctx, client_id, "test/sub/1", MYQTT_QOS_0))
+		return axl_false;
+	if (! myqtt_storage_sub_offline (ctx, client_id, "test/sub/2", MYQTT_QOS_1))
+		return axl_false;
+	if (! myqtt_storage_sub_offline (ctx, client_id, "test/sub/3", MYQTT_QOS_2))
+		return axl_false;
+
+	return axl_true; /* return ok */
+}
+
+axl_bool test_14a (void) {
+	MyQttCtx        * ctx = init_ctx ();
+	int               entries;
+	axlHashCursor   * cursor;
+
+	/* configure path */
+	myqtt_storage_set_path (ctx, ".myqtt-listener-test14a", 4096);
+
+	/* init storage for 5 clients */
+	myqtt_storage_init_offline (ctx, "test14aclient1", MYQTT_STORAGE_ALL);
+	myqtt_storage_init_offline (ctx, "test14aclient2", MYQTT_STORAGE_ALL);
+	myqtt_storage_init_offline (ctx, "test14aclient3", MYQTT_STORAGE_ALL);
+	myqtt_storage_init_offline (ctx, "test14aclient4", MYQTT_STORAGE_ALL);
+	myqtt_storage_init_offline (ctx, "test14aclient5", MYQTT_STORAGE_ALL);
+
+	if (! test_14a_subs (ctx, "test14aclient1"))
+		return axl_false;
+	if (! test_14a_subs (ctx, "test14aclient2"))
+		return axl_false;
+	if (! test_14a_subs (ctx, "test14aclient3"))
+		return axl_false;
+	if (! test_14a_subs (ctx, "test14aclient4"))
+		return axl_false;
+	if (! test_14a_subs (ctx, "test14aclient5"))
+		return axl_false;
+
+	/* load storage */
+	entries = myqtt_storage_load (ctx);
+	printf ("Test 14a: loaded %d subscriptions..\n", entries);
+	if (entries != 15) {
+		printf ("ERROR: expected to find 15 subscriptions but found %d\n", entries);
+		return axl_false;
+	} /* end if */
+
+	if (axl_hash_items (ctx->offline_subs) != 3) {
+		printf ("ERROR: expected to find 3 subscriptions inside offline subs..\n");
+		return axl_false;
+	}
+
+	if (axl_hash_items (ctx->subs) != 0) {
+		printf ("ERROR: expected to find 0 subscriptions inside online subs..\n");
+		return axl_false;
+	}
+
+	/* iterarate hashes */
+	cursor = axl_hash_cursor_new (ctx->offline_subs);
+	while (axl_hash_cursor_has_item (cursor)) {
+
+		if (axl_cmp (axl_hash_cursor_get_key (cursor), "test/sub/1")) {
+			if (axl_hash_items (axl_hash_cursor_get_value (cursor)) != 5) {
+				printf ("Expected to find 5 items inside hash directed by subscription: %s but found (%d)\n", 
+					(char *) axl_hash_cursor_get_key (cursor), axl_hash_items (axl_hash_cursor_get_value (cursor)));
+				return axl_false;
+			}
+		} else if (axl_cmp (axl_hash_cursor_get_key (cursor), "test/sub/2")) {
+			if (axl_hash_items (axl_hash_cursor_get_value (cursor)) != 5) {
+				printf ("Expected to find 5 items inside hash directed by subscription: %s but found (%d)\n", 
+					(char *) axl_hash_cursor_get_key (cursor), axl_hash_items (axl_hash_cursor_get_value (cursor)));
+				return axl_false;
+			}
+			
+		} else if (axl_cmp (axl_hash_cursor_get_key (cursor), "test/sub/3")) {
+			if (axl_hash_items (axl_hash_cursor_get_value (cursor)) != 5) {
+				printf ("Expected to find 5 items inside hash directed by subscription: %s but found (%d)\n", 
+					(char *) axl_hash_cursor_get_key (cursor), axl_hash_items (axl_hash_cursor_get_value (cursor)));
+				return axl_false;
+			}
+			
+		} else {
+			printf ("ERROR: unexpected subscription found: %s\n", (char *) axl_hash_cursor_get_key (cursor));
+			return axl_false;
+		}
+
+
+		/* next hash cursor */
+		axl_hash_cursor_next (cursor);
+	} /* end if */
+	axl_hash_cursor_free (cursor);
+
+	/* release context */
+	printf ("Test 14a: releasing context..\n");
+	myqtt_exit_ctx (ctx, axl_true);
+	
+	return axl_true;
+}
+
+axl_bool test_14d (void) {
+	MyQttCtx        * ctx = init_ctx ();
+	int               entries;
+	axlPointer        handle;
+	axlList         * list;
+	MyQttQos          qos;
+	unsigned char   * app_msg;
+	int               app_size;
+
+	/* configure path (it must not be used) and memory storage */
+	myqtt_storage_set_path (ctx, ".myqtt-listener-test14d", 4096);
+	if (! myqtt_storage_use (ctx, MYQTT_STORAGE_TYPE_MEMORY)) {
+		printf ("ERROR: failed to configure memory storage..\n");
+		return axl_false;
+	} /* end if */
+	if (myqtt_storage_get_type (ctx) != MYQTT_STORAGE_TYPE_MEMORY) {
+		printf ("ERROR: expected memory storage to be configured but found: %d\n", myqtt_storage_get_type (ctx));
+		return axl_false;
+	} /* end if */
+
+	/* init storage for 2 clients */
+	myqtt_storage_init_offline (ctx, "test14dclient1", MYQTT_STORAGE_ALL);
+	myqtt_storage_init_offline (ctx, "test14dclient2", MYQTT_STORAGE_ALL);
+
+	if (! test_14a_subs (ctx, "test14dclient1"))
+		return axl_false;
+	if (! test_14a_subs (ctx, "test14dclient2"))
+		return axl_false;
+
+	/* subscribe again: must not duplicate */
+	if (! test_14a_subs (ctx, "test14dclient2"))
+		return axl_false;
+	if (myqtt_storage_sub_count_offline (ctx, "test14dclient2") != 3) {
+		printf ("ERROR: expected to find 3 subscriptions but found %d\n", myqtt_storage_sub_count_offline (ctx, "test14dclient2"));
+		return axl_false;
+	} /* end if */
+
+	/* queue messages */
+	handle = myqtt_storage_store_msg_offline (ctx, "test14dclient1", 10, MYQTT_QOS_1, (unsigned char *) "This is a test", 14);
+	if (handle == NULL) {
+		printf ("ERROR: failed to store message..\n");
+		return axl_false;
+	} /* end if */
+	axl_free (handle);
+	if (myqtt_storage_queued_messages_offline (ctx, "test14dclient1") != 1 ||
+	    myqtt_storage_queued_messages_quota_offline (ctx, "test14dclient1") != 14) {
+		printf ("ERROR: expected 1 message queued (14 bytes) but found %d (%d bytes)\n", 
+			myqtt_storage_queued_messages_offline (ctx, "test14dclient1"),
+			myqtt_storage_queued_messages_quota_offline (ctx, "test14dclient1"));
+		return axl_false;
+	} /* end if */
+
+	/* lock pkgids */
+	if (! myqtt_storage_lock_pkgid_offline (ctx, "test14dclient1", 10) || myqtt_storage_lock_pkgid_offline (ctx, "test14dclient1", 10)) {
+		printf ("ERROR: expected to lock pkgid 10 only once..\n");
+		return axl_false;
+	} /* end if */
+	myqtt_storage_release_pkgid_offline (ctx, "test14dclient1", 10);
+	if (! myqtt_storage_lock_pkgid_offline (ctx, "test14dclient1", 10)) {
+		printf ("ERROR: expected to lock pkgid 10 after release..\n");
+		return axl_false;
+	} /* end if */
+
+	/* retained messages */
+	if (! myqtt_storage_retain_msg_set (ctx, "this/is/a/test", MYQTT_QOS_2, (axlPointer) "Retained message..", 18)) {
+		printf ("ERROR: failed to set retained message..\n");
+		return axl_false;
+	} /* end if */
+	list = myqtt_storage_get_retained_topics (ctx, "#");
+	if (list == NULL || axl_list_length (list) != 1) {
+		printf ("ERROR: expected to find 1 retained topic..\n");
+		return axl_false;
+	} /* end if */
+	axl_list_free (list);
+	if (! myqtt_storage_retain_msg_recover (ctx, "this/is/a/test", &qos, &app_msg, &app_size) || 
+	    qos != MYQTT_QOS_2 || app_size != 18 || ! axl_memcmp ((const char *) app_msg, "Retained message..", 18)) {
+		printf ("ERROR: failed to recover retained message..\n");
+		return axl_false;
+	} /* end if */
+	axl_free (app_msg);
+
+	/* load storage */
+	entries = myqtt_storage_load (ctx);
+	printf ("Test 14d: loaded %d subscriptions..\n", entries);
+	if (entries != 6) {
+		printf ("ERROR: expected to find 6 subscriptions but found %d\n", entries);
+		return axl_false;
+	} /* end if */
+
+	if (axl_hash_items (ctx->offline_subs) != 3) {
+		printf ("ERROR: expected to find 3 subscriptions inside offline subs..\n");
+		return axl_false;
+	}
+
+	/* nothing must be written to disk */
+	if (myqtt_support_file_test (".myqtt-listener-test14d", FILE_EXISTS)) {
+		printf ("ERROR: memory storage created .myqtt-listener-test14d directory..\n");
+		return axl_false;
+	} /* end if */
+
+	/* release context */
+	printf ("Test 14d: releasing context..\n");
+	myqtt_exit_ctx (ctx, axl_true);
+	
+	return axl_true;
+}
+axl_bool test_14e_load (const char * label, int expected, int expected_topics)
+{
+	MyQttCtx        * ctx = init_ctx ();
+	int               entries;
+
+	/* configure path and load */
+	myqtt_storage_set_path (ctx, ".myqtt-listener-test14e", 4096);
+	entries = myqtt_storage_load (ctx);
+	printf ("Test 14e: loaded %d subscriptions (%s)..\n", entries, label);
+	if (entries != expected) {
+		printf ("ERROR: expected to find %d subscriptions but found %d (%s)\n", expected, entries, label);
+		return axl_false;
+	} /* end if */
+
+	if (axl_hash_items (ctx->offline_subs) != expected_topics) {
+		printf ("ERROR: expected to find %d subscriptions inside offline subs but found %d (%s)..\n", 
+			expected_topics, axl_hash_items (ctx->offline_subs), label);
+		return axl_false;
+	}
+
+	/* release context */
+	myqtt_exit_ctx (ctx, axl_true);
+	return axl_true;
+}
+
+axl_bool test_14e (void) {
+	MyQttCtx        * ctx;
+	FILE            * handle;
+
+	/* clean previous runs */
+	if (system ("rm -rf .myqtt-listener-test14e") != 0)
+		return axl_false;
+
+	/* create storage for 3 clients */
+	ctx = init_ctx ();
+	myqtt_storage_set_path (ctx, ".myqtt-listener-test14e", 4096);
+	myqtt_storage_init_offline (ctx, "test14eclient1", MYQTT_STORAGE_ALL);
+	myqtt_storage_init_offline (ctx, "test14eclient2", MYQTT_STORAGE_ALL);
+	myqtt_storage_init_offline (ctx, "test14eclient3", MYQTT_STORAGE_ALL);
+	if (! test_14a_subs (ctx, "test14eclient1") || ! test_14a_subs (ctx, "test14eclient2") || ! test_14a_subs (ctx, "test14eclient3"))
+		return axl_false;
+	myqtt_exit_ctx (ctx, axl_true);
+
+	/* first load: walks directories and creates index */
+	if (! test_14e_load ("directory walk", 9, 3))
+		return axl_false;
+	if (! myqtt_support_file_test (".myqtt-listener-test14e/.myqtt/subs.index", FILE_EXISTS)) {
+		printf ("ERROR: expected to find subscription index after loading..\n");
+		return axl_false;
+	} /* end if */
+
+	/* update subscriptions once the index is created */
+	ctx = init_ctx ();
+	myqtt_storage_set_path (ctx, ".myqtt-listener-test14e", 4096);
+	if (myqtt_storage_load (ctx) != 9)
+		return axl_false;
+	if (! myqtt_storage_sub_offline (ctx, "test14eclient3", "test/sub/4", MYQTT_QOS_1))
+		return axl_false;
+	myqtt_storage_clear_offline (ctx, "test14eclient1", MYQTT_STORAGE_ALL);
+	myqtt_exit_ctx (ctx, axl_true);
+
+	/* second load: from index */
+	if (! test_14e_load ("index", 7, 4))
+		return axl_false;
+
+	/* append garbage to simulate an incomplete record */
+	handle = fopen (".myqtt-listener-test14e/.myqtt/subs.index", "ab");
+	if (handle == NULL)
+		return axl_false;
+	fwrite ("garbage", 1, 7, handle);
+	fclose (handle);
+	if (! test_14e_load ("truncated index", 7, 4))
+		return axl_false;
+
+	/* corrupt index header: must fall back to directory walk */
+	handle = fopen (".myqtt-listener-test14e/.myqtt/subs.index", "r+b");
+	if (handle == NULL)
+		return axl_false;
+	fwrite ("XXXX", 1, 4, handle);
+	fclose (handle);
+	if (! test_14e_load ("corrupted index", 7, 4))
+		return axl_false;
+
+	/* index names are valid client identifiers while the
+	 * reserved directory is not */
+	ctx = init_ctx ();
+	myqtt_storage_set_path (ctx, ".myqtt-listener-test14e", 4096);
+	if (myqtt_storage_load (ctx) != 7)
+		return axl_false;
+	if (myqtt_storage_init_offline (ctx, ".myqtt", MYQTT_STORAGE_ALL)) {
+		printf ("ERROR: expected reserved storage directory to be rejected as client identifier..\n");
+		return axl_false;
+	} /* end if */
+	if (! myqtt_storage_init_offline (ctx, "subs.index", MYQTT_STORAGE_ALL) || ! test_14a_subs (ctx, "subs.index"))
+		return axl_false;
+	myqtt_exit_ctx (ctx, axl_true);
+	if (! test_14e_load ("index with subs.index client", 10, 4))
+		return axl_false;
+
+	/* same result walking directories */
+	if (system ("rm -f .myqtt-listener-test14e/.myqtt/subs.index") != 0)
+		return axl_false;
+	if (! test_14e_load ("directory walk with subs.index client", 10, 4))
+		return axl_false;
+
+	return axl_true;
+}
+
+void test_14f_on_release (MyQttCtx * ctx, MyQttConn * conn, const char * client_identifier, 
+			  int packet_id, MyQttQos qos, unsigned char * app_msg, int app_msg_size, axlPointer user_data)
+{
+	int * released = user_data;
+
+	/* expired messages are released without connection */
+	if (conn == NULL)
+		(*released) += app_msg_size;
+	return;
+}
+
+axl_bool test_14f (void) {
+	MyQttCtx        * ctx;
+	axlPointer        handle;
+	int               released = 0;
+	int               removed;
+
+	/* clean previous runs */
+	if (system ("rm -rf .myqtt-listener-test14f") != 0)
+		return axl_false;
+
+	ctx = init_ctx ();
+	myqtt_storage_set_path (ctx, ".myqtt-listener-test14f", 4096);
+	myqtt_ctx_set_on_release (ctx, test_14f_on_release, &released);
+	myqtt_storage_init_offline (ctx, "test14fclient1", MYQTT_STORAGE_ALL);
+	myqtt_storage_init_offline (ctx, "test14fclient2", MYQTT_STORAGE_ALL);
+	if (! test_14a_subs (ctx, "test14fclient1") || ! test_14a_subs (ctx, "test14fclient2"))
+		return axl_false;
+
+	/* queue two messages that will expire */
+	if (! myqtt_storage_lock_pkgid_offline (ctx, "test14fclient1", 10) || ! myqtt_storage_lock_pkgid_offline (ctx, "test14fclient1", 11))
+		return axl_false;
+	handle = myqtt_storage_store_msg_offline (ctx, "test14fclient1", 10, MYQTT_QOS_1, (unsigned char *) "This is a test", 14);
+	axl_free (handle);
+	handle = myqtt_storage_store_msg_offline (ctx, "test14fclient1", 11, MYQTT_QOS_1, (unsigned char *) "This is a test", 14);
+	axl_free (handle);
+
+	/* configure 1 second ttl, without sweeper */
+	if (! myqtt_storage_set_expiry (ctx, 1, 0, 0)) {
+		printf ("ERROR: failed to configure storage expiration..\n");
+		return axl_false;
+	} /* end if */
+	sleep (2);
+
+	/* queue a message that must survive */
+	handle = myqtt_storage_store_msg_offline (ctx, "test14fclient1", 12, MYQTT_QOS_1, (unsigned char *) "This is a test", 14);
+	axl_free (handle);
+
+	removed = myqtt_storage_expire (ctx);
+	printf ("Test 14f: removed %d expired messages (%d bytes released)..\n", removed, released);
+	if (removed != 2 || released != 28) {
+		printf ("ERROR: expected to remove 2 messages (28 bytes) but found %d (%d bytes)\n", removed, released);
+		return axl_false;
+	} /* end if */
+	if (myqtt_storage_queued_messages_offline (ctx, "test14fclient1") != 1) {
+		printf ("ERROR: expected 1 message queued but found %d\n", myqtt_storage_queued_messages_offline (ctx, "test14fclient1"));
+		return axl_false;
+	} /* end if */
+
+	/* packet id used by expired messages must be available */
+	if (! myqtt_storage_lock_pkgid_offline (ctx, "test14fclient1", 10)) {
+		printf ("ERROR: expected to lock pkgid 10 after message expiration..\n");
+		return axl_false;
+	} /* end if */
+
+	/* now expire sessions */
+	if (myqtt_storage_load (ctx) != 6) {
+		printf ("ERROR: expected to load 6 subscriptions..\n");
+		return axl_false;
+	} /* end if */
+	myqtt_storage_set_expiry (ctx, 0, 1, 0);
+	sleep (2);
+
+	released = 0;
+	removed  = myqtt_storage_expire (ctx);
+	if (removed != 1 || released != 14) {
+		printf ("ERROR: expected to release 1 message (14 bytes) on session expiration but found %d (%d bytes)\n", removed, released);
+		return axl_false;
+	} /* end if */
+
+	if (myqtt_support_file_test (".myqtt-listener-test14f/test14fclient1", FILE_EXISTS) ||
+	    myqtt_support_file_test (".myqtt-listener-test14f/test14fclient2", FILE_EXISTS)) {
+		printf ("ERROR: expected expired sessions to be removed from disk..\n");
+		return axl_false;
+	} /* end if */
+
+	if (axl_hash_items (ctx->offline_subs) != 0) {
+		printf ("ERROR: expected to find no offline subscription but found %d\n", axl_hash_items (ctx->offline_subs));
+		return axl_false;
+	} /* end if */
+
+	myqtt_exit_ctx (ctx, axl_true);
+
+	return axl_true;
+}
+
+typedef struct _Test14gData {
+	MyQttMutex   mutex;
+	int          stored;
+	int          done;
+	int          max_pending;
+	int          last;
+	int          out_of_order;
+} Test14gData;
+
+axl_bool test_14g_job (MyQttCtx * ctx, axlPointer user_data, axlPointer user_data2)
+{
+	Test14gData * data = user_data;
+	axlPointer    handle;
+	int           pending;
+
+	/* store message */
+	handle = myqtt_storage_store_msg_offline (ctx, "test14gclient1", 100000 + PTR_TO_INT (user_data2), MYQTT_QOS_0, (unsigned char *) "This is a test", 14);
+	if (handle == NULL)
+		return axl_false;
+	axl_free (handle);
+
+	/* record max operations pending */
+	pending = myqtt_storage_writer_pending (ctx);
+	myqtt_mutex_lock (&data->mutex);
+	data->stored++;
+	if (pending > data->max_pending)
+		data->max_pending = pending;
+	if (PTR_TO_INT (user_data2) != data->last + 1)
+		data->out_of_order++;
+	data->last = PTR_TO_INT (user_data2);
+	myqtt_mutex_unlock (&data->mutex);
+
+	return axl_true;
+}
+
+void test_14g_done (MyQttCtx * ctx, axl_bool status, axlPointer user_data, axlPointer user_data2)
+{
+	Test14gData * data = user_data;
+
+	myqtt_mutex_lock (&data->mutex);
+	if (status)
+		data->done++;
+	myqtt_mutex_unlock (&data->mutex);
+	return;
+}
+
+void test_14g_retained_done (MyQttCtx * ctx, axl_bool status, axlPointer user_data, axlPointer user_data2)
+{
+	test_14g_done (ctx, status, user_data, user_data2);
+	myqtt_atomic_add (&ctx->storage_writer_retained, -1);
+	return;
+}
+
+axl_bool test_14g (void) {
+	MyQttCtx        * ctx;
+	Test14gData       data;
+	int               iterator;
+
+	/* clean previous runs */
+	if (system ("rm -rf .myqtt-listener-test14g") != 0)
+		return axl_false;
+
+	ctx = init_ctx ();
+	myqtt_storage_set_path (ctx, ".myqtt-listener-test14g", 4096);
+	myqtt_storage_init_offline (ctx, "test14gclient1", MYQTT_STORAGE_ALL);
+
+	memset (&data, 0, sizeof (Test14gData));
+	myqtt_mutex_create (&data.mutex);
+	data.last = -1;
+
+	/* without writer operations are run right away */
+	myqtt_storage_writer_queue (ctx, test_14g_job, test_14g_done, &data, INT_TO_PTR (0));
+	if (data.done != 1 || myqtt_storage_queued_messages_offline (ctx, "test14gclient1") != 1) {
+		printf ("ERROR: expected operation to be run without storage writer..\n");
+		return axl_false;
+	} /* end if */
+
+	/* start writer with a small queue */
+	if (! myqtt_storage_writer_start (ctx, 4)) {
+		printf ("ERROR: failed to start storage writer..\n");
+		return axl_false;
+	} /* end if */
+
+	iterator = 1;
+	while (iterator < 100) {
+		if (! myqtt_storage_writer_queue (ctx, test_14g_job, test_14g_done, &data, INT_TO_PTR (iterator))) {
+			printf ("ERROR: failed to queue storage operation %d..\n", iterator);
 			return axl_false;
 		} /* end if */
+		iterator++;
+	} /* end while */
 
-		/* release message */
-		myqtt_msg_unref (msg);
+	/* wait all operations to finish */
+	myqtt_storage_writer_flush (ctx);
+	printf ("Test 14g: stored %d messages (max pending %d)..\n", data.stored, data.max_pending);
+	if (data.done != 100 || myqtt_storage_writer_pending (ctx) != 0) {
+		printf ("ERROR: expected 100 operations done but found %d (pending %d)\n", data.done, myqtt_storage_writer_pending (ctx));
+		return axl_false;
+	} /* end if */
 
-		/* next iterator */
+	/* queue must be bounded: limit plus the operation running */
+	if (data.max_pending > 5) {
+		printf ("ERROR: expected at most 5 operations pending but found %d\n", data.max_pending);
+		return axl_false;
+	} /* end if */
+
+	if (myqtt_storage_queued_messages_offline (ctx, "test14gclient1") != 100) {
+		printf ("ERROR: expected 100 messages queued but found %d\n", myqtt_storage_queued_messages_offline (ctx, "test14gclient1"));
+		return axl_false;
+	} /* end if */
+
+	/* waiting for tracked operations (retained messages) returns
+	 * once they are done */
+	myqtt_atomic_add (&ctx->storage_writer_retained, 1);
+	myqtt_storage_writer_queue (ctx, test_14g_job, test_14g_retained_done, &data, INT_TO_PTR (100));
+	__myqtt_storage_writer_wait (ctx, &ctx->storage_writer_retained);
+	if (data.done != 101) {
+		printf ("ERROR: expected tracked operation to be done after waiting but found %d done\n", data.done);
+		return axl_false;
+	} /* end if */
+
+	/* queue more operations: they must be run before finishing */
+	iterator = 101;
+	while (iterator < 111) {
+		myqtt_storage_writer_queue (ctx, test_14g_job, test_14g_done, &data, INT_TO_PTR (iterator));
 		iterator++;
 	} /* end while */
+	myqtt_exit_ctx (ctx, axl_true);
 
-	/* now check pending messages for test14@identifier.com */
-	if (myqtt_storage_queued_messages (ctx, conn) != 0) {
-		printf ("ERROR: expected to not find any queued message but found: %d\n", myqtt_storage_queued_messages (ctx, conn));
+	if (data.done != 111) {
+		printf ("ERROR: expected 111 operations done after finishing context but found %d\n", data.done);
 		return axl_false;
 	} /* end if */
 
-	/* close both connections */
-	myqtt_conn_close (conn2);
+	/* operations must be run in the order they were queued */
+	if (data.out_of_order != 0) {
+		printf ("ERROR: expected operations to be run in order but found %d out of order\n", data.out_of_order);
+		return axl_false;
+	} /* end if */
+	myqtt_mutex_destroy (&data.mutex);
 
+	return axl_true;
+}
 
+axl_bool test_14h_check (MyQttCtx * ctx, const char * label, int messages, long bytes)
+{
+	int  total_messages;
+	long total_bytes;
 
-	switch (wildcard) {
-	case 0:
-		/* unsubscribe */
-		if (! myqtt_conn_unsub (conn, "test/message/1", 10)) {
-			printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
-			return axl_false;
-		} /* end if */
+	myqtt_storage_usage (ctx, &total_messages, &total_bytes);
+	printf ("Test 14h: %s: %d messages, %ld bytes\n", label, total_messages, total_bytes);
+	if (total_messages != messages || total_bytes != bytes) {
+		printf ("ERROR: %s: expected %d messages (%ld bytes) but found %d (%ld bytes)\n",
+			label, messages, bytes, total_messages, total_bytes);
+		return axl_false;
+	} /* end if */
+	return axl_true;
+}
 
-		if (! myqtt_conn_unsub (conn, "test/message/2", 10)) {
-			printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
-			return axl_false;
-		} /* end if */
+axl_bool test_14h (void) {
+	MyQttCtx        * ctx;
+	axlPointer        handle;
+	int               iterator;
 
-		if (! myqtt_conn_unsub (conn, "test/message/3", 10)) {
-			printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+	/* clean previous runs */
+	if (system ("rm -rf .myqtt-listener-test14h") != 0)
+		return axl_false;
+
+	ctx = init_ctx ();
+	myqtt_storage_set_path (ctx, ".myqtt-listener-test14h", 4096);
+	myqtt_storage_init_offline (ctx, "test14hclient1", MYQTT_STORAGE_ALL);
+	myqtt_storage_init_offline (ctx, "test14hclient2", MYQTT_STORAGE_ALL);
+	if (! test_14h_check (ctx, "empty storage", 0, 0))
+		return axl_false;
+
+	/* queue 3 messages for client1 and 2 for client2 */
+	iterator = 0;
+	while (iterator < 5) {
+		handle = myqtt_storage_store_msg_offline (ctx, iterator < 3 ? "test14hclient1" : "test14hclient2",
+							  iterator + 1, MYQTT_QOS_1, (unsigned char *) "This is a test", 14);
+		if (handle == NULL) {
+			printf ("ERROR: failed to store message %d..\n", iterator);
 			return axl_false;
 		} /* end if */
+		axl_free (handle);
+		iterator++;
+	} /* end while */
 
+	if (myqtt_storage_queued_messages_offline (ctx, "test14hclient1") != 3 ||
+	    myqtt_storage_queued_messages_quota_offline (ctx, "test14hclient1") != 42 ||
+	    myqtt_storage_queued_messages_offline (ctx, "test14hclient2") != 2 ||
+	    myqtt_storage_queued_messages_quota_offline (ctx, "test14hclient2") != 28) {
+		printf ("ERROR: wrong usage reported for clients (%d, %d), (%d, %d)\n",
+			myqtt_storage_queued_messages_offline (ctx, "test14hclient1"),
+			myqtt_storage_queued_messages_quota_offline (ctx, "test14hclient1"),
+			myqtt_storage_queued_messages_offline (ctx, "test14hclient2"),
+			myqtt_storage_queued_messages_quota_offline (ctx, "test14hclient2"));
+		return axl_false;
+	} /* end if */
+	if (! test_14h_check (ctx, "after store", 5, 70))
+		return axl_false;
 
+	/* remove client2 messages */
+	myqtt_storage_clear_offline (ctx, "test14hclient2", MYQTT_STORAGE_MSGS);
+	if (myqtt_storage_queued_messages_offline (ctx, "test14hclient2") != 0 || ! test_14h_check (ctx, "after clear", 3, 42))
+		return axl_false;
+	myqtt_exit_ctx (ctx, axl_true);
 
-		break;
-	case 1:
-	case 2:
-		/* unsubscribe */
-		if (! myqtt_conn_unsub (conn, sub_topic, 10)) {
-			printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
-			return axl_false;
-		} /* end if */
-		break;
-	}
+	/* now load storage again: counters must be rebuilt */
+	ctx = init_ctx ();
+	myqtt_storage_set_path (ctx, ".myqtt-listener-test14h", 4096);
+	myqtt_storage_load (ctx);
+	if (! test_14h_check (ctx, "after load", 3, 42))
+		return axl_false;
+	if (myqtt_storage_queued_messages_quota_offline (ctx, "test14hclient1") != 42) {
+		printf ("ERROR: expected 42 bytes used by test14hclient1 after load but found %d\n",
+			myqtt_storage_queued_messages_quota_offline (ctx, "test14hclient1"));
+		return axl_false;
+	} /* end if */
+	myqtt_exit_ctx (ctx, axl_true);
 
-	myqtt_conn_close (conn);
+	/* counters must have been persisted next to the index */
+	if (! myqtt_support_file_test (".myqtt-listener-test14h/.myqtt/usage.index", FILE_EXISTS)) {
+		printf ("ERROR: expected usage counters to be persisted..\n");
+		return axl_false;
+	} /* end if */
 
-	/* release queue */
-	myqtt_async_queue_unref (queue);
-	
-	/* release context */
-	printf ("Test %s: releasing context..\n", test_label);
+	/* load again: counters are read from the file */
+	ctx = init_ctx ();
+	myqtt_storage_set_path (ctx, ".myqtt-listener-test14h", 4096);
+	myqtt_storage_load (ctx);
+	if (! test_14h_check (ctx, "after second load", 3, 42))
+		return axl_false;
+
+	/* once counters change, persisted ones are removed */
+	handle = myqtt_storage_store_msg_offline (ctx, "test14hclient1", 10, MYQTT_QOS_1, (unsigned char *) "This is a test", 14);
+	if (handle == NULL || myqtt_support_file_test (".myqtt-listener-test14h/.myqtt/usage.index", FILE_EXISTS)) {
+		printf ("ERROR: expected persisted usage counters to be removed after storing a message..\n");
+		return axl_false;
+	} /* end if */
+	axl_free (handle);
+	if (! test_14h_check (ctx, "after store on loaded storage", 4, 56))
+		return axl_false;
 	myqtt_exit_ctx (ctx, axl_true);
 
 	return axl_true;
 }
 
-axl_bool test_14 (void) {
-	return test_14_common (0);
-}
+axl_bool test_14i_retained (MyQttCtx * ctx, const char * topic, const unsigned char * payload, int payload_size)
+{
+	unsigned char * app_msg      = NULL;
+	int             app_msg_size = 0;
+	MyQttQos        qos;
 
-axl_bool test_14b (void) {
-	return test_14_common (1);
+	if (! myqtt_storage_retain_msg_set (ctx, topic, MYQTT_QOS_1, payload, payload_size)) {
+		printf ("ERROR: failed to store retained message for %s..\n", topic);
+		return axl_false;
+	} /* end if */
+	if (! myqtt_storage_retain_msg_recover (ctx, topic, &qos, &app_msg, &app_msg_size)) {
+		printf ("ERROR: failed to recover retained message for %s..\n", topic);
+		return axl_false;
+	} /* end if */
+	if (app_msg_size != payload_size || memcmp (app_msg, payload, payload_size) != 0) {
+		printf ("ERROR: retained message recovered for %s differs (%d != %d)..\n", topic, app_msg_size, payload_size);
+		axl_free (app_msg);
+		return axl_false;
+	} /* end if */
+	axl_free (app_msg);
+	return axl_true;
 }
 
-axl_bool test_14c (void) {
-	return test_14_common (2);
-}
+axl_bool test_14i (void) {
+	MyQttCtx        * ctx;
+	axlPointer        handle;
+	unsigned char     payload[2048];
+	int               iterator;
+	int               quota;
+	axl_bool          compression;
+	unsigned char   * app_msg;
+	int               app_msg_size;
+	MyQttQos          qos;
 
-axl_bool test_14a_subs (MyQttCtx * ctx, const char * client_id)
-{
-	/* store some subscriptions */
-	if (! myqtt_storage_sub_offline (ctx, client_id, "test/sub/1", MYQTT_QOS_0))
+	/* clean previous runs */
+	if (system ("rm -rf .myqtt-listener-test14i") != 0)
 		return axl_false;
-	if (! myqtt_storage_sub_offline (ctx, client_id, "test/sub/2", MYQTT_QOS_1))
+
+	/* build a payload that compresses well */
+	iterator = 0;
+	while (iterator < (int) sizeof (payload)) {
+		payload[iterator] = "{\"sensor\": \"temp\", \"value\": 21} "[iterator % 34];
+		iterator++;
+	} /* end while */
+
+	ctx = init_ctx ();
+	myqtt_storage_set_path (ctx, ".myqtt-listener-test14i", 4096);
+	compression = myqtt_storage_set_compression (ctx, MYQTT_STORAGE_COMPRESSION_LZ4, 256);
+	printf ("Test 14i: lz4 compression available: %d\n", compression);
+
+	/* queue message and check quota accounts what is stored */
+	myqtt_storage_init_offline (ctx, "test14iclient1", MYQTT_STORAGE_ALL);
+	handle = myqtt_storage_store_msg_offline (ctx, "test14iclient1", 1, MYQTT_QOS_1, payload, sizeof (payload));
+	if (handle == NULL) {
+		printf ("ERROR: failed to store message..\n");
 		return axl_false;
-	if (! myqtt_storage_sub_offline (ctx, client_id, "test/sub/3", MYQTT_QOS_2))
+	} /* end if */
+	axl_free (handle);
+	quota = myqtt_storage_queued_messages_quota_offline (ctx, "test14iclient1");
+	printf ("Test 14i: quota used by a %d bytes message: %d\n", (int) sizeof (payload), quota);
+	if ((compression && quota >= (int) sizeof (payload)) || (! compression && quota != (int) sizeof (payload))) {
+		printf ("ERROR: unexpected quota reported %d..\n", quota);
 		return axl_false;
+	} /* end if */
 
-	return axl_true; /* return ok */
+	/* retained messages: compressed, small (not compressed) and
+	 * payloads that look like an encoded one */
+	if (! test_14i_retained (ctx, "test14i/large", payload, sizeof (payload)))
+		return axl_false;
+	if (! test_14i_retained (ctx, "test14i/small", (const unsigned char *) "This is a test", 14))
+		return axl_false;
+	if (! test_14i_retained (ctx, "test14i/magic", (const unsigned char *) "\x89MQZ\x01\x00\x00\x00\x10 raw", 13))
+		return axl_false;
+
+	/* disable compression: stored payloads must be recovered
+	 * (recover removes the retained message, store it again) */
+	myqtt_storage_retain_msg_set (ctx, "test14i/large", MYQTT_QOS_1, payload, sizeof (payload));
+	myqtt_storage_set_compression (ctx, MYQTT_STORAGE_COMPRESSION_NONE, 0);
+	if (! myqtt_storage_retain_msg_recover (ctx, "test14i/large", &qos, &app_msg, &app_msg_size) ||
+	    app_msg_size != sizeof (payload) || memcmp (app_msg, payload, sizeof (payload)) != 0) {
+		printf ("ERROR: failed to recover retained message stored with compression (size %d)..\n", app_msg_size);
+		return axl_false;
+	} /* end if */
+	axl_free (app_msg);
+
+	myqtt_exit_ctx (ctx, axl_true);
+
+	return axl_true;
 }
 
-axl_bool test_14a (void) {
-	MyQttCtx        * ctx = init_ctx ();
-	int               entries;
-	axlHashCursor   * cursor;
+MyQttCtx * test_14j_ctx (void)
+{
+	MyQttCtx * ctx = init_ctx ();
 
-	/* configure path */
-	myqtt_storage_set_path (ctx, ".myqtt-listener-test14a", 4096);
+	myqtt_storage_set_path (ctx, ".myqtt-listener-test14j/shard0", 4096);
+	if (! myqtt_storage_add_path (ctx, ".myqtt-listener-test14j/shard1") ||
+	    ! myqtt_storage_add_path (ctx, ".myqtt-listener-test14j/shard2")) {
+		printf ("ERROR: failed to add storage shards..\n");
+		return NULL;
+	} /* end if */
+	return ctx;
+}
 
-	/* init storage for 5 clients */
-	myqtt_storage_init_offline (ctx, "test14aclient1", MYQTT_STORAGE_ALL);
-	myqtt_storage_init_offline (ctx, "test14aclient2", MYQTT_STORAGE_ALL);
-	myqtt_storage_init_offline (ctx, "test14aclient3", MYQTT_STORAGE_ALL);
-	myqtt_storage_init_offline (ctx, "test14aclient4", MYQTT_STORAGE_ALL);
-	myqtt_storage_init_offline (ctx, "test14aclient5", MYQTT_STORAGE_ALL);
+axl_bool test_14j (void) {
+	MyQttCtx        * ctx;
+	axlPointer        handle;
+	axlList         * topics;
+	int               iterator;
+	int               shards[3] = {0, 0, 0};
+	int               shard;
+	char            * client_id;
+	char            * path;
+	int               messages;
 
-	if (! test_14a_subs (ctx, "test14aclient1"))
+	/* clean previous runs */
+	if (system ("rm -rf .myqtt-listener-test14j") != 0)
 		return axl_false;
-	if (! test_14a_subs (ctx, "test14aclient2"))
+	if (system ("mkdir -p .myqtt-listener-test14j") != 0)
 		return axl_false;
-	if (! test_14a_subs (ctx, "test14aclient3"))
+
+	ctx = test_14j_ctx ();
+	if (ctx == NULL)
 		return axl_false;
-	if (! test_14a_subs (ctx, "test14aclient4"))
+	if (myqtt_storage_shards (ctx) != 3 || myqtt_storage_add_path (ctx, ".myqtt-listener-test14j/shard1")) {
+		printf ("ERROR: expected 3 shards and failure when adding a shard twice..\n");
 		return axl_false;
-	if (! test_14a_subs (ctx, "test14aclient5"))
+	} /* end if */
+
+	/* store a message for several client ids and retained topics */
+	iterator = 0;
+	while (iterator < 30) {
+		client_id = axl_strdup_printf ("test14jclient%d", iterator);
+		handle    = myqtt_storage_store_msg_offline (ctx, client_id, 1, MYQTT_QOS_1, (unsigned char *) "This is a test", 14);
+		if (handle == NULL) {
+			printf ("ERROR: failed to store message for %s..\n", client_id);
+			return axl_false;
+		} /* end if */
+		axl_free (handle);
+
+		/* check where it was placed */
+		shard = 0;
+		while (shard < 3) {
+			path = axl_strdup_printf (".myqtt-listener-test14j/shard%d/%s", shard, client_id);
+			if (myqtt_support_file_test (path, FILE_EXISTS | FILE_IS_DIR))
+				shards[shard]++;
+			axl_free (path);
+			shard++;
+		} /* end while */
+		axl_free (client_id);
+
+		client_id = axl_strdup_printf ("test14j/topic/%d", iterator);
+		myqtt_storage_retain_msg_set (ctx, client_id, MYQTT_QOS_0, (const unsigned char *) "This is a test", 14);
+		axl_free (client_id);
+		iterator++;
+	} /* end while */
+
+	printf ("Test 14j: sessions placed on shards: %d, %d, %d\n", shards[0], shards[1], shards[2]);
+	if (shards[0] + shards[1] + shards[2] != 30 || shards[0] == 30 || shards[1] == 30 || shards[2] == 30) {
+		printf ("ERROR: expected sessions to be spread over shards..\n");
 		return axl_false;
+	} /* end if */
 
-	/* load storage */
-	entries = myqtt_storage_load (ctx);
-	printf ("Test 14a: loaded %d subscriptions..\n", entries);
-	if (entries != 15) {
-		printf ("ERROR: expected to find 15 subscriptions but found %d\n", entries);
+	/* retained topics must be found on all shards */
+	topics = myqtt_storage_get_retained_topics (ctx, "test14j/topic/#");
+	if (topics == NULL || axl_list_length (topics) != 30) {
+		printf ("ERROR: expected 30 retained topics but found %d..\n", topics ? axl_list_length (topics) : -1);
 		return axl_false;
 	} /* end if */
+	axl_list_free (topics);
+	myqtt_exit_ctx (ctx, axl_true);
 
-	if (axl_hash_items (ctx->offline_subs) != 3) {
-		printf ("ERROR: expected to find 3 subscriptions inside offline subs..\n");
+	/* load again: all sessions must be found */
+	ctx = test_14j_ctx ();
+	if (ctx == NULL)
 		return axl_false;
-	}
+	myqtt_storage_load (ctx);
+	myqtt_storage_usage (ctx, &messages, NULL);
+	if (messages != 30) {
+		printf ("ERROR: expected 30 messages after load but found %d..\n", messages);
+		return axl_false;
+	} /* end if */
+	if (myqtt_storage_queued_messages_offline (ctx, "test14jclient7") != 1) {
+		printf ("ERROR: expected 1 message queued for test14jclient7..\n");
+		return axl_false;
+	} /* end if */
+	myqtt_exit_ctx (ctx, axl_true);
 
-	if (axl_hash_items (ctx->subs) != 0) {
-		printf ("ERROR: expected to find 0 subscriptions inside online subs..\n");
+	return axl_true;
+}
+
+int test_14k_retained_topics (const char * topic_filter)
+{
+	MyQttCtx        * ctx;
+	axlList         * topics;
+	int               count;
+
+	/* check what is written on disk with another context */
+	ctx = init_ctx ();
+	myqtt_storage_set_path (ctx, ".myqtt-listener-test14k", 4096);
+	topics = myqtt_storage_get_retained_topics (ctx, topic_filter);
+	count  = topics ? axl_list_length (topics) : 0;
+	axl_list_free (topics);
+	myqtt_exit_ctx (ctx, axl_true);
+
+	return count;
+}
+
+axl_bool test_14k (void) {
+	MyQttCtx        * ctx;
+	axlList         * topics;
+	char            * payload;
+	int               iterator;
+	unsigned char   * app_msg;
+	int               app_msg_size;
+	MyQttQos          qos;
+
+	/* clean previous runs */
+	if (system ("rm -rf .myqtt-listener-test14k") != 0)
 		return axl_false;
-	}
 
-	/* iterarate hashes */
-	cursor = axl_hash_cursor_new (ctx->offline_subs);
-	while (axl_hash_cursor_has_item (cursor)) {
+	ctx = init_ctx ();
+	myqtt_storage_set_path (ctx, ".myqtt-listener-test14k", 4096);
+	if (! myqtt_storage_set_retain_write_behind (ctx, 0)) {
+		printf ("ERROR: failed to enable retained write-behind..\n");
+		return axl_false;
+	} /* end if */
 
-		if (axl_cmp (axl_hash_cursor_get_key (cursor), "test/sub/1")) {
-			if (axl_hash_items (axl_hash_cursor_get_value (cursor)) != 5) {
-				printf ("Expected to find 5 items inside hash directed by subscription: %s but found (%d)\n", 
-					(char *) axl_hash_cursor_get_key (cursor), axl_hash_items (axl_hash_cursor_get_value (cursor)));
-				return axl_false;
-			}
-		} else if (axl_cmp (axl_hash_cursor_get_key (cursor), "test/sub/2")) {
-			if (axl_hash_items (axl_hash_cursor_get_value (cursor)) != 5) {
-				printf ("Expected to find 5 items inside hash directed by subscription: %s but found (%d)\n", 
-					(char *) axl_hash_cursor_get_key (cursor), axl_hash_items (axl_hash_cursor_get_value (cursor)));
-				return axl_false;
-			}
-			
-		} else if (axl_cmp (axl_hash_cursor_get_key (cursor), "test/sub/3")) {
-			if (axl_hash_items (axl_hash_cursor_get_value (cursor)) != 5) {
-				printf ("Expected to find 5 items inside hash directed by subscription: %s but found (%d)\n", 
-					(char *) axl_hash_cursor_get_key (cursor), axl_hash_items (axl_hash_cursor_get_value (cursor)));
-				return axl_false;
-			}
-			
-		} else {
-			printf ("ERROR: unexpected subscription found: %s\n", (char *) axl_hash_cursor_get_key (cursor));
+	/* update the same retained topic many times */
+	iterator = 0;
+	while (iterator < 100) {
+		payload = axl_strdup_printf ("value %d", iterator);
+		if (! myqtt_storage_retain_msg_set (ctx, "test14k/hot", MYQTT_QOS_1, (const unsigned char *) payload, strlen (payload))) {
+			printf ("ERROR: failed to set retained message..\n");
 			return axl_false;
-		}
+		} /* end if */
+		axl_free (payload);
+		iterator++;
+	} /* end while */
+	myqtt_storage_retain_msg_set (ctx, "test14k/released", MYQTT_QOS_0, (const unsigned char *) "gone", 4);
+	myqtt_storage_retain_msg_release (ctx, "test14k/released");
+
+	/* nothing written yet but topics are reported */
+	if (test_14k_retained_topics ("test14k/#") != 0) {
+		printf ("ERROR: expected no retained topic on disk before flush..\n");
+		return axl_false;
+	} /* end if */
+	topics = myqtt_storage_get_retained_topics (ctx, "test14k/#");
+	if (topics == NULL || axl_list_length (topics) != 1 || ! axl_cmp (axl_list_get_nth (topics, 0), "test14k/hot")) {
+		printf ("ERROR: expected test14k/hot as the only retained topic..\n");
+		return axl_false;
+	} /* end if */
+	axl_list_free (topics);
 
+	/* flush: only changed topics are written */
+	if (myqtt_storage_retain_flush (ctx) != 2) {
+		printf ("ERROR: expected 2 topics flushed..\n");
+		return axl_false;
+	} /* end if */
+	if (myqtt_storage_retain_flush (ctx) != 0) {
+		printf ("ERROR: expected nothing to flush..\n");
+		return axl_false;
+	} /* end if */
+	if (test_14k_retained_topics ("test14k/#") != 1) {
+		printf ("ERROR: expected 1 retained topic on disk after flush..\n");
+		return axl_false;
+	} /* end if */
 
-		/* next hash cursor */
-		axl_hash_cursor_next (cursor);
+	/* last value must be the one stored */
+	if (! myqtt_storage_retain_msg_recover (ctx, "test14k/hot", &qos, &app_msg, &app_msg_size)) {
+		printf ("ERROR: failed to recover retained message..\n");
+		return axl_false;
+	} /* end if */
+	if (app_msg_size != 8 || memcmp (app_msg, "value 99", 8) != 0 || qos != MYQTT_QOS_1) {
+		printf ("ERROR: expected last retained value but found %d bytes..\n", app_msg_size);
+		axl_free (app_msg);
+		return axl_false;
+	} /* end if */
+	axl_free (app_msg);
+
+	/* topics on disk released in memory are not reported */
+	myqtt_storage_retain_msg_set (ctx, "test14k/disk/a", MYQTT_QOS_1, (const unsigned char *) "a", 1);
+	myqtt_storage_retain_msg_set (ctx, "test14k/disk/b", MYQTT_QOS_1, (const unsigned char *) "b", 1);
+	if (myqtt_storage_retain_flush (ctx) != 2) {
+		printf ("ERROR: expected 2 topics flushed..\n");
+		return axl_false;
 	} /* end if */
-	axl_hash_cursor_free (cursor);
+	myqtt_storage_retain_msg_release (ctx, "test14k/disk/a");
+	topics = myqtt_storage_get_retained_topics (ctx, "test14k/disk/#");
+	if (topics == NULL || axl_list_length (topics) != 1 || ! axl_cmp (axl_list_get_nth (topics, 0), "test14k/disk/b")) {
+		printf ("ERROR: expected test14k/disk/b as the only retained topic (found %d)..\n", topics ? axl_list_length (topics) : -1);
+		return axl_false;
+	} /* end if */
+	axl_list_free (topics);
 
-	/* release context */
-	printf ("Test 14a: releasing context..\n");
+	/* pending values are written at exit */
+	myqtt_storage_retain_msg_set (ctx, "test14k/shutdown", MYQTT_QOS_0, (const unsigned char *) "bye", 3);
 	myqtt_exit_ctx (ctx, axl_true);
-	
+	if (test_14k_retained_topics ("test14k/shutdown") != 1) {
+		printf ("ERROR: expected retained topic to be written at exit..\n");
+		return axl_false;
+	} /* end if */
+
 	return axl_true;
 }
+
 axl_bool __test_15_check (MyQttMsg * msg, int * count_qos0, int * count_qos1, int * count_qos2)
 {
 	if (msg == NULL || myqtt_msg_get_type (msg) != MYQTT_PUBLISH) {
@@ -3167,7 +4679,7 @@ axl_bool test_17c_common (const char * label, const char * topic, const char * m
 
 	/* close connection and release message */
 	printf ("Test %s: closing connnection=%p, conn-id=%d (peer-wait-replies=%d, wait-replies=%d) \n",
-		label, conn, myqtt_conn_get_id (conn), axl_hash_items (conn->peer_wait_replies), axl_hash_items (conn->wait_replies));
+		label, conn, myqtt_conn_get_id (conn), __myqtt_conn_hash_items (conn->peer_wait_replies), __myqtt_conn_hash_items (conn->wait_replies));
 	myqtt_conn_close (conn);
 
 	/* release queue */
@@ -4818,111 +6330,1025 @@ axl_bool test_00_d (void)
 
 	match_topic ("a/b/c/d", "b/+/c/d", axl_false);
 
-	match_topic ("a/b/c/d", "+/+/+", axl_false);
+	match_topic ("a/b/c/d", "+/+/+", axl_false);
+
+
+	/* set 4 */
+	match_topic ("a/b/c/d", "#", axl_true);
+
+	match_topic ("a/b/c/d", "a/#", axl_true);
+
+	match_topic ("a/b/c/d", "a/b/#", axl_true);
+
+	match_topic ("a/b/c/d", "a/b/c/#", axl_true);
+
+	match_topic ("a/b/c/d", "+/b/c/#", axl_true);
+
+	
+
+	/* set 5 */
+	match_topic ("a//topic", "a/+/topic", axl_true);
+
+	match_topic ("a//topic", "a/+/topic", axl_true);
+
+	match_topic ("/a/topic", "+/a/topic", axl_true);
+
+	match_topic ("/a/topic", "#", axl_true);
+
+	match_topic ("/a/topic", "/#", axl_true);
+
+	match_topic ("value/a/topic", "/#", axl_false);
+
+
+	/* set  6 */
+
+	match_topic ("a/topic/", "a/topic/+", axl_true);
+
+	match_topic ("a/topic/", "a/topic/#", axl_true);
+
+
+	
+	/* set 7 */
+
+	match_topic ("sport/tennis/player1", "sport/tennis/player1/#", axl_true);
+
+	match_topic ("sport/tennis/player1/ranking", "sport/tennis/player1/#", axl_true);
+
+	match_topic ("sport/tennis/player1/score/wimbledon", "sport/tennis/player1/#", axl_true);
+
+
+	/* set 8 */
+
+	match_topic ("sport", "sport/#", axl_true);
+
+
+	/* set 9 */
+
+	match_topic ("sport/tennis/player1", "sport/tennis/+", axl_true);
+
+	match_topic ("sport/tennis/player2", "sport/tennis/+", axl_true);
+
+	match_topic ("sport/tennis/player1/ranking", "sport/tennis/+", axl_false);
+
+	
+	/* set 10 */
+
+	match_topic ("sport", "sport/+", axl_false);
+
+	match_topic ("sport/", "sport/+", axl_true);
+
+
+	/* set 11 */
+
+
+	match_topic ("/finance", "+/+", axl_true);
+
+	match_topic ("/finance", "/+", axl_true);
+
+	match_topic ("/finance", "+", axl_false);
+
+
+	/* set 12 */
+
+	match_topic ("$SYS", "#", axl_false);
+
+	match_topic ("$SYS", "+", axl_false);
+
+	match_topic ("$SYS/monitor/Clients", "+/monitor/Clients", axl_false);
+
+	match_topic ("$SYS/", "$SYS/#", axl_true);
+
+	match_topic ("$SYS/monitor/Clients", "$SYS/monitor/+", axl_true);
+
+
+	/* set 13 */
+
+	match_topic ("ACCOUNTS", "Accounts", axl_false);
+
+	match_topic ("finance", "/finance", axl_false);
+
+
+	/* not valid subscriptions */
+	
+	wrong_sub ("sport/tennis#", axl_true);
+
+	wrong_sub ("sport/tennis/#/ranking", axl_true);
+
+	wrong_sub ("sport+", axl_true);
+
+	return axl_true;
+}
+
+axl_bool test_00_e_compare (const char * label, unsigned char * built, int built_size, unsigned char * encoded, int encoded_size)
+{
+	if (built == NULL || built_size != encoded_size || memcmp (built, encoded, built_size) != 0) {
+		printf ("ERROR: encoder output for %s differs from myqtt_msg_build (built size=%d, encoded size=%d)\n", 
+			label, built_size, encoded_size);
+		return axl_false;
+	} /* end if */
+
+	printf ("Test 00-e: %s encoded ok (%d bytes)\n", label, encoded_size);
+	return axl_true;
+}
+
+axl_bool test_00_e (void)
+{
+	MyQttCtx       * ctx = myqtt_ctx_new ();
+	unsigned char  * built;
+	int              built_size;
+	unsigned char    buffer[512];
+	int              size;
+	unsigned char    codes[3] = {0, 1, 0x80};
+	unsigned char    suback[7] = {0x90, 5, 0x12, 0x34, 0, 1, 0x80};
+	const char     * topic = "myqtt/test/00-e";
+	const char     * app_msg = "This is a test message";
+	int              iterator;
+	struct timeval   start;
+	struct timeval   stop;
+	struct timeval   diff;
+
+	/* PUBLISH qos 0 */
+	built = myqtt_msg_build (ctx, MYQTT_PUBLISH, axl_false, 0, axl_true, &built_size,
+				 MYQTT_PARAM_UTF8_STRING, strlen (topic), topic,
+				 MYQTT_PARAM_BINARY_PAYLOAD, strlen (app_msg), app_msg,
+				 MYQTT_PARAM_END);
+	size = myqtt_msg_encode_publish (ctx, buffer, sizeof (buffer), axl_false, MYQTT_QOS_0, axl_true, 0,
+					 topic, strlen (topic), (const unsigned char *) app_msg, strlen (app_msg));
+	if (! test_00_e_compare ("PUBLISH qos=0", built, built_size, buffer, size))
+		return axl_false;
+	myqtt_msg_free_build (ctx, built, built_size);
+
+	/* PUBLISH qos 1 (check single allocation builder too) */
+	built = myqtt_msg_build (ctx, MYQTT_PUBLISH, axl_false, 1, axl_false, &built_size,
+				 MYQTT_PARAM_UTF8_STRING, strlen (topic), topic,
+				 MYQTT_PARAM_16BIT_INT, 4321,
+				 MYQTT_PARAM_BINARY_PAYLOAD, strlen (app_msg), app_msg,
+				 MYQTT_PARAM_END);
+	size = myqtt_msg_encode_publish (ctx, buffer, sizeof (buffer), axl_false, MYQTT_QOS_1, axl_false, 4321,
+					 topic, strlen (topic), (const unsigned char *) app_msg, strlen (app_msg));
+	if (! test_00_e_compare ("PUBLISH qos=1", built, built_size, buffer, size))
+		return axl_false;
+	myqtt_msg_free_build (ctx, built, built_size);
+
+	built = myqtt_msg_build_publish (ctx, axl_false, MYQTT_QOS_1, axl_false, 4321, topic, 
+					 (const unsigned char *) app_msg, strlen (app_msg), &built_size);
+	if (! test_00_e_compare ("PUBLISH qos=1 (build_publish)", built, built_size, buffer, size))
+		return axl_false;
+	myqtt_msg_free_build (ctx, built, built_size);
+
+	/* check encoder reports required size and refuses short buffers */
+	if (myqtt_msg_encode_publish (ctx, NULL, 0, axl_false, MYQTT_QOS_1, axl_false, 4321,
+				      topic, strlen (topic), (const unsigned char *) app_msg, strlen (app_msg)) != size) {
+		printf ("ERROR: expected encode_publish to report %d bytes required\n", size);
+		return axl_false;
+	} /* end if */
+	if (myqtt_msg_encode_publish (ctx, buffer, size - 1, axl_false, MYQTT_QOS_1, axl_false, 4321,
+				      topic, strlen (topic), (const unsigned char *) app_msg, strlen (app_msg)) != -1) {
+		printf ("ERROR: expected encode_publish to fail with a short buffer\n");
+		return axl_false;
+	} /* end if */
+
+	/* PUBACK */
+	built = myqtt_msg_build (ctx, MYQTT_PUBACK, axl_false, 0, axl_false, &built_size,
+				 MYQTT_PARAM_16BIT_INT, 4321,
+				 MYQTT_PARAM_END);
+	size = myqtt_msg_encode_ack (ctx, buffer, sizeof (buffer), MYQTT_PUBACK, 4321);
+	if (! test_00_e_compare ("PUBACK", built, built_size, buffer, size))
+		return axl_false;
+	myqtt_msg_free_build (ctx, built, built_size);
+
+	/* PUBREL (reserved flags 0x2) */
+	built = myqtt_msg_build (ctx, MYQTT_PUBREL, axl_false, MYQTT_QOS_1, axl_false, &built_size,
+				 MYQTT_PARAM_16BIT_INT, 4321,
+				 MYQTT_PARAM_END);
+	size = myqtt_msg_encode_ack (ctx, buffer, sizeof (buffer), MYQTT_PUBREL, 4321);
+	if (! test_00_e_compare ("PUBREL", built, built_size, buffer, size))
+		return axl_false;
+	myqtt_msg_free_build (ctx, built, built_size);
+
+	/* CONNACK */
+	built = myqtt_msg_build (ctx, MYQTT_CONNACK, axl_false, 0, axl_false, &built_size,
+				 MYQTT_PARAM_16BIT_INT, 5,
+				 MYQTT_PARAM_END);
+	size = myqtt_msg_encode_connack (ctx, buffer, sizeof (buffer), axl_false, 5);
+	if (! test_00_e_compare ("CONNACK", built, built_size, buffer, size))
+		return axl_false;
+	myqtt_msg_free_build (ctx, built, built_size);
+
+	/* PINGRESP */
+	built = myqtt_msg_build (ctx, MYQTT_PINGRESP, axl_false, 0, axl_false, &built_size,
+				 MYQTT_PARAM_END);
+	size = myqtt_msg_encode_pingresp (ctx, buffer, sizeof (buffer));
+	if (! test_00_e_compare ("PINGRESP", built, built_size, buffer, size))
+		return axl_false;
+	myqtt_msg_free_build (ctx, built, built_size);
+
+	/* SUBACK */
+	size = myqtt_msg_encode_suback (ctx, buffer, sizeof (buffer), 0x1234, codes, 3);
+	if (! test_00_e_compare ("SUBACK", suback, sizeof (suback), buffer, size))
+		return axl_false;
+
+	/* microbenchmark: generic builder */
+	gettimeofday (&start, NULL);
+	iterator = 0;
+	while (iterator < 200000) {
+		built = myqtt_msg_build (ctx, MYQTT_PUBLISH, axl_false, 1, axl_false, &built_size,
+					 MYQTT_PARAM_UTF8_STRING, strlen (topic), topic,
+					 MYQTT_PARAM_16BIT_INT, 4321,
+					 MYQTT_PARAM_BINARY_PAYLOAD, strlen (app_msg), app_msg,
+					 MYQTT_PARAM_END);
+		myqtt_msg_free_build (ctx, built, built_size);
+		built = myqtt_msg_build (ctx, MYQTT_PUBACK, axl_false, 0, axl_false, &built_size,
+					 MYQTT_PARAM_16BIT_INT, 4321,
+					 MYQTT_PARAM_END);
+		myqtt_msg_free_build (ctx, built, built_size);
+		iterator++;
+	} /* end while */
+	gettimeofday (&stop, NULL);
+	myqtt_timeval_substract (&stop, &start, &diff);
+	printf ("Test 00-e: myqtt_msg_build PUBLISH+PUBACK x 200000 took %ld.%06ld secs\n", (long) diff.tv_sec, (long) diff.tv_usec);
+
+	/* microbenchmark: single pass encoders */
+	gettimeofday (&start, NULL);
+	iterator = 0;
+	while (iterator < 200000) {
+		myqtt_msg_encode_publish (ctx, buffer, sizeof (buffer), axl_false, MYQTT_QOS_1, axl_false, 4321,
+					  topic, strlen (topic), (const unsigned char *) app_msg, strlen (app_msg));
+		myqtt_msg_encode_ack (ctx, buffer, sizeof (buffer), MYQTT_PUBACK, 4321);
+		iterator++;
+	} /* end while */
+	gettimeofday (&stop, NULL);
+	myqtt_timeval_substract (&stop, &start, &diff);
+	printf ("Test 00-e: myqtt_msg_encode_* PUBLISH+PUBACK x 200000 took %ld.%06ld secs\n", (long) diff.tv_sec, (long) diff.tv_usec);
+
+	myqtt_ctx_free (ctx);
+	return axl_true;
+}
+
+axl_bool test_00_f (void)
+{
+	MyQttCtx  * ctx = myqtt_ctx_new ();
+	char      * topic;
+	char      * topic2;
+	char        buffer[64];
+	axlHash   * hash;
+	int         iterator;
+
+	/* same string, same reference */
+	topic  = myqtt_support_intern (ctx, "sensors/+/temperature");
+	snprintf (buffer, sizeof (buffer), "sensors/+/%s", "temperature");
+	topic2 = myqtt_support_intern (ctx, buffer);
+	if (topic == NULL || topic != topic2 || ! axl_cmp (topic, "sensors/+/temperature")) {
+		printf ("ERROR: expected to find same interned reference (%p != %p)\n", topic, topic2);
+		return axl_false;
+	} /* end if */
+
+	if (myqtt_support_intern_count (ctx) != 1) {
+		printf ("ERROR: expected 1 interned string but found %d\n", myqtt_support_intern_count (ctx));
+		return axl_false;
+	} /* end if */
+
+	/* use them as hash keys like subscription tables do */
+	hash     = axl_hash_new (axl_hash_string, axl_hash_equal_string);
+	iterator = 0;
+	while (iterator < 1000) {
+		snprintf (buffer, sizeof (buffer), "myqtt/test/%d", iterator % 10);
+		axl_hash_insert_full (hash, myqtt_support_intern (ctx, buffer), myqtt_support_intern_release, INT_TO_PTR (iterator), NULL);
+		iterator++;
+	} /* end while */
+
+	if (axl_hash_items (hash) != 10 || myqtt_support_intern_count (ctx) != 11) {
+		printf ("ERROR: expected 10 items in hash (found %d) and 11 interned strings (found %d)\n", 
+			axl_hash_items (hash), myqtt_support_intern_count (ctx));
+		return axl_false;
+	} /* end if */
+
+	/* releasing the hash must release all keys */
+	axl_hash_free (hash);
+	myqtt_support_intern_release (topic);
+	if (myqtt_support_intern_count (ctx) != 1) {
+		printf ("ERROR: expected 1 interned string after releasing hash but found %d\n", myqtt_support_intern_count (ctx));
+		return axl_false;
+	} /* end if */
+
+	myqtt_support_intern_release (topic2);
+	if (myqtt_support_intern_count (ctx) != 0) {
+		printf ("ERROR: expected intern table to be empty but found %d\n", myqtt_support_intern_count (ctx));
+		return axl_false;
+	} /* end if */
+
+	myqtt_ctx_free (ctx);
+	return axl_true;
+}
+
+#define TEST_00_G_ROOTS    5000
+#define TEST_00_G_CHILDREN 3
+#define TEST_00_G_TASKS    (TEST_00_G_ROOTS * (TEST_00_G_CHILDREN + 1))
+
+typedef struct _Test00gTask {
+	MyQttCtx       * ctx;
+	struct timeval   queued;
+	long             latency;
+} Test00gTask;
+
+Test00gTask    test_00_g_tasks[TEST_00_G_TASKS];
+int            test_00_g_next;
+int            test_00_g_done;
+
+axlPointer test_00_g_task (axlPointer _task)
+{
+	Test00gTask    * task = _task;
+	Test00gTask    * child;
+	struct timeval   now;
+	struct timeval   diff;
+	int              iterator;
+
+	gettimeofday (&now, NULL);
+	myqtt_timeval_substract (&now, &task->queued, &diff);
+	task->latency = diff.tv_sec * 1000000 + diff.tv_usec;
+
+	/* root tasks fan out like a publish delivered to several subscribers */
+	iterator = 0;
+	while (task < test_00_g_tasks + TEST_00_G_ROOTS && iterator < TEST_00_G_CHILDREN) {
+		child      = &test_00_g_tasks[myqtt_atomic_add (&test_00_g_next, 1) - 1];
+		child->ctx = task->ctx;
+		gettimeofday (&child->queued, NULL);
+		myqtt_thread_pool_new_task (task->ctx, test_00_g_task, child);
+		iterator++;
+	} /* end while */
+
+	myqtt_atomic_add (&test_00_g_done, 1);
+	return NULL;
+}
+
+int test_00_g_cmp (const void * a, const void * b)
+{
+	long la = *((const long *) a);
+	long lb = *((const long *) b);
+
+	return (la > lb) - (la < lb);
+}
+
+axl_bool test_00_g_run (axl_bool work_stealing, int threads)
+{
+	MyQttCtx       * ctx = myqtt_ctx_new ();
+	long           * latencies;
+	struct timeval   start;
+	struct timeval   stop;
+	struct timeval   diff;
+	long             elapsed;
+	int              iterator;
+
+	myqtt_thread_pool_set_num (threads);
+	myqtt_thread_pool_set_work_stealing (ctx, work_stealing);
+	if (! myqtt_init_ctx (ctx)) {
+		printf ("ERROR: unable to initialize context..\n");
+		return axl_false;
+	} /* end if */
+
+	memset (test_00_g_tasks, 0, sizeof (test_00_g_tasks));
+	test_00_g_next = TEST_00_G_ROOTS;
+	test_00_g_done = 0;
+
+	gettimeofday (&start, NULL);
+	iterator = 0;
+	while (iterator < TEST_00_G_ROOTS) {
+		test_00_g_tasks[iterator].ctx = ctx;
+		gettimeofday (&test_00_g_tasks[iterator].queued, NULL);
+		myqtt_thread_pool_new_task (ctx, test_00_g_task, &test_00_g_tasks[iterator]);
+		iterator++;
+	} /* end while */
+
+	/* wait for all tasks (up to 30 seconds) */
+	iterator = 0;
+	while (myqtt_atomic_get (&test_00_g_done) < TEST_00_G_TASKS && iterator < 30000) {
+		myqtt_sleep (1000);
+		iterator++;
+	} /* end while */
+	gettimeofday (&stop, NULL);
+
+	if (myqtt_atomic_get (&test_00_g_done) != TEST_00_G_TASKS) {
+		printf ("ERROR: expected %d tasks to be executed but found %d (%s, threads=%d)\n",
+			TEST_00_G_TASKS, myqtt_atomic_get (&test_00_g_done), work_stealing ? "work-stealing" : "shared", threads);
+		return axl_false;
+	} /* end if */
+
+	myqtt_timeval_substract (&stop, &start, &diff);
+	elapsed = diff.tv_sec * 1000000 + diff.tv_usec;
+	if (elapsed <= 0)
+		elapsed = 1;
+
+	latencies = axl_new (long, TEST_00_G_TASKS);
+	iterator  = 0;
+	while (iterator < TEST_00_G_TASKS) {
+		latencies[iterator] = test_00_g_tasks[iterator].latency;
+		iterator++;
+	} /* end while */
+	qsort (latencies, TEST_00_G_TASKS, sizeof (long), test_00_g_cmp);
+
+	printf ("Test 00-g: %-13s threads=%-2d %8ld tasks/s  p50=%ldus p99=%ldus p99.9=%ldus\n",
+		work_stealing ? "work-stealing" : "shared", threads,
+		(long) (((double) TEST_00_G_TASKS * 1000000) / elapsed),
+		latencies[TEST_00_G_TASKS / 2], latencies[(TEST_00_G_TASKS * 99) / 100], latencies[(TEST_00_G_TASKS * 999) / 1000]);
+	axl_free (latencies);
+
+	myqtt_exit_ctx (ctx, axl_true);
+	return axl_true;
+}
+
+axl_bool test_00_g (void)
+{
+	int    threads[] = {1, 2, 4, 8, 16};
+	int    iterator;
+	char * previous = getenv ("MYQTT_THREADS") ? axl_strdup (getenv ("MYQTT_THREADS")) : NULL;
+
+	/* benchmark: task throughput and queueing latency, shared
+	 * queue pool vs work-stealing pool */
+	iterator = 0;
+	while (iterator < 5) {
+		if (! test_00_g_run (axl_false, threads[iterator]))
+			return axl_false;
+		if (! test_00_g_run (axl_true, threads[iterator]))
+			return axl_false;
+		iterator++;
+	} /* end while */
+
+	/* restore thread number */
+	if (previous)
+		myqtt_support_setenv ("MYQTT_THREADS", previous);
+	else
+		myqtt_support_unsetenv ("MYQTT_THREADS");
+	axl_free (previous);
+
+	return axl_true;
+}
+
+axl_bool test_00_h_once (MyQttCtx * ctx, axlPointer queue, axlPointer id)
+{
+	/* notify and remove */
+	myqtt_async_queue_push (queue, id);
+	return axl_true;
+}
+
+axl_bool test_00_h_periodic (MyQttCtx * ctx, axlPointer count, axlPointer data2)
+{
+	/* keep it installed */
+	myqtt_atomic_add ((int *) count, 1);
+	return axl_false;
+}
+
+axl_bool test_00_h (void)
+{
+	MyQttCtx        * ctx = init_ctx ();
+	MyQttAsyncQueue * queue;
+	int               count = 0;
+	int               periodic;
+	int               ids[100];
+	int               events;
+	int               iterator;
+	struct timeval    start;
+	struct timeval    stop;
+	struct timeval    diff;
+
+	if (! ctx)
+		return axl_false;
+	queue = myqtt_async_queue_new ();
+
+	/* far events, removed before they fire */
+	iterator = 0;
+	while (iterator < 100) {
+		ids[iterator] = myqtt_thread_pool_new_event (ctx, 10000000 + iterator * 1000, test_00_h_once, queue, INT_TO_PTR (100));
+		iterator++;
+	} /* end while */
+
+	/* one shot events installed out of order */
+	gettimeofday (&start, NULL);
+	myqtt_thread_pool_new_event (ctx, 300000, test_00_h_once, queue, INT_TO_PTR (3));
+	myqtt_thread_pool_new_event (ctx, 100000, test_00_h_once, queue, INT_TO_PTR (1));
+	myqtt_thread_pool_new_event (ctx, 200000, test_00_h_once, queue, INT_TO_PTR (2));
+	periodic = myqtt_thread_pool_new_event (ctx, 10000, test_00_h_periodic, &count, NULL);
+
+	myqtt_thread_pool_event_stats (ctx, &events);
+	if (events != 104) {
+		printf ("ERROR: expected 104 events installed but found %d\n", events);
+		return axl_false;
+	} /* end if */
+
+	/* events must fire by deadline order */
+	iterator = 1;
+	while (iterator <= 3) {
+		if (PTR_TO_INT (myqtt_async_queue_timedpop (queue, 2000000)) != iterator) {
+			printf ("ERROR: expected event %d to fire\n", iterator);
+			return axl_false;
+		} /* end if */
 
+		/* check it fired close to its deadline */
+		gettimeofday (&stop, NULL);
+		myqtt_timeval_substract (&stop, &start, &diff);
+		printf ("Test 00-h: event %d (delay %dms) fired after %ldms\n", iterator, iterator * 100, 
+			(long) (diff.tv_sec * 1000 + diff.tv_usec / 1000));
+		if ((diff.tv_sec * 1000000 + diff.tv_usec) < iterator * 100000 || (diff.tv_sec * 1000000 + diff.tv_usec) > iterator * 100000 + 90000) {
+			printf ("ERROR: event %d fired out of its deadline\n", iterator);
+			return axl_false;
+		} /* end if */
+		iterator++;
+	} /* end while */
 
-	/* set 4 */
-	match_topic ("a/b/c/d", "#", axl_true);
+	if (myqtt_atomic_get (&count) < 15) {
+		printf ("ERROR: expected periodic event (10ms) to fire at least 15 times in 300ms but found %d\n", myqtt_atomic_get (&count));
+		return axl_false;
+	} /* end if */
 
-	match_topic ("a/b/c/d", "a/#", axl_true);
+	/* remove far events and the periodic one */
+	iterator = 0;
+	while (iterator < 100) {
+		if (! myqtt_thread_pool_remove_event (ctx, ids[iterator])) {
+			printf ("ERROR: failed to remove event %d\n", iterator);
+			return axl_false;
+		} /* end if */
+		iterator++;
+	} /* end while */
+	if (! myqtt_thread_pool_remove_event (ctx, periodic) || myqtt_thread_pool_remove_event (ctx, periodic)) {
+		printf ("ERROR: expected to remove periodic event only once\n");
+		return axl_false;
+	} /* end if */
 
-	match_topic ("a/b/c/d", "a/b/#", axl_true);
+	myqtt_thread_pool_event_stats (ctx, &events);
+	if (events != 0 || myqtt_async_queue_items (queue) != 0) {
+		printf ("ERROR: expected no events installed (found %d) nor fired (found %d)\n", events, myqtt_async_queue_items (queue));
+		return axl_false;
+	} /* end if */
 
-	match_topic ("a/b/c/d", "a/b/c/#", axl_true);
+	myqtt_async_queue_unref (queue);
+	myqtt_exit_ctx (ctx, axl_true);
+	return axl_true;
+}
 
-	match_topic ("a/b/c/d", "+/b/c/#", axl_true);
+#if defined(__linux__)
+axlPointer test_00_i_task (axlPointer _queue)
+{
+	MyQttAsyncQueue * queue = _queue;
+	cpu_set_t       * set   = axl_new (cpu_set_t, 1);
+
+	/* report affinity of the pool thread running the task */
+	if (pthread_getaffinity_np (pthread_self (), sizeof (cpu_set_t), set) != 0)
+		CPU_ZERO (set);
+	myqtt_async_queue_push (queue, set);
+	return NULL;
+}
 
-	
+axl_bool test_00_i_check (MyQttCtx * ctx, MyQttAsyncQueue * queue, cpu_set_t * expected, const char * label)
+{
+	cpu_set_t * set;
+	int         tries = 0;
+
+	/* running threads apply changes on their next loop */
+	while (tries < 50) {
+		myqtt_thread_pool_new_task (ctx, test_00_i_task, queue);
+		set = myqtt_async_queue_timedpop (queue, 5000000);
+		if (set && CPU_EQUAL (set, expected)) {
+			axl_free (set);
+			return axl_true;
+		} /* end if */
+		axl_free (set);
+		myqtt_sleep (20000);
+		tries++;
+	} /* end while */
 
-	/* set 5 */
-	match_topic ("a//topic", "a/+/topic", axl_true);
+	printf ("ERROR: pool thread affinity does not match %s\n", label);
+	return axl_false;
+}
+#endif
 
-	match_topic ("a//topic", "a/+/topic", axl_true);
+axl_bool test_00_i (void)
+{
+	MyQttCtx        * ctx;
+	const char      * wrong[] = {"a", "1-", "3-1", "0,,x", "1;2", "99999", NULL};
+	char            * cpus;
+	int               iterator;
+#if defined(__linux__)
+	MyQttAsyncQueue * queue;
+	cpu_set_t         startup;
+	cpu_set_t         pinned;
 
-	match_topic ("/a/topic", "+/a/topic", axl_true);
+	/* affinity found before creating the context */
+	if (pthread_getaffinity_np (pthread_self (), sizeof (cpu_set_t), &startup) != 0) {
+		printf ("ERROR: unable to get current affinity\n");
+		return axl_false;
+	} /* end if */
+#endif
 
-	match_topic ("/a/topic", "#", axl_true);
+	ctx = myqtt_ctx_new ();
 
-	match_topic ("/a/topic", "/#", axl_true);
+	/* wrong cpu lists are rejected */
+	iterator = 0;
+	while (wrong[iterator]) {
+		if (myqtt_thread_set_cpus (ctx, MYQTT_THREAD_POOL, wrong[iterator]) || (cpus = myqtt_thread_get_cpus (ctx, MYQTT_THREAD_POOL)) != NULL) {
+			printf ("ERROR: expected cpu list '%s' to be rejected\n", wrong[iterator]);
+			return axl_false;
+		} /* end if */
+		iterator++;
+	} /* end while */
 
-	match_topic ("value/a/topic", "/#", axl_false);
+#if defined(__linux__)
+	/* pin every thread class to cpu 0 before starting the context */
+	if (! myqtt_thread_set_cpus (ctx, MYQTT_THREAD_READER, "0") ||
+	    ! myqtt_thread_set_cpus (ctx, MYQTT_THREAD_SEQUENCER, "0") ||
+	    ! myqtt_thread_set_cpus (ctx, MYQTT_THREAD_POOL, "0, 0-0")) {
+		printf ("ERROR: expected to configure cpu sets\n");
+		return axl_false;
+	} /* end if */
 
+	/* a copy is returned */
+	cpus = myqtt_thread_get_cpus (ctx, MYQTT_THREAD_POOL);
+	if (! axl_cmp (cpus, "0, 0-0")) {
+		printf ("ERROR: expected to find cpu set configured\n");
+		return axl_false;
+	} /* end if */
+	axl_free (cpus);
+#endif
 
-	/* set  6 */
+	if (! myqtt_init_ctx (ctx)) {
+		printf ("ERROR: unable to initialize context..\n");
+		return axl_false;
+	} /* end if */
 
-	match_topic ("a/topic/", "a/topic/+", axl_true);
+#if defined(__linux__)
+	/* check pool threads were pinned (only if cpu 0 is allowed) */
+	queue = myqtt_async_queue_new ();
+	CPU_ZERO (&pinned);
+	CPU_SET (0, &pinned);
+	if (CPU_ISSET (0, &startup) && ! test_00_i_check (ctx, queue, &pinned, "cpu set configured (0)"))
+		return axl_false;
+#endif
 
-	match_topic ("a/topic/", "a/topic/#", axl_true);
+	/* changed and cleared while running */
+	myqtt_thread_set_cpus (ctx, MYQTT_THREAD_POOL, "0-1");
+	myqtt_sleep (200000);
+	myqtt_thread_set_cpus (ctx, MYQTT_THREAD_POOL, NULL);
+	cpus = myqtt_thread_get_cpus (ctx, MYQTT_THREAD_POOL);
+	if (cpus) {
+		printf ("ERROR: expected cpu set to be removed\n");
+		return axl_false;
+	} /* end if */
 
+#if defined(__linux__)
+	/* pool threads go back to the affinity found at startup */
+	if (! test_00_i_check (ctx, queue, &startup, "startup affinity"))
+		return axl_false;
+	myqtt_async_queue_unref (queue);
+#endif
 
-	
-	/* set 7 */
+	myqtt_exit_ctx (ctx, axl_true);
+	return axl_true;
+}
 
-	match_topic ("sport/tennis/player1", "sport/tennis/player1/#", axl_true);
+axlPointer test_00_j_task (axlPointer count)
+{
+	/* ~2ms task */
+	myqtt_sleep (2000);
+	myqtt_atomic_add ((int *) count, 1);
+	return NULL;
+}
 
-	match_topic ("sport/tennis/player1/ranking", "sport/tennis/player1/#", axl_true);
+axl_bool test_00_j (void)
+{
+	MyQttCtx * ctx;
+	long long  queue_wait[MYQTT_THREAD_POOL_HISTOGRAM_BUCKETS];
+	long long  run_time[MYQTT_THREAD_POOL_HISTOGRAM_BUCKETS];
+	int        ratios[16];
+	int        count = 0;
+	long long  checks, added, removed, limit_reached;
+	int        workers;
+	int        iterator;
+	long       p50;
+	long       p99;
+
+	char     * previous = getenv ("MYQTT_THREADS") ? axl_strdup (getenv ("MYQTT_THREADS")) : NULL;
+
+	myqtt_thread_pool_set_num (2);
+	ctx = init_ctx ();
 
-	match_topic ("sport/tennis/player1/score/wimbledon", "sport/tennis/player1/#", axl_true);
+	/* restore thread number */
+	if (previous)
+		myqtt_support_setenv ("MYQTT_THREADS", previous);
+	else
+		myqtt_support_unsetenv ("MYQTT_THREADS");
+	axl_free (previous);
 
+	if (! ctx)
+		return axl_false;
 
-	/* set 8 */
+	/* do not grow over 2 threads */
+	myqtt_thread_pool_setup (ctx, 2, 1, 0, axl_false);
 
-	match_topic ("sport", "sport/#", axl_true);
+	/* 100 tasks of ~2ms on 2 threads */
+	iterator = 0;
+	while (iterator < 100) {
+		myqtt_thread_pool_new_task (ctx, test_00_j_task, &count);
+		iterator++;
+	} /* end while */
 
+	iterator = 0;
+	while (myqtt_atomic_get (&count) < 100 && iterator < 1000) {
+		myqtt_sleep (10000);
+		iterator++;
+	} /* end while */
 
-	/* set 9 */
+	/* give some time to the last task to be accounted */
+	myqtt_sleep (10000);
 
-	match_topic ("sport/tennis/player1", "sport/tennis/+", axl_true);
+	if (myqtt_thread_pool_latency_stats (ctx, queue_wait, run_time) < 100) {
+		printf ("ERROR: expected at least 100 tasks in run time histogram\n");
+		return axl_false;
+	} /* end if */
 
-	match_topic ("sport/tennis/player2", "sport/tennis/+", axl_true);
+	p50 = myqtt_thread_pool_histogram_percentile (run_time, 50);
+	p99 = myqtt_thread_pool_histogram_percentile (queue_wait, 99);
+	printf ("Test 00-j: run time p50 <= %ldus, queue wait p99 <= %ldus\n", p50, p99);
+	if (p50 < 2048) {
+		printf ("ERROR: expected run time p50 to be at least 2048us (~2ms tasks), found %ld\n", p50);
+		return axl_false;
+	} /* end if */
+	if (p99 < 32768) {
+		printf ("ERROR: expected queue wait p99 to show tasks waited (100 tasks of 2ms on 2 threads), found %ld\n", p99);
+		return axl_false;
+	} /* end if */
 
-	match_topic ("sport/tennis/player1/ranking", "sport/tennis/+", axl_false);
+	/* both threads were busy most of the time */
+	workers = myqtt_thread_pool_busy_stats (ctx, ratios, 16);
+	if (workers != 2) {
+		printf ("ERROR: expected 2 busy ratios but found %d\n", workers);
+		return axl_false;
+	} /* end if */
+	printf ("Test 00-j: busy ratios %d%% %d%%\n", ratios[0], ratios[1]);
+	if (ratios[0] <= 0 || ratios[1] <= 0) {
+		printf ("ERROR: expected both threads to report busy time\n");
+		return axl_false;
+	} /* end if */
 
-	
-	/* set 10 */
+	myqtt_thread_pool_resize_stats (ctx, &checks, &added, &removed, &limit_reached);
+	printf ("Test 00-j: resize checks=%lld added=%lld removed=%lld limit-reached=%lld\n", checks, added, removed, limit_reached);
+	if (checks <= 0 || added != 0 || removed != 0 || limit_reached <= 0) {
+		printf ("ERROR: expected resize checks and limit reached decisions only\n");
+		return axl_false;
+	} /* end if */
 
-	match_topic ("sport", "sport/+", axl_false);
+	myqtt_exit_ctx (ctx, axl_true);
+	return axl_true;
+}
 
-	match_topic ("sport/", "sport/+", axl_true);
+const char * test_00_k_arg (int * evaluated)
+{
+	(*evaluated)++;
+	return "value";
+}
 
+void test_00_k_handler (MyQttCtx         * ctx,
+			const char       * file,
+			int                line,
+			MyQttDebugLevel    log_level,
+			const char       * message,
+			va_list            args,
+			axlPointer         user_data)
+{
+	int * reported = user_data;
+	(*reported)++;
+	return;
+}
 
-	/* set 11 */
+axl_bool test_00_k (void)
+{
+	MyQttCtx * ctx;
+	int        evaluated = 0;
+	int        reported  = 0;
 
+	ctx = myqtt_ctx_new ();
+	if (! ctx)
+		return axl_false;
 
-	match_topic ("/finance", "+/+", axl_true);
+	/* no console log and no handler: the first log updates
+	 * levels, the rest are skipped without evaluating arguments */
+	myqtt_log_enable (ctx, axl_false);
+	_myqtt_log (ctx, __AXL_FILE__, __AXL_LINE__, MYQTT_LEVEL_CRITICAL, "levels refresh");
+	if (myqtt_log_level_enabled (ctx, MYQTT_LEVEL_DEBUG) || myqtt_log_level_enabled (ctx, MYQTT_LEVEL_CRITICAL)) {
+		printf ("ERROR: expected no level to be enabled with log disabled and no handler\n");
+		return axl_false;
+	} /* end if */
+	myqtt_log (MYQTT_LEVEL_DEBUG, "disabled log %s", test_00_k_arg (&evaluated));
+	if (evaluated != 0) {
+		printf ("ERROR: expected disabled log arguments not to be evaluated, but found %d\n", evaluated);
+		return axl_false;
+	} /* end if */
 
-	match_topic ("/finance", "/+", axl_true);
+	/* handler configured, filtering debug */
+	myqtt_log_set_handler (ctx, test_00_k_handler, &reported);
+	myqtt_log_filter_level (ctx, "debug");
+	_myqtt_log (ctx, __AXL_FILE__, __AXL_LINE__, MYQTT_LEVEL_WARNING, "levels refresh");
+	if (reported != 1) {
+		printf ("ERROR: expected warning to reach the handler (reported=%d)\n", reported);
+		return axl_false;
+	} /* end if */
+	if (myqtt_log_level_enabled (ctx, MYQTT_LEVEL_DEBUG) || ! myqtt_log_level_enabled (ctx, MYQTT_LEVEL_WARNING)) {
+		printf ("ERROR: expected debug filtered and warning enabled\n");
+		return axl_false;
+	} /* end if */
+	myqtt_log (MYQTT_LEVEL_DEBUG, "filtered log %s", test_00_k_arg (&evaluated));
+	if (evaluated != 0 || reported != 1) {
+		printf ("ERROR: expected filtered log to be skipped (evaluated=%d, reported=%d)\n", evaluated, reported);
+		return axl_false;
+	} /* end if */
 
-	match_topic ("/finance", "+", axl_false);
+	myqtt_ctx_unref (&ctx);
+	return axl_true;
+}
 
+/** 
+ * @internal Waits (up to 1s) for fan-out of publications routed by
+ * ctx to reach the provided count.
+ */
+axl_bool test_00_l_wait (MyQttCtx * ctx, MyQttMetrics * metrics, int publications, int closed)
+{
+	int       tries = 100;
+	long long total;
+	int       iterator;
+
+	while (tries > 0) {
+		myqtt_metrics_get (ctx, metrics);
+		total    = 0;
+		iterator = 0;
+		while (iterator < MYQTT_METRICS_HISTOGRAM_BUCKETS) {
+			total += metrics->fanout[iterator];
+			iterator++;
+		} /* end while */
+		if (total == publications && metrics->counters[MYQTT_METRIC_CONNS_CLOSED] == closed && 
+		    metrics->counters[MYQTT_METRIC_MSGS_SENT_QOS0] + metrics->counters[MYQTT_METRIC_MSGS_SENT_QOS1] >= publications)
+			return axl_true;
+		myqtt_sleep (10000);
+		tries--;
+	} /* end while */
 
-	/* set 12 */
+	return axl_false;
+}
 
-	match_topic ("$SYS", "#", axl_false);
+axl_bool test_00_l (void)
+{
+	MyQttCtx        * ctx;
+	MyQttCtx        * client_ctx;
+	MyQttConn       * listener;
+	MyQttConn       * conn;
+	MyQttAsyncQueue * queue;
+	MyQttMsg        * msg;
+	MyQttMetrics      metrics;
+	const char      * local_host = "127.0.0.1";
+	const char      * local_port = "27897";
+	int               sub_result;
+	int               published;
+	int               iterator;
+	long              sent;
+	long              bytes;
 
-	match_topic ("$SYS", "+", axl_false);
+	ctx        = init_ctx ();
+	client_ctx = init_ctx ();
+	if (! ctx || ! client_ctx)
+		return axl_false;
 
-	match_topic ("$SYS/monitor/Clients", "+/monitor/Clients", axl_false);
+	/* broker with memory storage */
+	if (! myqtt_storage_use (ctx, MYQTT_STORAGE_TYPE_MEMORY)) {
+		printf ("ERROR: failed to configure memory storage..\n");
+		return axl_false;
+	} /* end if */
+	listener = myqtt_listener_new (ctx, local_host, local_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (listener, axl_false)) {
+		printf ("ERROR: failed to start listener at myqtt_listener_new () %s:%s..\n", local_host, local_port);
+		return axl_false;
+	} /* end if */
 
-	match_topic ("$SYS/", "$SYS/#", axl_true);
+	if (myqtt_metrics_set_sys_interval (ctx, -1) || ! myqtt_metrics_set_sys_interval (ctx, 1) || ! myqtt_metrics_set_sys_interval (ctx, 0)) {
+		printf ("ERROR: unexpected myqtt_metrics_set_sys_interval () result..\n");
+		return axl_false;
+	} /* end if */
 
-	match_topic ("$SYS/monitor/Clients", "$SYS/monitor/+", axl_true);
+	conn = myqtt_conn_new (client_ctx, "test_00_l", axl_true, 0, local_host, local_port, NULL, NULL, NULL);
+	if (! myqtt_conn_is_ok (conn, axl_false)) {
+		printf ("ERROR: unable to connect to %s:%s..\n", local_host, local_port);
+		return axl_false;
+	} /* end if */
+	queue = myqtt_async_queue_new ();
+	myqtt_conn_set_on_msg (conn, test_03_on_message, queue);
 
+	if (! myqtt_conn_sub (conn, 10, "myqtt/metrics", 1, &sub_result) || ! myqtt_conn_sub (conn, 10, "$SYS/broker/clients/#", 0, &sub_result)) {
+		printf ("ERROR: unable to subscribe, myqtt_conn_sub () failed, sub_result=%d\n", sub_result);
+		return axl_false;
+	} /* end if */
 
-	/* set 13 */
+	/* publish QoS 0 and QoS 1 to ourselves */
+	if (! myqtt_conn_pub (conn, "myqtt/metrics", "hello", 5, MYQTT_QOS_0, axl_false, 0) ||
+	    ! myqtt_conn_pub (conn, "myqtt/metrics", "hello", 5, MYQTT_QOS_1, axl_false, 10)) {
+		printf ("ERROR: failed to publish..\n");
+		return axl_false;
+	} /* end if */
+	iterator = 0;
+	while (iterator < 2) {
+		msg = myqtt_async_queue_timedpop (queue, 5000000);
+		if (msg == NULL) {
+			printf ("ERROR: expected to receive message published (%d)..\n", iterator);
+			return axl_false;
+		} /* end if */
+		myqtt_msg_unref (msg);
+		iterator++;
+	} /* end while */
 
-	match_topic ("ACCOUNTS", "Accounts", axl_false);
+	/* broker side metrics */
+	if (! test_00_l_wait (ctx, &metrics, 2, 0)) {
+		printf ("ERROR: expected 2 publications routed (fanout[1]=%lld, sent qos0=%ld, qos1=%ld)..\n",
+			metrics.fanout[1], metrics.counters[MYQTT_METRIC_MSGS_SENT_QOS0], metrics.counters[MYQTT_METRIC_MSGS_SENT_QOS1]);
+		return axl_false;
+	} /* end if */
+	printf ("Test 00-l: accepted=%ld connections=%d received=%ld/%ld/%ld sent=%ld/%ld bytes in=%ld out=%ld subs=%d latency p99=%ldus\n",
+		metrics.counters[MYQTT_METRIC_CONNS_ACCEPTED], metrics.connections,
+		metrics.counters[MYQTT_METRIC_MSGS_RECEIVED_QOS0], metrics.counters[MYQTT_METRIC_MSGS_RECEIVED_QOS1], metrics.counters[MYQTT_METRIC_MSGS_RECEIVED_QOS2],
+		metrics.counters[MYQTT_METRIC_MSGS_SENT_QOS0], metrics.counters[MYQTT_METRIC_MSGS_SENT_QOS1],
+		metrics.counters[MYQTT_METRIC_BYTES_RECEIVED], metrics.counters[MYQTT_METRIC_BYTES_SENT], metrics.subscriptions,
+		myqtt_thread_pool_histogram_percentile (metrics.latency, 99));
+	if (metrics.counters[MYQTT_METRIC_CONNS_ACCEPTED] != 1 || metrics.connections != 1) {
+		printf ("ERROR: expected 1 connection accepted and connected..\n");
+		return axl_false;
+	} /* end if */
+	if (metrics.counters[MYQTT_METRIC_MSGS_RECEIVED_QOS0] != 1 || metrics.counters[MYQTT_METRIC_MSGS_RECEIVED_QOS1] != 1 ||
+	    metrics.counters[MYQTT_METRIC_MSGS_RECEIVED_QOS2] != 0) {
+		printf ("ERROR: expected 1 message received with QoS 0 and 1 with QoS 1..\n");
+		return axl_false;
+	} /* end if */
+	if (metrics.fanout[1] != 2 || metrics.subscriptions != 2 || metrics.offline_subscriptions != 0) {
+		printf ("ERROR: expected 2 publications with fan-out 1 and 2 subscriptions (fanout[1]=%lld, subs=%d, offline=%d)..\n",
+			metrics.fanout[1], metrics.subscriptions, metrics.offline_subscriptions);
+		return axl_false;
+	} /* end if */
+	if (metrics.counters[MYQTT_METRIC_BYTES_RECEIVED] <= 0 || metrics.counters[MYQTT_METRIC_BYTES_SENT] <= 0 ||
+	    metrics.counters[MYQTT_METRIC_MSGS_DROPPED] != 0) {
+		printf ("ERROR: expected bytes to be accounted and no message dropped..\n");
+		return axl_false;
+	} /* end if */
 
-	match_topic ("finance", "/finance", axl_false);
+	/* $SYS topics: first publication reports everything */
+	sent      = metrics.counters[MYQTT_METRIC_MSGS_SENT_QOS0] + metrics.counters[MYQTT_METRIC_MSGS_SENT_QOS1];
+	bytes     = metrics.counters[MYQTT_METRIC_BYTES_SENT];
+	published = myqtt_metrics_publish_sys (ctx);
+	if (published < 24) {
+		printf ("ERROR: expected all $SYS topics to be published but found %d..\n", published);
+		return axl_false;
+	} /* end if */
+	iterator = 0;
+	while (iterator < 3) {
+		msg = myqtt_async_queue_timedpop (queue, 5000000);
+		if (msg == NULL) {
+			printf ("ERROR: expected to receive $SYS/broker/clients/ topics (%d)..\n", iterator);
+			return axl_false;
+		} /* end if */
+		if (axl_cmp (myqtt_msg_get_topic (msg), "$SYS/broker/clients/connected") && ! axl_cmp ((const char *) myqtt_msg_get_app_msg (msg), "1")) {
+			printf ("ERROR: expected 1 client connected but found %s..\n", (const char *) myqtt_msg_get_app_msg (msg));
+			return axl_false;
+		} /* end if */
+		myqtt_msg_unref (msg);
+		iterator++;
+	} /* end while */
 
+	/* $SYS traffic must not be accounted */
+	iterator = 0;
+	while (iterator < 100) {
+		myqtt_metrics_get (ctx, &metrics);
+		if (metrics.counters[MYQTT_METRIC_MSGS_SENT_QOS0] + metrics.counters[MYQTT_METRIC_MSGS_SENT_QOS1] == sent &&
+		    metrics.counters[MYQTT_METRIC_BYTES_SENT] == bytes)
+			break;
+		myqtt_sleep (10000);
+		iterator++;
+	} /* end while */
+	if (iterator == 100) {
+		printf ("ERROR: expected $SYS publications not to be accounted (sent=%ld/%ld, bytes=%ld/%ld)..\n",
+			metrics.counters[MYQTT_METRIC_MSGS_SENT_QOS0] + metrics.counters[MYQTT_METRIC_MSGS_SENT_QOS1], sent,
+			metrics.counters[MYQTT_METRIC_BYTES_SENT], bytes);
+		return axl_false;
+	} /* end if */
 
-	/* not valid subscriptions */
-	
-	wrong_sub ("sport/tennis#", axl_true);
+	/* second publication: only values changed */
+	published = myqtt_metrics_publish_sys (ctx);
+	if (published >= 24 || myqtt_async_queue_timedpop (queue, 100000) != NULL) {
+		printf ("ERROR: expected only changed $SYS topics to be published (published=%d)..\n", published);
+		return axl_false;
+	} /* end if */
 
-	wrong_sub ("sport/tennis/#/ranking", axl_true);
+	/* close and check it is accounted */
+	myqtt_conn_close (conn);
+	if (! test_00_l_wait (ctx, &metrics, 2, 1) || metrics.connections != 0) {
+		printf ("ERROR: expected connection closed to be accounted (closed=%ld, connections=%d)..\n",
+			metrics.counters[MYQTT_METRIC_CONNS_CLOSED], metrics.connections);
+		return axl_false;
+	} /* end if */
 
-	wrong_sub ("sport+", axl_true);
+	myqtt_async_queue_unref (queue);
+	myqtt_exit_ctx (client_ctx, axl_true);
+	myqtt_exit_ctx (ctx, axl_true);
 
 	return axl_true;
 }
@@ -5293,9 +7719,51 @@ int main (int argc, char ** argv)
 	CHECK_TEST("test_00_d")
 	run_test (test_00_d, "Test 00-d: wildcard pattern matching"); 
 
+	CHECK_TEST("test_00_e")
+	run_test (test_00_e, "Test 00-e: packet encoders (and builder microbenchmark)");
+
+	CHECK_TEST("test_00_f")
+	run_test (test_00_f, "Test 00-f: string intern table");
+
+	CHECK_TEST("test_00_g")
+	run_test (test_00_g, "Test 00-g: thread pool modes (shared queue vs work-stealing benchmark)");
+
+	CHECK_TEST("test_00_h")
+	run_test (test_00_h, "Test 00-h: thread pool events fire by deadline");
+
+	CHECK_TEST("test_00_i")
+	run_test (test_00_i, "Test 00-i: thread cpu sets");
+
+	CHECK_TEST("test_00_j")
+	run_test (test_00_j, "Test 00-j: thread pool latency, busy and resize stats");
+
+	CHECK_TEST("test_00_k")
+	run_test (test_00_k, "Test 00-k: log levels checked before evaluating log arguments");
+
+	CHECK_TEST("test_00_l")
+	run_test (test_00_l, "Test 00-l: metrics registry and $SYS topics");
+
 	CHECK_TEST("test_01")
 	run_test (test_01, "Test 01: basic listener startup and client connection");
 
+	CHECK_TEST("test_01a")
+	run_test (test_01a, "Test 01a: concurrent connection and context reference counting");
+
+	CHECK_TEST("test_01b")
+	run_test (test_01b, "Test 01b: resident memory used by idle connections");
+
+	CHECK_TEST("test_01c")
+	run_test (test_01c, "Test 01c: reconnect storm recovery (batched accept, SO_REUSEPORT)");
+
+	CHECK_TEST("test_01d")
+	run_test (test_01d, "Test 01d: listener socket options");
+
+	CHECK_TEST("test_01e")
+	run_test (test_01e, "Test 01e: ingress backpressure watermarks");
+
+	CHECK_TEST("test_01f")
+	run_test (test_01f, "Test 01f: slow subscriber pauses and resumes a real publisher");
+
 	CHECK_TEST("test_02")
 	run_test (test_02, "Test 02: basic subscribe function (QOS 0)");
 
@@ -5365,6 +7833,30 @@ int main (int argc, char ** argv)
 	CHECK_TEST("test_14a")
 	run_test (test_14a, "Test 14a: checking server side subscription loading on startup");  
 
+	CHECK_TEST("test_14d")
+	run_test (test_14d, "Test 14d: checking in-memory storage driver");  
+
+	CHECK_TEST("test_14e")
+	run_test (test_14e, "Test 14e: checking subscription index used to load storage");
+
+	CHECK_TEST("test_14f")
+	run_test (test_14f, "Test 14f: checking message and session expiration");
+
+	CHECK_TEST("test_14g")
+	run_test (test_14g, "Test 14g: checking storage writer queue and backpressure");  
+
+	CHECK_TEST("test_14h")
+	run_test (test_14h, "Test 14h: checking storage usage counters");  
+
+	CHECK_TEST("test_14i")
+	run_test (test_14i, "Test 14i: checking storage payload compression");  
+
+	CHECK_TEST("test_14j")
+	run_test (test_14j, "Test 14j: checking storage sharding");  
+
+	CHECK_TEST("test_14k")
+	run_test (test_14k, "Test 14k: checking retained write-behind");  
+
 	CHECK_TEST("test_14b")
 	run_test (test_14b, "Test 14: offline PUB test messages queued to be sent on next connection (client), wildcard +");  
 
@@ -193,8 +193,9 @@ MyQttPublishCodes on_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg,
 	/* get current client identifier */
 	if (axl_cmp ("get-subscriptions", myqtt_msg_get_topic (msg)) || axl_cmp ("get-subscriptions-ctx", myqtt_msg_get_topic (msg))) {
 
+		/* connection subscription hashes are created on demand */
 		if (axl_cmp ("get-subscriptions", myqtt_msg_get_topic (msg)))
-			cursor = axl_hash_cursor_new (conn->subs);
+			cursor = conn->subs ? axl_hash_cursor_new (conn->subs) : NULL;
 		else if (axl_cmp ("get-subscriptions-ctx", myqtt_msg_get_topic (msg)))
 			cursor = axl_hash_cursor_new (ctx->subs);
 
@@ -202,7 +203,7 @@ MyQttPublishCodes on_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg,
 		iterator = 0;
 		while (iterator < 2) {
 			
-			while (axl_hash_cursor_has_item (cursor)) {
+			while (cursor && axl_hash_cursor_has_item (cursor)) {
 				if (axl_cmp ("get-subscriptions", myqtt_msg_get_topic (msg)))
 					aux = axl_strdup_printf ("%s.%d", axl_hash_cursor_get_key (cursor), axl_hash_cursor_get_value (cursor));
 				else if (axl_cmp ("get-subscriptions-ctx", myqtt_msg_get_topic (msg)))
@@ -221,14 +222,16 @@ MyQttPublishCodes on_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg,
 				/* next cursor */
 				axl_hash_cursor_next (cursor);
 			}
-			axl_hash_cursor_free (cursor);
+			if (cursor)
+				axl_hash_cursor_free (cursor);
+			cursor = NULL;
 
 			iterator++;
 
 			/* now get wild card subscriptions */
 			if (iterator == 1) {
 				if (axl_cmp ("get-subscriptions", myqtt_msg_get_topic (msg)))
-					cursor = axl_hash_cursor_new (conn->wild_subs);
+					cursor = conn->wild_subs ? axl_hash_cursor_new (conn->wild_subs) : NULL;
 				else if (axl_cmp ("get-subscriptions-ctx", myqtt_msg_get_topic (msg)))
 					cursor = axl_hash_cursor_new (ctx->wild_subs);
 			} /* end if */
@@ -299,8 +302,8 @@ MyQttPublishCodes on_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg,
 		/* implement a wait so the caller can catch with myqtt_conn_get_next () */
 		__listener_sleep (1000000); /* 1 second */
 		
-		cursor = axl_hash_cursor_new (conn->subs);
-		while (axl_hash_cursor_has_item (cursor)) {
+		cursor = conn->subs ? axl_hash_cursor_new (conn->subs) : NULL;
+		while (cursor && axl_hash_cursor_has_item (cursor)) {
 			/* build message */
 			if (reply_msg == NULL)
 				reply_msg = axl_strdup_printf ("%d: %s\n", axl_hash_cursor_get_value (cursor), axl_hash_cursor_get_key (cursor));
@@ -314,7 +317,8 @@ MyQttPublishCodes on_publish (MyQttCtx * ctx, MyQttConn * conn, MyQttMsg * msg,
 			axl_hash_cursor_next (cursor);
 		} /* end while */
 
-		axl_hash_cursor_free (cursor);
+		if (cursor)
+			axl_hash_cursor_free (cursor);
 
 		printf ("replying: %s\n", reply_msg);
 